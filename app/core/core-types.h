@@ -201,6 +201,8 @@ typedef struct _GimpArea            GimpArea;
 typedef struct _GimpBoundSeg        GimpBoundSeg;
 typedef struct _GimpCoords          GimpCoords;
 typedef struct _GimpGradientSegment GimpGradientSegment;
+typedef struct _GimpHistogramCache  GimpHistogramCache;
+typedef struct _GimpMaskSummary     GimpMaskSummary;
 typedef struct _GimpPaletteEntry    GimpPaletteEntry;
 typedef struct _GimpSamplePoint     GimpSamplePoint;
 typedef struct _GimpScanConvert     GimpScanConvert;
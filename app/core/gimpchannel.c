@@ -31,7 +31,6 @@
 #include "paint/gimppaintoptions.h"
 
 #include "gegl/gimp-gegl-apply-operation.h"
-#include "gegl/gimp-gegl-mask.h"
 #include "gegl/gimp-gegl-utils.h"
 
 #include "gimp.h"
@@ -48,6 +47,7 @@
 #include "gimpcontext.h"
 #include "gimpdrawable-stroke.h"
 #include "gimpmarshal.h"
+#include "gimpmasksummary.h"
 #include "gimppaintinfo.h"
 #include "gimppickable.h"
 #include "gimpstrokeoptions.h"
@@ -192,6 +192,9 @@ static gboolean   gimp_channel_real_bounds   (GimpChannel         *channel,
                                               gint                *x2,
                                               gint                *y2);
 static gboolean   gimp_channel_real_is_empty (GimpChannel         *channel);
+static GimpMaskSummary *
+                  gimp_channel_get_summary   (GimpChannel         *channel);
+
 static void       gimp_channel_real_feather  (GimpChannel         *channel,
                                               gdouble              radius_x,
                                               gdouble              radius_y,
@@ -339,6 +342,7 @@ gimp_channel_init (GimpChannel *channel)
   channel->y1             = 0;
   channel->x2             = 0;
   channel->y2             = 0;
+  channel->summary        = NULL;
 }
 
 static void
@@ -364,6 +368,12 @@ gimp_channel_finalize (GObject *object)
       channel->segs_out = NULL;
     }
 
+  if (channel->summary)
+    {
+      gimp_mask_summary_free (channel->summary);
+      channel->summary = NULL;
+    }
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -372,11 +382,15 @@ gimp_channel_get_memsize (GimpObject *object,
                           gint64     *gui_size)
 {
   GimpChannel *channel = GIMP_CHANNEL (object);
+  gint64       memsize = 0;
 
   *gui_size += channel->num_segs_in  * sizeof (GimpBoundSeg);
   *gui_size += channel->num_segs_out * sizeof (GimpBoundSeg);
 
-  return GIMP_OBJECT_CLASS (parent_class)->get_memsize (object, gui_size);
+  if (channel->summary)
+    memsize += gimp_mask_summary_get_memsize (channel->summary);
+
+  return memsize + GIMP_OBJECT_CLASS (parent_class)->get_memsize (object, gui_size);
 }
 
 static gchar *
@@ -975,6 +989,13 @@ gimp_channel_set_buffer (GimpDrawable *drawable,
                                                   offset_x, offset_y);
 
   GIMP_CHANNEL (drawable)->bounds_known = FALSE;
+
+  /*  the summary is recreated for the new buffer when needed  */
+  if (GIMP_CHANNEL (drawable)->summary)
+    {
+      gimp_mask_summary_free (GIMP_CHANNEL (drawable)->summary);
+      GIMP_CHANNEL (drawable)->summary = NULL;
+    }
 }
 
 static void
@@ -1095,7 +1116,7 @@ gimp_channel_real_bounds (GimpChannel *channel,
                           gint        *x2,
                           gint        *y2)
 {
-  GeglBuffer *buffer;
+  GimpMaskSummary *summary;
 
   /*  if the channel's bounds have already been reliably calculated...  */
   if (channel->bounds_known)
@@ -1108,9 +1129,9 @@ gimp_channel_real_bounds (GimpChannel *channel,
       return ! channel->empty;
     }
 
-  buffer = gimp_drawable_get_buffer (GIMP_DRAWABLE (channel));
+  summary = gimp_channel_get_summary (channel);
 
-  channel->empty = ! gimp_gegl_mask_bounds (buffer, x1, y1, x2, y2);
+  channel->empty = ! gimp_mask_summary_bounds (summary, x1, y1, x2, y2);
 
   channel->x1 = *x1;
   channel->y1 = *y1;
@@ -1125,14 +1146,10 @@ gimp_channel_real_bounds (GimpChannel *channel,
 static gboolean
 gimp_channel_real_is_empty (GimpChannel *channel)
 {
-  GeglBuffer *buffer;
-
   if (channel->bounds_known)
     return channel->empty;
 
-  buffer = gimp_drawable_get_buffer (GIMP_DRAWABLE (channel));
-
-  if (! gimp_gegl_mask_is_empty (buffer))
+  if (! gimp_mask_summary_is_empty (gimp_channel_get_summary (channel)))
     return FALSE;
 
   /*  The mask is empty, meaning we can set the bounds as known  */
@@ -1156,6 +1173,24 @@ gimp_channel_real_is_empty (GimpChannel *channel)
   return TRUE;
 }
 
+static GimpMaskSummary *
+gimp_channel_get_summary (GimpChannel *channel)
+{
+  GeglBuffer *buffer = gimp_drawable_get_buffer (GIMP_DRAWABLE (channel));
+
+  if (channel->summary &&
+      gimp_mask_summary_get_buffer (channel->summary) != buffer)
+    {
+      gimp_mask_summary_free (channel->summary);
+      channel->summary = NULL;
+    }
+
+  if (! channel->summary)
+    channel->summary = gimp_mask_summary_new (buffer);
+
+  return channel->summary;
+}
+
 static void
 gimp_channel_real_feather (GimpChannel *channel,
                            gdouble      radius_x,
@@ -1297,6 +1332,10 @@ gimp_channel_real_invert (GimpChannel *channel,
     {
       gimp_channel_all (channel, FALSE);
     }
+  else if (gimp_channel_is_full (channel))
+    {
+      gimp_channel_clear (channel, NULL, FALSE);
+    }
   else
     {
       gimp_gegl_apply_invert_linear (gimp_drawable_get_buffer (drawable),
@@ -1902,6 +1941,26 @@ gimp_channel_is_empty (GimpChannel *channel)
   return GIMP_CHANNEL_GET_CLASS (channel)->is_empty (channel);
 }
 
+/*  Returns TRUE if every pixel of the channel is fully selected, like
+ *  after "Select All".  Only the tiles changed since the last query
+ *  are looked at.
+ */
+gboolean
+gimp_channel_is_full (GimpChannel *channel)
+{
+  g_return_val_if_fail (GIMP_IS_CHANNEL (channel), FALSE);
+
+  if (channel->bounds_known &&
+      (channel->empty ||
+       channel->x1 > 0 ||
+       channel->y1 > 0 ||
+       channel->x2 < gimp_item_get_width  (GIMP_ITEM (channel)) ||
+       channel->y2 < gimp_item_get_height (GIMP_ITEM (channel))))
+    return FALSE;
+
+  return gimp_mask_summary_is_full (gimp_channel_get_summary (channel));
+}
+
 void
 gimp_channel_feather (GimpChannel *channel,
                       gdouble      radius_x,
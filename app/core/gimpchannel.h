@@ -53,6 +53,8 @@ struct _GimpChannel
   gboolean      bounds_known;      /*  recalculate the bounds?        */
   gint          x1, y1;            /*  coordinates for bounding box   */
   gint          x2, y2;            /*  lower right hand coordinate    */
+
+  GimpMaskSummary *summary;        /*  per-tile bounds and emptiness  */
 };
 
 struct _GimpChannelClass
@@ -183,6 +185,7 @@ gboolean      gimp_channel_bounds             (GimpChannel         *mask,
                                                gint                *x2,
                                                gint                *y2);
 gboolean      gimp_channel_is_empty           (GimpChannel         *mask);
+gboolean      gimp_channel_is_full            (GimpChannel         *mask);
 
 void          gimp_channel_feather            (GimpChannel         *mask,
                                                gdouble              radius_x,
@@ -66,7 +66,9 @@ typedef struct
   gdouble           vec[2];
   GimpRepeatMode    repeat;
   GRand            *seed;
-  GeglBuffer       *dist_buffer;
+  gfloat           *dist_map;
+  gint              dist_width;
+  gint              dist_height;
 } RenderBlendData;
 
 typedef struct
@@ -115,21 +117,27 @@ static gdouble  gradient_calc_spiral_factor       (gdouble   dist,
                                                    gdouble   y,
                                                    gboolean  clockwise);
 
-static gdouble  gradient_calc_shapeburst_angular_factor   (GeglBuffer *dist_buffer,
-                                                           gdouble     x,
-                                                           gdouble     y);
-static gdouble  gradient_calc_shapeburst_spherical_factor (GeglBuffer *dist_buffer,
-                                                           gdouble     x,
-                                                           gdouble     y);
-static gdouble  gradient_calc_shapeburst_dimpled_factor   (GeglBuffer *dist_buffer,
-                                                           gdouble     x,
-                                                           gdouble     y);
-
-static GeglBuffer * gradient_precalc_shapeburst (GimpImage           *image,
-                                                 GimpDrawable        *drawable,
-                                                 const GeglRectangle *region,
-                                                 gdouble              dist,
-                                                 GimpProgress        *progress);
+static gdouble  gradient_calc_shapeburst_angular_factor   (const gfloat *dist_map,
+                                                           gint          width,
+                                                           gint          height,
+                                                           gdouble       x,
+                                                           gdouble       y);
+static gdouble  gradient_calc_shapeburst_spherical_factor (const gfloat *dist_map,
+                                                           gint          width,
+                                                           gint          height,
+                                                           gdouble       x,
+                                                           gdouble       y);
+static gdouble  gradient_calc_shapeburst_dimpled_factor   (const gfloat *dist_map,
+                                                           gint          width,
+                                                           gint          height,
+                                                           gdouble       x,
+                                                           gdouble       y);
+
+static gfloat * gradient_precalc_shapeburst (GimpImage           *image,
+                                             GimpDrawable        *drawable,
+                                             const GeglRectangle *region,
+                                             gdouble              dist,
+                                             GimpProgress        *progress);
 
 static void     gradient_render_pixel       (gdouble              x,
                                              gdouble              y,
@@ -474,17 +482,15 @@ gradient_calc_spiral_factor (gdouble   dist,
 }
 
 static gdouble
-gradient_calc_shapeburst_angular_factor (GeglBuffer *dist_buffer,
-                                         gdouble     x,
-                                         gdouble     y)
+gradient_calc_shapeburst_angular_factor (const gfloat *dist_map,
+                                         gint          width,
+                                         gint          height,
+                                         gdouble       x,
+                                         gdouble       y)
 {
-  gint   ix = CLAMP (x, 0.0, gegl_buffer_get_width  (dist_buffer) - 0.7);
-  gint   iy = CLAMP (y, 0.0, gegl_buffer_get_height (dist_buffer) - 0.7);
-  gfloat value;
-
-  gegl_buffer_get (dist_buffer, GEGL_RECTANGLE (ix, iy, 1, 1), 1.0,
-                   NULL, &value,
-                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gint   ix    = CLAMP (x, 0.0, width  - 0.7);
+  gint   iy    = CLAMP (y, 0.0, height - 0.7);
+  gfloat value = dist_map[iy * width + ix];
 
   value = 1.0 - value;
 
@@ -493,17 +499,15 @@ gradient_calc_shapeburst_angular_factor (GeglBuffer *dist_buffer,
 
 
 static gdouble
-gradient_calc_shapeburst_spherical_factor (GeglBuffer *dist_buffer,
-                                           gdouble     x,
-                                           gdouble     y)
+gradient_calc_shapeburst_spherical_factor (const gfloat *dist_map,
+                                           gint          width,
+                                           gint          height,
+                                           gdouble       x,
+                                           gdouble       y)
 {
-  gint   ix = CLAMP (x, 0.0, gegl_buffer_get_width  (dist_buffer) - 0.7);
-  gint   iy = CLAMP (y, 0.0, gegl_buffer_get_height (dist_buffer) - 0.7);
-  gfloat value;
-
-  gegl_buffer_get (dist_buffer, GEGL_RECTANGLE (ix, iy, 1, 1), 1.0,
-                   NULL, &value,
-                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gint   ix    = CLAMP (x, 0.0, width  - 0.7);
+  gint   iy    = CLAMP (y, 0.0, height - 0.7);
+  gfloat value = dist_map[iy * width + ix];
 
   value = 1.0 - sin (0.5 * G_PI * value);
 
@@ -512,24 +516,22 @@ gradient_calc_shapeburst_spherical_factor (GeglBuffer *dist_buffer,
 
 
 static gdouble
-gradient_calc_shapeburst_dimpled_factor (GeglBuffer *dist_buffer,
-                                         gdouble     x,
-                                         gdouble     y)
+gradient_calc_shapeburst_dimpled_factor (const gfloat *dist_map,
+                                         gint          width,
+                                         gint          height,
+                                         gdouble       x,
+                                         gdouble       y)
 {
-  gint   ix = CLAMP (x, 0.0, gegl_buffer_get_width  (dist_buffer) - 0.7);
-  gint   iy = CLAMP (y, 0.0, gegl_buffer_get_height (dist_buffer) - 0.7);
-  gfloat value;
-
-  gegl_buffer_get (dist_buffer, GEGL_RECTANGLE (ix, iy, 1, 1), 1.0,
-                   NULL, &value,
-                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gint   ix    = CLAMP (x, 0.0, width  - 0.7);
+  gint   iy    = CLAMP (y, 0.0, height - 0.7);
+  gfloat value = dist_map[iy * width + ix];
 
   value = cos (0.5 * G_PI * value);
 
   return value;
 }
 
-static GeglBuffer *
+static gfloat *
 gradient_precalc_shapeburst (GimpImage           *image,
                              GimpDrawable        *drawable,
                              const GeglRectangle *region,
@@ -538,6 +540,7 @@ gradient_precalc_shapeburst (GimpImage           *image,
 {
   GimpChannel *mask;
   GeglBuffer  *dist_buffer;
+  gfloat      *dist_map;
   GeglBuffer  *temp_buffer;
   GeglNode    *shapeburst;
   gdouble      max;
@@ -621,24 +624,25 @@ gradient_precalc_shapeburst (GimpImage           *image,
 
   g_object_unref (temp_buffer);
 
+  /*  read the whole map at once, the blend looks up every pixel  */
+  dist_map = g_new (gfloat, region->width * region->height);
+
+  gegl_buffer_get (dist_buffer, NULL, 1.0, NULL, dist_map,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  g_object_unref (dist_buffer);
+
   /*  normalize the shapeburst with the max iteration  */
   if (max_iteration > 0)
     {
-      GeglBufferIterator *iter;
-
-      iter = gegl_buffer_iterator_new (dist_buffer, NULL, 0, NULL,
-                                       GEGL_BUFFER_READWRITE, GEGL_ABYSS_NONE);
+      gint n = region->width * region->height;
+      gint i;
 
-      while (gegl_buffer_iterator_next (iter))
-        {
-          gfloat *data = iter->data[0];
-
-          while (iter->length--)
-            *data++ /= max_iteration;
-        }
+      for (i = 0; i < n; i++)
+        dist_map[i] /= max_iteration;
     }
 
-  return dist_buffer;
+  return dist_map;
 }
 
 
@@ -691,15 +695,24 @@ gradient_render_pixel (gdouble   x,
       break;
 
     case GIMP_GRADIENT_SHAPEBURST_ANGULAR:
-      factor = gradient_calc_shapeburst_angular_factor (rbd->dist_buffer, x, y);
+      factor = gradient_calc_shapeburst_angular_factor (rbd->dist_map,
+                                                        rbd->dist_width,
+                                                        rbd->dist_height,
+                                                        x, y);
       break;
 
     case GIMP_GRADIENT_SHAPEBURST_SPHERICAL:
-      factor = gradient_calc_shapeburst_spherical_factor (rbd->dist_buffer, x, y);
+      factor = gradient_calc_shapeburst_spherical_factor (rbd->dist_map,
+                                                          rbd->dist_width,
+                                                          rbd->dist_height,
+                                                          x, y);
       break;
 
     case GIMP_GRADIENT_SHAPEBURST_DIMPLED:
-      factor = gradient_calc_shapeburst_dimpled_factor (rbd->dist_buffer, x, y);
+      factor = gradient_calc_shapeburst_dimpled_factor (rbd->dist_map,
+                                                        rbd->dist_width,
+                                                        rbd->dist_height,
+                                                        x, y);
       break;
 
     case GIMP_GRADIENT_SPIRAL_CLOCKWISE:
@@ -934,9 +947,11 @@ gradient_fill_region (GimpImage           *image,
     case GIMP_GRADIENT_SHAPEBURST_SPHERICAL:
     case GIMP_GRADIENT_SHAPEBURST_DIMPLED:
       rbd.dist = sqrt (SQR (ex - sx) + SQR (ey - sy));
-      rbd.dist_buffer = gradient_precalc_shapeburst (image, drawable,
+      rbd.dist_map    = gradient_precalc_shapeburst (image, drawable,
                                                      buffer_region,
                                                      rbd.dist, progress);
+      rbd.dist_width  = buffer_region->width;
+      rbd.dist_height = buffer_region->height;
       gimp_progress_set_text (progress, _("Blending"));
       break;
 
@@ -1053,8 +1068,7 @@ gradient_fill_region (GimpImage           *image,
 
   g_object_unref (rbd.gradient);
 
-  if (rbd.dist_buffer)
-    g_object_unref (rbd.dist_buffer);
+  g_free (rbd.dist_map);
 
   GIMP_TIMER_END("gradient_fill_region");
 }
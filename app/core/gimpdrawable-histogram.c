@@ -27,6 +27,7 @@
 
 #include "gimpchannel.h"
 #include "gimpdrawable-histogram.h"
+#include "gimpdrawable-private.h"
 #include "gimphistogram.h"
 #include "gimpimage.h"
 
@@ -113,10 +114,53 @@ gimp_drawable_calculate_histogram (GimpDrawable  *drawable,
         }
       else
         {
-          gimp_histogram_calculate (histogram,
-                                    gimp_drawable_get_buffer (drawable),
-                                    GEGL_RECTANGLE (x, y, width, height),
-                                    NULL, NULL);
+          /*  without a selection, the histogram always covers the
+           *  whole drawable, so keep per-chunk partials around and
+           *  only rescan what changed since the last time
+           */
+          if (! drawable->private->histogram_cache)
+            drawable->private->histogram_cache = gimp_histogram_cache_new ();
+
+          gimp_histogram_calculate_cached (histogram,
+                                           gimp_drawable_get_buffer (drawable),
+                                           GEGL_RECTANGLE (x, y, width, height),
+                                           drawable->private->histogram_cache);
         }
     }
 }
+
+void
+gimp_drawable_histogram_invalidate (GimpDrawable *drawable,
+                                    gint          x,
+                                    gint          y,
+                                    gint          width,
+                                    gint          height)
+{
+  GimpDrawablePrivate *private;
+
+  g_return_if_fail (GIMP_IS_DRAWABLE (drawable));
+
+  private = drawable->private;
+
+  if (! private->histogram_cache || width <= 0 || height <= 0)
+    return;
+
+  gimp_histogram_cache_invalidate (private->histogram_cache,
+                                   GEGL_RECTANGLE (x, y, width, height));
+}
+
+void
+gimp_drawable_histogram_free (GimpDrawable *drawable)
+{
+  GimpDrawablePrivate *private;
+
+  g_return_if_fail (GIMP_IS_DRAWABLE (drawable));
+
+  private = drawable->private;
+
+  if (private->histogram_cache)
+    {
+      gimp_histogram_cache_free (private->histogram_cache);
+      private->histogram_cache = NULL;
+    }
+}
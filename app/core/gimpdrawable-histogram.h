@@ -21,8 +21,15 @@
 #define __GIMP_DRAWABLE_HISTOGRAM_H__
 
 
-void   gimp_drawable_calculate_histogram (GimpDrawable  *drawable,
-                                          GimpHistogram *histogram);
+void   gimp_drawable_calculate_histogram  (GimpDrawable  *drawable,
+                                           GimpHistogram *histogram);
+
+void   gimp_drawable_histogram_invalidate (GimpDrawable  *drawable,
+                                           gint           x,
+                                           gint           y,
+                                           gint           width,
+                                           gint           height);
+void   gimp_drawable_histogram_free       (GimpDrawable  *drawable);
 
 
 #endif /* __GIMP_HISTOGRAM_H__ */
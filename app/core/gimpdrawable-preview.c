@@ -28,6 +28,7 @@
 #include "config/gimpcoreconfig.h"
 
 #include "gimp.h"
+#include "gimparea.h"
 #include "gimpchannel.h"
 #include "gimpimage.h"
 #include "gimpdrawable-preview.h"
@@ -36,6 +37,21 @@
 #include "gimptempbuf.h"
 
 
+/*  Drawables larger than twice this size keep a downscaled copy of
+ *  themselves around (one power-of-two mipmap level, at most this big),
+ *  which is updated only where the drawable changes.  Previews that are
+ *  smaller than the mipmap are scaled from it instead of from the full
+ *  resolution buffer.
+ */
+#define GIMP_DRAWABLE_PREVIEW_MIPMAP_SIZE 256
+
+
+/*  local function prototypes  */
+
+static GeglBuffer * gimp_drawable_preview_get_mipmap (GimpDrawable *drawable,
+                                                      gdouble      *scale);
+
+
 /*  public functions  */
 
 GimpTempBuf *
@@ -94,8 +110,10 @@ gimp_drawable_get_sub_preview (GimpDrawable *drawable,
   GimpItem    *item;
   GimpImage   *image;
   GeglBuffer  *buffer;
+  GeglBuffer  *mipmap;
   GimpTempBuf *preview;
   gdouble      scale;
+  gdouble      mipmap_scale;
 
   g_return_val_if_fail (GIMP_IS_DRAWABLE (drawable), NULL);
   g_return_val_if_fail (src_x >= 0, NULL);
@@ -123,6 +141,17 @@ gimp_drawable_get_sub_preview (GimpDrawable *drawable,
   scale = MIN ((gdouble) dest_width  / (gdouble) gegl_buffer_get_width  (buffer),
                (gdouble) dest_height / (gdouble) gegl_buffer_get_height (buffer));
 
+  /*  the requested rectangle is in scaled coordinates, which are the
+   *  same no matter what buffer we scale down from
+   */
+  mipmap = gimp_drawable_preview_get_mipmap (drawable, &mipmap_scale);
+
+  if (mipmap && scale <= mipmap_scale)
+    {
+      buffer = mipmap;
+      scale /= mipmap_scale;
+    }
+
   gegl_buffer_get (buffer,
                    GEGL_RECTANGLE (src_x, src_y, dest_width, dest_height),
                    scale,
@@ -132,3 +161,135 @@ gimp_drawable_get_sub_preview (GimpDrawable *drawable,
 
   return preview;
 }
+
+void
+gimp_drawable_preview_invalidate (GimpDrawable *drawable,
+                                  gint          x,
+                                  gint          y,
+                                  gint          width,
+                                  gint          height)
+{
+  GimpDrawablePrivate *private;
+
+  g_return_if_fail (GIMP_IS_DRAWABLE (drawable));
+
+  private = drawable->private;
+
+  if (! private->preview_mipmap || width <= 0 || height <= 0)
+    return;
+
+  private->preview_dirty =
+    gimp_area_list_process (private->preview_dirty,
+                            gimp_area_new (x, y, x + width, y + height));
+}
+
+void
+gimp_drawable_preview_free (GimpDrawable *drawable)
+{
+  GimpDrawablePrivate *private;
+
+  g_return_if_fail (GIMP_IS_DRAWABLE (drawable));
+
+  private = drawable->private;
+
+  if (private->preview_mipmap)
+    {
+      g_object_unref (private->preview_mipmap);
+      private->preview_mipmap = NULL;
+    }
+
+  gimp_area_list_free (private->preview_dirty);
+  private->preview_dirty = NULL;
+}
+
+
+/*  private functions  */
+
+static GeglBuffer *
+gimp_drawable_preview_get_mipmap (GimpDrawable *drawable,
+                                  gdouble      *scale)
+{
+  GimpDrawablePrivate *private = drawable->private;
+  GeglBuffer          *buffer  = gimp_drawable_get_buffer (drawable);
+  const Babl          *format;
+  const GeglRectangle *extent;
+  gint                 width;
+  gint                 height;
+  gint                 mipmap_width;
+  gint                 mipmap_height;
+  gint                 level;
+  GSList              *list;
+
+  width  = gegl_buffer_get_width  (buffer);
+  height = gegl_buffer_get_height (buffer);
+
+  if (MAX (width, height) < 2 * GIMP_DRAWABLE_PREVIEW_MIPMAP_SIZE)
+    return NULL;
+
+  for (level = 0;
+       (MAX (width, height) >> level) > GIMP_DRAWABLE_PREVIEW_MIPMAP_SIZE;
+       level++);
+
+  *scale = 1.0 / (gdouble) (1 << level);
+
+  format = gimp_drawable_get_preview_format (drawable);
+
+  mipmap_width  = ceil (width  * *scale);
+  mipmap_height = ceil (height * *scale);
+
+  /*  group layers change size and format without a new buffer  */
+  if (private->preview_mipmap &&
+      (gegl_buffer_get_format (private->preview_mipmap) != format        ||
+       gegl_buffer_get_width  (private->preview_mipmap) != mipmap_width  ||
+       gegl_buffer_get_height (private->preview_mipmap) != mipmap_height))
+    {
+      gimp_drawable_preview_free (drawable);
+    }
+
+  if (! private->preview_mipmap)
+    {
+      private->preview_mipmap =
+        gegl_buffer_new (GEGL_RECTANGLE (0, 0, mipmap_width, mipmap_height),
+                         format);
+
+      private->preview_dirty =
+        g_slist_prepend (NULL, gimp_area_new (0, 0, width, height));
+    }
+
+  extent = gegl_buffer_get_extent (private->preview_mipmap);
+
+  /*  bring the dirty parts of the mipmap up to date, growing each area
+   *  by a pixel to catch the spill of the box filter
+   */
+  for (list = private->preview_dirty; list; list = g_slist_next (list))
+    {
+      GimpArea      *area = list->data;
+      GeglRectangle  rect;
+      guchar        *data;
+
+      rect.x      = floor (area->x1 * *scale) - 1;
+      rect.y      = floor (area->y1 * *scale) - 1;
+      rect.width  = ceil  (area->x2 * *scale) + 1 - rect.x;
+      rect.height = ceil  (area->y2 * *scale) + 1 - rect.y;
+
+      if (! gegl_rectangle_intersect (&rect, &rect, extent))
+        continue;
+
+      data = g_malloc (rect.width * rect.height *
+                       babl_format_get_bytes_per_pixel (format));
+
+      gegl_buffer_get (buffer, &rect, *scale,
+                       format, data,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+      gegl_buffer_set (private->preview_mipmap, &rect, 0,
+                       format, data,
+                       GEGL_AUTO_ROWSTRIDE);
+
+      g_free (data);
+    }
+
+  gimp_area_list_free (private->preview_dirty);
+  private->preview_dirty = NULL;
+
+  return private->preview_mipmap;
+}
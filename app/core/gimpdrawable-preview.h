@@ -39,5 +39,12 @@ GimpTempBuf * gimp_drawable_get_sub_preview    (GimpDrawable *drawable,
                                                 gint          dest_width,
                                                 gint          dest_height);
 
+void          gimp_drawable_preview_invalidate (GimpDrawable *drawable,
+                                                gint          x,
+                                                gint          y,
+                                                gint          width,
+                                                gint          height);
+void          gimp_drawable_preview_free       (GimpDrawable *drawable);
+
 
 #endif /* __GIMP_DRAWABLE__PREVIEW_H__ */
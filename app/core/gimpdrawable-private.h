@@ -33,6 +33,11 @@ struct _GimpDrawablePrivate
   GimpApplicator *fs_applicator;
 
   GeglNode       *mode_node;
+
+  GeglBuffer     *preview_mipmap; /* downscaled copy for previews */
+  GSList         *preview_dirty;  /* GimpAreas not yet in the mipmap */
+
+  GimpHistogramCache *histogram_cache; /* partials of the unmasked histogram */
 };
 
 #endif /* __GIMP_DRAWABLE_PRIVATE_H__ */
@@ -61,6 +61,31 @@
 #endif
 
 
+/*  the final affine transform is rendered in chunks of this size,
+ *  aligned to the result buffer's tile grid
+ */
+#define TRANSFORM_CHUNK_SIZE 256
+
+
+typedef struct
+{
+  GeglBuffer            *src_buffer;
+  GeglBuffer            *dest_buffer;
+  GimpInterpolationType  interpolation_type;
+  GimpMatrix3            matrix;
+  GAsyncQueue           *done;
+} TransformParams;
+
+
+static gboolean   gimp_drawable_transform_affine_parallel (GeglBuffer            *src_buffer,
+                                                           GeglBuffer            *dest_buffer,
+                                                           GimpInterpolationType  interpolation_type,
+                                                           const GimpMatrix3     *matrix,
+                                                           GimpProgress          *progress);
+static void       gimp_drawable_transform_affine_chunk    (GeglRectangle         *chunk,
+                                                           TransformParams       *params);
+
+
 /*  public functions  */
 
 GeglBuffer *
@@ -124,10 +149,16 @@ gimp_drawable_transform_buffer_affine (GimpDrawable           *drawable,
   gimp_matrix3_mult (&m, &gegl_matrix);
   gimp_matrix3_translate (&gegl_matrix, -x1, -y1);
 
-  gimp_gegl_apply_transform (orig_buffer, progress, NULL,
-                             new_buffer,
-                             interpolation_type,
-                             &gegl_matrix);
+  if (! gimp_drawable_transform_affine_parallel (orig_buffer, new_buffer,
+                                                interpolation_type,
+                                                &gegl_matrix,
+                                                progress))
+    {
+      gimp_gegl_apply_transform (orig_buffer, progress, NULL,
+                                 new_buffer,
+                                 interpolation_type,
+                                 &gegl_matrix);
+    }
 
   *new_offset_x = x1;
   *new_offset_y = y1;
@@ -980,3 +1011,151 @@ gimp_drawable_transform_paste (GimpDrawable *drawable,
 
   return drawable;
 }
+
+
+/*  private functions  */
+
+/*  Renders the transform into @dest_buffer in tile-aligned chunks on a
+ *  thread pool.  Each chunk pulls its source pixels through its own
+ *  gegl:transform node in a single blit, instead of the whole result
+ *  being rendered in one pass.  Returns FALSE if GEGL is configured to
+ *  use a single thread or the result is just one chunk, in which case
+ *  the caller should render it as a whole.
+ */
+static gboolean
+gimp_drawable_transform_affine_parallel (GeglBuffer            *src_buffer,
+                                         GeglBuffer            *dest_buffer,
+                                         GimpInterpolationType  interpolation_type,
+                                         const GimpMatrix3     *matrix,
+                                         GimpProgress          *progress)
+{
+  TransformParams  params;
+  GThreadPool     *pool;
+  GArray          *chunks;
+  gint             width  = gegl_buffer_get_width  (dest_buffer);
+  gint             height = gegl_buffer_get_height (dest_buffer);
+  gint             chunk_width;
+  gint             chunk_height;
+  gint             n_threads;
+  gint             x, y;
+  gint             i;
+  gboolean         progress_active = FALSE;
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  g_object_get (dest_buffer,
+                "tile-width",  &chunk_width,
+                "tile-height", &chunk_height,
+                NULL);
+
+  /*  use whole tiles, but not too few pixels per chunk  */
+  chunk_width  *= MAX (1, TRANSFORM_CHUNK_SIZE / chunk_width);
+  chunk_height *= MAX (1, TRANSFORM_CHUNK_SIZE / chunk_height);
+
+  if (n_threads < 2 || (width <= chunk_width && height <= chunk_height))
+    return FALSE;
+
+  chunks = g_array_new (FALSE, FALSE, sizeof (GeglRectangle));
+
+  for (y = 0; y < height; y += chunk_height)
+    for (x = 0; x < width; x += chunk_width)
+      {
+        GeglRectangle chunk;
+
+        chunk.x      = x;
+        chunk.y      = y;
+        chunk.width  = MIN (chunk_width,  width  - x);
+        chunk.height = MIN (chunk_height, height - y);
+
+        g_array_append_val (chunks, chunk);
+      }
+
+  params.src_buffer         = src_buffer;
+  params.dest_buffer        = dest_buffer;
+  params.interpolation_type = interpolation_type;
+  params.matrix             = *matrix;
+  params.done               = g_async_queue_new ();
+
+  if (progress)
+    {
+      progress_active = gimp_progress_is_active (progress);
+
+      if (! progress_active)
+        gimp_progress_start (progress, NULL, FALSE);
+    }
+
+  pool = g_thread_pool_new ((GFunc) gimp_drawable_transform_affine_chunk,
+                            &params,
+                            MIN (n_threads, chunks->len), FALSE, NULL);
+
+  for (i = 0; i < chunks->len; i++)
+    g_thread_pool_push (pool, &g_array_index (chunks, GeglRectangle, i), NULL);
+
+  /*  the workers report each finished chunk, so progress can be
+   *  updated from this thread while they run
+   */
+  for (i = 0; i < chunks->len; i++)
+    {
+      g_async_queue_pop (params.done);
+
+      if (progress)
+        gimp_progress_set_value (progress,
+                                 (gdouble) (i + 1) / (gdouble) chunks->len);
+    }
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  if (progress && ! progress_active)
+    gimp_progress_end (progress);
+
+  g_async_queue_unref (params.done);
+  g_array_free (chunks, TRUE);
+
+  return TRUE;
+}
+
+static void
+gimp_drawable_transform_affine_chunk (GeglRectangle   *chunk,
+                                      TransformParams *params)
+{
+  GeglNode   *gegl;
+  GeglNode   *src_node;
+  GeglNode   *transform_node;
+  const Babl *format = gegl_buffer_get_format (params->dest_buffer);
+  guchar     *data;
+  gint        rowstride;
+
+  /*  GEGL nodes must not be shared between threads, so every chunk
+   *  gets its own small graph
+   */
+  gegl = gegl_node_new ();
+
+  src_node = gegl_node_new_child (gegl,
+                                  "operation", "gegl:buffer-source",
+                                  "buffer",    params->src_buffer,
+                                  NULL);
+
+  transform_node = gegl_node_new_child (gegl,
+                                        "operation", "gegl:transform",
+                                        "sampler",   params->interpolation_type,
+                                        NULL);
+
+  gimp_gegl_node_set_matrix (transform_node, &params->matrix);
+
+  gegl_node_connect_to (src_node,       "output",
+                        transform_node, "input");
+
+  rowstride = chunk->width * babl_format_get_bytes_per_pixel (format);
+  data      = g_malloc (rowstride * chunk->height);
+
+  gegl_node_blit (transform_node, 1.0, chunk,
+                  format, data, rowstride, GEGL_BLIT_DEFAULT);
+
+  gegl_buffer_set (params->dest_buffer, chunk, 0,
+                   format, data, rowstride);
+
+  g_free (data);
+  g_object_unref (gegl);
+
+  g_async_queue_push (params->done, chunk);
+}
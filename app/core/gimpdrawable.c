@@ -37,6 +37,7 @@
 #include "gimpcontext.h"
 #include "gimpdrawable-combine.h"
 #include "gimpdrawable-filter.h"
+#include "gimpdrawable-histogram.h"
 #include "gimpdrawable-preview.h"
 #include "gimpdrawable-private.h"
 #include "gimpdrawable-shadow.h"
@@ -317,6 +318,8 @@ gimp_drawable_finalize (GObject *object)
     }
 
   gimp_drawable_free_shadow_buffer (drawable);
+  gimp_drawable_preview_free (drawable);
+  gimp_drawable_histogram_free (drawable);
 
   if (drawable->private->source_node)
     {
@@ -752,6 +755,9 @@ gimp_drawable_real_update (GimpDrawable *drawable,
         }
     }
 
+  gimp_drawable_preview_invalidate (drawable, x, y, width, height);
+  gimp_drawable_histogram_invalidate (drawable, x, y, width, height);
+
   gimp_viewable_invalidate_preview (GIMP_VIEWABLE (drawable));
 }
 
@@ -833,6 +839,9 @@ gimp_drawable_real_set_buffer (GimpDrawable *drawable,
 
   drawable->private->buffer = buffer;
 
+  gimp_drawable_preview_free (drawable);
+  gimp_drawable_histogram_free (drawable);
+
   gimp_item_set_offset (item, offset_x, offset_y);
   gimp_item_set_size (item,
                       gegl_buffer_get_width  (buffer),
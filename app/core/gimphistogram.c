@@ -48,6 +48,53 @@ struct _GimpHistogramPrivate
   gdouble *values;
 };
 
+/*  Histograms are computed in chunks of this size, aligned to
+ *  multiples of it in buffer coordinates.  Chunks are the unit of work
+ *  for the thread pool as well as of GimpHistogramCache.
+ */
+#define HISTOGRAM_CHUNK_SIZE 256
+
+
+typedef enum
+{
+  HISTOGRAM_SAMPLE_FLOAT,
+  HISTOGRAM_SAMPLE_U8,
+  HISTOGRAM_SAMPLE_U16
+} HistogramSample;
+
+typedef struct
+{
+  GeglBuffer      *buffer;
+  GeglBuffer      *mask;
+  const Babl      *format;       /* the format the buffer is read in   */
+  HistogramSample  sample;
+  gint             n_components;
+  gint             n_bins;
+  gint             n_values;     /* n_channels * n_bins                */
+  guint16         *bins;         /* integer sample -> bin, direct only */
+  gdouble          weight_scale; /* integer sample -> weight           */
+  GAsyncQueue     *partials;     /* per-thread partial histograms      */
+} HistogramContext;
+
+typedef struct
+{
+  GeglRectangle  rect;
+  GeglRectangle  mask_rect;
+  gdouble       *values;         /* NULL to use a per-thread partial   */
+} HistogramChunk;
+
+struct _GimpHistogramCache
+{
+  GeglBuffer    *buffer;         /* only compared, never dereferenced  */
+  const Babl    *format;
+  GeglRectangle  rect;
+  gint           n_cols;
+  gint           n_rows;
+  gint           n_values;
+  GeglRectangle *rects;
+  gdouble      **values;         /* per chunk, NULL if it is dirty     */
+};
+
 
 /*  local function prototypes  */
 
@@ -68,6 +115,20 @@ static void     gimp_histogram_alloc_values (GimpHistogram *histogram,
                                              gint           n_components,
                                              gint           n_bins);
 
+static gboolean gimp_histogram_context_init  (GimpHistogram       *histogram,
+                                              HistogramContext    *context,
+                                              GeglBuffer          *buffer,
+                                              GeglBuffer          *mask);
+static void     gimp_histogram_context_clear (HistogramContext    *context);
+static GArray * gimp_histogram_split         (const GeglRectangle *rect,
+                                              gint                *n_cols,
+                                              gint                *n_rows);
+static void     gimp_histogram_run_chunks    (HistogramContext    *context,
+                                              HistogramChunk      *chunks,
+                                              gint                 n_chunks,
+                                              gint                 n_threads);
+static void     gimp_histogram_cache_reset   (GimpHistogramCache  *cache);
+
 
 G_DEFINE_TYPE (GimpHistogram, gimp_histogram, GIMP_TYPE_OBJECT)
 
@@ -231,10 +292,13 @@ gimp_histogram_calculate (GimpHistogram       *histogram,
                           const GeglRectangle *mask_rect)
 {
   GimpHistogramPrivate *priv;
-  GeglBufferIterator   *iter;
-  const Babl           *format;
-  gint                  n_components;
-  gint                  n_bins;
+  HistogramContext      context;
+  HistogramChunk       *chunks;
+  GArray               *grid;
+  gdouble              *partial;
+  gint                  n_chunks;
+  gint                  n_threads;
+  gint                  i, j;
 
   g_return_if_fail (GIMP_IS_HISTOGRAM (histogram));
   g_return_if_fail (GEGL_IS_BUFFER (buffer));
@@ -242,238 +306,170 @@ gimp_histogram_calculate (GimpHistogram       *histogram,
 
   priv = histogram->priv;
 
-  format = gegl_buffer_get_format (buffer);
+  if (! gimp_histogram_context_init (histogram, &context, buffer, mask))
+    return;
 
-  if (babl_format_get_type (format, 0) == babl_type ("u8"))
-    n_bins = 256;
-  else
-    n_bins = 1024;
+  g_object_freeze_notify (G_OBJECT (histogram));
 
-  if (babl_format_is_palette (format))
-    {
-      if (babl_format_has_alpha (format))
-        format = babl_format ("R'G'B'A float");
-      else
-        format = babl_format ("R'G'B' float");
-    }
-  else
+  gimp_histogram_alloc_values (histogram,
+                               context.n_components, context.n_bins);
+
+  grid = gimp_histogram_split (buffer_rect, NULL, NULL);
+
+  n_chunks = grid->len;
+  chunks   = g_new0 (HistogramChunk, n_chunks);
+
+  for (i = 0; i < n_chunks; i++)
     {
-      const Babl *model = babl_format_get_model (format);
+      chunks[i].rect = g_array_index (grid, GeglRectangle, i);
 
-      if (model == babl_model ("Y"))
-        {
-          if (priv->gamma_correct)
-            format = babl_format ("Y' float");
-          else
-            format = babl_format ("Y float");
-        }
-      else if (model == babl_model ("Y'"))
-        {
-          format = babl_format ("Y' float");
-        }
-      else if (model == babl_model ("YA"))
-        {
-          if (priv->gamma_correct)
-            format = babl_format ("Y'A float");
-          else
-            format = babl_format ("YA float");
-        }
-      else if (model == babl_model ("Y'A"))
-        {
-          format = babl_format ("Y'A float");
-        }
-      else if (model == babl_model ("RGB"))
-        {
-          if (priv->gamma_correct)
-            format = babl_format ("R'G'B' float");
-          else
-            format = babl_format ("RGB float");
-        }
-      else if (model == babl_model ("R'G'B'"))
-        {
-          format = babl_format ("R'G'B' float");
-        }
-      else if (model == babl_model ("RGBA"))
-        {
-          if (priv->gamma_correct)
-            format = babl_format ("R'G'B'A float");
-          else
-            format = babl_format ("RGBA float");
-        }
-      else if (model == babl_model ("R'G'B'A"))
-        {
-          format = babl_format ("R'G'B'A float");
-        }
-      else
+      if (mask)
         {
-          g_return_if_reached ();
+          chunks[i].mask_rect = chunks[i].rect;
+
+          chunks[i].mask_rect.x += mask_rect->x - buffer_rect->x;
+          chunks[i].mask_rect.y += mask_rect->y - buffer_rect->y;
         }
     }
 
-  n_components = babl_format_get_n_components (format);
+  g_array_free (grid, TRUE);
 
-  g_object_freeze_notify (G_OBJECT (histogram));
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
 
-  gimp_histogram_alloc_values (histogram, n_components, n_bins);
+  n_threads = CLAMP (n_threads, 1, n_chunks);
 
-  iter = gegl_buffer_iterator_new (buffer, buffer_rect, 0, format,
-                                   GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
+  /*  one partial histogram per thread, the first one being our own  */
+  context.partials = g_async_queue_new ();
 
-  if (mask)
-    gegl_buffer_iterator_add (iter, mask, mask_rect, 0,
-                              babl_format ("Y float"),
-                              GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
+  g_async_queue_push (context.partials, priv->values);
 
-#define VALUE(c,i) (priv->values[(c) * priv->n_bins + \
-                                 (gint) (CLAMP ((i), 0.0, 1.0) * \
-                                         (priv->n_bins - 0.0001))])
+  for (i = 1; i < n_threads; i++)
+    g_async_queue_push (context.partials,
+                        g_new0 (gdouble, context.n_values));
 
-  while (gegl_buffer_iterator_next (iter))
+  gimp_histogram_run_chunks (&context, chunks, n_chunks, n_threads);
+
+  while ((partial = g_async_queue_try_pop (context.partials)))
     {
-      const gfloat *data = iter->data[0];
-      gfloat        max;
+      if (partial == priv->values)
+        continue;
 
-      if (mask)
-        {
-          const gfloat *mask_data = iter->data[1];
+      for (j = 0; j < context.n_values; j++)
+        priv->values[j] += partial[j];
 
-          switch (n_components)
-            {
-            case 1:
-              while (iter->length--)
-                {
-                  const gdouble masked = *mask_data;
-
-                  VALUE (0, data[0]) += masked;
-
-                  data += n_components;
-                  mask_data += 1;
-                }
-              break;
-
-            case 2:
-              while (iter->length--)
-                {
-                  const gdouble masked = *mask_data;
-                  const gdouble weight = data[1];
-
-                  VALUE (0, data[0]) += weight * masked;
-                  VALUE (1, data[1]) += masked;
-
-                  data += n_components;
-                  mask_data += 1;
-                }
-              break;
-
-            case 3: /* calculate separate value values */
-              while (iter->length--)
-                {
-                  const gdouble masked = *mask_data;
-
-                  VALUE (1, data[0]) += masked;
-                  VALUE (2, data[1]) += masked;
-                  VALUE (3, data[2]) += masked;
-
-                  max = MAX (data[0], data[1]);
-                  max = MAX (data[2], max);
-
-                  VALUE (0, max) += masked;
-
-                  data += n_components;
-                  mask_data += 1;
-                }
-              break;
-
-            case 4: /* calculate separate value values */
-              while (iter->length--)
-                {
-                  const gdouble masked = *mask_data;
-                  const gdouble weight = data[3];
-
-                  VALUE (1, data[0]) += weight * masked;
-                  VALUE (2, data[1]) += weight * masked;
-                  VALUE (3, data[2]) += weight * masked;
-                  VALUE (4, data[3]) += masked;
-
-                  max = MAX (data[0], data[1]);
-                  max = MAX (data[2], max);
-
-                  VALUE (0, max) += weight * masked;
-
-                  data += n_components;
-                  mask_data += 1;
-                }
-              break;
-            }
-        }
-      else /* no mask */
-        {
-          switch (n_components)
-            {
-            case 1:
-              while (iter->length--)
-                {
-                  VALUE (0, data[0]) += 1.0;
+      g_free (partial);
+    }
 
-                  data += n_components;
-                }
-              break;
+  g_async_queue_unref (context.partials);
 
-            case 2:
-              while (iter->length--)
-                {
-                  const gdouble weight = data[1];
+  gimp_histogram_context_clear (&context);
 
-                  VALUE (0, data[0]) += weight;
-                  VALUE (1, data[1]) += 1.0;
+  g_free (chunks);
 
-                  data += n_components;
-                }
-              break;
+  g_object_notify (G_OBJECT (histogram), "values");
 
-            case 3: /* calculate separate value values */
-              while (iter->length--)
-                {
-                  VALUE (1, data[0]) += 1.0;
-                  VALUE (2, data[1]) += 1.0;
-                  VALUE (3, data[2]) += 1.0;
+  g_object_thaw_notify (G_OBJECT (histogram));
+}
 
-                  max = MAX (data[0], data[1]);
-                  max = MAX (data[2], max);
+/**
+ * gimp_histogram_calculate_cached:
+ * @histogram:   a #GimpHistogram
+ * @buffer:      the buffer to calculate the histogram of
+ * @buffer_rect: the area of @buffer to consider
+ * @cache:       a #GimpHistogramCache belonging to @buffer
+ *
+ * Like gimp_histogram_calculate() without a mask, but keeps partial
+ * histograms of @buffer_rect's chunks in @cache. Only chunks that
+ * were invalidated using gimp_histogram_cache_invalidate() since the
+ * last call are scanned again.
+ **/
+void
+gimp_histogram_calculate_cached (GimpHistogram       *histogram,
+                                 GeglBuffer          *buffer,
+                                 const GeglRectangle *buffer_rect,
+                                 GimpHistogramCache  *cache)
+{
+  GimpHistogramPrivate *priv;
+  HistogramContext      context;
+  HistogramChunk       *chunks;
+  gint                  n_dirty = 0;
+  gint                  n_threads;
+  gint                  i, j;
 
-                  VALUE (0, max) += 1.0;
+  g_return_if_fail (GIMP_IS_HISTOGRAM (histogram));
+  g_return_if_fail (GEGL_IS_BUFFER (buffer));
+  g_return_if_fail (buffer_rect != NULL);
+  g_return_if_fail (cache != NULL);
 
-                  data += n_components;
-                }
-              break;
+  priv = histogram->priv;
 
-            case 4: /* calculate separate value values */
-              while (iter->length--)
-                {
-                  const gdouble weight = data[3];
+  if (! gimp_histogram_context_init (histogram, &context, buffer, NULL))
+    return;
 
-                  VALUE (1, data[0]) += weight;
-                  VALUE (2, data[1]) += weight;
-                  VALUE (3, data[2]) += weight;
-                  VALUE (4, data[3]) += 1.0;
+  if (cache->buffer   != buffer           ||
+      cache->format   != context.format   ||
+      cache->n_values != context.n_values ||
+      ! gegl_rectangle_equal (&cache->rect, buffer_rect))
+    {
+      GArray *grid;
 
-                  max = MAX (data[0], data[1]);
-                  max = MAX (data[2], max);
+      gimp_histogram_cache_reset (cache);
 
-                  VALUE (0, max) += weight;
+      grid = gimp_histogram_split (buffer_rect, &cache->n_cols, &cache->n_rows);
 
-                  data += n_components;
-                }
-              break;
-            }
+      cache->buffer   = buffer;
+      cache->format   = context.format;
+      cache->rect     = *buffer_rect;
+      cache->n_values = context.n_values;
+      cache->rects    = (GeglRectangle *) g_array_free (grid, FALSE);
+      cache->values   = g_new0 (gdouble *, cache->n_cols * cache->n_rows);
+    }
+
+  chunks = g_new0 (HistogramChunk, cache->n_cols * cache->n_rows);
+
+  for (i = 0; i < cache->n_cols * cache->n_rows; i++)
+    {
+      if (! cache->values[i])
+        {
+          cache->values[i] = g_new0 (gdouble, cache->n_values);
+
+          chunks[n_dirty].rect   = cache->rects[i];
+          chunks[n_dirty].values = cache->values[i];
+
+          n_dirty++;
         }
     }
 
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  gimp_histogram_run_chunks (&context, chunks, n_dirty,
+                             CLAMP (n_threads, 1, MAX (n_dirty, 1)));
+
+  g_free (chunks);
+
+  g_object_freeze_notify (G_OBJECT (histogram));
+
+  gimp_histogram_alloc_values (histogram,
+                               context.n_components, context.n_bins);
+
+  /*  summing up the cached partials is cheap compared to scanning
+   *  even a single chunk again, and unlike subtracting the stale
+   *  partials from the previous total, it doesn't accumulate
+   *  rounding errors in the alpha-weighted bins
+   */
+  for (i = 0; i < cache->n_cols * cache->n_rows; i++)
+    {
+      const gdouble *partial = cache->values[i];
+
+      for (j = 0; j < cache->n_values; j++)
+        priv->values[j] += partial[j];
+    }
+
+  gimp_histogram_context_clear (&context);
+
   g_object_notify (G_OBJECT (histogram), "values");
 
   g_object_thaw_notify (G_OBJECT (histogram));
-
-#undef VALUE
 }
 
 void
@@ -912,6 +908,57 @@ gimp_histogram_get_std_dev (GimpHistogram        *histogram,
 }
 
 
+/**
+ * gimp_histogram_cache_new:
+ *
+ * Creates an empty cache for gimp_histogram_calculate_cached().
+ *
+ * Return value: a new #GimpHistogramCache
+ **/
+GimpHistogramCache *
+gimp_histogram_cache_new (void)
+{
+  return g_slice_new0 (GimpHistogramCache);
+}
+
+void
+gimp_histogram_cache_free (GimpHistogramCache *cache)
+{
+  g_return_if_fail (cache != NULL);
+
+  gimp_histogram_cache_reset (cache);
+
+  g_slice_free (GimpHistogramCache, cache);
+}
+
+/**
+ * gimp_histogram_cache_invalidate:
+ * @cache: a #GimpHistogramCache
+ * @rect:  the changed area in buffer coordinates, or %NULL
+ *
+ * Marks the chunks intersecting @rect, or all of them if @rect is
+ * %NULL, for scanning on the next gimp_histogram_calculate_cached().
+ **/
+void
+gimp_histogram_cache_invalidate (GimpHistogramCache  *cache,
+                                 const GeglRectangle *rect)
+{
+  gint i;
+
+  g_return_if_fail (cache != NULL);
+
+  for (i = 0; i < cache->n_cols * cache->n_rows; i++)
+    {
+      if (cache->values[i] &&
+          (! rect || gegl_rectangle_intersect (NULL, rect, &cache->rects[i])))
+        {
+          g_free (cache->values[i]);
+          cache->values[i] = NULL;
+        }
+    }
+}
+
+
 /*  private functions  */
 
 static void
@@ -948,3 +995,367 @@ gimp_histogram_alloc_values (GimpHistogram *histogram,
               priv->n_channels * priv->n_bins * sizeof (gdouble));
     }
 }
+
+static gboolean
+gimp_histogram_context_init (GimpHistogram    *histogram,
+                             HistogramContext *context,
+                             GeglBuffer       *buffer,
+                             GeglBuffer       *mask)
+{
+  GimpHistogramPrivate *priv        = histogram->priv;
+  const Babl           *src_format  = gegl_buffer_get_format (buffer);
+  const Babl           *src_type    = babl_format_get_type (src_format, 0);
+  const Babl           *format;
+
+  if (babl_format_is_palette (src_format))
+    {
+      if (babl_format_has_alpha (src_format))
+        format = babl_format ("R'G'B'A float");
+      else
+        format = babl_format ("R'G'B' float");
+    }
+  else
+    {
+      const Babl *model = babl_format_get_model (src_format);
+
+      if (model == babl_model ("Y"))
+        {
+          if (priv->gamma_correct)
+            format = babl_format ("Y' float");
+          else
+            format = babl_format ("Y float");
+        }
+      else if (model == babl_model ("Y'"))
+        {
+          format = babl_format ("Y' float");
+        }
+      else if (model == babl_model ("YA"))
+        {
+          if (priv->gamma_correct)
+            format = babl_format ("Y'A float");
+          else
+            format = babl_format ("YA float");
+        }
+      else if (model == babl_model ("Y'A"))
+        {
+          format = babl_format ("Y'A float");
+        }
+      else if (model == babl_model ("RGB"))
+        {
+          if (priv->gamma_correct)
+            format = babl_format ("R'G'B' float");
+          else
+            format = babl_format ("RGB float");
+        }
+      else if (model == babl_model ("R'G'B'"))
+        {
+          format = babl_format ("R'G'B' float");
+        }
+      else if (model == babl_model ("RGBA"))
+        {
+          if (priv->gamma_correct)
+            format = babl_format ("R'G'B'A float");
+          else
+            format = babl_format ("RGBA float");
+        }
+      else if (model == babl_model ("R'G'B'A"))
+        {
+          format = babl_format ("R'G'B'A float");
+        }
+      else
+        {
+          g_return_val_if_reached (FALSE);
+        }
+    }
+
+  memset (context, 0, sizeof (HistogramContext));
+
+  context->buffer       = buffer;
+  context->mask         = mask;
+  context->format       = format;
+  context->sample       = HISTOGRAM_SAMPLE_FLOAT;
+  context->n_components = babl_format_get_n_components (format);
+
+  if (src_type == babl_type ("u8"))
+    context->n_bins = 256;
+  else
+    context->n_bins = 1024;
+
+  context->n_values = (context->n_components + 1) * context->n_bins;
+
+  /*  8 and 16 bit data that needs no color conversion is binned
+   *  directly, a lookup table gives the same bins the float path
+   *  would have computed
+   */
+  if (! babl_format_is_palette (src_format)                           &&
+      babl_format_get_model (src_format) == babl_format_get_model (format) &&
+      (src_type == babl_type ("u8") || src_type == babl_type ("u16")))
+    {
+      gint max = (src_type == babl_type ("u8")) ? 255 : 65535;
+      gint v;
+
+      context->format       = src_format;
+      context->sample       = ((src_type == babl_type ("u8")) ?
+                               HISTOGRAM_SAMPLE_U8 : HISTOGRAM_SAMPLE_U16);
+      context->weight_scale = 1.0 / max;
+      context->bins         = g_new (guint16, max + 1);
+
+      for (v = 0; v <= max; v++)
+        {
+          const gfloat value = (gfloat) v / (gfloat) max;
+
+          context->bins[v] = (gint) (value * (context->n_bins - 0.0001));
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+gimp_histogram_context_clear (HistogramContext *context)
+{
+  g_free (context->bins);
+  context->bins = NULL;
+}
+
+/*  Splits @rect into chunks, row by row, and optionally returns the
+ *  number of chunk columns and rows.
+ */
+static GArray *
+gimp_histogram_split (const GeglRectangle *rect,
+                      gint                *n_cols,
+                      gint                *n_rows)
+{
+  GArray *grid = g_array_new (FALSE, FALSE, sizeof (GeglRectangle));
+  gint    x0   = floor ((gdouble) rect->x / HISTOGRAM_CHUNK_SIZE) * HISTOGRAM_CHUNK_SIZE;
+  gint    y0   = floor ((gdouble) rect->y / HISTOGRAM_CHUNK_SIZE) * HISTOGRAM_CHUNK_SIZE;
+  gint    cols = 0;
+  gint    rows = 0;
+  gint    x, y;
+
+  for (y = y0; y < rect->y + rect->height; y += HISTOGRAM_CHUNK_SIZE, rows++)
+    {
+      for (x = x0, cols = 0;
+           x < rect->x + rect->width;
+           x += HISTOGRAM_CHUNK_SIZE, cols++)
+        {
+          GeglRectangle chunk = { x, y,
+                                  HISTOGRAM_CHUNK_SIZE, HISTOGRAM_CHUNK_SIZE };
+
+          gegl_rectangle_intersect (&chunk, &chunk, rect);
+
+          g_array_append_val (grid, chunk);
+        }
+    }
+
+  if (n_cols) *n_cols = cols;
+  if (n_rows) *n_rows = rows;
+
+  return grid;
+}
+
+/*  The inner loops, instantiated for each sample type below.  BIN()
+ *  maps a sample to its bin, WEIGHT() to the 0.0..1.0 weight it
+ *  carries as alpha.  Without a mask, @mask_data points to a single
+ *  1.0 and @mask_stride is 0.
+ */
+#define DEFINE_ACCUMULATE(name, type, BIN, WEIGHT)                      \
+static void                                                             \
+name (const HistogramContext *context,                                  \
+      gdouble                *values,                                   \
+      const type             *data,                                     \
+      const gfloat           *mask_data,                                \
+      gint                    mask_stride,                              \
+      gint                    length)                                   \
+{                                                                       \
+  const gint  n_bins = context->n_bins;                                 \
+  type        max;                                                      \
+                                                                        \
+  switch (context->n_components)                                        \
+    {                                                                   \
+    case 1:                                                             \
+      while (length--)                                                  \
+        {                                                               \
+          const gdouble masked = *mask_data;                            \
+                                                                        \
+          values[BIN (data[0])] += masked;                              \
+                                                                        \
+          data += 1;                                                    \
+          mask_data += mask_stride;                                     \
+        }                                                               \
+      break;                                                            \
+                                                                        \
+    case 2:                                                             \
+      while (length--)                                                  \
+        {                                                               \
+          const gdouble masked = *mask_data;                            \
+          const gdouble weight = WEIGHT (data[1]);                      \
+                                                                        \
+          values[BIN (data[0])]          += weight * masked;            \
+          values[n_bins + BIN (data[1])] += masked;                     \
+                                                                        \
+          data += 2;                                                    \
+          mask_data += mask_stride;                                     \
+        }                                                               \
+      break;                                                            \
+                                                                        \
+    case 3: /* calculate separate value values */                       \
+      while (length--)                                                  \
+        {                                                               \
+          const gdouble masked = *mask_data;                            \
+                                                                        \
+          values[1 * n_bins + BIN (data[0])] += masked;                 \
+          values[2 * n_bins + BIN (data[1])] += masked;                 \
+          values[3 * n_bins + BIN (data[2])] += masked;                 \
+                                                                        \
+          max = MAX (data[0], data[1]);                                 \
+          max = MAX (data[2], max);                                     \
+                                                                        \
+          values[BIN (max)] += masked;                                  \
+                                                                        \
+          data += 3;                                                    \
+          mask_data += mask_stride;                                     \
+        }                                                               \
+      break;                                                            \
+                                                                        \
+    case 4: /* calculate separate value values */                       \
+      while (length--)                                                  \
+        {                                                               \
+          const gdouble masked = *mask_data;                            \
+          const gdouble weight = WEIGHT (data[3]);                      \
+                                                                        \
+          values[1 * n_bins + BIN (data[0])] += weight * masked;        \
+          values[2 * n_bins + BIN (data[1])] += weight * masked;        \
+          values[3 * n_bins + BIN (data[2])] += weight * masked;        \
+          values[4 * n_bins + BIN (data[3])] += masked;                 \
+                                                                        \
+          max = MAX (data[0], data[1]);                                 \
+          max = MAX (data[2], max);                                     \
+                                                                        \
+          values[BIN (max)] += weight * masked;                         \
+                                                                        \
+          data += 4;                                                    \
+          mask_data += mask_stride;                                     \
+        }                                                               \
+      break;                                                            \
+    }                                                                   \
+}
+
+#define BIN_FLOAT(v)    ((gint) (CLAMP ((v), 0.0, 1.0) * (n_bins - 0.0001)))
+#define WEIGHT_FLOAT(v) (v)
+#define BIN_INT(v)      (context->bins[v])
+#define WEIGHT_INT(v)   ((v) * context->weight_scale)
+
+DEFINE_ACCUMULATE (gimp_histogram_accumulate_float, gfloat,
+                   BIN_FLOAT, WEIGHT_FLOAT)
+DEFINE_ACCUMULATE (gimp_histogram_accumulate_u8,    guint8,
+                   BIN_INT,   WEIGHT_INT)
+DEFINE_ACCUMULATE (gimp_histogram_accumulate_u16,   guint16,
+                   BIN_INT,   WEIGHT_INT)
+
+#undef BIN_FLOAT
+#undef WEIGHT_FLOAT
+#undef BIN_INT
+#undef WEIGHT_INT
+#undef DEFINE_ACCUMULATE
+
+static void
+gimp_histogram_calculate_chunk (HistogramChunk   *chunk,
+                                HistogramContext *context)
+{
+  static const gfloat  one    = 1.0;
+  GeglBufferIterator  *iter;
+  gdouble             *values = chunk->values;
+
+  /*  at most as many chunks run as there are partials, so this
+   *  never blocks
+   */
+  if (! values)
+    values = g_async_queue_pop (context->partials);
+
+  iter = gegl_buffer_iterator_new (context->buffer, &chunk->rect, 0,
+                                   context->format,
+                                   GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
+
+  if (context->mask)
+    gegl_buffer_iterator_add (iter, context->mask, &chunk->mask_rect, 0,
+                              babl_format ("Y float"),
+                              GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
+
+  while (gegl_buffer_iterator_next (iter))
+    {
+      const gfloat *mask_data   = &one;
+      gint          mask_stride = 0;
+
+      if (context->mask)
+        {
+          mask_data   = iter->data[1];
+          mask_stride = 1;
+        }
+
+      switch (context->sample)
+        {
+        case HISTOGRAM_SAMPLE_FLOAT:
+          gimp_histogram_accumulate_float (context, values, iter->data[0],
+                                           mask_data, mask_stride,
+                                           iter->length);
+          break;
+
+        case HISTOGRAM_SAMPLE_U8:
+          gimp_histogram_accumulate_u8 (context, values, iter->data[0],
+                                        mask_data, mask_stride,
+                                        iter->length);
+          break;
+
+        case HISTOGRAM_SAMPLE_U16:
+          gimp_histogram_accumulate_u16 (context, values, iter->data[0],
+                                         mask_data, mask_stride,
+                                         iter->length);
+          break;
+        }
+    }
+
+  if (! chunk->values)
+    g_async_queue_push (context->partials, values);
+}
+
+static void
+gimp_histogram_run_chunks (HistogramContext *context,
+                           HistogramChunk   *chunks,
+                           gint              n_chunks,
+                           gint              n_threads)
+{
+  gint i;
+
+  if (n_threads > 1 && n_chunks > 1)
+    {
+      GThreadPool *pool;
+
+      pool = g_thread_pool_new ((GFunc) gimp_histogram_calculate_chunk,
+                                context, n_threads, FALSE, NULL);
+
+      for (i = 0; i < n_chunks; i++)
+        g_thread_pool_push (pool, &chunks[i], NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (i = 0; i < n_chunks; i++)
+        gimp_histogram_calculate_chunk (&chunks[i], context);
+    }
+}
+
+static void
+gimp_histogram_cache_reset (GimpHistogramCache *cache)
+{
+  gint i;
+
+  for (i = 0; i < cache->n_cols * cache->n_rows; i++)
+    g_free (cache->values[i]);
+
+  g_free (cache->values);
+  g_free (cache->rects);
+
+  memset (cache, 0, sizeof (GimpHistogramCache));
+}
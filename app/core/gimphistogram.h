@@ -59,6 +59,11 @@ void            gimp_histogram_calculate     (GimpHistogram        *histogram,
                                               const GeglRectangle  *buffer_rect,
                                               GeglBuffer           *mask,
                                               const GeglRectangle  *mask_rect);
+void            gimp_histogram_calculate_cached
+                                             (GimpHistogram        *histogram,
+                                              GeglBuffer           *buffer,
+                                              const GeglRectangle  *buffer_rect,
+                                              GimpHistogramCache   *cache);
 
 void            gimp_histogram_clear_values  (GimpHistogram        *histogram);
 
@@ -93,5 +98,10 @@ gdouble         gimp_histogram_get_component (GimpHistogram        *histogram,
 gint            gimp_histogram_n_channels    (GimpHistogram        *histogram);
 gint            gimp_histogram_n_bins        (GimpHistogram        *histogram);
 
+GimpHistogramCache * gimp_histogram_cache_new        (void);
+void                 gimp_histogram_cache_free       (GimpHistogramCache  *cache);
+void                 gimp_histogram_cache_invalidate (GimpHistogramCache  *cache,
+                                                      const GeglRectangle *rect);
+
 
 #endif /* __GIMP_HISTOGRAM_H__ */
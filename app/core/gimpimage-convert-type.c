@@ -502,6 +502,43 @@ typedef struct
 
 } box, *boxptr;
 
+/*  Layers are split into bands of this many rows for building the
+ *  histogram, so a single large layer still keeps all threads busy.
+ */
+#define HISTOGRAM_BAND_HEIGHT 64
+
+typedef struct
+{
+  GimpLayer     *layer;
+  GeglRectangle  rect;
+  gint           offset_x;
+  gint           offset_y;
+
+  /*  the distinct colors of the band in scan order, collected only
+   *  while the image may still fit the requested number of colors
+   */
+  guchar        *found_cols;
+  gint           num_found_cols;
+} HistogramBand;
+
+typedef struct
+{
+  gint          col_limit;
+  gboolean      alpha_dither;
+  volatile gint needs_quantize;
+
+  GAsyncQueue  *histograms;   /* one histogram per worker thread  */
+  GAsyncQueue  *done;         /* finished bands, for progress     */
+} HistogramContext;
+
+typedef struct
+{
+  QuantizeObj *quantobj;
+  GimpLayer   *layer;
+  GeglBuffer  *new_buffer;
+  GAsyncQueue *done;
+} QuantizeJob;
+
 
 static void zero_histogram_gray     (CFHistogram   histogram);
 static void zero_histogram_rgb      (CFHistogram   histogram);
@@ -509,12 +546,10 @@ static void generate_histogram_gray (CFHistogram   hostogram,
                                      GimpLayer    *layer,
                                      gboolean      alpha_dither);
 static void generate_histogram_rgb  (CFHistogram   histogram,
-                                     GimpLayer    *layer,
+                                     GList        *layers,
                                      gint          col_limit,
                                      gboolean      alpha_dither,
-                                     GimpProgress *progress,
-                                     gint          nth_layer,
-                                     gint          n_layers);
+                                     GimpProgress *progress);
 
 static QuantizeObj * initialize_median_cut (GimpImageBaseType      old_type,
                                             gint                   num_cols,
@@ -528,6 +563,9 @@ static void          compute_color_lin8    (QuantizeObj           *quantobj,
                                             boxptr                 boxp,
                                             const int              icolor);
 
+static void          quantize_layers       (QuantizeObj           *quantobj,
+                                            GPtrArray             *jobs);
+
 
 static guchar    found_cols[MAXNUMCOLORS][3];
 static gint      num_found_cols;
@@ -671,8 +709,7 @@ make_remap_table (const unsigned char  old_palette[],
 
 static void
 remap_indexed_layer (GimpLayer    *layer,
-                     const guchar *remap_table,
-                     gint          num_entries)
+                     const guchar *remap_table)
 {
   GeglBufferIterator *iter;
   const Babl         *format;
@@ -714,6 +751,49 @@ remap_indexed_layer (GimpLayer    *layer,
     }
 }
 
+static void
+remap_indexed_layers (GList        *layers,
+                      const guchar *remap_table)
+{
+  GList *list;
+  gint   n_layers = g_list_length (layers);
+  gint   n_threads;
+  gint   i;
+
+  /*  the palette is often sorted by usage already, in which case
+   *  there is nothing to do
+   */
+  for (i = 0; i < 256; i++)
+    {
+      if (remap_table[i] != i)
+        break;
+    }
+
+  if (i == 256)
+    return;
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  if (n_threads > 1 && n_layers > 1)
+    {
+      GThreadPool *pool;
+
+      pool = g_thread_pool_new ((GFunc) remap_indexed_layer,
+                                (gpointer) remap_table,
+                                MIN (n_threads, n_layers), FALSE, NULL);
+
+      for (list = layers; list; list = g_list_next (list))
+        g_thread_pool_push (pool, list->data, NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (list = layers; list; list = g_list_next (list))
+        remap_indexed_layer (list->data, remap_table);
+    }
+}
+
 static int
 color_quicksort (const void *c1,
                  const void *c2)
@@ -752,8 +832,8 @@ gimp_image_convert_type (GimpImage               *image,
   GimpImageBaseType  old_type;
   GList             *all_layers;
   GList             *list;
+  GPtrArray         *quantize_jobs;
   const gchar       *undo_desc = NULL;
-  gint               nth_layer, n_layers;
 
   g_return_val_if_fail (GIMP_IS_IMAGE (image), FALSE);
   g_return_val_if_fail (new_type != gimp_image_get_base_type (image), FALSE);
@@ -785,8 +865,6 @@ gimp_image_convert_type (GimpImage               *image,
 
   all_layers = gimp_image_get_layer_list (image);
 
-  n_layers = g_list_length (all_layers);
-
   switch (new_type)
     {
     case GIMP_RGB:
@@ -856,19 +934,17 @@ gimp_image_convert_type (GimpImage               *image,
           num_found_cols = 0;
 
           /*  Build the histogram  */
-          for (list = all_layers, nth_layer = 0;
-               list;
-               list = g_list_next (list), nth_layer++)
+          if (old_type == GIMP_GRAY)
             {
-              GimpLayer *layer = list->data;
-
-              if (old_type == GIMP_GRAY)
+              for (list = all_layers; list; list = g_list_next (list))
                 generate_histogram_gray (quantobj->histogram,
-                                         layer, alpha_dither);
-              else
-                generate_histogram_rgb (quantobj->histogram,
-                                        layer, num_cols, alpha_dither,
-                                        progress, nth_layer, n_layers);
+                                         list->data, alpha_dither);
+            }
+          else
+            {
+              generate_histogram_rgb (quantobj->histogram,
+                                      all_layers, num_cols, alpha_dither,
+                                      progress);
 
               /* Note: generate_histogram_rgb may set needs_quantize if
                *  the image contains more colors than the limit specified
@@ -966,12 +1042,9 @@ gimp_image_convert_type (GimpImage               *image,
     }
 
   /*  Convert all layers  */
-  if (quantobj)
-    quantobj->n_layers = n_layers;
+  quantize_jobs = g_ptr_array_new ();
 
-  for (list = all_layers, nth_layer = 0;
-       list;
-       list = g_list_next (list), nth_layer++)
+  for (list = all_layers; list; list = g_list_next (list))
     {
       GimpLayer *layer    = list->data;
       gboolean   quantize = FALSE;
@@ -996,24 +1069,20 @@ gimp_image_convert_type (GimpImage               *image,
 
       if (quantize)
         {
-          GeglBuffer *new_buffer;
-          gboolean    has_alpha;
+          QuantizeJob *job = g_slice_new0 (QuantizeJob);
+          gboolean     has_alpha;
 
           has_alpha = gimp_drawable_has_alpha (GIMP_DRAWABLE (layer));
 
-          new_buffer =
+          job->layer      = layer;
+          job->new_buffer =
             gegl_buffer_new (GEGL_RECTANGLE (0, 0,
                                              gimp_item_get_width  (GIMP_ITEM (layer)),
                                              gimp_item_get_height (GIMP_ITEM (layer))),
                              gimp_image_get_layer_format (image,
                                                           has_alpha));
 
-          quantobj->nth_layer = nth_layer;
-          quantobj->second_pass (quantobj, layer, new_buffer);
-
-          gimp_drawable_set_buffer (GIMP_DRAWABLE (layer), TRUE, NULL,
-                                    new_buffer);
-          g_object_unref (new_buffer);
+          g_ptr_array_add (quantize_jobs, job);
         }
       else
         {
@@ -1024,6 +1093,26 @@ gimp_image_convert_type (GimpImage               *image,
         }
     }
 
+  if (quantize_jobs->len > 0)
+    {
+      gint i;
+
+      quantize_layers (quantobj, quantize_jobs);
+
+      for (i = 0; i < quantize_jobs->len; i++)
+        {
+          QuantizeJob *job = g_ptr_array_index (quantize_jobs, i);
+
+          gimp_drawable_set_buffer (GIMP_DRAWABLE (job->layer), TRUE, NULL,
+                                    job->new_buffer);
+          g_object_unref (job->new_buffer);
+
+          g_slice_free (QuantizeJob, job);
+        }
+    }
+
+  g_ptr_array_free (quantize_jobs, TRUE);
+
   /*  Set the final palette on the image  */
   switch (new_type)
     {
@@ -1052,16 +1141,17 @@ gimp_image_convert_type (GimpImage               *image,
 
           num_entries = quantobj->actual_number_of_colors;
 
+          /*  Indices nobody uses keep mapping to themselves  */
+          for (i = 0; i < 256; i++)
+            remap_table[i] = i;
+
           /* Generate a remapping table */
           make_remap_table (old_palette, new_palette,
                             quantobj->index_used_count,
                             remap_table, &num_entries);
 
           /*  Convert all layers  */
-          for (list = all_layers; list; list = g_list_next (list))
-            {
-              remap_indexed_layer (list->data, remap_table, num_entries);
-            }
+          remap_indexed_layers (all_layers, remap_table);
 
           for (i = 0, j = 0; i < num_entries; i++)
             {
@@ -1177,208 +1267,302 @@ generate_histogram_gray (CFHistogram  histogram,
 }
 
 
+static gboolean
+histogram_band_add_color (HistogramBand    *band,
+                          HistogramContext *context,
+                          const guchar     *data)
+{
+  guchar *cols = band->found_cols;
+  gint    i;
+
+  for (i = 0; i < band->num_found_cols; i++, cols += 3)
+    {
+      if ((data[RED]   == cols[0]) &&
+          (data[GREEN] == cols[1]) &&
+          (data[BLUE]  == cols[2]))
+        return TRUE;
+    }
+
+  if (band->num_found_cols == context->col_limit)
+    {
+      /* There are more colors in the image than were allowed.  Tell
+       *  the other bands to stop collecting and switch to plain
+       *  histogram calculation with a view to quantizing later.
+       */
+      g_atomic_int_set (&context->needs_quantize, TRUE);
+
+      return FALSE;
+    }
+
+  cols[0] = data[RED];
+  cols[1] = data[GREEN];
+  cols[2] = data[BLUE];
+
+  band->num_found_cols++;
+
+  return TRUE;
+}
+
+
 static void
-generate_histogram_rgb (CFHistogram   histogram,
-                        GimpLayer    *layer,
-                        gint          col_limit,
-                        gboolean      alpha_dither,
-                        GimpProgress *progress,
-                        gint          nth_layer,
-                        gint          n_layers)
+generate_histogram_rgb_band (HistogramBand    *band,
+                             HistogramContext *context)
 {
   GeglBufferIterator *iter;
   const Babl         *format;
   GeglRectangle      *roi;
+  CFHistogram         histogram;
   ColorFreq          *colfreq;
-  gint                nfc_iter;
   gint                row, col, coledge;
-  gint                offsetx, offsety;
-  glong               layer_size;
-  glong               total_size = 0;
-  gint                count      = 0;
   gint                bpp;
   gboolean            has_alpha;
+  gboolean            alpha_dither = context->alpha_dither;
 
-  format = gimp_drawable_get_format (GIMP_DRAWABLE (layer));
-
-  g_return_if_fail (format == babl_format ("R'G'B' u8") ||
-                    format == babl_format ("R'G'B'A u8"));
+  format = gimp_drawable_get_format (GIMP_DRAWABLE (band->layer));
 
   bpp       = babl_format_get_bytes_per_pixel (format);
   has_alpha = babl_format_has_alpha (format);
 
-  gimp_item_get_offset (GIMP_ITEM (layer), &offsetx, &offsety);
-
-  layer_size = (gimp_item_get_width  (GIMP_ITEM (layer)) *
-                gimp_item_get_height (GIMP_ITEM (layer)));
+  band->found_cols = g_new (guchar, 3 * context->col_limit);
 
-  /*  g_printerr ("col_limit = %d, nfc = %d\n", col_limit, num_found_cols); */
+  /*  at most as many bands run as there are histograms, so this
+   *  never blocks
+   */
+  histogram = g_async_queue_pop (context->histograms);
 
-  iter = gegl_buffer_iterator_new (gimp_drawable_get_buffer (GIMP_DRAWABLE (layer)),
-                                   NULL, 0, format,
+  iter = gegl_buffer_iterator_new (gimp_drawable_get_buffer (GIMP_DRAWABLE (band->layer)),
+                                   &band->rect, 0, format,
                                    GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
   roi = &iter->roi[0];
 
-  if (progress)
-    gimp_progress_set_value (progress, 0.0);
-
   while (gegl_buffer_iterator_next (iter))
     {
-      const guchar *data = iter->data[0];
-
-      total_size += iter->length;
+      const guchar *data  = iter->data[0];
+      gboolean      track = ! g_atomic_int_get (&context->needs_quantize);
 
-      /* g_printerr (" [%d,%d - %d,%d]", srcPR.x, src_roi->y, offsetx, offsety); */
+      /* if alpha-dithering, we need to be deterministic w.r.t. offsets */
+      col = roi->x + band->offset_x;
+      coledge = col + roi->width;
+      row = roi->y + band->offset_y;
 
-      if (needs_quantize)
+      while (iter->length--)
         {
-          if (alpha_dither)
-            {
-              /* if alpha-dithering,
-                 we need to be deterministic w.r.t. offsets */
-
-              col = roi->x + offsetx;
-              coledge = col + roi->width;
-              row = roi->y + offsety;
+          gboolean transparent = FALSE;
 
-              while (iter->length--)
+          if (has_alpha)
+            {
+              if (alpha_dither)
                 {
-                  gboolean transparent = FALSE;
-
-                  if (has_alpha &&
-                      data[ALPHA] <
+                  if (data[ALPHA] <
                       DM[col & DM_WIDTHMASK][row & DM_HEIGHTMASK])
                     transparent = TRUE;
-
-                  if (! transparent)
-                    {
-                      colfreq = HIST_RGB (histogram,
-                                          data[RED],
-                                          data[GREEN],
-                                          data[BLUE]);
-                      (*colfreq)++;
-                    }
-
-                  col++;
-                  if (col == coledge)
-                    {
-                      col = roi->x + offsetx;
-                      row++;
-                    }
-
-                  data += bpp;
+                }
+              else
+                {
+                  if (data[ALPHA] <= 127)
+                    transparent = TRUE;
                 }
             }
-          else
+
+          if (! transparent)
             {
-              while (iter->length--)
-                {
-                  if ((has_alpha && ((data[ALPHA] > 127)))
-                      || (!has_alpha))
-                    {
-                      colfreq = HIST_RGB (histogram,
-                                          data[RED],
-                                          data[GREEN],
-                                          data[BLUE]);
-                      (*colfreq)++;
-                    }
+              colfreq = HIST_RGB (histogram,
+                                  data[RED],
+                                  data[GREEN],
+                                  data[BLUE]);
+              (*colfreq)++;
+
+              if (track)
+                track = histogram_band_add_color (band, context, data);
+            }
 
-                  data += bpp;
-                }
+          col++;
+          if (col == coledge)
+            {
+              col = roi->x + band->offset_x;
+              row++;
             }
+
+          data += bpp;
         }
-      else
+    }
+
+  g_async_queue_push (context->histograms, histogram);
+
+  if (context->done)
+    g_async_queue_push (context->done, band);
+}
+
+
+/*  Builds the histogram of all @layers at once.  The layers are cut
+ *  into bands which are counted concurrently into per-thread
+ *  histograms; those are summed up at the end.  Each band also keeps
+ *  the list of distinct colors it saw, and merging these lists in scan
+ *  order yields exactly the found_cols table a serial scan would have
+ *  produced.
+ */
+static void
+generate_histogram_rgb (CFHistogram   histogram,
+                        GList        *layers,
+                        gint          col_limit,
+                        gboolean      alpha_dither,
+                        GimpProgress *progress)
+{
+  HistogramContext  context;
+  HistogramBand    *bands;
+  CFHistogram       extra;
+  GList            *list;
+  gint              n_bands = 0;
+  gint              n_threads;
+  gint              i, j;
+
+  for (list = layers; list; list = g_list_next (list))
+    {
+      const Babl *format = gimp_drawable_get_format (list->data);
+
+      g_return_if_fail (format == babl_format ("R'G'B' u8") ||
+                        format == babl_format ("R'G'B'A u8"));
+
+      n_bands += ((gimp_item_get_height (list->data) +
+                   HISTOGRAM_BAND_HEIGHT - 1) / HISTOGRAM_BAND_HEIGHT);
+    }
+
+  if (n_bands == 0)
+    return;
+
+  bands = g_new0 (HistogramBand, n_bands);
+
+  for (list = layers, i = 0; list; list = g_list_next (list))
+    {
+      GimpItem *item   = list->data;
+      gint      width  = gimp_item_get_width  (item);
+      gint      height = gimp_item_get_height (item);
+      gint      offset_x, offset_y;
+      gint      y;
+
+      gimp_item_get_offset (item, &offset_x, &offset_y);
+
+      for (y = 0; y < height; y += HISTOGRAM_BAND_HEIGHT, i++)
         {
-          /* if alpha-dithering, we need to be deterministic w.r.t. offsets */
-          col = roi->x + offsetx;
-          coledge = col + roi->width;
-          row = roi->y + offsety;
+          bands[i].layer    = list->data;
+          bands[i].rect     = *GEGL_RECTANGLE (0, y, width,
+                                               MIN (HISTOGRAM_BAND_HEIGHT,
+                                                    height - y));
+          bands[i].offset_x = offset_x;
+          bands[i].offset_y = offset_y;
+        }
+    }
 
-          while (iter->length--)
-            {
-	      gboolean transparent = FALSE;
-
-	      if (has_alpha)
-	        {
-		  if (alpha_dither)
-		    {
-		      if (data[ALPHA] <
-                          DM[col & DM_WIDTHMASK][row & DM_HEIGHTMASK])
-		  	transparent = TRUE;
-		    }
-		  else
-		    {
-		      if (data[ALPHA] <= 127)
-			transparent = TRUE;
-		    }
-		}
-
-	      if (! transparent)
-                {
-                  colfreq = HIST_RGB (histogram,
-                                      data[RED],
-                                      data[GREEN],
-                                      data[BLUE]);
-                  (*colfreq)++;
+  /*  g_printerr ("col_limit = %d, nfc = %d\n", col_limit, num_found_cols); */
 
-                  if (!needs_quantize)
-                    {
-                      for (nfc_iter = 0;
-                           nfc_iter < num_found_cols;
-                           nfc_iter++)
-                        {
-                          if ((data[RED]   == found_cols[nfc_iter][0]) &&
-                              (data[GREEN] == found_cols[nfc_iter][1]) &&
-                              (data[BLUE]  == found_cols[nfc_iter][2]))
-                            goto already_found;
-                        }
+  context.col_limit      = col_limit;
+  context.alpha_dither   = alpha_dither;
+  context.needs_quantize = needs_quantize;
+  context.histograms     = g_async_queue_new ();
+  context.done           = NULL;
 
-                      /* Color was not in the table of
-                       * existing colors
-                       */
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
 
-                      num_found_cols++;
+  n_threads = CLAMP (n_threads, 1, n_bands);
 
-                      if (num_found_cols > col_limit)
-                        {
-                          /* There are more colors in the image
-                           *  than were allowed.  We switch to plain
-                           *  histogram calculation with a view to
-                           *  quantizing at a later stage.
-                           */
-                          needs_quantize = TRUE;
-                          /* g_print ("\nmax colors exceeded - needs quantize.\n");*/
-                          goto already_found;
-                        }
-                      else
-                        {
-                          /* Remember the new color we just found.
-                           */
-                          found_cols[num_found_cols-1][0] = data[RED];
-                          found_cols[num_found_cols-1][1] = data[GREEN];
-                          found_cols[num_found_cols-1][2] = data[BLUE];
-                        }
-                    }
-                }
-            already_found:
+  g_async_queue_push (context.histograms, histogram);
 
-              col++;
-              if (col == coledge)
-                {
-                  col = roi->x + offsetx;
-                  row++;
-                }
+  for (i = 1; i < n_threads; i++)
+    g_async_queue_push (context.histograms,
+                        g_new0 (ColorFreq,
+                                HIST_R_ELEMS * HIST_G_ELEMS * HIST_B_ELEMS));
 
-              data += bpp;
+  if (progress)
+    gimp_progress_set_value (progress, 0.0);
+
+  if (n_threads > 1)
+    {
+      GThreadPool *pool;
+
+      context.done = g_async_queue_new ();
+
+      pool = g_thread_pool_new ((GFunc) generate_histogram_rgb_band, &context,
+                                n_threads, FALSE, NULL);
+
+      for (i = 0; i < n_bands; i++)
+        g_thread_pool_push (pool, &bands[i], NULL);
+
+      for (i = 0; i < n_bands; i++)
+        {
+          g_async_queue_pop (context.done);
+
+          if (progress && (i % 16 == 0))
+            gimp_progress_set_value (progress, (gdouble) i / n_bands);
+        }
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+
+      g_async_queue_unref (context.done);
+    }
+  else
+    {
+      for (i = 0; i < n_bands; i++)
+        {
+          generate_histogram_rgb_band (&bands[i], &context);
+
+          if (progress && (i % 16 == 0))
+            gimp_progress_set_value (progress, (gdouble) i / n_bands);
+        }
+    }
+
+  /*  sum the per-thread histograms up into the first one  */
+  while ((extra = g_async_queue_try_pop (context.histograms)))
+    {
+      if (extra == histogram)
+        continue;
+
+      for (j = 0; j < HIST_R_ELEMS * HIST_G_ELEMS * HIST_B_ELEMS; j++)
+        histogram[j] += extra[j];
+
+      g_free (extra);
+    }
+
+  g_async_queue_unref (context.histograms);
+
+  needs_quantize = context.needs_quantize;
+
+  for (i = 0; i < n_bands; i++)
+    {
+      const guchar *cols = bands[i].found_cols;
+      gint          k;
+
+      for (j = 0; j < bands[i].num_found_cols && ! needs_quantize; j++)
+        {
+          for (k = 0; k < num_found_cols; k++)
+            {
+              if ((cols[j * 3 + 0] == found_cols[k][0]) &&
+                  (cols[j * 3 + 1] == found_cols[k][1]) &&
+                  (cols[j * 3 + 2] == found_cols[k][2]))
+                break;
+            }
+
+          if (k < num_found_cols)
+            continue;
+
+          num_found_cols++;
+
+          if (num_found_cols > col_limit)
+            {
+              needs_quantize = TRUE;
+            }
+          else
+            {
+              found_cols[num_found_cols-1][0] = cols[j * 3 + 0];
+              found_cols[num_found_cols-1][1] = cols[j * 3 + 1];
+              found_cols[num_found_cols-1][2] = cols[j * 3 + 2];
             }
         }
 
-      if (progress && (count % 16 == 0))
-        gimp_progress_set_value (progress,
-                                 (nth_layer + ((gdouble) total_size)/
-                                  layer_size) / (gdouble) n_layers);
+      g_free (bands[i].found_cols);
     }
 
+  g_free (bands);
+
 /*  g_print ("O: col_limit = %d, nfc = %d\n", col_limit, num_found_cols);*/
 }
 
@@ -2387,6 +2571,20 @@ select_colors_rgb (QuantizeObj *quantobj,
 #define BOX_G_SHIFT  (G_SHIFT + BOX_G_LOG)
 #define BOX_B_SHIFT  (B_SHIFT + BOX_B_LOG)
 
+/* When the whole inverse colormap is filled up front (so the pass2
+ * routines never have to write to it and can run concurrently) the
+ * cache-friendly small box above loses to the original 1/8th-per-axis
+ * box, which lets Heckbert's criterion discard most of the colormap
+ * once per 512 cells instead of once per cell.
+ */
+#define PRECALC_BOX_R_LOG 3
+#define PRECALC_BOX_G_LOG 3
+#define PRECALC_BOX_B_LOG 3
+
+#define PRECALC_BOX_R_ELEMS (1<<PRECALC_BOX_R_LOG)
+#define PRECALC_BOX_G_ELEMS (1<<PRECALC_BOX_G_LOG)
+#define PRECALC_BOX_B_ELEMS (1<<PRECALC_BOX_B_LOG)
+
 
 /*
  * The next three routines implement inverse colormap filling.  They could
@@ -2401,10 +2599,14 @@ find_nearby_colors (QuantizeObj *quantobj,
                     int          minR,
                     int          minG,
                     int          minB,
+                    int          boxRlog,
+                    int          boxGlog,
+                    int          boxBlog,
                     int          colorlist[])
 /* Locate the colormap entries close enough to an update box to be candidates
  * for the nearest entry to some cell(s) in the update box.  The update box
- * is specified by the center coordinates of its first cell.  The number of
+ * is specified by the center coordinates of its first cell and by the
+ * log2 of its size in cells along each axis.  The number of
  * candidate colormap entries is returned, and their colormap indexes are
  * placed in colorlist[].
  * This routine uses Heckbert's "locally sorted search" criterion to select
@@ -2424,11 +2626,11 @@ find_nearby_colors (QuantizeObj *quantobj,
    * Note that since ">>" rounds down, the "center" values may be closer to
    * min than to max; hence comparisons to them must be "<=", not "<".
    */
-  maxR = minR + ((1 << BOX_R_SHIFT) - (1 << R_SHIFT));
+  maxR = minR + ((1 << (R_SHIFT + boxRlog)) - (1 << R_SHIFT));
   centerR = (minR + maxR + 1) >> 1;
-  maxG = minG + ((1 << BOX_G_SHIFT) - (1 << G_SHIFT));
+  maxG = minG + ((1 << (G_SHIFT + boxGlog)) - (1 << G_SHIFT));
   centerG = (minG + maxG + 1) >> 1;
-  maxB = minB + ((1 << BOX_B_SHIFT) - (1 << B_SHIFT));
+  maxB = minB + ((1 << (B_SHIFT + boxBlog)) - (1 << B_SHIFT));
   centerB = (minB + maxB + 1) >> 1;
 
   /* For each color in colormap, find:
@@ -2560,6 +2762,9 @@ find_best_colors (QuantizeObj *quantobj,
                   int          minR,
                   int          minG,
                   int          minB,
+                  int          boxRlog,
+                  int          boxGlog,
+                  int          boxBlog,
                   int          numcolors,
                   int          colorlist[],
                   int          bestcolor[])
@@ -2579,13 +2784,16 @@ find_best_colors (QuantizeObj *quantobj,
   int  xx0, xx1;         /* distance increments */
   int  xx2;
   int  inR, inG, inB;    /* initial values for increments */
+  int  nR = 1 << boxRlog;
+  int  nG = 1 << boxGlog;
+  int  nB = 1 << boxBlog;
 
   /* This array holds the distance to the nearest-so-far color for each cell */
-  int  bestdist[BOX_R_ELEMS * BOX_G_ELEMS * BOX_B_ELEMS] = { 0, };
+  int  bestdist[PRECALC_BOX_R_ELEMS * PRECALC_BOX_G_ELEMS * PRECALC_BOX_B_ELEMS];
 
   /* Initialize best-distance for each cell of the update box */
   bptr = bestdist;
-  for (i = BOX_R_ELEMS*BOX_G_ELEMS*BOX_B_ELEMS-1; i >= 0; i--)
+  for (i = nR * nG * nB - 1; i >= 0; i--)
     *bptr++ = 0x7FFFFFFFL;
 
   /* For each color selected by find_nearby_colors,
@@ -2625,15 +2833,15 @@ find_best_colors (QuantizeObj *quantobj,
       bptr = bestdist;
       cptr = bestcolor;
       xx0 = inR;
-      for (iR = BOX_R_ELEMS-1; iR >= 0; iR--)
+      for (iR = nR-1; iR >= 0; iR--)
         {
           dist1 = dist0;
           xx1 = inG;
-          for (iG = BOX_G_ELEMS-1; iG >= 0; iG--)
+          for (iG = nG-1; iG >= 0; iG--)
             {
               dist2 = dist1;
               xx2 = inB;
-              for (iB = BOX_B_ELEMS-1; iB >= 0; iB--)
+              for (iB = nB-1; iB >= 0; iB--)
                 {
                   if (dist2 < *bptr)
                     {
@@ -2691,14 +2899,16 @@ fill_inverse_cmap_gray (QuantizeObj *quantobj,
 
 
 static void
-fill_inverse_cmap_rgb (QuantizeObj *quantobj,
-                       CFHistogram  histogram,
-                       int          R,
-                       int          G,
-                       int          B)
-/* Fill the inverse-colormap entries in the update box that contains */
-/* histogram cell R/G/B.  (Only that one cell MUST be filled, but */
-/* we can fill as many others as we wish.) */
+fill_inverse_cmap_rgb_box (QuantizeObj *quantobj,
+                           CFHistogram  histogram,
+                           int          R,
+                           int          G,
+                           int          B,
+                           int          boxRlog,
+                           int          boxGlog,
+                           int          boxBlog)
+/* Fill the inverse-colormap entries in the update box whose first */
+/* histogram cell is R/G/B and whose size is given in log2 cells. */
 {
   int  minR, minG, minB; /* lower left corner of update box */
   int  iR, iG, iB;
@@ -2707,40 +2917,34 @@ fill_inverse_cmap_rgb (QuantizeObj *quantobj,
   int  colorlist[MAXNUMCOLORS];
   int  numcolors;                /* number of candidate colors */
   /* This array holds the actually closest colormap index for each cell. */
-  int  bestcolor[BOX_R_ELEMS * BOX_G_ELEMS * BOX_B_ELEMS] = { 0, };
-
-  /* Convert cell coordinates to update box id */
-  R >>= BOX_R_LOG;
-  G >>= BOX_G_LOG;
-  B >>= BOX_B_LOG;
+  int  bestcolor[PRECALC_BOX_R_ELEMS * PRECALC_BOX_G_ELEMS * PRECALC_BOX_B_ELEMS];
 
   /* Compute true coordinates of update box's origin corner.
    * Actually we compute the coordinates of the center of the corner
    * histogram cell, which are the lower bounds of the volume we care about.
    */
-  minR = (R << BOX_R_SHIFT) + ((1 << R_SHIFT) >> 1);
-  minG = (G << BOX_G_SHIFT) + ((1 << G_SHIFT) >> 1);
-  minB = (B << BOX_B_SHIFT) + ((1 << B_SHIFT) >> 1);
+  minR = (R << R_SHIFT) + ((1 << R_SHIFT) >> 1);
+  minG = (G << G_SHIFT) + ((1 << G_SHIFT) >> 1);
+  minB = (B << B_SHIFT) + ((1 << B_SHIFT) >> 1);
 
   /* Determine which colormap entries are close enough to be candidates
    * for the nearest entry to some cell in the update box.
    */
-  numcolors = find_nearby_colors (quantobj, minR, minG, minB, colorlist);
+  numcolors = find_nearby_colors (quantobj, minR, minG, minB,
+                                  boxRlog, boxGlog, boxBlog, colorlist);
 
   /* Determine the actually nearest colors. */
-  find_best_colors (quantobj, minR, minG, minB, numcolors, colorlist,
+  find_best_colors (quantobj, minR, minG, minB,
+                    boxRlog, boxGlog, boxBlog, numcolors, colorlist,
                     bestcolor);
 
   /* Save the best color numbers (plus 1) in the main cache array */
-  R <<= BOX_R_LOG;              /* convert id back to base cell indexes */
-  G <<= BOX_G_LOG;
-  B <<= BOX_B_LOG;
   cptr = bestcolor;
-  for (iR = 0; iR < BOX_R_ELEMS; iR++)
+  for (iR = 0; iR < (1 << boxRlog); iR++)
     {
-      for (iG = 0; iG < BOX_G_ELEMS; iG++)
+      for (iG = 0; iG < (1 << boxGlog); iG++)
         {
-          for (iB = 0; iB < BOX_B_ELEMS; iB++)
+          for (iB = 0; iB < (1 << boxBlog); iB++)
             {
               *HIST_LIN (histogram, R + iR, G + iG, B + iB) = (*cptr++) + 1;
             }
@@ -2749,6 +2953,73 @@ fill_inverse_cmap_rgb (QuantizeObj *quantobj,
 }
 
 
+static void
+fill_inverse_cmap_rgb (QuantizeObj *quantobj,
+                       CFHistogram  histogram,
+                       int          R,
+                       int          G,
+                       int          B)
+/* Fill the inverse-colormap entries in the update box that contains */
+/* histogram cell R/G/B.  (Only that one cell MUST be filled, but */
+/* we can fill as many others as we wish.) */
+{
+  /* Convert cell coordinates to the base cell of the update box */
+  R = (R >> BOX_R_LOG) << BOX_R_LOG;
+  G = (G >> BOX_G_LOG) << BOX_G_LOG;
+  B = (B >> BOX_B_LOG) << BOX_B_LOG;
+
+  fill_inverse_cmap_rgb_box (quantobj, histogram, R, G, B,
+                             BOX_R_LOG, BOX_G_LOG, BOX_B_LOG);
+}
+
+
+static void
+fill_inverse_cmap_rgb_slab (gpointer     slab,
+                            QuantizeObj *quantobj)
+/* Fill all update boxes starting at red cell slab - 1 (offset by one */
+/* because thread pool data must not be NULL). */
+{
+  int R = GPOINTER_TO_INT (slab) - 1;
+  int G, B;
+
+  for (G = 0; G < HIST_G_ELEMS; G += PRECALC_BOX_G_ELEMS)
+    for (B = 0; B < HIST_B_ELEMS; B += PRECALC_BOX_B_ELEMS)
+      fill_inverse_cmap_rgb_box (quantobj, quantobj->histogram, R, G, B,
+                                 PRECALC_BOX_R_LOG,
+                                 PRECALC_BOX_G_LOG,
+                                 PRECALC_BOX_B_LOG);
+}
+
+
+static void
+fill_inverse_cmap_rgb_all (QuantizeObj *quantobj)
+/* Fill the whole inverse colormap, one red slab per thread pool job. */
+{
+  gint n_threads;
+  gint R;
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  if (n_threads > 1)
+    {
+      GThreadPool *pool;
+
+      pool = g_thread_pool_new ((GFunc) fill_inverse_cmap_rgb_slab, quantobj,
+                                n_threads, FALSE, NULL);
+
+      for (R = 0; R < HIST_R_ELEMS; R += PRECALC_BOX_R_ELEMS)
+        g_thread_pool_push (pool, GINT_TO_POINTER (R + 1), NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (R = 0; R < HIST_R_ELEMS; R += PRECALC_BOX_R_ELEMS)
+        fill_inverse_cmap_rgb_slab (GINT_TO_POINTER (R + 1), quantobj);
+    }
+}
+
+
 /*  This is pass 1  */
 
 static void
@@ -3885,8 +4156,6 @@ median_cut_pass2_rgb_init (QuantizeObj *quantobj)
 {
   int i;
 
-  zero_histogram_rgb (quantobj->histogram);
-
   /* Mark all indices as currently unused */
   memset (quantobj->index_used_count, 0, 256 * sizeof (unsigned long));
 
@@ -3900,15 +4169,26 @@ median_cut_pass2_rgb_init (QuantizeObj *quantobj)
                             &quantobj->clin[i].green,
                             &quantobj->clin[i].blue);
     }
+
+  /* Fill the whole inverse colormap now, so the pass2 routines only
+   * ever read it and layers can be dithered concurrently.
+   */
+  fill_inverse_cmap_rgb_all (quantobj);
 }
 
 static void
 median_cut_pass2_gray_init (QuantizeObj *quantobj)
 {
+  int i;
+
   zero_histogram_gray (quantobj->histogram);
 
   /* Mark all indices as currently unused */
   memset (quantobj->index_used_count, 0, 256 * sizeof (unsigned long));
+
+  /* See median_cut_pass2_rgb_init() */
+  for (i = 0; i < 256; i++)
+    fill_inverse_cmap_gray (quantobj, quantobj->histogram, i);
 }
 
 static void
@@ -4287,6 +4567,89 @@ median_cut_pass2_fs_dither_rgb (QuantizeObj *quantobj,
 }
 
 
+static void
+quantize_layer_job (QuantizeJob *job,
+                    gpointer     data)
+{
+  job->quantobj->second_pass (job->quantobj, job->layer, job->new_buffer);
+
+  g_async_queue_push (job->done, job);
+}
+
+/*  Runs the second pass on all @jobs.  With more than one thread,
+ *  every layer is dithered by its own private copy of @quantobj so
+ *  the usage counts don't race; the inverse colormap they share has
+ *  been filled completely by second_pass_init and is only read.
+ */
+static void
+quantize_layers (QuantizeObj *quantobj,
+                 GPtrArray   *jobs)
+{
+  gint n_threads;
+  gint i, j;
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  quantobj->n_layers = jobs->len;
+
+  if (n_threads > 1 && jobs->len > 1)
+    {
+      GThreadPool *pool;
+      GAsyncQueue *done = g_async_queue_new ();
+
+      pool = g_thread_pool_new ((GFunc) quantize_layer_job, NULL,
+                                MIN (n_threads, jobs->len), FALSE, NULL);
+
+      for (i = 0; i < jobs->len; i++)
+        {
+          QuantizeJob *job = g_ptr_array_index (jobs, i);
+
+          job->quantobj = g_memdup (quantobj, sizeof (QuantizeObj));
+          job->done     = done;
+
+          job->quantobj->progress = NULL;
+          memset (job->quantobj->index_used_count, 0,
+                  256 * sizeof (unsigned long));
+
+          g_thread_pool_push (pool, job, NULL);
+        }
+
+      for (i = 0; i < jobs->len; i++)
+        {
+          g_async_queue_pop (done);
+
+          if (quantobj->progress)
+            gimp_progress_set_value (quantobj->progress,
+                                     (gdouble) (i + 1) / jobs->len);
+        }
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+
+      g_async_queue_unref (done);
+
+      for (i = 0; i < jobs->len; i++)
+        {
+          QuantizeJob *job = g_ptr_array_index (jobs, i);
+
+          for (j = 0; j < 256; j++)
+            quantobj->index_used_count[j] += job->quantobj->index_used_count[j];
+
+          g_free (job->quantobj);
+        }
+    }
+  else
+    {
+      for (i = 0; i < jobs->len; i++)
+        {
+          QuantizeJob *job = g_ptr_array_index (jobs, i);
+
+          quantobj->nth_layer = i;
+          quantobj->second_pass (quantobj, job->layer, job->new_buffer);
+        }
+    }
+}
+
+
 static void
 delete_median_cut (QuantizeObj *quantobj)
 {
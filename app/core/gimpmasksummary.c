@@ -0,0 +1,497 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * gimpmasksummary.c
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <gegl.h>
+
+#include "core-types.h"
+
+#include "gimpmasksummary.h"
+
+
+typedef enum
+{
+  MASK_TILE_DIRTY,
+  MASK_TILE_EMPTY,
+  MASK_TILE_FULL,
+  MASK_TILE_PARTIAL
+} MaskTileState;
+
+typedef struct
+{
+  MaskTileState state;
+  guint         serial;   /*  bumped on every change to the tile     */
+  gint          x1, y1;   /*  bounds of the non-zero pixels, for     */
+  gint          x2, y2;   /*  partial tiles, in buffer coordinates   */
+} MaskTile;
+
+struct _GimpMaskSummary
+{
+  GeglBuffer    *buffer;
+  gulong         changed_handler;
+
+  GeglRectangle  extent;
+  gint           tile_width;
+  gint           tile_height;
+  gint           n_cols;
+  gint           n_rows;
+
+  /*  the tiles and n_dirty are written from whatever thread writes to
+   *  the buffer, so they are protected by the mutex
+   */
+  GMutex         mutex;
+  MaskTile      *tiles;
+  gint           n_dirty;
+
+  gfloat        *data;
+};
+
+
+static void   gimp_mask_summary_buffer_changed (GeglBuffer          *buffer,
+                                                const GeglRectangle *rect,
+                                                GimpMaskSummary     *summary);
+static void   gimp_mask_summary_tile_rect      (GimpMaskSummary     *summary,
+                                                gint                 index,
+                                                GeglRectangle       *rect);
+static void   gimp_mask_summary_scan_tile      (GimpMaskSummary     *summary,
+                                                gint                 index,
+                                                MaskTile            *result);
+static void   gimp_mask_summary_validate       (GimpMaskSummary     *summary);
+
+
+/*  public functions  */
+
+GimpMaskSummary *
+gimp_mask_summary_new (GeglBuffer *buffer)
+{
+  GimpMaskSummary *summary;
+  gint             grid_x;
+  gint             grid_y;
+  gint             i;
+
+  g_return_val_if_fail (GEGL_IS_BUFFER (buffer), NULL);
+
+  summary = g_slice_new0 (GimpMaskSummary);
+
+  summary->buffer = g_object_ref (buffer);
+  summary->extent = *gegl_buffer_get_extent (buffer);
+
+  g_object_get (buffer,
+                "tile-width",  &summary->tile_width,
+                "tile-height", &summary->tile_height,
+                NULL);
+
+  grid_x = summary->extent.x / summary->tile_width  * summary->tile_width;
+  grid_y = summary->extent.y / summary->tile_height * summary->tile_height;
+
+  if (summary->extent.x < grid_x)
+    grid_x -= summary->tile_width;
+
+  if (summary->extent.y < grid_y)
+    grid_y -= summary->tile_height;
+
+  summary->extent.width  += summary->extent.x - grid_x;
+  summary->extent.height += summary->extent.y - grid_y;
+  summary->extent.x       = grid_x;
+  summary->extent.y       = grid_y;
+
+  summary->n_cols = ((summary->extent.width + summary->tile_width - 1) /
+                     summary->tile_width);
+  summary->n_rows = ((summary->extent.height + summary->tile_height - 1) /
+                     summary->tile_height);
+
+  summary->tiles   = g_new0 (MaskTile, summary->n_cols * summary->n_rows);
+  summary->n_dirty = summary->n_cols * summary->n_rows;
+
+  for (i = 0; i < summary->n_dirty; i++)
+    summary->tiles[i].state = MASK_TILE_DIRTY;
+
+  summary->data = g_new (gfloat, summary->tile_width * summary->tile_height);
+
+  g_mutex_init (&summary->mutex);
+
+  summary->changed_handler =
+    gegl_buffer_signal_connect (buffer, "changed",
+                                G_CALLBACK (gimp_mask_summary_buffer_changed),
+                                summary);
+
+  return summary;
+}
+
+void
+gimp_mask_summary_free (GimpMaskSummary *summary)
+{
+  g_return_if_fail (summary != NULL);
+
+  g_signal_handler_disconnect (summary->buffer, summary->changed_handler);
+  g_object_unref (summary->buffer);
+
+  g_mutex_clear (&summary->mutex);
+
+  g_free (summary->tiles);
+  g_free (summary->data);
+
+  g_slice_free (GimpMaskSummary, summary);
+}
+
+GeglBuffer *
+gimp_mask_summary_get_buffer (GimpMaskSummary *summary)
+{
+  g_return_val_if_fail (summary != NULL, NULL);
+
+  return summary->buffer;
+}
+
+/*  Same semantics as gimp_gegl_mask_bounds(), only that it scans
+ *  nothing but the tiles that changed since the last query.
+ */
+gboolean
+gimp_mask_summary_bounds (GimpMaskSummary *summary,
+                          gint            *x1,
+                          gint            *y1,
+                          gint            *x2,
+                          gint            *y2)
+{
+  const GeglRectangle *extent;
+  gint                 tx1, ty1, tx2, ty2;
+  gint                 i;
+
+  g_return_val_if_fail (summary != NULL, FALSE);
+  g_return_val_if_fail (x1 != NULL, FALSE);
+  g_return_val_if_fail (y1 != NULL, FALSE);
+  g_return_val_if_fail (x2 != NULL, FALSE);
+  g_return_val_if_fail (y2 != NULL, FALSE);
+
+  gimp_mask_summary_validate (summary);
+
+  tx1 = G_MAXINT;
+  ty1 = G_MAXINT;
+  tx2 = G_MININT;
+  ty2 = G_MININT;
+
+  g_mutex_lock (&summary->mutex);
+
+  for (i = 0; i < summary->n_cols * summary->n_rows; i++)
+    {
+      const MaskTile *tile = &summary->tiles[i];
+      GeglRectangle   rect;
+
+      switch (tile->state)
+        {
+        case MASK_TILE_EMPTY:
+          break;
+
+        case MASK_TILE_PARTIAL:
+          tx1 = MIN (tx1, tile->x1);
+          ty1 = MIN (ty1, tile->y1);
+          tx2 = MAX (tx2, tile->x2);
+          ty2 = MAX (ty2, tile->y2);
+          break;
+
+        case MASK_TILE_FULL:
+        case MASK_TILE_DIRTY:
+          /*  a tile that got dirty again since we validated can only be
+           *  assumed to be covered
+           */
+          gimp_mask_summary_tile_rect (summary, i, &rect);
+
+          tx1 = MIN (tx1, rect.x);
+          ty1 = MIN (ty1, rect.y);
+          tx2 = MAX (tx2, rect.x + rect.width);
+          ty2 = MAX (ty2, rect.y + rect.height);
+          break;
+        }
+    }
+
+  g_mutex_unlock (&summary->mutex);
+
+  extent = gegl_buffer_get_extent (summary->buffer);
+
+  if (tx1 > tx2)
+    {
+      *x1 = extent->x;
+      *y1 = extent->y;
+      *x2 = extent->x + extent->width;
+      *y2 = extent->y + extent->height;
+
+      return FALSE;
+    }
+
+  *x1 = tx1;
+  *y1 = ty1;
+  *x2 = tx2;
+  *y2 = ty2;
+
+  return TRUE;
+}
+
+gboolean
+gimp_mask_summary_is_empty (GimpMaskSummary *summary)
+{
+  gboolean empty = TRUE;
+  gint     i;
+
+  g_return_val_if_fail (summary != NULL, FALSE);
+
+  /*  any tile we already know to be non-empty answers the question
+   *  without scanning the dirty ones
+   */
+  g_mutex_lock (&summary->mutex);
+
+  for (i = 0; i < summary->n_cols * summary->n_rows; i++)
+    {
+      MaskTileState state = summary->tiles[i].state;
+
+      if (state == MASK_TILE_FULL || state == MASK_TILE_PARTIAL)
+        {
+          g_mutex_unlock (&summary->mutex);
+
+          return FALSE;
+        }
+    }
+
+  g_mutex_unlock (&summary->mutex);
+
+  gimp_mask_summary_validate (summary);
+
+  g_mutex_lock (&summary->mutex);
+
+  for (i = 0; empty && i < summary->n_cols * summary->n_rows; i++)
+    empty = (summary->tiles[i].state == MASK_TILE_EMPTY);
+
+  g_mutex_unlock (&summary->mutex);
+
+  return empty;
+}
+
+gboolean
+gimp_mask_summary_is_full (GimpMaskSummary *summary)
+{
+  gboolean full = TRUE;
+  gint     i;
+
+  g_return_val_if_fail (summary != NULL, FALSE);
+
+  g_mutex_lock (&summary->mutex);
+
+  for (i = 0; i < summary->n_cols * summary->n_rows; i++)
+    {
+      MaskTileState state = summary->tiles[i].state;
+
+      if (state == MASK_TILE_EMPTY || state == MASK_TILE_PARTIAL)
+        {
+          g_mutex_unlock (&summary->mutex);
+
+          return FALSE;
+        }
+    }
+
+  g_mutex_unlock (&summary->mutex);
+
+  gimp_mask_summary_validate (summary);
+
+  g_mutex_lock (&summary->mutex);
+
+  for (i = 0; full && i < summary->n_cols * summary->n_rows; i++)
+    full = (summary->tiles[i].state == MASK_TILE_FULL);
+
+  g_mutex_unlock (&summary->mutex);
+
+  return full;
+}
+
+gsize
+gimp_mask_summary_get_memsize (GimpMaskSummary *summary)
+{
+  g_return_val_if_fail (summary != NULL, 0);
+
+  return (sizeof (GimpMaskSummary) +
+          sizeof (MaskTile) * summary->n_cols * summary->n_rows +
+          sizeof (gfloat) * summary->tile_width * summary->tile_height);
+}
+
+
+/*  private functions  */
+
+static void
+gimp_mask_summary_buffer_changed (GeglBuffer          *buffer,
+                                  const GeglRectangle *rect,
+                                  GimpMaskSummary     *summary)
+{
+  gint col1, row1, col2, row2;
+  gint col, row;
+
+  col1 = (rect->x - summary->extent.x) / summary->tile_width;
+  row1 = (rect->y - summary->extent.y) / summary->tile_height;
+  col2 = ((rect->x + rect->width  - 1 - summary->extent.x) /
+          summary->tile_width);
+  row2 = ((rect->y + rect->height - 1 - summary->extent.y) /
+          summary->tile_height);
+
+  col1 = MAX (col1, 0);
+  row1 = MAX (row1, 0);
+  col2 = MIN (col2, summary->n_cols - 1);
+  row2 = MIN (row2, summary->n_rows - 1);
+
+  g_mutex_lock (&summary->mutex);
+
+  for (row = row1; row <= row2; row++)
+    {
+      for (col = col1; col <= col2; col++)
+        {
+          MaskTile *tile = &summary->tiles[row * summary->n_cols + col];
+
+          if (tile->state != MASK_TILE_DIRTY)
+            {
+              tile->state = MASK_TILE_DIRTY;
+              summary->n_dirty++;
+            }
+
+          tile->serial++;
+        }
+    }
+
+  g_mutex_unlock (&summary->mutex);
+}
+
+static void
+gimp_mask_summary_tile_rect (GimpMaskSummary *summary,
+                             gint             index,
+                             GeglRectangle   *rect)
+{
+  gegl_rectangle_intersect (rect,
+                            GEGL_RECTANGLE (summary->extent.x +
+                                            (index % summary->n_cols) *
+                                            summary->tile_width,
+                                            summary->extent.y +
+                                            (index / summary->n_cols) *
+                                            summary->tile_height,
+                                            summary->tile_width,
+                                            summary->tile_height),
+                            gegl_buffer_get_extent (summary->buffer));
+}
+
+static void
+gimp_mask_summary_scan_tile (GimpMaskSummary *summary,
+                             gint             index,
+                             MaskTile        *result)
+{
+  GeglRectangle  rect;
+  const gfloat  *data;
+  gboolean       full = TRUE;
+  gint           tx1  = G_MAXINT;
+  gint           tx2  = G_MININT;
+  gint           ty1  = G_MAXINT;
+  gint           ty2  = G_MININT;
+  gint           x, y;
+
+  gimp_mask_summary_tile_rect (summary, index, &rect);
+
+  result->state = MASK_TILE_EMPTY;
+
+  if (rect.width < 1 || rect.height < 1)
+    return;
+
+  gegl_buffer_get (summary->buffer, &rect, 1.0, babl_format ("Y float"),
+                   summary->data, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  for (y = 0, data = summary->data; y < rect.height; y++, data += rect.width)
+    {
+      gint minx = -1;
+      gint maxx = -1;
+
+      for (x = 0; x < rect.width; x++)
+        {
+          if (data[x])
+            {
+              if (minx < 0)
+                minx = x;
+
+              maxx = x;
+            }
+
+          if (data[x] != 1.0)
+            full = FALSE;
+        }
+
+      if (minx >= 0)
+        {
+          tx1 = MIN (tx1, minx);
+          tx2 = MAX (tx2, maxx);
+
+          if (ty1 == G_MAXINT)
+            ty1 = y;
+
+          ty2 = y;
+        }
+    }
+
+  if (full)
+    {
+      result->state = MASK_TILE_FULL;
+    }
+  else if (ty1 != G_MAXINT)
+    {
+      result->state = MASK_TILE_PARTIAL;
+      result->x1    = rect.x + tx1;
+      result->y1    = rect.y + ty1;
+      result->x2    = rect.x + tx2 + 1;
+      result->y2    = rect.y + ty2 + 1;
+    }
+}
+
+/*  Rescans the dirty tiles.  The buffer is read with the mutex
+ *  released, so a tile that changes again meanwhile just stays dirty.
+ */
+static void
+gimp_mask_summary_validate (GimpMaskSummary *summary)
+{
+  gint i;
+
+  g_mutex_lock (&summary->mutex);
+
+  for (i = 0; summary->n_dirty > 0 && i < summary->n_cols * summary->n_rows; i++)
+    {
+      MaskTile *tile = &summary->tiles[i];
+      MaskTile  result;
+      guint     serial;
+
+      if (tile->state != MASK_TILE_DIRTY)
+        continue;
+
+      serial = tile->serial;
+
+      g_mutex_unlock (&summary->mutex);
+
+      gimp_mask_summary_scan_tile (summary, i, &result);
+
+      g_mutex_lock (&summary->mutex);
+
+      if (tile->serial == serial)
+        {
+          result.serial = serial;
+
+          *tile = result;
+          summary->n_dirty--;
+        }
+    }
+
+  g_mutex_unlock (&summary->mutex);
+}
@@ -0,0 +1,46 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * gimpmasksummary.h
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GIMP_MASK_SUMMARY_H__
+#define __GIMP_MASK_SUMMARY_H__
+
+
+/*  Keeps track of which tiles of a mask buffer are empty, full or
+ *  partially covered, and of the bounds of the partial ones.  Tiles
+ *  are marked dirty when the buffer emits "changed", and are only
+ *  looked at again when a query needs them.
+ */
+
+GimpMaskSummary * gimp_mask_summary_new         (GeglBuffer      *buffer);
+void              gimp_mask_summary_free        (GimpMaskSummary *summary);
+
+GeglBuffer      * gimp_mask_summary_get_buffer  (GimpMaskSummary *summary);
+
+gboolean          gimp_mask_summary_bounds      (GimpMaskSummary *summary,
+                                                 gint            *x1,
+                                                 gint            *y1,
+                                                 gint            *x2,
+                                                 gint            *y2);
+gboolean          gimp_mask_summary_is_empty    (GimpMaskSummary *summary);
+gboolean          gimp_mask_summary_is_full     (GimpMaskSummary *summary);
+
+gsize             gimp_mask_summary_get_memsize (GimpMaskSummary *summary);
+
+
+#endif  /*  __GIMP_MASK_SUMMARY_H__  */
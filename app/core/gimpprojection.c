@@ -106,6 +106,7 @@ static gboolean    gimp_projection_chunk_render_callback (gpointer         data)
 static void        gimp_projection_chunk_render_init     (GimpProjection  *proj);
 static gboolean    gimp_projection_chunk_render_iteration(GimpProjection  *proj);
 static gboolean    gimp_projection_chunk_render_next_area(GimpProjection  *proj);
+static void        gimp_projection_chunk_render_requeue  (GimpProjection  *proj);
 static void        gimp_projection_paint_area            (GimpProjection  *proj,
                                                           gboolean         now,
                                                           gint             x,
@@ -429,6 +430,40 @@ gimp_projection_flush_now (GimpProjection *proj)
   gimp_projection_flush_whenever (proj, TRUE);
 }
 
+/*  Makes the chunk renderer start with the parts of the update areas
+ *  that intersect the given rectangle, usually what a display shows,
+ *  so a large invalidation (like a filter preview on a big image)
+ *  becomes visible first where the user is looking.
+ */
+void
+gimp_projection_set_priority_rect (GimpProjection *proj,
+                                   gint            x,
+                                   gint            y,
+                                   gint            w,
+                                   gint            h)
+{
+  gint off_x, off_y;
+
+  g_return_if_fail (GIMP_IS_PROJECTION (proj));
+
+  /*  same coordinate conversion as in add_update_area()  */
+  gimp_projectable_get_offset (proj->projectable, &off_x, &off_y);
+
+  proj->priority_rect.x      = x - off_x;
+  proj->priority_rect.y      = y - off_y;
+  proj->priority_rect.width  = MAX (w, 0);
+  proj->priority_rect.height = MAX (h, 0);
+
+  /*  if we are in the middle of some other area, put it back and
+   *  continue with the new priority
+   */
+  if (proj->chunk_render.running)
+    {
+      gimp_projection_chunk_render_requeue (proj);
+      gimp_projection_chunk_render_next_area (proj);
+    }
+}
+
 void
 gimp_projection_finish_draw (GimpProjection *proj)
 {
@@ -618,17 +653,7 @@ gimp_projection_chunk_render_init (GimpProjection *proj)
    */
   if (proj->chunk_render.running)
     {
-      GimpArea *area =
-        gimp_area_new (proj->chunk_render.base_x,
-                       proj->chunk_render.y,
-                       proj->chunk_render.base_x + proj->chunk_render.width,
-                       proj->chunk_render.y + (proj->chunk_render.height -
-                                               (proj->chunk_render.y -
-                                                proj->chunk_render.base_y)));
-
-      proj->chunk_render.update_areas =
-        gimp_area_list_process (proj->chunk_render.update_areas, area);
-
+      gimp_projection_chunk_render_requeue (proj);
       gimp_projection_chunk_render_next_area (proj);
     }
   else
@@ -709,15 +734,72 @@ gimp_projection_chunk_render_iteration (GimpProjection *proj)
 static gboolean
 gimp_projection_chunk_render_next_area (GimpProjection *proj)
 {
-  GimpArea *area;
+  GimpArea      *area     = NULL;
+  GeglRectangle *priority = &proj->priority_rect;
+  GSList        *list;
 
   if (! proj->chunk_render.update_areas)
     return FALSE;
 
-  area = proj->chunk_render.update_areas->data;
+  /*  prefer an area that intersects the priority rect  */
+  if (priority->width > 0 && priority->height > 0)
+    {
+      for (list = proj->chunk_render.update_areas;
+           list;
+           list = g_slist_next (list))
+        {
+          GimpArea *this = list->data;
 
-  proj->chunk_render.update_areas =
-    g_slist_remove (proj->chunk_render.update_areas, area);
+          if (this->x1 < priority->x + priority->width  &&
+              this->x2 > priority->x                    &&
+              this->y1 < priority->y + priority->height &&
+              this->y2 > priority->y)
+            {
+              area = this;
+              break;
+            }
+        }
+    }
+
+  if (area)
+    {
+      gint x1 = MAX (area->x1, priority->x);
+      gint y1 = MAX (area->y1, priority->y);
+      gint x2 = MIN (area->x2, priority->x + priority->width);
+      gint y2 = MIN (area->y2, priority->y + priority->height);
+
+      proj->chunk_render.update_areas =
+        g_slist_remove (proj->chunk_render.update_areas, area);
+
+      /*  render the intersection now and queue what is left of the
+       *  area as up to four bands around it, without merging them
+       *  back into one
+       */
+#define QUEUE_REST(ax1, ay1, ax2, ay2)                                  \
+      if ((ax1) < (ax2) && (ay1) < (ay2))                               \
+        proj->chunk_render.update_areas =                               \
+          g_slist_append (proj->chunk_render.update_areas,              \
+                          gimp_area_new ((ax1), (ay1), (ax2), (ay2)));
+
+      QUEUE_REST (area->x1, area->y1, area->x2, y1);
+      QUEUE_REST (area->x1, y2,       area->x2, area->y2);
+      QUEUE_REST (area->x1, y1,       x1,       y2);
+      QUEUE_REST (x2,       y1,       area->x2, y2);
+
+#undef QUEUE_REST
+
+      area->x1 = x1;
+      area->y1 = y1;
+      area->x2 = x2;
+      area->y2 = y2;
+    }
+  else
+    {
+      area = proj->chunk_render.update_areas->data;
+
+      proj->chunk_render.update_areas =
+        g_slist_remove (proj->chunk_render.update_areas, area);
+    }
 
   proj->chunk_render.x      = proj->chunk_render.base_x = area->x1;
   proj->chunk_render.y      = proj->chunk_render.base_y = area->y1;
@@ -729,6 +811,27 @@ gimp_projection_chunk_render_next_area (GimpProjection *proj)
   return TRUE;
 }
 
+/*  Puts the unrendered rest of the area the chunk renderer is working
+ *  on back into its list of update areas.
+ */
+static void
+gimp_projection_chunk_render_requeue (GimpProjection *proj)
+{
+  GimpArea *area;
+
+  if (proj->chunk_render.y >=
+      proj->chunk_render.base_y + proj->chunk_render.height)
+    return;
+
+  area = gimp_area_new (proj->chunk_render.base_x,
+                        proj->chunk_render.y,
+                        proj->chunk_render.base_x + proj->chunk_render.width,
+                        proj->chunk_render.base_y + proj->chunk_render.height);
+
+  proj->chunk_render.update_areas =
+    gimp_area_list_process (proj->chunk_render.update_areas, area);
+}
+
 static void
 gimp_projection_paint_area (GimpProjection *proj,
                             gboolean        now,
@@ -60,6 +60,7 @@ struct _GimpProjection
   GSList                    *update_areas;
   GimpProjectionChunkRender  chunk_render;
   guint                      chunk_render_idle_id;
+  GeglRectangle              priority_rect;  /*  rendered first  */
 
   gboolean                   invalidate_preview;
 };
@@ -85,6 +86,13 @@ void             gimp_projection_flush            (GimpProjection    *proj);
 void             gimp_projection_flush_now        (GimpProjection    *proj);
 void             gimp_projection_finish_draw      (GimpProjection    *proj);
 
+void             gimp_projection_set_priority_rect
+                                                  (GimpProjection    *proj,
+                                                   gint               x,
+                                                   gint               y,
+                                                   gint               w,
+                                                   gint               h);
+
 gint64           gimp_projection_estimate_memsize (GimpImageBaseType  type,
                                                    GimpPrecision      precision,
                                                    gint               width,
@@ -55,6 +55,83 @@ struct _GimpScanConvert
 };
 
 
+typedef struct
+{
+  gdouble x0, y0;
+  gdouble x1, y1;
+} ScanEdge;
+
+typedef struct
+{
+  cairo_path_data_type_t  type;       /* LINE_TO, CURVE_TO or CLOSE_PATH */
+  gint                    subpath;
+  GimpVector2             start;
+  GimpVector2             points[3];  /* a close ends at points[0] */
+} ScanElement;
+
+typedef struct
+{
+  gint                    first;      /* index of the first element */
+  gint                    n_elements;
+  gboolean                closed;
+  GimpVector2             start;
+} ScanSubpath;
+
+typedef struct
+{
+  GeglRectangle           rect;
+  GArray                 *items;      /* indices of edges or elements */
+  GArray                 *toggles;    /* y coordinates, see bin_edges() */
+  gboolean                inside;
+} ScanTile;
+
+typedef struct
+{
+  GimpScanConvert        *sc;
+  GeglBuffer             *buffer;
+  const Babl             *format;
+  gboolean                replace;
+  gboolean                antialias;
+  gdouble                 value;
+  guchar                  solid;
+
+  GeglRectangle           rect;
+  gint                    tile_width;
+  gint                    tile_height;
+  gint                    grid_x;
+  gint                    grid_y;
+  gint                    n_cols;
+  gint                    n_rows;
+  ScanTile               *tiles;
+
+  GArray                 *edges;      /* ScanEdge, when filling */
+  GArray                 *elements;   /* ScanElement, when stroking */
+  GArray                 *subpaths;   /* ScanSubpath, when stroking */
+} ScanRender;
+
+
+/*  local function prototypes  */
+
+static void   gimp_scan_convert_bin_edges      (ScanRender        *render,
+                                                gint               off_x,
+                                                gint               off_y);
+static void   gimp_scan_convert_add_edge       (ScanRender        *render,
+                                                const GimpVector2 *p0,
+                                                const GimpVector2 *p1);
+static void   gimp_scan_convert_bin_elements   (ScanRender        *render,
+                                                gint               off_x,
+                                                gint               off_y);
+static void   gimp_scan_convert_bin_element    (ScanRender        *render,
+                                                const ScanElement *element,
+                                                gint               n_points,
+                                                gdouble            reach,
+                                                gint               index);
+static gint   gimp_scan_convert_compare_ints   (gconstpointer      a,
+                                                gconstpointer      b);
+static void   gimp_scan_convert_render_tile    (ScanTile          *tile,
+                                                ScanRender        *render);
+
+
 /*  public functions  */
 
 /**
@@ -437,6 +514,11 @@ gimp_scan_convert_compose_value (GimpScanConvert *sc,
  * top of existing content or replacing it completely. The @value
  * specifies the opacity value to be used for the objects in the @sc.
  *
+ * The path is sorted into the tiles of @buffer once.  Tiles that are
+ * completely inside or outside a filled path are written without
+ * rasterizing, the others are rasterized in parallel, each against
+ * only the part of the path that can touch it.
+ *
  * You cannot add additional polygons after this command.
  */
 void
@@ -448,15 +530,13 @@ gimp_scan_convert_render_full (GimpScanConvert *sc,
                                gboolean         antialias,
                                gdouble          value)
 {
-  const Babl         *format;
-  GeglBufferIterator *iter;
-  GeglRectangle      *roi;
-  cairo_t            *cr;
-  cairo_surface_t    *surface;
-  cairo_path_t        path;
-  gint                bpp;
-  gint                x, y;
-  gint                width, height;
+  ScanRender  render = { 0, };
+  GPtrArray  *jobs;
+  gint        x, y;
+  gint        width, height;
+  gint        tile_width, tile_height;
+  gint        n_threads;
+  gint        i;
 
   g_return_if_fail (sc != NULL);
   g_return_if_fail (GEGL_IS_BUFFER (buffer));
@@ -472,76 +552,810 @@ gimp_scan_convert_render_full (GimpScanConvert *sc,
                                               &x, &y, &width, &height))
     return;
 
+  if (width < 1 || height < 1)
+    return;
+
+  g_object_get (buffer,
+                "tile-width",  &tile_width,
+                "tile-height", &tile_height,
+                NULL);
+
+  render.sc        = sc;
+  render.buffer    = buffer;
+  render.format    = babl_format ("Y u8");
+  render.antialias = antialias;
+  render.replace   = replace;
+  render.value     = value;
+
+  /*  this is what cairo stores for a solid source of alpha @value  */
+  render.solid = (guint) (CLAMP (value, 0.0, 1.0) * 65535.0 + 0.5) >> 8;
+
+  render.rect.x      = x;
+  render.rect.y      = y;
+  render.rect.width  = width;
+  render.rect.height = height;
+
+  render.tile_width  = tile_width;
+  render.tile_height = tile_height;
+  render.grid_x      = (x / tile_width)  * tile_width;
+  render.grid_y      = (y / tile_height) * tile_height;
+  render.n_cols      = (x + width  - render.grid_x + tile_width  - 1) / tile_width;
+  render.n_rows      = (y + height - render.grid_y + tile_height - 1) / tile_height;
+
+  render.tiles = g_new0 (ScanTile, render.n_cols * render.n_rows);
+
+  for (i = 0; i < render.n_cols * render.n_rows; i++)
+    {
+      ScanTile *tile = &render.tiles[i];
+
+      gimp_rectangle_intersect (render.grid_x + (i % render.n_cols) * tile_width,
+                                render.grid_y + (i / render.n_cols) * tile_height,
+                                tile_width, tile_height,
+                                x, y, width, height,
+                                &tile->rect.x, &tile->rect.y,
+                                &tile->rect.width, &tile->rect.height);
+    }
+
+  if (sc->do_stroke)
+    gimp_scan_convert_bin_elements (&render, off_x, off_y);
+  else
+    gimp_scan_convert_bin_edges (&render, off_x, off_y);
+
+  /*  untouched tiles are left alone, so clear them all up front  */
+  if (replace)
+    gegl_buffer_clear (buffer, &render.rect);
+
+  jobs = g_ptr_array_new ();
+
+  for (i = 0; i < render.n_cols * render.n_rows; i++)
+    {
+      ScanTile *tile = &render.tiles[i];
+
+      if (tile->inside || tile->items || tile->toggles)
+        g_ptr_array_add (jobs, tile);
+    }
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  if (n_threads > 1 && jobs->len > 1)
+    {
+      GThreadPool *pool;
+
+      pool = g_thread_pool_new ((GFunc) gimp_scan_convert_render_tile, &render,
+                                MIN (n_threads, jobs->len), FALSE, NULL);
+
+      for (i = 0; i < jobs->len; i++)
+        g_thread_pool_push (pool, g_ptr_array_index (jobs, i), NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (i = 0; i < jobs->len; i++)
+        gimp_scan_convert_render_tile (g_ptr_array_index (jobs, i), &render);
+    }
+
+  g_ptr_array_free (jobs, TRUE);
+
+  for (i = 0; i < render.n_cols * render.n_rows; i++)
+    {
+      ScanTile *tile = &render.tiles[i];
+
+      if (tile->items)
+        g_array_free (tile->items, TRUE);
+
+      if (tile->toggles)
+        g_array_free (tile->toggles, TRUE);
+    }
+
+  g_free (render.tiles);
+
+  if (render.edges)
+    g_array_free (render.edges, TRUE);
+
+  if (render.elements)
+    g_array_free (render.elements, TRUE);
+
+  if (render.subpaths)
+    g_array_free (render.subpaths, TRUE);
+}
+
+
+/*  private functions  */
+
+static inline gint
+gimp_scan_convert_column (ScanRender *render,
+                          gdouble     x)
+{
+  return (gint) floor ((x - render->grid_x) / render->tile_width);
+}
+
+static inline gint
+gimp_scan_convert_row (ScanRender *render,
+                       gdouble     y)
+{
+  return (gint) floor ((y - render->grid_y) / render->tile_height);
+}
+
+static void
+gimp_scan_convert_tile_add_item (ScanTile *tile,
+                                 gint      item)
+{
+  if (! tile->items)
+    tile->items = g_array_new (FALSE, FALSE, sizeof (gint));
+
+  g_array_append_val (tile->items, item);
+}
+
+/*  Flips the parity of the winding left of a tile at @y: a @y that is
+ *  already in the sorted @toggles cancels out, any other one gets
+ *  inserted.
+ */
+static void
+gimp_scan_convert_toggle (GArray  *toggles,
+                          gdouble  y)
+{
+  gint lo = 0;
+  gint hi = toggles->len;
+
+  while (lo < hi)
+    {
+      gint mid = (lo + hi) / 2;
+
+      if (g_array_index (toggles, gdouble, mid) < y)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  if (lo < toggles->len && g_array_index (toggles, gdouble, lo) == y)
+    g_array_remove_index (toggles, lo);
+  else
+    g_array_insert_val (toggles, lo, y);
+}
+
+/*  Bins the edges of the flattened path for an even-odd fill.
+ *
+ *  In every row of tiles, a tile gets the edges that cross it.  An
+ *  edge that lies completely left of a tile still flips inside and
+ *  outside for the scanlines it spans; for those the tile only keeps
+ *  the y coordinates where that parity changes, which it renders as a
+ *  few vertical edges along its left border.  A tile without edges of
+ *  its own is then either completely inside or completely outside.
+ */
+static void
+gimp_scan_convert_bin_edges (ScanRender *render,
+                             gint        off_x,
+                             gint        off_y)
+{
+  GimpScanConvert *sc = render->sc;
+  cairo_surface_t *surface;
+  cairo_t         *cr;
+  cairo_path_t     path;
+  cairo_path_t    *flat;
+  GimpVector2      start   = { 0.0, 0.0 };
+  GimpVector2      current = { 0.0, 0.0 };
+  GArray          *toggles;
+  gint             i, r, c;
+
+  /*  let cairo flatten the curves, with the same tolerance it uses
+   *  when filling
+   */
   path.status   = CAIRO_STATUS_SUCCESS;
   path.data     = (cairo_path_data_t *) sc->path_data->data;
   path.num_data = sc->path_data->len;
 
-  format = babl_format ("Y u8");
-  bpp    = babl_format_get_bytes_per_pixel (format);
+  surface = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+  cr = cairo_create (surface);
+
+  cairo_append_path (cr, &path);
+  flat = cairo_copy_path_flat (cr);
 
-  iter = gegl_buffer_iterator_new (buffer, NULL, 0, format,
-                                   GEGL_BUFFER_READWRITE, GEGL_ABYSS_NONE);
-  roi = &iter->roi[0];
+  cairo_destroy (cr);
+  cairo_surface_destroy (surface);
 
-  while (gegl_buffer_iterator_next (iter))
+  render->edges = g_array_new (FALSE, FALSE, sizeof (ScanEdge));
+
+  for (i = 0; i < flat->num_data; i += flat->data[i].header.length)
     {
-      guchar     *data    = iter->data[0];
-      guchar     *tmp_buf = NULL;
-      const gint  stride  = cairo_format_stride_for_width (CAIRO_FORMAT_A8,
-                                                           roi->width);
-
-      /*  cairo rowstrides are always multiples of 4, whereas
-       *  maskPR.rowstride can be anything, so to be able to create an
-       *  image surface, we maybe have to create our own temporary
-       *  buffer
-       */
-      if (roi->width * bpp != stride)
+      const cairo_path_data_t *data = &flat->data[i];
+      GimpVector2              point;
+
+      switch (data->header.type)
+        {
+        case CAIRO_PATH_MOVE_TO:
+          gimp_scan_convert_add_edge (render, &current, &start);
+
+          point.x = data[1].point.x - off_x;
+          point.y = data[1].point.y - off_y;
+
+          start   = point;
+          current = point;
+          break;
+
+        case CAIRO_PATH_LINE_TO:
+          point.x = data[1].point.x - off_x;
+          point.y = data[1].point.y - off_y;
+
+          gimp_scan_convert_add_edge (render, &current, &point);
+          current = point;
+          break;
+
+        case CAIRO_PATH_CLOSE_PATH:
+          gimp_scan_convert_add_edge (render, &current, &start);
+          current = start;
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  /*  fill implicitly closes the last subpath  */
+  gimp_scan_convert_add_edge (render, &current, &start);
+
+  cairo_path_destroy (flat);
+
+  /*  sweep every row of tiles from left to right, turning the parity
+   *  flips queued on each tile into the set valid for it
+   */
+  toggles = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  for (r = 0; r < render->n_rows; r++)
+    {
+      g_array_set_size (toggles, 0);
+
+      for (c = 0; c < render->n_cols; c++)
         {
-          tmp_buf = g_alloca (stride * roi->height);
+          ScanTile *tile = &render->tiles[r * render->n_cols + c];
+
+          if (tile->toggles)
+            {
+              for (i = 0; i < tile->toggles->len; i++)
+                gimp_scan_convert_toggle (toggles,
+                                          g_array_index (tile->toggles,
+                                                         gdouble, i));
+
+              g_array_free (tile->toggles, TRUE);
+              tile->toggles = NULL;
+            }
+
+          if (toggles->len > 0)
+            {
+              tile->toggles = g_array_sized_new (FALSE, FALSE,
+                                                 sizeof (gdouble),
+                                                 toggles->len);
+              g_array_append_vals (tile->toggles,
+                                   toggles->data, toggles->len);
+            }
 
-          if (! replace)
+          if (! tile->items                                           &&
+              toggles->len == 2                                       &&
+              g_array_index (toggles, gdouble, 0) == tile->rect.y     &&
+              g_array_index (toggles, gdouble, 1) == (tile->rect.y +
+                                                      tile->rect.height))
             {
-              const guchar *src  = data;
-              guchar       *dest = tmp_buf;
-              gint          i;
+              tile->inside = TRUE;
+            }
+        }
+    }
+
+  g_array_free (toggles, TRUE);
+}
+
+static void
+gimp_scan_convert_add_edge (ScanRender        *render,
+                            const GimpVector2 *p0,
+                            const GimpVector2 *p1)
+{
+  ScanEdge edge;
+  gdouble  y_min, y_max;
+  gint     r, r_first, r_last;
+
+  /*  horizontal edges never change the coverage  */
+  if (p0->y == p1->y)
+    return;
+
+  y_min = MIN (p0->y, p1->y);
+  y_max = MAX (p0->y, p1->y);
+
+  if (y_max <= render->rect.y ||
+      y_min >= render->rect.y + render->rect.height)
+    return;
+
+  edge.x0 = p0->x;
+  edge.y0 = p0->y;
+  edge.x1 = p1->x;
+  edge.y1 = p1->y;
+
+  g_array_append_val (render->edges, edge);
+
+  r_first = MAX (gimp_scan_convert_row (render, y_min), 0);
+  r_last  = MIN (gimp_scan_convert_row (render, y_max), render->n_rows - 1);
+
+  for (r = r_first; r <= r_last; r++)
+    {
+      ScanTile *row = &render->tiles[r * render->n_cols];
+      gdouble   ya  = MAX (y_min, row->rect.y);
+      gdouble   yb  = MIN (y_max, row->rect.y + row->rect.height);
+      gdouble   xa, xb;
+      gint      c, c_first, c_last;
+
+      if (ya >= yb)
+        continue;
+
+      /*  the horizontal extent of the part inside this row  */
+      xa = p0->x + (ya - p0->y) * (p1->x - p0->x) / (p1->y - p0->y);
+      xb = p0->x + (yb - p0->y) * (p1->x - p0->x) / (p1->y - p0->y);
+
+      c_first = gimp_scan_convert_column (render, MIN (xa, xb));
+      c_last  = gimp_scan_convert_column (render, MAX (xa, xb));
+
+      for (c = MAX (c_first, 0); c <= MIN (c_last, render->n_cols - 1); c++)
+        gimp_scan_convert_tile_add_item (&row[c], render->edges->len - 1);
+
+      /*  all tiles further right see this part of the edge as a flip
+       *  of the parity between ya and yb; queue it on the first one
+       */
+      c = MAX (c_last + 1, 0);
+
+      if (c < render->n_cols)
+        {
+          ScanTile *tile = &row[c];
+
+          if (! tile->toggles)
+            tile->toggles = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+          g_array_append_val (tile->toggles, ya);
+          g_array_append_val (tile->toggles, yb);
+        }
+    }
+}
+
+/*  Bins the path elements for stroking.  A tile gets every element
+ *  whose bounding box, grown by the farthest the stroke can reach from
+ *  its center line, overlaps it.
+ */
+static void
+gimp_scan_convert_bin_elements (ScanRender *render,
+                                gint        off_x,
+                                gint        off_y)
+{
+  GimpScanConvert *sc      = render->sc;
+  ScanSubpath     *subpath = NULL;
+  GimpVector2      start   = { 0.0, 0.0 };
+  GimpVector2      current = { 0.0, 0.0 };
+  gboolean         moved   = FALSE;
+  gdouble          reach;
+  gint             i;
 
-              for (i = 0; i < roi->height; i++)
+  reach = sc->width / 2.0 * MAX (sc->ratio_xy, 1.0);
+
+  if (sc->join == GIMP_JOIN_MITER)
+    reach *= MAX (sc->miter, G_SQRT2);
+  else
+    reach *= G_SQRT2;
+
+  /*  one more pixel for antialiasing  */
+  reach += 1.0;
+
+  render->elements = g_array_new (FALSE, FALSE, sizeof (ScanElement));
+  render->subpaths = g_array_new (FALSE, FALSE, sizeof (ScanSubpath));
+
+  for (i = 0; i < sc->path_data->len; )
+    {
+      const cairo_path_data_t *data = &g_array_index (sc->path_data,
+                                                      cairo_path_data_t, i);
+      ScanElement              element;
+      gint                     n_points = 0;
+      gint                     j;
+
+      i += data->header.length;
+
+      switch (data->header.type)
+        {
+        case CAIRO_PATH_MOVE_TO:
+          start.x = data[1].point.x - off_x;
+          start.y = data[1].point.y - off_y;
+
+          current = start;
+          subpath = NULL;
+          moved   = TRUE;
+          continue;
+
+        case CAIRO_PATH_LINE_TO:
+          n_points = 1;
+          break;
+
+        case CAIRO_PATH_CURVE_TO:
+          n_points = 3;
+          break;
+
+        case CAIRO_PATH_CLOSE_PATH:
+          /*  a lone move and close still gives a dot with round caps  */
+          if (! subpath && ! moved)
+            continue;
+          break;
+        }
+
+      moved = FALSE;
+
+      /*  cairo starts a new subpath at the current point when drawing
+       *  after a close or without a move
+       */
+      if (! subpath)
+        {
+          ScanSubpath new_subpath = { 0, };
+
+          new_subpath.first = render->elements->len;
+          new_subpath.start = current;
+
+          g_array_append_val (render->subpaths, new_subpath);
+          subpath = &g_array_index (render->subpaths, ScanSubpath,
+                                    render->subpaths->len - 1);
+
+          start = current;
+        }
+
+      element.type    = data->header.type;
+      element.subpath = render->subpaths->len - 1;
+      element.start   = current;
+
+      for (j = 0; j < n_points; j++)
+        {
+          element.points[j].x = data[1 + j].point.x - off_x;
+          element.points[j].y = data[1 + j].point.y - off_y;
+        }
+
+      if (data->header.type == CAIRO_PATH_CLOSE_PATH)
+        element.points[0] = start;
+
+      current = element.points[MAX (n_points, 1) - 1];
+
+      g_array_append_val (render->elements, element);
+      subpath->n_elements++;
+
+      if (data->header.type == CAIRO_PATH_CLOSE_PATH)
+        {
+          subpath->closed = TRUE;
+          subpath = NULL;
+        }
+
+      gimp_scan_convert_bin_element (render, &element, MAX (n_points, 1),
+                                     reach, render->elements->len - 1);
+    }
+}
+
+static void
+gimp_scan_convert_bin_element (ScanRender        *render,
+                               const ScanElement *element,
+                               gint               n_points,
+                               gdouble            reach,
+                               gint               index)
+{
+  gdouble x1 = element->start.x;
+  gdouble y1 = element->start.y;
+  gdouble x2 = element->start.x;
+  gdouble y2 = element->start.y;
+  gint    c_first, c_last;
+  gint    r_first, r_last;
+  gint    r, c;
+  gint    j;
+
+  for (j = 0; j < n_points; j++)
+    {
+      x1 = MIN (x1, element->points[j].x);
+      y1 = MIN (y1, element->points[j].y);
+      x2 = MAX (x2, element->points[j].x);
+      y2 = MAX (y2, element->points[j].y);
+    }
+
+  c_first = MAX (gimp_scan_convert_column (render, x1 - reach), 0);
+  c_last  = MIN (gimp_scan_convert_column (render, x2 + reach),
+                 render->n_cols - 1);
+  r_first = MAX (gimp_scan_convert_row (render, y1 - reach), 0);
+  r_last  = MIN (gimp_scan_convert_row (render, y2 + reach),
+                 render->n_rows - 1);
+
+  for (r = r_first; r <= r_last; r++)
+    for (c = c_first; c <= c_last; c++)
+      gimp_scan_convert_tile_add_item (&render->tiles[r * render->n_cols + c],
+                                       index);
+}
+
+static void
+gimp_scan_convert_append_element (cairo_t           *cr,
+                                  const ScanElement *element,
+                                  const ScanSubpath *subpath,
+                                  gboolean           whole)
+{
+  switch (element->type)
+    {
+    case CAIRO_PATH_LINE_TO:
+      cairo_line_to (cr, element->points[0].x, element->points[0].y);
+      break;
+
+    case CAIRO_PATH_CURVE_TO:
+      cairo_curve_to (cr,
+                      element->points[0].x, element->points[0].y,
+                      element->points[1].x, element->points[1].y,
+                      element->points[2].x, element->points[2].y);
+      break;
+
+    case CAIRO_PATH_CLOSE_PATH:
+      if (whole)
+        cairo_close_path (cr);
+      else
+        cairo_line_to (cr, subpath->start.x, subpath->start.y);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/*  Appends the elements a tile needs for stroking.  Besides the binned
+ *  elements this includes their direct neighbours, so the joins near
+ *  the tile are drawn as joins; the caps that now end the open runs
+ *  are too far away to reach into the tile.
+ */
+static void
+gimp_scan_convert_append_stroke (cairo_t    *cr,
+                                 ScanRender *render,
+                                 ScanTile   *tile)
+{
+  GArray *include;
+  gint    i;
+
+  include = g_array_sized_new (FALSE, FALSE, sizeof (gint),
+                               tile->items->len * 3);
+
+  for (i = 0; i < tile->items->len; i++)
+    {
+      gint               index   = g_array_index (tile->items, gint, i);
+      const ScanElement *element = &g_array_index (render->elements,
+                                                   ScanElement, index);
+      const ScanSubpath *subpath = &g_array_index (render->subpaths,
+                                                   ScanSubpath,
+                                                   element->subpath);
+      gint               last    = subpath->first + subpath->n_elements - 1;
+      gint               prev    = index - 1;
+      gint               next    = index + 1;
+
+      if (subpath->closed)
+        {
+          if (prev < subpath->first) prev = last;
+          if (next > last)           next = subpath->first;
+        }
+
+      if (prev >= subpath->first)
+        g_array_append_val (include, prev);
+
+      g_array_append_val (include, index);
+
+      if (next <= last)
+        g_array_append_val (include, next);
+    }
+
+  g_array_sort (include, gimp_scan_convert_compare_ints);
+
+  i = 0;
+
+  while (i < include->len)
+    {
+      const ScanElement *element;
+      const ScanSubpath *subpath;
+      gint               first;
+      gint               last;
+      gint               n_included = 0;
+      gint               j;
+
+      element = &g_array_index (render->elements, ScanElement,
+                                g_array_index (include, gint, i));
+      subpath = &g_array_index (render->subpaths, ScanSubpath,
+                                element->subpath);
+      first   = subpath->first;
+      last    = subpath->first + subpath->n_elements - 1;
+
+      /*  collect the marks of this subpath, dropping duplicates  */
+      for (j = i; j < include->len; j++)
+        {
+          gint index = g_array_index (include, gint, j);
+
+          if (index > last)
+            break;
+
+          if (j == i || index != g_array_index (include, gint, j - 1))
+            g_array_index (include, gint, i + n_included++) = index;
+        }
+
+      if (n_included == subpath->n_elements)
+        {
+          gint k;
+
+          cairo_move_to (cr, subpath->start.x, subpath->start.y);
+
+          for (k = first; k <= last; k++)
+            gimp_scan_convert_append_element (cr,
+                                              &g_array_index (render->elements,
+                                                              ScanElement, k),
+                                              subpath, TRUE);
+        }
+      else
+        {
+          gint *marks  = &g_array_index (include, gint, i);
+          gint  origin = 0;
+          gint  k;
+
+          /*  for a closed subpath, start at a gap so a run crossing
+           *  the end continues with the first elements
+           */
+          if (subpath->closed)
+            {
+              for (origin = 0; origin < n_included; origin++)
                 {
-                  memcpy (dest, src, roi->width * bpp);
+                  gint next = (origin + 1 < n_included ?
+                               marks[origin + 1] : marks[0] + subpath->n_elements);
 
-                  src  += roi->width * bpp;
-                  dest += stride;
+                  if (next != marks[origin] + 1)
+                    break;
                 }
+
+              origin = (origin + 1) % n_included;
+            }
+
+          for (k = 0; k < n_included; k++)
+            {
+              gint               index = marks[(origin + k) % n_included];
+              gint               prev  = marks[(origin + k + n_included - 1) %
+                                                 n_included];
+              const ScanElement *e     = &g_array_index (render->elements,
+                                                         ScanElement, index);
+
+              if (k == 0                                  ||
+                  (prev != index - 1                      &&
+                   ! (subpath->closed                     &&
+                      index == first && prev == last)))
+                {
+                  cairo_move_to (cr, e->start.x, e->start.y);
+                }
+
+              gimp_scan_convert_append_element (cr, e, subpath, FALSE);
             }
         }
 
-      surface = cairo_image_surface_create_for_data (tmp_buf ?
-                                                     tmp_buf : data,
-                                                     CAIRO_FORMAT_A8,
-                                                     roi->width, roi->height,
-                                                     stride);
+      i = j;
+    }
 
-      cairo_surface_set_device_offset (surface,
-                                       -off_x - roi->x,
-                                       -off_y - roi->y);
-      cr = cairo_create (surface);
-      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+  g_array_free (include, TRUE);
+}
 
-      if (replace)
+static gint
+gimp_scan_convert_compare_ints (gconstpointer a,
+                                gconstpointer b)
+{
+  return *(const gint *) a - *(const gint *) b;
+}
+
+/*  Appends the tile's edges for an even-odd fill.  Every edge becomes
+ *  a closed loop through a point right of the tile, where the extra
+ *  vertical edge can't affect any pixel of it; the parity flips from
+ *  edges left of the tile become vertical edges just left of it.
+ */
+static void
+gimp_scan_convert_append_fill (cairo_t    *cr,
+                               ScanRender *render,
+                               ScanTile   *tile)
+{
+  gdouble left  = tile->rect.x - 1;
+  gdouble right = tile->rect.x + tile->rect.width + 1;
+  gint    i;
+
+  if (tile->items)
+    {
+      for (i = 0; i < tile->items->len; i++)
         {
-          cairo_set_source_rgba (cr, 0, 0, 0, 0);
-          cairo_paint (cr);
+          const ScanEdge *edge = &g_array_index (render->edges, ScanEdge,
+                                                 g_array_index (tile->items,
+                                                                gint, i));
+
+          cairo_move_to (cr, edge->x0, edge->y0);
+          cairo_line_to (cr, edge->x1, edge->y1);
+          cairo_line_to (cr, right,    edge->y1);
+          cairo_line_to (cr, right,    edge->y0);
+          cairo_close_path (cr);
         }
+    }
+
+  if (tile->toggles)
+    {
+      for (i = 0; i + 1 < tile->toggles->len; i += 2)
+        {
+          gdouble y0 = g_array_index (tile->toggles, gdouble, i);
+          gdouble y1 = g_array_index (tile->toggles, gdouble, i + 1);
+
+          cairo_move_to (cr, left,  y0);
+          cairo_line_to (cr, left,  y1);
+          cairo_line_to (cr, right, y1);
+          cairo_line_to (cr, right, y0);
+          cairo_close_path (cr);
+        }
+    }
+}
+
+static void
+gimp_scan_convert_render_tile (ScanTile   *tile,
+                               ScanRender *render)
+{
+  GimpScanConvert     *sc     = render->sc;
+  const GeglRectangle *rect   = &tile->rect;
+  const gint           stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8,
+                                                               rect->width);
+  guchar              *data;
 
-      cairo_set_source_rgba (cr, 0, 0, 0, value);
-      cairo_append_path (cr, &path);
+  data = g_malloc (stride * rect->height);
 
-      cairo_set_antialias (cr, antialias ?
+  if (tile->inside)
+    {
+      memset (data, render->solid, stride * rect->height);
+    }
+  else
+    {
+      cairo_surface_t *surface;
+      cairo_t         *cr;
+
+      if (render->replace)
+        memset (data, 0, stride * rect->height);
+      else
+        gegl_buffer_get (render->buffer, rect, 1.0, render->format,
+                         data, stride, GEGL_ABYSS_NONE);
+
+      surface = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_A8,
+                                                     rect->width,
+                                                     rect->height,
+                                                     stride);
+
+      cairo_surface_set_device_offset (surface, -rect->x, -rect->y);
+      cr = cairo_create (surface);
+      cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+
+      cairo_set_source_rgba (cr, 0, 0, 0, render->value);
+
+      cairo_set_antialias (cr, render->antialias ?
                            CAIRO_ANTIALIAS_GRAY : CAIRO_ANTIALIAS_NONE);
       cairo_set_miter_limit (cr, sc->miter);
 
       if (sc->do_stroke)
         {
+          /*  the dash pattern depends on the length of the whole
+           *  subpath, so dashed strokes always get all of it
+           */
+          if (sc->dash_info)
+            {
+              gint i;
+
+              for (i = 0; i < render->subpaths->len; i++)
+                {
+                  const ScanSubpath *subpath;
+                  gint               k;
+
+                  subpath = &g_array_index (render->subpaths, ScanSubpath, i);
+
+                  cairo_move_to (cr, subpath->start.x, subpath->start.y);
+
+                  for (k = 0; k < subpath->n_elements; k++)
+                    gimp_scan_convert_append_element (cr,
+                                                      &g_array_index (render->elements,
+                                                                      ScanElement,
+                                                                      subpath->first + k),
+                                                      subpath, TRUE);
+                }
+            }
+          else
+            {
+              gimp_scan_convert_append_stroke (cr, render, tile);
+            }
+
           cairo_set_line_cap (cr,
                               sc->cap == GIMP_CAP_BUTT ? CAIRO_LINE_CAP_BUTT :
                               sc->cap == GIMP_CAP_ROUND ? CAIRO_LINE_CAP_ROUND :
@@ -564,26 +1378,17 @@ gimp_scan_convert_render_full (GimpScanConvert *sc,
         }
       else
         {
+          gimp_scan_convert_append_fill (cr, render, tile);
+
           cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
           cairo_fill (cr);
         }
 
       cairo_destroy (cr);
       cairo_surface_destroy (surface);
+    }
 
-      if (tmp_buf)
-        {
-          const guchar *src  = tmp_buf;
-          guchar       *dest = data;
-          gint          i;
-
-          for (i = 0; i < roi->height; i++)
-            {
-              memcpy (dest, src, roi->width * bpp);
+  gegl_buffer_set (render->buffer, rect, 0, render->format, data, stride);
 
-              src  += stride;
-              dest += roi->width * bpp;
-            }
-        }
-    }
+  g_free (data);
 }
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gegl.h>
 #include <gtk/gtk.h>
 
@@ -38,15 +40,16 @@
 #include "gimpcanvas.h"
 #include "gimpcanvastransformpreview.h"
 #include "gimpdisplayshell.h"
+#include "gimpdisplayshell-transform.h"
 
 
 #define INT_MULT(a,b,t)    ((t) = (a) * (b) + 0x80, ((((t) >> 8) + (t)) >> 8))
-#define INT_MULT3(a,b,c,t) ((t) = (a) * (b) * (c) + 0x7F5B, \
-                           ((((t) >> 7) + (t)) >> 16))
 
 #define MAX_SUB_COLS       6 /* number of columns and  */
 #define MAX_SUB_ROWS       6 /* rows to use in perspective preview subdivision */
 
+#define MAX_TEXTURE_LEVEL  8 /* coarsest mipmap level used for the preview */
+
 
 enum
 {
@@ -62,6 +65,38 @@ enum
 };
 
 
+/*  the drawable's pixels (and the selection's, if any) the preview
+ *  is textured from.  Only the part of the drawable that is visible
+ *  through the clip is fetched, at the mipmap level matching the
+ *  display scale, and kept between draws for as long as it covers
+ *  what is visible, so the scanline loops only ever index into these
+ *  arrays.
+ */
+typedef struct
+{
+  GimpDrawable *drawable;     /* what the arrays were fetched from   */
+  GimpChannel  *selection;
+  gint          selection_offx;
+  gint          selection_offy;
+  gint          level;
+
+  guint32      *pixels;       /* cairo-ARGB32                        */
+  gint          x;            /* origin and size of pixels, in       */
+  gint          y;            /* scaled drawable coordinates         */
+  gint          width;
+  gint          height;
+  gfloat        scale;        /* from drawable to scaled coordinates */
+
+  guchar       *mask;         /* Y u8, at the same level, or NULL    */
+  gint          mask_x;       /* origin and size of mask, in scaled  */
+  gint          mask_y;       /* selection coordinates               */
+  gint          mask_width;
+  gint          mask_height;
+  gfloat        mask_du;      /* from texel coordinates of pixels    */
+  gfloat        mask_dv;      /* to texel coordinates of mask        */
+} TransformTexture;
+
+
 typedef struct _GimpCanvasTransformPreviewPrivate GimpCanvasTransformPreviewPrivate;
 
 struct _GimpCanvasTransformPreviewPrivate
@@ -72,6 +107,8 @@ struct _GimpCanvasTransformPreviewPrivate
   gdouble            x2, y2;
   gboolean           perspective;
   gdouble            opacity;
+
+  TransformTexture   texture;
 };
 
 #define GET_PRIVATE(transform_preview) \
@@ -82,6 +119,7 @@ struct _GimpCanvasTransformPreviewPrivate
 
 /*  local function prototypes  */
 
+static void             gimp_canvas_transform_preview_finalize     (GObject        *object);
 static void             gimp_canvas_transform_preview_set_property (GObject        *object,
                                                                     guint           property_id,
                                                                     const GValue   *value,
@@ -95,63 +133,58 @@ static void             gimp_canvas_transform_preview_draw         (GimpCanvasIt
                                                                     cairo_t        *cr);
 static cairo_region_t * gimp_canvas_transform_preview_get_extents  (GimpCanvasItem *item);
 
-static void   gimp_canvas_transform_preview_draw_quad         (GimpDrawable    *texture,
-                                                               cairo_t         *cr,
-                                                               GimpChannel     *mask,
-                                                               gint             mask_offx,
-                                                               gint             mask_offy,
-                                                               gint            *x,
-                                                               gint            *y,
-                                                               gfloat          *u,
-                                                               gfloat          *v,
-                                                               guchar           opacity);
-static void   gimp_canvas_transform_preview_draw_tri          (GimpDrawable    *texture,
-                                                               cairo_t         *cr,
-                                                               cairo_surface_t *area,
-                                                               gint             area_offx,
-                                                               gint             area_offy,
-                                                               GimpChannel     *mask,
-                                                               gint             mask_offx,
-                                                               gint             mask_offy,
-                                                               gint            *x,
-                                                               gint            *y,
-                                                               gfloat          *u,
-                                                               gfloat          *v,
-                                                               guchar           opacity);
-static void   gimp_canvas_transform_preview_draw_tri_row      (GimpDrawable    *texture,
-                                                               cairo_t         *cr,
-                                                               cairo_surface_t *area,
-                                                               gint             area_offx,
-                                                               gint             area_offy,
-                                                               gint             x1,
-                                                               gfloat           u1,
-                                                               gfloat           v1,
-                                                               gint             x2,
-                                                               gfloat           u2,
-                                                               gfloat           v2,
-                                                               gint             y,
-                                                               guchar           opacity);
-static void   gimp_canvas_transform_preview_draw_tri_row_mask (GimpDrawable    *texture,
-                                                               cairo_t         *cr,
-                                                               cairo_surface_t *area,
-                                                               gint             area_offx,
-                                                               gint             area_offy,
-                                                               GimpChannel     *mask,
-                                                               gint             mask_offx,
-                                                               gint             mask_offy,
-                                                               gint             x1,
-                                                               gfloat           u1,
-                                                               gfloat           v1,
-                                                               gint             x2,
-                                                               gfloat           u2,
-                                                               gfloat           v2,
-                                                               gint             y,
-                                                               guchar           opacity);
-static void   gimp_canvas_transform_preview_trace_tri_edge    (gint            *dest,
-                                                               gint             x1,
-                                                               gint             y1,
-                                                               gint             x2,
-                                                               gint             y2);
+static gboolean gimp_canvas_transform_preview_visible_bounds  (GimpCanvasItem   *item,
+                                                               cairo_t          *cr,
+                                                               gint             *x1,
+                                                               gint             *y1,
+                                                               gint             *x2,
+                                                               gint             *y2);
+
+static void   gimp_canvas_transform_preview_texture_get       (TransformTexture *texture,
+                                                               GimpDrawable     *drawable,
+                                                               GimpChannel      *selection,
+                                                               gint              selection_offx,
+                                                               gint              selection_offy,
+                                                               gint              x1,
+                                                               gint              y1,
+                                                               gint              x2,
+                                                               gint              y2,
+                                                               gdouble           display_scale);
+static void   gimp_canvas_transform_preview_texture_free      (TransformTexture *texture);
+
+static void   gimp_canvas_transform_preview_draw_quad         (TransformTexture *texture,
+                                                               cairo_t          *cr,
+                                                               gint             *x,
+                                                               gint             *y,
+                                                               gfloat           *u,
+                                                               gfloat           *v,
+                                                               guchar            opacity);
+static void   gimp_canvas_transform_preview_draw_tri          (TransformTexture *texture,
+                                                               cairo_surface_t  *area,
+                                                               gint              area_offx,
+                                                               gint              area_offy,
+                                                               gint             *x,
+                                                               gint             *y,
+                                                               gfloat           *u,
+                                                               gfloat           *v,
+                                                               guchar            opacity);
+static void   gimp_canvas_transform_preview_draw_tri_row      (TransformTexture *texture,
+                                                               cairo_surface_t  *area,
+                                                               gint              area_offx,
+                                                               gint              area_offy,
+                                                               gint              x1,
+                                                               gfloat            u1,
+                                                               gfloat            v1,
+                                                               gint              x2,
+                                                               gfloat            u2,
+                                                               gfloat            v2,
+                                                               gint              y,
+                                                               guchar            opacity);
+static void   gimp_canvas_transform_preview_trace_tri_edge    (gint             *dest,
+                                                               gint              x1,
+                                                               gint              y1,
+                                                               gint              x2,
+                                                               gint              y2);
 
 
 G_DEFINE_TYPE (GimpCanvasTransformPreview, gimp_canvas_transform_preview,
@@ -166,6 +199,7 @@ gimp_canvas_transform_preview_class_init (GimpCanvasTransformPreviewClass *klass
   GObjectClass        *object_class = G_OBJECT_CLASS (klass);
   GimpCanvasItemClass *item_class   = GIMP_CANVAS_ITEM_CLASS (klass);
 
+  object_class->finalize     = gimp_canvas_transform_preview_finalize;
   object_class->set_property = gimp_canvas_transform_preview_set_property;
   object_class->get_property = gimp_canvas_transform_preview_get_property;
 
@@ -236,6 +270,16 @@ gimp_canvas_transform_preview_init (GimpCanvasTransformPreview *transform_previe
 {
 }
 
+static void
+gimp_canvas_transform_preview_finalize (GObject *object)
+{
+  GimpCanvasTransformPreviewPrivate *private = GET_PRIVATE (object);
+
+  gimp_canvas_transform_preview_texture_free (&private->texture);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
 static void
 gimp_canvas_transform_preview_set_property (GObject      *object,
                                             guint         property_id,
@@ -248,6 +292,7 @@ gimp_canvas_transform_preview_set_property (GObject      *object,
     {
     case PROP_DRAWABLE:
       private->drawable = g_value_get_object (value); /* don't ref */
+      gimp_canvas_transform_preview_texture_free (&private->texture);
       break;
 
     case PROP_TRANSFORM:
@@ -405,7 +450,10 @@ gimp_canvas_transform_preview_draw (GimpCanvasItem *item,
                                     cairo_t        *cr)
 {
   GimpCanvasTransformPreviewPrivate *private = GET_PRIVATE (item);
+  GimpDisplayShell                  *shell   = gimp_canvas_item_get_shell (item);
   GimpChannel                       *mask;
+  gint                               tex_x1, tex_y1;
+  gint                               tex_x2, tex_y2;
   gint                               mask_x1, mask_y1;
   gint                               mask_x2, mask_y2;
   gint                               mask_offx, mask_offy;
@@ -549,10 +597,27 @@ gimp_canvas_transform_preview_draw (GimpCanvasItem *item,
 #undef CALC_VERTEX
 #undef COPY_VERTEX
 
+  tex_x1 = mask_x1;
+  tex_y1 = mask_y1;
+  tex_x2 = mask_x2;
+  tex_y2 = mask_y2;
+
+  if (! gimp_canvas_transform_preview_visible_bounds (item, cr,
+                                                      &tex_x1, &tex_y1,
+                                                      &tex_x2, &tex_y2))
+    return;
+
+  gimp_canvas_transform_preview_texture_get (&private->texture,
+                                             private->drawable,
+                                             mask, mask_offx, mask_offy,
+                                             tex_x1, tex_y1,
+                                             tex_x2, tex_y2,
+                                             MIN (shell->scale_x,
+                                                  shell->scale_y));
+
   k = columns * rows;
   for (j = 0; j < k; j++)
-    gimp_canvas_transform_preview_draw_quad (private->drawable, cr,
-                                             mask, mask_offx, mask_offy,
+    gimp_canvas_transform_preview_draw_quad (&private->texture, cr,
                                              x[j], y[j], u[j], v[j],
                                              opacity);
 }
@@ -599,27 +664,241 @@ gimp_canvas_transform_preview_new (GimpDisplayShell  *shell,
 
 /*  private functions  */
 
+/**
+ * gimp_canvas_transform_preview_visible_bounds:
+ * @item: the #GimpCanvasTransformPreview
+ * @cr:   the #cairo_t the preview is drawn on
+ * @x1:   left edge of the previewed part of the drawable, returns
+ *        the left edge of its visible part
+ * @y1:   top edge, likewise
+ * @x2:   right edge, likewise
+ * @y2:   bottom edge, likewise
+ *
+ * Maps the clip extents of @cr back through the display's zoom and
+ * the inverse of the transform, and shrinks the given bounds to what
+ * can end up within them.  The bounds are left alone if the inverse
+ * transform doesn't map the clip to a bounded area.
+ *
+ * Return value: %FALSE if nothing of the drawable is visible.
+ **/
+static gboolean
+gimp_canvas_transform_preview_visible_bounds (GimpCanvasItem *item,
+                                              cairo_t        *cr,
+                                              gint           *x1,
+                                              gint           *y1,
+                                              gint           *x2,
+                                              gint           *y2)
+{
+  GimpCanvasTransformPreviewPrivate *private = GET_PRIVATE (item);
+  GimpDisplayShell                  *shell   = gimp_canvas_item_get_shell (item);
+  GimpMatrix3                        inverse;
+  gdouble                            clip[4][2];
+  gdouble                            u1, v1, u2, v2;
+  gdouble                            sx, sy;
+  gdouble                            w0 = 0.0;
+  gint                               i;
+
+  if (private->x2 <= private->x1 || private->y2 <= private->y1)
+    return TRUE;
+
+  inverse = private->transform;
+
+  if (fabs (gimp_matrix3_determinant (&inverse)) < 1e-10)
+    return TRUE;
+
+  gimp_matrix3_invert (&inverse);
+
+  cairo_clip_extents (cr,
+                      &clip[0][0], &clip[0][1],
+                      &clip[3][0], &clip[3][1]);
+
+  clip[1][0] = clip[3][0];  clip[1][1] = clip[0][1];
+  clip[2][0] = clip[0][0];  clip[2][1] = clip[3][1];
+
+  /*  from the transformed bounds to drawable coordinates  */
+  sx = (*x2 - *x1) / (private->x2 - private->x1);
+  sy = (*y2 - *y1) / (private->y2 - private->y1);
+
+  u1 = v1 =  G_MAXDOUBLE;
+  u2 = v2 = -G_MAXDOUBLE;
+
+  for (i = 0; i < 4; i++)
+    {
+      gdouble ix, iy;
+      gdouble tx, ty;
+      gdouble w;
+
+      gimp_display_shell_unzoom_xy_f (shell, clip[i][0], clip[i][1],
+                                      &ix, &iy);
+
+      /*  the clip's preimage is only bounded if it doesn't reach
+       *  the transform's horizon
+       */
+      w = (inverse.coeff[2][0] * ix +
+           inverse.coeff[2][1] * iy +
+           inverse.coeff[2][2]);
+
+      if (fabs (w) < 1e-10 || (i > 0 && (w > 0.0) != (w0 > 0.0)))
+        return TRUE;
+
+      w0 = w;
+
+      gimp_matrix3_transform_point (&inverse, ix, iy, &tx, &ty);
+
+      tx = *x1 + (tx - private->x1) * sx;
+      ty = *y1 + (ty - private->y1) * sy;
+
+      u1 = MIN (u1, tx);
+      v1 = MIN (v1, ty);
+      u2 = MAX (u2, tx);
+      v2 = MAX (v2, ty);
+    }
+
+  /*  one pixel more, for the rounding of the texture coordinates  */
+  *x1 = MAX (*x1, (gint) floor (u1) - 1);
+  *y1 = MAX (*y1, (gint) floor (v1) - 1);
+  *x2 = MIN (*x2, (gint) ceil  (u2) + 1);
+  *y2 = MIN (*y2, (gint) ceil  (v2) + 1);
+
+  return (*x1 < *x2 && *y1 < *y2);
+}
+
+/**
+ * gimp_canvas_transform_preview_texture_get:
+ * @texture:        the #TransformTexture to fill
+ * @drawable:       the #GimpDrawable to be previewed
+ * @selection:      the image's selection, or %NULL
+ * @selection_offx: x offset of @drawable in @selection
+ * @selection_offy: y offset of @drawable in @selection
+ * @x1:             left edge of the visible part of @drawable
+ * @y1:             top edge of the visible part of @drawable
+ * @x2:             right edge of the visible part of @drawable
+ * @y2:             bottom edge of the visible part of @drawable
+ * @display_scale:  the display's zoom factor
+ *
+ * Makes sure @texture holds the pixels of @drawable (and @selection)
+ * within the given bounds, from the smallest mipmap level that still
+ * has at least one texel per screen pixel.  They are only fetched
+ * again if @texture doesn't already cover them at that level.
+ *
+ * The selection's texels are fetched on the selection's own grid of
+ * the level, a drawable offset that isn't a multiple of the level's
+ * size doesn't line the two grids up.
+ **/
+static void
+gimp_canvas_transform_preview_texture_get (TransformTexture *texture,
+                                           GimpDrawable     *drawable,
+                                           GimpChannel      *selection,
+                                           gint              selection_offx,
+                                           gint              selection_offy,
+                                           gint              x1,
+                                           gint              y1,
+                                           gint              x2,
+                                           gint              y2,
+                                           gdouble           display_scale)
+{
+  GeglRectangle rect;
+  gfloat        scale;
+  gint          level = 0;
+
+  while (level < MAX_TEXTURE_LEVEL &&
+         display_scale * (1 << (level + 1)) <= 1.0)
+    level++;
+
+  scale = 1.0 / (1 << level);
+
+  rect.x      = floor (x1 * scale);
+  rect.y      = floor (y1 * scale);
+  rect.width  = MAX (1, ceil (x2 * scale) - rect.x);
+  rect.height = MAX (1, ceil (y2 * scale) - rect.y);
+
+  if (texture->pixels                                   &&
+      texture->drawable       == drawable               &&
+      texture->selection      == selection              &&
+      texture->selection_offx == selection_offx         &&
+      texture->selection_offy == selection_offy         &&
+      texture->level          == level                  &&
+      rect.x               >= texture->x                &&
+      rect.y               >= texture->y                &&
+      rect.x + rect.width  <= texture->x + texture->width &&
+      rect.y + rect.height <= texture->y + texture->height)
+    return;
+
+  gimp_canvas_transform_preview_texture_free (texture);
+
+  texture->drawable       = drawable;
+  texture->selection      = selection;
+  texture->selection_offx = selection_offx;
+  texture->selection_offy = selection_offy;
+  texture->level          = level;
+
+  texture->scale  = scale;
+  texture->x      = rect.x;
+  texture->y      = rect.y;
+  texture->width  = rect.width;
+  texture->height = rect.height;
+
+  texture->pixels = g_new (guint32, texture->width * texture->height);
+
+  gegl_buffer_get (gimp_drawable_get_buffer (drawable),
+                   &rect, scale,
+                   babl_format ("cairo-ARGB32"), texture->pixels,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  if (selection)
+    {
+      rect.x      = floor ((x1 + selection_offx) * scale);
+      rect.y      = floor ((y1 + selection_offy) * scale);
+      rect.width  = MAX (1, ceil ((x2 + selection_offx) * scale) - rect.x);
+      rect.height = MAX (1, ceil ((y2 + selection_offy) * scale) - rect.y);
+
+      texture->mask_x      = rect.x;
+      texture->mask_y      = rect.y;
+      texture->mask_width  = rect.width;
+      texture->mask_height = rect.height;
+
+      /*  a texel u of pixels is at drawable coordinate
+       *  (u + texture->x) / scale, so at u + texture->x +
+       *  selection_offx * scale - mask_x in mask
+       */
+      texture->mask_du = texture->x + selection_offx * scale - rect.x;
+      texture->mask_dv = texture->y + selection_offy * scale - rect.y;
+
+      texture->mask = g_new (guchar, rect.width * rect.height);
+
+      gegl_buffer_get (gimp_drawable_get_buffer (GIMP_DRAWABLE (selection)),
+                       &rect, scale,
+                       babl_format ("Y u8"), texture->mask,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+    }
+}
+
+static void
+gimp_canvas_transform_preview_texture_free (TransformTexture *texture)
+{
+  g_free (texture->pixels);
+  g_free (texture->mask);
+
+  memset (texture, 0, sizeof (TransformTexture));
+}
+
 /**
  * gimp_canvas_transform_preview_draw_quad:
- * @texture:   the #GimpDrawable to be previewed
+ * @texture:   the pixels of the #GimpDrawable to be previewed
  * @cr:        the #cairo_t to draw to
- * @mask:      a #GimpChannel
  * @opacity:   the opacity of the preview
  *
- * Take a quadrilateral, divide it into two triangles, and draw those
- * with gimp_canvas_transform_preview_draw_tri().
+ * Take a quadrilateral, divide it into two triangles, render those
+ * with gimp_canvas_transform_preview_draw_tri() and draw the result.
  **/
 static void
-gimp_canvas_transform_preview_draw_quad (GimpDrawable *texture,
-                                         cairo_t      *cr,
-                                         GimpChannel  *mask,
-                                         gint          mask_offx,
-                                         gint          mask_offy,
-                                         gint         *x,
-                                         gint         *y,
-                                         gfloat       *u,
-                                         gfloat       *v,
-                                         guchar        opacity)
+gimp_canvas_transform_preview_draw_quad (TransformTexture *texture,
+                                         cairo_t          *cr,
+                                         gint             *x,
+                                         gint             *y,
+                                         gfloat           *u,
+                                         gfloat           *v,
+                                         guchar            opacity)
 {
   gint    x2[3], y2[3];
   gfloat  u2[3], v2[3];
@@ -631,8 +910,8 @@ gimp_canvas_transform_preview_draw_quad (GimpDrawable *texture,
   x2[1] = x[2];  y2[1] = y[2];  u2[1] = u[2];  v2[1] = v[2];
   x2[2] = x[1];  y2[2] = y[1];  u2[2] = u[1];  v2[2] = v[1];
 
-   /* Allocate a box around the quad to compute preview data into
-    * and fill it with the original window contents.
+   /* Allocate a box around the quad to render the preview into,
+    * it is drawn in one go when both triangles are done.
     */
 
   cairo_clip_extents (cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
@@ -664,48 +943,48 @@ gimp_canvas_transform_preview_draw_quad (GimpDrawable *texture,
 
       g_return_if_fail (area != NULL);
 
-      gimp_canvas_transform_preview_draw_tri (texture, cr, area, minx, miny,
-                                              mask, mask_offx, mask_offy,
+      cairo_surface_flush (area);
+
+      gimp_canvas_transform_preview_draw_tri (texture, area, minx, miny,
                                               x, y, u, v, opacity);
-      gimp_canvas_transform_preview_draw_tri (texture, cr, area, minx, miny,
-                                              mask, mask_offx, mask_offy,
+      gimp_canvas_transform_preview_draw_tri (texture, area, minx, miny,
                                               x2, y2, u2, v2, opacity);
 
+      cairo_surface_mark_dirty (area);
+
+      cairo_set_source_surface (cr, area, minx, miny);
+      cairo_rectangle (cr, minx, miny, maxx - minx + 1, maxy - miny + 1);
+      cairo_fill (cr);
+
       cairo_surface_destroy (area);
     }
 }
 
 /**
  * gimp_canvas_transform_preview_draw_tri:
- * @texture:   the thing being transformed
- * @cr:        the #cairo_t to draw to
- * @area:      has prefetched pixel data of dest
+ * @texture:   the pixels of the thing being transformed
+ * @area:      the surface to render into
  * @area_offx: x coordinate of area in dest
  * @area_offy: y coordinate of area in dest
  * @x:         Array of the three x coords of triangle
  * @y:         Array of the three y coords of triangle
  *
- * This draws a triangle onto dest by breaking it down into pixel
+ * This renders a triangle into @area by breaking it down into pixel
  * rows, and then calling gimp_canvas_transform_preview_draw_tri_row()
- * and gimp_canvas_transform_preview_draw_tri_row_mask() to do the
- * actual pixel changing.
+ * to do the actual pixel changing.
  **/
 static void
-gimp_canvas_transform_preview_draw_tri (GimpDrawable    *texture,
-                                        cairo_t         *cr,
-                                        cairo_surface_t *area,
-                                        gint             area_offx,
-                                        gint             area_offy,
-                                        GimpChannel     *mask,
-                                        gint             mask_offx,
-                                        gint             mask_offy,
-                                        gint            *x,
-                                        gint            *y,
-                                        gfloat          *u, /* texture coords */
-                                        gfloat          *v, /* 0.0 ... tex width, height */
-                                        guchar           opacity)
+gimp_canvas_transform_preview_draw_tri (TransformTexture *texture,
+                                        cairo_surface_t  *area,
+                                        gint              area_offx,
+                                        gint              area_offy,
+                                        gint             *x,
+                                        gint             *y,
+                                        gfloat           *u, /* texture coords */
+                                        gfloat           *v, /* 0.0 ... tex width, height */
+                                        guchar            opacity)
 {
-  gdouble      clip_x1, clip_y1, clip_x2, clip_y2;
+  gint         area_y1, area_y2;
   gint         j, k;
   gint         ry;
   gint        *l_edge, *r_edge;    /* arrays holding x-coords of edge pixels */
@@ -713,12 +992,13 @@ gimp_canvas_transform_preview_draw_tri (GimpDrawable    *texture,
   gfloat       dul, dvl, dur, dvr; /* left and right texture coord deltas  */
   gfloat       u_l, v_l, u_r, v_r; /* left and right texture coord pairs  */
 
-  g_return_if_fail (GIMP_IS_DRAWABLE (texture));
+  g_return_if_fail (texture != NULL);
   g_return_if_fail (area != NULL);
 
   g_return_if_fail (x != NULL && y != NULL && u != NULL && v != NULL);
 
-  cairo_clip_extents (cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+  area_y1 = area_offy;
+  area_y2 = area_offy + cairo_image_surface_get_height (area);
 
   /* sort vertices in order of y-coordinate */
 
@@ -761,35 +1041,19 @@ gimp_canvas_transform_preview_draw_tri (GimpDrawable    *texture,
       u_r   = u[0];
       v_r   = v[0];
 
-      if (mask)
-        for (ry = y[0]; ry < y[1]; ry++)
-          {
-            if (ry >= clip_y1 && ry < clip_y2)
-              gimp_canvas_transform_preview_draw_tri_row_mask (texture, cr,
-                                                               area, area_offx, area_offy,
-                                                               mask, mask_offx, mask_offy,
-                                                               *left, u_l, v_l,
-                                                               *right, u_r, v_r,
-                                                               ry,
-                                                               opacity);
-            left ++;      right ++;
-            u_l += dul;   v_l += dvl;
-            u_r += dur;   v_r += dvr;
-          }
-      else
-        for (ry = y[0]; ry < y[1]; ry++)
-          {
-            if (ry >= clip_y1 && ry < clip_y2)
-              gimp_canvas_transform_preview_draw_tri_row (texture, cr,
-                                                          area, area_offx, area_offy,
-                                                          *left, u_l, v_l,
-                                                          *right, u_r, v_r,
-                                                          ry,
-                                                          opacity);
-            left ++;      right ++;
-            u_l += dul;   v_l += dvl;
-            u_r += dur;   v_r += dvr;
-          }
+      for (ry = y[0]; ry < y[1]; ry++)
+        {
+          if (ry >= area_y1 && ry < area_y2)
+            gimp_canvas_transform_preview_draw_tri_row (texture,
+                                                        area, area_offx, area_offy,
+                                                        *left, u_l, v_l,
+                                                        *right, u_r, v_r,
+                                                        ry,
+                                                        opacity);
+          left ++;      right ++;
+          u_l += dul;   v_l += dvl;
+          u_r += dur;   v_r += dvr;
+        }
     }
 
   if (y[1] != y[2])
@@ -802,35 +1066,19 @@ gimp_canvas_transform_preview_draw_tri (GimpDrawable    *texture,
       u_r   = u[1];
       v_r   = v[1];
 
-      if (mask)
-        for (ry = y[1]; ry < y[2]; ry++)
-          {
-            if (ry >= clip_y1 && ry < clip_y2)
-              gimp_canvas_transform_preview_draw_tri_row_mask (texture, cr,
-                                                               area, area_offx, area_offy,
-                                                               mask, mask_offx, mask_offy,
-                                                               *left,  u_l, v_l,
-                                                               *right, u_r, v_r,
-                                                               ry,
-                                                               opacity);
-            left ++;      right ++;
-            u_l += dul;   v_l += dvl;
-            u_r += dur;   v_r += dvr;
-          }
-      else
-        for (ry = y[1]; ry < y[2]; ry++)
-          {
-            if (ry >= clip_y1 && ry < clip_y2)
-              gimp_canvas_transform_preview_draw_tri_row (texture, cr,
-                                                          area, area_offx, area_offy,
-                                                          *left,  u_l, v_l,
-                                                          *right, u_r, v_r,
-                                                          ry,
-                                                          opacity);
-            left ++;      right ++;
-            u_l += dul;   v_l += dvl;
-            u_r += dur;   v_r += dvr;
-          }
+      for (ry = y[1]; ry < y[2]; ry++)
+        {
+          if (ry >= area_y1 && ry < area_y2)
+            gimp_canvas_transform_preview_draw_tri_row (texture,
+                                                        area, area_offx, area_offy,
+                                                        *left,  u_l, v_l,
+                                                        *right, u_r, v_r,
+                                                        ry,
+                                                        opacity);
+          left ++;      right ++;
+          u_l += dul;   v_l += dvl;
+          u_r += dur;   v_r += dvr;
+        }
     }
 
   g_free (l_edge);
@@ -839,45 +1087,45 @@ gimp_canvas_transform_preview_draw_tri (GimpDrawable    *texture,
 
 /**
  * gimp_canvas_transform_preview_draw_tri_row:
- * @texture: the thing being transformed
- * @cr:      the #cairo_t to draw to
- * @area:    has prefetched pixel data of dest
+ * @texture: the pixels of the thing being transformed
+ * @area:    the surface to render into
+ *
+ * Called from gimp_canvas_transform_preview_draw_tri(), this renders
+ * a single row of a triangle into @area. The run (x1,y) to (x2,y) in
+ * dest corresponds to the run (u1,v1) to (u2,v2) in texture.
  *
- * Called from gimp_canvas_transform_preview_draw_tri(), this draws a
- * single row of a triangle onto dest when there is not a mask. The
- * run (x1,y) to (x2,y) in dest corresponds to the run (u1,v1) to
- * (u2,v2) in texture.
+ * The row is done in separate passes over plain arrays, computing
+ * the texel offsets, copying the texels and applying opacity and
+ * selection, so that the first and last pass can be vectorized.
  **/
 static void
-gimp_canvas_transform_preview_draw_tri_row (GimpDrawable    *texture,
-                                            cairo_t         *cr,
-                                            cairo_surface_t *area,
-                                            gint             area_offx,
-                                            gint             area_offy,
-                                            gint             x1,
-                                            gfloat           u1,
-                                            gfloat           v1,
-                                            gint             x2,
-                                            gfloat           u2,
-                                            gfloat           v2,
-                                            gint             y,
-                                            guchar           opacity)
+gimp_canvas_transform_preview_draw_tri_row (TransformTexture *texture,
+                                            cairo_surface_t  *area,
+                                            gint              area_offx,
+                                            gint              area_offy,
+                                            gint              x1,
+                                            gfloat            u1,
+                                            gfloat            v1,
+                                            gint              x2,
+                                            gfloat            u2,
+                                            gfloat            v2,
+                                            gint              y,
+                                            guchar            opacity)
 {
-  GeglBuffer *buffer;
-  const Babl *format;
-  guchar     *buf;
-  guchar     *b;
-  guchar     *pptr;      /* points into the pixels of a row of area */
-  gint        bpp;
-  gfloat      u, v;
-  gfloat      du, dv;
-  gint        dx;
-  gint        samples;
+  guint32 *pptr;      /* points into the pixels of a row of area */
+  gint    *offsets;
+  gint    *mask_offsets = NULL;
+  guchar  *factors;
+  gfloat   u, v;
+  gfloat   du, dv;
+  gint     area_width;
+  gint     dx;
+  gint     i;
 
   if (x2 == x1)
     return;
 
-  g_return_if_fail (GIMP_IS_DRAWABLE (texture));
+  g_return_if_fail (texture != NULL);
   g_return_if_fail (area != NULL);
   g_return_if_fail (cairo_image_surface_get_format (area) == CAIRO_FORMAT_ARGB32);
 
@@ -892,11 +1140,19 @@ gimp_canvas_transform_preview_draw_tri_row (GimpDrawable    *texture,
       ftmp = v2;  v2 = v1;  v1 = ftmp;
     }
 
+  /* go from drawable coordinates to offsets into the texture arrays */
+  u1 = u1 * texture->scale - texture->x;
+  v1 = v1 * texture->scale - texture->y;
+  u2 = u2 * texture->scale - texture->x;
+  v2 = v2 * texture->scale - texture->y;
+
   u = u1;
   v = v1;
   du = (u2 - u1) / (x2 - x1);
   dv = (v2 - v1) / (x2 - x1);
 
+  area_width = cairo_image_surface_get_width (area);
+
   /* don't calculate unseen pixels */
   if (x1 < area_offx)
     {
@@ -904,7 +1160,7 @@ gimp_canvas_transform_preview_draw_tri_row (GimpDrawable    *texture,
       v += dv * (area_offx - x1);
       x1 = area_offx;
     }
-  else if (x1 > area_offx + cairo_image_surface_get_width (area) - 1)
+  else if (x1 > area_offx + area_width - 1)
     {
       return;
     }
@@ -913,247 +1169,81 @@ gimp_canvas_transform_preview_draw_tri_row (GimpDrawable    *texture,
     {
       return;
     }
-  else if (x2 > area_offx + cairo_image_surface_get_width (area) - 1)
+  else if (x2 > area_offx + area_width - 1)
     {
-      x2 = area_offx + cairo_image_surface_get_width (area) - 1;
+      x2 = area_offx + area_width - 1;
     }
 
   dx = x2 - x1;
   if (! dx)
     return;
 
-  cairo_surface_flush (area);
-  pptr = (cairo_image_surface_get_data (area)
-          + (y - area_offy) * cairo_image_surface_get_stride (area)
-          + (x1 - area_offx) * 4);
-
-  buffer = gimp_drawable_get_buffer (texture);
+  pptr = (guint32 *) (cairo_image_surface_get_data (area)
+                      + (y - area_offy) * cairo_image_surface_get_stride (area)
+                      + (x1 - area_offx) * 4);
 
-  format = gegl_buffer_get_format (buffer);
-  bpp    = babl_format_get_bytes_per_pixel (format);
-  buf    = g_alloca (bpp * dx);
+  offsets = g_alloca (dx * sizeof (gint));
 
-  samples = dx;
-  b       = buf;
-
-  while (samples--)
+  for (i = 0; i < dx; i++)
     {
-      gegl_buffer_sample (buffer, (gint) u, (gint) v, NULL, b,
-                          format,
-                          GEGL_SAMPLER_NEAREST, GEGL_ABYSS_NONE);
-
-      b += bpp;
+      gint tu = CLAMP ((gint) (u + du * i), 0, texture->width  - 1);
+      gint tv = CLAMP ((gint) (v + dv * i), 0, texture->height - 1);
 
-      u += du;
-      v += dv;
+      offsets[i] = tv * texture->width + tu;
     }
 
-  if (opacity < 255)
+  if (texture->mask)
     {
-      guchar *u8_buffer = g_alloca (4 * dx);
-      guchar *u8_b;
-
-      babl_process (babl_fish (format,
-                               babl_format ("R'G'B'A u8")),
-                    buf, u8_buffer, dx);
+      gfloat mu = u + texture->mask_du;
+      gfloat mv = v + texture->mask_dv;
 
-      samples = dx;
-      u8_b    = u8_buffer;
+      mask_offsets = g_alloca (dx * sizeof (gint));
 
-      while (samples--)
+      for (i = 0; i < dx; i++)
         {
-          register gulong tmp;
+          gint tu = CLAMP ((gint) (mu + du * i), 0, texture->mask_width  - 1);
+          gint tv = CLAMP ((gint) (mv + dv * i), 0, texture->mask_height - 1);
 
-          u8_b[3] = INT_MULT (opacity, u8_b[3], tmp);
-
-          u8_b += 4;
+          mask_offsets[i] = tv * texture->mask_width + tu;
         }
-
-      babl_process (babl_fish (babl_format ("R'G'B'A u8"),
-                               babl_format ("cairo-ARGB32")),
-                    u8_buffer, pptr, dx);
-    }
-  else
-    {
-      babl_process (babl_fish (format,
-                               babl_format ("cairo-ARGB32")),
-                    buf, pptr, dx);
     }
 
-  cairo_surface_mark_dirty (area);
-
-  cairo_set_source_surface (cr, area, area_offx, area_offy);
-  cairo_rectangle (cr, x1, y, x2 - x1, 1);
-  cairo_fill (cr);
-}
+  for (i = 0; i < dx; i++)
+    pptr[i] = texture->pixels[offsets[i]];
 
-/**
- * gimp_canvas_transform_preview_draw_tri_row_mask:
- *
- * Called from gimp_canvas_transform_preview_draw_tri(), this draws a
- * single row of a triangle onto dest, when there is a mask.
- **/
-static void
-gimp_canvas_transform_preview_draw_tri_row_mask (GimpDrawable    *texture,
-                                                 cairo_t         *cr,
-                                                 cairo_surface_t *area,
-                                                 gint             area_offx,
-                                                 gint             area_offy,
-                                                 GimpChannel     *mask,
-                                                 gint             mask_offx,
-                                                 gint             mask_offy,
-                                                 gint             x1,
-                                                 gfloat           u1,
-                                                 gfloat           v1,
-                                                 gint             x2,
-                                                 gfloat           u2,
-                                                 gfloat           v2,
-                                                 gint             y,
-                                                 guchar           opacity)
-{
-  GeglBuffer *buffer;
-  GeglBuffer *mask_buffer;
-  const Babl *format;
-  const Babl *mask_format;
-  guchar     *buf;
-  guchar     *mask_buf;
-  guchar     *b;
-  guchar     *mask_b;
-  guchar     *pptr;              /* points into the pixels of area        */
-  gint        bpp;
-  gint        mask_bpp;
-  gfloat      u, v;
-  gfloat      mu, mv;
-  gfloat      du, dv;
-  gint        dx;
-  gint        samples;
-
-  if (x2 == x1)
+  if (! texture->mask && opacity == 255)
     return;
 
-  g_return_if_fail (GIMP_IS_DRAWABLE (texture));
-  g_return_if_fail (GIMP_IS_CHANNEL (mask));
-  g_return_if_fail (area != NULL);
-  g_return_if_fail (cairo_image_surface_get_format (area) == CAIRO_FORMAT_ARGB32);
+  factors = g_alloca (dx);
 
-  /* make sure the pixel run goes in the positive direction */
-  if (x1 > x2)
+  if (texture->mask)
     {
-      gint   tmp;
-      gfloat ftmp;
-
-      tmp  = x2;  x2 = x1;  x1 = tmp;
-      ftmp = u2;  u2 = u1;  u1 = ftmp;
-      ftmp = v2;  v2 = v1;  v1 = ftmp;
-    }
-
-  u = u1;
-  v = v1;
-  du = (u2 - u1) / (x2 - x1);
-  dv = (v2 - v1) / (x2 - x1);
-
-  /* don't calculate unseen pixels */
-  if (x1 < area_offx)
-    {
-      u += du * (area_offx - x1);
-      v += dv * (area_offx - x1);
-      x1 = area_offx;
-    }
-  else if (x1 > area_offx + cairo_image_surface_get_width (area) - 1)
-    {
-      return;
-    }
+      for (i = 0; i < dx; i++)
+        {
+          guint tmp;
 
-  if (x2 < area_offx)
-    {
-      return;
-    }
-  else if (x2 > area_offx + cairo_image_surface_get_width (area) - 1)
-    {
-      x2 = area_offx + cairo_image_surface_get_width (area) - 1;
+          factors[i] = INT_MULT (opacity, texture->mask[mask_offsets[i]], tmp);
+        }
     }
-
-  dx = x2 - x1;
-  if (! dx)
-    return;
-
-  mu = u + mask_offx;
-  mv = v + mask_offy;
-
-  cairo_surface_flush (area);
-  pptr = (cairo_image_surface_get_data (area)
-          + (y - area_offy) * cairo_image_surface_get_stride (area)
-          + (x1 - area_offx) * 4);
-
-  buffer      = gimp_drawable_get_buffer (texture);
-  mask_buffer = gimp_drawable_get_buffer (GIMP_DRAWABLE (mask));
-
-  format      = gegl_buffer_get_format (buffer);
-  mask_format = gegl_buffer_get_format (mask_buffer);
-  bpp         = babl_format_get_bytes_per_pixel (format);
-  mask_bpp    = babl_format_get_bytes_per_pixel (mask_format);
-  buf         = g_alloca (bpp * dx);
-  mask_buf    = g_alloca (mask_bpp * dx);
-
-  samples = dx;
-  b       = buf;
-  mask_b  = mask_buf;
-
-  while (samples--)
+  else
     {
-      gegl_buffer_sample (buffer, (gint) u, (gint) v, NULL, b,
-                          format,
-                          GEGL_SAMPLER_NEAREST, GEGL_ABYSS_NONE);
-      gegl_buffer_sample (mask_buffer, (gint) mu, (gint) mv, NULL, mask_b,
-                          mask_format,
-                          GEGL_SAMPLER_NEAREST, GEGL_ABYSS_NONE);
-
-      b      += bpp;
-      mask_b += mask_bpp;
-
-      u += du;
-      v += dv;
-      mu += du;
-      mv += dv;
+      memset (factors, opacity, dx);
     }
 
+  /*  the pixels are premultiplied, so all components get scaled  */
   {
-    guchar *u8_buffer      = g_alloca (4 * dx);
-    guchar *u8_mask_buffer = g_alloca (dx);
-    guchar *u8_b;
-    guchar *u8_mask_b;
-
-    babl_process (babl_fish (format,
-                             babl_format ("R'G'B'A u8")),
-                  buf, u8_buffer, dx);
-    babl_process (babl_fish (mask_format,
-                             babl_format ("Y u8")),
-                  mask_buf, u8_mask_buffer, dx);
-
-    samples   = dx;
-    u8_b      = u8_buffer;
-    u8_mask_b = u8_mask_buffer;
-
-    while (samples--)
-      {
-        register gulong tmp;
+    guchar *p = (guchar *) pptr;
 
-        u8_b[3] = INT_MULT3 (opacity, *u8_mask_b, u8_b[3], tmp);
+    for (i = 0; i < dx; i++, p += 4)
+      {
+        guint tmp;
 
-        u8_b      += 4;
-        u8_mask_b += 1;
+        p[0] = INT_MULT (factors[i], p[0], tmp);
+        p[1] = INT_MULT (factors[i], p[1], tmp);
+        p[2] = INT_MULT (factors[i], p[2], tmp);
+        p[3] = INT_MULT (factors[i], p[3], tmp);
       }
-
-    babl_process (babl_fish (babl_format ("R'G'B'A u8"),
-                             babl_format ("cairo-ARGB32")),
-                  u8_buffer, pptr, dx);
   }
-
-  cairo_surface_mark_dirty (area);
-
-  cairo_set_source_surface (cr, area, area_offx, area_offy);
-  cairo_rectangle (cr, x1, y, x2 - x1, 1);
-  cairo_fill (cr);
 }
 
 /**
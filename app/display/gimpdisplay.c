@@ -45,6 +45,7 @@
 #include "gimpdisplayshell-expose.h"
 #include "gimpdisplayshell-handlers.h"
 #include "gimpdisplayshell-icon.h"
+#include "gimpdisplayshell-render.h"
 #include "gimpdisplayshell-transform.h"
 #include "gimpimagewindow.h"
 
@@ -776,6 +777,12 @@ gimp_display_update_area (GimpDisplay *display,
 
   private = GIMP_DISPLAY_GET_PRIVATE (display);
 
+  /*  the cached display filter output is stale right away, even if
+   *  the expose is deferred to the next flush
+   */
+  gimp_display_shell_render_invalidate_area (gimp_display_get_shell (display),
+                                             x, y, w, h);
+
   if (now)
     {
       gimp_display_paint_area (display, x, y, w, h);
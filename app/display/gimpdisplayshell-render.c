@@ -17,10 +17,13 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gegl.h>
 #include <gtk/gtk.h>
 
 #include "libgimpcolor/gimpcolor.h"
+#include "libgimpmath/gimpmath.h"
 #include "libgimpwidgets/gimpwidgets.h"
 
 #include "display-types.h"
@@ -44,6 +47,106 @@
 #include "gimpdisplayxfer.h"
 
 
+/*  The color display filters (most notably color management) are by far
+ *  the most expensive part of rendering the projection.  Their output is
+ *  cached in tiles of scaled image coordinates, so scrolling and
+ *  redrawing canvas items only have to copy pixels, and only tiles
+ *  touched by projection updates need to go through the filters again.
+ */
+#define RENDER_CACHE_TILE_SIZE  GIMP_DISPLAY_RENDER_BUF_WIDTH
+#define RENDER_CACHE_MAX_TILES  256
+
+
+typedef struct
+{
+  gint col1, row1;
+  gint col2, row2;
+} RenderCacheRange;
+
+
+static gdouble           gimp_display_shell_render_get_window_scale
+                                                            (GimpDisplayShell *shell);
+static void              gimp_display_shell_render_cached   (GimpDisplayShell *shell,
+                                                             GeglBuffer       *buffer,
+                                                             gdouble           scale,
+                                                             gint              x,
+                                                             gint              y,
+                                                             gint              w,
+                                                             gint              h,
+                                                             guchar           *data,
+                                                             gint              stride);
+static cairo_surface_t * gimp_display_shell_render_get_tile (GimpDisplayShell *shell,
+                                                             GeglBuffer       *buffer,
+                                                             gdouble           scale,
+                                                             gint              tile_col,
+                                                             gint              tile_row);
+static void              gimp_display_shell_render_trim     (GimpDisplayShell *shell);
+static gboolean          gimp_display_shell_render_tile_in_range
+                                                            (gpointer          key,
+                                                             gpointer          value,
+                                                             gpointer          data);
+
+
+/*  public functions  */
+
+void
+gimp_display_shell_render_invalidate_full (GimpDisplayShell *shell)
+{
+  g_return_if_fail (GIMP_IS_DISPLAY_SHELL (shell));
+
+  if (shell->render_cache)
+    g_hash_table_remove_all (shell->render_cache);
+}
+
+void
+gimp_display_shell_render_invalidate_area (GimpDisplayShell *shell,
+                                           gint              x,
+                                           gint              y,
+                                           gint              w,
+                                           gint              h)
+{
+  RenderCacheRange range;
+  gdouble          window_scale;
+  gint             x1, y1, x2, y2;
+
+  g_return_if_fail (GIMP_IS_DISPLAY_SHELL (shell));
+
+  if (! shell->render_cache ||
+      g_hash_table_size (shell->render_cache) == 0)
+    return;
+
+  window_scale = gimp_display_shell_render_get_window_scale (shell);
+
+  /*  image to scaled coordinates, grown by a pixel on each side to
+   *  accommodate for spill of the box filter used when zoomed out
+   */
+  x1 = floor (x       * shell->scale_x * window_scale) - 1;
+  y1 = floor (y       * shell->scale_y * window_scale) - 1;
+  x2 = ceil  ((x + w) * shell->scale_x * window_scale) + 1;
+  y2 = ceil  ((y + h) * shell->scale_y * window_scale) + 1;
+
+  range.col1 = floor ((gdouble) x1 / RENDER_CACHE_TILE_SIZE);
+  range.row1 = floor ((gdouble) y1 / RENDER_CACHE_TILE_SIZE);
+  range.col2 = floor ((gdouble) (x2 - 1) / RENDER_CACHE_TILE_SIZE);
+  range.row2 = floor ((gdouble) (y2 - 1) / RENDER_CACHE_TILE_SIZE);
+
+  g_hash_table_foreach_remove (shell->render_cache,
+                               gimp_display_shell_render_tile_in_range,
+                               &range);
+}
+
+void
+gimp_display_shell_render_free (GimpDisplayShell *shell)
+{
+  g_return_if_fail (GIMP_IS_DISPLAY_SHELL (shell));
+
+  if (shell->render_cache)
+    {
+      g_hash_table_destroy (shell->render_cache);
+      shell->render_cache = NULL;
+    }
+}
+
 void
 gimp_display_shell_render (GimpDisplayShell *shell,
                            cairo_t          *cr,
@@ -55,7 +158,7 @@ gimp_display_shell_render (GimpDisplayShell *shell,
   GimpImage       *image;
   GimpProjection  *projection;
   GeglBuffer      *buffer;
-  gdouble          window_scale = 1.0;
+  gdouble          window_scale;
   gint             viewport_offset_x;
   gint             viewport_offset_y;
   gint             viewport_width;
@@ -76,12 +179,7 @@ gimp_display_shell_render (GimpDisplayShell *shell,
   projection = gimp_image_get_projection (image);
   buffer     = gimp_pickable_get_buffer (GIMP_PICKABLE (projection));
 
-#ifdef GIMP_DISPLAY_RENDER_ENABLE_SCALING
-  /* if we had this future API, things would look pretty on hires (retina) */
-  window_scale = gdk_window_get_scale_factor (gtk_widget_get_window (gtk_widget_get_toplevel (GTK_WIDGET (shell))));
-#endif
-
-  window_scale = MIN (window_scale, GIMP_DISPLAY_RENDER_MAX_SCALE);
+  window_scale = gimp_display_shell_render_get_window_scale (shell);
 
   gimp_display_shell_scroll_get_scaled_viewport (shell,
                                                  &viewport_offset_x,
@@ -110,26 +208,28 @@ gimp_display_shell_render (GimpDisplayShell *shell,
   data = cairo_image_surface_get_data (xfer);
   data += src_y * stride + src_x * 4;
 
-  gegl_buffer_get (buffer,
-                   GEGL_RECTANGLE ((x + viewport_offset_x) * window_scale,
-                                   (y + viewport_offset_y) * window_scale,
-                                   w * window_scale,
-                                   h * window_scale),
-                   shell->scale_x * window_scale,
-                   babl_format ("cairo-ARGB32"),
-		   data, stride,
-                   GEGL_ABYSS_NONE);
-
-  /*  apply filters to the rendered projection  */
   if (shell->filter_stack)
     {
-      cairo_surface_t *image =
-	cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
-					     w * window_scale,
-					     h * window_scale,
-					     stride);
-      gimp_color_display_stack_convert_surface (shell->filter_stack, image);
-      cairo_surface_destroy (image);
+      /*  get the filtered projection from the render cache  */
+      gimp_display_shell_render_cached (shell, buffer,
+                                        shell->scale_x * window_scale,
+                                        (x + viewport_offset_x) * window_scale,
+                                        (y + viewport_offset_y) * window_scale,
+                                        w * window_scale,
+                                        h * window_scale,
+                                        data, stride);
+    }
+  else
+    {
+      gegl_buffer_get (buffer,
+                       GEGL_RECTANGLE ((x + viewport_offset_x) * window_scale,
+                                       (y + viewport_offset_y) * window_scale,
+                                       w * window_scale,
+                                       h * window_scale),
+                       shell->scale_x * window_scale,
+                       babl_format ("cairo-ARGB32"),
+                       data, stride,
+                       GEGL_ABYSS_NONE);
     }
 
   if (shell->mask)
@@ -217,3 +317,180 @@ gimp_display_shell_render (GimpDisplayShell *shell,
 
   cairo_restore (cr);
 }
+
+
+/*  private functions  */
+
+static gdouble
+gimp_display_shell_render_get_window_scale (GimpDisplayShell *shell)
+{
+  gdouble window_scale = 1.0;
+
+#ifdef GIMP_DISPLAY_RENDER_ENABLE_SCALING
+  /* if we had this future API, things would look pretty on hires (retina) */
+  window_scale = gdk_window_get_scale_factor (gtk_widget_get_window (gtk_widget_get_toplevel (GTK_WIDGET (shell))));
+#endif
+
+  return MIN (window_scale, GIMP_DISPLAY_RENDER_MAX_SCALE);
+}
+
+static void
+gimp_display_shell_render_cached (GimpDisplayShell *shell,
+                                  GeglBuffer       *buffer,
+                                  gdouble           scale,
+                                  gint              x,
+                                  gint              y,
+                                  gint              w,
+                                  gint              h,
+                                  guchar           *data,
+                                  gint              stride)
+{
+  gint col1, row1, col2, row2;
+  gint col, row;
+
+  if (! shell->render_cache)
+    shell->render_cache = g_hash_table_new_full (g_int64_hash,
+                                                 g_int64_equal,
+                                                 g_free,
+                                                 (GDestroyNotify) cairo_surface_destroy);
+
+  col1 = floor ((gdouble) x / RENDER_CACHE_TILE_SIZE);
+  row1 = floor ((gdouble) y / RENDER_CACHE_TILE_SIZE);
+  col2 = floor ((gdouble) (x + w - 1) / RENDER_CACHE_TILE_SIZE);
+  row2 = floor ((gdouble) (y + h - 1) / RENDER_CACHE_TILE_SIZE);
+
+  if (g_hash_table_size (shell->render_cache) +
+      (col2 - col1 + 1) * (row2 - row1 + 1) > RENDER_CACHE_MAX_TILES)
+    {
+      gimp_display_shell_render_trim (shell);
+    }
+
+  for (row = row1; row <= row2; row++)
+    {
+      for (col = col1; col <= col2; col++)
+        {
+          cairo_surface_t *tile;
+          const guchar    *src;
+          gint             src_stride;
+          gint             tile_x = col * RENDER_CACHE_TILE_SIZE;
+          gint             tile_y = row * RENDER_CACHE_TILE_SIZE;
+          gint             x1     = MAX (x, tile_x);
+          gint             y1     = MAX (y, tile_y);
+          gint             x2     = MIN (x + w, tile_x + RENDER_CACHE_TILE_SIZE);
+          gint             y2     = MIN (y + h, tile_y + RENDER_CACHE_TILE_SIZE);
+          guchar          *dest;
+          gint             i;
+
+          tile = gimp_display_shell_render_get_tile (shell, buffer, scale,
+                                                     col, row);
+
+          src_stride = cairo_image_surface_get_stride (tile);
+          src = (cairo_image_surface_get_data (tile) +
+                 (y1 - tile_y) * src_stride + (x1 - tile_x) * 4);
+
+          dest = data + (y1 - y) * stride + (x1 - x) * 4;
+
+          for (i = y1; i < y2; i++)
+            {
+              memcpy (dest, src, (x2 - x1) * 4);
+
+              src  += src_stride;
+              dest += stride;
+            }
+        }
+    }
+}
+
+static cairo_surface_t *
+gimp_display_shell_render_get_tile (GimpDisplayShell *shell,
+                                    GeglBuffer       *buffer,
+                                    gdouble           scale,
+                                    gint              tile_col,
+                                    gint              tile_row)
+{
+  cairo_surface_t *tile;
+  gint64           key;
+
+  key = (gint64) (((guint64) (guint32) tile_row << 32) | (guint32) tile_col);
+
+  tile = g_hash_table_lookup (shell->render_cache, &key);
+
+  if (! tile)
+    {
+      tile = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                         RENDER_CACHE_TILE_SIZE,
+                                         RENDER_CACHE_TILE_SIZE);
+
+      cairo_surface_flush (tile);
+
+      gegl_buffer_get (buffer,
+                       GEGL_RECTANGLE (tile_col * RENDER_CACHE_TILE_SIZE,
+                                       tile_row * RENDER_CACHE_TILE_SIZE,
+                                       RENDER_CACHE_TILE_SIZE,
+                                       RENDER_CACHE_TILE_SIZE),
+                       scale,
+                       babl_format ("cairo-ARGB32"),
+                       cairo_image_surface_get_data (tile),
+                       cairo_image_surface_get_stride (tile),
+                       GEGL_ABYSS_NONE);
+
+      cairo_surface_mark_dirty (tile);
+
+      /*  apply filters to the rendered projection  */
+      gimp_color_display_stack_convert_surface (shell->filter_stack, tile);
+
+      g_hash_table_insert (shell->render_cache,
+                           g_memdup (&key, sizeof (key)), tile);
+    }
+
+  return tile;
+}
+
+static gboolean
+gimp_display_shell_render_tile_in_range (gpointer key,
+                                         gpointer value,
+                                         gpointer data)
+{
+  const gint64           tile  = *(const gint64 *) key;
+  const RenderCacheRange *range = data;
+  gint                    col   = (gint32) (tile & 0xffffffff);
+  gint                    row   = (gint32) (tile >> 32);
+
+  return (col >= range->col1 && col <= range->col2 &&
+          row >= range->row1 && row <= range->row2);
+}
+
+static gboolean
+gimp_display_shell_render_tile_outside_range (gpointer key,
+                                              gpointer value,
+                                              gpointer data)
+{
+  return ! gimp_display_shell_render_tile_in_range (key, value, data);
+}
+
+/*  Keeps the cache bounded: drop everything that is not visible in
+ *  the current viewport, and everything if that is not enough.
+ */
+static void
+gimp_display_shell_render_trim (GimpDisplayShell *shell)
+{
+  RenderCacheRange range;
+  gdouble          window_scale;
+  gint             x, y, w, h;
+
+  window_scale = gimp_display_shell_render_get_window_scale (shell);
+
+  gimp_display_shell_scroll_get_scaled_viewport (shell, &x, &y, &w, &h);
+
+  range.col1 = floor (x * window_scale / RENDER_CACHE_TILE_SIZE);
+  range.row1 = floor (y * window_scale / RENDER_CACHE_TILE_SIZE);
+  range.col2 = floor (((x + w) * window_scale - 1) / RENDER_CACHE_TILE_SIZE);
+  range.row2 = floor (((y + h) * window_scale - 1) / RENDER_CACHE_TILE_SIZE);
+
+  g_hash_table_foreach_remove (shell->render_cache,
+                               gimp_display_shell_render_tile_outside_range,
+                               &range);
+
+  if (g_hash_table_size (shell->render_cache) >= RENDER_CACHE_MAX_TILES)
+    g_hash_table_remove_all (shell->render_cache);
+}
@@ -170,6 +170,8 @@ static void   gimp_display_shell_transform_overlay (GimpDisplayShell *shell,
                                                     GtkWidget        *child,
                                                     gdouble          *x,
                                                     gdouble          *y);
+static void   gimp_display_shell_update_priority_rect
+                                                   (GimpDisplayShell *shell);
 
 
 G_DEFINE_TYPE_WITH_CODE (GimpDisplayShell, gimp_display_shell,
@@ -791,6 +793,8 @@ gimp_display_shell_dispose (GObject *object)
       shell->mask_surface = NULL;
     }
 
+  gimp_display_shell_render_free (shell);
+
   if (shell->checkerboard)
     {
       cairo_pattern_destroy (shell->checkerboard);
@@ -1156,6 +1160,28 @@ gimp_display_shell_transform_overlay (GimpDisplayShell *shell,
     }
 }
 
+/*  Let the projection render what we show first, so expensive
+ *  invalidations like filter previews show up where the user looks
+ *  before the rest of the image is done in the background.
+ */
+static void
+gimp_display_shell_update_priority_rect (GimpDisplayShell *shell)
+{
+  GimpImage *image = gimp_display_get_image (shell->display);
+
+  if (image)
+    {
+      gint x, y;
+      gint width, height;
+
+      gimp_display_shell_untransform_viewport (shell,
+                                               &x, &y, &width, &height);
+
+      gimp_projection_set_priority_rect (gimp_image_get_projection (image),
+                                         x, y, width, height);
+    }
+}
+
 
 /*  public functions  */
 
@@ -1427,6 +1453,8 @@ gimp_display_shell_scale_changed (GimpDisplayShell *shell)
       shell->scale_x = 1.0;
       shell->scale_y = 1.0;
     }
+
+  gimp_display_shell_render_invalidate_full (shell);
 }
 
 void
@@ -1449,6 +1477,8 @@ gimp_display_shell_scaled (GimpDisplayShell *shell)
                                            child, x, y);
     }
 
+  gimp_display_shell_update_priority_rect (shell);
+
   g_signal_emit (shell, display_shell_signals[SCALED], 0);
 }
 
@@ -1472,6 +1502,8 @@ gimp_display_shell_scrolled (GimpDisplayShell *shell)
                                            child, x, y);
     }
 
+  gimp_display_shell_update_priority_rect (shell);
+
   g_signal_emit (shell, display_shell_signals[SCROLLED], 0);
 }
 
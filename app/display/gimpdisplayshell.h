@@ -110,6 +110,7 @@ struct _GimpDisplayShell
 
   GimpDisplayXfer   *xfer;             /*  managers image buffer transfers    */
   cairo_surface_t   *mask_surface;     /*  buffer for rendering the mask      */
+  GHashTable        *render_cache;     /*  filtered projection tiles          */
   cairo_pattern_t   *checkerboard;     /*  checkerboard pattern               */
 
   GimpCanvasItem    *canvas_item;      /*  items drawn on the canvas          */
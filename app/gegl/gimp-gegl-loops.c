@@ -30,6 +30,222 @@
 #include "gimp-gegl-loops.h"
 
 
+/*  gimp_gegl_convolve() works on a linear copy of the source, which is
+ *  split into bands of this many rows
+ */
+#define CONVOLVE_BAND_HEIGHT 16
+
+/*  below this many pixels, starting and joining the threads costs more
+ *  than it saves, and the loops run inline.  Paint core dabs mostly are
+ *  this small.
+ */
+#define MIN_PARALLEL_PIXELS  (256 * 256)
+
+
+typedef struct
+{
+  const gfloat        *src;
+  gint                 src_width;
+  gint                 src_height;
+  gint                 src_components;
+  gfloat              *dest;
+  gint                 dest_width;
+  gint                 dest_components;
+  const gfloat        *kernel;
+  gint                 kernel_size;
+  gdouble              divisor;
+  gdouble              offset;
+  GimpConvolutionType  mode;
+  gboolean             alpha_weighting;
+} ConvolveParams;
+
+typedef struct
+{
+  GeglBuffer          *src_buffer;
+  const GeglRectangle *src_rect;
+  GeglBuffer          *dest_buffer;
+  const GeglRectangle *dest_rect;
+  GimpTransferMode     mode;
+  gfloat               exposure;
+  gfloat               factor;
+} DodgeBurnParams;
+
+typedef struct
+{
+  GeglBuffer          *top_buffer;
+  const GeglRectangle *top_rect;
+  GeglBuffer          *bottom_buffer;
+  const GeglRectangle *bottom_rect;
+  GeglBuffer          *mask_buffer;
+  const GeglRectangle *mask_rect;
+  GeglBuffer          *dest_buffer;
+  const GeglRectangle *dest_rect;
+  gfloat               opacity;
+  gfloat               blend;
+  gboolean             stipple;
+  const gboolean      *affect;
+} BlendParams;
+
+
+static GArray        * gimp_gegl_loop_split              (const GeglRectangle *rect,
+                                                          gint                 chunk_width,
+                                                          gint                 chunk_height);
+static GArray        * gimp_gegl_loop_split_dest         (GeglBuffer          *dest_buffer,
+                                                          const GeglRectangle *dest_rect);
+static void            gimp_gegl_loop_run                (GArray              *areas,
+                                                          GFunc                func,
+                                                          gpointer             data);
+static GeglRectangle   gimp_gegl_loop_area               (const GeglRectangle *rect,
+                                                          const GeglRectangle *area);
+
+static void            gimp_gegl_convolve_area           (const GeglRectangle *area,
+                                                          ConvolveParams      *params);
+static void            gimp_gegl_dodgeburn_area          (const GeglRectangle *area,
+                                                          DodgeBurnParams     *params);
+static void            gimp_gegl_smudge_blend_area       (const GeglRectangle *area,
+                                                          BlendParams         *params);
+static void            gimp_gegl_apply_mask_area         (const GeglRectangle *area,
+                                                          BlendParams         *params);
+static void            gimp_gegl_combine_mask_area       (const GeglRectangle *area,
+                                                          BlendParams         *params);
+static void            gimp_gegl_combine_mask_weird_area (const GeglRectangle *area,
+                                                          BlendParams         *params);
+static void            gimp_gegl_replace_area            (const GeglRectangle *area,
+                                                          BlendParams         *params);
+
+
+/*  private functions  */
+
+/*  Splits @rect along a grid of @chunk_width x @chunk_height cells
+ *  anchored at the origin, so that for a buffer's tile size every
+ *  area covers (part of) exactly one tile.  The returned areas are
+ *  relative to @rect's origin, so the same area can be applied to the
+ *  other, equally sized rectangles a loop is called with.
+ */
+static GArray *
+gimp_gegl_loop_split (const GeglRectangle *rect,
+                      gint                 chunk_width,
+                      gint                 chunk_height)
+{
+  GArray *areas;
+  gint    x1 = rect->x;
+  gint    y1 = rect->y;
+  gint    x2 = rect->x + rect->width;
+  gint    y2 = rect->y + rect->height;
+  gint    grid_x;
+  gint    grid_y;
+  gint    x, y;
+
+  areas = g_array_new (FALSE, FALSE, sizeof (GeglRectangle));
+
+  if (rect->width < 1 || rect->height < 1)
+    return areas;
+
+  grid_x = (x1 >= 0 ?
+            x1 / chunk_width :
+            (x1 - chunk_width + 1) / chunk_width) * chunk_width;
+  grid_y = (y1 >= 0 ?
+            y1 / chunk_height :
+            (y1 - chunk_height + 1) / chunk_height) * chunk_height;
+
+  for (y = grid_y; y < y2; y += chunk_height)
+    {
+      for (x = grid_x; x < x2; x += chunk_width)
+        {
+          GeglRectangle area;
+
+          area.x      = MAX (x, x1);
+          area.y      = MAX (y, y1);
+          area.width  = MIN (x + chunk_width,  x2) - area.x;
+          area.height = MIN (y + chunk_height, y2) - area.y;
+
+          area.x -= x1;
+          area.y -= y1;
+
+          g_array_append_val (areas, area);
+        }
+    }
+
+  return areas;
+}
+
+static GArray *
+gimp_gegl_loop_split_dest (GeglBuffer          *dest_buffer,
+                           const GeglRectangle *dest_rect)
+{
+  gint tile_width;
+  gint tile_height;
+
+  g_object_get (dest_buffer,
+                "tile-width",  &tile_width,
+                "tile-height", &tile_height,
+                NULL);
+
+  return gimp_gegl_loop_split (dest_rect, tile_width, tile_height);
+}
+
+/*  Calls @func for each area in @areas, on a thread pool if GEGL is
+ *  configured to use more than one thread and the areas are large
+ *  enough to be worth it.  Areas never overlap, so @func only needs to
+ *  be reentrant.
+ */
+static void
+gimp_gegl_loop_run (GArray   *areas,
+                    GFunc     func,
+                    gpointer  data)
+{
+  gint64 n_pixels = 0;
+  gint   n_threads;
+  gint   i;
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  for (i = 0; i < areas->len; i++)
+    {
+      const GeglRectangle *area = &g_array_index (areas, GeglRectangle, i);
+
+      n_pixels += (gint64) area->width * area->height;
+    }
+
+  if (n_threads > 1 && areas->len > 1 && n_pixels >= MIN_PARALLEL_PIXELS)
+    {
+      GThreadPool *pool;
+
+      pool = g_thread_pool_new (func, data,
+                                MIN (n_threads, areas->len), FALSE, NULL);
+
+      for (i = 0; i < areas->len; i++)
+        g_thread_pool_push (pool,
+                            &g_array_index (areas, GeglRectangle, i), NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (i = 0; i < areas->len; i++)
+        func (&g_array_index (areas, GeglRectangle, i), data);
+    }
+
+  g_array_free (areas, TRUE);
+}
+
+static GeglRectangle
+gimp_gegl_loop_area (const GeglRectangle *rect,
+                     const GeglRectangle *area)
+{
+  GeglRectangle result;
+
+  result.x      = rect->x + area->x;
+  result.y      = rect->y + area->y;
+  result.width  = area->width;
+  result.height = area->height;
+
+  return result;
+}
+
+
+/*  public functions  */
+
 void
 gimp_gegl_convolve (GeglBuffer          *src_buffer,
                     const GeglRectangle *src_rect,
@@ -41,13 +257,13 @@ gimp_gegl_convolve (GeglBuffer          *src_buffer,
                     GimpConvolutionType  mode,
                     gboolean             alpha_weighting)
 {
-  GeglBufferIterator *iter;
-  GeglRectangle      *src_roi;
-  GeglRectangle      *dest_roi;
-  const Babl         *src_format;
-  const Babl         *dest_format;
-  gint                src_components;
-  gint                dest_components;
+  ConvolveParams  params;
+  const Babl     *src_format;
+  const Babl     *dest_format;
+  gfloat         *src;
+  gfloat         *dest;
+  gint            width;
+  gint            height;
 
   src_format = gegl_buffer_get_format (src_buffer);
 
@@ -71,135 +287,177 @@ gimp_gegl_convolve (GeglBuffer          *src_buffer,
                                     GIMP_PRECISION_FLOAT_LINEAR,
                                     babl_format_has_alpha (dest_format));
 
-  src_components  = babl_format_get_n_components (src_format);
-  dest_components = babl_format_get_n_components (dest_format);
+  if (! src_rect)
+    src_rect = gegl_buffer_get_extent (src_buffer);
 
-  iter = gegl_buffer_iterator_new (src_buffer, src_rect, 0, src_format,
-                                   GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
-  src_roi = &iter->roi[0];
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0, dest_format,
-                            GEGL_BUFFER_WRITE, GEGL_ABYSS_NONE);
-  dest_roi = &iter->roi[1];
+  width  = MIN (src_rect->width,  dest_rect->width);
+  height = MIN (src_rect->height, dest_rect->height);
 
-  while (gegl_buffer_iterator_next (iter))
+  if (width < 1 || height < 1)
+    return;
+
+  params.src_width       = src_rect->width;
+  params.src_height      = src_rect->height;
+  params.src_components  = babl_format_get_n_components (src_format);
+  params.dest_width      = width;
+  params.dest_components = babl_format_get_n_components (dest_format);
+  params.kernel          = kernel;
+  params.kernel_size     = kernel_size;
+  params.divisor         = divisor;
+  params.alpha_weighting = alpha_weighting;
+
+  /*  If the mode is NEGATIVE_CONVOL, the offset should be 128  */
+  if (mode == GIMP_NEGATIVE_CONVOL)
     {
-      /*  Convolve the src image using the convolution kernel, writing
-       *  to dest Convolve is not tile-enabled--use accordingly
-       */
-      const gfloat *src         = iter->data[0];
-      gfloat       *dest        = iter->data[1];
-      const gint    components  = src_components;
-      const gint    a_component = components - 1;
-      const gint    rowstride   = src_components * src_roi->width;
-      const gint    margin      = kernel_size / 2;
-      const gint    x1          = src_roi->x;
-      const gint    y1          = src_roi->y;
-      const gint    x2          = src_roi->x + src_roi->width  - 1;
-      const gint    y2          = src_roi->y + src_roi->height - 1;
-      gint          x, y;
-      gfloat        offset;
-
-      /*  If the mode is NEGATIVE_CONVOL, the offset should be 128  */
-      if (mode == GIMP_NEGATIVE_CONVOL)
-        {
-          offset = 0.5;
-          mode = GIMP_NORMAL_CONVOL;
-        }
-      else
-        {
-          offset = 0.0;
-        }
+      params.offset = 0.5;
+      params.mode   = GIMP_NORMAL_CONVOL;
+    }
+  else
+    {
+      params.offset = 0.0;
+      params.mode   = mode;
+    }
 
-      for (y = 0; y < dest_roi->height; y++)
-        {
-          gfloat *d = dest;
+  /*  every output pixel reads a kernel_size x kernel_size neighborhood,
+   *  so fetch the whole source once and convolve bands of rows from
+   *  memory, instead of going through the buffer for each of them
+   */
+  src  = g_new (gfloat, params.src_width * params.src_height *
+                        params.src_components);
+  dest = g_new (gfloat, width * height * params.dest_components);
+
+  gegl_buffer_get (src_buffer, src_rect, 1.0, src_format, src,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  params.src  = src;
+  params.dest = dest;
 
-          if (alpha_weighting)
+  gimp_gegl_loop_run (gimp_gegl_loop_split (GEGL_RECTANGLE (0, 0,
+                                                            width, height),
+                                            width, CONVOLVE_BAND_HEIGHT),
+                      (GFunc) gimp_gegl_convolve_area, &params);
+
+  gegl_buffer_set (dest_buffer,
+                   GEGL_RECTANGLE (dest_rect->x, dest_rect->y, width, height),
+                   0, dest_format, dest, GEGL_AUTO_ROWSTRIDE);
+
+  g_free (src);
+  g_free (dest);
+}
+
+static void
+gimp_gegl_convolve_area (const GeglRectangle *area,
+                         ConvolveParams      *params)
+{
+  /*  Convolve the src image using the convolution kernel, writing
+   *  to dest.  Pixels outside the source are clamped to its edges.
+   */
+  const gfloat *src         = params->src;
+  const gint    components  = params->src_components;
+  const gint    a_component = components - 1;
+  const gint    rowstride   = components * params->src_width;
+  const gint    margin      = params->kernel_size / 2;
+  const gint    x2          = params->src_width  - 1;
+  const gint    y2          = params->src_height - 1;
+  const gfloat  offset      = params->offset;
+  const gdouble divisor     = params->divisor;
+  const gint    abs_values  = params->mode != GIMP_NORMAL_CONVOL;
+  gint          x, y;
+
+  for (y = area->y; y < area->y + area->height; y++)
+    {
+      gfloat *d = params->dest + (y * params->dest_width + area->x) *
+                                 params->dest_components;
+
+      if (params->alpha_weighting)
+        {
+          for (x = area->x; x < area->x + area->width; x++)
             {
-              for (x = 0; x < dest_roi->width; x++)
+              const gfloat *m                = params->kernel;
+              gdouble       total[4]         = { 0.0, 0.0, 0.0, 0.0 };
+              gdouble       weighted_divisor = 0.0;
+              gint          i, j, b;
+
+              for (j = y - margin; j <= y + margin; j++)
                 {
-                  const gfloat *m                = kernel;
-                  gdouble       total[4]         = { 0.0, 0.0, 0.0, 0.0 };
-                  gdouble       weighted_divisor = 0.0;
-                  gint          i, j, b;
+                  const gfloat *row = src + CLAMP (j, 0, y2) * rowstride;
 
-                  for (j = y - margin; j <= y + margin; j++)
+                  for (i = x - margin; i <= x + margin; i++, m++)
                     {
-                      for (i = x - margin; i <= x + margin; i++, m++)
-                        {
-                          gint          xx = CLAMP (i, x1, x2);
-                          gint          yy = CLAMP (j, y1, y2);
-                          const gfloat *s  = src + yy * rowstride + xx * components;
-                          const gfloat  a  = s[a_component];
+                      const gfloat *s = row + CLAMP (i, 0, x2) * components;
+                      const gfloat  a = s[a_component];
 
-                          if (a)
-                            {
-                              gdouble mult_alpha = *m * a;
+                      if (a)
+                        {
+                          gdouble mult_alpha = *m * a;
 
-                              weighted_divisor += mult_alpha;
+                          weighted_divisor += mult_alpha;
 
-                              for (b = 0; b < a_component; b++)
-                                total[b] += mult_alpha * s[b];
+                          for (b = 0; b < a_component; b++)
+                            total[b] += mult_alpha * s[b];
 
-                              total[a_component] += mult_alpha;
-                            }
+                          total[a_component] += mult_alpha;
                         }
                     }
+                }
 
-                  if (weighted_divisor == 0.0)
-                    weighted_divisor = divisor;
+              if (weighted_divisor == 0.0)
+                weighted_divisor = divisor;
 
-                  for (b = 0; b < a_component; b++)
-                    total[b] /= weighted_divisor;
+              for (b = 0; b < a_component; b++)
+                total[b] /= weighted_divisor;
 
-                  total[a_component] /= divisor;
+              total[a_component] /= divisor;
 
-                  for (b = 0; b < components; b++)
-                    {
-                      total[b] += offset;
+              for (b = 0; b < components; b++)
+                {
+                  total[b] += offset;
 
-                      if (mode != GIMP_NORMAL_CONVOL && total[b] < 0.0)
-                        total[b] = - total[b];
+                  if (abs_values && total[b] < 0.0)
+                    total[b] = - total[b];
 
-                      *d++ = CLAMP (total[b], 0.0, 1.0);
-                    }
+                  d[b] = CLAMP (total[b], 0.0, 1.0);
                 }
+
+              d += params->dest_components;
             }
-          else
+        }
+      else
+        {
+          for (x = area->x; x < area->x + area->width; x++)
             {
-              for (x = 0; x < dest_roi->width; x++)
+              const gfloat *m        = params->kernel;
+              gdouble       total[4] = { 0.0, 0.0, 0.0, 0.0 };
+              gint          i, j, b;
+
+              for (j = y - margin; j <= y + margin; j++)
                 {
-                  const gfloat *m        = kernel;
-                  gdouble       total[4] = { 0.0, 0.0, 0.0, 0.0 };
-                  gint          i, j, b;
+                  const gfloat *row = src + CLAMP (j, 0, y2) * rowstride;
 
-                  for (j = y - margin; j <= y + margin; j++)
+                  for (i = x - margin; i <= x + margin; i++, m++)
                     {
-                      for (i = x - margin; i <= x + margin; i++, m++)
-                        {
-                          gint          xx = CLAMP (i, x1, x2);
-                          gint          yy = CLAMP (j, y1, y2);
-                          const gfloat *s  = src + yy * rowstride + xx * components;
+                      const gfloat *s = row + CLAMP (i, 0, x2) * components;
 
-                          for (b = 0; b < components; b++)
-                            total[b] += *m * s[b];
-                        }
+                      for (b = 0; b < components; b++)
+                        total[b] += *m * s[b];
                     }
+                }
 
-                  for (b = 0; b < components; b++)
-                    {
-                      total[b] = total[b] / divisor + offset;
+              for (b = 0; b < components; b++)
+                {
+                  total[b] = total[b] / divisor + offset;
 
-                      if (mode != GIMP_NORMAL_CONVOL && total[b] < 0.0)
-                        total[b] = - total[b];
+                  if (abs_values && total[b] < 0.0)
+                    total[b] = - total[b];
 
-                      total[b] = CLAMP (total[b], 0.0, 1.0);
-                    }
+                  d[b] = CLAMP (total[b], 0.0, 1.0);
                 }
-            }
 
-          dest += dest_roi->width * dest_components;
+              d += params->dest_components;
+            }
         }
     }
 }
@@ -213,112 +471,133 @@ gimp_gegl_dodgeburn (GeglBuffer          *src_buffer,
                      GimpDodgeBurnType    type,
                      GimpTransferMode     mode)
 {
-  GeglBufferIterator *iter;
+  DodgeBurnParams params;
 
   if (type == GIMP_BURN)
     exposure = -exposure;
 
-  iter = gegl_buffer_iterator_new (src_buffer, src_rect, 0,
-                                   babl_format ("R'G'B'A float"),
-                                   GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
+  if (! src_rect)
+    src_rect = gegl_buffer_get_extent (src_buffer);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0,
-                            babl_format ("R'G'B'A float"),
-                            GEGL_BUFFER_WRITE, GEGL_ABYSS_NONE);
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
+
+  params.src_buffer  = src_buffer;
+  params.src_rect    = src_rect;
+  params.dest_buffer = dest_buffer;
+  params.dest_rect   = dest_rect;
+  params.mode        = mode;
+  params.exposure    = exposure;
 
   switch (mode)
     {
-      gfloat factor;
-
     case GIMP_HIGHLIGHTS:
-      factor = 1.0 + exposure * (0.333333);
-
-      while (gegl_buffer_iterator_next (iter))
-        {
-          gfloat *src  = iter->data[0];
-          gfloat *dest = iter->data[1];
-
-          while (iter->length--)
-            {
-              *dest++ = *src++ * factor;
-              *dest++ = *src++ * factor;
-              *dest++ = *src++ * factor;
-
-              *dest++ = *src++;
-            }
-        }
+      params.factor = 1.0 + exposure * (0.333333);
       break;
 
     case GIMP_MIDTONES:
       if (exposure < 0)
-        factor = 1.0 - exposure * (0.333333);
+        params.factor = 1.0 - exposure * (0.333333);
       else
-        factor = 1.0 / (1.0 + exposure);
-
-      while (gegl_buffer_iterator_next (iter))
-        {
-          gfloat *src  = iter->data[0];
-          gfloat *dest = iter->data[1];
-
-          while (iter->length--)
-            {
-              *dest++ = pow (*src++, factor);
-              *dest++ = pow (*src++, factor);
-              *dest++ = pow (*src++, factor);
-
-              *dest++ = *src++;
-            }
-        }
+        params.factor = 1.0 / (1.0 + exposure);
       break;
 
     case GIMP_SHADOWS:
       if (exposure >= 0)
-        factor = 0.333333 * exposure;
+        params.factor = 0.333333 * exposure;
       else
-        factor = -0.333333 * exposure;
+        params.factor = -0.333333 * exposure;
+      break;
+    }
+
+  gimp_gegl_loop_run (gimp_gegl_loop_split_dest (dest_buffer, dest_rect),
+                      (GFunc) gimp_gegl_dodgeburn_area, &params);
+}
+
+/*  The per-pixel loops below are written as plain counted loops over
+ *  the iterator's data, with the constant parts hoisted and branches
+ *  reduced to selects, so the compiler can vectorize them.
+ */
+static void
+gimp_gegl_dodgeburn_area (const GeglRectangle *area,
+                          DodgeBurnParams     *params)
+{
+  GeglBufferIterator *iter;
+  GeglRectangle       src_rect  = gimp_gegl_loop_area (params->src_rect,  area);
+  GeglRectangle       dest_rect = gimp_gegl_loop_area (params->dest_rect, area);
+  const gfloat        factor    = params->factor;
+
+  iter = gegl_buffer_iterator_new (params->src_buffer, &src_rect, 0,
+                                   babl_format ("R'G'B'A float"),
+                                   GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-      while (gegl_buffer_iterator_next (iter))
+  gegl_buffer_iterator_add (iter, params->dest_buffer, &dest_rect, 0,
+                            babl_format ("R'G'B'A float"),
+                            GEGL_BUFFER_WRITE, GEGL_ABYSS_NONE);
+
+  while (gegl_buffer_iterator_next (iter))
+    {
+      const gfloat *src    = iter->data[0];
+      gfloat       *dest   = iter->data[1];
+      const gint    length = iter->length;
+      gint          i;
+
+      switch (params->mode)
         {
-          gfloat *src  = iter->data[0];
-          gfloat *dest = iter->data[1];
+        case GIMP_HIGHLIGHTS:
+          for (i = 0; i < length * 4; i += 4)
+            {
+              dest[i + 0] = src[i + 0] * factor;
+              dest[i + 1] = src[i + 1] * factor;
+              dest[i + 2] = src[i + 2] * factor;
+              dest[i + 3] = src[i + 3];
+            }
+          break;
 
-          while (iter->length--)
+        case GIMP_MIDTONES:
+          for (i = 0; i < length * 4; i += 4)
             {
-              if (exposure >= 0)
-                {
-                  gfloat s;
+              dest[i + 0] = pow (src[i + 0], factor);
+              dest[i + 1] = pow (src[i + 1], factor);
+              dest[i + 2] = pow (src[i + 2], factor);
+              dest[i + 3] = src[i + 3];
+            }
+          break;
 
-                  s = *src++; *dest++ = factor + s - factor * s;
-                  s = *src++; *dest++ = factor + s - factor * s;
-                  s = *src++; *dest++ = factor + s - factor * s;
-                }
-              else
+        case GIMP_SHADOWS:
+          if (params->exposure >= 0)
+            {
+              const gfloat scale = 1.0 - factor;
+
+              for (i = 0; i < length * 4; i += 4)
                 {
-                  gfloat s;
-
-                  s = *src++;
-                  if (s < factor)
-                    *dest++ = 0;
-                  else /* factor <= value <=1 */
-                    *dest++ = (s - factor) / (1.0 - factor);
-
-                  s = *src++;
-                  if (s < factor)
-                    *dest++ = 0;
-                  else /* factor <= value <=1 */
-                    *dest++ = (s - factor) / (1.0 - factor);
-
-                  s = *src++;
-                  if (s < factor)
-                    *dest++ = 0;
-                  else /* factor <= value <=1 */
-                    *dest++ = (s - factor) / (1.0 - factor);
+                  dest[i + 0] = factor + src[i + 0] * scale;
+                  dest[i + 1] = factor + src[i + 1] * scale;
+                  dest[i + 2] = factor + src[i + 2] * scale;
+                  dest[i + 3] = src[i + 3];
                 }
+            }
+          else
+            {
+              const gfloat scale = 1.0 / (1.0 - factor);
 
-              *dest++ = *src++;
-           }
+              /*  values below factor go to 0, factor <= value <= 1
+               *  gets stretched to 0..1
+               */
+              for (i = 0; i < length * 4; i += 4)
+                {
+                  const gfloat r = src[i + 0];
+                  const gfloat g = src[i + 1];
+                  const gfloat b = src[i + 2];
+
+                  dest[i + 0] = r < factor ? 0.0f : (r - factor) * scale;
+                  dest[i + 1] = g < factor ? 0.0f : (g - factor) * scale;
+                  dest[i + 2] = b < factor ? 0.0f : (b - factor) * scale;
+                  dest[i + 3] = src[i + 3];
+                }
+            }
+          break;
         }
-      break;
     }
 }
 
@@ -338,17 +617,52 @@ gimp_gegl_smudge_blend (GeglBuffer          *top_buffer,
                         const GeglRectangle *dest_rect,
                         gdouble              blend)
 {
-  GeglBufferIterator *iter;
+  BlendParams params = { 0, };
+
+  if (! top_rect)
+    top_rect = gegl_buffer_get_extent (top_buffer);
+
+  if (! bottom_rect)
+    bottom_rect = gegl_buffer_get_extent (bottom_buffer);
+
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
+
+  params.top_buffer    = top_buffer;
+  params.top_rect      = top_rect;
+  params.bottom_buffer = bottom_buffer;
+  params.bottom_rect   = bottom_rect;
+  params.dest_buffer   = dest_buffer;
+  params.dest_rect     = dest_rect;
+  params.blend         = blend;
 
-  iter = gegl_buffer_iterator_new (top_buffer, top_rect, 0,
+  gimp_gegl_loop_run (gimp_gegl_loop_split_dest (dest_buffer, dest_rect),
+                      (GFunc) gimp_gegl_smudge_blend_area, &params);
+}
+
+static void
+gimp_gegl_smudge_blend_area (const GeglRectangle *area,
+                             BlendParams         *params)
+{
+  GeglBufferIterator *iter;
+  GeglRectangle       top_rect    = gimp_gegl_loop_area (params->top_rect,
+                                                         area);
+  GeglRectangle       bottom_rect = gimp_gegl_loop_area (params->bottom_rect,
+                                                         area);
+  GeglRectangle       dest_rect   = gimp_gegl_loop_area (params->dest_rect,
+                                                         area);
+  const gfloat        blend1      = 1.0 - params->blend;
+  const gfloat        blend2      = params->blend;
+
+  iter = gegl_buffer_iterator_new (params->top_buffer, &top_rect, 0,
                                    babl_format ("RGBA float"),
                                    GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, bottom_buffer, bottom_rect, 0,
+  gegl_buffer_iterator_add (iter, params->bottom_buffer, &bottom_rect, 0,
                             babl_format ("RGBA float"),
                             GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0,
+  gegl_buffer_iterator_add (iter, params->dest_buffer, &dest_rect, 0,
                             babl_format ("RGBA float"),
                             GEGL_BUFFER_WRITE, GEGL_ABYSS_NONE);
 
@@ -357,33 +671,25 @@ gimp_gegl_smudge_blend (GeglBuffer          *top_buffer,
       const gfloat *top    = iter->data[0];
       const gfloat *bottom = iter->data[1];
       gfloat       *dest   = iter->data[2];
-      const gfloat  blend1 = 1.0 - blend;
-      const gfloat  blend2 = blend;
+      const gint    length = iter->length;
+      gint          i;
 
-      while (iter->length--)
+      for (i = 0; i < length * 4; i += 4)
         {
-          const gfloat a1 = blend1 * bottom[3];
-          const gfloat a2 = blend2 * top[3];
+          const gfloat a1 = blend1 * bottom[i + 3];
+          const gfloat a2 = blend2 * top[i + 3];
           const gfloat a  = a1 + a2;
           gint         b;
 
-          if (a == 0)
-            {
-              for (b = 0; b < 4; b++)
-                dest[b] = 0;
-            }
-          else
+          for (b = 0; b < 3; b++)
             {
-              for (b = 0; b < 3; b++)
-                dest[b] =
-                  bottom[b] + (bottom[b] * a1 + top[b] * a2 - a * bottom[b]);
+              const gfloat c = bottom[i + b];
 
-              dest[3] = a;
+              dest[i + b] = a == 0 ?
+                            0.0f : c + (c * a1 + top[i + b] * a2 - a * c);
             }
 
-          top    += 4;
-          bottom += 4;
-          dest   += 4;
+          dest[i + 3] = a;
         }
     }
 }
@@ -394,29 +700,53 @@ gimp_gegl_apply_mask (GeglBuffer          *mask_buffer,
                       GeglBuffer          *dest_buffer,
                       const GeglRectangle *dest_rect,
                       gdouble              opacity)
+{
+  BlendParams params = { 0, };
+
+  if (! mask_rect)
+    mask_rect = gegl_buffer_get_extent (mask_buffer);
+
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
+
+  params.mask_buffer = mask_buffer;
+  params.mask_rect   = mask_rect;
+  params.dest_buffer = dest_buffer;
+  params.dest_rect   = dest_rect;
+  params.opacity     = opacity;
+
+  gimp_gegl_loop_run (gimp_gegl_loop_split_dest (dest_buffer, dest_rect),
+                      (GFunc) gimp_gegl_apply_mask_area, &params);
+}
+
+static void
+gimp_gegl_apply_mask_area (const GeglRectangle *area,
+                           BlendParams         *params)
 {
   GeglBufferIterator *iter;
+  GeglRectangle       mask_rect = gimp_gegl_loop_area (params->mask_rect,
+                                                       area);
+  GeglRectangle       dest_rect = gimp_gegl_loop_area (params->dest_rect,
+                                                       area);
+  const gfloat        opacity   = params->opacity;
 
-  iter = gegl_buffer_iterator_new (mask_buffer, mask_rect, 0,
+  iter = gegl_buffer_iterator_new (params->mask_buffer, &mask_rect, 0,
                                    babl_format ("Y float"),
                                    GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0,
+  gegl_buffer_iterator_add (iter, params->dest_buffer, &dest_rect, 0,
                             babl_format ("RGBA float"),
                             GEGL_BUFFER_READWRITE, GEGL_ABYSS_NONE);
 
   while (gegl_buffer_iterator_next (iter))
     {
-      const gfloat *mask = iter->data[0];
-      gfloat       *dest = iter->data[1];
-
-      while (iter->length--)
-        {
-          dest[3] *= *mask * opacity;
+      const gfloat *mask   = iter->data[0];
+      gfloat       *dest   = iter->data[1];
+      const gint    length = iter->length;
+      gint          i;
 
-          mask += 1;
-          dest += 4;
-        }
+      for (i = 0; i < length; i++)
+        dest[i * 4 + 3] *= mask[i] * opacity;
     }
 }
 
@@ -426,29 +756,53 @@ gimp_gegl_combine_mask (GeglBuffer          *mask_buffer,
                         GeglBuffer          *dest_buffer,
                         const GeglRectangle *dest_rect,
                         gdouble              opacity)
+{
+  BlendParams params = { 0, };
+
+  if (! mask_rect)
+    mask_rect = gegl_buffer_get_extent (mask_buffer);
+
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
+
+  params.mask_buffer = mask_buffer;
+  params.mask_rect   = mask_rect;
+  params.dest_buffer = dest_buffer;
+  params.dest_rect   = dest_rect;
+  params.opacity     = opacity;
+
+  gimp_gegl_loop_run (gimp_gegl_loop_split_dest (dest_buffer, dest_rect),
+                      (GFunc) gimp_gegl_combine_mask_area, &params);
+}
+
+static void
+gimp_gegl_combine_mask_area (const GeglRectangle *area,
+                             BlendParams         *params)
 {
   GeglBufferIterator *iter;
+  GeglRectangle       mask_rect = gimp_gegl_loop_area (params->mask_rect,
+                                                       area);
+  GeglRectangle       dest_rect = gimp_gegl_loop_area (params->dest_rect,
+                                                       area);
+  const gfloat        opacity   = params->opacity;
 
-  iter = gegl_buffer_iterator_new (mask_buffer, mask_rect, 0,
+  iter = gegl_buffer_iterator_new (params->mask_buffer, &mask_rect, 0,
                                    babl_format ("Y float"),
                                    GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0,
+  gegl_buffer_iterator_add (iter, params->dest_buffer, &dest_rect, 0,
                             babl_format ("Y float"),
                             GEGL_BUFFER_READWRITE, GEGL_ABYSS_NONE);
 
   while (gegl_buffer_iterator_next (iter))
     {
-      const gfloat *mask = iter->data[0];
-      gfloat       *dest = iter->data[1];
-
-      while (iter->length--)
-        {
-          *dest *= *mask * opacity;
+      const gfloat *mask   = iter->data[0];
+      gfloat       *dest   = iter->data[1];
+      const gint    length = iter->length;
+      gint          i;
 
-          mask += 1;
-          dest += 1;
-        }
+      for (i = 0; i < length; i++)
+        dest[i] *= mask[i] * opacity;
     }
 }
 
@@ -459,41 +813,64 @@ gimp_gegl_combine_mask_weird (GeglBuffer          *mask_buffer,
                               const GeglRectangle *dest_rect,
                               gdouble              opacity,
                               gboolean             stipple)
+{
+  BlendParams params = { 0, };
+
+  if (! mask_rect)
+    mask_rect = gegl_buffer_get_extent (mask_buffer);
+
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
+
+  params.mask_buffer = mask_buffer;
+  params.mask_rect   = mask_rect;
+  params.dest_buffer = dest_buffer;
+  params.dest_rect   = dest_rect;
+  params.opacity     = opacity;
+  params.stipple     = stipple;
+
+  gimp_gegl_loop_run (gimp_gegl_loop_split_dest (dest_buffer, dest_rect),
+                      (GFunc) gimp_gegl_combine_mask_weird_area, &params);
+}
+
+static void
+gimp_gegl_combine_mask_weird_area (const GeglRectangle *area,
+                                   BlendParams         *params)
 {
   GeglBufferIterator *iter;
+  GeglRectangle       mask_rect = gimp_gegl_loop_area (params->mask_rect,
+                                                       area);
+  GeglRectangle       dest_rect = gimp_gegl_loop_area (params->dest_rect,
+                                                       area);
+  const gfloat        opacity   = params->opacity;
 
-  iter = gegl_buffer_iterator_new (mask_buffer, mask_rect, 0,
+  iter = gegl_buffer_iterator_new (params->mask_buffer, &mask_rect, 0,
                                    babl_format ("Y float"),
                                    GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0,
+  gegl_buffer_iterator_add (iter, params->dest_buffer, &dest_rect, 0,
                             babl_format ("Y float"),
                             GEGL_BUFFER_READWRITE, GEGL_ABYSS_NONE);
 
   while (gegl_buffer_iterator_next (iter))
     {
-      const gfloat *mask = iter->data[0];
-      gfloat       *dest = iter->data[1];
+      const gfloat *mask   = iter->data[0];
+      gfloat       *dest   = iter->data[1];
+      const gint    length = iter->length;
+      gint          i;
 
-      if (stipple)
+      if (params->stipple)
         {
-          while (iter->length--)
-            {
-              dest[0] += (1.0 - dest[0]) * *mask * opacity;
-
-              mask += 1;
-              dest += 1;
-            }
+          for (i = 0; i < length; i++)
+            dest[i] += (1.0f - dest[i]) * mask[i] * opacity;
         }
       else
         {
-          while (iter->length--)
+          for (i = 0; i < length; i++)
             {
-              if (opacity > dest[0])
-                dest[0] += (opacity - dest[0]) * *mask * opacity;
+              const gfloat d = dest[i];
 
-              mask += 1;
-              dest += 1;
+              dest[i] = opacity > d ? d + (opacity - d) * mask[i] * opacity : d;
             }
         }
     }
@@ -511,21 +888,64 @@ gimp_gegl_replace (GeglBuffer          *top_buffer,
                    gdouble              opacity,
                    const gboolean      *affect)
 {
-  GeglBufferIterator *iter;
+  BlendParams params = { 0, };
+
+  if (! top_rect)
+    top_rect = gegl_buffer_get_extent (top_buffer);
+
+  if (! bottom_rect)
+    bottom_rect = gegl_buffer_get_extent (bottom_buffer);
+
+  if (! mask_rect)
+    mask_rect = gegl_buffer_get_extent (mask_buffer);
 
-  iter = gegl_buffer_iterator_new (top_buffer, top_rect, 0,
+  if (! dest_rect)
+    dest_rect = gegl_buffer_get_extent (dest_buffer);
+
+  params.top_buffer    = top_buffer;
+  params.top_rect      = top_rect;
+  params.bottom_buffer = bottom_buffer;
+  params.bottom_rect   = bottom_rect;
+  params.mask_buffer   = mask_buffer;
+  params.mask_rect     = mask_rect;
+  params.dest_buffer   = dest_buffer;
+  params.dest_rect     = dest_rect;
+  params.opacity       = opacity;
+  params.affect        = affect;
+
+  gimp_gegl_loop_run (gimp_gegl_loop_split_dest (dest_buffer, dest_rect),
+                      (GFunc) gimp_gegl_replace_area, &params);
+}
+
+static void
+gimp_gegl_replace_area (const GeglRectangle *area,
+                        BlendParams         *params)
+{
+  GeglBufferIterator *iter;
+  GeglRectangle       top_rect    = gimp_gegl_loop_area (params->top_rect,
+                                                         area);
+  GeglRectangle       bottom_rect = gimp_gegl_loop_area (params->bottom_rect,
+                                                         area);
+  GeglRectangle       mask_rect   = gimp_gegl_loop_area (params->mask_rect,
+                                                         area);
+  GeglRectangle       dest_rect   = gimp_gegl_loop_area (params->dest_rect,
+                                                         area);
+  const gboolean     *affect      = params->affect;
+  const gdouble       opacity     = params->opacity;
+
+  iter = gegl_buffer_iterator_new (params->top_buffer, &top_rect, 0,
                                    babl_format ("RGBA float"),
                                    GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, bottom_buffer, bottom_rect, 0,
+  gegl_buffer_iterator_add (iter, params->bottom_buffer, &bottom_rect, 0,
                             babl_format ("RGBA float"),
                             GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, mask_buffer, mask_rect, 0,
+  gegl_buffer_iterator_add (iter, params->mask_buffer, &mask_rect, 0,
                             babl_format ("Y float"),
                             GEGL_BUFFER_READ, GEGL_ABYSS_NONE);
 
-  gegl_buffer_iterator_add (iter, dest_buffer, dest_rect, 0,
+  gegl_buffer_iterator_add (iter, params->dest_buffer, &dest_rect, 0,
                             babl_format ("RGBA float"),
                             GEGL_BUFFER_WRITE, GEGL_ABYSS_NONE);
 
@@ -535,8 +955,10 @@ gimp_gegl_replace (GeglBuffer          *top_buffer,
       const gfloat *bottom = iter->data[1];
       const gfloat *mask   = iter->data[2];
       gfloat       *dest   = iter->data[3];
+      const gint    length = iter->length;
+      gint          i;
 
-      while (iter->length--)
+      for (i = 0; i < length; i++)
         {
           gint    b;
           gdouble mask_val = *mask * opacity;
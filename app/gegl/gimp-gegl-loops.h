@@ -22,8 +22,8 @@
 #define __GIMP_GEGL_LOOPS_H__
 
 
-/*  this is a pretty stupid port of concolve_region() that only works
- *  on a linear source buffer
+/*  this is a pretty stupid port of concolve_region(), it fetches the
+ *  whole source rectangle into memory, so keep it small
  */
 void   gimp_gegl_convolve           (GeglBuffer          *src_buffer,
                                      const GeglRectangle *src_rect,
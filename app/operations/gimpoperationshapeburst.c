@@ -32,6 +32,13 @@
 #include "gimpoperationshapeburst.h"
 
 
+/*  number of columns or rows processed per thread pool job  */
+#define SHAPEBURST_BAND_SIZE 32
+
+/*  larger than any squared distance within a buffer  */
+#define SHAPEBURST_INFINITY  1e20
+
+
 enum
 {
   PROP_0,
@@ -40,6 +47,22 @@ enum
 };
 
 
+typedef struct
+{
+  gint    start;
+  gint    end;
+  gfloat  max;
+} ShapeburstBand;
+
+typedef struct
+{
+  const guchar   *src;
+  gfloat         *dist;
+  gint            width;
+  gint            height;
+} ShapeburstData;
+
+
 static void     gimp_operation_shapeburst_get_property (GObject      *object,
                                                         guint         property_id,
                                                         GValue       *value,
@@ -63,6 +86,21 @@ static gboolean gimp_operation_shapeburst_process (GeglOperation       *operatio
                                                    const GeglRectangle *roi,
                                                    gint                 level);
 
+static ShapeburstBand *
+                gimp_operation_shapeburst_run       (GFunc           func,
+                                                     ShapeburstData *data,
+                                                     gint            n,
+                                                     gint           *n_bands);
+static void     gimp_operation_shapeburst_transform (const gdouble  *f,
+                                                     gdouble        *d,
+                                                     gint            n,
+                                                     gint           *v,
+                                                     gdouble        *z);
+static void     gimp_operation_shapeburst_columns   (ShapeburstBand *band,
+                                                     ShapeburstData *data);
+static void     gimp_operation_shapeburst_rows      (ShapeburstBand *band,
+                                                     ShapeburstData *data);
+
 
 G_DEFINE_TYPE (GimpOperationShapeburst, gimp_operation_shapeburst,
                GEGL_TYPE_OPERATION_FILTER)
@@ -189,132 +227,238 @@ gimp_operation_shapeburst_process (GeglOperation       *operation,
                                    const GeglRectangle *roi,
                                    gint                 level)
 {
-  const Babl *input_format   = babl_format ("Y u8");
-  const Babl *output_format  = babl_format ("Y float");
-  gfloat      max_iterations = 0.0;
-  gfloat     *distp_cur;
-  gfloat     *distp_prev;
-  gfloat     *memory;
-  gint        length;
-  gint        i;
-
-  length = roi->width + 1;
-  memory = g_new (gfloat, length * 2);
-
-  distp_prev = memory;
-  for (i = 0; i < length; i++)
-    distp_prev[i] = 0.0;
-
-  distp_prev += 1;
-  distp_cur = distp_prev + length;
-
-  for (i = 0; i < roi->height; i++)
-    {
-      gfloat *tmp;
-      gint    src = 0;
-      gint    j;
+  const Babl     *input_format   = babl_format ("Y u8");
+  const Babl     *output_format  = babl_format ("Y float");
+  ShapeburstData  data;
+  ShapeburstBand *bands;
+  gfloat          max_iterations = 0.0;
+  gint            n_bands;
+  gint            i;
+
+  data.width  = roi->width;
+  data.height = roi->height;
+  data.src    = g_new (guchar, data.width * data.height);
+  data.dist   = g_new (gfloat, data.width * data.height);
+
+  gegl_buffer_get (input, roi, 1.0, input_format, data.src,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  /*  first the squared distance to the nearest unselected pixel in
+   *  each column, then combine the columns along each row
+   */
+  bands = gimp_operation_shapeburst_run ((GFunc) gimp_operation_shapeburst_columns,
+                                         &data, data.width, &n_bands);
+  g_free (bands);
 
-      /*  set the current dist row to 0's  */
-      memset (distp_cur - 1, 0, sizeof (gfloat) * (length - 1));
+  g_object_set (operation,
+                "progress", 0.5,
+                NULL);
 
-      for (j = 0; j < roi->width; j++)
-        {
-          gfloat float_tmp;
-          gfloat min_prev = MIN (distp_cur[j-1], distp_prev[j]);
-          gint   min_left = MIN ((roi->width - j - 1), (roi->height - i - 1));
-          gint   min      = (gint) MIN (min_left, min_prev);
-          gint   fraction = 255;
-          gint   k;
-
-          /*  This might need to be changed to 0
-              instead of k = (min) ? (min - 1) : 0  */
-
-          for (k = (min) ? (min - 1) : 0; k <= min; k++)
-            {
-              gint x   = j;
-              gint y   = i + k;
-              gint end = y - k;
-
-              while (y >= end)
-                {
-                  guchar src_uchar;
-
-#if 1
-                  /* FIXME: this should be much faster, it converts
-                   * to 32 bit rgba intermediately, bah...
-                   */
-                  gegl_buffer_sample (input, x, y, NULL, &src_uchar,
-                                      input_format,
-                                      GEGL_SAMPLER_NEAREST, GEGL_ABYSS_NONE);
-#else
-                  gegl_buffer_get (input, GEGL_RECTANGLE (x, y, 1, 1), 1.0,
-                                   input_format, &src_uchar,
-                                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
-#endif
-
-                  src = src_uchar;
-
-                  if (src == 0)
-                    {
-                      min = k;
-                      y = -1;
-                      break;
-                    }
-
-                  if (src < fraction)
-                    fraction = src;
-
-                  x++;
-                  y--;
-                }
-            }
-
-          if (src != 0)
-            {
-              /*  If min_left != min_prev use the previous fraction
-               *   if it is less than the one found
-               */
-              if (min_left != min)
-                {
-                  gint prev_frac = (int) (255 * (min_prev - min));
-
-                  if (prev_frac == 255)
-                    prev_frac = 0;
-
-                  fraction = MIN (fraction, prev_frac);
-                }
-
-              min++;
-            }
-
-          float_tmp = distp_cur[j] = min + fraction / 256.0;
-
-          if (float_tmp > max_iterations)
-            max_iterations = float_tmp;
-        }
+  bands = gimp_operation_shapeburst_run ((GFunc) gimp_operation_shapeburst_rows,
+                                         &data, data.height, &n_bands);
 
-      /*  set the dist row  */
-      gegl_buffer_set (output,
-                       GEGL_RECTANGLE (roi->x, roi->y + i,
-                                       roi->width, 1),
-                       1.0, output_format, distp_cur,
-                       GEGL_AUTO_ROWSTRIDE);
-
-      /*  swap pointers around  */
-      tmp = distp_prev;
-      distp_prev = distp_cur;
-      distp_cur = tmp;
-
-      g_object_set (operation,
-                    "progress", (gdouble) i / roi->height,
-                    NULL);
-    }
+  for (i = 0; i < n_bands; i++)
+    max_iterations = MAX (max_iterations, bands[i].max);
+
+  g_free (bands);
 
-  g_free (memory);
+  gegl_buffer_set (output, roi, 0, output_format, data.dist,
+                   GEGL_AUTO_ROWSTRIDE);
+
+  g_free (data.dist);
+  g_free (data.src);
 
   g_object_set (operation,
+                "progress",       1.0,
                 "max-iterations", (gdouble) max_iterations,
                 NULL);
 
   return TRUE;
 }
+
+/*  Splits @n columns or rows into bands and calls @func on each of
+ *  them, on a thread pool if GEGL is configured to use more than one
+ *  thread.  Returns the bands, so their results can be collected.
+ */
+static ShapeburstBand *
+gimp_operation_shapeburst_run (GFunc           func,
+                               ShapeburstData *data,
+                               gint            n,
+                               gint           *n_bands)
+{
+  ShapeburstBand *bands;
+  gint            n_threads;
+  gint            i;
+
+  *n_bands = (n + SHAPEBURST_BAND_SIZE - 1) / SHAPEBURST_BAND_SIZE;
+
+  bands = g_new0 (ShapeburstBand, *n_bands);
+
+  for (i = 0; i < *n_bands; i++)
+    {
+      bands[i].start = i * SHAPEBURST_BAND_SIZE;
+      bands[i].end   = MIN (n, bands[i].start + SHAPEBURST_BAND_SIZE);
+    }
+
+  g_object_get (gegl_config (), "threads", &n_threads, NULL);
+
+  if (n_threads > 1 && *n_bands > 1)
+    {
+      GThreadPool *pool;
+
+      pool = g_thread_pool_new (func, data,
+                                MIN (n_threads, *n_bands), FALSE, NULL);
+
+      for (i = 0; i < *n_bands; i++)
+        g_thread_pool_push (pool, &bands[i], NULL);
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (i = 0; i < *n_bands; i++)
+        func (&bands[i], data);
+    }
+
+  return bands;
+}
+
+/*  Felzenszwalb and Huttenlocher's squared euclidean distance
+ *  transform of the sampled function @f, in linear time.  @f holds
+ *  @n + 2 samples, the first and last one being the zeros right
+ *  outside of the processed area.  @v and @z are scratch space for
+ *  the parabolas of the lower envelope, of @n + 2 and @n + 3 entries.
+ */
+static void
+gimp_operation_shapeburst_transform (const gdouble *f,
+                                     gdouble       *d,
+                                     gint           n,
+                                     gint          *v,
+                                     gdouble       *z)
+{
+  gint k = 0;
+  gint q;
+
+  n += 2;
+
+  v[0] = 0;
+  z[0] = -G_MAXDOUBLE;
+  z[1] =  G_MAXDOUBLE;
+
+  for (q = 1; q < n; q++)
+    {
+      gdouble s;
+
+      /*  pixels with no seed in their column don't add a parabola  */
+      if (f[q] >= SHAPEBURST_INFINITY)
+        continue;
+
+      s = ((f[q] + (gdouble) q * q) - (f[v[k]] + (gdouble) v[k] * v[k])) /
+          (2.0 * (q - v[k]));
+
+      while (s <= z[k])
+        {
+          k--;
+
+          s = ((f[q] + (gdouble) q * q) - (f[v[k]] + (gdouble) v[k] * v[k])) /
+              (2.0 * (q - v[k]));
+        }
+
+      k++;
+
+      v[k]     = q;
+      z[k]     = s;
+      z[k + 1] = G_MAXDOUBLE;
+    }
+
+  for (q = 0, k = 0; q < n; q++)
+    {
+      while (z[k + 1] < q)
+        k++;
+
+      d[q] = (gdouble) (q - v[k]) * (q - v[k]) + f[v[k]];
+    }
+}
+
+static void
+gimp_operation_shapeburst_columns (ShapeburstBand *band,
+                                   ShapeburstData *data)
+{
+  gint     width  = data->width;
+  gint     height = data->height;
+  gdouble *f      = g_new (gdouble, height + 2);
+  gdouble *d      = g_new (gdouble, height + 2);
+  gdouble *z      = g_new (gdouble, height + 3);
+  gint    *v      = g_new (gint,    height + 2);
+  gint     x, y;
+
+  f[0]          = 0.0;
+  f[height + 1] = 0.0;
+
+  for (x = band->start; x < band->end; x++)
+    {
+      const guchar *src  = data->src  + x;
+      gfloat       *dist = data->dist + x;
+
+      for (y = 0; y < height; y++)
+        f[y + 1] = src[y * width] ? SHAPEBURST_INFINITY : 0.0;
+
+      gimp_operation_shapeburst_transform (f, d, height, v, z);
+
+      for (y = 0; y < height; y++)
+        dist[y * width] = d[y + 1];
+    }
+
+  g_free (f);
+  g_free (d);
+  g_free (z);
+  g_free (v);
+}
+
+static void
+gimp_operation_shapeburst_rows (ShapeburstBand *band,
+                                ShapeburstData *data)
+{
+  gint     width = data->width;
+  gdouble *f     = g_new (gdouble, width + 2);
+  gdouble *d     = g_new (gdouble, width + 2);
+  gdouble *z     = g_new (gdouble, width + 3);
+  gint    *v     = g_new (gint,    width + 2);
+  gfloat   max   = 0.0;
+  gint     x, y;
+
+  f[0]         = 0.0;
+  f[width + 1] = 0.0;
+
+  for (y = band->start; y < band->end; y++)
+    {
+      const guchar *src  = data->src  + y * width;
+      gfloat       *dist = data->dist + y * width;
+
+      for (x = 0; x < width; x++)
+        f[x + 1] = dist[x];
+
+      gimp_operation_shapeburst_transform (f, d, width, v, z);
+
+      /*  the distance to the nearest unselected pixel is at least one
+       *  for all selected pixels, partially selected pixels are moved
+       *  closer by their coverage, to keep edges antialiased
+       */
+      for (x = 0; x < width; x++)
+        {
+          if (src[x])
+            dist[x] = sqrt (d[x + 1]) - 1.0 + src[x] / 255.0;
+          else
+            dist[x] = 0.0;
+
+          max = MAX (max, dist[x]);
+        }
+    }
+
+  band->max = max;
+
+  g_free (f);
+  g_free (d);
+  g_free (z);
+  g_free (v);
+}
@@ -0,0 +1,342 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <gegl.h>
+#include <gtk/gtk.h>
+
+#include "widgets/widgets-types.h"
+
+#include "widgets/gimpuimanager.h"
+
+#include "core/gimp.h"
+#include "core/gimpimage.h"
+#include "core/gimpimage-colormap.h"
+#include "core/gimpimage-convert-type.h"
+#include "core/gimplayer.h"
+
+#include "tests.h"
+
+#include "gimp-app-test-utils.h"
+
+
+#define GIMP_TEST_IMAGE_WIDTH   320
+#define GIMP_TEST_IMAGE_HEIGHT  240
+#define GIMP_TEST_N_LAYERS      8
+
+/*  with -m perf, convert an animation-sized image instead  */
+#define GIMP_TEST_PERF_WIDTH    640
+#define GIMP_TEST_PERF_HEIGHT   480
+#define GIMP_TEST_PERF_N_LAYERS 100
+
+/*  the conversion is timed on this many threads, and its result
+ *  compared with that of a single thread
+ */
+#define GIMP_TEST_THREADS       4
+
+#define ADD_TEST(function) \
+  g_test_add_data_func ("/gimp-convert-type/" #function, gimp, function);
+
+
+/**
+ * gimp_test_create_animation:
+ * @gimp:     the #Gimp instance
+ * @n_colors: if > 0, the number of distinct colors to use,
+ *            otherwise use noisy gradients
+ *
+ * Creates an RGB image with a stack of layers that look like frames
+ * of an animation, each slightly shifted against the previous one.
+ *
+ * Returns: the new image
+ **/
+static GimpImage *
+gimp_test_create_animation (Gimp *gimp,
+                            gint  n_colors)
+{
+  GimpImage *image;
+  GRand     *rand = g_rand_new_with_seed (42);
+  gint       width;
+  gint       height;
+  gint       n_layers;
+  guchar    *pixels;
+  gint       i;
+
+  if (g_test_perf ())
+    {
+      width    = GIMP_TEST_PERF_WIDTH;
+      height   = GIMP_TEST_PERF_HEIGHT;
+      n_layers = GIMP_TEST_PERF_N_LAYERS;
+    }
+  else
+    {
+      width    = GIMP_TEST_IMAGE_WIDTH;
+      height   = GIMP_TEST_IMAGE_HEIGHT;
+      n_layers = GIMP_TEST_N_LAYERS;
+    }
+
+  image = gimp_image_new (gimp, width, height,
+                          GIMP_RGB, GIMP_PRECISION_U8_GAMMA);
+
+  pixels = g_new (guchar, width * height * 4);
+
+  for (i = 0; i < n_layers; i++)
+    {
+      GimpLayer *layer;
+      guchar    *p = pixels;
+      gint       x, y;
+
+      layer = gimp_layer_new (image, width, height,
+                              babl_format ("R'G'B'A u8"),
+                              "Frame",
+                              1.0,
+                              GIMP_NORMAL_MODE);
+
+      for (y = 0; y < height; y++)
+        {
+          for (x = 0; x < width; x++, p += 4)
+            {
+              if (n_colors > 0)
+                {
+                  gint c = ((x + i) / 16 + y / 16) % n_colors;
+
+                  p[0] = c * 255 / n_colors;
+                  p[1] = 255 - c * 127 / n_colors;
+                  p[2] = (c * 37) & 0xff;
+                }
+              else
+                {
+                  p[0] = (x + i) * 255 / width;
+                  p[1] = y * 255 / height;
+                  p[2] = CLAMP (128 + g_rand_int_range (rand, -32, 32), 0, 255);
+                }
+
+              /*  a transparent border, to exercise the alpha paths  */
+              p[3] = (x < 4 || y < 4) ? 0 : 255;
+            }
+        }
+
+      gegl_buffer_set (gimp_drawable_get_buffer (GIMP_DRAWABLE (layer)),
+                       GEGL_RECTANGLE (0, 0, width, height), 0,
+                       babl_format ("R'G'B'A u8"), pixels,
+                       GEGL_AUTO_ROWSTRIDE);
+
+      gimp_image_add_layer (image, layer,
+                            GIMP_IMAGE_ACTIVE_PARENT, 0, FALSE);
+    }
+
+  g_free (pixels);
+  g_rand_free (rand);
+
+  return image;
+}
+
+static void
+gimp_test_convert (GimpImage             *image,
+                   gint                   num_cols,
+                   GimpConvertDitherType  dither)
+{
+  GError  *error = NULL;
+  gdouble  elapsed;
+
+  g_test_timer_start ();
+
+  gimp_image_convert_type (image, GIMP_INDEXED, num_cols, dither,
+                           FALSE, FALSE, FALSE,
+                           GIMP_MAKE_PALETTE, NULL,
+                           NULL, &error);
+
+  elapsed = g_test_timer_elapsed ();
+
+  g_assert_no_error (error);
+
+  g_test_minimized_result (elapsed, "converted %d layers in %.3f s",
+                           gimp_image_get_n_layers (image), elapsed);
+
+  g_assert_cmpint (gimp_image_get_base_type (image), ==, GIMP_INDEXED);
+}
+
+/**
+ * gimp_test_convert_threaded:
+ * @gimp:     the #Gimp instance
+ * @n_colors: passed to gimp_test_create_animation()
+ * @num_cols: the maximum number of colors to convert to
+ * @dither:   the dither type to convert with
+ *
+ * Converts the same animation once on a single thread and once on
+ * GIMP_TEST_THREADS threads, which must give the same colormap and
+ * the same indices in every layer.
+ *
+ * Returns: the image converted on GIMP_TEST_THREADS threads
+ **/
+static GimpImage *
+gimp_test_convert_threaded (Gimp                  *gimp,
+                            gint                   n_colors,
+                            gint                   num_cols,
+                            GimpConvertDitherType  dither)
+{
+  GimpImage *reference = gimp_test_create_animation (gimp, n_colors);
+  GimpImage *image     = gimp_test_create_animation (gimp, n_colors);
+  GList     *ref_list;
+  GList     *list;
+  gint       n_bytes;
+
+  g_object_set (gegl_config (), "threads", 1, NULL);
+  gimp_test_convert (reference, num_cols, dither);
+
+  g_object_set (gegl_config (), "threads", GIMP_TEST_THREADS, NULL);
+  gimp_test_convert (image, num_cols, dither);
+
+  g_assert_cmpint (gimp_image_get_colormap_size (image), ==,
+                   gimp_image_get_colormap_size (reference));
+
+  n_bytes = gimp_image_get_colormap_size (image) * 3;
+
+  g_assert (memcmp (gimp_image_get_colormap (image),
+                    gimp_image_get_colormap (reference), n_bytes) == 0);
+
+  for (list = gimp_image_get_layer_iter (image),
+         ref_list = gimp_image_get_layer_iter (reference);
+       list && ref_list;
+       list = g_list_next (list), ref_list = g_list_next (ref_list))
+    {
+      GimpDrawable  *drawable     = list->data;
+      GimpDrawable  *ref_drawable = ref_list->data;
+      const Babl    *format       = gimp_drawable_get_format (drawable);
+      GeglRectangle  rect         = { 0, };
+      guchar        *data;
+      guchar        *ref_data;
+
+      rect.width  = gimp_item_get_width  (GIMP_ITEM (drawable));
+      rect.height = gimp_item_get_height (GIMP_ITEM (drawable));
+
+      n_bytes = (rect.width * rect.height *
+                 babl_format_get_bytes_per_pixel (format));
+
+      data     = g_malloc (n_bytes);
+      ref_data = g_malloc (n_bytes);
+
+      /*  read the indices, in each image's own palette format  */
+      gegl_buffer_get (gimp_drawable_get_buffer (drawable), &rect, 1.0,
+                       format, data,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+      gegl_buffer_get (gimp_drawable_get_buffer (ref_drawable), &rect, 1.0,
+                       gimp_drawable_get_format (ref_drawable), ref_data,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+      g_assert (memcmp (data, ref_data, n_bytes) == 0);
+
+      g_free (data);
+      g_free (ref_data);
+    }
+
+  g_assert (list == NULL && ref_list == NULL);
+
+  g_object_unref (reference);
+
+  return image;
+}
+
+/**
+ * convert_few_colors:
+ * @data:
+ *
+ * Converts an image that has fewer colors than asked for, which must
+ * give a palette with exactly the image's colors, no matter how the
+ * histogram work is split up.
+ **/
+static void
+convert_few_colors (gconstpointer data)
+{
+  Gimp      *gimp  = GIMP (data);
+  GimpImage *image = gimp_test_convert_threaded (gimp, 23,
+                                                 256, GIMP_FS_DITHER);
+
+  g_assert_cmpint (gimp_image_get_colormap_size (image), ==, 23);
+
+  g_object_unref (image);
+}
+
+/**
+ * convert_no_dither:
+ * @data:
+ *
+ * Quantizes a many-colored image to 256 colors without dithering.
+ **/
+static void
+convert_no_dither (gconstpointer data)
+{
+  Gimp      *gimp  = GIMP (data);
+  GimpImage *image = gimp_test_convert_threaded (gimp, 0,
+                                                 256, GIMP_NO_DITHER);
+
+  g_assert_cmpint (gimp_image_get_colormap_size (image), <=, 256);
+
+  g_object_unref (image);
+}
+
+/**
+ * convert_fs_dither:
+ * @data:
+ *
+ * Quantizes a many-colored image to 64 colors with Floyd-Steinberg
+ * dithering, the common case when exporting animated GIFs.
+ **/
+static void
+convert_fs_dither (gconstpointer data)
+{
+  Gimp      *gimp  = GIMP (data);
+  GimpImage *image = gimp_test_convert_threaded (gimp, 0,
+                                                 64, GIMP_FS_DITHER);
+
+  g_assert_cmpint (gimp_image_get_colormap_size (image), <=, 64);
+
+  g_object_unref (image);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  Gimp *gimp;
+  int   result;
+
+  g_test_init (&argc, &argv, NULL);
+
+  gimp_test_utils_set_gimp2_directory ("GIMP_TESTING_ABS_TOP_SRCDIR",
+                                       "app/tests/gimpdir");
+
+  /* We share the same application instance across all tests */
+  gimp = gimp_init_for_testing ();
+
+  /* Add tests */
+  ADD_TEST (convert_few_colors);
+  ADD_TEST (convert_no_dither);
+  ADD_TEST (convert_fs_dither);
+
+  /* Run the tests */
+  result = g_test_run ();
+
+  /* Don't write files to the source dir */
+  gimp_test_utils_set_gimp2_directory ("GIMP_TESTING_ABS_TOP_BUILDDIR",
+                                       "app/tests/gimpdir-output");
+
+  /* Exit so we don't break script-fu plug-in wire */
+  gimp_exit (gimp, TRUE);
+
+  return result;
+}
@@ -0,0 +1,463 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <gegl.h>
+
+#include "gegl/gimp-gegl-types.h"
+
+#include "gegl/gimp-babl.h"
+#include "gegl/gimp-gegl-loops.h"
+
+
+/*  large enough for the loops to go parallel  */
+#define GIMP_TEST_SIZE       512
+
+/*  with -m perf, time the loops on something the size of a photo  */
+#define GIMP_TEST_PERF_SIZE  2048
+
+/*  the loops are timed on this many threads, and their results
+ *  compared with those of a single thread
+ */
+#define GIMP_TEST_THREADS    4
+
+#define ADD_TEST(precision, function) \
+  g_test_add ("/gimp-gegl-loops/" #precision "/" #function, \
+              GimpTestFixture, \
+              GINT_TO_POINTER (GIMP_PRECISION_ ## precision), \
+              gimp_test_loops_setup, \
+              function, \
+              gimp_test_loops_teardown);
+
+
+typedef struct
+{
+  GimpPrecision  precision;
+  GeglRectangle  rect;
+  GeglBuffer    *top;
+  GeglBuffer    *bottom;
+  GeglBuffer    *mask;
+  GeglBuffer    *dest;
+  GeglBuffer    *dest_mask;
+} GimpTestFixture;
+
+typedef void (* GimpTestLoopFunc) (GimpTestFixture *fixture);
+
+
+static GeglBuffer *
+gimp_test_loops_buffer_new (const GeglRectangle *rect,
+                            const Babl          *format,
+                            GRand               *rand)
+{
+  GeglBuffer *buffer = gegl_buffer_new (rect, format);
+  gint        n      = babl_format_get_n_components (format);
+  gfloat     *data   = g_new (gfloat, rect->width * rect->height * n);
+  gint        i;
+
+  for (i = 0; i < rect->width * rect->height * n; i++)
+    data[i] = g_rand_double (rand);
+
+  gegl_buffer_set (buffer, rect, 0,
+                   n == 1 ? babl_format ("Y float") : babl_format ("RGBA float"),
+                   data, GEGL_AUTO_ROWSTRIDE);
+
+  g_free (data);
+
+  return buffer;
+}
+
+static void
+gimp_test_loops_setup (GimpTestFixture *fixture,
+                       gconstpointer    data)
+{
+  GRand *rand = g_rand_new_with_seed (42);
+  gint   size = g_test_perf () ? GIMP_TEST_PERF_SIZE : GIMP_TEST_SIZE;
+
+  fixture->precision = GPOINTER_TO_INT (data);
+
+  fixture->rect.x      = 0;
+  fixture->rect.y      = 0;
+  fixture->rect.width  = size;
+  fixture->rect.height = size;
+
+#define RGBA_FORMAT gimp_babl_format (GIMP_RGB,  fixture->precision, TRUE)
+#define Y_FORMAT    gimp_babl_format (GIMP_GRAY, fixture->precision, FALSE)
+
+  fixture->top       = gimp_test_loops_buffer_new (&fixture->rect,
+                                                   RGBA_FORMAT, rand);
+  fixture->bottom    = gimp_test_loops_buffer_new (&fixture->rect,
+                                                   RGBA_FORMAT, rand);
+  fixture->mask      = gimp_test_loops_buffer_new (&fixture->rect,
+                                                   Y_FORMAT, rand);
+  fixture->dest      = gimp_test_loops_buffer_new (&fixture->rect,
+                                                   RGBA_FORMAT, rand);
+  fixture->dest_mask = gimp_test_loops_buffer_new (&fixture->rect,
+                                                   Y_FORMAT, rand);
+
+#undef RGBA_FORMAT
+#undef Y_FORMAT
+
+  g_rand_free (rand);
+}
+
+static void
+gimp_test_loops_teardown (GimpTestFixture *fixture,
+                          gconstpointer    data)
+{
+  g_object_unref (fixture->top);
+  g_object_unref (fixture->bottom);
+  g_object_unref (fixture->mask);
+  g_object_unref (fixture->dest);
+  g_object_unref (fixture->dest_mask);
+}
+
+static void
+gimp_test_loops_report (GimpTestFixture *fixture,
+                        const gchar     *name,
+                        gint             n_pixels)
+{
+  gdouble elapsed = g_test_timer_elapsed ();
+
+  g_test_minimized_result (elapsed, "%s: %d pixels at %s in %.4f s",
+                           name, n_pixels,
+                           babl_get_name (gimp_babl_format (GIMP_RGB,
+                                                            fixture->precision,
+                                                            TRUE)),
+                           elapsed);
+}
+
+/*  Returns the largest difference between two same-sized buffers  */
+static gfloat
+gimp_test_loops_compare (GeglBuffer          *buffer1,
+                         GeglBuffer          *buffer2,
+                         const GeglRectangle *rect)
+{
+  const Babl *format = babl_format ("RGBA float");
+  gint        n      = rect->width * rect->height * 4;
+  gfloat     *data1  = g_new (gfloat, n);
+  gfloat     *data2  = g_new (gfloat, n);
+  gfloat      max    = 0.0;
+  gint        i;
+
+  gegl_buffer_get (buffer1, rect, 1.0, format, data1,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+  gegl_buffer_get (buffer2, rect, 1.0, format, data2,
+                   GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  for (i = 0; i < n; i++)
+    max = MAX (max, ABS (data1[i] - data2[i]));
+
+  g_free (data1);
+  g_free (data2);
+
+  return max;
+}
+
+/*  Runs @func once on a single thread, for reference, and then, timed,
+ *  on GIMP_TEST_THREADS threads on the fixture's destination buffers as
+ *  they were before.  Splitting the work must not change the result.
+ */
+static void
+gimp_test_loops_run (GimpTestFixture  *fixture,
+                     const gchar      *name,
+                     gint              n_pixels,
+                     GimpTestLoopFunc  func)
+{
+  GeglBuffer *dest      = gegl_buffer_dup (fixture->dest);
+  GeglBuffer *dest_mask = gegl_buffer_dup (fixture->dest_mask);
+  GeglBuffer *ref_dest;
+  GeglBuffer *ref_dest_mask;
+
+  g_object_set (gegl_config (), "threads", 1, NULL);
+
+  func (fixture);
+
+  ref_dest           = fixture->dest;
+  ref_dest_mask      = fixture->dest_mask;
+  fixture->dest      = dest;
+  fixture->dest_mask = dest_mask;
+
+  g_object_set (gegl_config (), "threads", GIMP_TEST_THREADS, NULL);
+
+  g_test_timer_start ();
+
+  func (fixture);
+
+  gimp_test_loops_report (fixture, name, n_pixels);
+
+  g_assert_cmpfloat (gimp_test_loops_compare (ref_dest, fixture->dest,
+                                              &fixture->rect), ==, 0.0);
+  g_assert_cmpfloat (gimp_test_loops_compare (ref_dest_mask,
+                                              fixture->dest_mask,
+                                              &fixture->rect), ==, 0.0);
+
+  g_object_unref (ref_dest);
+  g_object_unref (ref_dest_mask);
+}
+
+static void
+convolve_run (GimpTestFixture *fixture)
+{
+  static const gfloat kernel[9] = { 0, 0, 0, 0, 1, 0, 0, 0, 0 };
+
+  gimp_gegl_convolve (fixture->top,  &fixture->rect,
+                      fixture->dest, &fixture->rect,
+                      kernel, 3, 1.0,
+                      GIMP_NORMAL_CONVOL, FALSE);
+}
+
+/**
+ * convolve:
+ * @fixture:
+ * @data:
+ *
+ * Convolves with an identity kernel, which must leave the pixels
+ * alone.
+ **/
+static void
+convolve (GimpTestFixture *fixture,
+          gconstpointer    data)
+{
+  gimp_test_loops_run (fixture, "convolve",
+                       fixture->rect.width * fixture->rect.height,
+                       convolve_run);
+
+  g_assert_cmpfloat (gimp_test_loops_compare (fixture->top, fixture->dest,
+                                              &fixture->rect), <, 0.01);
+}
+
+static void
+dodgeburn_run (GimpTestFixture *fixture)
+{
+  gimp_gegl_dodgeburn (fixture->top,  &fixture->rect,
+                       fixture->dest, &fixture->rect,
+                       0.5, GIMP_DODGE, GIMP_SHADOWS);
+  gimp_gegl_dodgeburn (fixture->top,  &fixture->rect,
+                       fixture->dest, &fixture->rect,
+                       0.5, GIMP_BURN, GIMP_SHADOWS);
+  gimp_gegl_dodgeburn (fixture->top,  &fixture->rect,
+                       fixture->dest, &fixture->rect,
+                       0.5, GIMP_DODGE, GIMP_MIDTONES);
+  gimp_gegl_dodgeburn (fixture->top,  &fixture->rect,
+                       fixture->dest, &fixture->rect,
+                       0.0, GIMP_DODGE, GIMP_HIGHLIGHTS);
+}
+
+/**
+ * dodgeburn:
+ * @fixture:
+ * @data:
+ *
+ * Runs all three dodge transfer modes.
+ **/
+static void
+dodgeburn (GimpTestFixture *fixture,
+           gconstpointer    data)
+{
+  gimp_test_loops_run (fixture, "dodgeburn",
+                       fixture->rect.width * fixture->rect.height * 4,
+                       dodgeburn_run);
+
+  /*  the last call had a factor of 1.0  */
+  g_assert_cmpfloat (gimp_test_loops_compare (fixture->top, fixture->dest,
+                                              &fixture->rect), <, 0.01);
+}
+
+static void
+smudge_blend_run (GimpTestFixture *fixture)
+{
+  gimp_gegl_smudge_blend (fixture->top,    &fixture->rect,
+                          fixture->bottom, &fixture->rect,
+                          fixture->dest,   &fixture->rect,
+                          0.5);
+}
+
+/**
+ * smudge_blend:
+ * @fixture:
+ * @data:
+ *
+ * Blends the smudge accumulation buffer into the canvas.
+ **/
+static void
+smudge_blend (GimpTestFixture *fixture,
+              gconstpointer    data)
+{
+  gimp_test_loops_run (fixture, "smudge-blend",
+                       fixture->rect.width * fixture->rect.height,
+                       smudge_blend_run);
+}
+
+static void
+apply_mask_run (GimpTestFixture *fixture)
+{
+  gimp_gegl_apply_mask (fixture->mask, &fixture->rect,
+                        fixture->dest, &fixture->rect,
+                        0.0);
+}
+
+/**
+ * apply_mask:
+ * @fixture:
+ * @data:
+ *
+ * Applies the mask at zero opacity, which must clear the alpha.
+ **/
+static void
+apply_mask (GimpTestFixture *fixture,
+            gconstpointer    data)
+{
+  gfloat pixel[4];
+
+  gimp_test_loops_run (fixture, "apply-mask",
+                       fixture->rect.width * fixture->rect.height,
+                       apply_mask_run);
+
+  gegl_buffer_sample (fixture->dest,
+                      fixture->rect.width / 2, fixture->rect.height / 2,
+                      NULL, pixel, babl_format ("RGBA float"),
+                      GEGL_SAMPLER_NEAREST, GEGL_ABYSS_NONE);
+
+  g_assert_cmpfloat (pixel[3], ==, 0.0);
+}
+
+static void
+combine_mask_run (GimpTestFixture *fixture)
+{
+  gimp_gegl_combine_mask (fixture->mask,      &fixture->rect,
+                          fixture->dest_mask, &fixture->rect,
+                          1.0);
+}
+
+/**
+ * combine_mask:
+ * @fixture:
+ * @data:
+ *
+ * Combines two masks.
+ **/
+static void
+combine_mask (GimpTestFixture *fixture,
+              gconstpointer    data)
+{
+  gimp_test_loops_run (fixture, "combine-mask",
+                       fixture->rect.width * fixture->rect.height,
+                       combine_mask_run);
+}
+
+static void
+combine_mask_weird_run (GimpTestFixture *fixture)
+{
+  gimp_gegl_combine_mask_weird (fixture->mask,      &fixture->rect,
+                                fixture->dest_mask, &fixture->rect,
+                                0.5, TRUE);
+  gimp_gegl_combine_mask_weird (fixture->mask,      &fixture->rect,
+                                fixture->dest_mask, &fixture->rect,
+                                0.5, FALSE);
+}
+
+/**
+ * combine_mask_weird:
+ * @fixture:
+ * @data:
+ *
+ * Combines two masks both the airbrush and the paintbrush way.
+ **/
+static void
+combine_mask_weird (GimpTestFixture *fixture,
+                    gconstpointer    data)
+{
+  gimp_test_loops_run (fixture, "combine-mask-weird",
+                       fixture->rect.width * fixture->rect.height * 2,
+                       combine_mask_weird_run);
+}
+
+static void
+replace_run (GimpTestFixture *fixture)
+{
+  static const gboolean affect[4] = { TRUE, TRUE, TRUE, TRUE };
+
+  gimp_gegl_replace (fixture->top,    &fixture->rect,
+                     fixture->bottom, &fixture->rect,
+                     fixture->mask,   &fixture->rect,
+                     fixture->dest,   &fixture->rect,
+                     1.0, affect);
+  gimp_gegl_replace (fixture->top,    &fixture->rect,
+                     fixture->bottom, &fixture->rect,
+                     fixture->mask,   &fixture->rect,
+                     fixture->dest,   &fixture->rect,
+                     0.0, affect);
+}
+
+/**
+ * replace:
+ * @fixture:
+ * @data:
+ *
+ * Replaces with all components affected, at full and at zero opacity;
+ * the latter must give back the bottom buffer.
+ **/
+static void
+replace (GimpTestFixture *fixture,
+         gconstpointer    data)
+{
+  gimp_test_loops_run (fixture, "replace",
+                       fixture->rect.width * fixture->rect.height * 2,
+                       replace_run);
+
+  g_assert_cmpfloat (gimp_test_loops_compare (fixture->bottom, fixture->dest,
+                                              &fixture->rect), <, 0.01);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  gegl_init (&argc, &argv);
+  gimp_babl_init ();
+
+  g_object_set (gegl_config (), "threads", GIMP_TEST_THREADS, NULL);
+
+  ADD_TEST (U8_LINEAR,    convolve);
+  ADD_TEST (U8_LINEAR,    dodgeburn);
+  ADD_TEST (U8_LINEAR,    smudge_blend);
+  ADD_TEST (U8_LINEAR,    apply_mask);
+  ADD_TEST (U8_LINEAR,    combine_mask);
+  ADD_TEST (U8_LINEAR,    combine_mask_weird);
+  ADD_TEST (U8_LINEAR,    replace);
+
+  ADD_TEST (U16_LINEAR,   convolve);
+  ADD_TEST (U16_LINEAR,   dodgeburn);
+  ADD_TEST (U16_LINEAR,   smudge_blend);
+  ADD_TEST (U16_LINEAR,   apply_mask);
+  ADD_TEST (U16_LINEAR,   combine_mask);
+  ADD_TEST (U16_LINEAR,   combine_mask_weird);
+  ADD_TEST (U16_LINEAR,   replace);
+
+  ADD_TEST (FLOAT_LINEAR, convolve);
+  ADD_TEST (FLOAT_LINEAR, dodgeburn);
+  ADD_TEST (FLOAT_LINEAR, smudge_blend);
+  ADD_TEST (FLOAT_LINEAR, apply_mask);
+  ADD_TEST (FLOAT_LINEAR, combine_mask);
+  ADD_TEST (FLOAT_LINEAR, combine_mask_weird);
+  ADD_TEST (FLOAT_LINEAR, replace);
+
+  return g_test_run ();
+}
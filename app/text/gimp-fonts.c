@@ -23,6 +23,7 @@
 #include <glib-object.h>
 
 #include <fontconfig/fontconfig.h>
+#include <pango/pangocairo.h>
 
 #include "libgimpbase/gimpbase.h"
 #include "libgimpconfig/gimpconfig.h"
@@ -35,6 +36,7 @@
 
 #include "gimp-fonts.h"
 #include "gimpfontlist.h"
+#include "gimptextlayout.h"
 
 
 #define CONF_FNAME "fonts.conf"
@@ -101,6 +103,8 @@ gimp_fonts_load (Gimp *gimp)
 
   FcConfigSetCurrent (config);
 
+  gimp_text_layout_reset_font_maps ();
+
   gimp_font_list_restore (GIMP_FONT_LIST (gimp->fonts));
 
  cleanup:
@@ -116,6 +120,8 @@ gimp_fonts_reset (Gimp *gimp)
   if (gimp->no_fonts)
     return;
 
+  gimp_text_layout_reset_font_maps ();
+
   /* Reinit the library with defaults. */
   FcInitReinitialize ();
 }
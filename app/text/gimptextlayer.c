@@ -110,6 +110,12 @@ static void       gimp_text_layer_text_changed   (GimpTextLayer     *layer);
 static gboolean   gimp_text_layer_render         (GimpTextLayer     *layer);
 static void       gimp_text_layer_render_layout  (GimpTextLayer     *layer,
                                                   GimpTextLayout    *layout);
+static gchar    * gimp_text_layer_get_render_key (GimpTextLayer     *layer,
+                                                  GimpTextLayout    *layout);
+static cairo_region_t *
+                  gimp_text_layer_get_damage     (GimpTextLayer     *layer,
+                                                  GArray            *lines);
+static void       gimp_text_layer_forget_render  (GimpTextLayer     *layer);
 
 
 G_DEFINE_TYPE (GimpTextLayer, gimp_text_layer, GIMP_TYPE_LAYER)
@@ -191,6 +197,8 @@ gimp_text_layer_finalize (GObject *object)
       layer->text = NULL;
     }
 
+  gimp_text_layer_forget_render (layer);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -238,6 +246,9 @@ gimp_text_layer_set_property (GObject      *object,
       break;
     case PROP_MODIFIED:
       text_layer->modified = g_value_get_boolean (value);
+
+      if (text_layer->modified)
+        gimp_text_layer_forget_render (text_layer);
       break;
 
     default:
@@ -357,6 +368,9 @@ gimp_text_layer_set_buffer (GimpDrawable *drawable,
   GimpTextLayer *layer = GIMP_TEXT_LAYER (drawable);
   GimpImage     *image = gimp_item_get_image (GIMP_ITEM (layer));
 
+  /*  the new pixels didn't come from render_layout()  */
+  gimp_text_layer_forget_render (layer);
+
   if (push_undo && ! layer->modified)
     gimp_image_undo_group_start (image, GIMP_UNDO_GROUP_DRAWABLE_MOD,
                                  undo_desc);
@@ -388,6 +402,9 @@ gimp_text_layer_push_undo (GimpDrawable *drawable,
   GimpTextLayer *layer = GIMP_TEXT_LAYER (drawable);
   GimpImage     *image = gimp_item_get_image (GIMP_ITEM (layer));
 
+  /*  the pixels are about to be changed by something else  */
+  gimp_text_layer_forget_render (layer);
+
   if (! layer->modified)
     gimp_image_undo_group_start (image, GIMP_UNDO_GROUP_DRAWABLE, undo_desc);
 
@@ -702,38 +719,157 @@ gimp_text_layer_render (GimpTextLayer *layer)
   return (width > 0 && height > 0);
 }
 
+/*  Only the lines whose glyphs, attributes or position changed since
+ *  the last call are drawn again, as long as nothing else touched the
+ *  layer's pixels in between and the layer kept its size, format and
+ *  rendering options.
+ */
 static void
 gimp_text_layer_render_layout (GimpTextLayer  *layer,
                                GimpTextLayout *layout)
 {
-  GimpDrawable    *drawable = GIMP_DRAWABLE (layer);
-  GimpItem        *item     = GIMP_ITEM (layer);
-  GeglBuffer      *buffer;
-  cairo_t         *cr;
-  cairo_surface_t *surface;
-  gint             width;
-  gint             height;
+  GimpDrawable          *drawable = GIMP_DRAWABLE (layer);
+  GimpItem              *item     = GIMP_ITEM (layer);
+  GeglBuffer            *buffer;
+  GArray                *lines;
+  gchar                 *key;
+  cairo_region_t        *damage;
+  cairo_rectangle_int_t  bounds;
+  gint                   n_rects;
+  gint                   i;
 
   g_return_if_fail (gimp_drawable_has_alpha (drawable));
 
-  width  = gimp_item_get_width  (item);
-  height = gimp_item_get_height (item);
+  bounds.x      = 0;
+  bounds.y      = 0;
+  bounds.width  = gimp_item_get_width  (item);
+  bounds.height = gimp_item_get_height (item);
+
+  lines = gimp_text_layout_get_lines (layout);
+  key   = gimp_text_layer_get_render_key (layer, layout);
+
+  if (layer->render_lines && ! g_strcmp0 (key, layer->render_key))
+    damage = gimp_text_layer_get_damage (layer, lines);
+  else
+    damage = cairo_region_create_rectangle (&bounds);
+
+  cairo_region_intersect_rectangle (damage, &bounds);
+
+  n_rects = cairo_region_num_rectangles (damage);
+
+  for (i = 0; i < n_rects; i++)
+    {
+      cairo_rectangle_int_t  rect;
+      cairo_surface_t       *surface;
+      cairo_t               *cr;
+
+      cairo_region_get_rectangle (damage, i, &rect);
+
+      surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                            rect.width, rect.height);
+
+      cr = cairo_create (surface);
+      cairo_translate (cr, -rect.x, -rect.y);
+      gimp_text_layout_render_lines (layout, cr, layer->text->base_dir,
+                                     &rect);
+      cairo_destroy (cr);
+
+      cairo_surface_flush (surface);
+
+      buffer = gimp_cairo_surface_create_buffer (surface);
+
+      gegl_buffer_copy (buffer, NULL,
+                        gimp_drawable_get_buffer (drawable),
+                        GEGL_RECTANGLE (rect.x, rect.y, 0, 0));
+
+      g_object_unref (buffer);
+      cairo_surface_destroy (surface);
+
+      gimp_drawable_update (drawable,
+                            rect.x, rect.y, rect.width, rect.height);
+    }
 
-  surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+  cairo_region_destroy (damage);
 
-  cr = cairo_create (surface);
-  gimp_text_layout_render (layout, cr, layer->text->base_dir, FALSE);
-  cairo_destroy (cr);
+  gimp_text_layer_forget_render (layer);
 
-  cairo_surface_flush (surface);
+  layer->render_key   = key;
+  layer->render_lines = lines;
+}
 
-  buffer = gimp_cairo_surface_create_buffer (surface);
+static gchar *
+gimp_text_layer_get_render_key (GimpTextLayer  *layer,
+                                GimpTextLayout *layout)
+{
+  GimpText *text = layer->text;
+  GimpItem *item = GIMP_ITEM (layer);
+  gdouble   xres;
+  gdouble   yres;
+
+  gimp_text_layout_get_resolution (layout, &xres, &yres);
+
+  return g_strdup_printf ("%p %dx%d %g %g %d %d %g %g %g %g",
+                          gimp_drawable_get_format (GIMP_DRAWABLE (layer)),
+                          gimp_item_get_width  (item),
+                          gimp_item_get_height (item),
+                          xres, yres,
+                          text->antialias,
+                          text->hint_style,
+                          text->transformation.coeff[0][0],
+                          text->transformation.coeff[0][1],
+                          text->transformation.coeff[1][0],
+                          text->transformation.coeff[1][1]);
+}
 
-  gegl_buffer_copy (buffer, NULL,
-                    gimp_drawable_get_buffer (drawable), NULL);
+static cairo_region_t *
+gimp_text_layer_get_damage (GimpTextLayer *layer,
+                            GArray        *lines)
+{
+  GArray         *old_lines = layer->render_lines;
+  cairo_region_t *damage    = cairo_region_create ();
+  gint            i;
 
-  g_object_unref (buffer);
-  cairo_surface_destroy (surface);
+  for (i = 0; i < MAX (lines->len, old_lines->len); i++)
+    {
+      GimpTextLine *line     = NULL;
+      GimpTextLine *old_line = NULL;
 
-  gimp_drawable_update (drawable, 0, 0, width, height);
+      if (i < lines->len)
+        line = &g_array_index (lines, GimpTextLine, i);
+
+      if (i < old_lines->len)
+        old_line = &g_array_index (old_lines, GimpTextLine, i);
+
+      if (line && old_line                    &&
+          line->hash        == old_line->hash &&
+          line->area.x      == old_line->area.x &&
+          line->area.y      == old_line->area.y &&
+          line->area.width  == old_line->area.width &&
+          line->area.height == old_line->area.height)
+        continue;
+
+      if (line)
+        cairo_region_union_rectangle (damage, &line->area);
+
+      if (old_line)
+        cairo_region_union_rectangle (damage, &old_line->area);
+    }
+
+  return damage;
+}
+
+static void
+gimp_text_layer_forget_render (GimpTextLayer *layer)
+{
+  if (layer->render_key)
+    {
+      g_free (layer->render_key);
+      layer->render_key = NULL;
+    }
+
+  if (layer->render_lines)
+    {
+      g_array_free (layer->render_lines, TRUE);
+      layer->render_lines = NULL;
+    }
 }
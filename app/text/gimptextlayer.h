@@ -48,6 +48,10 @@ struct _GimpTextLayer
   gboolean      modified;
 
   const Babl   *convert_format;
+
+  /*  what the layer's pixels were rendered from, see render_layout()  */
+  gchar        *render_key;
+  GArray       *render_lines;
 };
 
 struct _GimpTextLayerClass
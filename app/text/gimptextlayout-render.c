@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <math.h>
+
 #include <pango/pangocairo.h>
 
 #include "text-types.h"
@@ -28,6 +30,14 @@
 #include "gimptextlayout-render.h"
 
 
+static guint  gimp_text_layout_line_hash (PangoLayoutIter       *iter);
+static void   gimp_text_layout_line_area (PangoLayoutIter       *iter,
+                                          const cairo_matrix_t  *trafo,
+                                          gint                   offset_x,
+                                          gint                   offset_y,
+                                          cairo_rectangle_int_t *area);
+
+
 void
 gimp_text_layout_render (GimpTextLayout    *layout,
                          cairo_t           *cr,
@@ -55,3 +65,236 @@ gimp_text_layout_render (GimpTextLayout    *layout,
   else
     pango_cairo_show_layout (cr, pango_layout);
 }
+
+/**
+ * gimp_text_layout_get_lines:
+ * @layout: a #GimpTextLayout
+ *
+ * Describes every line of @layout by a hash of its glyphs, their
+ * attributes and the line's position, and by the area it can draw
+ * to, in the coordinates gimp_text_layout_render() draws in.  Two
+ * lines with equal hash and area render the same pixels.
+ *
+ * Return value: a #GArray of #GimpTextLine, one per line.
+ **/
+GArray *
+gimp_text_layout_get_lines (GimpTextLayout *layout)
+{
+  PangoLayout     *pango_layout;
+  PangoLayoutIter *iter;
+  cairo_matrix_t   trafo;
+  GArray          *lines;
+  gint             x, y;
+
+  g_return_val_if_fail (GIMP_IS_TEXT_LAYOUT (layout), NULL);
+
+  gimp_text_layout_get_offsets (layout, &x, &y);
+  gimp_text_layout_get_transform (layout, &trafo);
+
+  pango_layout = gimp_text_layout_get_pango_layout (layout);
+
+  lines = g_array_new (FALSE, FALSE, sizeof (GimpTextLine));
+
+  iter = pango_layout_get_iter (pango_layout);
+
+  do
+    {
+      GimpTextLine line;
+
+      line.hash = gimp_text_layout_line_hash (iter);
+      gimp_text_layout_line_area (iter, &trafo, x, y, &line.area);
+
+      g_array_append_val (lines, line);
+    }
+  while (pango_layout_iter_next_line (iter));
+
+  pango_layout_iter_free (iter);
+
+  return lines;
+}
+
+/**
+ * gimp_text_layout_render_lines:
+ * @layout:   a #GimpTextLayout
+ * @cr:       a cairo context
+ * @base_dir: the base text direction
+ * @area:     the area to draw, or %NULL
+ *
+ * Like gimp_text_layout_render(), but only draws the lines that can
+ * touch @area.  This is enough to completely redraw @area.
+ **/
+void
+gimp_text_layout_render_lines (GimpTextLayout              *layout,
+                               cairo_t                     *cr,
+                               GimpTextDirection            base_dir,
+                               const cairo_rectangle_int_t *area)
+{
+  PangoLayout     *pango_layout;
+  PangoLayoutIter *iter;
+  cairo_matrix_t   trafo;
+  gint             x, y;
+
+  g_return_if_fail (GIMP_IS_TEXT_LAYOUT (layout));
+  g_return_if_fail (cr != NULL);
+
+  gimp_text_layout_get_offsets (layout, &x, &y);
+  gimp_text_layout_get_transform (layout, &trafo);
+
+  cairo_translate (cr, x, y);
+  cairo_transform (cr, &trafo);
+
+  pango_layout = gimp_text_layout_get_pango_layout (layout);
+
+  iter = pango_layout_get_iter (pango_layout);
+
+  do
+    {
+      PangoRectangle logical;
+
+      if (area)
+        {
+          cairo_rectangle_int_t line_area;
+
+          gimp_text_layout_line_area (iter, &trafo, x, y, &line_area);
+
+          if (line_area.x >= area->x + area->width  ||
+              line_area.y >= area->y + area->height ||
+              line_area.x + line_area.width  <= area->x ||
+              line_area.y + line_area.height <= area->y)
+            continue;
+        }
+
+      /*  this is how pango_cairo_show_layout() places the lines  */
+      pango_layout_iter_get_line_extents (iter, NULL, &logical);
+
+      cairo_move_to (cr,
+                     pango_units_to_double (logical.x),
+                     pango_units_to_double (pango_layout_iter_get_baseline (iter)));
+
+      pango_cairo_show_layout_line (cr,
+                                    pango_layout_iter_get_line_readonly (iter));
+    }
+  while (pango_layout_iter_next_line (iter));
+
+  pango_layout_iter_free (iter);
+}
+
+
+/*  private functions  */
+
+#define HASH_ADD(hash, value) ((hash) = (hash) * 31 + (guint) (value))
+
+static guint
+gimp_text_layout_line_hash (PangoLayoutIter *iter)
+{
+  PangoLayoutLine *line = pango_layout_iter_get_line_readonly (iter);
+  PangoRectangle   logical;
+  GSList          *list;
+  guint            hash = 0;
+
+  pango_layout_iter_get_line_extents (iter, NULL, &logical);
+
+  HASH_ADD (hash, logical.x);
+  HASH_ADD (hash, logical.y);
+  HASH_ADD (hash, logical.width);
+  HASH_ADD (hash, logical.height);
+  HASH_ADD (hash, pango_layout_iter_get_baseline (iter));
+
+  for (list = line->runs; list; list = g_slist_next (list))
+    {
+      PangoGlyphItem       *run    = list->data;
+      PangoGlyphString     *glyphs = run->glyphs;
+      PangoFontDescription *desc;
+      GSList               *attrs;
+      gint                  i;
+
+      desc = pango_font_describe (run->item->analysis.font);
+      HASH_ADD (hash, pango_font_description_hash (desc));
+      pango_font_description_free (desc);
+
+      HASH_ADD (hash, run->item->analysis.level);
+
+      for (i = 0; i < glyphs->num_glyphs; i++)
+        {
+          const PangoGlyphInfo *info = &glyphs->glyphs[i];
+
+          HASH_ADD (hash, info->glyph);
+          HASH_ADD (hash, info->geometry.width);
+          HASH_ADD (hash, info->geometry.x_offset);
+          HASH_ADD (hash, info->geometry.y_offset);
+        }
+
+      for (attrs = run->item->analysis.extra_attrs;
+           attrs;
+           attrs = g_slist_next (attrs))
+        {
+          PangoAttribute *attr = attrs->data;
+
+          HASH_ADD (hash, attr->klass->type);
+
+          switch (attr->klass->type)
+            {
+            case PANGO_ATTR_FOREGROUND:
+            case PANGO_ATTR_BACKGROUND:
+            case PANGO_ATTR_UNDERLINE_COLOR:
+            case PANGO_ATTR_STRIKETHROUGH_COLOR:
+              {
+                PangoColor *color = &((PangoAttrColor *) attr)->color;
+
+                HASH_ADD (hash, color->red);
+                HASH_ADD (hash, color->green);
+                HASH_ADD (hash, color->blue);
+              }
+              break;
+
+            case PANGO_ATTR_UNDERLINE:
+            case PANGO_ATTR_STRIKETHROUGH:
+            case PANGO_ATTR_RISE:
+              HASH_ADD (hash, ((PangoAttrInt *) attr)->value);
+              break;
+
+            default:
+              break;
+            }
+        }
+    }
+
+  return hash;
+}
+
+static void
+gimp_text_layout_line_area (PangoLayoutIter       *iter,
+                            const cairo_matrix_t  *trafo,
+                            gint                   offset_x,
+                            gint                   offset_y,
+                            cairo_rectangle_int_t *area)
+{
+  PangoRectangle ink;
+  gdouble        x1 = G_MAXDOUBLE;
+  gdouble        y1 = G_MAXDOUBLE;
+  gdouble        x2 = -G_MAXDOUBLE;
+  gdouble        y2 = -G_MAXDOUBLE;
+  gint           i;
+
+  pango_layout_iter_get_line_extents (iter, &ink, NULL);
+  pango_extents_to_pixels (&ink, NULL);
+
+  for (i = 0; i < 4; i++)
+    {
+      gdouble x = ink.x + ((i & 1) ? ink.width  : 0);
+      gdouble y = ink.y + ((i & 2) ? ink.height : 0);
+
+      cairo_matrix_transform_point (trafo, &x, &y);
+
+      x1 = MIN (x1, x);
+      y1 = MIN (y1, y);
+      x2 = MAX (x2, x);
+      y2 = MAX (y2, y);
+    }
+
+  /*  leave room for antialiasing and hinting  */
+  area->x      = offset_x + (gint) floor (x1) - 2;
+  area->y      = offset_y + (gint) floor (y1) - 2;
+  area->width  = (gint) ceil (x2) - (gint) floor (x1) + 4;
+  area->height = (gint) ceil (y2) - (gint) floor (y1) + 4;
+}
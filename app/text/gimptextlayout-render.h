@@ -22,10 +22,25 @@
 #define __GIMP_TEXT_LAYOUT_RENDER_H__
 
 
-void  gimp_text_layout_render (GimpTextLayout    *layout,
-                               cairo_t           *cr,
-                               GimpTextDirection  base_dir,
-                               gboolean           path);
+typedef struct _GimpTextLine GimpTextLine;
+
+struct _GimpTextLine
+{
+  guint                  hash;  /*  glyphs, attributes and position  */
+  cairo_rectangle_int_t  area;  /*  pixels the line may touch        */
+};
+
+
+void     gimp_text_layout_render       (GimpTextLayout              *layout,
+                                        cairo_t                     *cr,
+                                        GimpTextDirection            base_dir,
+                                        gboolean                     path);
+
+GArray * gimp_text_layout_get_lines    (GimpTextLayout              *layout);
+void     gimp_text_layout_render_lines (GimpTextLayout              *layout,
+                                        cairo_t                     *cr,
+                                        GimpTextDirection            base_dir,
+                                        const cairo_rectangle_int_t *area);
 
 
 #endif /* __GIMP_TEXT_LAYOUT_RENDER_H__ */
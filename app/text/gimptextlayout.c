@@ -58,6 +58,10 @@ static PangoContext * gimp_text_get_pango_context (GimpText       *text,
                                                    gdouble         yres);
 
 
+/*  font maps shared by all layouts, one per resolution  */
+static GHashTable *font_maps = NULL;
+
+
 G_DEFINE_TYPE (GimpTextLayout, gimp_text_layout, G_TYPE_OBJECT)
 
 #define parent_class gimp_text_layout_parent_class
@@ -207,6 +211,19 @@ gimp_text_layout_new (GimpText  *text,
   return layout;
 }
 
+/**
+ * gimp_text_layout_reset_font_maps:
+ *
+ * Drops the font maps shared by the layouts.  Call this when the set
+ * of available fonts changed.
+ **/
+void
+gimp_text_layout_reset_font_maps (void)
+{
+  if (font_maps)
+    g_hash_table_remove_all (font_maps);
+}
+
 gboolean
 gimp_text_layout_get_size (GimpTextLayout *layout,
                            gint           *width,
@@ -665,24 +682,48 @@ gimp_text_get_font_options (GimpText *text)
   return options;
 }
 
+/*  Layouts share their font map, so fonts are only loaded once and
+ *  the glyph images cairo caches for each font, size and set of font
+ *  options are reused by every text layer and each re-layout.
+ */
+static PangoFontMap *
+gimp_text_get_font_map (gdouble resolution)
+{
+  PangoFontMap *fontmap;
+
+  if (! font_maps)
+    font_maps = g_hash_table_new_full (g_double_hash, g_double_equal,
+                                       g_free, g_object_unref);
+
+  fontmap = g_hash_table_lookup (font_maps, &resolution);
+
+  if (! fontmap)
+    {
+      fontmap = pango_cairo_font_map_new_for_font_type (CAIRO_FONT_TYPE_FT);
+      if (! fontmap)
+        g_error ("You are using a Pango that has been built against a cairo "
+                 "that lacks the Freetype font backend");
+
+      pango_cairo_font_map_set_resolution (PANGO_CAIRO_FONT_MAP (fontmap),
+                                           resolution);
+
+      g_hash_table_insert (font_maps,
+                           g_memdup (&resolution, sizeof (gdouble)),
+                           fontmap);
+    }
+
+  return fontmap;
+}
+
 static PangoContext *
 gimp_text_get_pango_context (GimpText *text,
                              gdouble   xres,
                              gdouble   yres)
 {
   PangoContext         *context;
-  PangoFontMap         *fontmap;
   cairo_font_options_t *options;
 
-  fontmap = pango_cairo_font_map_new_for_font_type (CAIRO_FONT_TYPE_FT);
-  if (! fontmap)
-    g_error ("You are using a Pango that has been built against a cairo "
-             "that lacks the Freetype font backend");
-
-  pango_cairo_font_map_set_resolution (PANGO_CAIRO_FONT_MAP (fontmap), yres);
-
-  context = pango_font_map_create_context (fontmap);
-  g_object_unref (fontmap);
+  context = pango_font_map_create_context (gimp_text_get_font_map (yres));
 
   options = gimp_text_get_font_options (text);
   pango_cairo_context_set_font_options (context, options);
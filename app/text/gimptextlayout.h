@@ -40,6 +40,8 @@ GType            gimp_text_layout_get_type             (void) G_GNUC_CONST;
 GimpTextLayout * gimp_text_layout_new                  (GimpText       *text,
                                                         gdouble         xres,
                                                         gdouble         yres);
+void             gimp_text_layout_reset_font_maps      (void);
+
 gboolean         gimp_text_layout_get_size             (GimpTextLayout *layout,
                                                         gint           *width,
                                                         gint           *heigth);
@@ -117,6 +117,14 @@ static void   gimp_foreground_select_tool_set_preview    (GimpForegroundSelectTo
 static void   gimp_foreground_select_tool_drop_masks     (GimpForegroundSelectTool *fg_select,
                                                           GimpDisplay              *display);
 
+static void   gimp_foreground_select_tool_set_drawable   (GimpForegroundSelectTool *fg_select,
+                                                          GimpDrawable             *drawable);
+static void   gimp_foreground_select_tool_drawable_update (GimpDrawable             *drawable,
+                                                           gint                      x,
+                                                           gint                      y,
+                                                           gint                      width,
+                                                           gint                      height,
+                                                           GimpForegroundSelectTool *fg_select);
 static void   gimp_foreground_select_tool_apply          (GimpForegroundSelectTool *fg_select,
                                                           GimpDisplay              *display);
 static void   gimp_foreground_select_tool_preview        (GimpForegroundSelectTool *fg_select,
@@ -199,10 +207,12 @@ gimp_foreground_select_tool_init (GimpForegroundSelectTool *fg_select)
   gimp_tool_control_set_action_value_2 (tool->control,
                                         "tools/tools-foreground-select-brush-size-set");
 
-  fg_select->stroke  = NULL;
-  fg_select->mask    = NULL;
-  fg_select->trimap  = NULL;
-  fg_select->state   = MATTING_STATE_FREE_SELECT;
+  fg_select->stroke   = NULL;
+  fg_select->mask     = NULL;
+  fg_select->trimap   = NULL;
+  fg_select->state    = MATTING_STATE_FREE_SELECT;
+  fg_select->drawable = NULL;
+  fg_select->dirty    = FALSE;
 }
 
 static void
@@ -231,6 +241,9 @@ gimp_foreground_select_tool_finalize (GObject *object)
   if (fg_select->trimap)
     g_warning ("%s: mask should be NULL at this point", G_STRLOC);
 
+  if (fg_select->drawable)
+    g_warning ("%s: drawable should be NULL at this point", G_STRLOC);
+
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
@@ -627,6 +640,8 @@ gimp_foreground_select_tool_select (GimpFreeSelectTool *free_sel,
                                       0, 0, 1.0);
       gimp_scan_convert_free (scan_convert);
 
+      fg_select->dirty = TRUE;
+
       gimp_foreground_select_tool_set_trimap (fg_select, display);
     }
 }
@@ -691,6 +706,8 @@ gimp_foreground_select_tool_drop_masks (GimpForegroundSelectTool *fg_select,
 {
   GimpTool *tool = GIMP_TOOL (fg_select);
 
+  gimp_foreground_select_tool_set_drawable (fg_select, NULL);
+
   if (fg_select->trimap)
     {
       g_object_unref (fg_select->trimap);
@@ -718,6 +735,41 @@ gimp_foreground_select_tool_drop_masks (GimpForegroundSelectTool *fg_select,
   fg_select->state = MATTING_STATE_FREE_SELECT;
 }
 
+/*  Follows changes of the drawable the mask is computed from, a
+ *  filter or an undo can change its pixels while the tool is active.
+ */
+static void
+gimp_foreground_select_tool_set_drawable (GimpForegroundSelectTool *fg_select,
+                                          GimpDrawable             *drawable)
+{
+  if (drawable == fg_select->drawable)
+    return;
+
+  if (fg_select->drawable)
+    g_signal_handlers_disconnect_by_func (fg_select->drawable,
+                                          gimp_foreground_select_tool_drawable_update,
+                                          fg_select);
+
+  fg_select->drawable = drawable;
+  fg_select->dirty    = TRUE;
+
+  if (fg_select->drawable)
+    g_signal_connect (fg_select->drawable, "update",
+                      G_CALLBACK (gimp_foreground_select_tool_drawable_update),
+                      fg_select);
+}
+
+static void
+gimp_foreground_select_tool_drawable_update (GimpDrawable             *drawable,
+                                             gint                      x,
+                                             gint                      y,
+                                             gint                      width,
+                                             gint                      height,
+                                             GimpForegroundSelectTool *fg_select)
+{
+  fg_select->dirty = TRUE;
+}
+
 static void
 gimp_foreground_select_tool_preview (GimpForegroundSelectTool *fg_select,
                                      GimpDisplay              *display)
@@ -738,6 +790,18 @@ gimp_foreground_select_tool_preview (GimpForegroundSelectTool *fg_select,
   GeglProcessor               *processor;
   gdouble                     value;
 
+  gimp_foreground_select_tool_set_drawable (fg_select, drawable);
+
+  /*  the mask only depends on the trimap, the drawable and the matting
+   *  options, so if none of them changed since the last preview, show
+   *  that one again
+   */
+  if (fg_select->mask && ! fg_select->dirty)
+    {
+      gimp_foreground_select_tool_set_preview (fg_select, display);
+      return;
+    }
+
   if (fg_select->mask)
     {
       g_object_unref (fg_select->mask);
@@ -803,7 +867,8 @@ gimp_foreground_select_tool_preview (GimpForegroundSelectTool *fg_select,
 
   g_object_unref (processor);
 
-  fg_select->mask = buffer;
+  fg_select->mask  = buffer;
+  fg_select->dirty = FALSE;
 
   gimp_foreground_select_tool_set_preview (fg_select, display);
 
@@ -876,6 +941,8 @@ gimp_foreground_select_tool_stroke_paint (GimpForegroundSelectTool    *fg_select
 
   gimp_scan_convert_free (scan_convert);
 
+  fg_select->dirty = TRUE;
+
   g_array_free (fg_select->stroke, TRUE);
   fg_select->stroke = NULL;
 
@@ -886,7 +953,15 @@ gimp_foreground_select_options_notify (GimpForegroundSelectOptions *options,
                                        GParamSpec                  *pspec,
                                        GimpForegroundSelectTool    *fg_select)
 {
-  if (g_str_has_prefix (pspec->name, "mask-color"))
+  if (! strcmp (pspec->name, "engine")        ||
+      ! strcmp (pspec->name, "iterations")    ||
+      ! strcmp (pspec->name, "levels")        ||
+      ! strcmp (pspec->name, "active-levels"))
+    {
+      /*  the mask was computed with other settings  */
+      fg_select->dirty = TRUE;
+    }
+  else if (g_str_has_prefix (pspec->name, "mask-color"))
     {
       GimpTool *tool = GIMP_TOOL (fg_select);
 
@@ -52,6 +52,9 @@ struct _GimpForegroundSelectTool
   GeglBuffer         *trimap;
   GeglBuffer         *mask;
   MattingState        state;
+
+  GimpDrawable       *drawable;     /*  the drawable mask is computed from  */
+  gboolean            dirty;        /*  mask needs to be recomputed         */
 };
 
 struct _GimpForegroundSelectToolClass
@@ -44,6 +44,13 @@
 #include "gimpwidgets-utils.h"
 
 
+/*  minimum time between two updates caused by invalidation, so a
+ *  drawable that is being painted on doesn't re-render its previews
+ *  on every idle cycle
+ */
+#define GIMP_VIEW_RENDERER_THROTTLE_INTERVAL (G_TIME_SPAN_MILLISECOND * 200)
+
+
 enum
 {
   UPDATE,
@@ -158,6 +165,7 @@ gimp_view_renderer_init (GimpViewRenderer *renderer)
   renderer->size          = -1;
   renderer->needs_render  = TRUE;
   renderer->idle_id       = 0;
+  renderer->last_update   = 0;
 }
 
 static void
@@ -529,20 +537,35 @@ gimp_view_renderer_set_background (GimpViewRenderer *renderer,
 void
 gimp_view_renderer_invalidate (GimpViewRenderer *renderer)
 {
+  gint64 elapsed;
+
   g_return_if_fail (GIMP_IS_VIEW_RENDERER (renderer));
 
+  GIMP_VIEW_RENDERER_GET_CLASS (renderer)->invalidate (renderer);
+
+  /*  an update is already on its way  */
   if (renderer->idle_id)
-    {
-      g_source_remove (renderer->idle_id);
-      renderer->idle_id = 0;
-    }
+    return;
 
-  GIMP_VIEW_RENDERER_GET_CLASS (renderer)->invalidate (renderer);
+  elapsed = g_get_monotonic_time () - renderer->last_update;
 
-  renderer->idle_id =
-    g_idle_add_full (GIMP_VIEWABLE_PRIORITY_IDLE,
-                     (GSourceFunc) gimp_view_renderer_idle_update,
-                     renderer, NULL);
+  if (elapsed < GIMP_VIEW_RENDERER_THROTTLE_INTERVAL)
+    {
+      gint delay = (GIMP_VIEW_RENDERER_THROTTLE_INTERVAL - elapsed) /
+                   G_TIME_SPAN_MILLISECOND;
+
+      renderer->idle_id =
+        g_timeout_add_full (GIMP_VIEWABLE_PRIORITY_IDLE, MAX (delay, 1),
+                            (GSourceFunc) gimp_view_renderer_idle_update,
+                            renderer, NULL);
+    }
+  else
+    {
+      renderer->idle_id =
+        g_idle_add_full (GIMP_VIEWABLE_PRIORITY_IDLE,
+                         (GSourceFunc) gimp_view_renderer_idle_update,
+                         renderer, NULL);
+    }
 }
 
 void
@@ -653,7 +676,8 @@ gimp_view_renderer_draw (GimpViewRenderer *renderer,
 static gboolean
 gimp_view_renderer_idle_update (GimpViewRenderer *renderer)
 {
-  renderer->idle_id = 0;
+  renderer->idle_id     = 0;
+  renderer->last_update = g_get_monotonic_time ();
 
   gimp_view_renderer_update (renderer);
 
@@ -64,6 +64,7 @@ struct _GimpViewRenderer
   gint                size;
   gboolean            needs_render;
   guint               idle_id;
+  gint64              last_update;
 };
 
 struct _GimpViewRendererClass
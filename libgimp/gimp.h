@@ -48,6 +48,7 @@
 #include <libgimp/gimppalette.h>
 #include <libgimp/gimppalettes.h>
 #include <libgimp/gimppaletteselect.h>
+#include <libgimp/gimpparallel.h>
 #include <libgimp/gimppatterns.h>
 #include <libgimp/gimppatternselect.h>
 #include <libgimp/gimppixbuf.h>
@@ -0,0 +1,620 @@
+/* LIBGIMP - The GIMP Library
+ * Copyright (C) 1995-1997 Peter Mattis and Spencer Kimball
+ *
+ * gimpparallel.c
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gimp.h"
+
+
+/**
+ * SECTION: gimpparallel
+ * @title: gimpparallel
+ * @short_description: Functions to process a buffer in parallel.
+ *
+ * gimp_parallel_process() splits a region of a #GeglBuffer into
+ * areas and runs a #GimpParallelFunc on each of them from a pool of
+ * worker threads.
+ *
+ * The callback only ever sees plain memory: the source pixels of
+ * its area (including a margin, for filters that need to look at
+ * their neighbours), optionally the pixels of an auxiliary buffer,
+ * and the destination pixels it has to fill in. All reading from
+ * and writing to the buffers happens on the calling thread, while
+ * the workers are busy with other areas, because the buffers of a
+ * plug-in's drawables talk to the core over the wire, which may only
+ * be used from one thread.
+ *
+ * Filters which look up their source at arbitrary positions, like
+ * displacement or flow filters, load it once into a
+ * #GimpParallelSource instead. Their callback then reads it through
+ * gimp_parallel_source_get_pixel() and gimp_parallel_source_sample()
+ * from any thread, and gimp_parallel_process() only writes their
+ * destination.
+ **/
+
+
+typedef struct _GimpParallelJob     GimpParallelJob;
+typedef struct _GimpParallelContext GimpParallelContext;
+
+struct _GimpParallelJob
+{
+  GimpParallelArea  area;
+
+  guchar           *src;
+  guchar           *aux;
+  guchar           *dest;
+};
+
+struct _GimpParallelContext
+{
+  GimpParallelFunc  func;
+  gpointer          user_data;
+
+  GAsyncQueue      *done;
+};
+
+
+static GimpParallelJob * gimp_parallel_job_new    (GeglBuffer          *src_buffer,
+                                                   GeglBuffer          *aux_buffer,
+                                                   const GeglRectangle *area_roi,
+                                                   const Babl          *format,
+                                                   gint                 margin_x,
+                                                   gint                 margin_y,
+                                                   GeglAbyssPolicy      abyss_policy);
+static void              gimp_parallel_job_finish (GimpParallelJob     *job,
+                                                   GeglBuffer          *dest_buffer,
+                                                   const Babl          *format);
+static void              gimp_parallel_thread     (GimpParallelJob     *job,
+                                                   GimpParallelContext *context);
+
+
+/*  public functions  */
+
+/**
+ * gimp_parallel_get_n_threads:
+ *
+ * Returns the number of worker threads gimp_parallel_process() uses,
+ * which is the number of processors of the machine.
+ *
+ * Return value: the number of threads.
+ *
+ * Since: GIMP 2.10
+ **/
+gint
+gimp_parallel_get_n_threads (void)
+{
+  return MAX (g_get_num_processors (), 1);
+}
+
+/**
+ * gimp_parallel_process:
+ * @src_buffer:     the #GeglBuffer to read from, or %NULL if @func
+ *                  computes its pixels from scratch.
+ * @aux_buffer:     an optional second #GeglBuffer to read from, or %NULL.
+ * @dest_buffer:    the #GeglBuffer to write to, must not be @src_buffer.
+ * @roi:            the region to process, or %NULL for the extent of
+ *                  @dest_buffer.
+ * @format:         the #Babl format all pixels are passed in.
+ * @margin_x:       how many source pixels left and right of its area
+ *                  the callback needs.
+ * @margin_y:       how many source pixels above and below its area
+ *                  the callback needs.
+ * @abyss_policy:   how to fill in source pixels outside of @src_buffer.
+ * @area_width:     the width of the areas, or 0 for the tile width.
+ * @area_height:    the height of the areas, or 0 for the tile height.
+ * @func:           the function to call on each area.
+ * @user_data:      data to pass to @func.
+ * @progress_start: the progress to report when starting.
+ * @progress_end:   the progress to report when done, if it is the
+ *                  same as @progress_start no progress is reported.
+ *
+ * Splits @roi into areas of @area_width x @area_height pixels,
+ * aligned to multiples of that size, and calls @func on each of them
+ * from a pool of gimp_parallel_get_n_threads() worker threads.
+ *
+ * Each call gets a #GimpParallelArea with the area's source pixels,
+ * grown by the margins (the area's src_roi, where it reaches outside
+ * @src_buffer, it is filled in according to @abyss_policy), the
+ * area's pixels of @aux_buffer, if any, and a destination to fill
+ * in, which is written to @dest_buffer once the call returns. Pass
+ * the full width or height of @roi as area size to process it in
+ * rows or columns of areas. Without a @src_buffer, the area's src is
+ * %NULL and @func only fills in its destination.
+ *
+ * Source areas are read ahead of the workers and finished areas are
+ * written while the workers go on with the next ones. @func is
+ * called from several threads at once and must not call any libgimp
+ * functions.
+ *
+ * Since: GIMP 2.10
+ **/
+void
+gimp_parallel_process (GeglBuffer          *src_buffer,
+                       GeglBuffer          *aux_buffer,
+                       GeglBuffer          *dest_buffer,
+                       const GeglRectangle *roi,
+                       const Babl          *format,
+                       gint                 margin_x,
+                       gint                 margin_y,
+                       GeglAbyssPolicy      abyss_policy,
+                       gint                 area_width,
+                       gint                 area_height,
+                       GimpParallelFunc     func,
+                       gpointer             user_data,
+                       gdouble              progress_start,
+                       gdouble              progress_end)
+{
+  GimpParallelContext  context;
+  GeglRectangle       *areas;
+  GThreadPool         *pool = NULL;
+  gboolean             show_progress;
+  gint                 n_areas;
+  gint                 n_threads;
+  gint                 n_pending = 0;
+  gint                 n_done    = 0;
+  gint                 origin_x;
+  gint                 origin_y;
+  gint                 i;
+  gint                 x, y;
+  gint                 x2, y2;
+
+  g_return_if_fail (src_buffer == NULL || GEGL_IS_BUFFER (src_buffer));
+  g_return_if_fail (aux_buffer == NULL || GEGL_IS_BUFFER (aux_buffer));
+  g_return_if_fail (GEGL_IS_BUFFER (dest_buffer));
+  g_return_if_fail (dest_buffer != src_buffer);
+  g_return_if_fail (format != NULL);
+  g_return_if_fail (func != NULL);
+
+  if (! roi)
+    roi = gegl_buffer_get_extent (dest_buffer);
+
+  if (roi->width < 1 || roi->height < 1)
+    return;
+
+  /*  areas of the default size are aligned to the tile grid, areas
+   *  of a given size to the roi
+   */
+  origin_x = roi->x;
+  origin_y = roi->y;
+
+  if (area_width < 1)
+    {
+      area_width = gimp_tile_width ();
+      origin_x   = 0;
+    }
+
+  if (area_height < 1)
+    {
+      area_height = gimp_tile_height ();
+      origin_y    = 0;
+    }
+
+  margin_x = MAX (margin_x, 0);
+  margin_y = MAX (margin_y, 0);
+
+  show_progress = (progress_start != progress_end);
+
+  n_areas = (((roi->x + roi->width  - origin_x + area_width  - 1) / area_width -
+              (roi->x - origin_x) / area_width) *
+             ((roi->y + roi->height - origin_y + area_height - 1) / area_height -
+              (roi->y - origin_y) / area_height));
+
+  areas = g_new (GeglRectangle, n_areas);
+
+  i = 0;
+
+  for (y = roi->y; y < roi->y + roi->height; y = y2)
+    {
+      y2 = origin_y + ((y - origin_y) / area_height + 1) * area_height;
+      y2 = MIN (y2, roi->y + roi->height);
+
+      for (x = roi->x; x < roi->x + roi->width; x = x2)
+        {
+          x2 = origin_x + ((x - origin_x) / area_width + 1) * area_width;
+          x2 = MIN (x2, roi->x + roi->width);
+
+          gegl_rectangle_set (&areas[i++], x, y, x2 - x, y2 - y);
+        }
+    }
+
+  g_assert (i == n_areas);
+
+  if (show_progress)
+    gimp_progress_update (progress_start);
+
+  context.func      = func;
+  context.user_data = user_data;
+  context.done      = NULL;
+
+  n_threads = MIN (gimp_parallel_get_n_threads (), n_areas);
+
+  if (n_threads > 1)
+    {
+      context.done = g_async_queue_new ();
+
+      pool = g_thread_pool_new ((GFunc) gimp_parallel_thread,
+                                &context,
+                                n_threads,
+                                FALSE, NULL);
+    }
+
+  if (pool)
+    {
+      /*  keep twice as many areas in flight as there are workers, so
+       *  that the next area is already read when a worker gets free
+       */
+      i = 0;
+
+      while (n_done < n_areas)
+        {
+          GimpParallelJob *job;
+
+          while (i < n_areas && n_pending < 2 * n_threads)
+            {
+              job = gimp_parallel_job_new (src_buffer, aux_buffer,
+                                           &areas[i++], format,
+                                           margin_x, margin_y,
+                                           abyss_policy);
+
+              g_thread_pool_push (pool, job, NULL);
+              n_pending++;
+            }
+
+          job = g_async_queue_pop (context.done);
+
+          gimp_parallel_job_finish (job, dest_buffer, format);
+          n_pending--;
+          n_done++;
+
+          if (show_progress)
+            gimp_progress_update (progress_start +
+                                  (progress_end - progress_start) *
+                                  n_done / n_areas);
+        }
+
+      g_thread_pool_free (pool, FALSE, TRUE);
+      g_async_queue_unref (context.done);
+    }
+  else
+    {
+      for (i = 0; i < n_areas; i++)
+        {
+          GimpParallelJob *job;
+
+          job = gimp_parallel_job_new (src_buffer, aux_buffer,
+                                       &areas[i], format,
+                                       margin_x, margin_y,
+                                       abyss_policy);
+
+          func (&job->area, user_data);
+
+          gimp_parallel_job_finish (job, dest_buffer, format);
+
+          if (show_progress)
+            gimp_progress_update (progress_start +
+                                  (progress_end - progress_start) *
+                                  (i + 1) / n_areas);
+        }
+    }
+
+  g_free (areas);
+}
+
+/**
+ * gimp_parallel_source_new:
+ * @buffer:       the #GeglBuffer to read.
+ * @rect:         the region to read, or %NULL for the extent of @buffer.
+ * @format:       a float #Babl format to read the pixels in.
+ * @abyss_policy: how to look up pixels outside of @rect.
+ *
+ * Reads @rect of @buffer into memory, so that worker threads can look
+ * up its pixels at random. Pixels outside of @rect are zero with
+ * %GEGL_ABYSS_NONE, opaque black or white with %GEGL_ABYSS_BLACK and
+ * %GEGL_ABYSS_WHITE, and those of the nearest edge or of the
+ * repeated region with %GEGL_ABYSS_CLAMP and %GEGL_ABYSS_LOOP.
+ *
+ * This has to be called from the main thread, and it needs
+ * width x height x components floats of memory.
+ *
+ * Return value: a new #GimpParallelSource, free it with
+ *               gimp_parallel_source_free().
+ *
+ * Since: GIMP 2.10
+ **/
+GimpParallelSource *
+gimp_parallel_source_new (GeglBuffer          *buffer,
+                          const GeglRectangle *rect,
+                          const Babl          *format,
+                          GeglAbyssPolicy      abyss_policy)
+{
+  GimpParallelSource *source;
+
+  g_return_val_if_fail (GEGL_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (format != NULL, NULL);
+  g_return_val_if_fail (babl_format_get_type (format, 0) ==
+                        babl_type ("float"), NULL);
+  g_return_val_if_fail (babl_format_get_n_components (format) <= 4, NULL);
+
+  if (! rect)
+    rect = gegl_buffer_get_extent (buffer);
+
+  g_return_val_if_fail (rect->width > 0 && rect->height > 0, NULL);
+
+  source = g_slice_new0 (GimpParallelSource);
+
+  source->rect         = *rect;
+  source->format       = format;
+  source->n_components = babl_format_get_n_components (format);
+  source->has_alpha    = babl_format_has_alpha (format);
+  source->abyss_policy = abyss_policy;
+  source->rowstride    = rect->width * source->n_components;
+
+  source->data = g_new (gfloat, (gsize) source->rowstride * rect->height);
+
+  gegl_buffer_get (buffer, rect, 1.0, format,
+                   source->data, source->rowstride * sizeof (gfloat),
+                   GEGL_ABYSS_NONE);
+
+  return source;
+}
+
+/**
+ * gimp_parallel_source_free:
+ * @source: a #GimpParallelSource.
+ *
+ * Frees @source and its pixels.
+ *
+ * Since: GIMP 2.10
+ **/
+void
+gimp_parallel_source_free (GimpParallelSource *source)
+{
+  g_return_if_fail (source != NULL);
+
+  g_free (source->data);
+
+  g_slice_free (GimpParallelSource, source);
+}
+
+/**
+ * gimp_parallel_source_get_pixel:
+ * @source: a #GimpParallelSource.
+ * @x:      the x coordinate of the pixel.
+ * @y:      the y coordinate of the pixel.
+ * @pixel:  return location for the pixel's components.
+ *
+ * Looks up the pixel at @x, @y, which may be outside of the source's
+ * region. May be called from any thread.
+ *
+ * Since: GIMP 2.10
+ **/
+void
+gimp_parallel_source_get_pixel (const GimpParallelSource *source,
+                                gint                      x,
+                                gint                      y,
+                                gfloat                   *pixel)
+{
+  const gfloat *p;
+  gint          i;
+
+  x -= source->rect.x;
+  y -= source->rect.y;
+
+  if (x < 0 || x >= source->rect.width ||
+      y < 0 || y >= source->rect.height)
+    {
+      switch (source->abyss_policy)
+        {
+        case GEGL_ABYSS_CLAMP:
+          x = CLAMP (x, 0, source->rect.width  - 1);
+          y = CLAMP (y, 0, source->rect.height - 1);
+          break;
+
+        case GEGL_ABYSS_LOOP:
+          x %= source->rect.width;
+          y %= source->rect.height;
+
+          if (x < 0)
+            x += source->rect.width;
+
+          if (y < 0)
+            y += source->rect.height;
+          break;
+
+        case GEGL_ABYSS_BLACK:
+        case GEGL_ABYSS_WHITE:
+          for (i = 0; i < source->n_components; i++)
+            pixel[i] = (source->abyss_policy == GEGL_ABYSS_WHITE) ? 1.0 : 0.0;
+
+          if (source->has_alpha)
+            pixel[source->n_components - 1] = 1.0;
+          return;
+
+        default:
+          for (i = 0; i < source->n_components; i++)
+            pixel[i] = 0.0;
+          return;
+        }
+    }
+
+  p = source->data + y * source->rowstride + x * source->n_components;
+
+  for (i = 0; i < source->n_components; i++)
+    pixel[i] = p[i];
+}
+
+/**
+ * gimp_parallel_source_sample:
+ * @source: a #GimpParallelSource.
+ * @x:      the x coordinate to sample at.
+ * @y:      the y coordinate to sample at.
+ * @pixel:  return location for the sample's components.
+ *
+ * Interpolates bilinearly between the pixels at floor(@x), floor(@y)
+ * and the pixels right of and below them, like gimp_bilinear(). With
+ * an alpha channel, the color components are weighted by alpha, so
+ * that transparent pixels don't bleed their color into the sample.
+ * May be called from any thread.
+ *
+ * Since: GIMP 2.10
+ **/
+void
+gimp_parallel_source_sample (const GimpParallelSource *source,
+                             gdouble                   x,
+                             gdouble                   y,
+                             gfloat                   *pixel)
+{
+  gfloat  p[4][4];
+  gdouble w[4];
+  gdouble fx, fy;
+  gint    xi, yi;
+  gint    n_colors;
+  gint    i, j;
+
+  xi = (gint) floor (x);
+  yi = (gint) floor (y);
+
+  fx = x - xi;
+  fy = y - yi;
+
+  gimp_parallel_source_get_pixel (source, xi,     yi,     p[0]);
+  gimp_parallel_source_get_pixel (source, xi + 1, yi,     p[1]);
+  gimp_parallel_source_get_pixel (source, xi,     yi + 1, p[2]);
+  gimp_parallel_source_get_pixel (source, xi + 1, yi + 1, p[3]);
+
+  w[0] = (1.0 - fx) * (1.0 - fy);
+  w[1] = fx         * (1.0 - fy);
+  w[2] = (1.0 - fx) * fy;
+  w[3] = fx         * fy;
+
+  n_colors = source->n_components;
+
+  if (source->has_alpha)
+    {
+      gdouble alpha = 0.0;
+
+      n_colors--;
+
+      for (j = 0; j < 4; j++)
+        {
+          w[j]  *= p[j][n_colors];
+          alpha += w[j];
+        }
+
+      pixel[n_colors] = alpha;
+
+      if (alpha <= 0.0)
+        {
+          for (i = 0; i < n_colors; i++)
+            pixel[i] = 0.0;
+
+          return;
+        }
+
+      for (j = 0; j < 4; j++)
+        w[j] /= alpha;
+    }
+
+  for (i = 0; i < n_colors; i++)
+    pixel[i] = w[0] * p[0][i] + w[1] * p[1][i] + w[2] * p[2][i] + w[3] * p[3][i];
+}
+
+
+/*  private functions  */
+
+static GimpParallelJob *
+gimp_parallel_job_new (GeglBuffer          *src_buffer,
+                       GeglBuffer          *aux_buffer,
+                       const GeglRectangle *area_roi,
+                       const Babl          *format,
+                       gint                 margin_x,
+                       gint                 margin_y,
+                       GeglAbyssPolicy      abyss_policy)
+{
+  GimpParallelJob  *job  = g_slice_new0 (GimpParallelJob);
+  GimpParallelArea *area = &job->area;
+
+  area->roi = *area_roi;
+  area->bpp = babl_format_get_bytes_per_pixel (format);
+
+  gegl_rectangle_set (&area->src_roi,
+                      area_roi->x      - margin_x,
+                      area_roi->y      - margin_y,
+                      area_roi->width  + 2 * margin_x,
+                      area_roi->height + 2 * margin_y);
+
+  if (src_buffer)
+    {
+      area->src_rowstride = area->src_roi.width * area->bpp;
+
+      job->src = g_malloc (area->src_rowstride * area->src_roi.height);
+
+      gegl_buffer_get (src_buffer, &area->src_roi, 1.0, format,
+                       job->src, area->src_rowstride,
+                       abyss_policy);
+
+      area->src = job->src;
+    }
+
+  if (aux_buffer)
+    {
+      area->aux_rowstride = area->roi.width * area->bpp;
+
+      job->aux = g_malloc (area->aux_rowstride * area->roi.height);
+
+      gegl_buffer_get (aux_buffer, &area->roi, 1.0, format,
+                       job->aux, area->aux_rowstride,
+                       GEGL_ABYSS_NONE);
+
+      area->aux = job->aux;
+    }
+
+  area->dest_rowstride = area->roi.width * area->bpp;
+
+  job->dest = g_malloc (area->dest_rowstride * area->roi.height);
+
+  area->dest = job->dest;
+
+  return job;
+}
+
+static void
+gimp_parallel_job_finish (GimpParallelJob *job,
+                          GeglBuffer      *dest_buffer,
+                          const Babl      *format)
+{
+  gegl_buffer_set (dest_buffer, &job->area.roi, 0, format,
+                   job->dest, job->area.dest_rowstride);
+
+  g_free (job->src);
+  g_free (job->aux);
+  g_free (job->dest);
+
+  g_slice_free (GimpParallelJob, job);
+}
+
+static void
+gimp_parallel_thread (GimpParallelJob     *job,
+                      GimpParallelContext *context)
+{
+  context->func (&job->area, context->user_data);
+
+  g_async_queue_push (context->done, job);
+}
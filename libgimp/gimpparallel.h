@@ -0,0 +1,106 @@
+/* LIBGIMP - The GIMP Library
+ * Copyright (C) 1995-1997 Peter Mattis and Spencer Kimball
+ *
+ * gimpparallel.h
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined (__GIMP_H_INSIDE__) && !defined (GIMP_COMPILATION)
+#error "Only <libgimp/gimp.h> can be included directly."
+#endif
+
+#ifndef __GIMP_PARALLEL_H__
+#define __GIMP_PARALLEL_H__
+
+G_BEGIN_DECLS
+
+/* For information look into the C source or the html documentation */
+
+
+typedef struct _GimpParallelArea GimpParallelArea;
+
+struct _GimpParallelArea
+{
+  GeglRectangle  roi;
+  GeglRectangle  src_roi;
+
+  const guchar  *src;
+  gint           src_rowstride;
+
+  const guchar  *aux;
+  gint           aux_rowstride;
+
+  guchar        *dest;
+  gint           dest_rowstride;
+
+  gint           bpp;
+};
+
+typedef void (* GimpParallelFunc) (const GimpParallelArea *area,
+                                   gpointer                user_data);
+
+
+typedef struct _GimpParallelSource GimpParallelSource;
+
+struct _GimpParallelSource
+{
+  GeglRectangle    rect;
+  const Babl      *format;
+  gint             n_components;
+  gboolean         has_alpha;
+  GeglAbyssPolicy  abyss_policy;
+
+  gint             rowstride;
+  gfloat          *data;
+};
+
+
+gint                 gimp_parallel_get_n_threads    (void);
+
+void                 gimp_parallel_process          (GeglBuffer               *src_buffer,
+                                                     GeglBuffer               *aux_buffer,
+                                                     GeglBuffer               *dest_buffer,
+                                                     const GeglRectangle      *roi,
+                                                     const Babl               *format,
+                                                     gint                      margin_x,
+                                                     gint                      margin_y,
+                                                     GeglAbyssPolicy           abyss_policy,
+                                                     gint                      area_width,
+                                                     gint                      area_height,
+                                                     GimpParallelFunc          func,
+                                                     gpointer                  user_data,
+                                                     gdouble                   progress_start,
+                                                     gdouble                   progress_end);
+
+GimpParallelSource * gimp_parallel_source_new       (GeglBuffer               *buffer,
+                                                     const GeglRectangle      *rect,
+                                                     const Babl               *format,
+                                                     GeglAbyssPolicy           abyss_policy);
+void                 gimp_parallel_source_free      (GimpParallelSource       *source);
+
+void                 gimp_parallel_source_get_pixel (const GimpParallelSource *source,
+                                                     gint                      x,
+                                                     gint                      y,
+                                                     gfloat                   *pixel);
+void                 gimp_parallel_source_sample    (const GimpParallelSource *source,
+                                                     gdouble                   x,
+                                                     gdouble                   y,
+                                                     gfloat                   *pixel);
+
+
+G_END_DECLS
+
+#endif /* __GIMP_PARALLEL_H__ */
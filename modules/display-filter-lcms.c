@@ -47,6 +47,8 @@
 
 #include "libgimp/libgimp-intl.h"
 
+#include "display-filter-lut.h"
+
 
 #define CDISPLAY_TYPE_LCMS            (cdisplay_lcms_get_type ())
 #define CDISPLAY_LCMS(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), CDISPLAY_TYPE_LCMS, CdisplayLcms))
@@ -62,7 +64,7 @@ struct _CdisplayLcms
 {
   GimpColorDisplay  parent_instance;
 
-  cmsHTRANSFORM     transform;
+  CdisplayLut      *lut;
 };
 
 struct _CdisplayLcmsClass
@@ -147,7 +149,7 @@ cdisplay_lcms_class_finalize (CdisplayLcmsClass *klass)
 static void
 cdisplay_lcms_init (CdisplayLcms *lcms)
 {
-  lcms->transform = NULL;
+  lcms->lut = NULL;
 }
 
 static void
@@ -155,10 +157,10 @@ cdisplay_lcms_finalize (GObject *object)
 {
   CdisplayLcms *lcms = CDISPLAY_LCMS (object);
 
-  if (lcms->transform)
+  if (lcms->lut)
     {
-      cmsDeleteTransform (lcms->transform);
-      lcms->transform = NULL;
+      cdisplay_lut_free (lcms->lut);
+      lcms->lut = NULL;
     }
 
   G_OBJECT_CLASS (cdisplay_lcms_parent_class)->finalize (object);
@@ -309,52 +311,12 @@ static void
 cdisplay_lcms_convert_surface (GimpColorDisplay *display,
                                cairo_surface_t  *surface)
 {
-  CdisplayLcms   *lcms   = CDISPLAY_LCMS (display);
-  gint            width  = cairo_image_surface_get_width (surface);
-  gint            height = cairo_image_surface_get_height (surface);
-  gint            stride = cairo_image_surface_get_stride (surface);
-  guchar         *buf    = cairo_image_surface_get_data (surface);
-  cairo_format_t  fmt    = cairo_image_surface_get_format (surface);
-  guchar         *rowbuf;
-  gint            x, y;
-  guchar          r, g, b, a;
-
-  if (fmt != CAIRO_FORMAT_ARGB32)
-    return;
+  CdisplayLcms *lcms = CDISPLAY_LCMS (display);
 
-  if (! lcms->transform)
+  if (! lcms->lut)
     return;
 
-  rowbuf = g_malloc (stride);
-
-  for (y = 0; y < height; y++, buf += stride)
-    {
-      /* Switch buf from ARGB premul to ARGB non-premul, since lcms ignores the
-       * alpha channel.  The macro takes care of byte order.
-       */
-      for (x = 0; x < width; x++)
-        {
-          GIMP_CAIRO_ARGB32_GET_PIXEL (buf + 4*x, r, g, b, a);
-          rowbuf[4*x+0] = a;
-          rowbuf[4*x+1] = r;
-          rowbuf[4*x+2] = g;
-          rowbuf[4*x+3] = b;
-        }
-
-      cmsDoTransform (lcms->transform, rowbuf, rowbuf, width);
-
-      /* And back to ARGB premul */
-      for (x = 0; x < width; x++)
-        {
-          a = rowbuf[4*x+0];
-          r = rowbuf[4*x+1];
-          g = rowbuf[4*x+2];
-          b = rowbuf[4*x+3];
-          GIMP_CAIRO_ARGB32_SET_PIXEL (buf + 4*x, r, g, b, a);
-        }
-    }
-
-  g_free (rowbuf);
+  cdisplay_lut_convert_surface (lcms->lut, surface);
 }
 
 static void
@@ -366,22 +328,27 @@ cdisplay_lcms_changed (GimpColorDisplay *display)
   cmsHPROFILE      src_profile   = NULL;
   cmsHPROFILE      dest_profile  = NULL;
   cmsHPROFILE      proof_profile = NULL;
+  cmsHTRANSFORM    transform     = NULL;
   cmsUInt32Number  flags         = 0;
-  cmsUInt16Number  alarmCodes[cmsMAXCHANNELS] = { 0, };
+  guchar           alarm[3] = { 0, };
+  GChecksum       *checksum;
+  const gchar     *key;
 
-  if (lcms->transform)
+  if (! config || config->mode == GIMP_COLOR_MANAGEMENT_OFF)
     {
-      cmsDeleteTransform (lcms->transform);
-      lcms->transform = NULL;
-    }
+      if (lcms->lut)
+        {
+          cdisplay_lut_free (lcms->lut);
+          lcms->lut = NULL;
+        }
 
-  if (! config)
-    return;
+      return;
+    }
 
   switch (config->mode)
     {
     case GIMP_COLOR_MANAGEMENT_OFF:
-      return;
+      break;
 
     case GIMP_COLOR_MANAGEMENT_SOFTPROOF:
       proof_profile = cdisplay_lcms_get_printer_profile (lcms);
@@ -401,36 +368,62 @@ cdisplay_lcms_changed (GimpColorDisplay *display)
 
   if (proof_profile)
     {
-      if (! src_profile)
-        src_profile = cmsCreate_sRGBProfile ();
-
-      if (! dest_profile)
-        dest_profile = cmsCreate_sRGBProfile ();
-
       flags |= cmsFLAGS_SOFTPROOFING;
 
       if (config->simulation_gamut_check)
         {
-          guchar r, g, b;
-
           flags |= cmsFLAGS_GAMUTCHECK;
 
-          gimp_rgb_get_uchar (&config->out_of_gamut_color, &r, &g, &b);
+          gimp_rgb_get_uchar (&config->out_of_gamut_color,
+                              &alarm[0], &alarm[1], &alarm[2]);
+        }
+    }
 
-          alarmCodes[0] = (cmsUInt16Number) r * 256;
-          alarmCodes[1] = (cmsUInt16Number) g * 256;
-          alarmCodes[2] = (cmsUInt16Number) b * 256;
+  /*  building the lookup table is the expensive part, so only do it
+   *  when the profiles or rendering parameters really changed; the
+   *  config emits "notify" for a lot of unrelated properties
+   */
+  checksum = g_checksum_new (G_CHECKSUM_MD5);
 
-          cmsSetAlarmCodes (alarmCodes);
-        }
+  cdisplay_lut_checksum_profile (checksum, src_profile);
+  cdisplay_lut_checksum_profile (checksum, dest_profile);
+  cdisplay_lut_checksum_profile (checksum, proof_profile);
+
+  g_checksum_update (checksum, (const guchar *) &config->display_intent,
+                     sizeof (config->display_intent));
+  g_checksum_update (checksum, (const guchar *) &config->simulation_intent,
+                     sizeof (config->simulation_intent));
+  g_checksum_update (checksum, (const guchar *) &flags, sizeof (flags));
+  g_checksum_update (checksum, alarm, sizeof (alarm));
+
+  key = g_checksum_get_string (checksum);
+
+  if (lcms->lut && ! strcmp (key, cdisplay_lut_get_key (lcms->lut)))
+    goto out;
+
+  if (lcms->lut)
+    {
+      cdisplay_lut_free (lcms->lut);
+      lcms->lut = NULL;
+    }
+
+  if (proof_profile)
+    {
+      if (! src_profile)
+        src_profile = cmsCreate_sRGBProfile ();
 
-      lcms->transform = cmsCreateProofingTransform (src_profile, TYPE_ARGB_8,
-                                                    dest_profile, TYPE_ARGB_8,
-                                                    proof_profile,
-                                                    config->simulation_intent,
-                                                    config->display_intent,
-                                                    flags);
-      cmsCloseProfile (proof_profile);
+      if (! dest_profile)
+        dest_profile = cmsCreate_sRGBProfile ();
+
+      /*  the lookup table gets the colors only, the gamut alarm is
+       *  applied on top of it, see cdisplay_lut_set_gamut_check()
+       */
+      transform = cmsCreateProofingTransform (src_profile, TYPE_RGB_16,
+                                              dest_profile, TYPE_RGB_16,
+                                              proof_profile,
+                                              config->simulation_intent,
+                                              config->display_intent,
+                                              flags & ~cmsFLAGS_GAMUTCHECK);
     }
   else if (src_profile || dest_profile)
     {
@@ -440,12 +433,31 @@ cdisplay_lcms_changed (GimpColorDisplay *display)
       if (! dest_profile)
         dest_profile = cmsCreate_sRGBProfile ();
 
-      lcms->transform = cmsCreateTransform (src_profile, TYPE_ARGB_8,
-                                            dest_profile, TYPE_ARGB_8,
-                                            config->display_intent,
-                                            flags);
+      transform = cmsCreateTransform (src_profile, TYPE_RGB_16,
+                                      dest_profile, TYPE_RGB_16,
+                                      config->display_intent,
+                                      flags);
     }
 
+  if (transform)
+    {
+      lcms->lut = cdisplay_lut_new (transform, key);
+      cmsDeleteTransform (transform);
+
+      if (flags & cmsFLAGS_GAMUTCHECK)
+        cdisplay_lut_set_gamut_check (lcms->lut,
+                                      src_profile, proof_profile,
+                                      config->simulation_intent,
+                                      flags & cmsFLAGS_BLACKPOINTCOMPENSATION,
+                                      alarm[0], alarm[1], alarm[2]);
+    }
+
+ out:
+  g_checksum_free (checksum);
+
+  if (proof_profile)
+    cmsCloseProfile (proof_profile);
+
   if (dest_profile)
     cmsCloseProfile (dest_profile);
 
@@ -0,0 +1,464 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * display-filter-lut.c
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <glib.h>  /* lcms.h uses the "inline" keyword */
+
+#include <string.h>
+
+#ifdef G_OS_WIN32
+#define STRICT
+#include <windows.h>
+#define LCMS_WIN_TYPES_ALREADY_DEFINED
+#endif
+
+#include <lcms2.h>
+
+#include <cairo.h>
+
+#include "display-filter-lut.h"
+
+
+/*  The grid spacing is chosen so that 255 is a multiple of it, which
+ *  puts grid nodes exactly on 0 and 255.  18 nodes per axis keep the
+ *  whole table (~34 KB) in cache while still being finer than what
+ *  lcms uses for its own 8 bit precalculated transforms.
+ */
+#define LUT_SPACING  15
+#define LUT_NODES    (255 / LUT_SPACING + 1)
+#define LUT_STRIDE_R (LUT_NODES * LUT_NODES * 3)
+#define LUT_STRIDE_G (LUT_NODES * 3)
+#define LUT_STRIDE_B 3
+
+/*  the gamut check transform converts to Lab and flags out of gamut
+ *  colors with these alarm codes.  No color converts to black with
+ *  the largest possible chroma, so they can't be mistaken for a real
+ *  result.
+ */
+#define GAMUT_ALARM_L  0x0000
+#define GAMUT_ALARM_AB 0xffff
+
+#define GAMUT_INDEX(r,g,b) (((r) << 16) | ((g) << 8) | (b))
+#define GAMUT_BITMAP_SIZE  (256 * 256 * 256 / 8)
+
+
+struct _CdisplayLut
+{
+  gchar   *key;
+
+  guint16 *table;
+
+  /*  per-channel lookup of the node offset into the table and the
+   *  interpolation weight (0..256) inside the cell
+   */
+  gint     offset_r[256];
+  gint     offset_g[256];
+  gint     offset_b[256];
+  gint     weight[256];
+
+  /*  fixed point reciprocals used to un-premultiply cairo pixels  */
+  guint    unpremultiply[256];
+
+  /*  the exact out of gamut test, and its results so far, one bit
+   *  per 8 bit color
+   */
+  cmsHTRANSFORM  gamut_check;
+  guint8        *gamut_known;
+  guint8        *gamut_out;
+  guint          alarm_r;
+  guint          alarm_g;
+  guint          alarm_b;
+};
+
+
+CdisplayLut *
+cdisplay_lut_new (cmsHTRANSFORM  transform,
+                  const gchar   *key)
+{
+  CdisplayLut *lut;
+  guint16     *src;
+  gint         r, g, b;
+  gint         v;
+
+  g_return_val_if_fail (transform != NULL, NULL);
+
+  lut = g_slice_new0 (CdisplayLut);
+
+  lut->key   = g_strdup (key);
+  lut->table = g_new (guint16, LUT_NODES * LUT_NODES * LUT_NODES * 3);
+
+  /*  sample the transform on the grid, one red/green plane at a time
+   *  so cmsDoTransform() gets reasonably long runs
+   */
+  src = g_new (guint16, LUT_NODES * 3);
+
+  for (r = 0; r < LUT_NODES; r++)
+    {
+      for (g = 0; g < LUT_NODES; g++)
+        {
+          guint16 *dest = lut->table + r * LUT_STRIDE_R + g * LUT_STRIDE_G;
+
+          for (b = 0; b < LUT_NODES; b++)
+            {
+              src[b * 3 + 0] = r * LUT_SPACING * 257;
+              src[b * 3 + 1] = g * LUT_SPACING * 257;
+              src[b * 3 + 2] = b * LUT_SPACING * 257;
+            }
+
+          cmsDoTransform (transform, src, dest, LUT_NODES);
+        }
+    }
+
+  g_free (src);
+
+  for (v = 0; v < 256; v++)
+    {
+      gint node = MIN (v / LUT_SPACING, LUT_NODES - 2);
+      gint frac = v - node * LUT_SPACING;
+
+      lut->offset_r[v] = node * LUT_STRIDE_R;
+      lut->offset_g[v] = node * LUT_STRIDE_G;
+      lut->offset_b[v] = node * LUT_STRIDE_B;
+      lut->weight[v]   = (frac * 256 + LUT_SPACING / 2) / LUT_SPACING;
+    }
+
+  lut->unpremultiply[0] = 0;
+
+  for (v = 1; v < 256; v++)
+    lut->unpremultiply[v] = ((255 << 16) + v / 2) / v;
+
+  return lut;
+}
+
+void
+cdisplay_lut_free (CdisplayLut *lut)
+{
+  g_return_if_fail (lut != NULL);
+
+  if (lut->gamut_check)
+    cmsDeleteTransform (lut->gamut_check);
+
+  g_free (lut->gamut_known);
+  g_free (lut->gamut_out);
+
+  g_free (lut->key);
+  g_free (lut->table);
+
+  g_slice_free (CdisplayLut, lut);
+}
+
+/*  Makes @lut paint colors that are out of @proof_profile's gamut with
+ *  the alarm color @r, @g, @b.  The alarm can't be part of the table,
+ *  its interpolation would bleed the alarm color into the in-gamut
+ *  colors around, so the table must be sampled from a transform
+ *  without cmsFLAGS_GAMUTCHECK.  Instead, each color is tested on its
+ *  own, the first time it is converted.
+ */
+void
+cdisplay_lut_set_gamut_check (CdisplayLut     *lut,
+                              cmsHPROFILE      src_profile,
+                              cmsHPROFILE      proof_profile,
+                              cmsUInt32Number  intent,
+                              cmsUInt32Number  flags,
+                              guchar           r,
+                              guchar           g,
+                              guchar           b)
+{
+  cmsUInt16Number alarm_codes[cmsMAXCHANNELS] = { 0, };
+  cmsHPROFILE     lab_profile;
+
+  g_return_if_fail (lut != NULL);
+  g_return_if_fail (src_profile != NULL);
+  g_return_if_fail (proof_profile != NULL);
+
+  alarm_codes[0] = GAMUT_ALARM_L;
+  alarm_codes[1] = GAMUT_ALARM_AB;
+  alarm_codes[2] = GAMUT_ALARM_AB;
+
+  cmsSetAlarmCodes (alarm_codes);
+
+  lab_profile = cmsCreateLab4Profile (NULL);
+
+  if (lut->gamut_check)
+    cmsDeleteTransform (lut->gamut_check);
+
+  lut->gamut_check = cmsCreateProofingTransform (src_profile, TYPE_RGB_8,
+                                                 lab_profile, TYPE_Lab_16,
+                                                 proof_profile,
+                                                 intent,
+                                                 INTENT_RELATIVE_COLORIMETRIC,
+                                                 flags |
+                                                 cmsFLAGS_SOFTPROOFING |
+                                                 cmsFLAGS_GAMUTCHECK);
+
+  cmsCloseProfile (lab_profile);
+
+  if (! lut->gamut_check)
+    return;
+
+  if (! lut->gamut_known)
+    {
+      lut->gamut_known = g_new (guint8, GAMUT_BITMAP_SIZE);
+      lut->gamut_out   = g_new (guint8, GAMUT_BITMAP_SIZE);
+    }
+
+  memset (lut->gamut_known, 0, GAMUT_BITMAP_SIZE);
+
+  lut->alarm_r = r;
+  lut->alarm_g = g;
+  lut->alarm_b = b;
+}
+
+const gchar *
+cdisplay_lut_get_key (CdisplayLut *lut)
+{
+  g_return_val_if_fail (lut != NULL, NULL);
+
+  return lut->key;
+}
+
+/*  Feeds a profile's MD5 into @checksum, so callers can tell whether a
+ *  new profile combination actually differs from the one the current
+ *  table was built for.
+ */
+void
+cdisplay_lut_checksum_profile (GChecksum   *checksum,
+                               cmsHPROFILE  profile)
+{
+  cmsUInt8Number id[16];
+
+  g_return_if_fail (checksum != NULL);
+
+  if (! profile)
+    {
+      g_checksum_update (checksum, (const guchar *) "none", 4);
+      return;
+    }
+
+  cmsMD5computeID (profile);
+  cmsGetHeaderProfileID (profile, id);
+
+  g_checksum_update (checksum, id, sizeof (id));
+}
+
+/*  Tetrahedral interpolation inside the cell at @cell.  The cell is
+ *  split along its main diagonal into six tetrahedra; the ordering of
+ *  the three weights selects the one containing the sample.
+ */
+static inline void
+cdisplay_lut_interpolate (const guint16 *cell,
+                          gint           wr,
+                          gint           wg,
+                          gint           wb,
+                          guint         *r,
+                          guint         *g,
+                          guint         *b)
+{
+  const guint16 *c1;
+  const guint16 *c2;
+  const guint16 *c3 = cell + LUT_STRIDE_R + LUT_STRIDE_G + LUT_STRIDE_B;
+  gint           w1, w2, w3;
+  gint           i;
+  guint          out[3];
+
+  if (wr >= wg)
+    {
+      if (wg >= wb)
+        {
+          c1 = cell + LUT_STRIDE_R;
+          c2 = cell + LUT_STRIDE_R + LUT_STRIDE_G;
+          w1 = wr; w2 = wg; w3 = wb;
+        }
+      else if (wr >= wb)
+        {
+          c1 = cell + LUT_STRIDE_R;
+          c2 = cell + LUT_STRIDE_R + LUT_STRIDE_B;
+          w1 = wr; w2 = wb; w3 = wg;
+        }
+      else
+        {
+          c1 = cell + LUT_STRIDE_B;
+          c2 = cell + LUT_STRIDE_R + LUT_STRIDE_B;
+          w1 = wb; w2 = wr; w3 = wg;
+        }
+    }
+  else
+    {
+      if (wr >= wb)
+        {
+          c1 = cell + LUT_STRIDE_G;
+          c2 = cell + LUT_STRIDE_R + LUT_STRIDE_G;
+          w1 = wg; w2 = wr; w3 = wb;
+        }
+      else if (wg >= wb)
+        {
+          c1 = cell + LUT_STRIDE_G;
+          c2 = cell + LUT_STRIDE_G + LUT_STRIDE_B;
+          w1 = wg; w2 = wb; w3 = wr;
+        }
+      else
+        {
+          c1 = cell + LUT_STRIDE_B;
+          c2 = cell + LUT_STRIDE_G + LUT_STRIDE_B;
+          w1 = wb; w2 = wg; w3 = wr;
+        }
+    }
+
+  for (i = 0; i < 3; i++)
+    {
+      guint v16 = (cell[i] * (256 - w1) +
+                   c1[i]   * (w1 - w2)  +
+                   c2[i]   * (w2 - w3)  +
+                   c3[i]   * w3         + 128) >> 8;
+
+      out[i] = (v16 * 255 + 32895) >> 16;
+    }
+
+  *r = out[0];
+  *g = out[1];
+  *b = out[2];
+}
+
+static gboolean
+cdisplay_lut_out_of_gamut (CdisplayLut *lut,
+                           guint        r,
+                           guint        g,
+                           guint        b)
+{
+  const guint  index = GAMUT_INDEX (r, g, b);
+  const guint  byte  = index >> 3;
+  const guint8 bit   = 1 << (index & 7);
+
+  if (! (lut->gamut_known[byte] & bit))
+    {
+      guint8          src[3] = { r, g, b };
+      cmsUInt16Number lab[3];
+
+      cmsDoTransform (lut->gamut_check, src, lab, 1);
+
+      if (lab[0] == GAMUT_ALARM_L  &&
+          lab[1] == GAMUT_ALARM_AB &&
+          lab[2] == GAMUT_ALARM_AB)
+        lut->gamut_out[byte] |= bit;
+      else
+        lut->gamut_out[byte] &= ~bit;
+
+      lut->gamut_known[byte] |= bit;
+    }
+
+  return (lut->gamut_out[byte] & bit) != 0;
+}
+
+/*  Converts a CAIRO_FORMAT_ARGB32 surface in place.  Premultiplication
+ *  is undone and redone in the same pass as the table lookup, and runs
+ *  of identical pixels reuse the previous result.
+ */
+void
+cdisplay_lut_convert_surface (CdisplayLut     *lut,
+                              cairo_surface_t *surface)
+{
+  gint     width;
+  gint     height;
+  gint     stride;
+  guchar  *buf;
+  guint32  last_in  = 0;
+  guint32  last_out = 0;
+  gint     x, y;
+
+  g_return_if_fail (lut != NULL);
+  g_return_if_fail (surface != NULL);
+
+  if (cairo_image_surface_get_format (surface) != CAIRO_FORMAT_ARGB32)
+    return;
+
+  width  = cairo_image_surface_get_width (surface);
+  height = cairo_image_surface_get_height (surface);
+  stride = cairo_image_surface_get_stride (surface);
+  buf    = cairo_image_surface_get_data (surface);
+
+  for (y = 0; y < height; y++, buf += stride)
+    {
+      guint32 *pixel = (guint32 *) buf;
+
+      for (x = 0; x < width; x++, pixel++)
+        {
+          guint32 p = *pixel;
+          guint   a, r, g, b;
+
+          if (p == last_in)
+            {
+              *pixel = last_out;
+              continue;
+            }
+
+          a = p >> 24;
+
+          if (a == 0)
+            continue;
+
+          r = (p >> 16) & 0xff;
+          g = (p >>  8) & 0xff;
+          b = (p      ) & 0xff;
+
+          if (a != 255)
+            {
+              const guint u = lut->unpremultiply[a];
+
+              r = MIN ((r * u + 0x8000) >> 16, 255);
+              g = MIN ((g * u + 0x8000) >> 16, 255);
+              b = MIN ((b * u + 0x8000) >> 16, 255);
+            }
+
+          if (lut->gamut_check && cdisplay_lut_out_of_gamut (lut, r, g, b))
+            {
+              r = lut->alarm_r;
+              g = lut->alarm_g;
+              b = lut->alarm_b;
+            }
+          else
+            {
+              cdisplay_lut_interpolate (lut->table +
+                                        lut->offset_r[r] +
+                                        lut->offset_g[g] +
+                                        lut->offset_b[b],
+                                        lut->weight[r],
+                                        lut->weight[g],
+                                        lut->weight[b],
+                                        &r, &g, &b);
+            }
+
+          if (a != 255)
+            {
+              guint t;
+
+              t = a * r + 0x80; r = ((t >> 8) + t) >> 8;
+              t = a * g + 0x80; g = ((t >> 8) + t) >> 8;
+              t = a * b + 0x80; b = ((t >> 8) + t) >> 8;
+            }
+
+          last_in  = p;
+          last_out = (a << 24) | (r << 16) | (g << 8) | b;
+
+          *pixel = last_out;
+        }
+    }
+
+  cairo_surface_mark_dirty (surface);
+}
@@ -0,0 +1,54 @@
+/* GIMP - The GNU Image Manipulation Program
+ * Copyright (C) 1995 Spencer Kimball and Peter Mattis
+ *
+ * display-filter-lut.h
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CDISPLAY_LUT_H__
+#define __CDISPLAY_LUT_H__
+
+
+/*  A 3D lookup table sampled from a TYPE_RGB_16 -> TYPE_RGB_16 lcms
+ *  transform, used by the color management display filters to avoid
+ *  calling into lcms for every exposed pixel.
+ */
+
+typedef struct _CdisplayLut CdisplayLut;
+
+
+CdisplayLut * cdisplay_lut_new                 (cmsHTRANSFORM    transform,
+                                                const gchar     *key);
+void          cdisplay_lut_free                (CdisplayLut     *lut);
+
+void          cdisplay_lut_set_gamut_check     (CdisplayLut     *lut,
+                                                cmsHPROFILE      src_profile,
+                                                cmsHPROFILE      proof_profile,
+                                                cmsUInt32Number  intent,
+                                                cmsUInt32Number  flags,
+                                                guchar           r,
+                                                guchar           g,
+                                                guchar           b);
+
+const gchar * cdisplay_lut_get_key             (CdisplayLut     *lut);
+
+void          cdisplay_lut_checksum_profile    (GChecksum       *checksum,
+                                                cmsHPROFILE      profile);
+
+void          cdisplay_lut_convert_surface     (CdisplayLut     *lut,
+                                                cairo_surface_t *surface);
+
+
+#endif /* __CDISPLAY_LUT_H__ */
@@ -19,6 +19,8 @@
 
 #include <glib.h>  /* lcms.h uses the "inline" keyword */
 
+#include <string.h>
+
 #include <lcms2.h>
 
 #include <gegl.h>
@@ -33,6 +35,8 @@
 
 #include "libgimp/libgimp-intl.h"
 
+#include "display-filter-lut.h"
+
 #define CDISPLAY_TYPE_PROOF            (cdisplay_proof_get_type ())
 #define CDISPLAY_PROOF(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), CDISPLAY_TYPE_PROOF, CdisplayProof))
 #define CDISPLAY_PROOF_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), CDISPLAY_TYPE_PROOF, CdisplayProofClass))
@@ -51,7 +55,7 @@ struct _CdisplayProof
   gboolean          bpc;
   gchar            *profile;
 
-  cmsHTRANSFORM     transform;
+  CdisplayLut      *lut;
 };
 
 struct _CdisplayProofClass
@@ -158,8 +162,8 @@ cdisplay_proof_class_finalize (CdisplayProofClass *klass)
 static void
 cdisplay_proof_init (CdisplayProof *proof)
 {
-  proof->transform = NULL;
-  proof->profile   = NULL;
+  proof->lut     = NULL;
+  proof->profile = NULL;
 }
 
 static void
@@ -173,10 +177,10 @@ cdisplay_proof_finalize (GObject *object)
       proof->profile = NULL;
     }
 
-  if (proof->transform)
+  if (proof->lut)
     {
-      cmsDeleteTransform (proof->transform);
-      proof->transform = NULL;
+      cdisplay_lut_free (proof->lut);
+      proof->lut = NULL;
     }
 
   G_OBJECT_CLASS (cdisplay_proof_parent_class)->finalize (object);
@@ -239,52 +243,12 @@ static void
 cdisplay_proof_convert_surface (GimpColorDisplay *display,
                                 cairo_surface_t  *surface)
 {
-  CdisplayProof  *proof  = CDISPLAY_PROOF (display);
-  gint            width  = cairo_image_surface_get_width (surface);
-  gint            height = cairo_image_surface_get_height (surface);
-  gint            stride = cairo_image_surface_get_stride (surface);
-  guchar         *buf    = cairo_image_surface_get_data (surface);
-  cairo_format_t  fmt    = cairo_image_surface_get_format (surface);
-  guchar         *rowbuf;
-  gint            x, y;
-  guchar          r, g, b, a;
-
-  if (fmt != CAIRO_FORMAT_ARGB32)
-    return;
+  CdisplayProof *proof = CDISPLAY_PROOF (display);
 
-  if (! proof->transform)
+  if (! proof->lut)
     return;
 
-  rowbuf = g_malloc (stride);
-
-  for (y = 0; y < height; y++, buf += stride)
-    {
-      /* Switch buf from ARGB premul to ARGB non-premul, since lcms ignores the
-       * alpha channel.  The macro takes care of byte order.
-       */
-      for (x = 0; x < width; x++)
-        {
-          GIMP_CAIRO_ARGB32_GET_PIXEL (buf + 4*x, r, g, b, a);
-          rowbuf[4*x+0] = a;
-          rowbuf[4*x+1] = r;
-          rowbuf[4*x+2] = g;
-          rowbuf[4*x+3] = b;
-        }
-
-      cmsDoTransform (proof->transform, rowbuf, rowbuf, width);
-
-      /* And back to ARGB premul */
-      for (x = 0; x < width; x++)
-        {
-          a = rowbuf[4*x+0];
-          r = rowbuf[4*x+1];
-          g = rowbuf[4*x+2];
-          b = rowbuf[4*x+3];
-          GIMP_CAIRO_ARGB32_SET_PIXEL (buf + 4*x, r, g, b, a);
-        }
-    }
-
-  g_free (rowbuf);
+  cdisplay_lut_convert_surface (proof->lut, surface);
 }
 
 static void
@@ -479,14 +443,16 @@ cdisplay_proof_changed (GimpColorDisplay *display)
   cmsHPROFILE    rgbProfile;
   cmsHPROFILE    proofProfile;
 
-  if (proof->transform)
+  if (! proof->profile)
     {
-      cmsDeleteTransform (proof->transform);
-      proof->transform = NULL;
-    }
+      if (proof->lut)
+        {
+          cdisplay_lut_free (proof->lut);
+          proof->lut = NULL;
+        }
 
-  if (! proof->profile)
-    return;
+      return;
+    }
 
   rgbProfile = cmsCreate_sRGBProfile ();
 
@@ -494,20 +460,56 @@ cdisplay_proof_changed (GimpColorDisplay *display)
 
   if (proofProfile)
     {
-      cmsUInt32Number flags = cmsFLAGS_SOFTPROOFING;
+      cmsUInt32Number  flags = cmsFLAGS_SOFTPROOFING;
+      GChecksum       *checksum;
+      const gchar     *key;
 
       if (proof->bpc)
         flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
 
-      proof->transform = cmsCreateProofingTransform (rgbProfile, TYPE_ARGB_8,
-                                                     rgbProfile, TYPE_ARGB_8,
-                                                     proofProfile,
-                                                     proof->intent,
-                                                     proof->intent,
-                                                     flags);
+      checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+      cdisplay_lut_checksum_profile (checksum, proofProfile);
+
+      g_checksum_update (checksum, (const guchar *) &proof->intent,
+                         sizeof (proof->intent));
+      g_checksum_update (checksum, (const guchar *) &flags, sizeof (flags));
+
+      key = g_checksum_get_string (checksum);
+
+      if (! proof->lut || strcmp (key, cdisplay_lut_get_key (proof->lut)))
+        {
+          cmsHTRANSFORM transform;
+
+          if (proof->lut)
+            {
+              cdisplay_lut_free (proof->lut);
+              proof->lut = NULL;
+            }
+
+          transform = cmsCreateProofingTransform (rgbProfile, TYPE_RGB_16,
+                                                  rgbProfile, TYPE_RGB_16,
+                                                  proofProfile,
+                                                  proof->intent,
+                                                  proof->intent,
+                                                  flags);
+
+          if (transform)
+            {
+              proof->lut = cdisplay_lut_new (transform, key);
+              cmsDeleteTransform (transform);
+            }
+        }
+
+      g_checksum_free (checksum);
 
       cmsCloseProfile (proofProfile);
     }
+  else if (proof->lut)
+    {
+      cdisplay_lut_free (proof->lut);
+      proof->lut = NULL;
+    }
 
   cmsCloseProfile (rgbProfile);
 }
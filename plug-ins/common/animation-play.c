@@ -28,6 +28,7 @@
  *
  *  speedups (caching?  most bottlenecks seem to be in pixelrgns)
  *    -> do pixelrgns properly!
+ *    -> frames are cached at display size now, see frame_cache_*()
  */
 
 #include "config.h"
@@ -46,6 +47,9 @@
 #define PLUG_IN_ROLE   "gimp-animation-play"
 #define DITHERTYPE     GDK_RGB_DITHER_NORMAL
 
+#define FRAME_CACHE_SIZE  (256 << 20)  /* bytes of frames to keep     */
+#define FRAME_PREFETCH    16           /* frames to fetch ahead, idle */
+
 
 typedef enum
 {
@@ -67,6 +71,19 @@ typedef struct
   gint x, y;
 } CursorOffset;
 
+/* A frame as fetched for display, "R'G'B'A u8" at the size and scale
+ * of the drawing area.  Frames which differ from the previous one in
+ * a small part only keep just that part.
+ */
+typedef struct
+{
+  gint32         frame;
+  GeglRectangle  rect;   /* the pixels kept in data            */
+  gboolean       delta;  /* whether rect is only what changed  */
+  guchar        *data;
+  GList         *link;   /* in frame_cache_lru                 */
+} CachedFrame;
+
 /* Declare local functions. */
 static void        query                     (void);
 static void        run                       (const gchar      *name,
@@ -111,6 +128,22 @@ static gboolean    repaint_da                (GtkWidget       *darea,
                                               gpointer         data);
 
 static void        init_frames               (void);
+static void        frame_cache_reset         (void);
+static void        frame_cache_validate      (guint            cache_width,
+                                              guint            cache_height,
+                                              gdouble          cache_scale);
+static void        frame_cache_insert        (gint32           frame,
+                                              const guchar    *data,
+                                              const guchar    *previous);
+static gboolean    frame_cache_restore       (gint32           frame,
+                                              guchar          *dest,
+                                              gint32           dest_frame);
+static void        frame_cache_report        (void);
+static void        frame_fetch               (gint32           frame,
+                                              guchar          *dest);
+static void        prefetch_start            (void);
+static void        prefetch_stop             (void);
+static gboolean    prefetch_idle             (gpointer         data);
 static void        render_frame              (gint32           whichframe);
 static void        show_frame                (void);
 static void        total_alpha_preview       (void);
@@ -181,6 +214,19 @@ static gint32            *frames                    = NULL;
 static guchar            *rawframe                  = NULL;
 static guint32           *frame_durations           = NULL;
 static guint              frame_number              = 0;
+static gint32             rawframe_number           = -1;
+
+static CachedFrame      **frame_cache               = NULL;
+static GQueue             frame_cache_lru           = G_QUEUE_INIT;
+static gsize              frame_cache_memory        = 0;
+static guint              frame_cache_width         = 0;
+static guint              frame_cache_height        = 0;
+static gdouble            frame_cache_scale         = 0.0;
+
+static guchar            *prefetch_data             = NULL;
+static guchar            *prefetch_scratch          = NULL;
+static gint32             prefetch_number           = -1;
+static guint              prefetch_idle_id          = 0;
 
 static gboolean           playing                   = FALSE;
 static guint              timer                     = 0;
@@ -363,6 +409,7 @@ da_size_callback (GtkWidget *widget,
       /* Update the rawframe. */
       g_free (rawframe);
       rawframe = g_malloc ((unsigned long) drawing_area_width * drawing_area_height * 4);
+      rawframe_number = -1;
 
       /* As we re-allocated the drawn data, let's render it again. */
       if (frame_number < total_frames)
@@ -415,6 +462,7 @@ sda_size_callback (GtkWidget *widget,
       /* Update the rawframe. */
       g_free (rawframe);
       rawframe = g_malloc ((unsigned long) shape_drawing_area_width * shape_drawing_area_height * 4);
+      rawframe_number = -1;
 
       if (frame_number < total_frames)
         render_frame (frame_number);
@@ -1025,6 +1073,9 @@ init_frames (void)
       gimp_quit ();
       return;
     }
+  /* The cached frames are of the old ones. */
+  frame_cache_reset ();
+
   frames_image_id = gimp_image_new (width, height, imagetype);
   /* Save processing time and memory by not saving history and merged frames. */
   gimp_image_undo_disable (frames_image_id);
@@ -1125,12 +1176,298 @@ initialize (void)
   show_frame ();
 }
 
+/* Frame cache */
+
+static void
+frame_cache_free (CachedFrame *cached)
+{
+  frame_cache[cached->frame] = NULL;
+  frame_cache_memory -= (sizeof (CachedFrame) +
+                         (gsize) cached->rect.width * cached->rect.height * 4);
+
+  g_queue_delete_link (&frame_cache_lru, cached->link);
+
+  g_free (cached->data);
+  g_slice_free (CachedFrame, cached);
+}
+
+/* Drops all cached frames, which have to be fetched again then. */
+static void
+frame_cache_reset (void)
+{
+  prefetch_stop ();
+
+  while (! g_queue_is_empty (&frame_cache_lru))
+    frame_cache_free (g_queue_peek_head (&frame_cache_lru));
+
+  g_free (frame_cache);
+  frame_cache = g_new0 (CachedFrame *, MAX (total_frames, 1));
+
+  g_free (prefetch_data);
+  g_free (prefetch_scratch);
+  prefetch_data    = NULL;
+  prefetch_scratch = NULL;
+  prefetch_number  = -1;
+
+  rawframe_number = -1;
+}
+
+/* Frames are cached at the size they are displayed at, so a change of
+ * the drawing area or zoom throws the cache away.
+ */
+static void
+frame_cache_validate (guint   cache_width,
+                      guint   cache_height,
+                      gdouble cache_scale)
+{
+  if (! frame_cache                          ||
+      cache_width  != frame_cache_width      ||
+      cache_height != frame_cache_height     ||
+      cache_scale  != frame_cache_scale)
+    {
+      frame_cache_reset ();
+
+      frame_cache_width  = cache_width;
+      frame_cache_height = cache_height;
+      frame_cache_scale  = cache_scale;
+    }
+}
+
+/* Keeps only the part of a frame which differs from @previous, if
+ * that's less than half of it, else the whole frame.
+ */
+static void
+frame_cache_insert (gint32        frame,
+                    const guchar *data,
+                    const guchar *previous)
+{
+  CachedFrame *cached;
+  gint         rowstride = frame_cache_width * 4;
+  gint         x1        = frame_cache_width;
+  gint         y1        = frame_cache_height;
+  gint         x2        = 0;
+  gint         y2        = 0;
+  gint         x, y;
+
+  if (frame_cache[frame])
+    frame_cache_free (frame_cache[frame]);
+
+  cached = g_slice_new0 (CachedFrame);
+
+  cached->frame = frame;
+
+  if (previous && frame > 0)
+    {
+      for (y = 0; y < frame_cache_height; y++)
+        {
+          const guint32 *row      = (const guint32 *) (data + y * rowstride);
+          const guint32 *prev_row = (const guint32 *) (previous + y * rowstride);
+
+          if (! memcmp (row, prev_row, rowstride))
+            continue;
+
+          for (x = 0; row[x] == prev_row[x]; x++);
+          x1 = MIN (x1, x);
+
+          for (x = frame_cache_width - 1; row[x] == prev_row[x]; x--);
+          x2 = MAX (x2, x + 1);
+
+          y1 = MIN (y1, y);
+          y2 = y + 1;
+        }
+
+      if (x2 <= x1 || y2 <= y1)
+        x1 = y1 = x2 = y2 = 0;
+
+      cached->delta = ((gsize) (x2 - x1) * (y2 - y1) * 2 <
+                       (gsize) frame_cache_width * frame_cache_height);
+    }
+
+  if (cached->delta)
+    gegl_rectangle_set (&cached->rect, x1, y1, x2 - x1, y2 - y1);
+  else
+    gegl_rectangle_set (&cached->rect,
+                        0, 0, frame_cache_width, frame_cache_height);
+
+  cached->data = g_malloc ((gsize) cached->rect.width *
+                           cached->rect.height * 4);
+
+  for (y = 0; y < cached->rect.height; y++)
+    memcpy (cached->data + y * cached->rect.width * 4,
+            data + (cached->rect.y + y) * rowstride + cached->rect.x * 4,
+            cached->rect.width * 4);
+
+  frame_cache[frame] = cached;
+  frame_cache_memory += (sizeof (CachedFrame) +
+                         (gsize) cached->rect.width * cached->rect.height * 4);
+
+  g_queue_push_head (&frame_cache_lru, cached);
+  cached->link = g_queue_peek_head_link (&frame_cache_lru);
+
+  /* the least recently shown frames go first */
+  while (frame_cache_memory > FRAME_CACHE_SIZE &&
+         g_queue_peek_tail (&frame_cache_lru) != cached)
+    frame_cache_free (g_queue_peek_tail (&frame_cache_lru));
+}
+
+static void
+frame_cache_touch (CachedFrame *cached)
+{
+  g_queue_unlink (&frame_cache_lru, cached->link);
+  g_queue_push_head_link (&frame_cache_lru, cached->link);
+}
+
+/* Puts @frame into @dest, which holds @dest_frame, from the cache.
+ * A frame kept as difference needs the frames before it, back to
+ * @dest_frame or to a whole one; returns FALSE if any is missing.
+ */
+static gboolean
+frame_cache_restore (gint32  frame,
+                     guchar *dest,
+                     gint32  dest_frame)
+{
+  gint rowstride = frame_cache_width * 4;
+  gint first;
+  gint i, y;
+
+  if (frame == dest_frame)
+    {
+      if (frame_cache[frame])
+        frame_cache_touch (frame_cache[frame]);
+
+      return TRUE;
+    }
+
+  for (first = frame; ; first--)
+    {
+      CachedFrame *cached = frame_cache[first];
+
+      if (! cached)
+        return FALSE;
+
+      if (! cached->delta || first - 1 == dest_frame)
+        break;
+    }
+
+  for (i = first; i <= frame; i++)
+    {
+      CachedFrame *cached = frame_cache[i];
+
+      for (y = 0; y < cached->rect.height; y++)
+        memcpy (dest + (cached->rect.y + y) * rowstride + cached->rect.x * 4,
+                cached->data + y * cached->rect.width * 4,
+                cached->rect.width * 4);
+
+      frame_cache_touch (cached);
+    }
+
+  return TRUE;
+}
+
+static void
+frame_cache_report (void)
+{
+  gchar *size = g_format_size (frame_cache_memory);
+  gchar *text;
+
+  text = g_strdup_printf (_("Frame cache: %d frames, %s"),
+                          g_queue_get_length (&frame_cache_lru), size);
+  gtk_widget_set_tooltip_text (progress, text);
+
+  g_free (text);
+  g_free (size);
+}
+
+/* Fetches and scales a whole frame from the core. */
+static void
+frame_fetch (gint32  frame,
+             guchar *dest)
+{
+  GeglBuffer *buffer = gimp_drawable_get_buffer (frames[frame]);
+
+  gegl_buffer_get (buffer,
+                   GEGL_RECTANGLE (0, 0, frame_cache_width, frame_cache_height),
+                   frame_cache_scale, babl_format ("R'G'B'A u8"),
+                   dest, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+
+  g_object_unref (buffer);
+}
+
+/* The frames after the shown one are fetched into the cache from an
+ * idle handler, one at a time, starting over from the shown frame
+ * whenever it changes.  This can't happen in a thread, as only the
+ * main thread may talk to the core.
+ */
+static void
+prefetch_start (void)
+{
+  if (total_frames < 2 || rawframe_number < 0)
+    return;
+
+  if (! prefetch_data)
+    {
+      prefetch_data    = g_malloc ((gsize) frame_cache_width * frame_cache_height * 4);
+      prefetch_scratch = g_malloc ((gsize) frame_cache_width * frame_cache_height * 4);
+    }
+
+  memcpy (prefetch_data, rawframe,
+          (gsize) frame_cache_width * frame_cache_height * 4);
+  prefetch_number = rawframe_number;
+
+  if (! prefetch_idle_id)
+    prefetch_idle_id = g_idle_add_full (G_PRIORITY_LOW, prefetch_idle,
+                                        NULL, NULL);
+}
+
+static void
+prefetch_stop (void)
+{
+  if (prefetch_idle_id)
+    {
+      g_source_remove (prefetch_idle_id);
+      prefetch_idle_id = 0;
+    }
+}
+
+static gboolean
+prefetch_idle (gpointer data)
+{
+  gint32  next;
+  gint    ahead;
+  guchar *tmp;
+
+  next  = (prefetch_number + 1) % total_frames;
+  ahead = (next - rawframe_number + total_frames) % total_frames;
+
+  if (prefetch_number < 0 || rawframe_number < 0 ||
+      ahead == 0 || ahead > MIN (FRAME_PREFETCH, total_frames - 1))
+    {
+      prefetch_idle_id = 0;
+      return FALSE;
+    }
+
+  if (! frame_cache_restore (next, prefetch_data, prefetch_number))
+    {
+      frame_fetch (next, prefetch_scratch);
+      frame_cache_insert (next, prefetch_scratch, prefetch_data);
+
+      tmp              = prefetch_data;
+      prefetch_data    = prefetch_scratch;
+      prefetch_scratch = tmp;
+    }
+
+  prefetch_number = next;
+
+  frame_cache_report ();
+
+  return TRUE;
+}
+
 /* Rendering Functions */
 
 static void
 render_frame (gint32 whichframe)
 {
-  GeglBuffer    *buffer;
   gint           i, j, k;
   guchar        *srcptr;
   guchar        *destptr;
@@ -1161,12 +1498,16 @@ render_frame (gint32 whichframe)
       total_alpha_preview ();
     }
 
-  buffer = gimp_drawable_get_buffer (frames[whichframe]);
+  frame_cache_validate (drawing_width, drawing_height, drawing_scale);
+
+  /* Restore the frame from the cache, or fetch and scale it */
+  if (! frame_cache_restore (whichframe, rawframe, rawframe_number))
+    {
+      frame_fetch (whichframe, rawframe);
+      frame_cache_insert (whichframe, rawframe, NULL);
+    }
 
-  /* Fetch and scale the whole raw new frame */
-  gegl_buffer_get (buffer, GEGL_RECTANGLE (0, 0, drawing_width, drawing_height),
-                   drawing_scale, babl_format ("R'G'B'A u8"),
-                   rawframe, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_CLAMP);
+  rawframe_number = whichframe;
 
   /* Number of pixels. */
   i = drawing_width * drawing_height;
@@ -1219,8 +1560,10 @@ render_frame (gint32 whichframe)
                        GDK_RGB_DITHER_MAX : DITHERTYPE),
                       preview_data, drawing_width * 3);
 
-  /* clean up */
-  g_object_unref (buffer);
+  frame_cache_report ();
+
+  /* fetch the next frames while there is nothing else to do */
+  prefetch_start ();
 }
 
 static void
@@ -1324,6 +1667,8 @@ window_destroy (GtkWidget *widget)
   if (playing)
     remove_timer ();
 
+  prefetch_stop ();
+
   if (shape_window)
     gtk_widget_destroy (GTK_WIDGET (shape_window));
 
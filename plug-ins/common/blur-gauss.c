@@ -32,6 +32,8 @@
 #define PLUG_IN_BINARY  "blur-gauss"
 #define PLUG_IN_ROLE    "gimp-blur-gauss"
 
+#define IIR_BLOCK       16   /* pixels transposed at once per row */
+
 typedef enum
 {
   BLUR_IIR,
@@ -45,6 +47,23 @@ typedef struct
   BlurMethod  method;
 } BlurValues;
 
+typedef struct
+{
+  BlurMethod  method;
+  gboolean    has_alpha;
+
+  /*  BLUR_IIR  */
+  gdouble     n_p[5], n_m[5];
+  gdouble     d_p[5], d_m[5];
+  gdouble     bd_p[5], bd_m[5];
+
+  /*  BLUR_RLE  */
+  gint       *curve;
+  gint       *sum;
+  gint        length;
+  gint        total;
+} BlurKernel;
+
 
 /* Declare local functions.
  */
@@ -80,12 +99,6 @@ static void      find_iir_constants    (gdouble  n_p[],
                                         gdouble  bd_m[],
                                         gdouble  std_dev);
 
-static void      transfer_pixels   (const gdouble *src1,
-                                    const gdouble *src2,
-                                    guchar        *dest,
-                                    gint           bytes,
-                                    gint           width);
-
 static void      make_rle_curve    (gdouble   sigma,
                                     gint    **p_curve,
                                     gint     *p_length,
@@ -104,6 +117,31 @@ static inline gint run_length_encode (const guchar *src,
                                       gint          border,
                                       gboolean      pack);
 
+static gint      blur_kernel_init  (BlurKernel       *kernel,
+                                    BlurMethod        method,
+                                    gboolean          has_alpha,
+                                    gdouble           radius);
+static void      blur_kernel_free  (BlurKernel       *kernel);
+static void      blur_line         (const BlurKernel *kernel,
+                                    guchar           *src,
+                                    guchar           *dest,
+                                    gint              len,
+                                    gint              bytes);
+static void      blur_rows         (const GimpParallelArea *area,
+                                    gpointer          data);
+static void      blur_cols         (const GimpParallelArea *area,
+                                    gpointer          data);
+static void      blur_iir_lanes    (const BlurKernel *kernel,
+                                    const gfloat     *src,
+                                    gfloat           *dest,
+                                    gdouble          *history,
+                                    gint              len,
+                                    gint              n_lanes);
+static void      blur_rows_iir     (const GimpParallelArea *area,
+                                    gpointer          data);
+static void      blur_cols_iir     (const GimpParallelArea *area,
+                                    gpointer          data);
+
 
 const GimpPlugInInfo PLUG_IN_INFO =
 {
@@ -275,6 +313,7 @@ run (const gchar      *name,
   run_mode = param[0].data.d_int32;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   *nreturn_vals = 1;
   *return_vals  = values;
@@ -870,543 +909,456 @@ do_full_lre (const gint *src,
     }
 }
 
-static void
-gauss_iir (GimpDrawable *drawable,
-           gdouble       horz,
-           gdouble       vert,
-           BlurMethod    method,
-           guchar       *preview_buffer,
-           gint          x1,
-           gint          y1,
-           gint          width,
-           gint          height)
+static gint
+blur_kernel_init (BlurKernel *kernel,
+                  BlurMethod  method,
+                  gboolean    has_alpha,
+                  gdouble     radius)
 {
-  GimpPixelRgn  src_rgn, dest_rgn;
-  gint          bytes;
-  gint          has_alpha;
-  guchar       *dest;
-  guchar       *src,  *sp_p, *sp_m;
-  gdouble       n_p[5], n_m[5];
-  gdouble       d_p[5], d_m[5];
-  gdouble       bd_p[5], bd_m[5];
-  gdouble      *val_p = NULL;
-  gdouble      *val_m = NULL;
-  gdouble      *vp, *vm;
-  gint          i, j;
-  gint          row, col, b;
-  gint          terms;
-  gdouble       progress, max_progress;
-  gint          initial_p[4];
-  gint          initial_m[4];
-  gdouble       std_dev;
-  gboolean      direct;
-  gint          progress_step;
-
-  direct = (preview_buffer == NULL);
-
-  bytes = drawable->bpp;
-  has_alpha = gimp_drawable_has_alpha (drawable->drawable_id);
-
-  val_p = g_new (gdouble, MAX (width, height) * bytes);
-  val_m = g_new (gdouble, MAX (width, height) * bytes);
-
-  src =  g_new (guchar, MAX (width, height) * bytes);
-  dest = g_new (guchar, MAX (width, height) * bytes);
-
-  gimp_pixel_rgn_init (&src_rgn,
-                       drawable, 0, 0, drawable->width, drawable->height,
-                       FALSE, FALSE);
-  if (direct)
-    {
-      gimp_pixel_rgn_init (&dest_rgn,
-                           drawable, 0, 0, drawable->width, drawable->height,
-                           TRUE, TRUE);
-    }
+  gdouble std_dev;
 
+  memset (kernel, 0, sizeof (BlurKernel));
 
-  progress = 0.0;
-  max_progress  = (horz <= 0.0) ? 0 : width * height * horz;
-  max_progress += (vert <= 0.0) ? 0 : width * height * vert;
+  kernel->method    = method;
+  kernel->has_alpha = has_alpha;
 
+  radius  = fabs (radius) + 1.0;
+  std_dev = sqrt (-(radius * radius) / (2 * log (1.0 / 255.0)));
 
-  /*  First the vertical pass  */
-  if (vert > 0.0)
+  if (method == BLUR_IIR)
     {
-      vert = fabs (vert) + 1.0;
-      std_dev = sqrt (-(vert * vert) / (2 * log (1.0 / 255.0)));
-
-      /* We do not want too many progress updates because they
-       * can slow down the processing significantly for very
-       * large images
-       */
-      progress_step = width / 16;
-
-      if (progress_step < 5)
-        progress_step = 5;
-
       /*  derive the constants for calculating the gaussian
        *  from the std dev
        */
-
-      find_iir_constants (n_p, n_m, d_p, d_m, bd_p, bd_m, std_dev);
-
-      for (col = 0; col < width; col++)
-        {
-          memset (val_p, 0, height * bytes * sizeof (gdouble));
-          memset (val_m, 0, height * bytes * sizeof (gdouble));
-
-          gimp_pixel_rgn_get_col (&src_rgn, src, col + x1, y1, height);
-
-          if (has_alpha)
-            multiply_alpha (src, height, bytes);
-
-          sp_p = src;
-          sp_m = src + (height - 1) * bytes;
-          vp = val_p;
-          vm = val_m + (height - 1) * bytes;
-
-          /*  Set up the first vals  */
-          for (i = 0; i < bytes; i++)
-            {
-              initial_p[i] = sp_p[i];
-              initial_m[i] = sp_m[i];
-            }
-
-          for (row = 0; row < height; row++)
-            {
-              gdouble *vpptr, *vmptr;
-              terms = (row < 4) ? row : 4;
-
-              for (b = 0; b < bytes; b++)
-                {
-                  vpptr = vp + b; vmptr = vm + b;
-                  for (i = 0; i <= terms; i++)
-                    {
-                      *vpptr += n_p[i] * sp_p[(-i * bytes) + b] - d_p[i] * vp[(-i * bytes) + b];
-                      *vmptr += n_m[i] * sp_m[(i * bytes) + b] - d_m[i] * vm[(i * bytes) + b];
-                    }
-                  for (j = i; j <= 4; j++)
-                    {
-                      *vpptr += (n_p[j] - bd_p[j]) * initial_p[b];
-                      *vmptr += (n_m[j] - bd_m[j]) * initial_m[b];
-                    }
-                }
-
-              sp_p += bytes;
-              sp_m -= bytes;
-              vp += bytes;
-              vm -= bytes;
-            }
-
-          transfer_pixels (val_p, val_m, dest, bytes, height);
-
-
-          if (has_alpha)
-            separate_alpha (dest, height, bytes);
-
-          if (direct)
-            {
-              gimp_pixel_rgn_set_col(&dest_rgn, dest, col + x1, y1, height);
-
-              progress += height * vert;
-
-              if ((col % progress_step) == 0)
-                gimp_progress_update (progress / max_progress);
-            }
-          else
-            {
-              for (row = 0; row < height; row++)
-                memcpy (preview_buffer + (row * width + col) * bytes,
-                        dest + row * bytes,
-                        bytes);
-            }
-        }
-
-      /*  prepare for the horizontal pass  */
-      gimp_pixel_rgn_init (&src_rgn,
-                           drawable,
-                           0, 0,
-                           drawable->width, drawable->height,
-                           FALSE, TRUE);
+      find_iir_constants (kernel->n_p, kernel->n_m,
+                          kernel->d_p, kernel->d_m,
+                          kernel->bd_p, kernel->bd_m,
+                          std_dev);
     }
-  else if (!direct)
+  else
     {
-      gimp_pixel_rgn_get_rect (&src_rgn,
-                               preview_buffer,
-                               x1, y1,
-                               width, height);
+      make_rle_curve (std_dev,
+                      &kernel->curve, &kernel->length,
+                      &kernel->sum, &kernel->total);
     }
 
-  /*  Now the horizontal pass  */
-  if (horz > 0.0)
-    {
+  /*  the curve reaches out to where the gaussian drops below 1/255,
+   *  which is the radius
+   */
+  return ceil (radius);
+}
 
-      /* We do not want too many progress updates because they
-       * can slow down the processing significantly for very
-       * large images
-       */
-      progress_step = height / 16;
+static void
+blur_kernel_free (BlurKernel *kernel)
+{
+  if (kernel->curve)
+    free_rle_curve (kernel->curve, kernel->length, kernel->sum);
+}
 
-      if (progress_step < 5)
-        progress_step = 5;
+static void
+blur_line_rle (const BlurKernel *kernel,
+               const guchar     *src,
+               guchar           *dest,
+               gint              len,
+               gint              bytes)
+{
+  const gint  length = kernel->length;
+  gint       *rle;
+  gint       *pix;
+  gint        b;
 
-      horz = fabs (horz) + 1.0;
+  rle = g_new (gint, len + 2 * length);
+  rle += length; /* rle[] extends from -length to len+length-1 */
 
-      if (horz != vert)
-        {
-          std_dev = sqrt (-(horz * horz) / (2 * log (1.0 / 255.0)));
+  pix = g_new (gint, len + 2 * length);
+  pix += length; /* pix[] extends from -length to len+length-1 */
 
-          /*  derive the constants for calculating the gaussian
-           *  from the std dev
-           */
-          find_iir_constants (n_p, n_m, d_p, d_m, bd_p, bd_m, std_dev);
+  for (b = 0; b < bytes; b++)
+    {
+      gint same = run_length_encode (src + b, rle, pix, bytes,
+                                     len, length, TRUE);
 
+      if (same > (3 * len) / 4)
+        {
+          /* encoded_rle is only fastest if there are a lot of
+           * repeating pixels
+           */
+          do_encoded_lre (rle, pix, dest + b, len, length, bytes,
+                          kernel->curve, kernel->total, kernel->sum);
         }
-
-
-      for (row = 0; row < height; row++)
+      else
         {
+          /* else a full but more simple algorithm is better */
+          do_full_lre (pix, dest + b, len, length, bytes,
+                       kernel->curve, kernel->total);
+        }
+    }
 
-          memset (val_p, 0, width * bytes * sizeof (gdouble));
-          memset (val_m, 0, width * bytes * sizeof (gdouble));
-
-          if (direct)
-            {
-              gimp_pixel_rgn_get_row (&src_rgn, src, x1, row + y1, width);
-            }
-          else
-            {
-              memcpy (src,
-                      preview_buffer + row * width * bytes,
-                      width * bytes);
-            }
+  g_free (rle - length);
+  g_free (pix - length);
+}
 
+/* Blurs a line of 8-bit pixels from src into dest with the RLE curve,
+ * src is premultiplied in place if there is an alpha channel.
+ */
+static void
+blur_line (const BlurKernel *kernel,
+           guchar           *src,
+           guchar           *dest,
+           gint              len,
+           gint              bytes)
+{
+  if (kernel->has_alpha)
+    multiply_alpha (src, len, bytes);
 
-          if (has_alpha)
-            multiply_alpha (src, width, bytes);
+  blur_line_rle (kernel, src, dest, len, bytes);
 
+  if (kernel->has_alpha)
+    separate_alpha (dest, len, bytes);
+}
 
-          sp_p = src;
-          sp_m = src + (width - 1) * bytes;
-          vp = val_p;
-          vm = val_m + (width - 1) * bytes;
+static void
+blur_rows (const GimpParallelArea *area,
+           gpointer                data)
+{
+  const BlurKernel *kernel = data;
+  const gint        bytes  = area->bpp;
+  const gint        len    = area->src_roi.width;
+  const gint        offset = (area->roi.x - area->src_roi.x) * bytes;
+  guchar           *src    = g_new (guchar, len * bytes);
+  guchar           *dest   = g_new (guchar, len * bytes);
+  gint              row;
+
+  for (row = 0; row < area->roi.height; row++)
+    {
+      memcpy (src,
+              area->src + ((area->roi.y - area->src_roi.y + row) *
+                           area->src_rowstride),
+              len * bytes);
 
-          /*  Set up the first vals  */
-          for (i = 0; i < bytes; i++)
-            {
-              initial_p[i] = sp_p[i];
-              initial_m[i] = sp_m[i];
-            }
+      blur_line (kernel, src, dest, len, bytes);
 
-          for (col = 0; col < width; col++)
-            {
-              gdouble *vpptr, *vmptr;
-
-              terms = (col < 4) ? col : 4;
-
-              for (b = 0; b < bytes; b++)
-                {
-                  vpptr = vp + b; vmptr = vm + b;
-
-                  for (i = 0; i <= terms; i++)
-                    {
-                      *vpptr += n_p[i] * sp_p[(-i * bytes) + b] -
-                        d_p[i] * vp[(-i * bytes) + b];
-                      *vmptr += n_m[i] * sp_m[(i * bytes) + b] -
-                        d_m[i] * vm[(i * bytes) + b];
-                    }
-                  for (j = i; j <= 4; j++)
-                    {
-                      *vpptr += (n_p[j] - bd_p[j]) * initial_p[b];
-                      *vmptr += (n_m[j] - bd_m[j]) * initial_m[b];
-                    }
-                }
-
-              sp_p += bytes;
-              sp_m -= bytes;
-              vp += bytes;
-              vm -= bytes;
-            }
+      memcpy (area->dest + row * area->dest_rowstride,
+              dest + offset, area->roi.width * bytes);
+    }
 
-          transfer_pixels (val_p, val_m, dest, bytes, width);
+  g_free (src);
+  g_free (dest);
+}
 
-          if (has_alpha)
-            separate_alpha (dest, width, bytes);
+static void
+blur_cols (const GimpParallelArea *area,
+           gpointer                data)
+{
+  const BlurKernel *kernel = data;
+  const gint        bytes  = area->bpp;
+  const gint        len    = area->src_roi.height;
+  const gint        offset = area->roi.y - area->src_roi.y;
+  guchar           *src    = g_new (guchar, len * bytes);
+  guchar           *dest   = g_new (guchar, len * bytes);
+  gint              col;
+
+  for (col = 0; col < area->roi.width; col++)
+    {
+      const guchar *s = area->src + (area->roi.x - area->src_roi.x + col) * bytes;
+      gint          row;
 
-          if (direct)
-            {
-              gimp_pixel_rgn_set_row (&dest_rgn, dest, x1, row + y1, width);
+      for (row = 0; row < len; row++)
+        memcpy (src + row * bytes, s + row * area->src_rowstride, bytes);
 
-              progress += width * horz;
+      blur_line (kernel, src, dest, len, bytes);
 
-              if ((row % progress_step) == 0)
-                gimp_progress_update (progress / max_progress);
-            }
-          else
-            {
-              memcpy (preview_buffer + row * width * bytes,
-                      dest,
-                      width * bytes);
-            }
-        }
+      for (row = 0; row < area->roi.height; row++)
+        memcpy (area->dest + row * area->dest_rowstride + col * bytes,
+                dest + (offset + row) * bytes,
+                bytes);
     }
 
-  /*  free up buffers  */
-
-  g_free (val_p);
-  g_free (val_m);
-
   g_free (src);
   g_free (dest);
 }
 
-
+/* Runs the IIR filter along n_lanes lines at once.  Sample i of lane
+ * l is src[i * n_lanes + l], so that all the inner loops walk over
+ * consecutive floats, and the compiler can turn them into vector
+ * code.  history has to hold 5 * n_lanes values.
+ */
 static void
-gauss_rle (GimpDrawable *drawable,
-           gdouble       horz,
-           gdouble       vert,
-           BlurMethod    method,
-           guchar       *preview_buffer,
-           gint          x1,
-           gint          y1,
-           gint          width,
-           gint          height)
+blur_iir_lanes (const BlurKernel *kernel,
+                const gfloat     *src,
+                gfloat           *dest,
+                gdouble          *history,
+                gint              len,
+                gint              n_lanes)
 {
-  GimpPixelRgn  src_rgn, dest_rgn;
-  gint          bytes;
-  gboolean      has_alpha;
-  guchar       *dest;
-  guchar       *src;
-  gint          row, col, b;
-  gdouble       progress, max_progress;
-  gdouble       std_dev;
-  gint          total = 1;
-  gint         *curve = NULL;
-  gint         *sum   = NULL;
-  gint          length;
-  gboolean      direct;
-  gint          progress_step;
-
-  direct = (preview_buffer == NULL);
-
-  bytes = drawable->bpp;
-  has_alpha = gimp_drawable_has_alpha (drawable->drawable_id);
-
-  src  = g_new (guchar, MAX (width, height) * bytes);
-  dest = g_new (guchar, MAX (width, height) * bytes);
-
-  gimp_pixel_rgn_init (&src_rgn,
-                       drawable, 0, 0, drawable->width, drawable->height,
-                       FALSE, FALSE);
-
-  if (direct)
-    gimp_pixel_rgn_init (&dest_rgn,
-                         drawable, 0, 0, drawable->width, drawable->height,
-                         TRUE, TRUE);
-
-  progress = 0.0;
-  max_progress  = (horz <= 0.0) ? 0 : width * height * horz;
-  max_progress += (vert <= 0.0) ? 0 : width * height * vert;
-
+  const gfloat *first = src;
+  const gfloat *last  = src + (len - 1) * n_lanes;
+  gint          i, k, l;
 
-  /*  First the vertical pass  */
-  if (vert > 0.0)
+  /*  the causal pass, from the start of the lines  */
+  for (i = 0; i < len; i++)
     {
-      gint   * rle = NULL;
-      gint   * pix = NULL;
+      const gfloat *s     = src + i * n_lanes;
+      gfloat       *d     = dest + i * n_lanes;
+      gdouble      *v     = history + (i % 5) * n_lanes;
+      const gint    terms = MIN (i, 4);
+      gdouble       c     = 0.0;
 
-      vert = fabs (vert) + 1.0;
-      std_dev = sqrt (-(vert * vert) / (2 * log (1.0 / 255.0)));
+      for (l = 0; l < n_lanes; l++)
+        v[l] = kernel->n_p[0] * s[l];
 
-      /* Insure that we do not have too many progress updates for
-       * images with a lot of rows or columns
-       */
-      progress_step = width / 16;
+      for (k = 1; k <= terms; k++)
+        {
+          const gfloat  *sk = s - k * n_lanes;
+          const gdouble *vk = history + ((i - k) % 5) * n_lanes;
+          const gdouble  n  = kernel->n_p[k];
+          const gdouble  dk = kernel->d_p[k];
+
+          for (l = 0; l < n_lanes; l++)
+            v[l] += n * sk[l] - dk * vk[l];
+        }
 
-      if (progress_step < 5)
-        progress_step = 5;
+      /*  the samples before the start are the first one repeated  */
+      for (k = terms + 1; k <= 4; k++)
+        c += kernel->n_p[k] - kernel->bd_p[k];
 
-      make_rle_curve (std_dev, &curve, &length, &sum, &total);
+      if (c != 0.0)
+        for (l = 0; l < n_lanes; l++)
+          v[l] += c * first[l];
 
-      rle = g_new (gint, height + 2 * length);
-      rle += length; /* rle[] extends from -length to height+length-1 */
+      for (l = 0; l < n_lanes; l++)
+        d[l] = v[l];
+    }
+
+  /*  the anti-causal pass, from the end of the lines  */
+  for (i = len - 1; i >= 0; i--)
+    {
+      const gint    q     = len - 1 - i;
+      const gfloat *s     = src + i * n_lanes;
+      gfloat       *d     = dest + i * n_lanes;
+      gdouble      *v     = history + (q % 5) * n_lanes;
+      const gint    terms = MIN (q, 4);
+      gdouble       c     = 0.0;
 
-      pix = g_new (gint, height + 2 * length);
-      pix += length; /* pix[] extends from -length to height+length-1 */
+      for (l = 0; l < n_lanes; l++)
+        v[l] = kernel->n_m[0] * s[l];
 
-      for (col = 0; col < width; col++)
+      for (k = 1; k <= terms; k++)
         {
+          const gfloat  *sk = s + k * n_lanes;
+          const gdouble *vk = history + ((q - k) % 5) * n_lanes;
+          const gdouble  n  = kernel->n_m[k];
+          const gdouble  dk = kernel->d_m[k];
 
-          gimp_pixel_rgn_get_col (&src_rgn, src, col + x1, y1, height);
+          for (l = 0; l < n_lanes; l++)
+            v[l] += n * sk[l] - dk * vk[l];
+        }
 
-          if (has_alpha)
-            multiply_alpha (src, height, bytes);
+      for (k = terms + 1; k <= 4; k++)
+        c += kernel->n_m[k] - kernel->bd_m[k];
 
-          for (b = 0; b < bytes; b++)
-            {
-              gint same =  run_length_encode (src + b, rle, pix, bytes,
-                                              height, length, TRUE);
-
-              if (same > (3 * height) / 4)
-                {
-                  /* encoded_rle is only fastest if there are a lot of
-                   * repeating pixels
-                   */
-                  do_encoded_lre (rle, pix, dest + b, height, length, bytes,
-                                  curve, total, sum);
-                }
-              else
-                {
-                  /* else a full but more simple algorithm is better */
-                  do_full_lre (pix, dest + b, height, length, bytes,
-                               curve, total);
-                }
-            }
+      if (c != 0.0)
+        for (l = 0; l < n_lanes; l++)
+          v[l] += c * last[l];
 
-          if (has_alpha)
-            separate_alpha (dest, height, bytes);
+      for (l = 0; l < n_lanes; l++)
+        d[l] += v[l];
+    }
+}
 
-          if (direct)
-            {
-              gimp_pixel_rgn_set_col (&dest_rgn, dest, col + x1, y1, height);
+/* The horizontal IIR pass.  The rows of the area are transposed in
+ * blocks, so that every component of every row becomes one lane of
+ * blur_iir_lanes(), and transposed back when they are done.
+ */
+static void
+blur_rows_iir (const GimpParallelArea *area,
+               gpointer                data)
+{
+  const BlurKernel *kernel  = data;
+  const gint        n_comps = area->bpp / sizeof (gfloat);
+  const gint        len     = area->src_roi.width;
+  const gint        height  = area->roi.height;
+  const gint        n_lanes = height * n_comps;
+  const gint        offset  = area->roi.x - area->src_roi.x;
+  gfloat           *src     = g_new (gfloat, len * n_lanes);
+  gfloat           *dest    = g_new (gfloat, len * n_lanes);
+  gdouble          *history = g_new (gdouble, 5 * n_lanes);
+  gint              row, x, x0;
+
+  for (x0 = 0; x0 < len; x0 += IIR_BLOCK)
+    {
+      const gint x1 = MIN (x0 + IIR_BLOCK, len);
 
-              progress += height * vert;
+      for (row = 0; row < height; row++)
+        {
+          const gfloat *s;
 
-              if ((col % progress_step) == 0)
-                gimp_progress_update (progress / max_progress);
-            }
-          else
-            {
-              for (row = 0; row < height; row++)
-                memcpy (preview_buffer + (row * width + col) * bytes,
-                        dest + row * bytes,
-                        bytes);
-            }
+          s = (const gfloat *) (area->src +
+                                (area->roi.y - area->src_roi.y + row) *
+                                area->src_rowstride);
 
+          for (x = x0; x < x1; x++)
+            memcpy (src + x * n_lanes + row * n_comps,
+                    s + x * n_comps, area->bpp);
         }
+    }
 
+  blur_iir_lanes (kernel, src, dest, history, len, n_lanes);
 
-      g_free (rle - length);
-      g_free (pix - length);
-
-      /* prepare for the horizontal pass  */
-      gimp_pixel_rgn_init (&src_rgn,
-                           drawable, 0, 0, drawable->width, drawable->height,
-                           FALSE, TRUE);
-    }
-  else if (!direct)
+  for (x0 = 0; x0 < area->roi.width; x0 += IIR_BLOCK)
     {
-      gimp_pixel_rgn_get_rect (&src_rgn,
-                               preview_buffer, x1, y1, width, height);
-    }
+      const gint x1 = MIN (x0 + IIR_BLOCK, area->roi.width);
 
-  /*  Now the horizontal pass  */
-  if (horz > 0.0)
-    {
-      gint   * rle = NULL;
-      gint   * pix = NULL;
+      for (row = 0; row < height; row++)
+        {
+          gfloat *d = (gfloat *) (area->dest + row * area->dest_rowstride);
 
-      /* Insure that we do not have too many progress updates for
-       * images with a lot of rows or columns
-       */
-      progress_step = height / 16;
+          for (x = x0; x < x1; x++)
+            memcpy (d + x * n_comps,
+                    dest + (offset + x) * n_lanes + row * n_comps,
+                    area->bpp);
+        }
+    }
 
-      if (progress_step < 5) {
-        progress_step = 5;
-      }
+  g_free (history);
+  g_free (dest);
+  g_free (src);
+}
 
-      horz = fabs (horz) + 1.0;
+/* The vertical IIR pass.  The area is a block of whole columns, whose
+ * rows already are the lanes blur_iir_lanes() wants, so it runs on
+ * the area's pixels as they are.
+ */
+static void
+blur_cols_iir (const GimpParallelArea *area,
+               gpointer                data)
+{
+  const BlurKernel *kernel  = data;
+  const gint        len     = area->src_roi.height;
+  const gint        offset  = area->roi.y - area->src_roi.y;
+  const gint        n_lanes = area->src_rowstride / sizeof (gfloat);
+  gfloat           *dest    = g_new (gfloat, len * n_lanes);
+  gdouble          *history = g_new (gdouble, 5 * n_lanes);
 
-      /* euse the same curve if possible else recompute a new one */
-      if (horz != vert)
-        {
+  g_assert (area->src_roi.x     == area->roi.x &&
+            area->src_roi.width == area->roi.width);
 
-          std_dev = sqrt (-(horz * horz) / (2 * log (1.0 / 255.0)));
+  blur_iir_lanes (kernel, (const gfloat *) area->src, dest, history,
+                  len, n_lanes);
 
-          if (curve != NULL) {
-            free_rle_curve(curve, length, sum);
-          }
+  memcpy (area->dest, dest + offset * n_lanes,
+          area->roi.height * area->dest_rowstride);
 
-          make_rle_curve(std_dev, &curve, &length, &sum, &total);
+  g_free (history);
+  g_free (dest);
+}
 
-        }
+/* Blurs the roi of src_buffer into dest_buffer, first the columns,
+ * then the rows.  Pixels around the roi are used as far as the blur
+ * reaches, but only the roi is written.
+ */
+static void
+gauss_buffer (GeglBuffer          *src_buffer,
+              GeglBuffer          *dest_buffer,
+              const Babl          *format,
+              gboolean             has_alpha,
+              gdouble              horz,
+              gdouble              vert,
+              BlurMethod           method,
+              const GeglRectangle *roi,
+              gboolean             show_progress)
+{
+  GeglBuffer *tmp_buffer = NULL;
+  gdouble     progress   = 0.0;
 
+  if (show_progress)
+    progress = (horz <= 0.0) ? 1.0 : (vert <= 0.0) ? 0.0 : vert / (horz + vert);
 
-      rle = g_new (gint, width+2*length);
-      rle += length; /* so rle[] extends from -width to width+length-1 */
+  /*  First the vertical pass  */
+  if (vert > 0.0)
+    {
+      BlurKernel     kernel;
+      GeglRectangle  vert_roi = *roi;
+      GeglBuffer    *vert_dest = dest_buffer;
+      gint           margin;
 
-      pix = g_new (gint, width+2*length);
-      pix += length; /* so pix[] extends from -width to width+length-1 */
+      margin = blur_kernel_init (&kernel, method, has_alpha, vert);
 
-      for (row = 0; row < height; row++)
+      if (horz > 0.0)
         {
-          if (direct)
-            {
-              gimp_pixel_rgn_get_row (&src_rgn, src, x1, row + y1, width);
-            }
-          else
-            {
-              memcpy (src,
-                      preview_buffer + row * width * bytes,
-                      width * bytes);
-            }
+          /*  the horizontal pass needs blurred columns left and right
+           *  of the roi
+           */
+          gint horz_margin = ceil (fabs (horz) + 1.0);
 
-          if (has_alpha)
-            multiply_alpha (src, width, bytes);
+          gegl_rectangle_set (&vert_roi,
+                              roi->x - horz_margin, roi->y,
+                              roi->width + 2 * horz_margin, roi->height);
+          gegl_rectangle_intersect (&vert_roi,
+                                    &vert_roi,
+                                    gegl_buffer_get_extent (src_buffer));
 
-          for (b = 0; b < bytes; b++)
-            {
-              gint same = run_length_encode (src + b, rle, pix, bytes,
-                                             width, length, TRUE);
-
-              if (same > (3 * width) / 4)
-                {
-                  /* encoded_rle is only fastest if there are a lot of
-                   * repeating pixels
-                   */
-                  do_encoded_lre (rle, pix, dest + b, width, length, bytes,
-                                  curve, total, sum);
-                }
-              else
-                {
-                  /* else a full but more simple algorithm is better */
-                  do_full_lre (pix, dest + b, width, length, bytes,
-                               curve, total);
-                }
-            }
+          tmp_buffer = gegl_buffer_new (&vert_roi, format);
+          vert_dest  = tmp_buffer;
+        }
 
+      gimp_parallel_process (src_buffer, NULL, vert_dest, &vert_roi, format,
+                             0, margin, GEGL_ABYSS_CLAMP,
+                             0, vert_roi.height,
+                             method == BLUR_IIR ? blur_cols_iir : blur_cols,
+                             &kernel,
+                             0.0, progress);
 
-          if (has_alpha)
-            separate_alpha (dest, width, bytes);
+      blur_kernel_free (&kernel);
 
-          if (direct)
-            {
-              gimp_pixel_rgn_set_row (&dest_rgn, dest, x1, row + y1, width);
+      src_buffer = vert_dest;
+    }
 
-              progress += width * horz;
+  /*  Now the horizontal pass  */
+  if (horz > 0.0)
+    {
+      BlurKernel kernel;
+      gint       margin;
 
-              if ((row % progress_step) == 0)
-                gimp_progress_update (progress / max_progress);
-            }
-          else
-            {
-              memcpy (preview_buffer + row * width * bytes,
-                      dest,
-                      width * bytes);
-            }
-        }
+      margin = blur_kernel_init (&kernel, method, has_alpha, horz);
 
-      g_free (rle - length);
-      g_free (pix - length);
-    }
+      gimp_parallel_process (src_buffer, NULL, dest_buffer, roi, format,
+                             margin, 0, GEGL_ABYSS_CLAMP,
+                             roi->width, 0,
+                             method == BLUR_IIR ? blur_rows_iir : blur_rows,
+                             &kernel,
+                             progress, show_progress ? 1.0 : 0.0);
 
-  if (curve)
-    free_rle_curve (curve, length, sum);
+      blur_kernel_free (&kernel);
+    }
 
-  g_free (src);
-  g_free (dest);
+  if (tmp_buffer)
+    g_object_unref (tmp_buffer);
 }
 
+/* The IIR filter runs on premultiplied floats, so it neither has to
+ * premultiply itself nor loses precision between the passes.  The
+ * RLE filter works on integer runs of 8-bit pixels.
+ */
+static const Babl *
+gauss_get_format (gint32     drawable_ID,
+                  BlurMethod method)
+{
+  gboolean has_alpha = gimp_drawable_has_alpha (drawable_ID);
+
+  if (method == BLUR_IIR)
+    {
+      if (gimp_drawable_is_gray (drawable_ID))
+        return babl_format (has_alpha ? "Y'aA float" : "Y' float");
+      else
+        return babl_format (has_alpha ? "R'aG'aB'aA float" : "R'G'B' float");
+    }
+
+  if (gimp_drawable_is_gray (drawable_ID))
+    return babl_format (has_alpha ? "Y'A u8" : "Y' u8");
+  else
+    return babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8");
+}
 
 static void
 gauss (GimpDrawable *drawable,
@@ -1415,10 +1367,10 @@ gauss (GimpDrawable *drawable,
        BlurMethod    method,
        GtkWidget    *preview)
 {
-
-  gint    x, y;
-  gint    width, height;
-  guchar *preview_buffer = NULL;
+  const Babl    *format;
+  const Babl    *preview_format;
+  gboolean       has_alpha;
+  GeglRectangle  roi;
 
   /*
    * IIR goes wrong if the blur radius is less than 1, so we silently
@@ -1434,77 +1386,89 @@ gauss (GimpDrawable *drawable,
       return;
     }
 
+  format         = gauss_get_format (drawable->drawable_id, method);
+  preview_format = gauss_get_format (drawable->drawable_id, BLUR_RLE);
+  has_alpha      = gimp_drawable_has_alpha (drawable->drawable_id);
+
   if (preview)
     {
-      gimp_preview_get_position (GIMP_PREVIEW (preview), &x, &y);
-      gimp_preview_get_size (GIMP_PREVIEW (preview), &width, &height);
+      GimpPixelRgn   src_rgn;
+      GeglBuffer    *src_buffer;
+      GeglBuffer    *dest_buffer;
+      GeglRectangle  extent;
+      guchar        *src;
+      guchar        *dest;
+      gint           hor_extra = (horz > 0.0) ? ceil (fabs (horz) + 1.0) : 0;
+      gint           ver_extra = (vert > 0.0) ? ceil (fabs (vert) + 1.0) : 0;
+
+      gimp_preview_get_position (GIMP_PREVIEW (preview), &roi.x, &roi.y);
+      gimp_preview_get_size (GIMP_PREVIEW (preview), &roi.width, &roi.height);
+
+      /*  the preview reads the drawable through a pixel region, asking
+       *  for its buffer would switch the plug-in to the drawable's
+       *  precision
+       */
+      gegl_rectangle_set (&extent,
+                          roi.x - hor_extra, roi.y - ver_extra,
+                          roi.width + 2 * hor_extra, roi.height + 2 * ver_extra);
+      gegl_rectangle_intersect (&extent, &extent,
+                                GEGL_RECTANGLE (0, 0,
+                                                drawable->width,
+                                                drawable->height));
 
-      preview_buffer = g_new (guchar, width * height * drawable->bpp);
+      src = g_new (guchar, extent.width * extent.height * drawable->bpp);
 
-    }
-  else if (gimp_drawable_mask_intersect (drawable->drawable_id,
-                                         &x, &y, &width, &height))
-    { /* With a selection, extend the input area of the amount required */
-      gint hor_extra = method == BLUR_IIR ? 4 : 1 + ceil (horz);
-      gint ver_extra = method == BLUR_IIR ? 4 : 1 + ceil (vert);
-      gint x2        = x + width;
-      gint y2        = y + height;
-
-      x = MAX (x - hor_extra, 0);
-      y = MAX (y - ver_extra, 0);
-      width  = MIN (x2 + hor_extra, drawable->width) - x;
-      height = MIN (y2 + ver_extra, drawable->height) - y;
-    }
-  else
-    {
-      return;
-    }
+      gimp_pixel_rgn_init (&src_rgn, drawable,
+                           extent.x, extent.y, extent.width, extent.height,
+                           FALSE, FALSE);
+      gimp_pixel_rgn_get_rect (&src_rgn, src,
+                               extent.x, extent.y, extent.width, extent.height);
 
+      src_buffer  = gegl_buffer_linear_new_from_data (src, preview_format,
+                                                      &extent,
+                                                      GEGL_AUTO_ROWSTRIDE,
+                                                      NULL, NULL);
+      dest_buffer = gegl_buffer_new (&extent, preview_format);
 
-  if (method == BLUR_IIR)
-    gauss_iir (drawable,
-               horz, vert, method, preview_buffer, x, y, width, height);
-  else
-    gauss_rle (drawable,
-               horz, vert, method, preview_buffer, x, y, width, height);
+      gauss_buffer (src_buffer, dest_buffer, format, has_alpha,
+                    horz, vert, method, &roi, FALSE);
+
+      dest = g_new (guchar, roi.width * roi.height * drawable->bpp);
+
+      gegl_buffer_get (dest_buffer, &roi, 1.0, preview_format,
+                       dest, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
 
-  if (preview)
-    {
       gimp_preview_draw_buffer (GIMP_PREVIEW (preview),
-                                preview_buffer, width * drawable->bpp);
-      g_free (preview_buffer);
+                                dest, roi.width * drawable->bpp);
+
+      g_object_unref (dest_buffer);
+      g_object_unref (src_buffer);
+
+      g_free (dest);
+      g_free (src);
     }
-  else
+  else if (gimp_drawable_mask_intersect (drawable->drawable_id,
+                                         &roi.x, &roi.y,
+                                         &roi.width, &roi.height))
     {
-      gimp_progress_update (1.0);
-      /*  merge the shadow, update the drawable  */
-      gimp_drawable_flush (drawable);
-      gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
-      gimp_drawable_update (drawable->drawable_id, x, y, width, height);
-    }
-}
+      GeglBuffer *src_buffer;
+      GeglBuffer *dest_buffer;
 
-static void
-transfer_pixels (const gdouble *src1,
-                 const gdouble *src2,
-                 guchar        *dest,
-                 gint           bytes,
-                 gint           width)
-{
-  gint    b;
-  gint    bend = bytes * width;
-  gdouble sum;
+      src_buffer  = gimp_drawable_get_buffer (drawable->drawable_id);
+      dest_buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
 
-  for (b = 0; b < bend; b++)
-    {
-      sum = *src1++ + *src2++;
+      gauss_buffer (src_buffer, dest_buffer, format, has_alpha,
+                    horz, vert, method, &roi, TRUE);
+
+      g_object_unref (src_buffer);
+      g_object_unref (dest_buffer);
 
-      if (sum > 255)
-        sum = 255;
-      else if (sum < 0)
-        sum = 0;
+      gimp_progress_update (1.0);
 
-      *dest++ = (guchar) sum;
+      /*  merge the shadow, update the drawable  */
+      gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
+      gimp_drawable_update (drawable->drawable_id,
+                            roi.x, roi.y, roi.width, roi.height);
     }
 }
 
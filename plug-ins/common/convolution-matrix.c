@@ -46,7 +46,6 @@
 
 #define HALF_WINDOW   (MATRIX_SIZE/2)
 #define MATRIX_CELLS  (MATRIX_SIZE*MATRIX_SIZE)
-#define DEST_ROWS     (MATRIX_SIZE/2 + 1)
 #define CHANNELS      (5)
 #define BORDER_MODES  (3)
 
@@ -90,10 +89,13 @@ static void      convolve_image        (GimpDrawable  *drawable,
 
 static void      check_config          (GimpDrawable  *drawable);
 
-static gfloat    convolve_pixel        (guchar       **src_row,
+static gfloat    convolve_pixel        (const guchar **src_row,
                                         gint           x_offset,
                                         gint           channel,
-                                        GimpDrawable  *drawable);
+                                        gint           bpp,
+                                        gfloat         matrixsum);
+static void      convolve_area         (const GimpParallelArea *area,
+                                        gpointer       data);
 
 const GimpPlugInInfo PLUG_IN_INFO =
 {
@@ -116,6 +118,12 @@ typedef struct
   gboolean   autoset;
 } config_struct;
 
+typedef struct
+{
+  gboolean   chanmask[CHANNELS - 1];
+  gfloat     matrixsum;
+} ConvolveParams;
+
 #ifndef BIG_MATRIX
 static const config_struct default_config =
 {
@@ -226,6 +234,7 @@ run (const gchar      *name,
   GimpDrawable      *drawable;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   *nreturn_vals = 1;
   *return_vals = values;
@@ -462,28 +471,17 @@ my_get_row (GimpPixelRgn *PR,
 }
 
 static gfloat
-convolve_pixel (guchar       **src_row,
+convolve_pixel (const guchar **src_row,
                 gint           x_offset,
                 gint           channel,
-                GimpDrawable  *drawable)
+                gint           bpp,
+                gfloat         matrixsum)
 {
-  static gfloat matrixsum = 0; /* FIXME: this certainly breaks the preview */
-  static gint bpp         = 0;
-
   gfloat sum              = 0;
   gfloat alphasum         = 0;
   gint   x, y;
   gint   alpha_channel;
 
-  if (!bpp)
-    {
-      bpp = drawable->bpp;
-
-      for (y = 0; y < MATRIX_SIZE; y++)
-        for (x = 0; x < MATRIX_SIZE; x++)
-          matrixsum += ABS (config.matrix[x][y]);
-    }
-
   alpha_channel = bpp - 1;
 
   for (y = 0; y < MATRIX_SIZE; y++)
@@ -516,22 +514,66 @@ convolve_pixel (guchar       **src_row,
   return sum;
 }
 
+/*  Convolves one area, its source has a border of HALF_WINDOW pixels
+ *  on each side.
+ */
+static void
+convolve_area (const GimpParallelArea *area,
+               gpointer                data)
+{
+  const ConvolveParams *params = data;
+  const gint            bpp    = area->bpp;
+  const guchar         *src_row[MATRIX_SIZE];
+  gint                  row, col, i;
+
+  for (row = 0; row < area->roi.height; row++)
+    {
+      guchar *dest     = area->dest + row * area->dest_rowstride;
+      gint    x_offset = 0;
+
+      for (i = 0; i < MATRIX_SIZE; i++)
+        src_row[i] = area->src + (row + i) * area->src_rowstride;
+
+      for (col = 0; col < area->roi.width; col++)
+        {
+          gint channel;
+
+          for (channel = 0; channel < bpp; channel++)
+            {
+              guchar d;
+
+              if (params->chanmask[channel])
+                {
+                  gint result;
+
+                  result = ROUND (convolve_pixel (src_row,
+                                                  x_offset, channel, bpp,
+                                                  params->matrixsum));
+                  d = CLAMP (result, 0, 255);
+                }
+              else
+                {
+                  /* copy unmodified pixel */
+                  d = src_row[HALF_WINDOW][x_offset + HALF_WINDOW * bpp];
+                }
+
+              dest[x_offset] = d;
+              x_offset++;
+            }
+        }
+    }
+}
+
 static void
 convolve_image (GimpDrawable *drawable,
                 GimpPreview  *preview)
 {
-  GimpPixelRgn  srcPR, destPR;
-  gint          width, height, row, col;
-  gint          src_w, src_row_w, src_h, i;
-  gint          src_x1, src_y1, src_x2, src_y2;
-  gint          x1, x2, y1, y2;
-  guchar       *dest_row[DEST_ROWS];
-  guchar       *src_row[MATRIX_SIZE];
-  guchar       *tmp_row;
-  gint          x_offset;
-  gboolean      chanmask[CHANNELS - 1];
-  gint          bpp;
-  gint          alpha_channel;
+  ConvolveParams  params;
+  const Babl     *format;
+  gboolean        has_alpha;
+  GeglRectangle   roi;
+  gint            alpha_channel;
+  gint            x, y, i;
 
   /* Get the input area. This is the bounding box of the selection in
    *  the image (or the entire image if there is no selection). Only
@@ -541,147 +583,138 @@ convolve_image (GimpDrawable *drawable,
    */
   if (preview)
     {
-      gimp_preview_get_position (preview, &src_x1, &src_y1);
-      gimp_preview_get_size (preview, &src_w, &src_h);
-      src_x2 = src_x1 + src_w;
-      src_y2 = src_y1 + src_h;
+      gimp_preview_get_position (preview, &roi.x, &roi.y);
+      gimp_preview_get_size (preview, &roi.width, &roi.height);
     }
   else
     {
+      gint x2, y2;
+
       gimp_drawable_mask_bounds (drawable->drawable_id,
-                                 &src_x1, &src_y1, &src_x2, &src_y2);
-      src_w = src_x2 - src_x1;
-      src_h = src_y2 - src_y1;
+                                 &roi.x, &roi.y, &x2, &y2);
+      roi.width  = x2 - roi.x;
+      roi.height = y2 - roi.y;
     }
 
-  /* Get the size of the input image. (This will/must be the same
-   *  as the size of the output image.
-   */
-  width  = drawable->width;
-  height = drawable->height;
-  bpp  = drawable->bpp;
-  alpha_channel = bpp - 1;
+  has_alpha = gimp_drawable_has_alpha (drawable->drawable_id);
 
   if (gimp_drawable_is_rgb (drawable->drawable_id))
     {
+      format = babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8");
+
       for (i = 0; i < CHANNELS - 1; i++)
-        chanmask[i] = config.channels[i + 1];
+        params.chanmask[i] = config.channels[i + 1];
     }
   else /* Grayscale */
     {
-      chanmask[0] = config.channels[0];
-    }
+      format = babl_format (has_alpha ? "Y'A u8" : "Y' u8");
 
-  if (gimp_drawable_has_alpha (drawable->drawable_id))
-    chanmask[alpha_channel] = config.channels[4];
-
-  src_row_w = src_w + HALF_WINDOW + HALF_WINDOW;
+      params.chanmask[0] = config.channels[0];
+    }
 
-  for (i = 0; i < MATRIX_SIZE; i++)
-    src_row[i] = g_new (guchar, src_row_w * bpp);
+  alpha_channel = babl_format_get_n_components (format) - 1;
 
-  for (i = 0; i < DEST_ROWS; i++)
-    dest_row[i]= g_new (guchar, src_w * bpp);
+  if (has_alpha)
+    params.chanmask[alpha_channel] = config.channels[4];
 
-  /*  initialize the pixel regions  */
-  x1 = MAX (src_x1 - HALF_WINDOW, 0);
-  y1 = MAX (src_y1 - HALF_WINDOW, 0);
-  x2 = MIN (src_x2 + HALF_WINDOW, width);
-  y2 = MIN (src_y2 + HALF_WINDOW, height);
-  gimp_pixel_rgn_init (&srcPR, drawable,
-                       x1, y1, x2 - x1, y2 - y1, FALSE, FALSE);
-  gimp_pixel_rgn_init (&destPR, drawable,
-                       src_x1, src_y1, src_w, src_h,
-                       preview == NULL, TRUE);
+  params.matrixsum = 0;
 
-  /* initialize source arrays */
-  for (i = 0; i < MATRIX_SIZE; i++)
-    my_get_row (&srcPR, src_row[i], src_x1 - HALF_WINDOW,
-                src_y1 - HALF_WINDOW + i , src_row_w);
+  for (y = 0; y < MATRIX_SIZE; y++)
+    for (x = 0; x < MATRIX_SIZE; x++)
+      params.matrixsum += ABS (config.matrix[x][y]);
 
-  for (row = src_y1; row < src_y2; row++)
+  if (preview)
     {
-      gint channel;
-
-      x_offset = 0;
-
-      for (col = src_x1; col < src_x2; col++)
-        for (channel = 0; channel < bpp; channel++)
-          {
-            guchar d;
-
-            if (chanmask[channel])
-              {
-                gint result;
-
-                result = ROUND (convolve_pixel (src_row,
-                                                x_offset, channel, drawable));
-                d = CLAMP (result, 0, 255);
-              }
-            else
-              {
-                /* copy unmodified pixel */
-                d = src_row[HALF_WINDOW][x_offset + HALF_WINDOW * bpp];
-              }
-
-            dest_row[HALF_WINDOW][x_offset] = d;
-            x_offset++;
-          }
-
-      if (row >= src_y1 + HALF_WINDOW)
-        gimp_pixel_rgn_set_row (&destPR,
-                                dest_row[0], src_x1, row - HALF_WINDOW, src_w);
+      GimpPixelRgn   srcPR;
+      GeglBuffer    *src_buffer;
+      GeglBuffer    *dest_buffer;
+      GeglRectangle  extent;
+      guchar        *src;
+      guchar        *dest;
+      gint           bpp = drawable->bpp;
+
+      /*  the preview reads the drawable through a pixel region, asking
+       *  for its buffer would switch the plug-in to the drawable's
+       *  precision; my_get_row() fills in the border like the border
+       *  mode says
+       */
+      gegl_rectangle_set (&extent,
+                          roi.x - HALF_WINDOW, roi.y - HALF_WINDOW,
+                          roi.width  + 2 * HALF_WINDOW,
+                          roi.height + 2 * HALF_WINDOW);
+
+      src = g_new (guchar, extent.width * extent.height * bpp);
+
+      gimp_pixel_rgn_init (&srcPR, drawable,
+                           0, 0, drawable->width, drawable->height,
+                           FALSE, FALSE);
+
+      for (i = 0; i < extent.height; i++)
+        my_get_row (&srcPR, src + i * extent.width * bpp,
+                    extent.x, extent.y + i, extent.width);
+
+      src_buffer  = gegl_buffer_linear_new_from_data (src, format, &extent,
+                                                      GEGL_AUTO_ROWSTRIDE,
+                                                      NULL, NULL);
+      dest_buffer = gegl_buffer_new (&roi, format);
+
+      gimp_parallel_process (src_buffer, NULL, dest_buffer, &roi, format,
+                             HALF_WINDOW, HALF_WINDOW, GEGL_ABYSS_NONE,
+                             0, 0,
+                             convolve_area, &params,
+                             0.0, 0.0);
+
+      dest = g_new (guchar, roi.width * roi.height * bpp);
+
+      gegl_buffer_get (dest_buffer, &roi, 1.0, format,
+                       dest, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+      gimp_preview_draw_buffer (preview, dest, roi.width * bpp);
+
+      g_object_unref (dest_buffer);
+      g_object_unref (src_buffer);
+
+      g_free (dest);
+      g_free (src);
+    }
+  else
+    {
+      GeglBuffer      *src_buffer;
+      GeglBuffer      *dest_buffer;
+      GeglAbyssPolicy  abyss_policy;
 
-      if (row < src_y2 - 1)
+      switch (config.bmode)
         {
-          tmp_row = dest_row[0];
-
-          for (i = 0; i < DEST_ROWS - 1; i++)
-            dest_row[i] = dest_row[i + 1];
-
-          dest_row[DEST_ROWS - 1] = tmp_row;
-
-          tmp_row = src_row[0];
-
-          for (i = 0; i < MATRIX_SIZE - 1; i++)
-            src_row[i] = src_row[i + 1];
-
-          src_row[MATRIX_SIZE-1] = tmp_row;
-
-          my_get_row (&srcPR, src_row[MATRIX_SIZE - 1],
-                      src_x1 - HALF_WINDOW, row + HALF_WINDOW + 1, src_row_w);
+        case WRAP:
+          abyss_policy = GEGL_ABYSS_LOOP;
+          break;
+
+        case CLEAR:
+          abyss_policy = GEGL_ABYSS_NONE;
+          break;
+
+        case EXTEND:
+        default:
+          abyss_policy = GEGL_ABYSS_CLAMP;
+          break;
         }
 
-      if ((row % 10 == 0) && !preview)
-        gimp_progress_update ((double) (row - src_y1) / src_h);
-    }
+      src_buffer  = gimp_drawable_get_buffer (drawable->drawable_id);
+      dest_buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
 
-  /* put the remaining rows in the buffer in place */
-  for (i = 1; i <  DEST_ROWS; i++)
-    gimp_pixel_rgn_set_row (&destPR, dest_row[i],
-                            src_x1, src_y2 + i - 1 - HALF_WINDOW, src_w);
+      gimp_parallel_process (src_buffer, NULL, dest_buffer, &roi, format,
+                             HALF_WINDOW, HALF_WINDOW, abyss_policy,
+                             0, 0,
+                             convolve_area, &params,
+                             0.0, 1.0);
 
+      g_object_unref (src_buffer);
+      g_object_unref (dest_buffer);
 
-  /*  update the region  */
-  if (preview)
-    {
-      gimp_drawable_preview_draw_region (GIMP_DRAWABLE_PREVIEW (preview),
-                                         &destPR);
-    }
-  else
-    {
-      gimp_progress_update (1.0);
-      gimp_drawable_flush (drawable);
       gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
       gimp_drawable_update (drawable->drawable_id,
-                            src_x1, src_y1, src_x2 - src_x1, src_y2 - src_y1);
+                            roi.x, roi.y, roi.width, roi.height);
     }
-
-  for (i = 0; i < MATRIX_SIZE; i++)
-    g_free (src_row[i]);
-
-  for (i = 0; i < DEST_ROWS; i++)
-    g_free (dest_row[i]);
 }
 
 /***************************************************
@@ -23,6 +23,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
@@ -53,6 +54,30 @@
 /* List that stores pixels falling in to the same luma bucket */
 #define MAX_LIST_ELEMS SQR(2 * MAX_RADIUS + 1)
 
+/* Size of the areas the image is despeckled in, they overlap by the
+ * radius on each side
+ */
+#define AREA_SIZE        256
+
+/* Luma buckets of the constant-time median, in 16 coarse buckets of
+ * 16 fine buckets each
+ */
+#define N_COARSE          16
+#define N_FINE           256
+#define FINE_PER_COARSE  (N_FINE / N_COARSE)
+
+typedef struct
+{
+  gint          radius;
+  gint          type;
+  gint          black_level;
+  gint          white_level;
+  gint          bpp;          /* bytes per pixel                        */
+  gint          n_components;
+  gboolean      u16;          /* 16 bits per component, otherwise 8     */
+  GeglRectangle bounds;       /* the image, windows are clipped to it   */
+} DespeckleParams;
+
 typedef struct
 {
   const guchar *elems[MAX_LIST_ELEMS];
@@ -68,14 +93,24 @@ typedef struct
   gint       ymin;
   gint       xmax;
   gint       ymax; /* Source rect */
-} DespeckleHistogram;
 
-/* Number of pixels in actual histogram falling into each category */
-static gint                hist0;    /* Less than min treshold */
-static gint                hist255;  /* More than max treshold */
-static gint                histrest; /* From min to max        */
+  /* Number of pixels in the histogram falling into each category */
+  gint       hist0;    /* Less than min treshold */
+  gint       hist255;  /* More than max treshold */
+  gint       histrest; /* From min to max        */
 
-static DespeckleHistogram  histogram;
+  GRand     *rand;
+} DespeckleHistogram;
+
+/* Histogram of one column of the window, for the constant-time median */
+typedef struct
+{
+  guint16    coarse[N_COARSE];
+  guint16    fine[N_FINE];
+  guint16    n;        /* Number of pixels                            */
+  guint16    lo;       /* Number of pixels at or below the black level */
+  guint16    hi;       /* Number of pixels at or above the white level */
+} DespeckleColumn;
 
 
 /*
@@ -90,13 +125,16 @@ static void      run   (const gchar      *name,
                         GimpParam       **return_vals);
 
 static void      despeckle                 (void);
-static void      despeckle_median          (guchar        *src,
-                                            guchar        *dst,
-                                            gint           width,
-                                            gint           height,
-                                            gint           bpp,
-                                            gint           radius,
-                                            gboolean       preview);
+static void      despeckle_buffer          (GeglBuffer    *src_buffer,
+                                            GeglBuffer    *dest_buffer,
+                                            const Babl    *format,
+                                            const GeglRectangle *roi,
+                                            const GeglRectangle *bounds,
+                                            gboolean       show_progress);
+static void      despeckle_median          (const GimpParallelArea *area,
+                                            gpointer       data);
+static void      despeckle_adaptive        (const GimpParallelArea *area,
+                                            gpointer       data);
 
 static gboolean  despeckle_dialog          (void);
 
@@ -189,6 +227,7 @@ run (const gchar      *name,
   static GimpParam   values[1];
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   /*
    * Initialize parameter data...
@@ -332,22 +371,26 @@ run (const gchar      *name,
   gimp_drawable_detach (drawable);
 }
 
-static inline guchar
-pixel_luminance (const guchar *p,
-                 gint          bpp)
+/* Returns the luma bucket (0 to 255) of a pixel */
+static inline gint
+pixel_luminance (const guchar          *p,
+                 const DespeckleParams *params)
 {
-  switch (bpp)
+  if (params->u16)
     {
-    case 1:
-    case 2:
-      return p[0];
+      const guint16 *q = (const guint16 *) p;
 
-    case 3:
-    case 4:
-      return GIMP_RGB_LUMINANCE (p[0], p[1], p[2]);
+      if (params->n_components < 3)
+        return q[0] >> 8;
 
-    default:
-      return 0; /* should not be reached */
+      return (gint) (GIMP_RGB_LUMINANCE (q[0], q[1], q[2]) / 256.0);
+    }
+  else
+    {
+      if (params->n_components < 3)
+        return p[0];
+
+      return (gint) GIMP_RGB_LUMINANCE (p[0], p[1], p[2]);
     }
 }
 
@@ -356,69 +399,127 @@ pixel_copy (guchar       *dest,
             const guchar *src,
             gint          bpp)
 {
-  switch (bpp)
-    {
-    case 4:
-      *dest++ = *src++;
-    case 3:
-      *dest++ = *src++;
-    case 2:
-      *dest++ = *src++;
-    case 1:
-      *dest++ = *src++;
-    }
+  memcpy (dest, src, bpp);
 }
 
 /*
  * 'despeckle()' - Despeckle an image using a median filter.
  *
  * A median filter basically collects pixel values in a region around the
- * target pixel, sorts them, and uses the median value. This code uses a
- * circular row buffer to improve performance.
+ * target pixel, sorts them, and uses the median value.  The plain median
+ * keeps a histogram per column of the window and takes constant time per
+ * pixel, no matter the radius.
  *
  * The adaptive filter is based on the median filter but analizes the histogram
  * of the region around the target pixel and adjusts the despeckle diameter
  * accordingly.
+ *
+ * The image is streamed through the drawable's buffer in overlapping
+ * areas which are despeckled in parallel.
  */
 
 static void
 despeckle (void)
 {
-  GimpPixelRgn  src_rgn;        /* Source image region */
-  GimpPixelRgn  dst_rgn;
-  guchar       *src;
-  guchar       *dst;
-  gint          img_bpp;
-  gint          x, y;
-  gint          width, height;
-
-  img_bpp = gimp_drawable_bpp (drawable->drawable_id);
+  GeglBuffer    *src_buffer;
+  GeglBuffer    *dest_buffer;
+  const Babl    *format;
+  const Babl    *drawable_format;
+  GeglRectangle  roi;
+  gboolean       has_alpha;
+  gboolean       u16;
 
   if (! gimp_drawable_mask_intersect (drawable->drawable_id,
-                                      &x, &y, &width, &height))
+                                      &roi.x, &roi.y,
+                                      &roi.width, &roi.height))
     return;
 
-  gimp_pixel_rgn_init (&src_rgn, drawable, x, y, width, height, FALSE, FALSE);
-  gimp_pixel_rgn_init (&dst_rgn, drawable, x, y, width, height, TRUE, TRUE);
+  /*  keep 16 bits of high bit depth images, the luma buckets the
+   *  median is picked from stay at 8 bits
+   */
+  drawable_format = gimp_drawable_get_format (drawable->drawable_id);
+  has_alpha       = gimp_drawable_has_alpha (drawable->drawable_id);
 
-  src = g_new (guchar, width * height * img_bpp);
-  dst = g_new (guchar, width * height * img_bpp);
+  u16 = (babl_format_get_bytes_per_pixel (drawable_format) >
+         babl_format_get_n_components (drawable_format));
 
-  gimp_pixel_rgn_get_rect (&src_rgn, src, x, y, width, height);
+  if (gimp_drawable_is_gray (drawable->drawable_id))
+    {
+      if (u16)
+        format = babl_format (has_alpha ? "Y'A u16" : "Y' u16");
+      else
+        format = babl_format (has_alpha ? "Y'A u8" : "Y' u8");
+    }
+  else
+    {
+      if (u16)
+        format = babl_format (has_alpha ? "R'G'B'A u16" : "R'G'B' u16");
+      else
+        format = babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8");
+    }
 
-  despeckle_median (src, dst, width, height, img_bpp, despeckle_radius, FALSE);
+  src_buffer  = gimp_drawable_get_buffer (drawable->drawable_id);
+  dest_buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
 
-  gimp_pixel_rgn_set_rect (&dst_rgn, dst, x, y, width, height);
+  despeckle_buffer (src_buffer, dest_buffer, format,
+                    &roi, gegl_buffer_get_extent (src_buffer),
+                    TRUE);
 
-  gimp_drawable_flush (drawable);
-  gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
-  gimp_drawable_update (drawable->drawable_id, x, y, width, height);
+  g_object_unref (src_buffer);
+  g_object_unref (dest_buffer);
 
-  g_free (dst);
-  g_free (src);
+  gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
+  gimp_drawable_update (drawable->drawable_id,
+                        roi.x, roi.y, roi.width, roi.height);
 }
 
+static void
+despeckle_buffer (GeglBuffer          *src_buffer,
+                  GeglBuffer          *dest_buffer,
+                  const Babl          *format,
+                  const GeglRectangle *roi,
+                  const GeglRectangle *bounds,
+                  gboolean             show_progress)
+{
+  DespeckleParams  params;
+  GimpParallelFunc func;
+  gint             area_width  = AREA_SIZE;
+  gint             area_height = AREA_SIZE;
+
+  params.radius       = despeckle_radius;
+  params.type         = filter_type;
+  params.black_level  = black_level;
+  params.white_level  = white_level;
+  params.bpp          = babl_format_get_bytes_per_pixel (format);
+  params.n_components = babl_format_get_n_components (format);
+  params.u16          = (params.bpp > params.n_components);
+  params.bounds       = *bounds;
+
+  if (filter_type & (FILTER_ADAPTIVE | FILTER_RECURSIVE))
+    func = despeckle_adaptive;
+  else
+    func = despeckle_median;
 
+  /*  the recursive filter feeds its output back into its input, and
+   *  the adaptive filter carries its radius from pixel to pixel and
+   *  row to row, which only works when the whole region is done in
+   *  one go
+   */
+  if (filter_type & (FILTER_ADAPTIVE | FILTER_RECURSIVE))
+    {
+      area_width  = roi->width;
+      area_height = roi->height;
+    }
+
+  if (show_progress)
+    gimp_progress_init (_("Despeckle"));
+
+  gimp_parallel_process (src_buffer, NULL, dest_buffer, roi, format,
+                         params.radius, params.radius, GEGL_ABYSS_NONE,
+                         area_width, area_height,
+                         func, &params,
+                         0.0, show_progress ? 1.0 : 0.0);
+}
 
 /*
  * 'despeckle_dialog()' - Popup a dialog window for the filter box size...
@@ -574,33 +675,68 @@ despeckle_dialog (void)
 static void
 preview_update (GtkWidget *widget)
 {
-  GimpPixelRgn  src_rgn;        /* Source image region */
-  guchar       *dst;            /* Output image */
-  GimpPreview  *preview;        /* The preview widget */
-  guchar       *src;            /* Source pixel rows */
-  gint          img_bpp;
-  gint          x1,y1;
-  gint          width, height;
+  GimpPixelRgn   src_rgn;        /* Source image region */
+  GimpPreview   *preview;        /* The preview widget */
+  GeglBuffer    *src_buffer;
+  GeglBuffer    *dest_buffer;
+  const Babl    *format;
+  GeglRectangle  roi;
+  GeglRectangle  extent;
+  guchar        *src;            /* Source pixels */
+  guchar        *dst;            /* Output image */
+  gint           img_bpp;
+  gboolean       has_alpha;
 
   preview = GIMP_PREVIEW (widget);
 
-  img_bpp = gimp_drawable_bpp (drawable->drawable_id);
+  img_bpp   = gimp_drawable_bpp (drawable->drawable_id);
+  has_alpha = gimp_drawable_has_alpha (drawable->drawable_id);
+
+  if (gimp_drawable_is_gray (drawable->drawable_id))
+    format = babl_format (has_alpha ? "Y'A u8" : "Y' u8");
+  else
+    format = babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8");
+
+  gimp_preview_get_position (preview, &roi.x, &roi.y);
+  gimp_preview_get_size (preview, &roi.width, &roi.height);
 
-  width  = preview->width;
-  height = preview->height;
+  /*  read the pixels the window reaches around the preview as well  */
+  gegl_rectangle_set (&extent,
+                      roi.x - despeckle_radius, roi.y - despeckle_radius,
+                      roi.width  + 2 * despeckle_radius,
+                      roi.height + 2 * despeckle_radius);
+  gegl_rectangle_intersect (&extent, &extent,
+                            GEGL_RECTANGLE (0, 0,
+                                            drawable->width,
+                                            drawable->height));
 
-  gimp_preview_get_position (preview, &x1, &y1);
+  gimp_pixel_rgn_init (&src_rgn, drawable,
+                       extent.x, extent.y, extent.width, extent.height,
+                       FALSE, FALSE);
 
-  gimp_pixel_rgn_init (&src_rgn, drawable, x1, y1, width, height, FALSE, FALSE);
+  src = g_new (guchar, extent.width * extent.height * img_bpp);
+  dst = g_new (guchar, roi.width * roi.height * img_bpp);
 
-  dst = g_new (guchar, width * height * img_bpp);
-  src = g_new (guchar, width * height * img_bpp);
+  gimp_pixel_rgn_get_rect (&src_rgn, src,
+                           extent.x, extent.y, extent.width, extent.height);
 
-  gimp_pixel_rgn_get_rect (&src_rgn, src, x1, y1, width, height);
+  src_buffer  = gegl_buffer_linear_new_from_data (src, format, &extent,
+                                                  GEGL_AUTO_ROWSTRIDE,
+                                                  NULL, NULL);
+  dest_buffer = gegl_buffer_new (&roi, format);
 
-  despeckle_median (src, dst, width, height, img_bpp, despeckle_radius, TRUE);
+  despeckle_buffer (src_buffer, dest_buffer, format,
+                    &roi, GEGL_RECTANGLE (0, 0,
+                                          drawable->width, drawable->height),
+                    FALSE);
 
-  gimp_preview_draw_buffer (preview, dst, width * img_bpp);
+  gegl_buffer_get (dest_buffer, &roi, 1.0, format,
+                   dst, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  gimp_preview_draw_buffer (preview, dst, roi.width * img_bpp);
+
+  g_object_unref (dest_buffer);
+  g_object_unref (src_buffer);
 
   g_free (src);
   g_free (dst);
@@ -653,9 +789,10 @@ list_del_elem (PixelsList* list)
 }
 
 static inline const guchar *
-list_get_random_elem (PixelsList *list)
+list_get_random_elem (PixelsList *list,
+                      GRand      *rand)
 {
-  const gint pos = list->start + rand () % list->count;
+  const gint pos = list->start + g_rand_int_range (rand, 0, list->count);
 
   if (pos >= MAX_LIST_ELEMS)
     return list->elems[pos - MAX_LIST_ELEMS];
@@ -690,13 +827,17 @@ histogram_clean (DespeckleHistogram *hist)
       hist->elems[i] = 0;
       hist->origs[i].count = 0;
     }
+
+  hist->hist0    = 0;
+  hist->hist255  = 0;
+  hist->histrest = 0;
 }
 
 static inline const guchar *
 histogram_get_median (DespeckleHistogram *hist,
                       const guchar       *_default)
 {
-  gint count = histrest;
+  gint count = hist->histrest;
   gint i;
   gint sum = 0;
 
@@ -709,70 +850,70 @@ histogram_get_median (DespeckleHistogram *hist,
   while ((sum += hist->elems[i]) < count)
     i++;
 
-  return list_get_random_elem (&hist->origs[i]);
+  return list_get_random_elem (&hist->origs[i], hist->rand);
 }
 
 static inline void
-add_val (DespeckleHistogram *hist,
-         const guchar       *src,
-         gint                width,
-         gint                bpp,
-         gint                x,
-         gint                y)
+add_val (DespeckleHistogram    *hist,
+         const DespeckleParams *params,
+         const guchar          *src,
+         gint                   width,
+         gint                   x,
+         gint                   y)
 {
-  const gint pos   = (x + (y * width)) * bpp;
-  const gint value = pixel_luminance (src + pos, bpp);
+  const gint pos   = (x + (y * width)) * params->bpp;
+  const gint value = pixel_luminance (src + pos, params);
 
-  if (value > black_level && value < white_level)
+  if (value > params->black_level && value < params->white_level)
   {
     histogram_add (hist, value, src + pos);
-    histrest++;
+    hist->histrest++;
   }
   else
   {
-    if (value <= black_level)
-      hist0++;
+    if (value <= params->black_level)
+      hist->hist0++;
 
-    if (value >= white_level)
-      hist255++;
+    if (value >= params->white_level)
+      hist->hist255++;
   }
 }
 
 static inline void
-del_val (DespeckleHistogram *hist,
-         const guchar       *src,
-         gint                width,
-         gint                bpp,
-         gint                x,
-         gint                y)
+del_val (DespeckleHistogram    *hist,
+         const DespeckleParams *params,
+         const guchar          *src,
+         gint                   width,
+         gint                   x,
+         gint                   y)
 {
-  const gint pos   = (x + (y * width)) * bpp;
-  const gint value = pixel_luminance (src + pos, bpp);
+  const gint pos   = (x + (y * width)) * params->bpp;
+  const gint value = pixel_luminance (src + pos, params);
 
-  if (value > black_level && value < white_level)
+  if (value > params->black_level && value < params->white_level)
   {
     histogram_remove (hist, value);
-    histrest--;
+    hist->histrest--;
   }
   else
   {
-    if (value <= black_level)
-      hist0--;
+    if (value <= params->black_level)
+      hist->hist0--;
 
-    if (value >= white_level)
-      hist255--;
+    if (value >= params->white_level)
+      hist->hist255--;
   }
 }
 
 static inline void
-add_vals (DespeckleHistogram *hist,
-          const guchar       *src,
-          gint                width,
-          gint                bpp,
-          gint                xmin,
-          gint                ymin,
-          gint                xmax,
-          gint                ymax)
+add_vals (DespeckleHistogram    *hist,
+          const DespeckleParams *params,
+          const guchar          *src,
+          gint                   width,
+          gint                   xmin,
+          gint                   ymin,
+          gint                   xmax,
+          gint                   ymax)
 {
   gint x;
   gint y;
@@ -784,20 +925,20 @@ add_vals (DespeckleHistogram *hist,
     {
       for (x = xmin; x <= xmax; x++)
         {
-          add_val (hist, src, width, bpp, x, y);
+          add_val (hist, params, src, width, x, y);
         }
     }
 }
 
 static inline void
-del_vals (DespeckleHistogram *hist,
-          const guchar       *src,
-          gint                width,
-          gint                bpp,
-          gint                xmin,
-          gint                ymin,
-          gint                xmax,
-          gint                ymax)
+del_vals (DespeckleHistogram    *hist,
+          const DespeckleParams *params,
+          const guchar          *src,
+          gint                   width,
+          gint                   xmin,
+          gint                   ymin,
+          gint                   xmax,
+          gint                   ymax)
 {
   gint x;
   gint y;
@@ -809,34 +950,34 @@ del_vals (DespeckleHistogram *hist,
     {
       for (x = xmin; x <= xmax; x++)
         {
-          del_val (hist, src, width, bpp, x, y);
+          del_val (hist, params, src, width, x, y);
         }
     }
 }
 
 static inline void
-update_histogram (DespeckleHistogram *hist,
-                  const guchar       *src,
-                  gint                width,
-                  gint                bpp,
-                  gint                xmin,
-                  gint                ymin,
-                  gint                xmax,
-                  gint                ymax)
+update_histogram (DespeckleHistogram    *hist,
+                  const DespeckleParams *params,
+                  const guchar          *src,
+                  gint                   width,
+                  gint                   xmin,
+                  gint                   ymin,
+                  gint                   xmax,
+                  gint                   ymax)
 {
   /* assuming that radious of the box can change no more than one
      pixel in each call */
   /* assuming that box is moving either right or down */
 
-  del_vals (hist,
-            src, width, bpp, hist->xmin, hist->ymin, xmin - 1, hist->ymax);
-  del_vals (hist, src, width, bpp, xmin, hist->ymin, xmax, ymin - 1);
-  del_vals (hist, src, width, bpp, xmin, ymax + 1, xmax, hist->ymax);
+  del_vals (hist, params, src, width,
+            hist->xmin, hist->ymin, xmin - 1, hist->ymax);
+  del_vals (hist, params, src, width, xmin, hist->ymin, xmax, ymin - 1);
+  del_vals (hist, params, src, width, xmin, ymax + 1, xmax, hist->ymax);
 
-  add_vals (hist, src, width, bpp, hist->xmax + 1, ymin, xmax, ymax);
-  add_vals (hist, src, width, bpp, xmin, ymin, hist->xmax, hist->ymin - 1);
-  add_vals (hist,
-            src, width, bpp, hist->xmin, hist->ymax + 1, hist->xmax, ymax);
+  add_vals (hist, params, src, width, hist->xmax + 1, ymin, xmax, ymax);
+  add_vals (hist, params, src, width, xmin, ymin, hist->xmax, hist->ymin - 1);
+  add_vals (hist, params, src, width,
+            hist->xmin, hist->ymax + 1, hist->xmax, ymax);
 
   hist->xmin = xmin;
   hist->ymin = ymin;
@@ -844,83 +985,94 @@ update_histogram (DespeckleHistogram *hist,
   hist->ymax = ymax;
 }
 
+/*
+ * 'despeckle_adaptive()' - The adaptive and the recursive filters, with
+ * a sliding histogram of the window.
+ *
+ * Coordinates are in the area's source, whose pixels outside the image
+ * are never looked at.
+ */
 
 static void
-despeckle_median (guchar   *src,
-                  guchar   *dst,
-                  gint      width,
-                  gint      height,
-                  gint      bpp,
-                  gint      radius,
-                  gboolean  preview)
-{
-  guint  progress;
-  guint  max_progress;
-  gint   x, y;
-  gint   adapt_radius;
-  gint   pos;
-  gint   ymin;
-  gint   ymax;
-  gint   xmin;
-  gint   xmax;
-
-  memset (&histogram, 0, sizeof(histogram));
-  progress     = 0;
-  max_progress = width * height;
-
-  if (! preview)
-    gimp_progress_init(_("Despeckle"));
+despeckle_adaptive (const GimpParallelArea *area,
+                    gpointer                data)
+{
+  const DespeckleParams *params = data;
+  const gint             radius = params->radius;
+  const gint             bpp    = params->bpp;
+  const gint             width  = area->src_roi.width;
+  const gint             bx1    = MAX (0, params->bounds.x - area->src_roi.x);
+  const gint             by1    = MAX (0, params->bounds.y - area->src_roi.y);
+  const gint             bx2    = MIN (width,
+                                       params->bounds.x + params->bounds.width -
+                                       area->src_roi.x) - 1;
+  const gint             by2    = MIN (area->src_roi.height,
+                                       params->bounds.y + params->bounds.height -
+                                       area->src_roi.y) - 1;
+  const gint             ox     = area->roi.x - area->src_roi.x;
+  const gint             oy     = area->roi.y - area->src_roi.y;
+  DespeckleHistogram    *hist;
+  guchar                *src;
+  gint                   x, y;
+  gint                   adapt_radius;
+  gint                   ymin;
+  gint                   ymax;
+  gint                   xmin;
+  gint                   xmax;
+
+  /*  the recursive filter writes back into its source  */
+  src = g_memdup (area->src, area->src_rowstride * area->src_roi.height);
+
+  hist = g_new0 (DespeckleHistogram, 1);
+  hist->rand = g_rand_new_with_seed (area->roi.x ^ (area->roi.y << 16));
 
   adapt_radius = radius;
-  for (y = 0; y < height; y++)
+  for (y = oy; y < oy + area->roi.height; y++)
     {
-      x = 0;
-      ymin = MAX (0, y - adapt_radius);
-      ymax = MIN (height - 1, y + adapt_radius);
-      xmin = MAX (0, x - adapt_radius);
-      xmax = MIN (width - 1, x + adapt_radius);
-      hist0   = 0;
-      histrest = 0;
-      hist255 = 0;
-      histogram_clean (&histogram);
-      histogram.xmin = xmin;
-      histogram.ymin = ymin;
-      histogram.xmax = xmax;
-      histogram.ymax = ymax;
-      add_vals (&histogram,
-                src, width, bpp,
-                histogram.xmin, histogram.ymin, histogram.xmax, histogram.ymax);
-
-      for (x = 0; x < width; x++)
+      guchar *dst = area->dest + (y - oy) * area->dest_rowstride;
+
+      x = ox;
+      ymin = MAX (by1, y - adapt_radius);
+      ymax = MIN (by2, y + adapt_radius);
+      xmin = MAX (bx1, x - adapt_radius);
+      xmax = MIN (bx2, x + adapt_radius);
+      histogram_clean (hist);
+      hist->xmin = xmin;
+      hist->ymin = ymin;
+      hist->xmax = xmax;
+      hist->ymax = ymax;
+      add_vals (hist, params, src, width,
+                hist->xmin, hist->ymin, hist->xmax, hist->ymax);
+
+      for (x = ox; x < ox + area->roi.width; x++)
         {
           const guchar *pixel;
+          const gint    pos = (x + (y * width)) * bpp;
 
-          ymin = MAX (0, y - adapt_radius); /* update ymin, ymax when adapt_radius changed (FILTER_ADAPTIVE) */
-          ymax = MIN (height - 1, y + adapt_radius);
-          xmin = MAX (0, x - adapt_radius);
-          xmax = MIN (width - 1, x + adapt_radius);
+          ymin = MAX (by1, y - adapt_radius); /* update ymin, ymax when adapt_radius changed (FILTER_ADAPTIVE) */
+          ymax = MIN (by2, y + adapt_radius);
+          xmin = MAX (bx1, x - adapt_radius);
+          xmax = MIN (bx2, x + adapt_radius);
 
-          update_histogram (&histogram,
-                            src, width, bpp, xmin, ymin, xmax, ymax);
+          update_histogram (hist, params, src, width, xmin, ymin, xmax, ymax);
 
-          pos = (x + (y * width)) * bpp;
-          pixel = histogram_get_median (&histogram, src + pos);
+          pixel = histogram_get_median (hist, src + pos);
 
-          if (filter_type & FILTER_RECURSIVE)
+          if (params->type & FILTER_RECURSIVE)
             {
-              del_val (&histogram, src, width, bpp, x, y);
+              del_val (hist, params, src, width, x, y);
               pixel_copy (src + pos, pixel, bpp);
-              add_val (&histogram, src, width, bpp, x, y);
+              add_val (hist, params, src, width, x, y);
             }
 
-          pixel_copy (dst + pos, pixel, bpp);
+          pixel_copy (dst + (x - ox) * bpp, pixel, bpp);
 
           /*
            * Check the histogram and adjust the diameter accordingly...
            */
-          if (filter_type & FILTER_ADAPTIVE)
+          if (params->type & FILTER_ADAPTIVE)
             {
-              if (hist0 >= adapt_radius || hist255 >= adapt_radius)
+              if (hist->hist0 >= adapt_radius || hist->hist255 >= adapt_radius)
                 {
                   if (adapt_radius < radius)
                     adapt_radius++;
@@ -931,13 +1083,269 @@ despeckle_median (guchar   *src,
                 }
             }
         }
+    }
+
+  g_rand_free (hist->rand);
+  g_free (hist);
+  g_free (src);
+}
+
+/*  Adds (sign = 1) or removes (sign = -1) the pixel at (x, y) of the
+ *  area's source to the histogram of its column
+ */
+static inline void
+column_update (DespeckleColumn       *column,
+               guint32               *sums,
+               const DespeckleParams *params,
+               const guchar          *src,
+               gint                   width,
+               gint                   x,
+               gint                   y,
+               gint                   sign)
+{
+  const guchar *p     = src + (x + y * width) * params->bpp;
+  const gint    value = pixel_luminance (p, params);
+  gint          c;
+
+  column->coarse[value / FINE_PER_COARSE] += sign;
+  column->fine[value]              += sign;
+  column->n                        += sign;
+
+  if (value <= params->black_level)
+    column->lo += sign;
+
+  if (value >= params->white_level)
+    column->hi += sign;
+
+  sums += value * params->n_components;
+
+  if (params->u16)
+    {
+      const guint16 *q = (const guint16 *) p;
+
+      for (c = 0; c < params->n_components; c++)
+        sums[c] += sign * q[c];
+    }
+  else
+    {
+      for (c = 0; c < params->n_components; c++)
+        sums[c] += sign * p[c];
+    }
+}
+
+/*  Adds (sign = 1) or removes (sign = -1) the fine buckets of coarse
+ *  bucket c of a column to the window's
+ */
+static inline void
+column_add_fine (gint                  *fine,
+                 guint32               *fine_sums,
+                 const DespeckleColumn *column,
+                 const guint32         *sums,
+                 gint                   n_components,
+                 gint                   c,
+                 gint                   sign)
+{
+  const gint first = c * FINE_PER_COARSE;
+  gint       i;
+
+  for (i = first; i < first + FINE_PER_COARSE; i++)
+    fine[i] += sign * column->fine[i];
+
+  sums      += first * n_components;
+  fine_sums += first * n_components;
+
+  for (i = 0; i < FINE_PER_COARSE * n_components; i++)
+    fine_sums[i] += sign * sums[i];
+}
+
+/*
+ * 'despeckle_median()' - The plain median filter in constant time per
+ * pixel, after Perreault and Hebert: each column of the window keeps a
+ * histogram of its pixels, which moves down one row per image row, and
+ * the window's histogram moves right by adding one column and
+ * removing another.  Histograms have coarse and fine buckets, and the
+ * fine buckets of the window are only brought up to date for the
+ * coarse bucket the median is found in.
+ *
+ * As the old sliding histogram picked one of the pixels of the median
+ * luma bucket, the result is the mean of those pixels, which have
+ * the same luma and usually the same color.
+ */
+
+static void
+despeckle_median (const GimpParallelArea *area,
+                  gpointer                data)
+{
+  const DespeckleParams *params = data;
+  const gint             radius = params->radius;
+  const gint             bpp    = params->bpp;
+  const gint             nc     = params->n_components;
+  const gint             width  = area->src_roi.width;
+  const gint             bx1    = MAX (0, params->bounds.x - area->src_roi.x);
+  const gint             by1    = MAX (0, params->bounds.y - area->src_roi.y);
+  const gint             bx2    = MIN (width,
+                                       params->bounds.x + params->bounds.width -
+                                       area->src_roi.x) - 1;
+  const gint             by2    = MIN (area->src_roi.height,
+                                       params->bounds.y + params->bounds.height -
+                                       area->src_roi.y) - 1;
+  const gint             ox     = area->roi.x - area->src_roi.x;
+  const gint             oy     = area->roi.y - area->src_roi.y;
+  DespeckleColumn       *columns;
+  guint32               *column_sums;
+  gint                   coarse[N_COARSE];
+  gint                   fine[N_FINE];
+  guint32               *fine_sums;
+  gint                   last[N_COARSE];
+  gint                   x, y, i;
+
+  columns     = g_new0 (DespeckleColumn, width);
+  column_sums = g_new0 (guint32, width * N_FINE * nc);
+  fine_sums   = g_new (guint32, N_FINE * nc);
+
+  for (y = oy; y < oy + area->roi.height; y++)
+    {
+      guchar *dst = area->dest + (y - oy) * area->dest_rowstride;
+      gint    n, lo, hi;
+
+      /*  move the column histograms down to this row  */
+      for (x = bx1; x <= bx2; x++)
+        {
+          DespeckleColumn *column = &columns[x];
+          guint32         *sums   = column_sums + x * N_FINE * nc;
+          gint             row;
+
+          if (y == oy)
+            {
+              for (row = MAX (by1, y - radius); row <= MIN (by2, y + radius); row++)
+                column_update (column, sums, params, area->src, width, x, row, 1);
+            }
+          else
+            {
+              if (y - radius - 1 >= by1)
+                column_update (column, sums, params,
+                               area->src, width, x, y - radius - 1, -1);
+
+              if (y + radius <= by2)
+                column_update (column, sums, params,
+                               area->src, width, x, y + radius, 1);
+            }
+        }
 
-      progress += width;
+      /*  set up the window at the row's first pixel, the columns of
+       *  the area's source outside the image stay empty
+       */
+      memset (coarse, 0, sizeof (coarse));
+      n = lo = hi = 0;
 
-      if (! preview && y % 32 == 0)
-        gimp_progress_update ((gdouble) progress / (gdouble) max_progress);
+      for (x = ox - radius; x <= ox + radius; x++)
+        {
+          for (i = 0; i < N_COARSE; i++)
+            coarse[i] += columns[x].coarse[i];
+
+          n  += columns[x].n;
+          lo += columns[x].lo;
+          hi += columns[x].hi;
+        }
+
+      /*  too far away to be brought up to date  */
+      for (i = 0; i < N_COARSE; i++)
+        last[i] = ox - 2 * radius - 2;
+
+      for (x = ox; x < ox + area->roi.width; x++)
+        {
+          const guchar *pixel = area->src + (x + y * width) * bpp;
+          guchar       *d     = dst + (x - ox) * bpp;
+          gint          mid;
+          gint          rank;
+          gint          acc;
+          gint          c, f;
+
+          if (x > ox)
+            {
+              const DespeckleColumn *add = &columns[x + radius];
+              const DespeckleColumn *del = &columns[x - radius - 1];
+
+              for (i = 0; i < N_COARSE; i++)
+                coarse[i] += add->coarse[i] - del->coarse[i];
+
+              n  += add->n  - del->n;
+              lo += add->lo - del->lo;
+              hi += add->hi - del->hi;
+            }
+
+          /*  only pixels between the black and the white level count  */
+          mid = n - lo - hi;
+
+          if (mid <= 0)
+            {
+              pixel_copy (d, pixel, bpp);
+              continue;
+            }
+
+          rank = lo + (mid + 1) / 2;
+
+          for (c = 0, acc = 0; acc + coarse[c] < rank; c++)
+            acc += coarse[c];
+
+          /*  bring the fine buckets of coarse bucket c up to date, from
+           *  where they were last used or, if that is further away than
+           *  a window's width, from scratch
+           */
+          if (x - last[c] <= 2 * radius + 1)
+            {
+              gint p;
+
+              for (p = last[c] + 1; p <= x; p++)
+                {
+                  column_add_fine (fine, fine_sums,
+                                   &columns[p + radius],
+                                   column_sums + (p + radius) * N_FINE * nc,
+                                   nc, c, 1);
+                  column_add_fine (fine, fine_sums,
+                                   &columns[p - radius - 1],
+                                   column_sums + (p - radius - 1) * N_FINE * nc,
+                                   nc, c, -1);
+                }
+            }
+          else
+            {
+              gint p;
+
+              memset (fine + c * FINE_PER_COARSE, 0,
+                      FINE_PER_COARSE * sizeof (gint));
+              memset (fine_sums + c * FINE_PER_COARSE * nc, 0,
+                      FINE_PER_COARSE * nc * sizeof (guint32));
+
+              for (p = x - radius; p <= x + radius; p++)
+                column_add_fine (fine, fine_sums,
+                                 &columns[p],
+                                 column_sums + p * N_FINE * nc,
+                                 nc, c, 1);
+            }
+
+          last[c] = x;
+
+          for (f = c * FINE_PER_COARSE; acc + fine[f] < rank; f++)
+            acc += fine[f];
+
+          /*  the mean of the pixels in the median bucket  */
+          if (params->u16)
+            {
+              guint16 *q = (guint16 *) d;
+
+              for (i = 0; i < nc; i++)
+                q[i] = (fine_sums[f * nc + i] + fine[f] / 2) / fine[f];
+            }
+          else
+            {
+              for (i = 0; i < nc; i++)
+                d[i] = (fine_sums[f * nc + i] + fine[f] / 2) / fine[f];
+            }
+        }
     }
 
-  if (! preview)
-    gimp_progress_update (1.0);
+  g_free (fine_sums);
+  g_free (column_sums);
+  g_free (columns);
 }
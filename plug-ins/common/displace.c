@@ -79,6 +79,21 @@ typedef struct
   DisplaceMode mode;
 } DisplaceVals;
 
+typedef struct
+{
+  GimpParallelSource *src;
+  GimpParallelSource *map_x;
+  GimpParallelSource *map_y;
+  gdouble             cx;
+  gdouble             cy;
+} DisplaceParams;
+
+typedef struct
+{
+  gint32              drawable_id;
+  GimpParallelSource *source;
+} DisplaceSource;
+
 
 /*
  * Function prototypes.
@@ -93,6 +108,8 @@ static void      run    (const gchar      *name,
 
 static void      displace        (GimpDrawable *drawable,
                                   GimpPreview  *preview);
+static void      displace_area   (const GimpParallelArea *area,
+                                  gpointer                data);
 static gboolean  displace_dialog (GimpDrawable *drawable);
 
 static void      displace_radio_update   (GtkWidget     *widget,
@@ -104,9 +121,19 @@ static gint      displace_get_label_size (void);
 static gboolean  displace_map_constrain    (gint32     image_id,
                                             gint32     drawable_id,
                                             gpointer   data);
-static gdouble   displace_map_give_value   (guchar    *ptr,
-                                            gint       alpha,
-                                            gint       bytes);
+static gdouble   displace_map_give_value   (const GimpParallelSource *map,
+                                            gint                      x,
+                                            gint                      y);
+
+static const Babl         * displace_get_format    (gint32          drawable_id);
+static const Babl         * displace_get_u8_format (gint32          drawable_id);
+static GimpParallelSource * displace_source_new    (gint32          drawable_id,
+                                                    const Babl     *format,
+                                                    gboolean        preview);
+static GimpParallelSource * displace_source_get    (DisplaceSource *cache,
+                                                    gint32          drawable_id,
+                                                    const Babl     *format);
+static void                 displace_source_clear  (DisplaceSource *cache);
 
 /***** Local vars *****/
 
@@ -137,6 +164,10 @@ static GtkWidget   *preview        = NULL;
 static GtkWidget   *toggle_x       = NULL;
 static GtkWidget   *toggle_y       = NULL;
 
+static DisplaceSource preview_src   = { -1, NULL };
+static DisplaceSource preview_map_x = { -1, NULL };
+static DisplaceSource preview_map_y = { -1, NULL };
+
 static const gchar *mtext[][2] =
 {
   { N_("_X displacement"),   N_("_Pinch") },
@@ -215,6 +246,7 @@ run (const gchar      *name,
   run_mode = param[0].data.d_int32;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   /*  Get the specified drawable  */
   drawable = gimp_drawable_get (param[2].data.d_drawable);
@@ -503,299 +535,338 @@ displace_dialog (GimpDrawable *drawable)
 
   gtk_widget_destroy (dialog);
 
+  displace_source_clear (&preview_src);
+  displace_source_clear (&preview_map_x);
+  displace_source_clear (&preview_map_y);
+
   return run;
 }
 
-/* The displacement is done here. */
+/* The displacement is done here.
+ *
+ * The drawable and the maps are read into memory once, as floats, and
+ * the rows of the result are computed in parallel.  The preview keeps
+ * them around between updates.
+ */
 
 static void
 displace (GimpDrawable *drawable,
           GimpPreview  *preview)
 {
-  GimpDrawable     *map_x = NULL;
-  GimpDrawable     *map_y = NULL;
-  GimpPixelRgn      dest_rgn;
-  GimpPixelRgn      map_x_rgn;
-  GimpPixelRgn      map_y_rgn;
-  gpointer          pr;
-  GimpPixelFetcher *pft;
-
-  gint              width;
-  gint              height;
-  gint              bytes;
-  guchar           *destrow, *dest;
-  guchar           *mxrow, *mx;
-  guchar           *myrow, *my;
-  guchar            pixel[4][4];
-  gint              x1, y1;
-  gint              x, y;
-  gdouble           cx, cy;
-  gint              progress, max_progress;
-
-  gdouble           amnt;
-  gdouble           needx, needy;
-  gdouble           radius, d_alpha;
-  gint              xi, yi;
-
-  guchar            values[4];
-  guchar            val;
-
-  gint              k;
-
-  gdouble           xm_val, ym_val;
-  gint              xm_alpha = 0;
-  gint              ym_alpha = 0;
-  gint              xm_bytes = 1;
-  gint              ym_bytes = 1;
-  guchar           *buffer   = NULL;
-  gdouble           pi;
-
-  /* initialize */
-
-  /* get rid of uninitialized warnings */
-  cx = cy = needx = needy = radius = d_alpha = 0.0;
-
-  pi = 4 * atan (1);
-
-  mxrow = NULL;
-  myrow = NULL;
-
-  pft = gimp_pixel_fetcher_new (drawable, FALSE);
-  gimp_pixel_fetcher_set_edge_mode (pft, dvals.displace_type);
-
-  bytes  = drawable->bpp;
-
+  DisplaceParams  params;
+  const Babl     *format;
+  GeglBuffer     *dest_buffer;
+  GeglRectangle   roi;
+  guchar         *buffer = NULL;
 
   if (preview)
     {
-      gimp_preview_get_position (preview, &x1, &y1);
-      gimp_preview_get_size (preview, &width, &height);
-      buffer = g_new (guchar, width * height * bytes);
+      gimp_preview_get_position (preview, &roi.x, &roi.y);
+      gimp_preview_get_size (preview, &roi.width, &roi.height);
     }
-  else if (! gimp_drawable_mask_intersect (drawable->drawable_id, &x1, &y1,
-                                           &width, &height))
+  else if (! gimp_drawable_mask_intersect (drawable->drawable_id,
+                                           &roi.x, &roi.y,
+                                           &roi.width, &roi.height))
     {
       return;
     }
 
-  if (dvals.mode == POLAR_MODE)
-    {
-      cx = x1 + width / 2.0;
-      cy = y1 + height / 2.0;
-    }
+  format = displace_get_format (drawable->drawable_id);
 
-  progress     = 0;
-  max_progress = width * height;
+  params.cx = roi.x + roi.width  / 2.0;
+  params.cy = roi.y + roi.height / 2.0;
 
   /*
    * The algorithm used here is simple - see
    * http://the-tech.mit.edu/KPT/Tips/KPT7/KPT7.html for a description.
    */
 
-  /* Get the drawables  */
-  if (dvals.displace_map_x != -1 && dvals.do_x)
+  if (preview)
     {
-      map_x = gimp_drawable_get (dvals.displace_map_x);
-      gimp_pixel_rgn_init (&map_x_rgn, map_x,
-                           x1, y1, width, height, FALSE, FALSE);
+      params.src   = displace_source_get (&preview_src,
+                                          drawable->drawable_id, format);
+      params.map_x = NULL;
+      params.map_y = NULL;
+
+      if (dvals.do_x && dvals.displace_map_x != -1)
+        params.map_x = displace_source_get (&preview_map_x,
+                                            dvals.displace_map_x,
+                                            babl_format ("R'G'B'A float"));
+
+      if (dvals.do_y && dvals.displace_map_y != -1)
+        params.map_y = displace_source_get (&preview_map_y,
+                                            dvals.displace_map_y,
+                                            babl_format ("R'G'B'A float"));
+
+      buffer = g_new (guchar, roi.width * roi.height * drawable->bpp);
+
+      dest_buffer =
+        gegl_buffer_linear_new_from_data (buffer,
+                                          displace_get_u8_format (drawable->drawable_id),
+                                          &roi, GEGL_AUTO_ROWSTRIDE,
+                                          NULL, NULL);
+    }
+  else
+    {
+      params.src   = displace_source_new (drawable->drawable_id, format,
+                                          FALSE);
+      params.map_x = NULL;
+      params.map_y = NULL;
+
+      if (dvals.do_x && dvals.displace_map_x != -1)
+        params.map_x = displace_source_new (dvals.displace_map_x,
+                                            babl_format ("R'G'B'A float"),
+                                            FALSE);
+
+      if (dvals.do_y && dvals.displace_map_y != -1)
+        params.map_y = displace_source_new (dvals.displace_map_y,
+                                            babl_format ("R'G'B'A float"),
+                                            FALSE);
+
+      dest_buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
+    }
 
-      if (gimp_drawable_has_alpha (map_x->drawable_id))
-        xm_alpha = 1;
+  switch (dvals.displace_type)
+    {
+    case GIMP_PIXEL_FETCHER_EDGE_WRAP:
+      params.src->abyss_policy = GEGL_ABYSS_LOOP;
+      break;
+
+    case GIMP_PIXEL_FETCHER_EDGE_SMEAR:
+      params.src->abyss_policy = GEGL_ABYSS_CLAMP;
+      break;
 
-      xm_bytes = gimp_drawable_bpp (map_x->drawable_id);
+    default:
+      params.src->abyss_policy = GEGL_ABYSS_NONE;
+      break;
     }
 
-  if (dvals.displace_map_y != -1 && dvals.do_y)
+  gimp_parallel_process (NULL, NULL, dest_buffer, &roi, format,
+                         0, 0, GEGL_ABYSS_NONE, roi.width, 0,
+                         displace_area, &params,
+                         0.0, preview ? 0.0 : 1.0);
+
+  g_object_unref (dest_buffer);
+
+  if (preview)
     {
-      map_y = gimp_drawable_get (dvals.displace_map_y);
-      gimp_pixel_rgn_init (&map_y_rgn, map_y,
-                           x1, y1, width, height, FALSE, FALSE);
+      gimp_preview_draw_buffer (preview, buffer, roi.width * drawable->bpp);
+      g_free (buffer);
+    }
+  else
+    {
+      gimp_parallel_source_free (params.src);
 
-      if (gimp_drawable_has_alpha (map_y->drawable_id))
-        ym_alpha = 1;
+      if (params.map_x)
+        gimp_parallel_source_free (params.map_x);
+      if (params.map_y)
+        gimp_parallel_source_free (params.map_y);
 
-      ym_bytes = gimp_drawable_bpp (map_y->drawable_id);
+      /*  update the region  */
+      gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
+      gimp_drawable_update (drawable->drawable_id,
+                            roi.x, roi.y, roi.width, roi.height);
     }
+}
 
-  gimp_pixel_rgn_init (&dest_rgn, drawable,
-                       x1, y1, width, height,
-                       preview == NULL, preview == NULL);
-
-  /*  Register the pixel regions  */
-  if (dvals.do_x && dvals.do_y)
-    pr = gimp_pixel_rgns_register (3, &dest_rgn, &map_x_rgn, &map_y_rgn);
-  else if (dvals.do_x)
-    pr = gimp_pixel_rgns_register (2, &dest_rgn, &map_x_rgn);
-  else if (dvals.do_y)
-    pr = gimp_pixel_rgns_register (2, &dest_rgn, &map_y_rgn);
-  else
-    pr = NULL;
+static void
+displace_area (const GimpParallelArea *area,
+               gpointer                data)
+{
+  const DisplaceParams *params       = data;
+  gint                  n_components = params->src->n_components;
+  gdouble               cx           = params->cx;
+  gdouble               cy           = params->cy;
+  gint                  x, y;
 
-  for (pr = pr; pr != NULL; pr = gimp_pixel_rgns_process (pr))
+  for (y = area->roi.y; y < area->roi.y + area->roi.height; y++)
     {
-      destrow = dest_rgn.data;
-      if (dvals.do_x)
-        mxrow = map_x_rgn.data;
-      if (dvals.do_y)
-        myrow = map_y_rgn.data;
+      gfloat *dest = (gfloat *) (area->dest +
+                                 (y - area->roi.y) * area->dest_rowstride);
 
-      for (y = dest_rgn.y; y < (dest_rgn.y + dest_rgn.h); y++)
+      for (x = area->roi.x; x < area->roi.x + area->roi.width; x++)
         {
-          if (preview)
-            dest = buffer + ((y - y1) * width + (dest_rgn.x - x1)) * bytes;
+          gdouble needx   = 0.0;
+          gdouble needy   = 0.0;
+          gdouble radius  = 0.0;
+          gdouble d_alpha = 0.0;
+          gdouble amnt;
+          gdouble val;
+
+          if (params->map_x)
+            {
+              val  = displace_map_give_value (params->map_x, x, y);
+              amnt = dvals.amount_x * (val - 127.5) / 127.5;
+
+              /* CARTESIAN_MODE == 0 - performance important here */
+              if (! dvals.mode)
+                needx = x + amnt;
+              else
+                radius = sqrt (SQR (x - cx) + SQR (y - cy)) + amnt;
+            }
           else
-            dest = destrow;
-          mx = mxrow;
-          my = myrow;
-
-          /*
-           * We could move the displacement image address calculation
-           * out of here, but when we can have different sized
-           * displacement and destination images we'd have to move it
-           * back anyway.
-           */
-
-          for (x = dest_rgn.x; x < (dest_rgn.x + dest_rgn.w); x++)
             {
-              if (dvals.do_x)
-                {
-                  xm_val = displace_map_give_value(mx, xm_alpha, xm_bytes);
-                  amnt = dvals.amount_x * (xm_val - 127.5) / 127.5;
-                  /* CARTESIAN_MODE == 0 - performance important here */
-                  if (! dvals.mode)
-                    {
-                      needx = x + amnt;
-                    }
-                  else
-                    {
-                      radius = sqrt (SQR (x - cx) + SQR (y - cy)) + amnt;
-                    }
-                  mx += xm_bytes;
-                }
+              if (! dvals.mode)
+                needx = x;
               else
-                {
-                  if (! dvals.mode)
-                    needx = x;
-                  else
-                    radius = sqrt ((x - cx) * (x - cx) + (y - cy) * (y - cy));
-                }
-
-
-              if (dvals.do_y)
-                {
-                  ym_val = displace_map_give_value(my, ym_alpha, ym_bytes);
-                  amnt = dvals.amount_y * (ym_val - 127.5) / 127.5;
-                  if (! dvals.mode)
-                    {
-                      needy = y + amnt;
-                    }
-                  else
-                    {
-                      d_alpha = atan2 (x - cx, y - cy) + (dvals.amount_y / 180)
-                                * pi * (ym_val - 127.5) / 127.5;
-                    }
-                  my += ym_bytes;
-                }
+                radius = sqrt (SQR (x - cx) + SQR (y - cy));
+            }
+
+          if (params->map_y)
+            {
+              val  = displace_map_give_value (params->map_y, x, y);
+              amnt = dvals.amount_y * (val - 127.5) / 127.5;
+
+              if (! dvals.mode)
+                needy = y + amnt;
               else
-                {
-                  if (! dvals.mode)
-                    needy = y;
-                  else
-                    d_alpha = atan2 (x - cx, y - cy);
-                }
-              if (dvals.mode)
-                {
-                   needx = cx + radius * sin (d_alpha);
-                   needy = cy + radius * cos (d_alpha);
-                }
-              /* Calculations complete; now copy the proper pixel */
-
-              if (needx >= 0.0)
-                xi = (int) needx;
+                d_alpha = (atan2 (x - cx, y - cy) +
+                           (dvals.amount_y / 180) * G_PI * (val - 127.5) / 127.5);
+            }
+          else
+            {
+              if (! dvals.mode)
+                needy = y;
               else
-                xi = -((int) -needx + 1);
+                d_alpha = atan2 (x - cx, y - cy);
+            }
 
-              if (needy >= 0.0)
-                yi = (int) needy;
-              else
-                yi = -((int) -needy + 1);
-
-              gimp_pixel_fetcher_get_pixel (pft, xi, yi, pixel[0]);
-              gimp_pixel_fetcher_get_pixel (pft, xi + 1, yi, pixel[1]);
-              gimp_pixel_fetcher_get_pixel (pft, xi, yi + 1, pixel[2]);
-              gimp_pixel_fetcher_get_pixel (pft, xi + 1, yi + 1, pixel[3]);
-
-              for (k = 0; k < bytes; k++)
-                {
-                  values[0] = pixel[0][k];
-                  values[1] = pixel[1][k];
-                  values[2] = pixel[2][k];
-                  values[3] = pixel[3][k];
-                  val = gimp_bilinear_8 (needx, needy, values);
-
-                  *dest++ = val;
-                } /* for */
+          if (dvals.mode)
+            {
+              needx = cx + radius * sin (d_alpha);
+              needy = cy + radius * cos (d_alpha);
             }
 
-          destrow += dest_rgn.rowstride;
+          /* Calculations complete; now copy the proper pixel */
+          gimp_parallel_source_sample (params->src, needx, needy, dest);
 
-          if (dvals.do_x)
-            mxrow += map_x_rgn.rowstride;
-          if (dvals.do_y)
-            myrow += map_y_rgn.rowstride;
+          dest += n_components;
         }
+    }
+}
 
-      if (!preview)
-        {
-          progress += dest_rgn.w * dest_rgn.h;
-          gimp_progress_update ((double) progress / (double) max_progress);
-        }
-    } /* for */
+/*  The map values are the luminance of the gamma-corrected values on
+ *  a scale of 0 to 255, transparency pulls them towards the neutral
+ *  127.5
+ */
+static gdouble
+displace_map_give_value (const GimpParallelSource *map,
+                         gint                      x,
+                         gint                      y)
+{
+  gfloat  pixel[4];
+  gdouble ret;
+
+  gimp_parallel_source_get_pixel (map, x, y, pixel);
+
+  ret = GIMP_RGB_LUMINANCE (pixel[0], pixel[1], pixel[2]) * 255.0;
+
+  return (ret - 127.5) * pixel[3] + 127.5;
+}
+
+static const Babl *
+displace_get_format (gint32 drawable_id)
+{
+  gboolean has_alpha = gimp_drawable_has_alpha (drawable_id);
+
+  if (gimp_drawable_is_gray (drawable_id))
+    return babl_format (has_alpha ? "Y'A float" : "Y' float");
+  else
+    return babl_format (has_alpha ? "R'G'B'A float" : "R'G'B' float");
+}
 
-  gimp_pixel_fetcher_destroy (pft);
+/*  the format of the drawable's pixel regions, before the plug-in
+ *  switches to the drawable's precision
+ */
+static const Babl *
+displace_get_u8_format (gint32 drawable_id)
+{
+  gboolean has_alpha = gimp_drawable_has_alpha (drawable_id);
 
-  /*  detach from the map drawables  */
-  if (dvals.do_x)
-    gimp_drawable_detach (map_x);
-  if (dvals.do_y)
-    gimp_drawable_detach (map_y);
+  if (gimp_drawable_is_indexed (drawable_id))
+    return gimp_drawable_get_format (drawable_id);
+  else if (gimp_drawable_is_gray (drawable_id))
+    return babl_format (has_alpha ? "Y'A u8" : "Y' u8");
+  else
+    return babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8");
+}
+
+static GimpParallelSource *
+displace_source_new (gint32      drawable_id,
+                     const Babl *format,
+                     gboolean    preview)
+{
+  GimpParallelSource *source;
+  GeglBuffer         *buffer;
 
   if (preview)
     {
-/*      gimp_drawable_preview_draw_region (GIMP_DRAWABLE_PREVIEW (preview),
-                                         &dest_rgn);*/
-      gimp_preview_draw_buffer (preview, buffer, width * bytes);
-      g_free (buffer);
+      /* the preview reads the drawable through a pixel region, asking
+       * for its buffer would switch the plug-in to the drawable's
+       * precision
+       */
+      GimpDrawable *drawable = gimp_drawable_get (drawable_id);
+      GimpPixelRgn  region;
+      guchar       *data;
+
+      data = g_new (guchar, drawable->width * drawable->height * drawable->bpp);
+
+      gimp_pixel_rgn_init (&region, drawable,
+                           0, 0, drawable->width, drawable->height,
+                           FALSE, FALSE);
+      gimp_pixel_rgn_get_rect (&region, data,
+                               0, 0, drawable->width, drawable->height);
+
+      buffer = gegl_buffer_linear_new_from_data (data,
+                                                 displace_get_u8_format (drawable_id),
+                                                 GEGL_RECTANGLE (0, 0,
+                                                                 drawable->width,
+                                                                 drawable->height),
+                                                 GEGL_AUTO_ROWSTRIDE,
+                                                 (GDestroyNotify) g_free, data);
+
+      gimp_drawable_detach (drawable);
     }
   else
     {
-      gimp_progress_update (1.0);
-      /*  update the region  */
-      gimp_drawable_flush (drawable);
-      gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
-      gimp_drawable_update (drawable->drawable_id, x1, y1, width, height);
+      buffer = gimp_drawable_get_buffer (drawable_id);
     }
+
+  source = gimp_parallel_source_new (buffer, NULL, format, GEGL_ABYSS_NONE);
+
+  g_object_unref (buffer);
+
+  return source;
 }
 
-static gdouble
-displace_map_give_value (guchar *pt,
-                         gint    alpha,
-                         gint    bytes)
+static GimpParallelSource *
+displace_source_get (DisplaceSource *cache,
+                     gint32          drawable_id,
+                     const Babl     *format)
 {
-  gdouble ret, val_alpha;
-
-  if (bytes >= 3)
-    ret =  GIMP_RGB_LUMINANCE (pt[0], pt[1], pt[2]);
-  else
-    ret = (gdouble) *pt;
+  if (cache->source && cache->drawable_id != drawable_id)
+    {
+      gimp_parallel_source_free (cache->source);
+      cache->source = NULL;
+    }
 
-  if (alpha)
+  if (! cache->source)
     {
-      val_alpha = pt[bytes - 1];
-      ret = ((ret - 127.5) * val_alpha / 255.0) + 127.5;
+      cache->source      = displace_source_new (drawable_id, format, TRUE);
+      cache->drawable_id = drawable_id;
     }
 
-  return ret;
+  return cache->source;
+}
+
+static void
+displace_source_clear (DisplaceSource *cache)
+{
+  if (cache->source)
+    {
+      gimp_parallel_source_free (cache->source);
+      cache->source = NULL;
+    }
 }
 
 /*  Displace interface functions  */
@@ -64,6 +64,31 @@ typedef struct
   gint *pages;
 } PdfSelectedPages;
 
+/* load_image() renders the selected pages on worker threads, each
+ * with a document of its own, since a PopplerDocument must not be
+ * used from several threads at once.  The layers are still created
+ * on the main thread, in page order, because only it may talk to the
+ * core.
+ */
+typedef struct
+{
+  const gchar       *filename;
+  PdfSelectedPages  *pages;
+  gdouble            scale;
+  gboolean           antialias;
+
+  cairo_surface_t  **surfaces;
+  gboolean          *rendered;
+
+  gint               next_page;   /* the next page a worker takes     */
+  gint               n_inserted;  /* pages the main thread is done with */
+  gint               max_ahead;   /* how far workers may render ahead */
+  gint               n_workers;
+
+  GMutex             mutex;
+  GCond              cond;
+} RenderContext;
+
 /* Declare local functions */
 static void              query             (void);
 static void              run               (const gchar            *name,
@@ -81,6 +106,7 @@ static gint32            load_image        (PopplerDocument        *doc,
                                             PdfSelectedPages       *pages);
 
 static GimpPDBStatusType load_dialog       (PopplerDocument        *doc,
+                                            const gchar            *filename,
                                             PdfSelectedPages       *pages);
 
 static PopplerDocument * open_document     (const gchar            *filename,
@@ -370,7 +396,7 @@ run (const gchar      *name,
               break;
             }
 
-          status = load_dialog (doc, &pages);
+          status = load_dialog (doc, param[1].data.d_string, &pages);
           if (status == GIMP_PDB_SUCCESS)
             gimp_set_data (LOAD_PROC, &loadvals, sizeof(loadvals));
           break;
@@ -812,6 +838,138 @@ render_page_to_surface (PopplerPage *page,
   return surface;
 }
 
+static cairo_surface_t *
+render_page (PopplerDocument *doc,
+             gint             page_num,
+             gdouble          scale,
+             gboolean         antialias)
+{
+  PopplerPage     *page;
+  cairo_surface_t *surface;
+  gdouble          page_width;
+  gdouble          page_height;
+
+  page = poppler_document_get_page (doc, page_num);
+
+  poppler_page_get_size (page, &page_width, &page_height);
+
+  surface = render_page_to_surface (page,
+                                    page_width  * scale,
+                                    page_height * scale,
+                                    scale, antialias);
+
+  g_object_unref (page);
+
+  return surface;
+}
+
+static gpointer
+render_thread (gpointer data)
+{
+  RenderContext   *context     = data;
+  GMappedFile     *mapped_file;
+  PopplerDocument *doc         = NULL;
+
+  /*  not open_document(), its error reporting isn't thread-safe; a
+   *  worker which can't open the file just leaves its pages to the
+   *  others, or to the main thread
+   */
+  mapped_file = g_mapped_file_new (context->filename, FALSE, NULL);
+
+  if (mapped_file)
+    doc = poppler_document_new_from_data (g_mapped_file_get_contents (mapped_file),
+                                          g_mapped_file_get_length (mapped_file),
+                                          NULL, NULL);
+
+  g_mutex_lock (&context->mutex);
+
+  while (doc)
+    {
+      cairo_surface_t *surface;
+      gint             i;
+
+      while (context->next_page < context->pages->n_pages &&
+             context->next_page >= context->n_inserted + context->max_ahead)
+        g_cond_wait (&context->cond, &context->mutex);
+
+      if (context->next_page >= context->pages->n_pages)
+        break;
+
+      i = context->next_page++;
+
+      g_mutex_unlock (&context->mutex);
+
+      surface = render_page (doc, context->pages->pages[i],
+                             context->scale, context->antialias);
+
+      g_mutex_lock (&context->mutex);
+
+      context->surfaces[i] = surface;
+      context->rendered[i] = TRUE;
+
+      g_cond_broadcast (&context->cond);
+    }
+
+  context->n_workers--;
+  g_cond_broadcast (&context->cond);
+
+  g_mutex_unlock (&context->mutex);
+
+  if (doc)
+    g_object_unref (doc);
+
+  if (mapped_file)
+    g_mapped_file_unref (mapped_file);
+
+  return NULL;
+}
+
+/* Returns the surface of the i-th selected page, rendered by a worker
+ * or, if there are none left, right here with @doc.
+ */
+static cairo_surface_t *
+render_context_get_page (RenderContext   *context,
+                         PopplerDocument *doc,
+                         gint             i)
+{
+  cairo_surface_t *surface;
+
+  g_mutex_lock (&context->mutex);
+
+  while (! context->rendered[i] && context->n_workers > 0)
+    g_cond_wait (&context->cond, &context->mutex);
+
+  if (context->rendered[i])
+    {
+      surface = context->surfaces[i];
+      context->surfaces[i] = NULL;
+
+      g_mutex_unlock (&context->mutex);
+    }
+  else
+    {
+      context->next_page = MAX (context->next_page, i + 1);
+
+      g_mutex_unlock (&context->mutex);
+
+      surface = render_page (doc, context->pages->pages[i],
+                             context->scale, context->antialias);
+    }
+
+  return surface;
+}
+
+static void
+render_context_page_done (RenderContext *context)
+{
+  g_mutex_lock (&context->mutex);
+
+  context->n_inserted++;
+  g_cond_broadcast (&context->cond);
+
+  g_mutex_unlock (&context->mutex);
+}
+
 #if 0
 
 /* This is currently unused, but we'll have it here in case the military
@@ -846,11 +1004,14 @@ load_image (PopplerDocument        *doc,
             gboolean                antialias,
             PdfSelectedPages       *pages)
 {
-  gint32   image_ID = 0;
-  gint32  *images   = NULL;
-  gint     i;
-  gdouble  scale;
-  gdouble  doc_progress = 0;
+  RenderContext   context;
+  GThread       **threads;
+  gint            n_threads;
+  gint32          image_ID = 0;
+  gint32         *images   = NULL;
+  gint            i;
+  gdouble         scale;
+  gdouble         doc_progress = 0;
 
   if (target == GIMP_PAGE_SELECTOR_TARGET_IMAGES)
     images = g_new0 (gint32, pages->n_pages);
@@ -860,6 +1021,33 @@ load_image (PopplerDocument        *doc,
 
   scale = resolution / gimp_unit_get_factor (GIMP_UNIT_POINT);
 
+  /* render the pages in the background */
+
+  n_threads = MIN (g_get_num_processors (), pages->n_pages);
+
+  /* a single page is rendered right here, with the document we have */
+  if (n_threads < 2)
+    n_threads = 0;
+
+  context.filename   = filename;
+  context.pages      = pages;
+  context.scale      = scale;
+  context.antialias  = antialias;
+  context.surfaces   = g_new0 (cairo_surface_t *, pages->n_pages);
+  context.rendered   = g_new0 (gboolean, pages->n_pages);
+  context.next_page  = 0;
+  context.n_inserted = 0;
+  context.max_ahead  = 2 * n_threads;
+  context.n_workers  = n_threads;
+
+  g_mutex_init (&context.mutex);
+  g_cond_init (&context.cond);
+
+  threads = g_new (GThread *, MAX (n_threads, 1));
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("pdf-render", render_thread, &context);
+
   /* read the file */
 
   for (i = 0; i < pages->n_pages; i++)
@@ -881,6 +1069,8 @@ load_image (PopplerDocument        *doc,
 
       g_object_get (G_OBJECT (page), "label", &page_label, NULL);
 
+      g_object_unref (page);
+
       if (! image_ID)
         {
           gchar *name;
@@ -899,7 +1089,7 @@ load_image (PopplerDocument        *doc,
           gimp_image_set_resolution (image_ID, resolution, resolution);
         }
 
-      surface = render_page_to_surface (page, width, height, scale, antialias);
+      surface = render_context_get_page (&context, doc, i);
 
       layer_from_surface (image_ID, page_label, i, surface,
                           doc_progress, 1.0 / pages->n_pages);
@@ -907,6 +1097,8 @@ load_image (PopplerDocument        *doc,
       g_free (page_label);
       cairo_surface_destroy (surface);
 
+      render_context_page_done (&context);
+
       doc_progress = (double) (i + 1) / pages->n_pages;
       gimp_progress_update (doc_progress);
 
@@ -922,6 +1114,16 @@ load_image (PopplerDocument        *doc,
     }
   gimp_progress_update (1.0);
 
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_free (threads);
+  g_free (context.surfaces);
+  g_free (context.rendered);
+
+  g_cond_clear (&context.cond);
+  g_mutex_clear (&context.mutex);
+
   if (image_ID)
     {
       gimp_image_undo_enable (image_ID);
@@ -992,6 +1194,9 @@ get_thumb_pixbuf (PopplerDocument *doc,
   GdkPixbuf *pixbuf;
 
   surface = get_thumb_surface (doc, page_num, preferred_size);
+  if (! surface)
+    return NULL;
+
   pixbuf = gdk_pixbuf_get_from_surface (surface, 0, 0,
                                         cairo_image_surface_get_width (surface),
                                         cairo_image_surface_get_height (surface));
@@ -1003,7 +1208,11 @@ get_thumb_pixbuf (PopplerDocument *doc,
 typedef struct
 {
   PopplerDocument  *document;
+  const gchar      *filename;
   GimpPageSelector *selector;
+  gint              n_pages;
+  volatile gint     next_page;
+  volatile gint     document_taken;
   gboolean          stop_thumbnailing;
 } ThreadData;
 
@@ -1028,37 +1237,66 @@ idle_set_thumbnail (gpointer data)
   return FALSE;
 }
 
+/* Several of these run at once, one with the dialog's document and
+ * the others with documents of their own, and take the pages in
+ * order.
+ */
 static gpointer
 thumbnail_thread (gpointer data)
 {
-  ThreadData  *thread_data = data;
-  gint         n_pages;
-  gint         i;
+  ThreadData      *thread_data = data;
+  GMappedFile     *mapped_file = NULL;
+  PopplerDocument *doc         = thread_data->document;
 
-  n_pages = poppler_document_get_n_pages (thread_data->document);
+  if (! g_atomic_int_compare_and_exchange (&thread_data->document_taken,
+                                           FALSE, TRUE))
+    {
+      mapped_file = g_mapped_file_new (thread_data->filename, FALSE, NULL);
 
-  for (i = 0; i < n_pages; i++)
+      if (! mapped_file)
+        return NULL;
+
+      doc = poppler_document_new_from_data (g_mapped_file_get_contents (mapped_file),
+                                            g_mapped_file_get_length (mapped_file),
+                                            NULL, NULL);
+    }
+
+  while (doc && ! thread_data->stop_thumbnailing)
     {
-      IdleData *idle_data = g_new0 (IdleData, 1);
+      IdleData *idle_data;
+      gint      i;
+
+      i = g_atomic_int_add (&thread_data->next_page, 1);
+
+      if (i >= thread_data->n_pages)
+        break;
+
+      idle_data = g_new0 (IdleData, 1);
 
       idle_data->selector = thread_data->selector;
       idle_data->page_no  = i;
 
       /* FIXME get preferred size from somewhere? */
-      idle_data->pixbuf = get_thumb_pixbuf (thread_data->document, i,
-                                            THUMBNAIL_SIZE);
-
-      g_idle_add (idle_set_thumbnail, idle_data);
+      idle_data->pixbuf = get_thumb_pixbuf (doc, i, THUMBNAIL_SIZE);
 
-      if (thread_data->stop_thumbnailing)
-        break;
+      if (idle_data->pixbuf)
+        g_idle_add (idle_set_thumbnail, idle_data);
+      else
+        g_free (idle_data);
     }
 
+  if (doc && doc != thread_data->document)
+    g_object_unref (doc);
+
+  if (mapped_file)
+    g_mapped_file_unref (mapped_file);
+
   return NULL;
 }
 
 static GimpPDBStatusType
 load_dialog (PopplerDocument  *doc,
+             const gchar      *filename,
              PdfSelectedPages *pages)
 {
   GtkWidget  *dialog;
@@ -1069,8 +1307,9 @@ load_dialog (PopplerDocument  *doc,
   GtkWidget  *antialias;
   GtkWidget  *hbox;
 
-  ThreadData  thread_data;
-  GThread    *thread;
+  ThreadData   thread_data;
+  GThread    **threads;
+  gint         n_threads;
 
   gint        i;
   gint        n_pages;
@@ -1151,10 +1390,18 @@ load_dialog (PopplerDocument  *doc,
                             dialog);
 
   thread_data.document          = doc;
+  thread_data.filename          = filename;
   thread_data.selector          = GIMP_PAGE_SELECTOR (selector);
+  thread_data.n_pages           = n_pages;
+  thread_data.next_page         = 0;
+  thread_data.document_taken    = FALSE;
   thread_data.stop_thumbnailing = FALSE;
 
-  thread = g_thread_new ("thumbnailer", thumbnail_thread, &thread_data);
+  n_threads = CLAMP (g_get_num_processors (), 1, n_pages);
+  threads   = g_new (GThread *, n_threads);
+
+  for (i = 0; i < n_threads; i++)
+    threads[i] = g_thread_new ("thumbnailer", thumbnail_thread, &thread_data);
 
   /* Resolution */
 
@@ -1209,7 +1456,11 @@ load_dialog (PopplerDocument  *doc,
 
   /* cleanup */
   thread_data.stop_thumbnailing = TRUE;
-  g_thread_join (thread);
+
+  for (i = 0; i < n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_free (threads);
 
   return run ? GIMP_PDB_SUCCESS : GIMP_PDB_CANCEL;
 }
@@ -75,6 +75,16 @@
 #define PLUG_IN_BINARY "file-tiff-load"
 #define PLUG_IN_ROLE   "gimp-file-tiff-load"
 
+/*  Decoded rows are handed to GEGL in bands of at least this many
+ *  rows, so the plug-in writes whole tiles instead of slivers.
+ */
+#define LOAD_BAND_MIN_ROWS  256
+
+/*  Strips bigger than this are not decoded in one piece; files made
+ *  of such strips are read scanline by scanline instead.
+ */
+#define LOAD_MAX_CHUNK_SIZE (64 * 1024 * 1024)
+
 
 typedef struct
 {
@@ -99,6 +109,37 @@ typedef struct
   gint *pages;
 } TiffSelectedPages;
 
+typedef struct
+{
+  const gchar  *filename;
+  gint          page;
+
+  gboolean      tiled;
+  gint          n_planes;
+  gint          plane_bpp;
+  uint32        width;
+  uint32        length;
+  uint32        chunk_width;
+  uint32        chunk_length;
+  tsize_t       chunk_size;
+
+  /*  the band of rows currently being decoded, one buffer per plane  */
+  uint32        band_y;
+  uint32        band_rows;
+  guchar      **planes;
+  gint          chunks_across;
+  gint          chunks_down;
+
+  GMutex        mutex;
+  GCond         work_cond;
+  GCond         done_cond;
+  gint          next_chunk;
+  gint          n_chunks;
+  gint          n_done;
+  gboolean      failed;
+  gboolean      quit;
+} TiffLoader;
+
 /* Declare some local functions.
  */
 static void   query     (void);
@@ -128,6 +169,14 @@ static void      load_separate    (TIFF         *tif,
                                    gushort       bps,
                                    gushort       spp,
                                    gint          extra);
+static gboolean  load_chunked     (const gchar  *filename,
+                                   gint          page,
+                                   TIFF         *tif,
+                                   channel_data *channel,
+                                   gushort       bps,
+                                   gushort       spp,
+                                   gint          extra,
+                                   gboolean      separate);
 static void      load_paths       (TIFF         *tif,
                                    gint          image);
 
@@ -160,6 +209,9 @@ static TiffSaveVals tsvals =
 static GimpRunMode             run_mode      = GIMP_RUN_INTERACTIVE;
 static GimpPageSelectorTarget  target        = GIMP_PAGE_SELECTOR_TARGET_LAYERS;
 
+/*  set in the decoding threads, which must not talk to the core  */
+static GPrivate                worker_thread = G_PRIVATE_INIT (NULL);
+
 
 MAIN ()
 
@@ -324,6 +376,9 @@ tiff_warning (const gchar *module,
 {
   int tag = 0;
 
+  if (g_private_get (&worker_thread))
+    return;
+
   if (! strcmp (fmt, "%s: unknown field with tag %d (0x%x) encountered"))
     {
       va_list ap_test;
@@ -368,6 +423,10 @@ tiff_error (const gchar *module,
             const gchar *fmt,
             va_list      ap)
 {
+  /* Errors in the decoding threads are reported by the main thread */
+  if (g_private_get (&worker_thread))
+    return;
+
   /* Workaround for: http://bugzilla.gnome.org/show_bug.cgi?id=132297 */
   /* Ignore the errors related to random access and JPEG compression */
   if (! strcmp (fmt, "Compression algorithm does not support random access"))
@@ -1061,6 +1120,12 @@ load_image (const gchar        *filename,
         {
           load_rgba (tif, channel);
         }
+      else if (load_chunked (filename, pages->pages[li], tif, channel,
+                             bps, spp, extra,
+                             planar == PLANARCONFIG_SEPARATE))
+        {
+          /* done */
+        }
       else if (planar == PLANARCONFIG_CONTIG)
         {
           load_contiguous (tif, channel, bps, spp, extra);
@@ -1672,6 +1737,359 @@ load_separate (TIFF         *tif,
   g_free (buffer);
 }
 
+/*  Decodes chunk @index of the current band with @tif into @chunk and
+ *  copies its pixels into the band's plane buffer.
+ */
+static gboolean
+load_chunk (TiffLoader *loader,
+            TIFF       *tif,
+            gint        index,
+            guchar     *chunk)
+{
+  gint     per_plane    = loader->chunks_across * loader->chunks_down;
+  gint     plane        = index / per_plane;
+  gint     cy           = (index % per_plane) / loader->chunks_across;
+  gint     cx           = index % loader->chunks_across;
+  uint32   x            = cx * loader->chunk_width;
+  uint32   y            = loader->band_y + cy * loader->chunk_length;
+  uint32   cols         = MIN (loader->chunk_width,  loader->width  - x);
+  uint32   rows         = MIN (loader->chunk_length, loader->length - y);
+  gsize    chunk_stride = loader->chunk_width * loader->plane_bpp;
+  gsize    band_stride  = loader->width * loader->plane_bpp;
+  guchar  *dest;
+  tsize_t  size;
+  uint32   row;
+
+  if (loader->tiled)
+    size = TIFFReadEncodedTile (tif, TIFFComputeTile (tif, x, y, 0, plane),
+                                chunk, loader->chunk_size);
+  else
+    size = TIFFReadEncodedStrip (tif, TIFFComputeStrip (tif, y, plane),
+                                 chunk, loader->chunk_size);
+
+  if (size < 0)
+    return FALSE;
+
+  /*  keep going with black on truncated data, like the scanline code  */
+  if (size < loader->chunk_size)
+    memset (chunk + size, 0, loader->chunk_size - size);
+
+  dest = (loader->planes[plane] +
+          (y - loader->band_y) * band_stride + x * loader->plane_bpp);
+
+  for (row = 0; row < rows; row++)
+    memcpy (dest + row * band_stride,
+            chunk + row * chunk_stride,
+            cols * loader->plane_bpp);
+
+  return TRUE;
+}
+
+/*  Claims and decodes chunks of the current band until none are left.
+ *  Called with the loader's mutex held.
+ */
+static void
+load_chunks_claim (TiffLoader *loader,
+                   TIFF       *tif,
+                   guchar     *chunk)
+{
+  while (loader->next_chunk < loader->n_chunks)
+    {
+      gint     index = loader->next_chunk++;
+      gboolean success;
+
+      g_mutex_unlock (&loader->mutex);
+
+      success = load_chunk (loader, tif, index, chunk);
+
+      g_mutex_lock (&loader->mutex);
+
+      if (! success)
+        loader->failed = TRUE;
+
+      if (++loader->n_done == loader->n_chunks)
+        g_cond_signal (&loader->done_cond);
+    }
+}
+
+/*  Every thread reads through its own TIFF handle, libtiff handles
+ *  can't be shared.
+ */
+static gpointer
+load_chunks_thread (gpointer data)
+{
+  TiffLoader *loader = data;
+  TIFF       *tif;
+  guchar     *chunk;
+
+  g_private_set (&worker_thread, GINT_TO_POINTER (TRUE));
+
+  tif = tiff_open (loader->filename, "r", NULL);
+
+  if (tif && ! TIFFSetDirectory (tif, loader->page))
+    {
+      TIFFClose (tif);
+      tif = NULL;
+    }
+
+  chunk = g_malloc (loader->chunk_size);
+
+  g_mutex_lock (&loader->mutex);
+
+  while (! loader->quit)
+    {
+      /*  a thread that failed to open the file just sits this out  */
+      if (tif)
+        load_chunks_claim (loader, tif, chunk);
+
+      if (! loader->quit)
+        g_cond_wait (&loader->work_cond, &loader->mutex);
+    }
+
+  g_mutex_unlock (&loader->mutex);
+
+  g_free (chunk);
+
+  if (tif)
+    TIFFClose (tif);
+
+  return NULL;
+}
+
+/*  Hands the decoded band to GEGL, one gegl_buffer_set() per channel.  */
+static void
+load_band_to_channels (TiffLoader   *loader,
+                       channel_data *channel,
+                       gint          extra,
+                       guchar       *scratch)
+{
+  GeglRectangle *rect     = GEGL_RECTANGLE (0, loader->band_y,
+                                            loader->width, loader->band_rows);
+  gint           n_pixels = loader->width * loader->band_rows;
+  gint           offset   = 0;
+  gint           plane    = 0;
+  gint           i;
+
+  if (loader->n_planes == 1 && extra == 0)
+    {
+      gegl_buffer_set (channel[0].buffer, rect, 0, channel[0].format,
+                       loader->planes[0], GEGL_AUTO_ROWSTRIDE);
+      return;
+    }
+
+  for (i = 0; i <= extra; i++)
+    {
+      gint dest_bpp = babl_format_get_bytes_per_pixel (channel[i].format);
+      gint p;
+
+      if (loader->n_planes == 1)
+        {
+          const guchar *s = loader->planes[0] + offset;
+          guchar       *d = scratch;
+
+          for (p = 0; p < n_pixels; p++)
+            {
+              memcpy (d, s, dest_bpp);
+              d += dest_bpp;
+              s += loader->plane_bpp;
+            }
+
+          offset += dest_bpp;
+        }
+      else
+        {
+          gint n_comps = babl_format_get_n_components (channel[i].format);
+          gint j;
+
+          for (j = 0; j < n_comps; j++, plane++)
+            {
+              const guchar *s = loader->planes[plane];
+              guchar       *d = scratch + j * loader->plane_bpp;
+
+              for (p = 0; p < n_pixels; p++)
+                {
+                  memcpy (d, s, loader->plane_bpp);
+                  d += dest_bpp;
+                  s += loader->plane_bpp;
+                }
+            }
+        }
+
+      gegl_buffer_set (channel[i].buffer, rect, 0, channel[i].format,
+                       scratch, GEGL_AUTO_ROWSTRIDE);
+    }
+}
+
+/*  Loads 8 and 16 bit strips or tiles a band at a time.  The chunks of
+ *  a band are decoded in parallel, each thread through its own handle,
+ *  and only one band is kept in memory, so arbitrarily large files
+ *  stream into the core's tile manager.  Returns FALSE if the layout
+ *  has to go through load_contiguous() or load_separate() instead.
+ */
+static gboolean
+load_chunked (const gchar  *filename,
+              gint          page,
+              TIFF         *tif,
+              channel_data *channel,
+              gushort       bps,
+              gushort       spp,
+              gint          extra,
+              gboolean      separate)
+{
+  TiffLoader   loader = { 0, };
+  GThread    **threads;
+  gint         n_threads;
+  gint         n_comps = 0;
+  gint         max_bpp = 0;
+  guchar      *chunk;
+  guchar      *scratch;
+  gboolean     failed  = FALSE;
+  gint         i;
+
+  if ((bps != 8 && bps != 16) || ! channel[0].format)
+    return FALSE;
+
+  for (i = 0; i <= extra; i++)
+    {
+      n_comps += babl_format_get_n_components (channel[i].format);
+      max_bpp  = MAX (max_bpp,
+                      babl_format_get_bytes_per_pixel (channel[i].format));
+    }
+
+  if (n_comps > spp)
+    return FALSE;
+
+  loader.filename  = filename;
+  loader.page      = page;
+  loader.tiled     = TIFFIsTiled (tif);
+  loader.n_planes  = separate ? n_comps : 1;
+  loader.plane_bpp = (separate ? 1 : spp) * (bps / 8);
+
+  TIFFGetField (tif, TIFFTAG_IMAGEWIDTH,  &loader.width);
+  TIFFGetField (tif, TIFFTAG_IMAGELENGTH, &loader.length);
+
+  if (loader.tiled)
+    {
+      TIFFGetField (tif, TIFFTAG_TILEWIDTH,  &loader.chunk_width);
+      TIFFGetField (tif, TIFFTAG_TILELENGTH, &loader.chunk_length);
+      loader.chunk_size = TIFFTileSize (tif);
+    }
+  else
+    {
+      loader.chunk_width = loader.width;
+
+      TIFFGetFieldDefaulted (tif, TIFFTAG_ROWSPERSTRIP, &loader.chunk_length);
+      loader.chunk_length = MIN (loader.chunk_length, loader.length);
+      loader.chunk_size   = TIFFStripSize (tif);
+    }
+
+  if (loader.chunk_width == 0 || loader.chunk_length == 0 ||
+      loader.chunk_size <= 0 || loader.chunk_size > LOAD_MAX_CHUNK_SIZE ||
+      loader.chunk_size < (tsize_t) (loader.chunk_width *
+                                     loader.chunk_length *
+                                     loader.plane_bpp))
+    return FALSE;
+
+  n_threads = CLAMP (g_get_num_processors (), 1, 16);
+
+  /*  whole chunks per band; with strips also enough of them to keep
+   *  all threads busy
+   */
+  loader.band_rows = MAX (LOAD_BAND_MIN_ROWS, loader.chunk_length);
+
+  if (! loader.tiled)
+    loader.band_rows = MAX (loader.band_rows,
+                            n_threads * loader.chunk_length);
+
+  loader.band_rows = ((loader.band_rows + loader.chunk_length - 1) /
+                      loader.chunk_length * loader.chunk_length);
+  loader.band_rows = MIN (loader.band_rows, loader.length);
+
+  loader.chunks_across = ((loader.width + loader.chunk_width - 1) /
+                          loader.chunk_width);
+
+  loader.planes = g_new (guchar *, loader.n_planes);
+
+  for (i = 0; i < loader.n_planes; i++)
+    loader.planes[i] = g_malloc ((gsize) loader.width * loader.band_rows *
+                                 loader.plane_bpp);
+
+  chunk   = g_malloc (loader.chunk_size);
+  scratch = g_malloc ((gsize) loader.width * loader.band_rows * max_bpp);
+
+  g_mutex_init (&loader.mutex);
+  g_cond_init (&loader.work_cond);
+  g_cond_init (&loader.done_cond);
+
+  /*  the main thread decodes too, with the handle it already has  */
+  threads = g_new0 (GThread *, n_threads);
+
+  for (i = 1; i < n_threads; i++)
+    threads[i] = g_thread_new ("tiff-load", load_chunks_thread, &loader);
+
+  for (loader.band_y = 0;
+       loader.band_y < loader.length;
+       loader.band_y += loader.band_rows)
+    {
+      loader.band_rows = MIN (loader.band_rows,
+                              loader.length - loader.band_y);
+
+      g_mutex_lock (&loader.mutex);
+
+      loader.chunks_down = ((loader.band_rows + loader.chunk_length - 1) /
+                            loader.chunk_length);
+      loader.n_chunks    = (loader.n_planes *
+                            loader.chunks_down * loader.chunks_across);
+      loader.next_chunk  = 0;
+      loader.n_done      = 0;
+
+      g_cond_broadcast (&loader.work_cond);
+
+      load_chunks_claim (&loader, tif, chunk);
+
+      while (loader.n_done < loader.n_chunks)
+        g_cond_wait (&loader.done_cond, &loader.mutex);
+
+      failed |= loader.failed;
+      loader.failed = FALSE;
+
+      g_mutex_unlock (&loader.mutex);
+
+      load_band_to_channels (&loader, channel, extra, scratch);
+
+      gimp_progress_update ((gdouble) (loader.band_y + loader.band_rows) /
+                            (gdouble) loader.length);
+    }
+
+  g_mutex_lock (&loader.mutex);
+  loader.quit = TRUE;
+  g_cond_broadcast (&loader.work_cond);
+  g_mutex_unlock (&loader.mutex);
+
+  for (i = 1; i < n_threads; i++)
+    g_thread_join (threads[i]);
+
+  g_free (threads);
+
+  g_cond_clear (&loader.done_cond);
+  g_cond_clear (&loader.work_cond);
+  g_mutex_clear (&loader.mutex);
+
+  for (i = 0; i < loader.n_planes; i++)
+    g_free (loader.planes[i]);
+
+  g_free (loader.planes);
+  g_free (scratch);
+  g_free (chunk);
+
+  if (failed)
+    g_message (_("Some parts of '%s' could not be read, "
+                 "the image may be incomplete."),
+               gimp_filename_to_utf8 (filename));
+
+  return TRUE;
+}
+
 
 #if 0
 static void
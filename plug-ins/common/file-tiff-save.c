@@ -76,22 +76,67 @@
 #define PLUG_IN_BINARY "file-tiff-save"
 #define PLUG_IN_ROLE   "gimp-file-tiff-save"
 
+#define SAVE_TILE_SIZE  256
+
+/*  Beyond this much raw pixel data the file is written as BigTIFF,
+ *  leaving some headroom below 4 GB for codecs that expand data.
+ */
+#define SAVE_BIGTIFF_THRESHOLD  G_GUINT64_CONSTANT (0xF0000000)
+
 
 typedef struct
 {
   gint      compression;
   gint      fillorder;
   gboolean  save_transp_pixels;
+  gboolean  tiled;
 } TiffSaveVals;
 
 typedef struct
 {
-  gint32        ID;
-  GimpDrawable *drawable;
-  GimpPixelRgn  pixel_rgn;
-  guchar       *pixels;
-  guchar       *pixel;
-} channel_data;
+  gboolean       tiled;
+  gint           width;
+  gint           length;
+  gint           chunk_width;
+  gint           chunk_length;
+  tsize_t        chunk_row_bytes;
+  tsize_t        chunk_size;
+  gint           bpp;
+  gboolean       is_bw;
+  gboolean       invert;
+
+  /*  what the chunk encoders need to produce the same bytes as @tif  */
+  gshort         bitspersample;
+  gshort         samplesperpixel;
+  gshort         photometric;
+  gushort        compression;
+  gshort         predictor;
+  gushort        n_extra_samples;
+  gushort        extra_samples[1];
+
+  /*  the band of rows currently being written  */
+  gint           band_y;
+  gint           band_rows;
+  const guchar  *band;
+  gint           chunks_across;
+  gint           n_chunks;
+  guchar       **results;
+  tsize_t       *result_sizes;
+
+  GMutex         mutex;
+  GCond          work_cond;
+  GCond          done_cond;
+  gint           next_chunk;
+  gint           n_done;
+  gboolean       failed;
+  gboolean       quit;
+} TiffSaver;
+
+typedef struct
+{
+  GByteArray    *data;
+  toff_t         pos;
+} TiffMemFile;
 
 /* Declare some local functions.
  */
@@ -112,6 +157,11 @@ static gboolean  save_image             (const gchar  *filename,
                                          gint32        orig_image,
                                          GError      **error);
 
+static gboolean  save_chunks            (TIFF         *tif,
+                                         TiffSaver    *saver,
+                                         GeglBuffer   *buffer,
+                                         const Babl   *format);
+
 static gboolean  save_dialog            (gboolean      has_alpha,
                                          gboolean      is_monochrome);
 
@@ -144,12 +194,17 @@ const GimpPlugInInfo PLUG_IN_INFO =
 static TiffSaveVals tsvals =
 {
   COMPRESSION_NONE,    /*  compression    */
+  0,                   /*  fillorder      */
   TRUE,                /*  alpha handling */
+  FALSE                /*  tiled          */
 };
 
 static gchar       *image_comment = NULL;
 static GimpRunMode  run_mode      = GIMP_RUN_INTERACTIVE;
 
+/*  set in the encoding threads, which must not talk to the core  */
+static GPrivate     worker_thread = G_PRIVATE_INIT (NULL);
+
 
 MAIN ()
 
@@ -383,6 +438,9 @@ tiff_warning (const gchar *module,
 {
   va_list ap_test;
 
+  if (g_private_get (&worker_thread))
+    return;
+
   /* Workaround for: http://bugzilla.gnome.org/show_bug.cgi?id=131975 */
   /* Ignore the warnings about unregistered private tags (>= 32768) */
   if (! strcmp (fmt, "%s: unknown field with tag %d (0x%x) encountered"))
@@ -408,6 +466,10 @@ tiff_error (const gchar *module,
             const gchar *fmt,
             va_list      ap)
 {
+  /* Errors in the encoding threads are reported by the main thread */
+  if (g_private_get (&worker_thread))
+    return;
+
   /* Workaround for: http://bugzilla.gnome.org/show_bug.cgi?id=132297 */
   /* Ignore the errors related to random access and JPEG compression */
   if (! strcmp (fmt, "Compression algorithm does not support random access"))
@@ -664,7 +726,7 @@ save_image (const gchar  *filename,
   gushort        red[256];
   gushort        grn[256];
   gushort        blu[256];
-  gint           cols, rows, row, i;
+  gint           cols, rows, i;
   glong          rowsperstrip;
   gushort        compression;
   gushort        extra_samples[1];
@@ -674,17 +736,13 @@ save_image (const gchar  *filename,
   gshort         samplesperpixel;
   gshort         bitspersample;
   gint           bytesperrow;
-  guchar        *t;
-  guchar        *src = NULL;
-  guchar        *data = NULL;
   guchar        *cmap;
   gint           num_colors;
-  gint           success;
   GimpImageType  drawable_type;
   GeglBuffer    *buffer = NULL;
   const Babl    *format;
-  gint           tile_height;
-  gint           y, yend;
+  TiffSaver      saver  = { 0, };
+  const gchar   *mode   = "w";
   gboolean       is_bw    = FALSE;
   gboolean       invert   = TRUE;
   const guchar   bw_map[] = { 0, 0, 0, 255, 255, 255 };
@@ -700,10 +758,16 @@ save_image (const gchar  *filename,
 #endif
 
   predictor = 0;
-  tile_height = gimp_tile_height ();
-  rowsperstrip = tile_height;
+  rowsperstrip = gimp_tile_height ();
 
-  tif = tiff_open (filename, "w", error);
+#ifdef TIFF_VERSION_BIG
+  /*  classic TIFF uses 32 bit offsets  */
+  if ((guint64) gimp_drawable_width (layer) * gimp_drawable_height (layer) *
+      gimp_drawable_bpp (layer) > SAVE_BIGTIFF_THRESHOLD)
+    mode = "w8";
+#endif
+
+  tif = tiff_open (filename, mode, error);
 
   if (! tif)
     {
@@ -885,10 +949,23 @@ save_image (const gchar  *filename,
   TIFFSetField (tif, TIFFTAG_PHOTOMETRIC, photometric);
   TIFFSetField (tif, TIFFTAG_DOCUMENTNAME, filename);
   TIFFSetField (tif, TIFFTAG_SAMPLESPERPIXEL, samplesperpixel);
-  TIFFSetField (tif, TIFFTAG_ROWSPERSTRIP, rowsperstrip);
-  /* TIFFSetField( tif, TIFFTAG_STRIPBYTECOUNTS, rows / rowsperstrip ); */
   TIFFSetField (tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
 
+  /* the fax codecs are only used with strips */
+  saver.tiled = (tsvals.tiled &&
+                 compression != COMPRESSION_CCITTFAX3 &&
+                 compression != COMPRESSION_CCITTFAX4);
+
+  if (saver.tiled)
+    {
+      TIFFSetField (tif, TIFFTAG_TILEWIDTH,  SAVE_TILE_SIZE);
+      TIFFSetField (tif, TIFFTAG_TILELENGTH, SAVE_TILE_SIZE);
+    }
+  else
+    {
+      TIFFSetField (tif, TIFFTAG_ROWSPERSTRIP, rowsperstrip);
+    }
+
   /* resolution fields */
   {
     gdouble  xresolution;
@@ -995,80 +1072,473 @@ save_image (const gchar  *filename,
   if (!is_bw && drawable_type == GIMP_INDEXED_IMAGE)
     TIFFSetField (tif, TIFFTAG_COLORMAP, red, grn, blu);
 
-  /* array to rearrange data */
-  src = g_new (guchar, bytesperrow * tile_height);
-  data = g_new (guchar, bytesperrow);
+  saver.width           = cols;
+  saver.length          = rows;
+  saver.bpp             = babl_format_get_bytes_per_pixel (format);
+  saver.is_bw           = is_bw;
+  saver.invert          = invert;
+  saver.bitspersample   = bitspersample;
+  saver.samplesperpixel = samplesperpixel;
+  saver.photometric     = photometric;
+  saver.compression     = compression;
+  saver.predictor       = predictor;
+
+  if (alpha)
+    {
+      saver.n_extra_samples  = 1;
+      saver.extra_samples[0] = extra_samples[0];
+    }
+
+  if (saver.tiled)
+    {
+      saver.chunk_width     = SAVE_TILE_SIZE;
+      saver.chunk_length    = SAVE_TILE_SIZE;
+      saver.chunk_row_bytes = TIFFTileRowSize (tif);
+      saver.chunk_size      = TIFFTileSize (tif);
+    }
+  else
+    {
+      saver.chunk_width     = cols;
+      saver.chunk_length    = MIN (rowsperstrip, rows);
+      saver.chunk_row_bytes = TIFFScanlineSize (tif);
+      saver.chunk_size      = TIFFStripSize (tif);
+    }
 
   /* Now write the TIFF data. */
-  for (y = 0; y < rows; y = yend)
+  if (! save_chunks (tif, &saver, buffer, format))
+    {
+      g_message (_("Writing image data to '%s' failed."),
+                 gimp_filename_to_utf8 (filename));
+      goto out;
+    }
+
+  TIFFFlushData (tif);
+  TIFFClose (tif);
+
+  gimp_progress_update (1.0);
+
+  status = TRUE;
+
+ out:
+  if (buffer)
+    g_object_unref (buffer);
+
+  return status;
+}
+
+/*  libtiff I/O on a growing memory buffer, used to run a codec on a
+ *  single chunk outside of the file being written.
+ */
+static tsize_t
+tiff_mem_read (thandle_t handle,
+               tdata_t   buf,
+               tsize_t   size)
+{
+  TiffMemFile *mem = (TiffMemFile *) handle;
+
+  if (mem->pos >= mem->data->len)
+    return 0;
+
+  size = MIN (size, mem->data->len - mem->pos);
+  memcpy (buf, mem->data->data + mem->pos, size);
+  mem->pos += size;
+
+  return size;
+}
+
+static tsize_t
+tiff_mem_write (thandle_t handle,
+                tdata_t   buf,
+                tsize_t   size)
+{
+  TiffMemFile *mem = (TiffMemFile *) handle;
+
+  if (mem->pos + size > mem->data->len)
+    g_byte_array_set_size (mem->data, mem->pos + size);
+
+  memcpy (mem->data->data + mem->pos, buf, size);
+  mem->pos += size;
+
+  return size;
+}
+
+static toff_t
+tiff_mem_seek (thandle_t handle,
+               toff_t    offset,
+               int       whence)
+{
+  TiffMemFile *mem = (TiffMemFile *) handle;
+
+  switch (whence)
+    {
+    case SEEK_SET: mem->pos = offset;                  break;
+    case SEEK_CUR: mem->pos = mem->pos + offset;       break;
+    case SEEK_END: mem->pos = mem->data->len + offset; break;
+    }
+
+  return mem->pos;
+}
+
+static int
+tiff_mem_close (thandle_t handle)
+{
+  return 0;
+}
+
+static toff_t
+tiff_mem_size (thandle_t handle)
+{
+  TiffMemFile *mem = (TiffMemFile *) handle;
+
+  return mem->data->len;
+}
+
+static int
+tiff_mem_map (thandle_t  handle,
+              tdata_t   *base,
+              toff_t    *size)
+{
+  return 0;
+}
+
+static void
+tiff_mem_unmap (thandle_t handle,
+                tdata_t   base,
+                toff_t    size)
+{
+}
+
+/*  Copies chunk @index of the current band into @dest the way libtiff
+ *  expects it, padding tiles at the image edges.  Returns the number
+ *  of bytes to encode.
+ */
+static tsize_t
+save_chunk_pack (TiffSaver *saver,
+                 gint       index,
+                 guchar    *dest)
+{
+  gint  x    = (index % saver->chunks_across) * saver->chunk_width;
+  gint  y    = saver->band_y + (index / saver->chunks_across) * saver->chunk_length;
+  gint  cols = MIN (saver->chunk_width,  saver->width  - x);
+  gint  rows = MIN (saver->chunk_length, saver->length - y);
+  gsize band_stride = (gsize) saver->width * saver->bpp;
+  gint  row;
+
+  if (saver->tiled && (cols < saver->chunk_width || rows < saver->chunk_length))
+    memset (dest, 0, saver->chunk_size);
+
+  for (row = 0; row < rows; row++)
+    {
+      const guchar *s = (saver->band +
+                         (y - saver->band_y + row) * band_stride +
+                         x * saver->bpp);
+      guchar       *d = dest + row * saver->chunk_row_bytes;
+
+      if (saver->is_bw)
+        byte2bit (s, cols, d, saver->invert);
+      else
+        memcpy (d, s, cols * saver->bpp);
+    }
+
+  if (saver->tiled)
+    return saver->chunk_size;
+
+  return rows * saver->chunk_row_bytes;
+}
+
+/*  Compresses a packed chunk by writing it as the only strip of an
+ *  in-memory TIFF with the same sample layout and codec settings, and
+ *  returns the raw strip bytes.  A tile encodes exactly like a strip
+ *  of the tile's dimensions.
+ */
+static gboolean
+save_chunk_encode (TiffSaver  *saver,
+                   gint        rows,
+                   guchar     *packed,
+                   tsize_t     size,
+                   guchar    **result,
+                   tsize_t    *result_size)
+{
+  TiffMemFile  mem;
+  TIFF        *enc;
+  toff_t      *offsets;
+  toff_t      *counts;
+  gboolean     success = FALSE;
+
+  mem.data = g_byte_array_new ();
+  mem.pos  = 0;
+
+  enc = TIFFClientOpen ("tiff-chunk", "w", (thandle_t) &mem,
+                        tiff_mem_read, tiff_mem_write, tiff_mem_seek,
+                        tiff_mem_close, tiff_mem_size,
+                        tiff_mem_map, tiff_mem_unmap);
+
+  if (enc)
+    {
+      TIFFSetField (enc, TIFFTAG_IMAGEWIDTH,      saver->chunk_width);
+      TIFFSetField (enc, TIFFTAG_IMAGELENGTH,     rows);
+      TIFFSetField (enc, TIFFTAG_ROWSPERSTRIP,    rows);
+      TIFFSetField (enc, TIFFTAG_BITSPERSAMPLE,   saver->bitspersample);
+      TIFFSetField (enc, TIFFTAG_SAMPLESPERPIXEL, saver->samplesperpixel);
+      TIFFSetField (enc, TIFFTAG_PLANARCONFIG,    PLANARCONFIG_CONTIG);
+      TIFFSetField (enc, TIFFTAG_COMPRESSION,     saver->compression);
+
+      /* the colormap doesn't matter to the codecs */
+      TIFFSetField (enc, TIFFTAG_PHOTOMETRIC,
+                    saver->photometric == PHOTOMETRIC_PALETTE ?
+                    PHOTOMETRIC_MINISBLACK : saver->photometric);
+
+      if (saver->predictor != 0 &&
+          (saver->compression == COMPRESSION_LZW ||
+           saver->compression == COMPRESSION_DEFLATE))
+        TIFFSetField (enc, TIFFTAG_PREDICTOR, saver->predictor);
+
+      if (saver->n_extra_samples > 0)
+        TIFFSetField (enc, TIFFTAG_EXTRASAMPLES,
+                      saver->n_extra_samples, saver->extra_samples);
+
+      if (TIFFWriteEncodedStrip (enc, 0, packed, size) >= 0 &&
+          TIFFGetField (enc, TIFFTAG_STRIPOFFSETS,    &offsets) &&
+          TIFFGetField (enc, TIFFTAG_STRIPBYTECOUNTS, &counts)  &&
+          offsets[0] + counts[0] <= mem.data->len)
+        {
+          *result      = g_memdup (mem.data->data + offsets[0], counts[0]);
+          *result_size = counts[0];
+
+          success = TRUE;
+        }
+
+      TIFFClose (enc);
+    }
+
+  g_byte_array_free (mem.data, TRUE);
+
+  return success;
+}
+
+static gpointer
+save_chunks_thread (gpointer data)
+{
+  TiffSaver *saver  = data;
+  guchar    *packed = g_malloc (saver->chunk_size);
+
+  g_private_set (&worker_thread, GINT_TO_POINTER (TRUE));
+
+  g_mutex_lock (&saver->mutex);
+
+  while (! saver->quit)
+    {
+      while (saver->next_chunk < saver->n_chunks)
+        {
+          gint     index = saver->next_chunk++;
+          gint     y;
+          tsize_t  size;
+          gboolean success;
+
+          g_mutex_unlock (&saver->mutex);
+
+          y = saver->band_y + (index / saver->chunks_across) * saver->chunk_length;
+
+          size    = save_chunk_pack (saver, index, packed);
+          success = save_chunk_encode (saver,
+                                       saver->tiled ?
+                                       saver->chunk_length :
+                                       MIN (saver->chunk_length,
+                                            saver->length - y),
+                                       packed, size,
+                                       &saver->results[index],
+                                       &saver->result_sizes[index]);
+
+          g_mutex_lock (&saver->mutex);
+
+          if (! success)
+            saver->failed = TRUE;
+
+          if (++saver->n_done == saver->n_chunks)
+            g_cond_signal (&saver->done_cond);
+        }
+
+      if (! saver->quit)
+        g_cond_wait (&saver->work_cond, &saver->mutex);
+    }
+
+  g_mutex_unlock (&saver->mutex);
+
+  g_free (packed);
+
+  return NULL;
+}
+
+/*  Writes the image in bands of whole strips or tiles.  For codecs
+ *  whose chunks are independent of each other, the chunks of a band
+ *  are compressed in parallel and written with TIFFWriteRaw*(); the
+ *  others go through libtiff's own encoder on this thread.
+ */
+static gboolean
+save_chunks (TIFF       *tif,
+             TiffSaver  *saver,
+             GeglBuffer *buffer,
+             const Babl *format)
+{
+  GThread  **threads   = NULL;
+  gint       n_threads = 1;
+  guchar    *band;
+  guchar    *packed    = NULL;
+  gint       band_rows;
+  gboolean   success   = TRUE;
+  gint       i;
+
+  switch (saver->compression)
+    {
+    case COMPRESSION_LZW:
+    case COMPRESSION_PACKBITS:
+    case COMPRESSION_DEFLATE:
+    case COMPRESSION_ADOBE_DEFLATE:
+      n_threads = CLAMP (g_get_num_processors (), 1, 16);
+      break;
+
+    default:
+      break;
+    }
+
+  saver->chunks_across = ((saver->width + saver->chunk_width - 1) /
+                          saver->chunk_width);
+
+  band_rows = saver->chunk_length;
+
+  if (! saver->tiled)
+    band_rows *= n_threads;
+
+  band = g_malloc ((gsize) saver->width * band_rows * saver->bpp);
+
+  if (n_threads > 1)
     {
-      yend = y + tile_height;
-      yend = MIN (yend, rows);
+      saver->results      = g_new0 (guchar *,
+                                    saver->chunks_across *
+                                    ((band_rows + saver->chunk_length - 1) /
+                                     saver->chunk_length));
+      saver->result_sizes = g_new0 (tsize_t,
+                                    saver->chunks_across *
+                                    ((band_rows + saver->chunk_length - 1) /
+                                     saver->chunk_length));
+
+      g_mutex_init (&saver->mutex);
+      g_cond_init (&saver->work_cond);
+      g_cond_init (&saver->done_cond);
+
+      threads = g_new (GThread *, n_threads);
+
+      for (i = 0; i < n_threads; i++)
+        threads[i] = g_thread_new ("tiff-save", save_chunks_thread, saver);
+    }
+  else
+    {
+      packed = g_malloc (saver->chunk_size);
+    }
+
+  saver->band = band;
+
+  for (saver->band_y = 0;
+       saver->band_y < saver->length && success;
+       saver->band_y += saver->band_rows)
+    {
+      saver->band_rows = MIN (band_rows, saver->length - saver->band_y);
+      saver->n_chunks  = (saver->chunks_across *
+                          ((saver->band_rows + saver->chunk_length - 1) /
+                           saver->chunk_length));
 
       gegl_buffer_get (buffer,
-                       GEGL_RECTANGLE (0, y, cols, yend - y),
-                       1.0,
-                       format,
-                       src,
-                       GEGL_AUTO_ROWSTRIDE,
-                       GEGL_ABYSS_NONE);
-
-      for (row = y; row < yend; row++)
+                       GEGL_RECTANGLE (0, saver->band_y,
+                                       saver->width, saver->band_rows),
+                       1.0, format, band,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+      if (n_threads > 1)
         {
-          t = src + bytesperrow * (row - y);
+          g_mutex_lock (&saver->mutex);
+
+          saver->next_chunk = 0;
+          saver->n_done     = 0;
+          g_cond_broadcast (&saver->work_cond);
+
+          while (saver->n_done < saver->n_chunks)
+            g_cond_wait (&saver->done_cond, &saver->mutex);
 
-          switch (drawable_type)
+          success = ! saver->failed;
+
+          g_mutex_unlock (&saver->mutex);
+        }
+
+      for (i = 0; i < saver->n_chunks && success; i++)
+        {
+          gint x = (i % saver->chunks_across) * saver->chunk_width;
+          gint y = saver->band_y + (i / saver->chunks_across) * saver->chunk_length;
+
+          if (n_threads > 1)
             {
-            case GIMP_INDEXED_IMAGE:
-              if (is_bw)
-                {
-                  byte2bit (t, bytesperrow, data, invert);
-                  success = (TIFFWriteScanline (tif, data, row, 0) >= 0);
-                }
+              if (saver->tiled)
+                success = (TIFFWriteRawTile (tif,
+                                             TIFFComputeTile (tif, x, y, 0, 0),
+                                             saver->results[i],
+                                             saver->result_sizes[i]) >= 0);
               else
-                {
-                  success = (TIFFWriteScanline (tif, t, row, 0) >= 0);
-                }
-              break;
-
-            case GIMP_GRAY_IMAGE:
-            case GIMP_GRAYA_IMAGE:
-            case GIMP_RGB_IMAGE:
-            case GIMP_RGBA_IMAGE:
-              success = (TIFFWriteScanline (tif, t, row, 0) >= 0);
-              break;
+                success = (TIFFWriteRawStrip (tif,
+                                              TIFFComputeStrip (tif, y, 0),
+                                              saver->results[i],
+                                              saver->result_sizes[i]) >= 0);
+            }
+          else
+            {
+              tsize_t size = save_chunk_pack (saver, i, packed);
 
-            default:
-              success = FALSE;
-              break;
+              if (saver->tiled)
+                success = (TIFFWriteEncodedTile (tif,
+                                                 TIFFComputeTile (tif, x, y, 0, 0),
+                                                 packed, size) >= 0);
+              else
+                success = (TIFFWriteEncodedStrip (tif,
+                                                  TIFFComputeStrip (tif, y, 0),
+                                                  packed, size) >= 0);
             }
+        }
 
-          if (!success)
+      if (n_threads > 1)
+        {
+          for (i = 0; i < saver->n_chunks; i++)
             {
-              g_message (_("Failed a scanline write on row %d"), row);
-              goto out;
+              g_free (saver->results[i]);
+              saver->results[i] = NULL;
             }
         }
 
-      if ((row % 32) == 0)
-        gimp_progress_update ((gdouble) row / (gdouble) rows);
+      gimp_progress_update ((gdouble) (saver->band_y + saver->band_rows) /
+                            (gdouble) saver->length);
     }
 
-  TIFFFlushData (tif);
-  TIFFClose (tif);
+  if (n_threads > 1)
+    {
+      g_mutex_lock (&saver->mutex);
+      saver->quit = TRUE;
+      g_cond_broadcast (&saver->work_cond);
+      g_mutex_unlock (&saver->mutex);
 
-  gimp_progress_update (1.0);
+      for (i = 0; i < n_threads; i++)
+        g_thread_join (threads[i]);
 
-  status = TRUE;
+      g_free (threads);
 
- out:
-  if (buffer)
-    g_object_unref (buffer);
+      g_cond_clear (&saver->done_cond);
+      g_cond_clear (&saver->work_cond);
+      g_mutex_clear (&saver->mutex);
 
-  g_free (data);
-  g_free (src);
+      g_free (saver->results);
+      g_free (saver->result_sizes);
+    }
 
-  return status;
+  g_free (packed);
+  g_free (band);
+
+  return success;
 }
 
 static gboolean
@@ -1137,6 +1607,16 @@ save_dialog (gboolean has_alpha,
                     G_CALLBACK (gimp_toggle_button_update),
                     &tsvals.save_transp_pixels);
 
+  /* Tiled layout, faster to access for large images */
+  toggle = gtk_check_button_new_with_mnemonic (_("Save as _tiles"));
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (toggle), tsvals.tiled);
+  gtk_box_pack_start (GTK_BOX (vbox), toggle, FALSE, FALSE, 0);
+  gtk_widget_show (toggle);
+
+  g_signal_connect (toggle, "toggled",
+                    G_CALLBACK (gimp_toggle_button_update),
+                    &tsvals.tiled);
+
   /* comment entry */
   hbox = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
   gtk_box_pack_start (GTK_BOX (vbox), hbox, FALSE, FALSE, 0);
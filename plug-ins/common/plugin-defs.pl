@@ -5,7 +5,7 @@
     'apply-canvas' => { ui => 1 },
     'blinds' => { ui => 1 },
     'blur' => {},
-    'blur-gauss' => { ui => 1 },
+    'blur-gauss' => { ui => 1, gegl => 1 },
     'blur-gauss-selective' => { ui => 1, cflags => 'MMX_EXTRA_CFLAGS' },
     'border-average' => { ui => 1, gegl => 1 },
     'bump-map' => { ui => 1 },
@@ -22,16 +22,16 @@
     'contrast-retinex' => { ui => 1 },
     'contrast-stretch' => {},
     'contrast-stretch-hsv' => {},
-    'convolution-matrix' => { ui => 1 },
+    'convolution-matrix' => { ui => 1, gegl => 1 },
     'crop-zealous' => {},
     'curve-bend' => { ui => 1 },
     'decompose' => { ui => 1, gegl => 1 },
     'deinterlace' => { ui => 1 },
     'depth-merge' => { ui => 1 },
-    'despeckle' => { ui => 1 },
+    'despeckle' => { ui => 1, gegl => 1 },
     'destripe' => { ui => 1 },
     'diffraction' => { ui => 1 },
-    'displace' => { ui => 1 },
+    'displace' => { ui => 1, gegl => 1 },
     'edge' => { ui => 1 },
     'edge-dog' => { ui => 1 },
     'edge-laplace' => {},
@@ -119,11 +119,11 @@
     'tile-paper' => { ui => 1 },
     'tile-small' => { ui => 1 },
     'unit-editor' => { ui => 1 },
-    'unsharp-mask' => { ui => 1 },
+    'unsharp-mask' => { ui => 1, gegl => 1 },
     'value-propagate' => { ui => 1 },
-    'van-gogh-lic' => { ui => 1 },
+    'van-gogh-lic' => { ui => 1, gegl => 1 },
     'video' => { ui => 1 },
-    'warp' => { ui => 1 },
+    'warp' => { ui => 1, gegl => 1 },
     'web-browser' => { ui => 1 },
     'web-page' => { ui => 1, optional => 1, libs => 'WEBKIT_LIBS', cflags => 'WEBKIT_CFLAGS' },
     'wind' => { ui => 1 }
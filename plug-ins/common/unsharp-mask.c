@@ -20,6 +20,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
@@ -53,6 +54,16 @@ typedef struct
   gboolean  run;
 } UnsharpMaskInterface;
 
+typedef struct
+{
+  gdouble  *cmatrix;         /* Convolution matrix (for gaussian)     */
+  gint      cmatrix_length;
+  gint      box_width;       /* If > 0, use a three pass box blur
+                                instead of a gaussian blur            */
+  gdouble   amount;
+  gint      threshold;
+} UnsharpBlur;
+
 /* local function prototypes */
 static void      query (void);
 static void      run   (const gchar      *name,
@@ -75,9 +86,21 @@ static void      box_blur_line       (const gint      box_width,
                                       const gint      bpp);
 static gint      gen_convolve_matrix (gdouble         std_dev,
                                       gdouble       **cmatrix);
-static void      unsharp_region      (GimpPixelRgn   *srcPTR,
-                                      GimpPixelRgn   *dstPTR,
-                                      gint            bpp,
+static gint      unsharp_blur_init   (UnsharpBlur    *blur,
+                                      gdouble         radius,
+                                      gdouble         amount);
+static void      unsharp_blur_line   (const UnsharpBlur *blur,
+                                      guchar         *src,
+                                      guchar         *dest,
+                                      const gint      len,
+                                      const gint      bpp);
+static void      unsharp_rows        (const GimpParallelArea *area,
+                                      gpointer        data);
+static void      unsharp_cols        (const GimpParallelArea *area,
+                                      gpointer        data);
+static void      unsharp_buffer      (GeglBuffer     *src_buffer,
+                                      GeglBuffer     *dest_buffer,
+                                      const Babl     *format,
                                       gdouble         radius,
                                       gdouble         amount,
                                       gint            x1,
@@ -85,6 +108,7 @@ static void      unsharp_region      (GimpPixelRgn   *srcPTR,
                                       gint            y1,
                                       gint            y2,
                                       gboolean        show_progress);
+static const Babl * unsharp_get_format (gint32        drawable_ID);
 
 static void      unsharp_mask        (GimpDrawable   *drawable,
                                       gdouble         radius,
@@ -170,6 +194,7 @@ run (const gchar      *name,
   values[0].data.d_status = status;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   /*
    * Get drawable information...
@@ -534,58 +559,42 @@ unsharp_mask (GimpDrawable *drawable,
               gdouble       radius,
               gdouble       amount)
 {
-  GimpPixelRgn srcPR, destPR;
-  gint         x1, y1, x2, y2;
-
-  /* initialize pixel regions */
-  gimp_pixel_rgn_init (&srcPR, drawable,
-                       0, 0, drawable->width, drawable->height, FALSE, FALSE);
-  gimp_pixel_rgn_init (&destPR, drawable,
-                       0, 0, drawable->width, drawable->height, TRUE, TRUE);
+  GeglBuffer *src_buffer;
+  GeglBuffer *dest_buffer;
+  gint        x1, y1, x2, y2;
 
   /* Get the input */
   gimp_drawable_mask_bounds (drawable->drawable_id, &x1, &y1, &x2, &y2);
 
-  unsharp_region (&srcPR, &destPR, drawable->bpp,
+  src_buffer  = gimp_drawable_get_buffer (drawable->drawable_id);
+  dest_buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
+
+  unsharp_buffer (src_buffer, dest_buffer,
+                  unsharp_get_format (drawable->drawable_id),
                   radius, amount,
                   x1, x2, y1, y2,
                   TRUE);
 
-  gimp_drawable_flush (drawable);
+  g_object_unref (src_buffer);
+  g_object_unref (dest_buffer);
+
   gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
   gimp_drawable_update (drawable->drawable_id, x1, y1, x2 - x1, y2 - y1);
 }
 
-/* Perform an unsharp mask on the region, given a source region, dest.
- * region, width and height of the regions, and corner coordinates of
- * a subregion to act upon.  Everything outside the subregion is unaffected.
+/* Sets up the blur for a radius and returns how many pixels it
+ * reaches out on each side of the output pixel.
  */
-static void
-unsharp_region (GimpPixelRgn *srcPR,
-                GimpPixelRgn *destPR,
-                gint          bpp,
-                gdouble       radius, /* Radius, AKA standard deviation */
-                gdouble       amount,
-                gint          x1,
-                gint          x2,
-                gint          y1,
-                gint          y2,
-                gboolean      show_progress)
+static gint
+unsharp_blur_init (UnsharpBlur *blur,
+                   gdouble      radius, /* Radius, AKA standard deviation */
+                   gdouble      amount)
 {
-  guchar     *src;                /* Temporary copy of source row/col      */
-  guchar     *dest;               /* Temporary copy of destination row/col */
-  const gint  width   = x2 - x1;
-  const gint  height  = y2 - y1;
-  gdouble    *cmatrix = NULL;     /* Convolution matrix (for gaussian)     */
-  gint        cmatrix_length = 0;
-  gint        row, col;           /* Row, column counters                  */
-  const gint  threshold = unsharp_params.threshold;
-  gboolean    box_blur;           /* If we want to use a three pass box
-                                     blur instead of a gaussian blur       */
-  gint        box_width = 0;
-
-  if (show_progress)
-    gimp_progress_init (_("Blurring"));
+  blur->cmatrix        = NULL;
+  blur->cmatrix_length = 0;
+  blur->box_width      = 0;
+  blur->amount         = amount;
+  blur->threshold      = unsharp_params.threshold;
 
   /* If the radius is less than 10, use a true gaussian kernel.  This
    * is slower, but more accurate and allows for finer adjustments.
@@ -595,143 +604,217 @@ unsharp_region (GimpPixelRgn *srcPR,
    */
   if (radius < 10)
     {
-      box_blur = FALSE;
-      /* If true gaussian, generate convolution matrix
-         and make sure it's smaller than each dimension */
-      cmatrix_length = gen_convolve_matrix (radius, &cmatrix);
+      /* If true gaussian, generate convolution matrix */
+      blur->cmatrix_length = gen_convolve_matrix (radius, &blur->cmatrix);
+
+      return blur->cmatrix_length / 2;
     }
   else
     {
-      box_blur = TRUE;
       /* Three box blurs of this width approximate a gaussian */
-      box_width = ROUND (radius * 3 * sqrt (2 * G_PI) / 4);
+      blur->box_width = ROUND (radius * 3 * sqrt (2 * G_PI) / 4);
+
+      return 3 * (blur->box_width / 2 + 1);
     }
+}
 
-  /* Allocate buffers temporary copies of a row/column */
-  src  = g_new (guchar, MAX (width, height) * bpp);
-  dest = g_new (guchar, MAX (width, height) * bpp);
+/* Blurs a line of pixels from src into dest; src is used as scratch
+ * space by the box blur.
+ */
+static void
+unsharp_blur_line (const UnsharpBlur *blur,
+                   guchar            *src,
+                   guchar            *dest,
+                   const gint         len,
+                   const gint         bpp)
+{
+  const gint box_width = blur->box_width;
 
-  /* Blur the rows */
-  for (row = 0; row < height; row++)
+  if (box_width > 0)
     {
-      gimp_pixel_rgn_get_row (srcPR, src, x1, y1 + row, width);
-
-      if (box_blur)
+      /* Odd-width box blur: repeat 3 times, centered on output pixel.
+       * Swap back and forth between the buffers. */
+      if (box_width % 2)
         {
-          /* Odd-width box blur: repeat 3 times, centered on output pixel.
-           * Swap back and forth between the buffers. */
-          if (box_width % 2)
-            {
-              box_blur_line (box_width, 0, src, dest, width, bpp);
-              box_blur_line (box_width, 0, dest, src, width, bpp);
-              box_blur_line (box_width, 0, src, dest, width, bpp);
-            }
-          /* Even-width box blur:
-           * This method is suggested by the specification for SVG.
-           * One pass with width n, centered between output and right pixel
-           * One pass with width n, centered between output and left pixel
-           * One pass with width n+1, centered on output pixel
-           * Swap back and forth between buffers.
-           */
-          else
-            {
-              box_blur_line (box_width,  -1, src, dest, width, bpp);
-              box_blur_line (box_width,   1, dest, src, width, bpp);
-              box_blur_line (box_width+1, 0, src, dest, width, bpp);
-            }
+          box_blur_line (box_width, 0, src, dest, len, bpp);
+          box_blur_line (box_width, 0, dest, src, len, bpp);
+          box_blur_line (box_width, 0, src, dest, len, bpp);
         }
+      /* Even-width box blur:
+       * This method is suggested by the specification for SVG.
+       * One pass with width n, centered between output and right pixel
+       * One pass with width n, centered between output and left pixel
+       * One pass with width n+1, centered on output pixel
+       * Swap back and forth between buffers.
+       */
       else
         {
-          /* Gaussian blur */
-          gaussian_blur_line (cmatrix, cmatrix_length, src, dest, width, bpp);
+          box_blur_line (box_width,  -1, src, dest, len, bpp);
+          box_blur_line (box_width,   1, dest, src, len, bpp);
+          box_blur_line (box_width+1, 0, src, dest, len, bpp);
         }
-
-      gimp_pixel_rgn_set_row (destPR, dest, x1, y1 + row, width);
-
-      if (show_progress && row % 64 == 0)
-        gimp_progress_update ((gdouble) row / (3 * height));
     }
+  else
+    {
+      /* Gaussian blur */
+      gaussian_blur_line (blur->cmatrix, blur->cmatrix_length,
+                          src, dest, len, bpp);
+    }
+}
 
-  /* Blur the cols. Essentially same as above. */
-  for (col = 0; col < width; col++)
+/* Blurs the rows of an area.  The area spans whole rows of the
+ * region, its source reaches out by the blur radius on both sides.
+ */
+static void
+unsharp_rows (const GimpParallelArea *area,
+              gpointer                data)
+{
+  const UnsharpBlur *blur   = data;
+  const gint         bpp    = area->bpp;
+  const gint         len    = area->src_roi.width;
+  const gint         offset = (area->roi.x - area->src_roi.x) * bpp;
+  guchar            *src    = g_new (guchar, len * bpp);
+  guchar            *dest   = g_new (guchar, len * bpp);
+  gint               row;
+
+  for (row = 0; row < area->roi.height; row++)
     {
-      gimp_pixel_rgn_get_col (destPR, src, x1 + col, y1, height);
+      const guchar *s = (area->src +
+                         (area->roi.y - area->src_roi.y + row) *
+                         area->src_rowstride);
 
-      if (box_blur)
-        {
-          /* Odd-width box blur */
-          if (box_width % 2)
-            {
-              box_blur_line (box_width, 0, src, dest, height, bpp);
-              box_blur_line (box_width, 0, dest, src, height, bpp);
-              box_blur_line (box_width, 0, src, dest, height, bpp);
-            }
-          /* Even-width box blur */
-          else
-            {
-              box_blur_line (box_width,  -1, src, dest, height, bpp);
-              box_blur_line (box_width,   1, dest, src, height, bpp);
-              box_blur_line (box_width+1, 0, src, dest, height, bpp);
-            }
-        }
-      else
-        {
-          /* Gaussian blur */
-          gaussian_blur_line (cmatrix, cmatrix_length, src, dest,height, bpp);
-        }
+      memcpy (src, s, len * bpp);
 
-      gimp_pixel_rgn_set_col (destPR, dest, x1 + col, y1, height);
+      unsharp_blur_line (blur, src, dest, len, bpp);
 
-      if (show_progress && col % 64 == 0)
-        gimp_progress_update ((gdouble) col / (3 * width) + 0.33);
+      memcpy (area->dest + row * area->dest_rowstride,
+              dest + offset, area->roi.width * bpp);
     }
 
-  if (show_progress)
-    gimp_progress_set_text (_("Merging"));
+  g_free (dest);
+  g_free (src);
+}
 
-  /* merge the source and destination (which currently contains
-     the blurred version) images */
-  for (row = 0; row < height; row++)
+/* Blurs the columns of an area, which spans whole columns of the
+ * region, and merges the result with the original pixels.
+ */
+static void
+unsharp_cols (const GimpParallelArea *area,
+              gpointer                data)
+{
+  const UnsharpBlur *blur      = data;
+  const gint         bpp       = area->bpp;
+  const gint         len       = area->src_roi.height;
+  const gint         offset    = area->roi.y - area->src_roi.y;
+  const gint         threshold = blur->threshold;
+  const gdouble      amount    = blur->amount;
+  guchar            *src       = g_new (guchar, len * bpp);
+  guchar            *dest      = g_new (guchar, len * bpp);
+  gint               col;
+
+  for (col = 0; col < area->roi.width; col++)
     {
-      const guchar *s = src;
-      guchar       *d = dest;
-      gint          u, v;
+      const guchar *s = area->src + (area->roi.x - area->src_roi.x + col) * bpp;
+      gint          row;
 
-      /* get source row */
-      gimp_pixel_rgn_get_row (srcPR, src, x1, y1 + row, width);
+      for (row = 0; row < len; row++)
+        memcpy (src + row * bpp, s + row * area->src_rowstride, bpp);
 
-      /* get dest row */
-      gimp_pixel_rgn_get_row (destPR, dest, x1, y1 + row, width);
+      unsharp_blur_line (blur, src, dest, len, bpp);
 
-      /* combine the two */
-      for (u = 0; u < width; u++)
+      /* merge the source and the blurred version */
+      for (row = 0; row < area->roi.height; row++)
         {
+          const guchar *o = area->aux  + row * area->aux_rowstride  + col * bpp;
+          const guchar *b = dest + (offset + row) * bpp;
+          guchar       *d = area->dest + row * area->dest_rowstride + col * bpp;
+          gint          v;
+
           for (v = 0; v < bpp; v++)
             {
               gint value;
-              gint diff = *s - *d;
+              gint diff = o[v] - b[v];
 
               /* do tresholding */
               if (abs (2 * diff) < threshold)
                 diff = 0;
 
-              value = *s++ + amount * diff;
-              *d++ = CLAMP (value, 0, 255);
+              value = o[v] + amount * diff;
+              d[v] = CLAMP (value, 0, 255);
             }
         }
+    }
 
-      if (show_progress && row % 64 == 0)
-        gimp_progress_update ((gdouble) row / (3 * height) + 0.67);
+  g_free (dest);
+  g_free (src);
+}
 
-      gimp_pixel_rgn_set_row (destPR, dest, x1, y1 + row, width);
-    }
+/* Perform an unsharp mask on the region, given a source buffer, dest.
+ * buffer, and corner coordinates of a subregion to act upon.  Pixels
+ * around the subregion are used for blurring, but only the subregion
+ * is written.
+ */
+static void
+unsharp_buffer (GeglBuffer *src_buffer,
+                GeglBuffer *dest_buffer,
+                const Babl *format,
+                gdouble     radius,
+                gdouble     amount,
+                gint        x1,
+                gint        x2,
+                gint        y1,
+                gint        y2,
+                gboolean    show_progress)
+{
+  UnsharpBlur    blur;
+  GeglBuffer    *tmp_buffer;
+  GeglRectangle  roi;
+  GeglRectangle  tmp_roi;
+  gint           margin;
 
   if (show_progress)
-    gimp_progress_update (1.0);
+    gimp_progress_init (_("Blurring"));
 
-  g_free (dest);
-  g_free (src);
-  g_free (cmatrix);
+  margin = unsharp_blur_init (&blur, radius, amount);
+
+  gegl_rectangle_set (&roi, x1, y1, x2 - x1, y2 - y1);
+
+  /* the rows above and below the region are needed for blurring
+   * its columns
+   */
+  gegl_rectangle_set (&tmp_roi, x1, y1 - margin, x2 - x1, y2 - y1 + 2 * margin);
+  gegl_rectangle_intersect (&tmp_roi,
+                            &tmp_roi, gegl_buffer_get_extent (src_buffer));
+
+  tmp_buffer = gegl_buffer_new (&tmp_roi, format);
+
+  /* Blur the rows */
+  gimp_parallel_process (src_buffer, NULL, tmp_buffer, &tmp_roi, format,
+                         margin, 0, GEGL_ABYSS_CLAMP,
+                         tmp_roi.width, 0,
+                         unsharp_rows, &blur,
+                         0.0, show_progress ? 0.5 : 0.0);
+
+  /* Blur the cols and merge */
+  gimp_parallel_process (tmp_buffer, src_buffer, dest_buffer, &roi, format,
+                         0, margin, GEGL_ABYSS_CLAMP,
+                         0, roi.height,
+                         unsharp_cols, &blur,
+                         show_progress ? 0.5 : 0.0, show_progress ? 1.0 : 0.0);
+
+  g_object_unref (tmp_buffer);
+  g_free (blur.cmatrix);
+}
+
+static const Babl *
+unsharp_get_format (gint32 drawable_ID)
+{
+  gboolean has_alpha = gimp_drawable_has_alpha (drawable_ID);
+
+  if (gimp_drawable_is_gray (drawable_ID))
+    return babl_format (has_alpha ? "Y'A u8" : "Y' u8");
+  else
+    return babl_format (has_alpha ? "R'G'B'A u8" : "R'G'B' u8");
 }
 
 /* generates a 1-D convolution matrix to be used for each pass of
@@ -919,38 +1002,72 @@ unsharp_mask_dialog (GimpDrawable *drawable)
 static void
 preview_update (GimpPreview *preview)
 {
-  GimpDrawable *drawable;
-  gint          x1, x2;
-  gint          y1, y2;
-  gint          x, y;
-  gint          width, height;
-  gint          border;
-  GimpPixelRgn  srcPR;
-  GimpPixelRgn  destPR;
+  GimpDrawable  *drawable;
+  UnsharpBlur    blur;
+  const Babl    *format;
+  GeglBuffer    *src_buffer;
+  GeglBuffer    *dest_buffer;
+  GeglRectangle  extent;
+  GimpPixelRgn   srcPR;
+  guchar        *src;
+  guchar        *dest;
+  gint           x1, x2;
+  gint           y1, y2;
+  gint           x, y;
+  gint           width, height;
+  gint           border;
 
   drawable =
     gimp_drawable_preview_get_drawable (GIMP_DRAWABLE_PREVIEW (preview));
 
-  gimp_pixel_rgn_init (&srcPR, drawable,
-                       0, 0, drawable->width, drawable->height, FALSE, FALSE);
-  gimp_pixel_rgn_init (&destPR, drawable,
-                       0, 0, drawable->width, drawable->height, TRUE, TRUE);
-
   gimp_preview_get_position (preview, &x, &y);
   gimp_preview_get_size (preview, &width, &height);
 
-  /* enlarge the region to avoid artefacts at the edges of the preview */
-  border = 2.0 * unsharp_params.radius + 0.5;
+  /* enlarge the region by the reach of the blur to avoid artefacts
+   * at the edges of the preview
+   */
+  border = unsharp_blur_init (&blur,
+                              unsharp_params.radius, unsharp_params.amount);
+  g_free (blur.cmatrix);
+
   x1 = MAX (0, x - border);
   y1 = MAX (0, y - border);
   x2 = MIN (x + width  + border, drawable->width);
   y2 = MIN (y + height + border, drawable->height);
 
-  unsharp_region (&srcPR, &destPR, drawable->bpp,
+  /* the preview reads the drawable through a pixel region, asking for
+   * its buffer would switch the plug-in to the drawable's precision
+   */
+  src = g_new (guchar, (x2 - x1) * (y2 - y1) * drawable->bpp);
+
+  gimp_pixel_rgn_init (&srcPR, drawable,
+                       x1, y1, x2 - x1, y2 - y1, FALSE, FALSE);
+  gimp_pixel_rgn_get_rect (&srcPR, src, x1, y1, x2 - x1, y2 - y1);
+
+  format = unsharp_get_format (drawable->drawable_id);
+
+  gegl_rectangle_set (&extent, x1, y1, x2 - x1, y2 - y1);
+
+  src_buffer  = gegl_buffer_linear_new_from_data (src, format, &extent,
+                                                  GEGL_AUTO_ROWSTRIDE,
+                                                  NULL, NULL);
+  dest_buffer = gegl_buffer_new (&extent, format);
+
+  unsharp_buffer (src_buffer, dest_buffer, format,
                   unsharp_params.radius, unsharp_params.amount,
-                  x1, x2, y1, y2,
+                  x, x + width, y, y + height,
                   FALSE);
 
-  gimp_pixel_rgn_init (&destPR, drawable, x, y, width, height, FALSE, TRUE);
-  gimp_drawable_preview_draw_region (GIMP_DRAWABLE_PREVIEW (preview), &destPR);
+  dest = g_new (guchar, width * height * drawable->bpp);
+
+  gegl_buffer_get (dest_buffer, GEGL_RECTANGLE (x, y, width, height), 1.0,
+                   format, dest, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+  gimp_preview_draw_buffer (preview, dest, width * drawable->bpp);
+
+  g_object_unref (dest_buffer);
+  g_object_unref (src_buffer);
+
+  g_free (dest);
+  g_free (src);
 }
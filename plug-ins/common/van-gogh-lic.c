@@ -83,6 +83,13 @@ typedef struct
 
 static LicValues licvals;
 
+typedef struct
+{
+  GimpParallelSource *src;
+  const guchar       *scalarfield;
+  gboolean            rotate;
+} LicParams;
+
 static gdouble l      = 10.0;
 static gdouble dx     =  2.0;
 static gdouble dy     =  2.0;
@@ -90,8 +97,6 @@ static gdouble minv   = -2.5;
 static gdouble maxv   =  2.5;
 static gdouble isteps = 20.0;
 
-static gboolean source_drw_has_alpha = FALSE;
-
 static gint    effect_width, effect_height;
 static gint    border_x1, border_y1, border_x2, border_y2;
 
@@ -101,30 +106,6 @@ static GtkWidget *dialog;
 /* Convenience routines */
 /************************/
 
-static void
-peek (GimpPixelRgn *src_rgn,
-      gint          x,
-      gint          y,
-      GimpRGB      *color)
-{
-  static guchar data[4] = { 0, };
-
-  gimp_pixel_rgn_get_pixel (src_rgn, data, x, y);
-  gimp_rgba_set_uchar (color, data[0], data[1], data[2], data[3]);
-}
-
-static void
-poke (GimpPixelRgn *dest_rgn,
-      gint          x,
-      gint          y,
-      GimpRGB      *color)
-{
-  static guchar data[4];
-
-  gimp_rgba_get_uchar (color, &data[0], &data[1], &data[2], &data[3]);
-  gimp_pixel_rgn_set_pixel (dest_rgn, data, x, y);
-}
-
 static gint
 peekmap (const guchar *image,
          gint          x,
@@ -327,58 +308,29 @@ lic_noise (gint    x,
 }
 
 static void
-getpixel (GimpPixelRgn *src_rgn,
-          GimpRGB      *p,
-          gdouble       u,
-          gdouble       v)
+getpixel (const GimpParallelSource *src,
+          gfloat                   *p,
+          gdouble                   u,
+          gdouble                   v)
 {
-  register gint x1, y1, x2, y2;
-  gint width, height;
-  static GimpRGB pp[4];
-
-  width = src_rgn->w;
-  height = src_rgn->h;
-
-  x1 = (gint)u;
-  y1 = (gint)v;
-
-  if (x1 < 0)
-    x1 = width - (-x1 % width);
-  else
-    x1 = x1 % width;
-
-  if (y1 < 0)
-    y1 = height - (-y1 % height);
-  else
-    y1 = y1 % height;
-
-  x2 = (x1 + 1) % width;
-  y2 = (y1 + 1) % height;
-
-  peek (src_rgn, x1, y1, &pp[0]);
-  peek (src_rgn, x2, y1, &pp[1]);
-  peek (src_rgn, x1, y2, &pp[2]);
-  peek (src_rgn, x2, y2, &pp[3]);
-
-  if (source_drw_has_alpha)
-    *p = gimp_bilinear_rgba (u, v, pp);
-  else
-    *p = gimp_bilinear_rgb (u, v, pp);
+  gimp_parallel_source_sample (src, src->rect.x + u, src->rect.y + v, p);
 }
 
 static void
-lic_image (GimpPixelRgn *src_rgn,
-           gint          x,
-           gint          y,
-           gdouble       vx,
-           gdouble       vy,
-           GimpRGB      *color)
+lic_image (const GimpParallelSource *src,
+           gint                      x,
+           gint                      y,
+           gdouble                   vx,
+           gdouble                   vy,
+           gfloat                   *color)
 {
   gdouble u, step = 2.0 * l / isteps;
   gdouble xx = (gdouble) x, yy = (gdouble) y;
-  gdouble c, s;
-  GimpRGB col = { 0, 0, 0, 0 };
-  GimpRGB col1, col2, col3;
+  gdouble c, s, f;
+  gdouble col[4] = { 0.0, 0.0, 0.0, 0.0 };
+  gfloat  col1[4], col2[4];
+  gint    n_components = src->n_components;
+  gint    k;
 
   /* Get vector at x,y */
   /* ================= */
@@ -389,134 +341,127 @@ lic_image (GimpPixelRgn *src_rgn,
   /* Calculate integral numerically */
   /* ============================== */
 
-  getpixel (src_rgn, &col1, xx + l * c, yy + l * s);
-  if (source_drw_has_alpha)
-    gimp_rgba_multiply (&col1, filter (-l));
-  else
-    gimp_rgb_multiply (&col1, filter (-l));
+  getpixel (src, col1, xx + l * c, yy + l * s);
+
+  f = filter (-l);
+
+  for (k = 0; k < n_components; k++)
+    col1[k] *= f;
 
   for (u = -l + step; u <= l; u += step)
     {
-      getpixel (src_rgn, &col2, xx - u * c, yy - u * s);
-      if (source_drw_has_alpha)
-        {
-          gimp_rgba_multiply (&col2, filter (u));
+      getpixel (src, col2, xx - u * c, yy - u * s);
 
-          col3 = col1;
-          gimp_rgba_add (&col3, &col2);
-          gimp_rgba_multiply (&col3, 0.5 * step);
-          gimp_rgba_add (&col, &col3);
-        }
-      else
-        {
-          gimp_rgb_multiply (&col2, filter (u));
+      f = filter (u);
 
-          col3 = col1;
-          gimp_rgb_add (&col3, &col2);
-          gimp_rgb_multiply (&col3, 0.5 * step);
-          gimp_rgb_add (&col, &col3);
+      for (k = 0; k < n_components; k++)
+        {
+          col2[k] *= f;
+          col[k]  += (col1[k] + col2[k]) * 0.5 * step;
+          col1[k]  = col2[k];
         }
-      col1 = col2;
     }
-  if (source_drw_has_alpha)
-    gimp_rgba_multiply (&col, 1.0 / l);
-  else
-    gimp_rgb_multiply (&col, 1.0 / l);
-  gimp_rgb_clamp (&col);
 
-  *color = col;
+  for (k = 0; k < n_components; k++)
+    color[k] = CLAMP (col[k] / l, 0.0, 1.0);
 }
 
 static guchar*
-rgb_to_hsl (GimpDrawable     *drawable,
+rgb_to_hsl (gint32            drawable_id,
             LICEffectChannel  effect_channel)
 {
-  guchar       *themap, data[4];
-  gint          x, y;
+  GeglBuffer   *buffer;
+  guchar       *themap;
+  gfloat       *data;
+  gfloat       *p;
   GimpRGB       color;
   GimpHSL       color_hsl;
   gdouble       val = 0.0;
-  glong         maxc, index = 0;
-  GimpPixelRgn  region;
+  glong         maxc, index;
   GRand        *gr;
 
   gr = g_rand_new ();
 
-  maxc = drawable->width * drawable->height;
-
-  gimp_pixel_rgn_init (&region, drawable, border_x1, border_y1,
-                       border_x2 - border_x1, border_y2 - border_y1, FALSE, FALSE);
+  maxc = (glong) effect_width * effect_height;
 
   themap = g_new (guchar, maxc);
+  data   = g_new (gfloat, maxc * 3);
 
-  for (y = 0; y < region.h; y++)
-    {
-      for (x = 0; x < region.w; x++)
-        {
-          data[3] = 255;
+  buffer = gimp_drawable_get_buffer (drawable_id);
 
-          gimp_pixel_rgn_get_pixel (&region, data, x, y);
-          gimp_rgba_set_uchar (&color, data[0], data[1], data[2], data[3]);
-          gimp_rgb_to_hsl (&color, &color_hsl);
+  gegl_buffer_get (buffer, GEGL_RECTANGLE (0, 0, effect_width, effect_height),
+                   1.0, babl_format ("R'G'B' float"),
+                   data, GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
 
-          switch (effect_channel)
-            {
-            case LIC_HUE:
-              val = color_hsl.h * 255;
-              break;
-            case LIC_SATURATION:
-              val = color_hsl.s * 255;
-              break;
-            case LIC_BRIGHTNESS:
-              val = color_hsl.l * 255;
-              break;
-            }
+  g_object_unref (buffer);
 
-          /* add some random to avoid unstructured areas. */
-          val += g_rand_double_range (gr, -1.0, 1.0);
+  for (index = 0, p = data; index < maxc; index++, p += 3)
+    {
+      gimp_rgba_set (&color, p[0], p[1], p[2], 1.0);
+      gimp_rgb_to_hsl (&color, &color_hsl);
 
-          themap[index++] = (guchar) CLAMP0255 (RINT (val));
+      switch (effect_channel)
+        {
+        case LIC_HUE:
+          val = color_hsl.h * 255;
+          break;
+        case LIC_SATURATION:
+          val = color_hsl.s * 255;
+          break;
+        case LIC_BRIGHTNESS:
+          val = color_hsl.l * 255;
+          break;
         }
+
+      /* add some random to avoid unstructured areas. */
+      val += g_rand_double_range (gr, -1.0, 1.0);
+
+      themap[index] = (guchar) CLAMP0255 (RINT (val));
     }
 
+  g_free (data);
   g_rand_free (gr);
 
   return themap;
 }
 
-
+/* The LIC of each pixel only reads the source, the scalar field and
+ * the noise vectors, so the rows are computed in parallel.  The
+ * source is the selection bounds of the drawable, which repeat
+ * outside, like the scalar field.  The scalar field covers the whole
+ * effect image, so it is looked up at the pixel's image coordinates,
+ * while the noise and the source are walked from the selection's
+ * origin.
+ */
 static void
-compute_lic (GimpDrawable *drawable,
-             const guchar *scalarfield,
-             gboolean      rotate)
+compute_lic_area (const GimpParallelArea *area,
+                  gpointer                data)
 {
-  gint xcount, ycount;
-  GimpRGB color;
-  gdouble vx, vy, tmp;
-  GimpPixelRgn src_rgn, dest_rgn;
-
-  gimp_pixel_rgn_init (&src_rgn, drawable,
-                       border_x1, border_y1,
-                       border_x2 - border_x1,
-                       border_y2 - border_y1, FALSE, FALSE);
-
-  gimp_pixel_rgn_init (&dest_rgn, drawable,
-                       border_x1, border_y1,
-                       border_x2 - border_x1,
-                       border_y2 - border_y1, TRUE, TRUE);
-
-  for (ycount = 0; ycount < src_rgn.h; ycount++)
+  const LicParams          *params       = data;
+  const GimpParallelSource *src          = params->src;
+  gint                      n_components = src->n_components;
+  gint                      x, y;
+  gint                      k;
+  gdouble                   vx, vy, tmp;
+
+  for (y = area->roi.y; y < area->roi.y + area->roi.height; y++)
     {
-      for (xcount = 0; xcount < src_rgn.w; xcount++)
+      gfloat *dest = (gfloat *) (area->dest +
+                                 (y - area->roi.y) * area->dest_rowstride);
+
+      for (x = area->roi.x; x < area->roi.x + area->roi.width; x++)
         {
+          gint xcount = x - src->rect.x;
+          gint ycount = y - src->rect.y;
+
           /* Get derivative at (x,y) and normalize it */
           /* ============================================================== */
 
-          vx = gradx (scalarfield, xcount, ycount);
-          vy = grady (scalarfield, xcount, ycount);
+          vx = gradx (params->scalarfield, x, y);
+          vy = grady (params->scalarfield, x, y);
 
           /* Rotate if needed */
-          if (rotate)
+          if (params->rotate)
             {
               tmp = vy;
               vy = -vx;
@@ -536,30 +481,65 @@ compute_lic (GimpDrawable *drawable,
 
           if (licvals.effect_convolve == 0)
             {
-              peek (&src_rgn, xcount, ycount, &color);
+              gimp_parallel_source_get_pixel (src, x, y, dest);
               tmp = lic_noise (xcount, ycount, vx, vy);
-              if (source_drw_has_alpha)
-                gimp_rgba_multiply (&color, tmp);
-              else
-                gimp_rgb_multiply (&color, tmp);
+
+              for (k = 0; k < n_components; k++)
+                dest[k] *= tmp;
             }
           else
             {
-              lic_image (&src_rgn, xcount, ycount, vx, vy, &color);
+              lic_image (src, xcount, ycount, vx, vy, dest);
             }
-          poke (&dest_rgn, xcount, ycount, &color);
-        }
 
-      gimp_progress_update ((gfloat) ycount / (gfloat) src_rgn.h);
+          dest += n_components;
+        }
     }
-  gimp_progress_update (1.0);
+}
+
+static void
+compute_lic (GimpDrawable *drawable,
+             const guchar *scalarfield,
+             gboolean      rotate)
+{
+  LicParams      params;
+  GeglBuffer    *src_buffer;
+  GeglBuffer    *dest_buffer;
+  const Babl    *format;
+  GeglRectangle  roi;
+
+  gegl_rectangle_set (&roi,
+                      border_x1, border_y1,
+                      border_x2 - border_x1, border_y2 - border_y1);
+
+  if (gimp_drawable_has_alpha (drawable->drawable_id))
+    format = babl_format ("R'G'B'A float");
+  else
+    format = babl_format ("R'G'B' float");
+
+  src_buffer  = gimp_drawable_get_buffer (drawable->drawable_id);
+  dest_buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
+
+  params.src         = gimp_parallel_source_new (src_buffer, &roi, format,
+                                                 GEGL_ABYSS_LOOP);
+  params.scalarfield = scalarfield;
+  params.rotate      = rotate;
+
+  gimp_parallel_process (NULL, NULL, dest_buffer, &roi, format,
+                         0, 0, GEGL_ABYSS_NONE, roi.width, 0,
+                         compute_lic_area, &params,
+                         0.0, 1.0);
+
+  gimp_parallel_source_free (params.src);
+
+  g_object_unref (src_buffer);
+  g_object_unref (dest_buffer);
 }
 
 static void
 compute_image (GimpDrawable *drawable)
 {
-  GimpDrawable *effect;
-  guchar       *scalarfield = NULL;
+  guchar *scalarfield = NULL;
 
   /* Get some useful info on the input drawable */
   /* ========================================== */
@@ -580,23 +560,19 @@ compute_image (GimpDrawable *drawable)
   maxv = licvals.maxv / 10.0;
   isteps = licvals.intsteps;
 
-  source_drw_has_alpha = gimp_drawable_has_alpha (drawable->drawable_id);
-
-  effect = gimp_drawable_get (licvals.effect_image_id);
-
-  effect_width = effect->width;
-  effect_height = effect->height;
+  effect_width  = gimp_drawable_width (licvals.effect_image_id);
+  effect_height = gimp_drawable_height (licvals.effect_image_id);
 
   switch (licvals.effect_channel)
     {
       case 0:
-        scalarfield = rgb_to_hsl (effect, LIC_HUE);
+        scalarfield = rgb_to_hsl (licvals.effect_image_id, LIC_HUE);
         break;
       case 1:
-        scalarfield = rgb_to_hsl (effect, LIC_SATURATION);
+        scalarfield = rgb_to_hsl (licvals.effect_image_id, LIC_SATURATION);
         break;
       case 2:
-        scalarfield = rgb_to_hsl (effect, LIC_BRIGHTNESS);
+        scalarfield = rgb_to_hsl (licvals.effect_image_id, LIC_BRIGHTNESS);
         break;
     }
 
@@ -607,7 +583,6 @@ compute_image (GimpDrawable *drawable)
   /* Update image */
   /* ============ */
 
-  gimp_drawable_flush (drawable);
   gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
   gimp_drawable_update (drawable->drawable_id, border_x1, border_y1,
                         border_x2 - border_x1, border_y2 - border_y1);
@@ -839,6 +814,7 @@ run (const gchar      *name,
   run_mode = param[0].data.d_int32;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   *nreturn_vals = 1;
   *return_vals  = values;
@@ -65,6 +65,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
 
@@ -106,6 +108,18 @@ typedef struct
   gdouble vector_angle;
 } WarpVals;
 
+typedef struct
+{
+  GimpParallelSource *src;
+  GimpParallelSource *map_x;
+  GimpParallelSource *map_y;
+  GimpParallelSource *mag;
+  gint                width;
+  gint                height;
+  gfloat              src_outside[4];
+  gfloat              map_outside[4];
+} WarpParams;
+
 
 /*
  * Function prototypes.
@@ -130,37 +144,36 @@ static void      diff_prepare_row (GimpPixelRgn *pixel_rgn,
                                    gint          y,
                                    gint          w);
 
-static void      warp_one         (GimpDrawable *draw,
-                                   GimpDrawable *new,
-                                   GimpDrawable *map_x,
-                                   GimpDrawable *map_y,
-                                   GimpDrawable *mag_draw,
-                                   gboolean      first_time,
-                                   gint          step);
+static void      warp_one         (const GimpParallelArea *area,
+                                   gpointer                data);
 
 static void      warp        (GimpDrawable *drawable);
 
 static gboolean  warp_dialog (GimpDrawable *drawable);
-static GimpTile *warp_pixel  (GimpDrawable *drawable,
-                              GimpTile     *tile,
-                              gint          width,
-                              gint          height,
-                              gint          x1,
-                              gint          y1,
-                              gint          x2,
-                              gint          y2,
-                              gint          x,
-                              gint          y,
-                              gint         *row,
-                              gint         *col,
-                              guchar       *pixel);
+static void      warp_pixel  (const WarpParams         *params,
+                              const GimpParallelSource *source,
+                              const gfloat             *outside,
+                              gint                      x,
+                              gint                      y,
+                              gfloat                   *pixel);
+static void      warp_sample (const WarpParams         *params,
+                              const GimpParallelSource *source,
+                              const gfloat             *outside,
+                              gdouble                   x,
+                              gdouble                   y,
+                              gfloat                   *pixel);
+static gdouble   warp_map_sample (const WarpParams         *params,
+                                  const GimpParallelSource *map,
+                                  gdouble                   x,
+                                  gdouble                   y);
 
 static gboolean  warp_map_constrain       (gint32     image_id,
                                            gint32     drawable_id,
                                            gpointer   data);
-static gdouble   warp_map_mag_give_value  (guchar    *pt,
-                                           gint       alpha,
-                                           gint       bytes);
+static gdouble   warp_map_mag_give_value  (const gfloat *pixel);
+static gint      warp_map_value           (const gfloat *pixel);
+static void      warp_get_outside_pixel   (const Babl   *format,
+                                           gfloat       *pixel);
 
 /* -------------------------------------------------------------------------- */
 /*   Variables global over entire plug-in scope                               */
@@ -194,8 +207,6 @@ static WarpVals dvals =
 
 /* -------------------------------------------------------------------------- */
 
-static gint         progress = 0;              /* progress indicator bar      */
-static guint        tile_width, tile_height;   /* size of an image tile       */
 static GimpRunMode  run_mode;                  /* interactive, non-, etc.     */
 static guchar       color_pixel[4] = {0, 0, 0, 255};  /* current fg color     */
 
@@ -260,9 +271,7 @@ run (const gchar      *name,
   run_mode = param[0].data.d_int32;
 
   INIT_I18N ();
-
-  tile_width  = gimp_tile_width ();    /* initialize some globals */
-  tile_height = gimp_tile_height ();
+  gegl_init (NULL, NULL);
 
   /* get currently selected foreground pixel color */
   gimp_context_get_foreground (&color);
@@ -1203,23 +1212,21 @@ diff (GimpDrawable *drawable,
 static void
 warp (GimpDrawable *orig_draw)
 {
-  GimpDrawable *disp_map;    /* Displacement map, ie, control array */
-  GimpDrawable *mag_draw;    /* Magnitude multiplier factor map */
-  GimpDrawable *map_x;
-  GimpDrawable *map_y;
-  gboolean      first_time = TRUE;
-  gint          width;
-  gint          height;
-  gint          x1, y1, x2, y2;
-  gint32        xdlayer = -1;
-  gint32        ydlayer = -1;
-  gint32        image_ID;
+  GimpDrawable  *disp_map;   /* Displacement map, ie, control array */
+  WarpParams     params;
+  GeglBuffer    *buffer;
+  GeglRectangle  roi;
+  const Babl    *format;
+  const Babl    *map_format = babl_format ("R'G'B' float");
+  const Babl    *mag_format = babl_format ("R'G'B'A float");
+  gboolean       has_alpha;
+  gboolean       first_time = TRUE;
+  gint32         xdlayer = -1;
+  gint32         ydlayer = -1;
+  gint32         image_ID;
 
   /* index var. over all "warp" Displacement iterations */
-  gint          warp_iter;
-
-  disp_map = gimp_drawable_get (dvals.warp_map);
-  mag_draw = gimp_drawable_get (dvals.mag_map);
+  gint           warp_iter;
 
   /* calculate new X,Y Displacement image maps */
 
@@ -1227,31 +1234,77 @@ warp (GimpDrawable *orig_draw)
 
   /* Get selection area */
   if (! gimp_drawable_mask_intersect (orig_draw->drawable_id,
-                                      &x1, &y1, &width, &height))
+                                      &roi.x, &roi.y,
+                                      &roi.width, &roi.height))
     return;
 
-  x2 = x1 + width;
-  y2 = y1 + height;
-
-  width  = orig_draw->width;
-  height = orig_draw->height;
-
   /* generate x,y differential images (arrays) */
+  disp_map = gimp_drawable_get (dvals.warp_map);
+
   diff (disp_map, &xdlayer, &ydlayer);
 
-  map_x = gimp_drawable_get (xdlayer);
-  map_y = gimp_drawable_get (ydlayer);
+  gimp_drawable_detach (disp_map);
+
+  has_alpha = gimp_drawable_has_alpha (orig_draw->drawable_id);
+
+  if (gimp_drawable_is_gray (orig_draw->drawable_id))
+    format = babl_format (has_alpha ? "Y'A float" : "Y' float");
+  else
+    format = babl_format (has_alpha ? "R'G'B'A float" : "R'G'B' float");
+
+  params.width  = orig_draw->width;
+  params.height = orig_draw->height;
+
+  /*  everything warp_pixel() finds inside the selection bounds is read
+   *  into memory once, the source drawable again for every flow step
+   */
+  buffer = gimp_drawable_get_buffer (xdlayer);
+  params.map_x = gimp_parallel_source_new (buffer, &roi, map_format,
+                                           GEGL_ABYSS_NONE);
+  g_object_unref (buffer);
+
+  buffer = gimp_drawable_get_buffer (ydlayer);
+  params.map_y = gimp_parallel_source_new (buffer, &roi, map_format,
+                                           GEGL_ABYSS_NONE);
+  g_object_unref (buffer);
+
+  params.mag = NULL;
+
+  if (dvals.mag_use)
+    {
+      buffer = gimp_drawable_get_buffer (dvals.mag_map);
+      params.mag = gimp_parallel_source_new (buffer, &roi, mag_format,
+                                             GEGL_ABYSS_NONE);
+      g_object_unref (buffer);
+    }
+
+  warp_get_outside_pixel (map_format, params.map_outside);
+  warp_get_outside_pixel (format, params.src_outside);
 
   for (warp_iter = 0; warp_iter < dvals.iter; warp_iter++)
     {
       gimp_progress_init_printf (_("Flow step %d"), warp_iter+1);
-      progress = 0;
 
-      warp_one (orig_draw, orig_draw,
-                map_x, map_y, mag_draw, first_time, warp_iter);
+      buffer = gimp_drawable_get_buffer (orig_draw->drawable_id);
+      params.src = gimp_parallel_source_new (buffer, &roi, format,
+                                             GEGL_ABYSS_NONE);
+      g_object_unref (buffer);
+
+      buffer = gimp_drawable_get_shadow_buffer (orig_draw->drawable_id);
+
+      gimp_parallel_process (NULL, NULL, buffer, &roi, format,
+                             0, 0, GEGL_ABYSS_NONE, roi.width, 0,
+                             warp_one, &params,
+                             0.0, 1.0);
 
+      g_object_unref (buffer);
+
+      gimp_parallel_source_free (params.src);
+
+      /* only push undo-stack the first time through. Thanks Spencer! */
+      gimp_drawable_merge_shadow (orig_draw->drawable_id, first_time);
       gimp_drawable_update (orig_draw->drawable_id,
-                            x1, y1, (x2 - x1), (y2 - y1));
+                            roi.x, roi.y, roi.width, roi.height);
 
       if (run_mode != GIMP_RUN_NONINTERACTIVE)
         gimp_displays_flush ();
@@ -1259,419 +1312,246 @@ warp (GimpDrawable *orig_draw)
       first_time = FALSE;
     }
 
-  image_ID = gimp_item_get_image (map_x->drawable_id);
+  gimp_parallel_source_free (params.map_x);
+  gimp_parallel_source_free (params.map_y);
+
+  if (params.mag)
+    gimp_parallel_source_free (params.mag);
 
-  gimp_drawable_detach (map_x);
-  gimp_drawable_detach (map_y);
+  image_ID = gimp_item_get_image (xdlayer);
 
   gimp_image_delete (image_ID);
 }
 
 /* -------------------------------------------------------------------------- */
 
+/* One flow step for the rows of an area.  Every pixel only reads the
+ * source of this step and the maps, so areas are warped in parallel,
+ * each with its own random numbers for the dither.
+ */
 static void
-warp_one (GimpDrawable *draw,
-          GimpDrawable *new,
-          GimpDrawable *map_x,
-          GimpDrawable *map_y,
-          GimpDrawable *mag_draw,
-          gboolean      first_time,
-          gint          step)
+warp_one (const GimpParallelArea *area,
+          gpointer                data)
 {
-  GimpPixelRgn src_rgn;
-  GimpPixelRgn dest_rgn;
-  GimpPixelRgn map_x_rgn;
-  GimpPixelRgn map_y_rgn;
-  GimpPixelRgn mag_rgn;
-  GimpTile   * tile = NULL;
-  GimpTile   * xtile = NULL;
-  GimpTile   * ytile = NULL;
-  gint row=-1;
-  gint xrow=-1;
-  gint yrow=-1;
-  gint col=-1;
-  gint xcol=-1;
-  gint ycol=-1;
-
-  gpointer  pr;
-
-  gint    width = -1;
-  gint    height = -1;
-  gint    dest_bytes=-1;
-
-  guchar *destrow, *dest;
-  guchar *srcrow;
-  guchar *mxrow=NULL, *mx;  /* NULL ptr. to make gcc's -Wall fn. happy */
-  guchar *myrow=NULL, *my;
-
-  guchar *mmagrow=NULL, *mmag=NULL;
-  guchar  pixel[4][4];
-  gint    x1, y1, x2, y2;
-  gint    x, y;
-  gint    max_progress;
+  const WarpParams *params       = data;
+  gint              n_components = params->src->n_components;
+  gint              x, y;
 
   gdouble needx, needy;
-  gdouble xval=0;      /* initialize to quiet compiler grumbles */
-  gdouble yval=0;      /* interpolated vector displacement */
+  gdouble xval;            /* interpolated vector displacement */
+  gdouble yval;
   gdouble scalefac;        /* multiplier for vector displacement scaling */
   gdouble dscalefac;       /* multiplier for incremental displacement vectors */
-  gint    xi, yi;
   gint    substep;         /* loop variable counting displacement vector substeps */
+  gfloat  pixel[4];
 
-  guchar  values[4];
-  guint32 ivalues[4];
-  guchar  val;
-
-  gint k;
-
-  gdouble dx, dy;           /* X and Y Displacement, integer from GRAY map */
-
-  gint    mmag_alpha = 0;
-  gint    xm_bytes = 1;
-  gint    ym_bytes = 1;
-  gint    mmag_bytes = 1;
+  gdouble dx, dy;          /* X and Y Displacement, integer from GRAY map */
 
   GRand  *gr;
 
   gr = g_rand_new (); /* Seed Pseudo Random Number Generator */
 
-  /* ================ Outer Loop calculation ================================ */
-
-  /* Get selection area */
-
-  if (! gimp_drawable_mask_intersect (draw->drawable_id,
-                                      &x1, &y1, &width, &height))
-    return;
-
-  x2 = x1 + width;
-  y2 = y1 + height;
-
-  width  = draw->width;
-  height = draw->height;
-  dest_bytes = draw->bpp;
-
-   max_progress = (x2 - x1) * (y2 - y1);
-
-
-   /*  --------- Register the (many) pixel regions ----------  */
-
-   gimp_pixel_rgn_init (&src_rgn, draw,
-                        x1, y1, (x2 - x1), (y2 - y1), FALSE, FALSE);
-
-   /* only push undo-stack the first time through. Thanks Spencer! */
-   if (first_time)
-     gimp_pixel_rgn_init (&dest_rgn,
-                          new, x1, y1, (x2 - x1), (y2 - y1), TRUE, TRUE);
-   else
-     gimp_pixel_rgn_init (&dest_rgn,
-                          new, x1, y1, (x2 - x1), (y2 - y1), TRUE, TRUE);
-
-
-   gimp_pixel_rgn_init (&map_x_rgn,
-                        map_x, x1, y1, (x2 - x1), (y2 - y1), FALSE, FALSE);
-
-   xm_bytes = gimp_drawable_bpp(map_x->drawable_id);
-
-   gimp_pixel_rgn_init (&map_y_rgn,
-                        map_y, x1, y1, (x2 - x1), (y2 - y1), FALSE, FALSE);
-
-   ym_bytes = gimp_drawable_bpp(map_y->drawable_id);
-
-
-   if (dvals.mag_use)
-     {
-       gimp_pixel_rgn_init (&mag_rgn,
-                            mag_draw, x1, y1, (x2 - x1), (y2 - y1), FALSE, FALSE);
-       if (gimp_drawable_has_alpha(mag_draw->drawable_id))
-         mmag_alpha = 1;
-
-       mmag_bytes = gimp_drawable_bpp(mag_draw->drawable_id);
-
-       pr = gimp_pixel_rgns_register (5,
-                                      &src_rgn, &dest_rgn,
-                                      &map_x_rgn, &map_y_rgn, &mag_rgn);
-     }
-   else
-     {
-       pr = gimp_pixel_rgns_register (4,
-                                      &src_rgn, &dest_rgn,
-                                      &map_x_rgn, &map_y_rgn);
-     }
+  /* substep displacement vector scale factor */
+  dscalefac = dvals.amount / (256 * 127.5 * dvals.substeps);
 
-   /* substep displacement vector scale factor */
-   dscalefac = dvals.amount / (256 * 127.5 * dvals.substeps);
-
-   for (pr = pr; pr != NULL; pr = gimp_pixel_rgns_process (pr))
-     {
-       srcrow = src_rgn.data;
-       destrow = dest_rgn.data;
-       mxrow = map_x_rgn.data;
-       myrow = map_y_rgn.data;
-
-       if (dvals.mag_use)
-         mmagrow = mag_rgn.data;
-
-       /* loop over destination pixels */
-       for (y = dest_rgn.y; y < (dest_rgn.y + dest_rgn.h); y++)
-         {
-           dest = destrow;
-           mx = mxrow;
-           my = myrow;
-
-           if (dvals.mag_use == TRUE)
-             mmag = mmagrow;
+  /* loop over destination pixels */
+  for (y = area->roi.y; y < area->roi.y + area->roi.height; y++)
+    {
+      gfloat *dest = (gfloat *) (area->dest +
+                                 (y - area->roi.y) * area->dest_rowstride);
 
-           for (x = dest_rgn.x; x < (dest_rgn.x + dest_rgn.w); x++)
-             {
-               /* ----- Find displacement vector (amnt_x, amnt_y) ------------ */
+      for (x = area->roi.x; x < area->roi.x + area->roi.width; x++)
+        {
+          /* ----- Find displacement vector (amnt_x, amnt_y) ------------ */
 
-               dx = dscalefac * ((256.0 * mx[0]) + mx[1] -32768);  /* 16-bit values */
-               dy = dscalefac * ((256.0 * my[0]) + my[1] -32768);
+          gimp_parallel_source_get_pixel (params->map_x, x, y, pixel);
+          dx = dscalefac * (warp_map_value (pixel) - 32768);  /* 16-bit values */
 
-               if (dvals.mag_use)
-                 {
-                   scalefac = warp_map_mag_give_value (mmag,
-                                                       mmag_alpha,
-                                                       mmag_bytes) / 255.0;
-                   dx *= scalefac;
-                   dy *= scalefac;
-                 }
+          gimp_parallel_source_get_pixel (params->map_y, x, y, pixel);
+          dy = dscalefac * (warp_map_value (pixel) - 32768);
 
-               if (dvals.dither != 0.0)
-                 {       /* random dither is +/- dvals.dither pixels */
-                   dx += g_rand_double_range (gr, -dvals.dither, dvals.dither);
-                   dy += g_rand_double_range (gr, -dvals.dither, dvals.dither);
-                 }
+          if (params->mag)
+            {
+              gimp_parallel_source_get_pixel (params->mag, x, y, pixel);
+              scalefac = warp_map_mag_give_value (pixel);
+              dx *= scalefac;
+              dy *= scalefac;
+            }
 
-              if (dvals.substeps != 1)
-                {   /* trace (substeps) iterations of displacement vector */
-                  for (substep = 1; substep < dvals.substeps; substep++)
-                    {
-                      /* In this (substep) loop, (x,y) remain fixed. (dx,dy) vary each step. */
-                      needx = x + dx;
-                      needy = y + dy;
-
-                      if (needx >= 0.0)
-                        xi = (gint) needx;
-                      else
-                        xi = -((gint) -needx + 1);
-
-                      if (needy >= 0.0)
-                        yi = (gint) needy;
-                      else
-                        yi = -((gint) -needy + 1);
-
-                      /* get 4 neighboring DX values from DiffX drawable for linear interpolation */
-                      xtile = warp_pixel (map_x, xtile, width, height, x1, y1, x2, y2, xi, yi, &xrow, &xcol, pixel[0]);
-                      xtile = warp_pixel (map_x, xtile, width, height, x1, y1, x2, y2, xi + 1, yi, &xrow, &xcol, pixel[1]);
-                      xtile = warp_pixel (map_x, xtile, width, height, x1, y1, x2, y2, xi, yi + 1, &xrow, &xcol, pixel[2]);
-                      xtile = warp_pixel (map_x, xtile, width, height, x1, y1, x2, y2, xi + 1, yi + 1, &xrow, &xcol, pixel[3]);
-
-                      ivalues[0] = 256 * pixel[0][0] + pixel[0][1];
-                      ivalues[1] = 256 * pixel[1][0] + pixel[1][1];
-                      ivalues[2] = 256 * pixel[2][0] + pixel[2][1];
-                      ivalues[3] = 256 * pixel[3][0] + pixel[3][1];
-
-                      xval = gimp_bilinear_32 (needx, needy, ivalues);
-
-                      /* get 4 neighboring DY values from DiffY drawable for linear interpolation */
-                      ytile = warp_pixel (map_y, ytile, width, height, x1, y1, x2, y2, xi, yi, &yrow, &ycol, pixel[0]);
-                      ytile = warp_pixel (map_y, ytile, width, height, x1, y1, x2, y2, xi + 1, yi, &yrow, &ycol, pixel[1]);
-                      ytile = warp_pixel (map_y, ytile, width, height, x1, y1, x2, y2, xi, yi + 1, &yrow, &ycol, pixel[2]);
-                      ytile = warp_pixel (map_y, ytile, width, height, x1, y1, x2, y2, xi + 1, yi + 1, &yrow, &ycol, pixel[3]);
-
-                      ivalues[0] = 256 * pixel[0][0] + pixel[0][1];
-                      ivalues[1] = 256 * pixel[1][0] + pixel[1][1];
-                      ivalues[2] = 256 * pixel[2][0] + pixel[2][1];
-                      ivalues[3] = 256 * pixel[3][0] + pixel[3][1];
-
-                      yval = gimp_bilinear_32 (needx, needy, ivalues);
-
-                      /* move displacement vector to this new value */
-                      dx += dscalefac * (xval - 32768);
-                      dy += dscalefac * (yval - 32768);
-
-                    } /* for (substep) */
-                } /* if (substeps != 0) */
-
-              /* --------------------------------------------------------- */
+          if (dvals.dither != 0.0)
+            {       /* random dither is +/- dvals.dither pixels */
+              dx += g_rand_double_range (gr, -dvals.dither, dvals.dither);
+              dy += g_rand_double_range (gr, -dvals.dither, dvals.dither);
+            }
 
+          /* trace (substeps) iterations of displacement vector */
+          for (substep = 1; substep < dvals.substeps; substep++)
+            {
+              /* In this (substep) loop, (x,y) remain fixed. (dx,dy) vary each step. */
               needx = x + dx;
               needy = y + dy;
 
-              mx += xm_bytes;         /* pointers into x,y displacement maps */
-              my += ym_bytes;
-
-              if (dvals.mag_use == TRUE)
-                mmag += mmag_bytes;
-
-              /* Calculations complete; now copy the proper pixel */
-
-              if (needx >= 0.0)
-                xi = (gint) needx;
-              else
-                xi = -((gint) -needx + 1);
-
-              if (needy >= 0.0)
-                yi = (gint) needy;
-              else
-                yi = -((gint) -needy + 1);
-
-              /* get 4 neighboring pixel values from source drawable for linear interpolation */
-              tile = warp_pixel (draw, tile, width, height, x1, y1, x2, y2, xi, yi, &row, &col, pixel[0]);
-              tile = warp_pixel (draw, tile, width, height, x1, y1, x2, y2, xi + 1, yi, &row, &col, pixel[1]);
-              tile = warp_pixel (draw, tile, width, height, x1, y1, x2, y2, xi, yi + 1, &row, &col, pixel[2]);
-              tile = warp_pixel (draw, tile, width, height, x1, y1, x2, y2, xi + 1, yi + 1, &row, &col, pixel[3]);
+              /* linear interpolation of the 4 neighboring DX and DY values */
+              xval = warp_map_sample (params, params->map_x, needx, needy);
+              yval = warp_map_sample (params, params->map_y, needx, needy);
 
-              for (k = 0; k < dest_bytes; k++)
-                {
-                  values[0] = pixel[0][k];
-                  values[1] = pixel[1][k];
-                  values[2] = pixel[2][k];
-                  values[3] = pixel[3][k];
-
-                  val = gimp_bilinear_8 (needx, needy, values);
-
-                  *dest++ = val;
-                } /* for k */
-
-            } /* for x */
-
-          /*      srcrow += src_rgn.rowstride; */
-          srcrow += src_rgn.rowstride;
-          destrow += dest_rgn.rowstride;
-          mxrow += map_x_rgn.rowstride;
-          myrow += map_y_rgn.rowstride;
-
-          if (dvals.mag_use == TRUE)
-            mmagrow += mag_rgn.rowstride;
-
-        } /* for y */
-
-      progress += (dest_rgn.w * dest_rgn.h);
-      gimp_progress_update ((double) progress / (double) max_progress);
-
-    } /* for pr */
-   gimp_progress_update (1.0);
-
-   if (tile != NULL)
-    gimp_tile_unref (tile, FALSE);
-
-   if (xtile != NULL)
-    gimp_tile_unref (xtile, FALSE);
+              /* move displacement vector to this new value */
+              dx += dscalefac * (xval - 32768);
+              dy += dscalefac * (yval - 32768);
+            }
 
-   if (ytile != NULL)
-    gimp_tile_unref (ytile, FALSE);
+          /* --------------------------------------------------------- */
 
-     /*  update the region  */
-   gimp_drawable_flush (new);
+          needx = x + dx;
+          needy = y + dy;
 
-   gimp_drawable_merge_shadow (draw->drawable_id, first_time);
+          /* Calculations complete; now copy the proper pixel */
+          warp_sample (params, params->src, params->src_outside,
+                       needx, needy, dest);
 
-   g_rand_free (gr);
+          dest += n_components;
+        }
+    }
 
+  g_rand_free (gr);
 } /* warp_one */
 
 /* ------------------------------------------------------------------------- */
 
+/*  the magnitude is the average of the color channels, times alpha  */
 static gdouble
-warp_map_mag_give_value (guchar *pt,
-                         gint    alpha,
-                         gint    bytes)
+warp_map_mag_give_value (const gfloat *pixel)
+{
+  return (pixel[0] + pixel[1] + pixel[2]) / 3.0 * pixel[3];
+}
+
+/*  diff() packs the 16 bit displacements into the first two bytes of
+ *  its RGB layers
+ */
+static gint
+warp_map_value (const gfloat *pixel)
 {
-  gdouble ret, val_alpha;
+  return (256 * (gint) (pixel[0] * 255.0 + 0.5) +
+                (gint) (pixel[1] * 255.0 + 0.5));
+}
 
-  if (bytes >= 3)
-    ret =  (pt[0] + pt[1] + pt[2])/3.0;
+/*  the pixel warp_pixel() returns outside of the selection bounds,
+ *  in the format of a source
+ */
+static void
+warp_get_outside_pixel (const Babl *format,
+                        gfloat     *pixel)
+{
+  if (dvals.wrap_type == BLACK)
+    {
+      memset (pixel, 0, 4 * sizeof (gfloat));
+    }
   else
-    ret = (gdouble) *pt;
-
-  if (alpha)
     {
-      val_alpha = pt[bytes - 1];
-      ret = (ret * val_alpha / 255.0);
-    };
-
-  return (ret);
+      /* must have selected COLOR type */
+      babl_process (babl_fish (babl_format ("R'G'B'A u8"), format),
+                    color_pixel, pixel, 1);
+    }
 }
 
-
-static GimpTile *
-warp_pixel (GimpDrawable *drawable,
-            GimpTile     *tile,
-            gint       width,
-            gint       height,
-            gint       x1,
-            gint       y1,
-            gint       x2,
-            gint       y2,
-            gint       x,
-            gint       y,
-            gint      *row,
-            gint      *col,
-            guchar    *pixel)
+static void
+warp_pixel (const WarpParams         *params,
+            const GimpParallelSource *source,
+            const gfloat             *outside,
+            gint                      x,
+            gint                      y,
+            gfloat                   *pixel)
 {
-  static guchar empty_pixel[4] = {0, 0, 0, 0};
-  guchar *data;
-  gint    b;
+  gint width  = params->width;
+  gint height = params->height;
+  gint b;
 
   /* Tile the image. */
   if (dvals.wrap_type == WRAP)
     {
+      x %= width;
+      y %= height;
+
       if (x < 0)
-        x = width - (-x % width);
-      else
-        x %= width;
+        x += width;
 
       if (y < 0)
-        y = height - (-y % height);
-      else
-        y %= height;
+        y += height;
     }
   /* Smear out the edges of the image by repeating pixels. */
   else if (dvals.wrap_type == SMEAR)
     {
-      if (x < 0)
-        x = 0;
-      else if (x > width - 1)
-        x = width - 1;
-
-      if (y < 0)
-        y = 0;
-      else if (y > height - 1)
-        y = height - 1;
+      x = CLAMP (x, 0, width  - 1);
+      y = CLAMP (y, 0, height - 1);
     }
 
-  if (x >= x1 && y >= y1 && x < x2 && y < y2)
+  if (x >= source->rect.x && x < source->rect.x + source->rect.width &&
+      y >= source->rect.y && y < source->rect.y + source->rect.height)
     {
-      if ((((guint) (x / tile_width)) != *col) ||
-          (((guint) (y / tile_height)) != *row))
-        {
-          *col = x / tile_width;
-          *row = y / tile_height;
-
-          if (tile)
-            gimp_tile_unref (tile, FALSE);
-
-          tile = gimp_drawable_get_tile (drawable, FALSE, *row, *col);
-          gimp_tile_ref (tile);
-        }
-
-      data = (tile->data +
-              tile->bpp * (tile->ewidth * (y % tile_height) + (x % tile_width)));
+      gimp_parallel_source_get_pixel (source, x, y, pixel);
     }
   else
     {
-      if (dvals.wrap_type == BLACK)
-        data = empty_pixel;
-      else
-        data = color_pixel;      /* must have selected COLOR type */
+      for (b = 0; b < source->n_components; b++)
+        pixel[b] = outside[b];
     }
+}
+
+/*  interpolates linearly between the 4 neighboring pixels  */
+static void
+warp_sample (const WarpParams         *params,
+             const GimpParallelSource *source,
+             const gfloat             *outside,
+             gdouble                   x,
+             gdouble                   y,
+             gfloat                   *pixel)
+{
+  gfloat  p[4][4];
+  gdouble fx, fy;
+  gint    xi, yi;
+  gint    b;
+
+  xi = (gint) floor (x);
+  yi = (gint) floor (y);
+
+  fx = x - xi;
+  fy = y - yi;
+
+  warp_pixel (params, source, outside, xi,     yi,     p[0]);
+  warp_pixel (params, source, outside, xi + 1, yi,     p[1]);
+  warp_pixel (params, source, outside, xi,     yi + 1, p[2]);
+  warp_pixel (params, source, outside, xi + 1, yi + 1, p[3]);
+
+  for (b = 0; b < source->n_components; b++)
+    pixel[b] = ((1.0 - fy) * ((1.0 - fx) * p[0][b] + fx * p[1][b]) +
+                fy         * ((1.0 - fx) * p[2][b] + fx * p[3][b]));
+}
+
+static gdouble
+warp_map_sample (const WarpParams         *params,
+                 const GimpParallelSource *map,
+                 gdouble                   x,
+                 gdouble                   y)
+{
+  gfloat  p[4][3];
+  gdouble fx, fy;
+  gint    xi, yi;
+
+  xi = (gint) floor (x);
+  yi = (gint) floor (y);
+
+  fx = x - xi;
+  fy = y - yi;
 
-  for (b = 0; b < drawable->bpp; b++)
-    pixel[b] = data[b];
+  warp_pixel (params, map, params->map_outside, xi,     yi,     p[0]);
+  warp_pixel (params, map, params->map_outside, xi + 1, yi,     p[1]);
+  warp_pixel (params, map, params->map_outside, xi,     yi + 1, p[2]);
+  warp_pixel (params, map, params->map_outside, xi + 1, yi + 1, p[3]);
 
-  return tile;
+  return ((1.0 - fy) * ((1.0 - fx) * warp_map_value (p[0]) +
+                        fx         * warp_map_value (p[1])) +
+          fy         * ((1.0 - fx) * warp_map_value (p[2]) +
+                        fx         * warp_map_value (p[3])));
 }
 
 /*  Warp interface functions  */
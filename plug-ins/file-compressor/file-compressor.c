@@ -102,6 +102,13 @@
  * that metric, I figure this plug-in is worth about $10,000 USD */
 /* But you got it free.   Magic of Gnu. */
 
+/* gzip_save() and bzip2_save() cut their input into blocks of this
+ * many bytes and compress them on all processors
+ */
+#define GZIP_BLOCK_SIZE   (1 << 20)
+#define GZIP_WINDOW_SIZE  (1 << 15)
+#define BZIP2_BLOCK_SIZE  900000
+
 typedef gboolean (*LoadFn) (const char *infile,
                             const char *outfile);
 typedef gboolean (*SaveFn) (const char *infile,
@@ -129,44 +136,83 @@ struct _Compressor
   SaveFn       save_fn;
 };
 
+typedef struct _CompressBlock   CompressBlock;
+typedef struct _CompressContext CompressContext;
+
+typedef gboolean (*CompressBlockFn) (CompressBlock *block);
+
+struct _CompressBlock
+{
+  const guint8 *data;        /* the whole input, for the dictionary  */
+  gsize         offset;
+  gsize         length;
+  gboolean      last;
+
+  guint8       *out;
+  gsize         out_length;
+  guint32       crc;
+
+  gboolean      success;
+  gboolean      done;
+};
+
+struct _CompressContext
+{
+  CompressBlockFn  compress_fn;
+
+  GMutex           mutex;
+  GCond            cond;
+};
+
 
-static void                query          (void);
-static void                run            (const gchar        *name,
-                                           gint                nparams,
-                                           const GimpParam    *param,
-                                           gint               *nreturn_vals,
-                                           GimpParam         **return_vals);
-
-static GimpPDBStatusType   save_image     (const Compressor   *compressor,
-                                           const gchar        *filename,
-                                           gint32              image_ID,
-                                           gint32              drawable_ID,
-                                           gint32              run_mode,
-                                           GError            **error);
-static gint32              load_image     (const Compressor   *compressor,
-                                           const gchar        *filename,
-                                           gint32              run_mode,
-                                           GimpPDBStatusType  *status,
-                                           GError            **error);
-
-static gboolean            valid_file     (const gchar        *filename);
-static const gchar       * find_extension (const Compressor   *compressor,
-                                           const gchar        *filename);
-
-static gboolean            gzip_load      (const char         *infile,
-                                           const char         *outfile);
-static gboolean            gzip_save      (const char         *infile,
-
-                                           const char         *outfile);
-static gboolean            bzip2_load     (const char         *infile,
-                                           const char         *outfile);
-static gboolean            bzip2_save     (const char         *infile,
-                                           const char         *outfile);
-
-static gboolean            xz_load        (const char         *infile,
-                                           const char         *outfile);
-static gboolean            xz_save        (const char         *infile,
-                                           const char         *outfile);
+static void                query                 (void);
+static void                run                   (const gchar        *name,
+                                                  gint                nparams,
+                                                  const GimpParam    *param,
+                                                  gint               *nreturn_vals,
+                                                  GimpParam         **return_vals);
+
+static GimpPDBStatusType   save_image            (const Compressor   *compressor,
+                                                  const gchar        *filename,
+                                                  gint32              image_ID,
+                                                  gint32              drawable_ID,
+                                                  gint32              run_mode,
+                                                  GError            **error);
+static gint32              load_image            (const Compressor   *compressor,
+                                                  const gchar        *filename,
+                                                  gint32              run_mode,
+                                                  GimpPDBStatusType  *status,
+                                                  GError            **error);
+
+static gboolean            valid_file            (const gchar        *filename);
+static const gchar       * find_extension        (const Compressor   *compressor,
+                                                  const gchar        *filename);
+
+static gboolean            compress_blocks       (const gchar        *infile,
+                                                  FILE               *out,
+                                                  gsize               block_size,
+                                                  CompressBlockFn     compress_fn,
+                                                  guint32            *crc,
+                                                  gsize              *length);
+static void                compress_block_thread (CompressBlock      *block,
+                                                  CompressContext    *context);
+
+static gboolean            gzip_load             (const char         *infile,
+                                                  const char         *outfile);
+static gboolean            gzip_save             (const char         *infile,
+                                                  const char         *outfile);
+static gboolean            gzip_compress_block   (CompressBlock      *block);
+
+static gboolean            bzip2_load            (const char         *infile,
+                                                  const char         *outfile);
+static gboolean            bzip2_save            (const char         *infile,
+                                                  const char         *outfile);
+static gboolean            bzip2_compress_block  (CompressBlock      *block);
+
+static gboolean            xz_load               (const char         *infile,
+                                                  const char         *outfile);
+static gboolean            xz_save               (const char         *infile,
+                                                  const char         *outfile);
 
 
 static const Compressor compressors[] =
@@ -557,6 +603,121 @@ find_extension (const Compressor *compressor,
     }
 }
 
+/* Compresses @infile into @out in blocks of @block_size bytes, which
+ * are handed to @compress_fn on all processors and written in order.
+ * Optionally returns the crc32 and the length of the whole input.
+ */
+static gboolean
+compress_blocks (const gchar     *infile,
+                 FILE            *out,
+                 gsize            block_size,
+                 CompressBlockFn  compress_fn,
+                 guint32         *crc,
+                 gsize           *length)
+{
+  GMappedFile     *mapped;
+  const guint8    *data;
+  gsize            data_length;
+  CompressContext  context;
+  CompressBlock   *blocks;
+  GThreadPool     *pool;
+  gint             n_blocks;
+  gint             n_threads;
+  gint             n_pushed = 0;
+  gint             i;
+  gboolean         ret      = TRUE;
+
+  mapped = g_mapped_file_new (infile, FALSE, NULL);
+  if (! mapped)
+    return FALSE;
+
+  data        = (const guint8 *) g_mapped_file_get_contents (mapped);
+  data_length = g_mapped_file_get_length (mapped);
+
+  n_blocks = MAX (1, (data_length + block_size - 1) / block_size);
+  blocks   = g_new0 (CompressBlock, n_blocks);
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      blocks[i].data   = data;
+      blocks[i].offset = (gsize) i * block_size;
+      blocks[i].length = MIN (block_size, data_length - blocks[i].offset);
+      blocks[i].last   = (i == n_blocks - 1);
+    }
+
+  context.compress_fn = compress_fn;
+  g_mutex_init (&context.mutex);
+  g_cond_init (&context.cond);
+
+  n_threads = CLAMP (g_get_num_processors (), 1, n_blocks);
+
+  pool = g_thread_pool_new ((GFunc) compress_block_thread, &context,
+                            n_threads, FALSE, NULL);
+
+  if (crc)
+    *crc = crc32 (0L, Z_NULL, 0);
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      CompressBlock *block = &blocks[i];
+
+      /*  keep twice as many blocks in flight as there are threads,
+       *  so the compressed data waiting to be written stays bounded
+       */
+      while (ret && n_pushed < MIN (n_blocks, i + 2 * n_threads))
+        g_thread_pool_push (pool, &blocks[n_pushed++], NULL);
+
+      if (i >= n_pushed)
+        break;
+
+      g_mutex_lock (&context.mutex);
+      while (! block->done)
+        g_cond_wait (&context.cond, &context.mutex);
+      g_mutex_unlock (&context.mutex);
+
+      if (ret)
+        ret = (block->success &&
+               fwrite (block->out, 1, block->out_length,
+                       out) == block->out_length);
+
+      if (ret && crc)
+        *crc = crc32_combine (*crc, block->crc, block->length);
+
+      g_free (block->out);
+      block->out = NULL;
+    }
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i < n_blocks; i++)
+    g_free (blocks[i].out);
+
+  g_free (blocks);
+
+  g_cond_clear (&context.cond);
+  g_mutex_clear (&context.mutex);
+
+  g_mapped_file_unref (mapped);
+
+  if (length)
+    *length = data_length;
+
+  return ret;
+}
+
+static void
+compress_block_thread (CompressBlock   *block,
+                       CompressContext *context)
+{
+  gboolean success = context->compress_fn (block);
+
+  g_mutex_lock (&context->mutex);
+  block->success = success;
+  block->done    = TRUE;
+  g_cond_broadcast (&context->cond);
+  g_mutex_unlock (&context->mutex);
+}
+
 static gboolean
 gzip_load (const char *infile,
            const char *outfile)
@@ -619,87 +780,120 @@ static gboolean
 gzip_save (const char *infile,
            const char *outfile)
 {
-  gboolean  ret;
-  FILE     *in;
-  int       fd;
-  gzFile    out;
-  char      buf[16384];
-  int       len;
+  /* a gzip member header without name or time stamp, OS unix */
+  static const guint8 header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+  FILE    *out;
+  guint8   trailer[8];
+  guint32  crc;
+  gsize    length;
+  gboolean ret;
 
-  ret = FALSE;
-  in = NULL;
-  out = NULL;
+  out = g_fopen (outfile, "wb");
+  if (! out)
+    return FALSE;
 
-  in = g_fopen (infile, "rb");
-  if (!in)
-    goto out;
+  ret = (fwrite (header, 1, sizeof header, out) == sizeof header &&
+         compress_blocks (infile, out, GZIP_BLOCK_SIZE, gzip_compress_block,
+                          &crc, &length));
 
-  fd = g_open (outfile, O_CREAT | O_WRONLY | _O_BINARY, 0664);
-  if (fd == -1)
-    goto out;
-
-  out = gzdopen (fd, "wb");
-  if (!out)
+  if (ret)
     {
-      close (fd);
-      goto out;
+      /* the crc32 and the length modulo 2^32, little endian */
+      trailer[0] = crc;
+      trailer[1] = crc >> 8;
+      trailer[2] = crc >> 16;
+      trailer[3] = crc >> 24;
+      trailer[4] = length;
+      trailer[5] = length >> 8;
+      trailer[6] = length >> 16;
+      trailer[7] = length >> 24;
+
+      ret = fwrite (trailer, 1, sizeof trailer, out) == sizeof trailer;
     }
 
-  while (TRUE)
-    {
-      len = fread (buf, 1, sizeof buf, in);
-      if (ferror (in))
-        break;
+  if (fclose (out) != 0)
+    ret = FALSE;
 
-      if (len < 0)
-        break;
-      else if (len == 0)
-        {
-          ret = TRUE;
-          break;
-        }
+  return ret;
+}
 
-      if (gzwrite (out, buf, len) != len)
-        break;
+/* Deflates one block as part of a single raw deflate stream: the
+ * block is primed with the 32k of input before it, so compression is
+ * as good as in one go, and all but the last block end with a sync
+ * flush, so the blocks can simply be concatenated.
+ */
+static gboolean
+gzip_compress_block (CompressBlock *block)
+{
+  z_stream  strm = { 0, };
+  gsize     dict_length;
+  gsize     size;
+  gint      status;
+
+  if (deflateInit2 (&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                    -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return FALSE;
+
+  dict_length = MIN (block->offset, GZIP_WINDOW_SIZE);
+
+  if (dict_length > 0 &&
+      deflateSetDictionary (&strm,
+                            block->data + block->offset - dict_length,
+                            dict_length) != Z_OK)
+    {
+      deflateEnd (&strm);
+      return FALSE;
     }
 
- out:
-  if (in)
-    fclose (in);
+  /* leave room for the sync flush marker */
+  size = deflateBound (&strm, block->length) + 16;
 
-  /* There is no need to close(fd) as it is closed by gzclose(). */
-  if (out)
-    if (gzclose (out) != Z_OK)
-      ret = FALSE;
+  block->out = g_malloc (size);
 
-  return ret;
+  strm.next_in   = (Bytef *) block->data + block->offset;
+  strm.avail_in  = block->length;
+  strm.next_out  = block->out;
+  strm.avail_out = size;
+
+  status = deflate (&strm, block->last ? Z_FINISH : Z_SYNC_FLUSH);
+
+  block->out_length = size - strm.avail_out;
+  block->crc        = crc32 (crc32 (0L, Z_NULL, 0),
+                             block->data + block->offset, block->length);
+
+  deflateEnd (&strm);
+
+  if (block->last)
+    return status == Z_STREAM_END;
+
+  return status == Z_OK && strm.avail_in == 0 && strm.avail_out > 0;
 }
 
+/* Also reads concatenated bzip2 streams, as written by bzip2_save()
+ * and by parallel bzip2 implementations.
+ */
 static gboolean
 bzip2_load (const char *infile,
             const char *outfile)
 {
   gboolean  ret;
-  int       fd;
-  BZFILE   *in;
+  FILE     *in;
+  BZFILE   *bz_in;
   FILE     *out;
   char      buf[16384];
+  char      unused[BZ_MAX_UNUSED];
+  int       n_unused;
+  int       bzerror;
   int       len;
 
   ret = FALSE;
   in = NULL;
   out = NULL;
+  n_unused = 0;
 
-  fd = g_open (infile, O_RDONLY | _O_BINARY, 0);
-  if (fd == -1)
-    goto out;
-
-  in = BZ2_bzdopen (fd, "rb");
+  in = g_fopen (infile, "rb");
   if (!in)
-    {
-      close (fd);
-      goto out;
-    }
+    goto out;
 
   out = g_fopen (outfile, "wb");
   if (!out)
@@ -707,90 +901,102 @@ bzip2_load (const char *infile,
 
   while (TRUE)
     {
-      len = BZ2_bzread (in, buf, sizeof buf);
+      void *unused_data;
+      int   c;
 
-      if (len < 0)
-        break;
-      else if (len == 0)
+      bz_in = BZ2_bzReadOpen (&bzerror, in, 0, 0, unused, n_unused);
+      if (bzerror != BZ_OK)
+        goto out;
+
+      do
         {
-          ret = TRUE;
-          break;
+          len = BZ2_bzRead (&bzerror, bz_in, buf, sizeof buf);
+
+          if ((bzerror == BZ_OK || bzerror == BZ_STREAM_END) &&
+              fwrite (buf, 1, len, out) != len)
+            bzerror = BZ_IO_ERROR;
         }
+      while (bzerror == BZ_OK);
 
-      if (fwrite(buf, 1, len, out) != len)
-        break;
+      if (bzerror != BZ_STREAM_END)
+        {
+          BZ2_bzReadClose (&bzerror, bz_in);
+          goto out;
+        }
+
+      /* the data read past the end of this stream starts the next one */
+      BZ2_bzReadGetUnused (&bzerror, bz_in, &unused_data, &n_unused);
+      memcpy (unused, unused_data, n_unused);
+
+      BZ2_bzReadClose (&bzerror, bz_in);
+
+      if (n_unused == 0)
+        {
+          c = getc (in);
+
+          if (c == EOF)
+            {
+              ret = ! ferror (in);
+              break;
+            }
+
+          ungetc (c, in);
+        }
     }
 
  out:
-  /* TODO: Check this in the case of BZ2_bzclose(): */
-  /* There is no need to close(fd) as it is closed by BZ2_bzclose(). */
   if (in)
-    BZ2_bzclose (in);
+    fclose (in);
 
   if (out)
-    fclose (out);
+    if (fclose (out) != 0)
+      ret = FALSE;
 
   return ret;
 }
 
+/* Writes one bzip2 stream per block of BZIP2_BLOCK_SIZE bytes, which
+ * is what bzip2 -9 puts into one bzip2 block anyway.
+ */
 static gboolean
 bzip2_save (const char *infile,
             const char *outfile)
 {
+  FILE     *out;
   gboolean  ret;
-  FILE     *in;
-  int       fd;
-  BZFILE   *out;
-  char      buf[16384];
-  int       len;
 
-  ret = FALSE;
-  in = NULL;
-  out = NULL;
+  out = g_fopen (outfile, "wb");
+  if (! out)
+    return FALSE;
 
-  in = g_fopen (infile, "rb");
-  if (!in)
-    goto out;
+  ret = compress_blocks (infile, out, BZIP2_BLOCK_SIZE, bzip2_compress_block,
+                         NULL, NULL);
 
-  fd = g_open (outfile, O_CREAT | O_WRONLY | _O_BINARY, 0664);
-  if (fd == -1)
-    goto out;
+  if (fclose (out) != 0)
+    ret = FALSE;
 
-  out = BZ2_bzdopen (fd, "wb");
-  if (!out)
-    {
-      close (fd);
-      goto out;
-    }
+  return ret;
+}
 
-  while (TRUE)
-    {
-      len = fread (buf, 1, sizeof buf, in);
-      if (ferror (in))
-        break;
+static gboolean
+bzip2_compress_block (CompressBlock *block)
+{
+  unsigned int size;
 
-      if (len < 0)
-        break;
-      else if (len == 0)
-        {
-          ret = TRUE;
-          break;
-        }
+  /* the documented worst case, 1% larger plus 600 bytes */
+  size = block->length + block->length / 100 + 600;
 
-      if (BZ2_bzwrite (out, buf, len) != len)
-        break;
-    }
+  block->out = g_malloc (size);
 
- out:
-  if (in)
-    fclose (in);
+  if (BZ2_bzBuffToBuffCompress ((char *) block->out, &size,
+                                (char *) block->data + block->offset,
+                                block->length,
+                                9, 0, 0) != BZ_OK)
+    return FALSE;
 
-  /* TODO: Check this in the case of BZ2_bzclose(): */
-  /* There is no need to close(fd) as it is closed by BZ2_bzclose(). */
-  if (out)
-    BZ2_bzclose (out);
+  block->out_length = size;
 
-  return ret;
+  return TRUE;
 }
 
 static gboolean
@@ -818,8 +1024,24 @@ xz_load (const char *infile,
   if (!out)
     goto out;
 
+#if LZMA_VERSION >= 50040002UL
+  {
+    /* decodes files with several blocks, like the ones xz_save()
+     * writes, on all processors
+     */
+    lzma_mt mt = { 0, };
+
+    mt.threads            = MAX (g_get_num_processors (), 1);
+    mt.memlimit_threading = lzma_physmem () / 4;
+    mt.memlimit_stop      = UINT64_MAX;
+
+    if (lzma_stream_decoder_mt (&strm, &mt) != LZMA_OK)
+      goto out;
+  }
+#else
   if (lzma_stream_decoder (&strm, UINT64_MAX, 0) != LZMA_OK)
     goto out;
+#endif
 
   strm.next_in = NULL;
   strm.avail_in = 0;
@@ -868,15 +1090,17 @@ xz_load (const char *infile,
   if (status != LZMA_STREAM_END)
     goto out;
 
-  lzma_end (&strm);
   ret = TRUE;
 
  out:
+  lzma_end (&strm);
+
   if (in)
     fclose (in);
 
   if (out)
-    fclose (out);
+    if (fclose (out) != 0)
+      ret = FALSE;
 
   return ret;
 }
@@ -906,10 +1130,24 @@ xz_save (const char *infile,
   if (!out)
     goto out;
 
+#if LZMA_VERSION >= 50020002UL
+  {
+    /* compresses independent blocks on all processors */
+    lzma_mt mt = { 0, };
+
+    mt.threads = MAX (g_get_num_processors (), 1);
+    mt.preset  = LZMA_PRESET_DEFAULT;
+    mt.check   = LZMA_CHECK_CRC64;
+
+    if (lzma_stream_encoder_mt (&strm, &mt) != LZMA_OK)
+      goto out;
+  }
+#else
   if (lzma_easy_encoder (&strm,
                          LZMA_PRESET_DEFAULT,
                          LZMA_CHECK_CRC64) != LZMA_OK)
     goto out;
+#endif
 
   strm.next_in = NULL;
   strm.avail_in = 0;
@@ -958,15 +1196,17 @@ xz_save (const char *infile,
   if (status != LZMA_STREAM_END)
     goto out;
 
-  lzma_end (&strm);
   ret = TRUE;
 
  out:
+  lzma_end (&strm);
+
   if (in)
     fclose (in);
 
   if (out)
-    fclose (out);
+    if (fclose (out) != 0)
+      ret = FALSE;
 
   return ret;
 }
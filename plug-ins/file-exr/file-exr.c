@@ -17,6 +17,9 @@
 
 #include "config.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
 
@@ -25,10 +28,17 @@
 #include "openexr-wrapper.h"
 
 #define LOAD_PROC          "file-exr-load"
+#define SAVE_PROC          "file-exr-save"
 #define PLUG_IN_BINARY     "file-exr"
 #define PLUG_IN_ROLE       "gimp-file-exr"
 #define PLUG_IN_VERSION    "0.0.0"
 
+/* Rows handed to OpenEXR per read or write call; a multiple of the
+ * line block size of every compression type, so blocks are never
+ * decompressed twice.
+ */
+#define EXR_BAND_ROWS      256
+
 
 /*
  * Declare some local functions.
@@ -43,10 +53,19 @@ static void     run         (const gchar      *name,
 static gint32    load_image (const gchar      *filename,
                              gboolean          interactive,
                              GError          **error);
+static gboolean  save_image (const gchar      *filename,
+                             gint32            drawable_ID,
+                             GError          **error);
+static gboolean  save_dialog (void);
+
+static void      init_threads (void);
+
 /*
  * Some global variables.
  */
 
+static gint compression = COMPRESSION_ZIP;
+
 const GimpPlugInInfo PLUG_IN_INFO =
 {
   NULL,  /* init_proc  */
@@ -71,6 +90,15 @@ query (void)
   {
     { GIMP_PDB_IMAGE, "image", "Output image" }
   };
+  static const GimpParamDef save_args[] =
+  {
+    { GIMP_PDB_INT32,    "run-mode",     "The run mode { RUN-INTERACTIVE (0), RUN-NONINTERACTIVE (1) }" },
+    { GIMP_PDB_IMAGE,    "image",        "Input image" },
+    { GIMP_PDB_DRAWABLE, "drawable",     "Drawable to save" },
+    { GIMP_PDB_STRING,   "filename",     "The name of the file to save the image in" },
+    { GIMP_PDB_STRING,   "raw-filename", "The name of the file to save the image in" },
+    { GIMP_PDB_INT32,    "compression",  "Compression type: { NONE (0), RLE (1), ZIPS (2), ZIP (3), PIZ (4), PXR24 (5), B44 (6) }" }
+  };
 
   gimp_install_procedure (LOAD_PROC,
                           "Loads files in the OpenEXR file format",
@@ -90,6 +118,25 @@ query (void)
   gimp_register_file_handler_mime (LOAD_PROC, "image/x-exr");
   gimp_register_magic_load_handler (LOAD_PROC,
                                     "exr", "", "0,lelong,20000630");
+
+  gimp_install_procedure (SAVE_PROC,
+                          "Saves files in the OpenEXR file format",
+                          "This plug-in saves OpenEXR files. Images with "
+                          "up to 16 bits per channel are saved as half "
+                          "float, others as float.",
+                          "Dominik Ernst <dernst@gmx.de>, "
+                          "Mukund Sivaraman <muks@banu.com>",
+                          "Dominik Ernst <dernst@gmx.de>, "
+                          "Mukund Sivaraman <muks@banu.com>",
+                          PLUG_IN_VERSION,
+                          N_("OpenEXR image"),
+                          "RGB*, GRAY*",
+                          GIMP_PLUGIN,
+                          G_N_ELEMENTS (save_args), 0,
+                          save_args, NULL);
+
+  gimp_register_file_handler_mime (SAVE_PROC, "image/x-exr");
+  gimp_register_save_handler (SAVE_PROC, "exr", "");
 }
 
 static void
@@ -114,6 +161,8 @@ run (const gchar      *name,
   values[0].type          = GIMP_PDB_STATUS;
   values[0].data.d_status = GIMP_PDB_EXECUTION_ERROR;
 
+  init_threads ();
+
   if (strcmp (name, LOAD_PROC) == 0)
     {
       run_mode = param[0].data.d_int32;
@@ -132,6 +181,61 @@ run (const gchar      *name,
           status = GIMP_PDB_EXECUTION_ERROR;
         }
     }
+  else if (strcmp (name, SAVE_PROC) == 0)
+    {
+      gint32           image_ID    = param[1].data.d_int32;
+      gint32           drawable_ID = param[2].data.d_int32;
+      GimpExportReturn export      = GIMP_EXPORT_CANCEL;
+
+      run_mode = param[0].data.d_int32;
+
+      switch (run_mode)
+        {
+        case GIMP_RUN_INTERACTIVE:
+        case GIMP_RUN_WITH_LAST_VALS:
+          gimp_ui_init (PLUG_IN_BINARY, FALSE);
+
+          export = gimp_export_image (&image_ID, &drawable_ID, NULL,
+                                      GIMP_EXPORT_CAN_HANDLE_RGB  |
+                                      GIMP_EXPORT_CAN_HANDLE_GRAY |
+                                      GIMP_EXPORT_CAN_HANDLE_ALPHA);
+
+          if (export == GIMP_EXPORT_CANCEL)
+            {
+              values[0].data.d_status = GIMP_PDB_CANCEL;
+              return;
+            }
+
+          gimp_get_data (SAVE_PROC, &compression);
+
+          if (run_mode == GIMP_RUN_INTERACTIVE && ! save_dialog ())
+            status = GIMP_PDB_CANCEL;
+          break;
+
+        case GIMP_RUN_NONINTERACTIVE:
+          if (nparams != 6 ||
+              param[5].data.d_int32 < COMPRESSION_NONE ||
+              param[5].data.d_int32 > COMPRESSION_B44)
+            status = GIMP_PDB_CALLING_ERROR;
+          else
+            compression = param[5].data.d_int32;
+          break;
+
+        default:
+          break;
+        }
+
+      if (status == GIMP_PDB_SUCCESS)
+        {
+          if (save_image (param[3].data.d_string, drawable_ID, &error))
+            gimp_set_data (SAVE_PROC, &compression, sizeof (compression));
+          else
+            status = GIMP_PDB_EXECUTION_ERROR;
+        }
+
+      if (export == GIMP_EXPORT_EXPORT)
+        gimp_image_delete (image_ID);
+    }
   else
     {
       status = GIMP_PDB_CALLING_ERROR;
@@ -165,7 +269,6 @@ load_image (const gchar  *filename,
   const Babl *format;
   GeglBuffer *buffer = NULL;
   int bpp;
-  int tile_height;
   gchar *pixels = NULL;
   int begin;
   int end;
@@ -250,34 +353,25 @@ load_image (const gchar  *filename,
   format = gimp_drawable_get_format (layer);
   bpp = babl_format_get_bytes_per_pixel (format);
 
-  tile_height = gimp_tile_height ();
-  pixels = g_new0 (gchar, tile_height * width * bpp);
+  pixels = g_new0 (gchar, (gsize) EXR_BAND_ROWS * width * bpp);
 
-  for (begin = 0; begin < height; begin += tile_height)
+  for (begin = 0; begin < height; begin += EXR_BAND_ROWS)
     {
-      int retval;
-      int i;
-      end = MIN (begin + tile_height, height);
+      end = MIN (begin + EXR_BAND_ROWS, height);
       num = end - begin;
 
-      for (i = 0; i < num; i++)
+      if (exr_loader_read_pixel_rows (loader, pixels, bpp, begin, num) < 0)
         {
-          retval = exr_loader_read_pixel_row (loader,
-                                              pixels + (i * width * bpp),
-                                              bpp, begin + i);
-          if (retval < 0)
-            {
-              g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
-                           _("Error reading pixel data from '%s'"),
-                           gimp_filename_to_utf8 (filename));
-              goto out;
-            }
+          g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                       _("Error reading pixel data from '%s'"),
+                       gimp_filename_to_utf8 (filename));
+          goto out;
         }
 
       gegl_buffer_set (buffer, GEGL_RECTANGLE (0, begin, width, num),
                        0, NULL, pixels, GEGL_AUTO_ROWSTRIDE);
 
-      gimp_progress_update ((gdouble) begin / (gdouble) height);
+      gimp_progress_update ((gdouble) end / (gdouble) height);
     }
 
   gimp_progress_update (1.0);
@@ -302,3 +396,171 @@ load_image (const gchar  *filename,
 
   return status;
 }
+
+static gboolean
+save_image (const gchar  *filename,
+            gint32        drawable_ID,
+            GError      **error)
+{
+  gboolean      status = FALSE;
+  EXRWriter    *writer = NULL;
+  GeglBuffer   *buffer = NULL;
+  const Babl   *format;
+  EXRImageType  image_type;
+  EXRPrecision  precision;
+  gboolean      has_alpha;
+  gint          width;
+  gint          height;
+  gint          bpp;
+  gchar        *pixels = NULL;
+  gint          begin;
+  gint          num;
+
+  has_alpha = gimp_drawable_has_alpha (drawable_ID);
+
+  image_type = (gimp_drawable_is_gray (drawable_ID) ?
+                IMAGE_TYPE_GRAY : IMAGE_TYPE_RGB);
+
+  switch (gimp_image_get_precision (gimp_item_get_image (drawable_ID)))
+    {
+    case GIMP_PRECISION_U8_LINEAR:
+    case GIMP_PRECISION_U8_GAMMA:
+    case GIMP_PRECISION_U16_LINEAR:
+    case GIMP_PRECISION_U16_GAMMA:
+    case GIMP_PRECISION_HALF_LINEAR:
+    case GIMP_PRECISION_HALF_GAMMA:
+      precision = PREC_HALF;
+      break;
+
+    default:
+      precision = PREC_FLOAT;
+      break;
+    }
+
+  if (image_type == IMAGE_TYPE_GRAY)
+    format = babl_format_new (babl_model (has_alpha ? "YA" : "Y"),
+                              babl_type (precision == PREC_HALF ?
+                                         "half" : "float"),
+                              babl_component ("Y"),
+                              has_alpha ? babl_component ("A") : NULL,
+                              NULL);
+  else
+    format = babl_format_new (babl_model (has_alpha ? "RGBA" : "RGB"),
+                              babl_type (precision == PREC_HALF ?
+                                         "half" : "float"),
+                              babl_component ("R"),
+                              babl_component ("G"),
+                              babl_component ("B"),
+                              has_alpha ? babl_component ("A") : NULL,
+                              NULL);
+
+  bpp = babl_format_get_bytes_per_pixel (format);
+
+  buffer = gimp_drawable_get_buffer (drawable_ID);
+  width  = gegl_buffer_get_width (buffer);
+  height = gegl_buffer_get_height (buffer);
+
+  gimp_progress_init_printf (_("Saving '%s'"),
+                             gimp_filename_to_utf8 (filename));
+
+  writer = exr_writer_new (filename, width, height, image_type,
+                           has_alpha, precision,
+                           (EXRCompression) compression);
+  if (! writer)
+    {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                   _("Could not open '%s' for writing"),
+                   gimp_filename_to_utf8 (filename));
+      goto out;
+    }
+
+  pixels = g_new (gchar, (gsize) EXR_BAND_ROWS * width * bpp);
+
+  for (begin = 0; begin < height; begin += num)
+    {
+      num = MIN (EXR_BAND_ROWS, height - begin);
+
+      gegl_buffer_get (buffer, GEGL_RECTANGLE (0, begin, width, num),
+                       1.0, format, pixels,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+      if (exr_writer_write_pixel_rows (writer, pixels, bpp, num) < 0)
+        {
+          g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                       _("Error writing pixel data to '%s'"),
+                       gimp_filename_to_utf8 (filename));
+          goto out;
+        }
+
+      gimp_progress_update ((gdouble) (begin + num) / (gdouble) height);
+    }
+
+  gimp_progress_update (1.0);
+
+  status = TRUE;
+
+ out:
+  if (writer)
+    exr_writer_free (writer);
+
+  if (buffer)
+    g_object_unref (buffer);
+
+  g_free (pixels);
+
+  return status;
+}
+
+static gboolean
+save_dialog (void)
+{
+  GtkWidget *dialog;
+  GtkWidget *frame;
+  gboolean   run;
+
+  dialog = gimp_export_dialog_new (_("OpenEXR"), PLUG_IN_BINARY, SAVE_PROC);
+
+  frame = gimp_int_radio_group_new (TRUE, _("Compression"),
+                                    G_CALLBACK (gimp_radio_button_update),
+                                    &compression, compression,
+
+                                    _("_None"),               COMPRESSION_NONE,  NULL,
+                                    _("_RLE"),                COMPRESSION_RLE,   NULL,
+                                    _("ZIP (_single scanline)"), COMPRESSION_ZIPS, NULL,
+                                    _("_ZIP"),                COMPRESSION_ZIP,   NULL,
+                                    _("_PIZ"),                COMPRESSION_PIZ,   NULL,
+                                    _("P_XR24"),              COMPRESSION_PXR24, NULL,
+                                    _("_B44"),                COMPRESSION_B44,   NULL,
+
+                                    NULL);
+
+  gtk_container_set_border_width (GTK_CONTAINER (frame), 12);
+  gtk_box_pack_start (GTK_BOX (gimp_export_dialog_get_content_area (dialog)),
+                      frame, FALSE, TRUE, 0);
+  gtk_widget_show (frame);
+
+  gtk_widget_show (dialog);
+
+  run = (gimp_dialog_run (GIMP_DIALOG (dialog)) == GTK_RESPONSE_OK);
+
+  gtk_widget_destroy (dialog);
+
+  return run;
+}
+
+/* OpenEXR (de)compresses line blocks and tiles on its own thread
+ * pool; size it like the core does its GEGL threads.
+ */
+static void
+init_threads (void)
+{
+  gchar *value     = gimp_gimprc_query ("num-processors");
+  gint   n_threads = value ? atoi (value) : 0;
+
+  g_free (value);
+
+  if (n_threads < 1)
+    n_threads = g_get_num_processors ();
+
+  exr_set_thread_count (n_threads);
+}
@@ -3,10 +3,12 @@
 #include "openexr-wrapper.h"
 
 #include <ImfInputFile.h>
+#include <ImfOutputFile.h>
 #include <ImfChannelList.h>
 #include <ImfRgbaFile.h>
 #include <ImfRgbaYca.h>
 #include <ImfStandardAttributes.h>
+#include <ImfThreading.h>
 
 #include <string>
 
@@ -92,37 +94,51 @@ struct _EXRLoader
   int readPixelRow(char* pixels,
                    int bpp,
                    int row)
+  {
+    return readPixelRows(pixels, bpp, row, 1);
+  }
+
+  // Reads @n_rows consecutive rows with a single readPixels() call, so
+  // OpenEXR can decompress whole line blocks or tiles, on its own
+  // threads if there are any, instead of one scanline at a time.
+  int readPixelRows(char* pixels,
+                    int bpp,
+                    int row,
+                    int n_rows)
   {
     const int actual_row = data_window_.min.y + row;
+    const size_t ystride = (size_t) bpp * getWidth();
     FrameBuffer fb;
     // This is necessary because OpenEXR expects the buffer to begin at
     // (0, 0). Though it probably results in some unmapped address,
     // hopefully OpenEXR will not make use of it. :/
-    char* base = pixels - (data_window_.min.x * bpp);
+    char* base = (pixels -
+                  (data_window_.min.x * bpp) -
+                  (actual_row * ystride));
 
     switch (image_type_)
       {
       case IMAGE_TYPE_GRAY:
-        fb.insert("Y", Slice(pt_, base, bpp, 0, 1, 1, 0.5));
+        fb.insert("Y", Slice(pt_, base, bpp, ystride, 1, 1, 0.5));
         if (hasAlpha())
           {
-            fb.insert("A", Slice(pt_, base + bpc_, bpp, 0, 1, 1, 1.0));
+            fb.insert("A", Slice(pt_, base + bpc_, bpp, ystride, 1, 1, 1.0));
           }
         break;
 
       case IMAGE_TYPE_RGB:
       default:
-        fb.insert("R", Slice(pt_, base + (bpc_ * 0), bpp, 0, 1, 1, 0.0));
-        fb.insert("G", Slice(pt_, base + (bpc_ * 1), bpp, 0, 1, 1, 0.0));
-        fb.insert("B", Slice(pt_, base + (bpc_ * 2), bpp, 0, 1, 1, 0.0));
+        fb.insert("R", Slice(pt_, base + (bpc_ * 0), bpp, ystride, 1, 1, 0.0));
+        fb.insert("G", Slice(pt_, base + (bpc_ * 1), bpp, ystride, 1, 1, 0.0));
+        fb.insert("B", Slice(pt_, base + (bpc_ * 2), bpp, ystride, 1, 1, 0.0));
         if (hasAlpha())
           {
-            fb.insert("A", Slice(pt_, base + (bpc_ * 3), bpp, 0, 1, 1, 1.0));
+            fb.insert("A", Slice(pt_, base + (bpc_ * 3), bpp, ystride, 1, 1, 1.0));
           }
       }
 
     file_.setFrameBuffer(fb);
-    file_.readPixels(actual_row);
+    file_.readPixels(actual_row, actual_row + n_rows - 1);
 
     return 0;
   }
@@ -173,6 +189,81 @@ struct _EXRLoader
   std::string format_string_;
 };
 
+struct _EXRWriter
+{
+  _EXRWriter(const char* filename,
+             const Header& header,
+             EXRImageType image_type,
+             bool has_alpha,
+             PixelType pt) :
+    file_(filename, header),
+    width_(header.dataWindow().max.x - header.dataWindow().min.x + 1),
+    image_type_(image_type),
+    has_alpha_(has_alpha),
+    pt_(pt),
+    bpc_(pt == HALF ? 2 : 4)
+  {
+  }
+
+  // Writes the next @n_rows rows.  Handing OpenEXR several line
+  // blocks at once lets it compress them in parallel.
+  int writePixelRows(const char* pixels,
+                     int bpp,
+                     int n_rows)
+  {
+    const int row = file_.currentScanLine();
+    const size_t ystride = (size_t) bpp * width_;
+    FrameBuffer fb;
+    char* base = (char*) pixels - (row * ystride);
+
+    switch (image_type_)
+      {
+      case IMAGE_TYPE_GRAY:
+        fb.insert("Y", Slice(pt_, base, bpp, ystride));
+        if (has_alpha_)
+          {
+            fb.insert("A", Slice(pt_, base + bpc_, bpp, ystride));
+          }
+        break;
+
+      case IMAGE_TYPE_RGB:
+      default:
+        fb.insert("R", Slice(pt_, base + (bpc_ * 0), bpp, ystride));
+        fb.insert("G", Slice(pt_, base + (bpc_ * 1), bpp, ystride));
+        fb.insert("B", Slice(pt_, base + (bpc_ * 2), bpp, ystride));
+        if (has_alpha_)
+          {
+            fb.insert("A", Slice(pt_, base + (bpc_ * 3), bpp, ystride));
+          }
+      }
+
+    file_.setFrameBuffer(fb);
+    file_.writePixels(n_rows);
+
+    return 0;
+  }
+
+  OutputFile file_;
+  int width_;
+  EXRImageType image_type_;
+  bool has_alpha_;
+  PixelType pt_;
+  int bpc_;
+};
+
+void
+exr_set_thread_count (int n_threads)
+{
+  // Don't let any exceptions propagate to the C layer.
+  try
+    {
+      setGlobalThreadCount(n_threads);
+    }
+  catch (...)
+    {
+    }
+}
+
 EXRLoader*
 exr_loader_new (const char *filename)
 {
@@ -281,3 +372,115 @@ exr_loader_read_pixel_row (EXRLoader *loader,
 
   return retval;
 }
+
+int
+exr_loader_read_pixel_rows (EXRLoader *loader,
+                            char *pixels,
+                            int bpp,
+                            int row,
+                            int n_rows)
+{
+  int retval = -1;
+  // Don't let any exceptions propagate to the C layer.
+  try
+    {
+      retval = loader->readPixelRows(pixels, bpp, row, n_rows);
+    }
+  catch (...)
+    {
+      retval = -1;
+    }
+
+  return retval;
+}
+
+EXRWriter*
+exr_writer_new (const char *filename,
+                int width,
+                int height,
+                EXRImageType image_type,
+                int has_alpha,
+                EXRPrecision precision,
+                EXRCompression compression)
+{
+  EXRWriter* writer;
+  PixelType pt;
+
+  switch (precision)
+    {
+    case PREC_UINT:
+      pt = UINT;
+      break;
+    case PREC_HALF:
+      pt = HALF;
+      break;
+    case PREC_FLOAT:
+    default:
+      pt = FLOAT;
+    }
+
+  // Don't let any exceptions propagate to the C layer.
+  try
+    {
+      Header header(width, height);
+
+      header.compression() = (Compression) compression;
+      header.lineOrder() = INCREASING_Y;
+
+      if (image_type == IMAGE_TYPE_GRAY)
+        {
+          header.channels().insert("Y", Channel(pt));
+        }
+      else
+        {
+          header.channels().insert("R", Channel(pt));
+          header.channels().insert("G", Channel(pt));
+          header.channels().insert("B", Channel(pt));
+        }
+
+      if (has_alpha)
+        header.channels().insert("A", Channel(pt));
+
+      writer = new EXRWriter(filename, header, image_type,
+                             has_alpha ? true : false, pt);
+    }
+  catch (...)
+    {
+      writer = NULL;
+    }
+
+  return writer;
+}
+
+int
+exr_writer_write_pixel_rows (EXRWriter *writer,
+                             const char *pixels,
+                             int bpp,
+                             int n_rows)
+{
+  int retval = -1;
+  // Don't let any exceptions propagate to the C layer.
+  try
+    {
+      retval = writer->writePixelRows(pixels, bpp, n_rows);
+    }
+  catch (...)
+    {
+      retval = -1;
+    }
+
+  return retval;
+}
+
+void
+exr_writer_free (EXRWriter *writer)
+{
+  // The destructor writes the line offset table, which can throw.
+  try
+    {
+      delete writer;
+    }
+  catch (...)
+    {
+    }
+}
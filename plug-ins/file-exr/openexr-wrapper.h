@@ -12,6 +12,7 @@ extern "C" {
  * exposed to more than this.
  */
 typedef struct _EXRLoader EXRLoader;
+typedef struct _EXRWriter EXRWriter;
 
 typedef enum {
   PREC_UINT,
@@ -24,6 +25,23 @@ typedef enum {
   IMAGE_TYPE_GRAY
 } EXRImageType;
 
+/* Same order as Imf::Compression. */
+typedef enum {
+  COMPRESSION_NONE,
+  COMPRESSION_RLE,
+  COMPRESSION_ZIPS,
+  COMPRESSION_ZIP,
+  COMPRESSION_PIZ,
+  COMPRESSION_PXR24,
+  COMPRESSION_B44
+} EXRCompression;
+
+/* Sets the number of threads OpenEXR uses to (de)compress line
+ * blocks and tiles; must be called before opening files.
+ */
+void
+exr_set_thread_count (int n_threads);
+
 EXRLoader *
 exr_loader_new (const char *filename);
 
@@ -54,6 +72,31 @@ exr_loader_read_pixel_row (EXRLoader *loader,
                            int bpp,
                            int row);
 
+int
+exr_loader_read_pixel_rows (EXRLoader *loader,
+                            char *pixels,
+                            int bpp,
+                            int row,
+                            int n_rows);
+
+EXRWriter *
+exr_writer_new (const char *filename,
+                int width,
+                int height,
+                EXRImageType image_type,
+                int has_alpha,
+                EXRPrecision precision,
+                EXRCompression compression);
+
+int
+exr_writer_write_pixel_rows (EXRWriter *writer,
+                             const char *pixels,
+                             int bpp,
+                             int n_rows);
+
+void
+exr_writer_free (EXRWriter *writer);
+
 #ifdef __cplusplus
 }
 #endif
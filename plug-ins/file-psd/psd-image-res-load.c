@@ -920,8 +920,7 @@ load_resource_1033 (const PSDimageres  *res_a,
   struct jpeg_error_mgr         jerr;
 
   ThumbnailInfo         thumb_info;
-  GimpDrawable         *drawable;
-  GimpPixelRgn          pixel_rgn;
+  GeglBuffer           *buffer;
   gint32                layer_id;
   guchar               *buf;
   guchar               *rgb_buf;
@@ -1002,9 +1001,6 @@ load_resource_1033 (const PSDimageres  *res_a,
                              cinfo.output_width,
                              cinfo.output_height,
                              GIMP_RGB_IMAGE, 100, GIMP_NORMAL_MODE);
-  drawable = gimp_drawable_get (layer_id);
-  gimp_pixel_rgn_init (&pixel_rgn, drawable, 0, 0,
-                       drawable->width, drawable->height, TRUE, FALSE);
 
   /* Step 6: while (scan lines remain to be read) */
   /*           jpeg_read_scanlines(...); */
@@ -1012,28 +1008,34 @@ load_resource_1033 (const PSDimageres  *res_a,
     {
       jpeg_read_scanlines (&cinfo,
                            (JSAMPARRAY) &rowbuf[cinfo.output_scanline], 1);
+    }
 
-      if (res_a->id == PSD_THUMB_RES)   /* Order is BGR for resource 1033 */
-        {
-          guchar *dst = rgb_buf;
-          guchar *src = buf;
+  if (res_a->id == PSD_THUMB_RES)   /* Order is BGR for resource 1033 */
+    {
+      guchar *dst = rgb_buf;
+      guchar *src = buf;
 
-          for (i = 0; i < drawable->width * drawable->height; ++i)
-            {
-              guchar r, g, b;
-
-              r = *(src++);
-              g = *(src++);
-              b = *(src++);
-              *(dst++) = b;
-              *(dst++) = g;
-              *(dst++) = r;
-            }
+      for (i = 0; i < cinfo.output_width * cinfo.output_height; ++i)
+        {
+          guchar r, g, b;
+
+          r = *(src++);
+          g = *(src++);
+          b = *(src++);
+          *(dst++) = b;
+          *(dst++) = g;
+          *(dst++) = r;
         }
-      gimp_pixel_rgn_set_rect (&pixel_rgn, rgb_buf ? rgb_buf : buf,
-                               0, 0, drawable->width, drawable->height);
     }
 
+  buffer = gimp_drawable_get_buffer (layer_id);
+  gegl_buffer_set (buffer,
+                   GEGL_RECTANGLE (0, 0,
+                                   cinfo.output_width, cinfo.output_height),
+                   0, babl_format ("R'G'B' u8"),
+                   rgb_buf ? rgb_buf : buf, GEGL_AUTO_ROWSTRIDE);
+  g_object_unref (buffer);
+
   /* Step 7: Finish decompression */
   jpeg_finish_decompress (&cinfo);
   /* We can ignore the return value since suspension is not possible
@@ -1053,7 +1055,6 @@ load_resource_1033 (const PSDimageres  *res_a,
    * jerr.num_warnings is nonzero).
    */
   gimp_image_insert_layer (image_id, layer_id, -1, 0);
-  gimp_drawable_detach (drawable);
 
   return 0;
 }
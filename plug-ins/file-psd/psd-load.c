@@ -35,6 +35,23 @@
 #include "libgimp/stdplugins-intl.h"
 
 
+/*  Channels are read in batches of layers and decoded on a thread
+ *  pool; a batch holds up to this many bytes of decoded pixels.
+ */
+#define DECODE_BATCH_SIZE  (256 * 1024 * 1024)
+
+
+/* Channel data waiting to be decoded */
+typedef struct
+{
+  PSDchannel   *channel;
+  guint16       bps;
+  guint16       compression;
+  guint16      *rle_pack_len;
+  gchar        *src;                     /* Compressed channel data */
+} PSDchannelJob;
+
+
 #define COMP_MODE_SIZE sizeof(guint16)
 
 
@@ -89,15 +106,43 @@ static void             psd_to_gimp_color_map      (guchar       *map256);
 static GimpImageType    get_gimp_image_type        (const GimpImageBaseType image_base_type,
                                                     const gboolean          alpha);
 
+static gint             read_layer_batch           (PSDimage       *img_a,
+                                                    PSDlayer      **lyr_a,
+                                                    PSDchannel   ***lyr_chn_a,
+                                                    gint            first,
+                                                    FILE           *f,
+                                                    GError        **error);
+
 static gint             read_channel_data          (PSDchannel     *channel,
                                                     const guint16   bps,
                                                     const guint16   compression,
-                                                    const guint16  *rle_pack_len,
+                                                    guint16        *rle_pack_len,
+                                                    GPtrArray      *jobs,
                                                     FILE           *f,
                                                     GError        **error);
 
-static void             convert_16_bit             (const gchar *src,
-                                                    gchar       *dst,
+static void             decode_channel_data        (PSDchannelJob  *job,
+                                                    gpointer        user_data);
+
+static void             decode_channels            (GPtrArray      *jobs);
+
+static void             free_channel_jobs          (GPtrArray      *jobs);
+
+static void             interleave_channel         (gchar          *dst,
+                                                    const gchar    *src,
+                                                    gint32          n_pixels,
+                                                    gint            n_channels,
+                                                    gint            index,
+                                                    gint            bpc);
+
+static void             set_drawable_pixels        (gint32          drawable_id,
+                                                    const gchar    *pixels,
+                                                    gint            x,
+                                                    gint            y,
+                                                    gint            width,
+                                                    gint            height);
+
+static void             convert_16_bit             (gchar       *data,
                                                     guint32      len);
 
 static void             convert_1_bit              (const gchar *src,
@@ -329,11 +374,6 @@ read_header_block (PSDimage  *img_a,
     {
       case 16:
         IFDBG(3) g_debug ("16 Bit Data");
-        if (CONVERSION_WARNINGS)
-          g_message (_("Warning:\n"
-                       "The image you are loading has 16 bits per channel. GIMP "
-                       "can only handle 8 bit, so it will be converted for you. "
-                       "Information will be lost because of this conversion."));
         break;
 
       case 8:
@@ -926,7 +966,11 @@ create_gimp_image (PSDimage    *img_a,
 
   /* Create gimp image */
   IFDBG(2) g_debug ("Create image");
-  image_id = gimp_image_new (img_a->columns, img_a->rows, img_a->base_type);
+  image_id = gimp_image_new_with_precision (img_a->columns, img_a->rows,
+                                            img_a->base_type,
+                                            img_a->bps == 16 ?
+                                            GIMP_PRECISION_U16_GAMMA :
+                                            GIMP_PRECISION_U8_GAMMA);
 
   gimp_image_set_filename (image_id, filename);
   gimp_image_undo_disable (image_id);
@@ -1012,15 +1056,15 @@ add_layers (const gint32  image_id,
             FILE         *f,
             GError      **error)
 {
+  PSDchannel         ***lyr_chn_a;
   PSDchannel          **lyr_chn;
   GArray               *parent_group_stack;
   gint32                parent_group_id = -1;
-  guchar               *pixels;
+  gchar                *pixels;
   guint16               alpha_chn;
   guint16               user_mask_chn;
   guint16               layer_channels;
   guint16               channel_idx[MAX_CHANNELS];
-  guint16              *rle_pack_len;
   gint32                l_x;                   /* Layer x */
   gint32                l_y;                   /* Layer y */
   gint32                l_w;                   /* Layer width */
@@ -1035,14 +1079,12 @@ add_layers (const gint32  image_id,
   gint                  lidx;                  /* Layer index */
   gint                  cidx;                  /* Channel index */
   gint                  rowi;                  /* Row index */
-  gint                  coli;                  /* Column index */
-  gint                  i;
+  gint                  batch_end = 0;
+  gint                  bpc;                   /* Bytes per channel */
   gboolean              alpha;
   gboolean              user_mask;
   gboolean              empty;
   gboolean              empty_mask;
-  GimpDrawable         *drawable;
-  GimpPixelRgn          pixel_rgn;
   GimpImageType         image_type;
   GimpLayerModeEffects  layer_mode;
 
@@ -1062,6 +1104,10 @@ add_layers (const gint32  image_id,
       return -1;
     }
 
+  bpc = (img_a->bps == 16) ? 2 : 1;
+
+  lyr_chn_a = g_new0 (PSDchannel **, img_a->num_layers);
+
   /* set the root of the group hierarchy */
   parent_group_stack = g_array_new (FALSE, FALSE, sizeof(gint32));
   g_array_append_val (parent_group_stack, parent_group_id);
@@ -1070,19 +1116,19 @@ add_layers (const gint32  image_id,
     {
       IFDBG(2) g_debug ("Process Layer No %d.", lidx);
 
+      /* Load and decode the channel data of the next batch of layers */
+      if (lidx == batch_end)
+        {
+          batch_end = read_layer_batch (img_a, lyr_a, lyr_chn_a, lidx,
+                                        f, error);
+          if (batch_end < 0)
+            return -1;
+        }
+
       if (lyr_a[lidx]->drop)
         {
           IFDBG(2) g_debug ("Drop layer %d", lidx);
 
-          /* Step past layer data */
-          for (cidx = 0; cidx < lyr_a[lidx]->num_channels; ++cidx)
-            {
-              if (fseek (f, lyr_a[lidx]->chn_info[cidx].data_len, SEEK_CUR) < 0)
-                {
-                  psd_set_error (feof (f), errno, error);
-                  return -1;
-                }
-            }
           g_free (lyr_a[lidx]->chn_info);
           g_free (lyr_a[lidx]->name);
         }
@@ -1115,7 +1161,8 @@ add_layers (const gint32  image_id,
           else
               empty = FALSE;
 
-          /* Empty mask */
+          /* Empty mask, read_layer_batch() already fixed up the mask
+             size of files that give it as 0 despite having mask data */
           if (lyr_a[lidx]->layer_mask.bottom - lyr_a[lidx]->layer_mask.top == 0
               || lyr_a[lidx]->layer_mask.right - lyr_a[lidx]->layer_mask.left == 0)
               empty_mask = TRUE;
@@ -1126,114 +1173,7 @@ add_layers (const gint32  image_id,
                             lyr_a[lidx]->layer_mask.bottom - lyr_a[lidx]->layer_mask.top,
                             lyr_a[lidx]->layer_mask.right - lyr_a[lidx]->layer_mask.left);
 
-          /* Load layer channel data */
-          IFDBG(2) g_debug ("Number of channels: %d", lyr_a[lidx]->num_channels);
-          /* Create pointer array for the channel records */
-          lyr_chn = g_new (PSDchannel *, lyr_a[lidx]->num_channels);
-          for (cidx = 0; cidx < lyr_a[lidx]->num_channels; ++cidx)
-            {
-              guint16 comp_mode = PSD_COMP_RAW;
-
-              /* Allocate channel record */
-              lyr_chn[cidx] = g_malloc (sizeof (PSDchannel) );
-
-              lyr_chn[cidx]->id = lyr_a[lidx]->chn_info[cidx].channel_id;
-              lyr_chn[cidx]->rows = lyr_a[lidx]->bottom - lyr_a[lidx]->top;
-              lyr_chn[cidx]->columns = lyr_a[lidx]->right - lyr_a[lidx]->left;
-
-              if (lyr_chn[cidx]->id == PSD_CHANNEL_MASK)
-                {
-                  /* Works around a bug in panotools psd files where the layer mask
-                     size is given as 0 but data exists. Set mask size to layer size.
-                  */
-                  if (empty_mask && lyr_a[lidx]->chn_info[cidx].data_len - 2 > 0)
-                    {
-                      empty_mask = FALSE;
-                      if (lyr_a[lidx]->layer_mask.top == lyr_a[lidx]->layer_mask.bottom)
-                        {
-                          lyr_a[lidx]->layer_mask.top = lyr_a[lidx]->top;
-                          lyr_a[lidx]->layer_mask.bottom = lyr_a[lidx]->bottom;
-                        }
-                      if (lyr_a[lidx]->layer_mask.right == lyr_a[lidx]->layer_mask.left)
-                        {
-                          lyr_a[lidx]->layer_mask.right = lyr_a[lidx]->right;
-                          lyr_a[lidx]->layer_mask.left = lyr_a[lidx]->left;
-                        }
-                    }
-                  lyr_chn[cidx]->rows = (lyr_a[lidx]->layer_mask.bottom -
-                                        lyr_a[lidx]->layer_mask.top);
-                  lyr_chn[cidx]->columns = (lyr_a[lidx]->layer_mask.right -
-                                           lyr_a[lidx]->layer_mask.left);
-                }
-
-              IFDBG(3) g_debug ("Channel id %d, %dx%d",
-                                lyr_chn[cidx]->id,
-                                lyr_chn[cidx]->columns,
-                                lyr_chn[cidx]->rows);
-
-              /* Only read channel data if there is any channel
-               * data. Note that the channel data can contain a
-               * compression method but no actual data.
-               */
-              if (lyr_a[lidx]->chn_info[cidx].data_len >= COMP_MODE_SIZE)
-                {
-                  if (fread (&comp_mode, COMP_MODE_SIZE, 1, f) < 1)
-                    {
-                      psd_set_error (feof (f), errno, error);
-                      return -1;
-                    }
-                  comp_mode = GUINT16_FROM_BE (comp_mode);
-                  IFDBG(3) g_debug ("Compression mode: %d", comp_mode);
-                }
-              if (lyr_a[lidx]->chn_info[cidx].data_len > COMP_MODE_SIZE)
-                {
-                  switch (comp_mode)
-                    {
-                      case PSD_COMP_RAW:        /* Planar raw data */
-                        IFDBG(3) g_debug ("Raw data length: %d",
-                                          lyr_a[lidx]->chn_info[cidx].data_len - 2);
-                        if (read_channel_data (lyr_chn[cidx], img_a->bps,
-                            PSD_COMP_RAW, NULL, f, error) < 1)
-                          return -1;
-                        break;
-
-                      case PSD_COMP_RLE:        /* Packbits */
-                        IFDBG(3) g_debug ("RLE channel length %d, RLE length data: %d, "
-                                          "RLE data block: %d",
-                                          lyr_a[lidx]->chn_info[cidx].data_len - 2,
-                                          lyr_chn[cidx]->rows * 2,
-                                          (lyr_a[lidx]->chn_info[cidx].data_len - 2 -
-                                           lyr_chn[cidx]->rows * 2));
-                        rle_pack_len = g_malloc (lyr_chn[cidx]->rows * 2);
-                        for (rowi = 0; rowi < lyr_chn[cidx]->rows; ++rowi)
-                          {
-                            if (fread (&rle_pack_len[rowi], 2, 1, f) < 1)
-                              {
-                                psd_set_error (feof (f), errno, error);
-                                g_free (rle_pack_len);
-                                return -1;
-                              }
-                            rle_pack_len[rowi] = GUINT16_FROM_BE (rle_pack_len[rowi]);
-                          }
-
-                        IFDBG(3) g_debug ("RLE decode - data");
-                        if (read_channel_data (lyr_chn[cidx], img_a->bps,
-                            PSD_COMP_RLE, rle_pack_len, f, error) < 1)
-                          return -1;
-
-                        g_free (rle_pack_len);
-                        break;
-
-                      case PSD_COMP_ZIP:                 /* ? */
-                      case PSD_COMP_ZIP_PRED:
-                      default:
-                        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
-                                    _("Unsupported compression mode: %d"), comp_mode);
-                        return -1;
-                        break;
-                    }
-                }
-            }
+          lyr_chn = lyr_chn_a[lidx];
           g_free (lyr_a[lidx]->chn_info);
 
           /* Draw layer */
@@ -1288,20 +1228,16 @@ add_layers (const gint32  image_id,
               else
                 {
                   IFDBG(2) g_debug ("End group layer id %d.", layer_id);
-                  drawable = gimp_drawable_get (layer_id);
                   layer_mode = psd_to_gimp_blend_mode (lyr_a[lidx]->blend_mode);
                   gimp_layer_set_mode (layer_id, layer_mode);
-                  gimp_layer_set_opacity (layer_id, 
+                  gimp_layer_set_opacity (layer_id,
                                           lyr_a[lidx]->opacity * 100 / 255);
-                  gimp_item_set_name (drawable->drawable_id, lyr_a[lidx]->name);
+                  gimp_item_set_name (layer_id, lyr_a[lidx]->name);
                   g_free (lyr_a[lidx]->name);
-                  gimp_item_set_visible (drawable->drawable_id,
+                  gimp_item_set_visible (layer_id,
                                          lyr_a[lidx]->layer_flags.visible);
                   if (lyr_a[lidx]->id)
-                    gimp_item_set_tattoo (drawable->drawable_id,
-                                          lyr_a[lidx]->id);
-                  gimp_drawable_flush (drawable);
-                  gimp_drawable_detach (drawable);
+                    gimp_item_set_tattoo (layer_id, lyr_a[lidx]->id);
                 }
             }
           else if (empty)
@@ -1313,15 +1249,12 @@ add_layers (const gint32  image_id,
                                          image_type, 0, GIMP_NORMAL_MODE);
               g_free (lyr_a[lidx]->name);
               gimp_image_insert_layer (image_id, layer_id, parent_group_id, -1);
-              drawable = gimp_drawable_get (layer_id);
-              gimp_drawable_fill (drawable->drawable_id, GIMP_TRANSPARENT_FILL);
-              gimp_item_set_visible (drawable->drawable_id, lyr_a[lidx]->layer_flags.visible);
+              gimp_drawable_fill (layer_id, GIMP_TRANSPARENT_FILL);
+              gimp_item_set_visible (layer_id, lyr_a[lidx]->layer_flags.visible);
               if (lyr_a[lidx]->id)
-                gimp_item_set_tattoo (drawable->drawable_id, lyr_a[lidx]->id);
+                gimp_item_set_tattoo (layer_id, lyr_a[lidx]->id);
               if (lyr_a[lidx]->layer_flags.irrelevant)
-                gimp_item_set_visible (drawable->drawable_id, FALSE);
-              gimp_drawable_flush (drawable);
-              gimp_drawable_detach (drawable);
+                gimp_item_set_visible (layer_id, FALSE);
             }
           else
             {
@@ -1334,12 +1267,14 @@ add_layers (const gint32  image_id,
               image_type = get_gimp_image_type (img_a->base_type, alpha);
               IFDBG(3) g_debug ("Layer type %d", image_type);
               layer_size = l_w * l_h;
-              pixels = g_malloc (layer_size * layer_channels);
+              pixels = g_malloc0 ((gsize) layer_size * layer_channels * bpc);
               for (cidx = 0; cidx < layer_channels; ++cidx)
                 {
                   IFDBG(3) g_debug ("Start channel %d", channel_idx[cidx]);
-                  for (i = 0; i < layer_size; ++i)
-                    pixels[(i * layer_channels) + cidx] = lyr_chn[channel_idx[cidx]]->data[i];
+                  if (lyr_chn[channel_idx[cidx]]->data)
+                    interleave_channel (pixels,
+                                        lyr_chn[channel_idx[cidx]]->data,
+                                        layer_size, layer_channels, cidx, bpc);
                   g_free (lyr_chn[channel_idx[cidx]]->data);
                 }
 
@@ -1352,16 +1287,10 @@ add_layers (const gint32  image_id,
               gimp_image_insert_layer (image_id, layer_id, parent_group_id, -1);
               gimp_layer_set_offsets (layer_id, l_x, l_y);
               gimp_layer_set_lock_alpha  (layer_id, lyr_a[lidx]->layer_flags.trans_prot);
-              drawable = gimp_drawable_get (layer_id);
-              gimp_pixel_rgn_init (&pixel_rgn, drawable, 0, 0,
-                                   drawable->width, drawable->height, TRUE, FALSE);
-              gimp_pixel_rgn_set_rect (&pixel_rgn, pixels,
-                                       0, 0, drawable->width, drawable->height);
-              gimp_item_set_visible (drawable->drawable_id, lyr_a[lidx]->layer_flags.visible);
+              set_drawable_pixels (layer_id, pixels, 0, 0, l_w, l_h);
+              gimp_item_set_visible (layer_id, lyr_a[lidx]->layer_flags.visible);
               if (lyr_a[lidx]->id)
-                gimp_item_set_tattoo (drawable->drawable_id, lyr_a[lidx]->id);
-              gimp_drawable_flush (drawable);
-              gimp_drawable_detach (drawable);
+                gimp_item_set_tattoo (layer_id, lyr_a[lidx]->id);
               g_free (pixels);
             }
 
@@ -1381,6 +1310,10 @@ add_layers (const gint32  image_id,
                 }
               else
                 {
+                  gint32 src_x = 0;
+                  gint32 src_y = 0;
+                  gint32 src_w;
+
                   /* Load layer mask data */
                   if (lyr_a[lidx]->layer_mask.mask_flags.relative_pos)
                     {
@@ -1399,9 +1332,7 @@ add_layers (const gint32  image_id,
                   IFDBG(3) g_debug ("Mask channel index %d", user_mask_chn);
                   IFDBG(3) g_debug ("Relative pos %d",
                                     lyr_a[lidx]->layer_mask.mask_flags.relative_pos);
-                  layer_size = lm_w * lm_h;
-                  pixels = g_malloc (layer_size);
-                  IFDBG(3) g_debug ("Allocate Pixels %d", layer_size);
+                  src_w = lm_w;
                   /* Crop mask at layer boundary */
                   IFDBG(3) g_debug ("Original Mask %d %d %d %d", lm_x, lm_y, lm_w, lm_h);
                   if (lm_x < 0
@@ -1414,29 +1345,15 @@ add_layers (const gint32  image_id,
                                    "The layer mask is partly outside the "
                                    "layer boundary. The mask will be "
                                    "cropped which may result in data loss.");
-                      i = 0;
-                      for (rowi = 0; rowi < lm_h; ++rowi)
-                        {
-                          if (rowi + lm_y >= 0 && rowi + lm_y < l_h)
-                            {
-                              for (coli = 0; coli < lm_w; ++coli)
-                                {
-                                  if (coli + lm_x >= 0 && coli + lm_x < l_w)
-                                    {
-                                      pixels[i] =
-                                        lyr_chn[user_mask_chn]->data[(rowi * lm_w) + coli];
-                                      i++;
-                                    }
-                                }
-                            }
-                        }
                       if (lm_x < 0)
                         {
+                          src_x = -lm_x;
                           lm_w += lm_x;
                           lm_x = 0;
                         }
                       if (lm_y < 0)
                         {
+                          src_y = -lm_y;
                           lm_h += lm_y;
                           lm_y = 0;
                         }
@@ -1445,8 +1362,16 @@ add_layers (const gint32  image_id,
                       if (lm_h + lm_y > l_h)
                         lm_h = l_h - lm_y;
                     }
-                  else
-                    memcpy (pixels, lyr_chn[user_mask_chn]->data, layer_size);
+                  lm_w = MAX (lm_w, 0);
+                  lm_h = MAX (lm_h, 0);
+                  layer_size = lm_w * lm_h;
+                  pixels = g_malloc ((gsize) layer_size * bpc);
+                  IFDBG(3) g_debug ("Allocate Pixels %d", layer_size);
+                  for (rowi = 0; rowi < lm_h; ++rowi)
+                    memcpy (pixels + (gsize) rowi * lm_w * bpc,
+                            lyr_chn[user_mask_chn]->data +
+                            ((gsize) (rowi + src_y) * src_w + src_x) * bpc,
+                            lm_w * bpc);
                   g_free (lyr_chn[user_mask_chn]->data);
                   /* Draw layer mask data */
                   IFDBG(3) g_debug ("Layer %d %d %d %d", l_x, l_y, l_w, l_h);
@@ -1459,12 +1384,8 @@ add_layers (const gint32  image_id,
 
                   IFDBG(3) g_debug ("New layer mask %d", mask_id);
                   gimp_layer_add_mask (layer_id, mask_id);
-                  drawable = gimp_drawable_get (mask_id);
-                  gimp_pixel_rgn_init (&pixel_rgn, drawable, 0 , 0,
-                                       drawable->width, drawable->height, TRUE, FALSE);
-                  gimp_pixel_rgn_set_rect (&pixel_rgn, pixels, lm_x, lm_y, lm_w, lm_h);
-                  gimp_drawable_flush (drawable);
-                  gimp_drawable_detach (drawable);
+                  if (layer_size > 0)
+                    set_drawable_pixels (mask_id, pixels, lm_x, lm_y, lm_w, lm_h);
                   gimp_layer_set_apply_mask (layer_id,
                     ! lyr_a[lidx]->layer_mask.mask_flags.disabled);
                   g_free (pixels);
@@ -1476,13 +1397,206 @@ add_layers (const gint32  image_id,
           g_free (lyr_chn);
         }
       g_free (lyr_a[lidx]);
+
+      gimp_progress_update (0.8 + 0.1 * (lidx + 1) / img_a->num_layers);
     }
   g_free (lyr_a);
+  g_free (lyr_chn_a);
   g_array_free (parent_group_stack, FALSE);
 
   return 0;
 }
 
+/* Reads the channel data of the layers from @first on, until the
+ * batch holds DECODE_BATCH_SIZE bytes of decoded pixels, and decodes
+ * all of it on a thread pool. Returns the index of the first layer
+ * after the batch.
+ */
+static gint
+read_layer_batch (PSDimage     *img_a,
+                  PSDlayer    **lyr_a,
+                  PSDchannel ***lyr_chn_a,
+                  gint          first,
+                  FILE         *f,
+                  GError      **error)
+{
+  PSDchannel          **lyr_chn;
+  GPtrArray            *jobs;
+  guint16              *rle_pack_len;
+  gsize                 batch_size = 0;
+  gboolean              empty_mask;
+  gint                  lidx;                  /* Layer index */
+  gint                  cidx;                  /* Channel index */
+  gint                  rowi;                  /* Row index */
+
+  jobs = g_ptr_array_new ();
+
+  for (lidx = first;
+       lidx < img_a->num_layers && (lidx == first ||
+                                    batch_size < DECODE_BATCH_SIZE);
+       ++lidx)
+    {
+      if (lyr_a[lidx]->drop)
+        {
+          /* Step past layer data */
+          for (cidx = 0; cidx < lyr_a[lidx]->num_channels; ++cidx)
+            {
+              if (fseek (f, lyr_a[lidx]->chn_info[cidx].data_len, SEEK_CUR) < 0)
+                {
+                  psd_set_error (feof (f), errno, error);
+                  goto fail;
+                }
+            }
+          continue;
+        }
+
+      /* Empty mask */
+      if (lyr_a[lidx]->layer_mask.bottom - lyr_a[lidx]->layer_mask.top == 0
+          || lyr_a[lidx]->layer_mask.right - lyr_a[lidx]->layer_mask.left == 0)
+          empty_mask = TRUE;
+      else
+          empty_mask = FALSE;
+
+      /* Load layer channel data */
+      IFDBG(2) g_debug ("Number of channels: %d", lyr_a[lidx]->num_channels);
+      /* Create pointer array for the channel records */
+      lyr_chn = g_new0 (PSDchannel *, lyr_a[lidx]->num_channels);
+      lyr_chn_a[lidx] = lyr_chn;
+      for (cidx = 0; cidx < lyr_a[lidx]->num_channels; ++cidx)
+        {
+          guint16 comp_mode = PSD_COMP_RAW;
+
+          /* Allocate channel record */
+          lyr_chn[cidx] = g_new0 (PSDchannel, 1);
+
+          lyr_chn[cidx]->id = lyr_a[lidx]->chn_info[cidx].channel_id;
+          lyr_chn[cidx]->rows = lyr_a[lidx]->bottom - lyr_a[lidx]->top;
+          lyr_chn[cidx]->columns = lyr_a[lidx]->right - lyr_a[lidx]->left;
+
+          if (lyr_chn[cidx]->id == PSD_CHANNEL_MASK)
+            {
+              /* Works around a bug in panotools psd files where the layer mask
+                 size is given as 0 but data exists. Set mask size to layer size.
+              */
+              if (empty_mask && lyr_a[lidx]->chn_info[cidx].data_len - 2 > 0)
+                {
+                  empty_mask = FALSE;
+                  if (lyr_a[lidx]->layer_mask.top == lyr_a[lidx]->layer_mask.bottom)
+                    {
+                      lyr_a[lidx]->layer_mask.top = lyr_a[lidx]->top;
+                      lyr_a[lidx]->layer_mask.bottom = lyr_a[lidx]->bottom;
+                    }
+                  if (lyr_a[lidx]->layer_mask.right == lyr_a[lidx]->layer_mask.left)
+                    {
+                      lyr_a[lidx]->layer_mask.right = lyr_a[lidx]->right;
+                      lyr_a[lidx]->layer_mask.left = lyr_a[lidx]->left;
+                    }
+                }
+              lyr_chn[cidx]->rows = (lyr_a[lidx]->layer_mask.bottom -
+                                    lyr_a[lidx]->layer_mask.top);
+              lyr_chn[cidx]->columns = (lyr_a[lidx]->layer_mask.right -
+                                       lyr_a[lidx]->layer_mask.left);
+            }
+
+          IFDBG(3) g_debug ("Channel id %d, %dx%d",
+                            lyr_chn[cidx]->id,
+                            lyr_chn[cidx]->columns,
+                            lyr_chn[cidx]->rows);
+
+          /* Only read channel data if there is any channel
+           * data. Note that the channel data can contain a
+           * compression method but no actual data.
+           */
+          if (lyr_a[lidx]->chn_info[cidx].data_len >= COMP_MODE_SIZE)
+            {
+              if (fread (&comp_mode, COMP_MODE_SIZE, 1, f) < 1)
+                {
+                  psd_set_error (feof (f), errno, error);
+                  goto fail;
+                }
+              comp_mode = GUINT16_FROM_BE (comp_mode);
+              IFDBG(3) g_debug ("Compression mode: %d", comp_mode);
+            }
+          if (lyr_a[lidx]->chn_info[cidx].data_len > COMP_MODE_SIZE)
+            {
+              switch (comp_mode)
+                {
+                  case PSD_COMP_RAW:        /* Planar raw data */
+                    IFDBG(3) g_debug ("Raw data length: %d",
+                                      lyr_a[lidx]->chn_info[cidx].data_len - 2);
+                    if (read_channel_data (lyr_chn[cidx], img_a->bps,
+                        PSD_COMP_RAW, NULL, jobs, f, error) < 1)
+                      goto fail;
+                    break;
+
+                  case PSD_COMP_RLE:        /* Packbits */
+                    IFDBG(3) g_debug ("RLE channel length %d, RLE length data: %d, "
+                                      "RLE data block: %d",
+                                      lyr_a[lidx]->chn_info[cidx].data_len - 2,
+                                      lyr_chn[cidx]->rows * 2,
+                                      (lyr_a[lidx]->chn_info[cidx].data_len - 2 -
+                                       lyr_chn[cidx]->rows * 2));
+                    rle_pack_len = g_malloc (lyr_chn[cidx]->rows * 2);
+                    for (rowi = 0; rowi < lyr_chn[cidx]->rows; ++rowi)
+                      {
+                        if (fread (&rle_pack_len[rowi], 2, 1, f) < 1)
+                          {
+                            psd_set_error (feof (f), errno, error);
+                            g_free (rle_pack_len);
+                            goto fail;
+                          }
+                        rle_pack_len[rowi] = GUINT16_FROM_BE (rle_pack_len[rowi]);
+                      }
+
+                    IFDBG(3) g_debug ("RLE decode - data");
+                    if (read_channel_data (lyr_chn[cidx], img_a->bps,
+                        PSD_COMP_RLE, rle_pack_len, jobs, f, error) < 1)
+                      goto fail;
+                    break;
+
+                  case PSD_COMP_ZIP:                 /* ? */
+                  case PSD_COMP_ZIP_PRED:
+                  default:
+                    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                                _("Unsupported compression mode: %d"), comp_mode);
+                    goto fail;
+                }
+
+              batch_size += ((gsize) lyr_chn[cidx]->rows *
+                             lyr_chn[cidx]->columns * MAX (img_a->bps >> 3, 1));
+            }
+        }
+    }
+
+  IFDBG(2) g_debug ("Decode %d channels of layers %d to %d",
+                    jobs->len, first, lidx - 1);
+  decode_channels (jobs);
+
+  return lidx;
+
+ fail:
+  /*  Nothing of the batch is decoded yet, so the channel records
+   *  don't hold any data
+   */
+  free_channel_jobs (jobs);
+
+  for (lidx = first; lidx < img_a->num_layers; ++lidx)
+    {
+      lyr_chn = lyr_chn_a[lidx];
+
+      if (! lyr_chn)
+        continue;
+
+      for (cidx = 0; cidx < lyr_a[lidx]->num_channels; ++cidx)
+        g_free (lyr_chn[cidx]);
+
+      g_free (lyr_chn);
+      lyr_chn_a[lidx] = NULL;
+    }
+
+  return -1;
+}
+
 static gint
 add_merged_image (const gint32  image_id,
                   PSDimage     *img_a,
@@ -1490,13 +1604,14 @@ add_merged_image (const gint32  image_id,
                   GError      **error)
 {
   PSDchannel            chn_a[MAX_CHANNELS];
+  GPtrArray            *jobs;
   gchar                *alpha_name;
-  guchar               *pixels;
+  gchar                *pixels;
   guint16               comp_mode;
   guint16               base_channels;
   guint16               extra_channels;
   guint16               total_channels;
-  guint16              *rle_pack_len[MAX_CHANNELS];
+  guint16              *rle_pack_len[MAX_CHANNELS] = { NULL, };
   guint32               alpha_id;
   gint32                layer_size;
   gint32                layer_id = -1;
@@ -1508,10 +1623,9 @@ add_merged_image (const gint32  image_id,
   gint                  rowi;                  /* Row index */
   gint                  lyr_count;
   gint                  offset;
+  gint                  bpc;                   /* Bytes per channel */
   gint                  i;
   gboolean              alpha_visible;
-  GimpDrawable         *drawable;
-  GimpPixelRgn          pixel_rgn;
   GimpImageType         image_type;
   GimpRGB               alpha_rgb;
 
@@ -1541,6 +1655,8 @@ add_merged_image (const gint32  image_id,
     extra_channels--;
   base_channels = total_channels - extra_channels;
 
+  bpc = (img_a->bps == 16) ? 2 : 1;
+
   /* ----- Read merged image & extra channel pixel data ----- */
   if (img_a->num_layers == 0
       || extra_channels > 0)
@@ -1560,6 +1676,8 @@ add_merged_image (const gint32  image_id,
         }
       comp_mode = GUINT16_FROM_BE (comp_mode);
 
+      jobs = g_ptr_array_new ();
+
       switch (comp_mode)
         {
           case PSD_COMP_RAW:        /* Planar raw data */
@@ -1569,8 +1687,8 @@ add_merged_image (const gint32  image_id,
                 chn_a[cidx].columns = img_a->columns;
                 chn_a[cidx].rows = img_a->rows;
                 if (read_channel_data (&chn_a[cidx], img_a->bps,
-                    PSD_COMP_RAW, NULL, f, error) < 1)
-                  return -1;
+                    PSD_COMP_RAW, NULL, jobs, f, error) < 1)
+                  goto fail;
               }
             break;
 
@@ -1590,7 +1708,7 @@ add_merged_image (const gint32  image_id,
                     if (fread (&rle_pack_len[cidx][rowi], 2, 1, f) < 1)
                       {
                         psd_set_error (feof (f), errno, error);
-                        return -1;
+                        goto fail;
                       }
                     rle_pack_len[cidx][rowi] = GUINT16_FROM_BE (rle_pack_len[cidx][rowi]);
                   }
@@ -1599,10 +1717,14 @@ add_merged_image (const gint32  image_id,
             IFDBG(3) g_debug ("RLE decode - data");
             for (cidx = 0; cidx < total_channels; ++cidx)
               {
+                guint16 *pack_len = rle_pack_len[cidx];
+
+                /* read_channel_data() takes over the lengths */
+                rle_pack_len[cidx] = NULL;
+
                 if (read_channel_data (&chn_a[cidx], img_a->bps,
-                    PSD_COMP_RLE, rle_pack_len[cidx], f, error) < 1)
-                  return -1;
-                g_free (rle_pack_len[cidx]);
+                    PSD_COMP_RLE, pack_len, jobs, f, error) < 1)
+                  goto fail;
               }
             break;
 
@@ -1611,9 +1733,10 @@ add_merged_image (const gint32  image_id,
           default:
             g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
                         _("Unsupported compression mode: %d"), comp_mode);
-            return -1;
-            break;
+            goto fail;
         }
+
+      decode_channels (jobs);
     }
 
   /* ----- Draw merged image ----- */
@@ -1622,13 +1745,11 @@ add_merged_image (const gint32  image_id,
       image_type = get_gimp_image_type (img_a->base_type, img_a->transparency);
 
       layer_size = img_a->columns * img_a->rows;
-      pixels = g_malloc (layer_size * base_channels);
+      pixels = g_malloc ((gsize) layer_size * base_channels * bpc);
       for (cidx = 0; cidx < base_channels; ++cidx)
         {
-          for (i = 0; i < layer_size; ++i)
-            {
-              pixels[(i * base_channels) + cidx] = chn_a[cidx].data[i];
-            }
+          interleave_channel (pixels, chn_a[cidx].data,
+                              layer_size, base_channels, cidx, bpc);
           g_free (chn_a[cidx].data);
         }
 
@@ -1639,13 +1760,8 @@ add_merged_image (const gint32  image_id,
                                  image_type,
                                  100, GIMP_NORMAL_MODE);
       gimp_image_insert_layer (image_id, layer_id, -1, 0);
-      drawable = gimp_drawable_get (layer_id);
-      gimp_pixel_rgn_init (&pixel_rgn, drawable, 0, 0,
-                           drawable->width, drawable->height, TRUE, FALSE);
-      gimp_pixel_rgn_set_rect (&pixel_rgn, pixels,
-                               0, 0, drawable->width, drawable->height);
-      gimp_drawable_flush (drawable);
-      gimp_drawable_detach (drawable);
+      set_drawable_pixels (layer_id, pixels,
+                           0, 0, img_a->columns, img_a->rows);
       g_free (pixels);
     }
   else
@@ -1662,7 +1778,6 @@ add_merged_image (const gint32  image_id,
       && image_id > -1)
     {
       IFDBG(2) g_debug ("Add extra channels");
-      pixels = g_malloc(0);
 
       /* Get channel resource data */
       if (img_a->transparency)
@@ -1723,29 +1838,18 @@ add_merged_image (const gint32  image_id,
             }
 
           cidx = base_channels + i;
-          pixels = g_realloc (pixels, chn_a[cidx].columns * chn_a[cidx].rows);
-          memcpy (pixels, chn_a[cidx].data, chn_a[cidx].columns * chn_a[cidx].rows);
           channel_id = gimp_channel_new (image_id, alpha_name,
                                          chn_a[cidx].columns, chn_a[cidx].rows,
                                          alpha_opacity, &alpha_rgb);
           gimp_image_insert_channel (image_id, channel_id, -1, 0);
           g_free (alpha_name);
-          drawable = gimp_drawable_get (channel_id);
           if (alpha_id)
-            gimp_item_set_tattoo (drawable->drawable_id, alpha_id);
-          gimp_item_set_visible (drawable->drawable_id, alpha_visible);
-          gimp_pixel_rgn_init (&pixel_rgn, drawable, 0, 0,
-                                drawable->width, drawable->height,
-                                TRUE, FALSE);
-          gimp_pixel_rgn_set_rect (&pixel_rgn, pixels,
-                                   0, 0, drawable->width,
-                                   drawable->height);
-          gimp_drawable_flush (drawable);
-          gimp_drawable_detach (drawable);
+            gimp_item_set_tattoo (channel_id, alpha_id);
+          gimp_item_set_visible (channel_id, alpha_visible);
+          set_drawable_pixels (channel_id, chn_a[cidx].data,
+                               0, 0, chn_a[cidx].columns, chn_a[cidx].rows);
           g_free (chn_a[cidx].data);
         }
-
-      g_free (pixels);
       if (img_a->alpha_names)
         g_ptr_array_free (img_a->alpha_names, TRUE);
 
@@ -1772,6 +1876,14 @@ add_merged_image (const gint32  image_id,
   /* FIXME gimp image tattoo state */
 
   return 0;
+
+ fail:
+  for (cidx = 0; cidx < total_channels; ++cidx)
+    g_free (rle_pack_len[cidx]);
+
+  free_channel_jobs (jobs);
+
+  return -1;
 }
 
 
@@ -1855,15 +1967,15 @@ static gint
 read_channel_data (PSDchannel     *channel,
                    const guint16   bps,
                    const guint16   compression,
-                   const guint16  *rle_pack_len,
+                   guint16        *rle_pack_len,
+                   GPtrArray      *jobs,
                    FILE           *f,
                    GError        **error)
 {
-  gchar    *raw_data;
-  gchar    *src;
-  gchar    *dst;
-  guint32   readline_len;
-  gint      i;
+  PSDchannelJob *job;
+  guint32        readline_len;
+  gsize          data_len;
+  gint           i;
 
   if (bps == 1)
     readline_len = ((channel->columns + 7) >> 3);
@@ -1879,89 +1991,202 @@ read_channel_data (PSDchannel     *channel,
     {
       g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
                    _("Unsupported or invalid channel size"));
+      g_free (rle_pack_len);
       return -1;
     }
 
-  raw_data = g_malloc (readline_len * channel->rows);
-  switch (compression)
+  /* Only read the data here, decode_channels() unpacks it later */
+  if (compression == PSD_COMP_RLE)
     {
-      case PSD_COMP_RAW:
-        if (fread (raw_data, readline_len, channel->rows, f) < 1)
-          {
-            psd_set_error (feof (f), errno, error);
-            return -1;
-          }
-        break;
+      data_len = 0;
+      for (i = 0; i < channel->rows; ++i)
+        data_len += rle_pack_len[i];
+    }
+  else
+    {
+      data_len = (gsize) readline_len * channel->rows;
+    }
+
+  job = g_slice_new (PSDchannelJob);
+
+  job->channel      = channel;
+  job->bps          = bps;
+  job->compression  = compression;
+  job->rle_pack_len = rle_pack_len;
+  job->src          = g_malloc (MAX (data_len, 1));
+
+  g_ptr_array_add (jobs, job);
+
+  if (data_len > 0 && fread (job->src, data_len, 1, f) < 1)
+    {
+      psd_set_error (feof (f), errno, error);
+      return -1;
+    }
+
+  return 1;
+}
+
+static void
+decode_channel_data (PSDchannelJob *job,
+                     gpointer       user_data)
+{
+  PSDchannel *channel = job->channel;
+  gchar      *raw_data;
+  guint32     readline_len;
+  gint        i;
 
+  if (job->bps == 1)
+    readline_len = ((channel->columns + 7) >> 3);
+  else
+    readline_len = (channel->columns * job->bps >> 3);
+
+  switch (job->compression)
+    {
       case PSD_COMP_RLE:
-        for (i = 0; i < channel->rows; ++i)
-          {
-            src = g_malloc (rle_pack_len[i]);
-            dst = g_malloc (readline_len);
-/*      FIXME check for over-run
-            if (ftell (f) + rle_pack_len[i] > block_end)
-              {
-                psd_set_error (TRUE, errno, error);
-                return -1;
-              }
-*/
-            if (fread (src, rle_pack_len[i], 1, f) < 1)
-              {
-                psd_set_error (feof (f), errno, error);
-                g_free (src);
-                g_free (dst);
-                return -1;
-              }
-            /* FIXME check for errors returned from decode packbits */
-            decode_packbits (src, dst, rle_pack_len[i], readline_len);
-            g_free (src);
-            memcpy (raw_data + i * readline_len, dst, readline_len);
-            g_free (dst);
-          }
+        {
+          const gchar *src = job->src;
+
+          raw_data = g_malloc ((gsize) readline_len * channel->rows);
+
+          for (i = 0; i < channel->rows; ++i)
+            {
+              /* FIXME check for errors returned from decode packbits */
+              decode_packbits (src, raw_data + (gsize) i * readline_len,
+                               job->rle_pack_len[i], readline_len);
+              src += job->rle_pack_len[i];
+            }
+
+          g_free (job->src);
+        }
+        break;
+
+      case PSD_COMP_RAW:
+      default:
+        raw_data = job->src;
         break;
     }
 
   /* Convert channel data to GIMP format */
-  switch (bps)
+  switch (job->bps)
     {
       case 16:
-        channel->data = (gchar *) g_malloc (channel->rows * channel->columns);
-        convert_16_bit (raw_data, channel->data, (channel->rows * channel->columns) << 1);
+        convert_16_bit (raw_data, channel->rows * channel->columns);
+        channel->data = raw_data;
         break;
 
       case 8:
-        channel->data = (gchar *) g_malloc (channel->rows * channel->columns);
-        memcpy (channel->data, raw_data, (channel->rows * channel->columns));
+        channel->data = raw_data;
         break;
 
       case 1:
         channel->data = (gchar *) g_malloc (channel->rows * channel->columns);
         convert_1_bit (raw_data, channel->data, channel->rows, channel->columns);
+        g_free (raw_data);
         break;
     }
 
-  g_free (raw_data);
+  g_free (job->rle_pack_len);
+  g_slice_free (PSDchannelJob, job);
+}
 
-  return 1;
+/* Decodes all @jobs, spread over as many threads as there are
+ * processors, and frees them.
+ */
+static void
+decode_channels (GPtrArray *jobs)
+{
+  GThreadPool *pool;
+  gint         i;
+
+  pool = g_thread_pool_new ((GFunc) decode_channel_data, NULL,
+                            MAX (g_get_num_processors (), 1),
+                            FALSE, NULL);
+
+  for (i = 0; i < jobs->len; ++i)
+    g_thread_pool_push (pool, g_ptr_array_index (jobs, i), NULL);
+
+  /* Waits for all jobs to finish */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_ptr_array_free (jobs, TRUE);
 }
 
+/* Frees @jobs without decoding them, after a read error. */
 static void
-convert_16_bit (const gchar *src,
-                gchar       *dst,
-                guint32     len)
+free_channel_jobs (GPtrArray *jobs)
 {
-/* Convert 16 bit to 8 bit dropping low byte
-*/
-  gint      i;
+  gint i;
 
-  IFDBG(3)  g_debug ("Start 16 bit conversion");
+  for (i = 0; i < jobs->len; ++i)
+    {
+      PSDchannelJob *job = g_ptr_array_index (jobs, i);
+
+      g_free (job->src);
+      g_free (job->rle_pack_len);
+      g_slice_free (PSDchannelJob, job);
+    }
+
+  g_ptr_array_free (jobs, TRUE);
+}
 
-  for (i = 0; i < len >> 1; ++i)
+static void
+interleave_channel (gchar       *dst,
+                    const gchar *src,
+                    gint32       n_pixels,
+                    gint         n_channels,
+                    gint         index,
+                    gint         bpc)
+{
+  gint32 i;
+
+  if (bpc == 2)
+    {
+      const guint16 *s = (const guint16 *) src;
+      guint16       *d = (guint16 *) dst + index;
+
+      for (i = 0; i < n_pixels; ++i, d += n_channels)
+        *d = s[i];
+    }
+  else
     {
-      *dst = *src;
-      dst++;
-      src += 2;
+      gchar *d = dst + index;
+
+      for (i = 0; i < n_pixels; ++i, d += n_channels)
+        *d = src[i];
     }
+}
+
+/* Writes interleaved pixels in the drawable's own format */
+static void
+set_drawable_pixels (gint32       drawable_id,
+                     const gchar *pixels,
+                     gint         x,
+                     gint         y,
+                     gint         width,
+                     gint         height)
+{
+  GeglBuffer *buffer = gimp_drawable_get_buffer (drawable_id);
+
+  gegl_buffer_set (buffer, GEGL_RECTANGLE (x, y, width, height), 0,
+                   gimp_drawable_get_format (drawable_id),
+                   pixels, GEGL_AUTO_ROWSTRIDE);
+
+  g_object_unref (buffer);
+}
+
+static void
+convert_16_bit (gchar   *data,
+                guint32  len)
+{
+/* Convert big endian 16 bit samples to native byte order in place
+*/
+  guint16  *p = (guint16 *) data;
+  guint32   i;
+
+  IFDBG(3)  g_debug ("Start 16 bit conversion");
+
+  for (i = 0; i < len; ++i)
+    p[i] = GUINT16_FROM_BE (p[i]);
 
   IFDBG(3)  g_debug ("End 16 bit conversion");
 }
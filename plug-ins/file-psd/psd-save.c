@@ -95,6 +95,13 @@
 #define PSD_UNIT_INCH 1
 #define PSD_UNIT_CM   2
 
+/* Pixels are read in bands of at most this many bytes, and every
+ * channel of a band is packed in blocks of PACK_JOB_ROWS rows, one
+ * block per thread pool job.
+ */
+#define SAVE_BAND_SIZE (64 * 1024 * 1024)
+#define PACK_JOB_ROWS  64
+
 /* *** END OF DEFINES *** */
 
 
@@ -115,6 +122,8 @@ typedef struct PsdImageData
 {
   gboolean             compression;
 
+  gint                 bps;         /* Bits per sample, 8 or 16 */
+
   gint32               image_height;
   gint32               image_width;
 
@@ -135,6 +144,20 @@ typedef struct PsdImageData
 static PSD_Image_Data PSDImageData;
 
 
+typedef struct PsdPackJob
+{
+  gint          channel;    /* Sample index inside the pixel */
+  const guchar *src;        /* First sample of the block */
+  gint32        width;
+  gint32        rows;
+  gint          n_samples;  /* Samples per pixel */
+  gint          bpc;        /* Bytes per sample */
+  guint16      *lengths;    /* Packed length of every row */
+  guchar       *rle;        /* Packed rows */
+  gint32        len;        /* Total packed length */
+} PSDpackJob;
+
+
 /* Declare some local functions.
  */
 
@@ -189,6 +212,17 @@ static void   write_pixel_data     (FILE          *fd,
                                     gint32         drawableID,
                                     glong         *ChanLenPosition,
                                     gint32         rowlenOffset);
+static const Babl * get_pixel_format  (gint32        drawableID);
+static GPtrArray  * compress_drawable (gint32        drawableID,
+                                       const Babl   *format);
+static void   pack_channel_rows    (PSDpackJob    *job,
+                                    gpointer       user_data);
+static void   free_pack_job        (PSDpackJob    *job);
+static void   write_channel_data   (FILE          *fd,
+                                    GPtrArray     *jobs,
+                                    gint           channel,
+                                    glong         *chan_len_pos,
+                                    glong          ltable_pos);
 
 static gint32 create_merged_image  (gint32         imageID);
 
@@ -249,6 +283,8 @@ run (const gchar      *name,
 
   run_mode = param[0].data.d_int32;
 
+  gegl_init (NULL, NULL);
+
   *nreturn_vals = 1;
   *return_vals  = values;
 
@@ -709,8 +745,7 @@ save_header (FILE   *fd,
                 "channels");
   write_gint32 (fd, PSDImageData.image_height, "rows");
   write_gint32 (fd, PSDImageData.image_width, "columns");
-  write_gint16 (fd, 8, "depth");  /* Apparently GIMP only supports 8 bit deep
-                                     PSD images.  */
+  write_gint16 (fd, PSDImageData.bps, "depth");
   write_gint16 (fd, gimpBaseTypeToPsdMode (PSDImageData.baseType), "mode");
 }
 
@@ -1006,36 +1041,6 @@ save_resources (FILE   *fd,
 
 
 
-static int
-get_compress_channel_data (guchar  *channel_data,
-                           gint32   channel_cols,
-                           gint32   channel_rows,
-                           gint32   stride,
-                           gint16  *LengthsTable,
-                           guchar  *remdata)
-{
-  gint    i;
-  gint32  len;                 /* Length of compressed data */
-  guchar *start;               /* Starting position of a row in channel_data */
-
-  /* For every row in the channel */
-
-  len = 0;
-  for (i = 0; i < channel_rows; i++)
-    {
-      start = channel_data + (i * channel_cols * stride);
-
-      /* Create packed data for this row */
-      LengthsTable[i] = pack_pb_line (start, channel_cols, stride,
-                                       &remdata[len]);
-      len += LengthsTable[i];
-    }
-
-  /*  return((len + channel_rows * sizeof (gint16)) + sizeof (gint16));*/
-  return len;
-}
-
-
 static void
 save_layer_and_mask (FILE   *fd,
                      gint32  image_id)
@@ -1145,7 +1150,8 @@ save_layer_and_mask (FILE   *fd,
 
           ChannelLengthPos[i][j] = ftell (fd);
           ChanSize = sizeof (gint16) + (PSDImageData.layersDim[i].width *
-                                        PSDImageData.layersDim[i].height);
+                                        PSDImageData.layersDim[i].height *
+                                        (PSDImageData.bps / 8));
 
           write_gint32 (fd, ChanSize, "Channel Size");
           IFDBG printf ("\t\t\tLength: %d\n", ChanSize);
@@ -1259,30 +1265,237 @@ save_layer_and_mask (FILE   *fd,
 
 
 
+static const Babl *
+get_pixel_format (gint32 drawableID)
+{
+  gboolean u16 = (PSDImageData.bps == 16);
+
+  if (gimp_drawable_is_indexed (drawableID))
+    return gimp_drawable_get_format (drawableID);
+
+  if (gimp_item_is_channel (drawableID) ||
+      gimp_item_is_layer_mask (drawableID))
+    return babl_format (u16 ? "Y' u16" : "Y' u8");
+
+  if (gimp_drawable_is_rgb (drawableID))
+    {
+      if (gimp_drawable_has_alpha (drawableID))
+        return babl_format (u16 ? "R'G'B'A u16" : "R'G'B'A u8");
+      else
+        return babl_format (u16 ? "R'G'B' u16" : "R'G'B' u8");
+    }
+
+  if (gimp_drawable_has_alpha (drawableID))
+    return babl_format (u16 ? "Y'A u16" : "Y'A u8");
+  else
+    return babl_format (u16 ? "Y' u16" : "Y' u8");
+}
+
+/* Packs one block of rows of one channel.  16 bit samples are swapped
+ * to big endian first, PackBits then runs over the bytes of the row.
+ */
 static void
-write_pixel_data (FILE   *fd,
-                  gint32  drawableID,
-                  glong  *ChanLenPosition,
-                  gint32  ltable_offset)
+pack_channel_rows (PSDpackJob *job,
+                   gpointer    user_data)
 {
-  GimpPixelRgn region;      /* Image region */
-  guchar *data;             /* Temporary copy of pixel data */
+  gsize    src_stride = (gsize) job->width * job->n_samples * job->bpc;
+  gint32   row_bytes  = job->width * job->bpc;
+  guint16 *row        = NULL;
+  gint32   y;
+
+  if (job->bpc == 2)
+    row = g_new (guint16, job->width);
+
+  job->len = 0;
+
+  for (y = 0; y < job->rows; y++)
+    {
+      const guchar *src = job->src + y * src_stride;
+      gint32        len;
+
+      if (job->bpc == 2)
+        {
+          const guint16 *s = (const guint16 *) src;
+          gint32         x;
+
+          for (x = 0; x < job->width; x++)
+            row[x] = GUINT16_TO_BE (s[x * job->n_samples]);
+
+          len = pack_pb_line ((guchar *) row, row_bytes, 1,
+                              job->rle + job->len);
+        }
+      else
+        {
+          len = pack_pb_line ((guchar *) src, job->width, job->n_samples,
+                              job->rle + job->len);
+        }
+
+      job->lengths[y] = len;
+      job->len       += len;
+    }
+
+  g_free (row);
+
+  job->rle = g_realloc (job->rle, MAX (job->len, 1));
+}
+
+static void
+free_pack_job (PSDpackJob *job)
+{
+  g_free (job->lengths);
+  g_free (job->rle);
+
+  g_slice_free (PSDpackJob, job);
+}
+
+/* Reads the drawable in bands and packs every channel of a band on a
+ * thread pool.  The returned jobs are in file order for each channel.
+ */
+static GPtrArray *
+compress_drawable (gint32      drawableID,
+                   const Babl *format)
+{
+  GeglBuffer *buffer    = gimp_drawable_get_buffer (drawableID);
+  gint32      width     = gegl_buffer_get_width (buffer);
+  gint32      height    = gegl_buffer_get_height (buffer);
+  gint        bpp       = babl_format_get_bytes_per_pixel (format);
+  gint        bpc       = PSDImageData.bps / 8;
+  gint        n_samples = bpp / bpc;
+  gint32      row_bytes = width * bpc;
+  gint32      band_rows;
+  guchar     *band;
+  GPtrArray  *jobs;
+  gint32      y;
+
+  jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) free_pack_job);
+
+  band_rows = SAVE_BAND_SIZE / MAX ((gsize) width * bpp, 1);
+  band_rows = CLAMP (band_rows, 1, MAX (height, 1));
+
+  band = g_malloc ((gsize) band_rows * width * bpp);
+
+  for (y = 0; y < height; y += band_rows)
+    {
+      GThreadPool *pool;
+      gint32       rows = MIN (band_rows, height - y);
+      gint32       r;
+      gint         c;
+
+      gegl_buffer_get (buffer, GEGL_RECTANGLE (0, y, width, rows), 1.0,
+                       format, band,
+                       GEGL_AUTO_ROWSTRIDE, GEGL_ABYSS_NONE);
+
+      pool = g_thread_pool_new ((GFunc) pack_channel_rows, NULL,
+                                MAX (g_get_num_processors (), 1),
+                                FALSE, NULL);
+
+      for (c = 0; c < n_samples; c++)
+        for (r = 0; r < rows; r += PACK_JOB_ROWS)
+          {
+            PSDpackJob *job = g_slice_new (PSDpackJob);
+
+            job->channel   = c;
+            job->src       = band + (gsize) r * width * bpp + c * bpc;
+            job->width     = width;
+            job->rows      = MIN (PACK_JOB_ROWS, rows - r);
+            job->n_samples = n_samples;
+            job->bpc       = bpc;
+            job->lengths   = g_new (guint16, job->rows);
+            /* worst case is one extra byte per 128 literal bytes */
+            job->rle       = g_malloc ((gsize) job->rows *
+                                       (row_bytes + row_bytes / 128 + 1));
+            job->len       = 0;
+
+            g_ptr_array_add (jobs, job);
+            g_thread_pool_push (pool, job, NULL);
+          }
+
+      /* Waits for the band to be packed before it gets overwritten */
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+
+  g_free (band);
+  g_object_unref (buffer);
+
+  return jobs;
+}
+
+static void
+write_channel_data (FILE      *fd,
+                    GPtrArray *jobs,
+                    gint       channel,
+                    glong     *chan_len_pos,
+                    glong      ltable_pos)
+{
+  gint32 len = 0;
+  gint   i;
+
+  if (chan_len_pos)
+    {
+      write_gint16 (fd, 1, "Compression type (RLE)");
+      len += 2;
+    }
+
+  /* The row lengths either precede the data, or go to the table shared
+   * by all channels of the image data section.
+   */
+  if (ltable_pos > 0)
+    fseek (fd, ltable_pos, SEEK_SET);
+
+  for (i = 0; i < jobs->len; i++)
+    {
+      PSDpackJob *job = g_ptr_array_index (jobs, i);
+      gint32      y;
+
+      if (job->channel != channel)
+        continue;
 
-  gint32 tile_height = gimp_tile_height();
+      for (y = 0; y < job->rows; y++)
+        write_gint16 (fd, job->lengths[y], "RLE length");
 
-  GimpDrawable *drawable = gimp_drawable_get (drawableID);
+      if (ltable_pos == 0)
+        len += job->rows * sizeof (gint16);
+    }
+
+  if (ltable_pos > 0)
+    fseek (fd, 0, SEEK_END);
+
+  for (i = 0; i < jobs->len; i++)
+    {
+      PSDpackJob *job = g_ptr_array_index (jobs, i);
+
+      if (job->channel != channel)
+        continue;
 
-  gint32 height = drawable->height;
-  gint32 width  = drawable->width;
-  gint32 bytes  = drawable->bpp;
-  gint32 colors = bytes;    /* fixed up down below */
-  gint32 y;
+      xfwrite (fd, job->rle, job->len, "Compressed pixel data");
+      len += job->len;
+    }
+
+  if (chan_len_pos)    /* Update total compressed length */
+    {
+      fseek (fd, *chan_len_pos, SEEK_SET);
+      write_gint32 (fd, len, "channel data length");
+      IFDBG printf ("\t\tUpdating data len to %d\n", len);
 
-  gint32   len;                  /* Length of compressed data */
-  gint16 *LengthsTable;         /* Lengths of every compressed row */
-  guchar *rledata;              /* Compressed data from a region */
-  glong  length_table_pos;      /* position in file of the length table */
-  int i, j;
+      fseek (fd, 0, SEEK_END);
+    }
+
+  IF_DEEP_DBG printf ("\t\t\t\t. Cur pos %ld\n", ftell (fd));
+}
+
+static void
+write_pixel_data (FILE   *fd,
+                  gint32  drawableID,
+                  glong  *ChanLenPosition,
+                  gint32  ltable_offset)
+{
+  const Babl *format = get_pixel_format (drawableID);
+  gint32      height = gimp_drawable_height (drawableID);
+  gint32      bytes  = (babl_format_get_bytes_per_pixel (format) /
+                        (PSDImageData.bps / 8));
+  gint32      colors = bytes;    /* fixed up down below */
+  GPtrArray  *jobs;
+  gint        i;
 
   IFDBG printf (" Function: write_pixel_data, drw %d, lto %d\n",
                 drawableID, ltable_offset);
@@ -1291,23 +1504,12 @@ write_pixel_data (FILE   *fd,
       !gimp_drawable_is_indexed (drawableID))
     colors -= 1;
 
-  gimp_tile_cache_ntiles (2* (drawable->width / gimp_tile_width () + 1));
-
-  LengthsTable = g_new (gint16, height);
-  rledata = g_new (guchar, (MIN (height, tile_height) *
-                            (width + 10 + (width / 100))));
-
-  data = g_new (guchar, MIN(height, tile_height) * width * bytes);
-
-  gimp_pixel_rgn_init (&region, drawable, 0, 0,
-                       width, height, FALSE, FALSE);
+  jobs = compress_drawable (drawableID, format);
 
   for (i = 0; i < bytes; i++)
     {
       gint chan;
 
-      len = 0;
-
       if (bytes != colors && ltable_offset == 0) /* Need to write alpha channel first, except in image data section */
         {
           if (i == 0)
@@ -1324,57 +1526,14 @@ write_pixel_data (FILE   *fd,
           chan = i;
         }
 
-      if (ChanLenPosition)
-        {
-          write_gint16 (fd, 1, "Compression type (RLE)");
-          len += 2;
-        }
-
-      if (ltable_offset > 0)
-        {
-          length_table_pos = ltable_offset + 2 * chan * height;
-        }
-      else
-        {
-          length_table_pos = ftell(fd);
-
-          xfwrite (fd, LengthsTable, height * sizeof(gint16),
-                   "Dummy RLE length");
-          len += height * sizeof(gint16);
-          IF_DEEP_DBG printf ("\t\t\t\t. ltable, pos %ld len %d\n", length_table_pos, len);
-        }
-
-      for (y = 0; y < height; y += tile_height)
-        {
-          int tlen;
-            gimp_pixel_rgn_get_rect (&region, data, 0, y,
-                                   width, MIN(height - y, tile_height));
-          tlen = get_compress_channel_data (&data[chan],
-                                             width,
-                                             MIN(height - y, tile_height),
-                                             bytes,
-                                             &LengthsTable[y],
-                                             rledata);
-          len += tlen;
-          xfwrite (fd, rledata, tlen, "Compressed pixel data");
-          IF_DEEP_DBG printf ("\t\t\t\t. Writing compressed pixels, stream of %d\n", tlen);
-        }
-
-      /* Write compressed lengths table */
-      fseek (fd, length_table_pos, SEEK_SET);
-      for (j = 0; j < height; j++) /* write real length table */
-        write_gint16 (fd, LengthsTable[j], "RLE length");
-
-      if (ChanLenPosition)    /* Update total compressed length */
-        {
-          fseek (fd, ChanLenPosition[i], SEEK_SET);
-          write_gint32 (fd, len, "channel data length");
-          IFDBG printf ("\t\tUpdating data len to %d\n", len);
-        }
-      fseek (fd, 0, SEEK_END);
-      IF_DEEP_DBG printf ("\t\t\t\t. Cur pos %ld\n", ftell(fd));
+      write_channel_data (fd, jobs, chan,
+                          ChanLenPosition ? &ChanLenPosition[i] : NULL,
+                          ltable_offset > 0 ?
+                          ltable_offset + 2 * chan * height : 0);
     }
 
+  g_ptr_array_free (jobs, TRUE);
+
   /* Write layer mask, as last channel, id -2 */
   if (gimp_item_is_layer (drawableID))
     {
@@ -1382,79 +1541,15 @@ write_pixel_data (FILE   *fd,
 
       if (maskID != -1)
         {
-          GimpDrawable *mdrawable = gimp_drawable_get (maskID);
-          len = 0;
-
-          gimp_pixel_rgn_init (&region, mdrawable, 0, 0,
-                               width, height, FALSE, FALSE);
-
-          if (ChanLenPosition)
-            {
-              write_gint16 (fd, 1, "Compression type (RLE)");
-              len += 2;
-              IF_DEEP_DBG printf ("\t\t\t\t. ChanLenPos, len %d\n", len);
-            }
+          jobs = compress_drawable (maskID, get_pixel_format (maskID));
 
-          if (ltable_offset > 0)
-            {
-              length_table_pos = ltable_offset + 2 * (bytes+1) * height;
-              IF_DEEP_DBG printf ("\t\t\t\t. ltable, pos %ld\n",
-                                  length_table_pos);
-            }
-          else
-            {
-              length_table_pos = ftell(fd);
-
-              xfwrite (fd, LengthsTable, height * sizeof(gint16),
-                       "Dummy RLE length");
-              len += height * sizeof(gint16);
-              IF_DEEP_DBG printf ("\t\t\t\t. ltable, pos %ld len %d\n",
-                                  length_table_pos, len);
-            }
-
-          for (y = 0; y < height; y += tile_height)
-            {
-              int tlen;
-              gimp_pixel_rgn_get_rect (&region, data, 0, y,
-                                       width, MIN(height - y, tile_height));
-              tlen = get_compress_channel_data (&data[0],
-                                                width,
-                                                MIN(height - y, tile_height),
-                                                1,
-                                                &LengthsTable[y],
-                                                rledata);
-              len += tlen;
-              xfwrite (fd, rledata, tlen, "Compressed mask data");
-              IF_DEEP_DBG printf ("\t\t\t\t. Writing compressed mask, stream of %d\n", tlen);
-            }
-
-          /* Write compressed lengths table */
-          fseek (fd, length_table_pos, SEEK_SET); /*POS WHERE???*/
-          for (j = 0; j < height; j++) /* write real length table */
-            {
-              write_gint16 (fd, LengthsTable[j], "RLE length");
-              IF_DEEP_DBG printf ("\t\t\t\t. Updating RLE len %d\n",
-                                  LengthsTable[j]);
-            }
+          write_channel_data (fd, jobs, 0,
+                              ChanLenPosition ? &ChanLenPosition[bytes] : NULL,
+                              0);
 
-          if (ChanLenPosition)    /* Update total compressed length */
-            {
-              fseek (fd, ChanLenPosition[bytes], SEEK_SET); /*+bytes OR SOMETHING*/
-              write_gint32 (fd, len, "channel data length");
-              IFDBG printf ("\t\tUpdating data len to %d, at %ld\n", len, ftell(fd));
-            }
-          fseek (fd, 0, SEEK_END);
-          IF_DEEP_DBG printf ("\t\t\t\t. Cur pos %ld\n", ftell(fd));
-
-          gimp_drawable_detach (mdrawable);
+          g_ptr_array_free (jobs, TRUE);
         }
     }
-
-  gimp_drawable_detach (drawable);
-
-  g_free (data);
-  g_free (rledata);
-  g_free (LengthsTable);
 }
 
 
@@ -1514,50 +1609,48 @@ create_merged_image (gint32 image_id)
 
   if (gimp_image_base_type (image_id) != GIMP_INDEXED)
     {
-      GimpDrawable *drawable = gimp_drawable_get (projection);
-      GimpPixelRgn  region;
-      gboolean      transparency_found = FALSE;
-      gpointer      pr;
-
-      gimp_pixel_rgn_init (&region, drawable,
-                           0, 0, drawable->width, drawable->height,
-                           TRUE, FALSE);
-
-      for (pr = gimp_pixel_rgns_register (1, &region);
-           pr != NULL;
-           pr = gimp_pixel_rgns_process (pr))
+      GeglBuffer         *buffer = gimp_drawable_get_buffer (projection);
+      const Babl         *format;
+      GeglBufferIterator *iter;
+      gint                n_components;
+      gboolean            transparency_found = FALSE;
+
+      if (gimp_drawable_is_rgb (projection))
+        format = babl_format ("R'G'B'A float");
+      else
+        format = babl_format ("Y'A float");
+
+      n_components = babl_format_get_n_components (format);
+
+      iter = gegl_buffer_iterator_new (buffer, NULL, 0, format,
+                                       GEGL_BUFFER_READWRITE,
+                                       GEGL_ABYSS_NONE);
+
+      while (gegl_buffer_iterator_next (iter))
         {
-          guchar *data = region.data;
-          gint    y;
+          gfloat *d     = iter->data[0];
+          gint    count = iter->length;
 
-          for (y = 0; y < region.h; y++)
+          while (count--)
             {
-              guchar *d = data;
-              gint    x;
+              gfloat alpha = d[n_components - 1];
 
-              for (x = 0; x < region.w; x++)
+              if (alpha < 1.0)
                 {
-                  guint32 alpha = d[region.bpp - 1];
+                  gint i;
 
-                  if (alpha < 255)
-                    {
-                      gint i;
+                  transparency_found = TRUE;
 
-                      transparency_found = TRUE;
-
-                      /* blend against white, photoshop does this. */
-                      for (i = 0; i < region.bpp - 1; i++)
-                        d[i] = ((guint32) d[i] * alpha) / 255 + 255 - alpha;
-                    }
-
-                  d += region.bpp;
+                  /* blend against white, photoshop does this. */
+                  for (i = 0; i < n_components - 1; i++)
+                    d[i] = d[i] * alpha + 1.0 - alpha;
                 }
 
-              data += region.rowstride;
+              d += n_components;
             }
         }
 
-      gimp_drawable_detach (drawable);
+      g_object_unref (buffer);
 
       if (! transparency_found)
         gimp_layer_flatten (projection);
@@ -1588,6 +1681,19 @@ get_image_data (FILE   *fd,
   PSDImageData.baseType = gimp_image_base_type (image_id);
   IFDBG printf ("\tGot base type: %d\n", PSDImageData.baseType);
 
+  switch (gimp_image_get_precision (image_id))
+    {
+    case GIMP_PRECISION_U8_LINEAR:
+    case GIMP_PRECISION_U8_GAMMA:
+      PSDImageData.bps = 8;
+      break;
+
+    default:
+      PSDImageData.bps = 16;
+      break;
+    }
+  IFDBG printf ("\tGot bits per sample: %d\n", PSDImageData.bps);
+
   PSDImageData.merged_layer = create_merged_image (image_id);
 
   PSDImageData.lChannels = gimp_image_get_channels (image_id,
@@ -1612,7 +1718,6 @@ save_image (const gchar  *filename,
   gint32 *layers;
   gint    nlayers;
   gint    i;
-  GimpDrawable *drawable;
 
   IFDBG printf (" Function: save_image\n");
 
@@ -1631,8 +1736,8 @@ save_image (const gchar  *filename,
   layers = gimp_image_get_layers (image_id, &nlayers);
   for (i = 0; i < nlayers; i++)
     {
-      drawable = gimp_drawable_get (layers[i]);
-      if (drawable->width > 30000 || drawable->height > 30000)
+      if (gimp_drawable_width (layers[i])  > 30000 ||
+          gimp_drawable_height (layers[i]) > 30000)
         {
           g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
                        _("Unable to save '%s'.  The PSD file format does not "
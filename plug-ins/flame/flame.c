@@ -45,6 +45,11 @@
 #define SCALE_WIDTH       150
 #define PREVIEW_SIZE      150
 #define EDIT_PREVIEW_SIZE 85
+
+/* the previews render with the flame's sample density,
+   but take no more than this many samples */
+#define PREVIEW_SAMPLES      250000
+#define EDIT_PREVIEW_SAMPLES 50000
 #define NMUTANTS          9
 
 #define BLACK_DRAWABLE    (-2)
@@ -544,7 +549,7 @@ set_edit_preview (void)
   control_point  pcp;
   gint           nbytes = EDIT_PREVIEW_SIZE * EDIT_PREVIEW_SIZE * 3;
 
-  static frame_spec pf = { 0.0, 0, 1, 0.0 };
+  static frame_spec pf = { 0.0, 0, 1, 0.0, EDIT_PREVIEW_SAMPLES };
 
   if (NULL == edit_previews[0])
     return;
@@ -576,7 +581,6 @@ set_edit_preview (void)
         pcp.width = EDIT_PREVIEW_SIZE;
         pcp.height = EDIT_PREVIEW_SIZE;
 
-        pcp.sample_density = 1;
         pcp.spatial_oversample = 1;
         pcp.spatial_filter_radius = 0.5;
 
@@ -849,7 +853,7 @@ set_flame_preview (void)
   guchar *b;
   control_point pcp;
 
-  static frame_spec pf = {0.0, 0, 1, 0.0};
+  static frame_spec pf = {0.0, 0, 1, 0.0, PREVIEW_SAMPLES};
 
   if (NULL == flame_preview)
     return;
@@ -865,7 +869,6 @@ set_flame_preview (void)
     (pcp.pixels_per_unit * preview_width) / pcp.width;
   pcp.width = preview_width;
   pcp.height = preview_height;
-  pcp.sample_density = 1;
   pcp.spatial_oversample = 1;
   pcp.spatial_filter_radius = 0.1;
   render_rectangle (&pf, b, preview_width, field_both, 3, NULL);
@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <math.h>
 
+#include <glib.h>
+
 #include "cmap.h"
 
 #define EPS (1e-10)
@@ -71,7 +73,8 @@ typedef struct {
 
 
 
-extern void iterate(control_point *cp, int n, int fuse, point points[]);
+extern void iterate(control_point *cp, int n, int fuse, point points[],
+                    GRand *rand);
 extern void interpolate(control_point cps[], int ncps, double time, control_point *result);
 extern void tokenize(char **ss, char *argv[], int *argc);
 extern void print_control_point(FILE *f, control_point *cp, int quote);
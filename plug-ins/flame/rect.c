@@ -24,9 +24,11 @@
 /* for batch
  *   interpolate
  *   compute colormap
- *   for subbatch
- *     compute samples
- *     buckets += cmap[samples]
+ *   for each thread
+ *     for its share of the subbatches
+ *       compute samples
+ *       thread buckets += cmap[samples]
+ *   buckets = sum of all thread buckets
  *   accum += time_filter[batch] * log(buckets)
  * image = filter(accum)
  */
@@ -60,12 +62,51 @@ typedef accum_t abucket[4];
 /* should be MAXBUCKET / (OVERSAMPLE^2) */
 #define PREFILTER_WHITE (MAXBUCKET>>4)
 
+/* the threads besides the first get buckets of their own, but
+   not more than this many bytes of them all together */
+#define THREAD_BUCKETS_MEMORY (1 << 28)
+
 
 #define bump_no_overflow(dest, delta, type) { \
    type tt_ = dest + delta;            \
    if (tt_ > dest) dest = tt_;                 \
 }
 
+/* what one thread of the chaos game works on */
+typedef struct {
+   control_point *cp;
+   bucket        *buckets;
+   bucket        *cmap;
+   double        *bounds;
+   double        *size;
+   int            width, height;
+   int            n_sub_batches;
+   GRand         *rand;
+   int          (*progress)(double);
+} chaos_task;
+
+/* what one thread of the spatial filter works on */
+typedef struct {
+   abucket       *accumulate;
+   float         *filter_x, *filter_y;
+   int            filter_width;
+   int            oversample;
+   int            width;           /* of the histogram */
+   int            image_width;
+   int            first_row, n_rows;
+   double         gamma;
+   unsigned char *out;
+   int            out_width;
+   int            nchan;
+   int          (*progress)(double);
+} filter_task;
+
+typedef struct {
+   void (*func)(void *task);
+   void  *task;
+} thread_start;
+
+
 /* sum of entries of vector to 1 */
 static void
 normalize_vector(double *v,
@@ -80,6 +121,188 @@ normalize_vector(double *v,
     v[i] *= t;
 }
 
+static gpointer
+thread_main (gpointer data)
+{
+  thread_start *start = data;
+
+  start->func (start->task);
+
+  return NULL;
+}
+
+/* runs FUNC on each of the N tasks, each on a thread of its own.
+   the first task runs on the calling thread, which makes it the
+   only one that may report progress */
+static void
+run_tasks (void  (*func)(void *task),
+           void   *tasks,
+           size_t  task_size,
+           int     n)
+{
+  thread_start *starts  = g_new (thread_start, n);
+  GThread     **threads = g_new (GThread *, n);
+  int           i;
+
+  for (i = 1; i < n; i++)
+    {
+      starts[i].func = func;
+      starts[i].task = (char *) tasks + i * task_size;
+      threads[i] = g_thread_new ("flame", thread_main, &starts[i]);
+    }
+
+  func (tasks);
+
+  for (i = 1; i < n; i++)
+    g_thread_join (threads[i]);
+
+  g_free (starts);
+  g_free (threads);
+}
+
+static void
+chaos_game (void *data)
+{
+  chaos_task *task   = data;
+  point      *points = malloc (sizeof (point) * SUB_BATCH_SIZE);
+  double     *bounds = task->bounds;
+  double     *size   = task->size;
+  int         width  = task->width;
+  int         height = task->height;
+  int         sub_batch, j;
+
+  for (sub_batch = 0; sub_batch < task->n_sub_batches; sub_batch++)
+    {
+      if (task->progress && (sub_batch % 32) == 0)
+        (*task->progress)(0.5 * sub_batch / (double) task->n_sub_batches);
+      /* generate a sub_batch_size worth of samples */
+      points[0][0] = g_rand_double_range (task->rand, -1.0, 1.0);
+      points[0][1] = g_rand_double_range (task->rand, -1.0, 1.0);
+      points[0][2] = g_rand_double (task->rand);
+      iterate (task->cp, SUB_BATCH_SIZE, FUSE, points, task->rand);
+
+      /* merge them into buckets, looking up colors */
+      for (j = 0; j < SUB_BATCH_SIZE; j++)
+        {
+          int k, color_index;
+          double *p = points[j];
+          bucket *b;
+
+          /* Note that we must test if p[0] and p[1] is "within"
+           * the valid bounds rather than "not outside", because
+           * p[0] and p[1] might be NaN.
+           */
+          if (p[0] >= bounds[0] &&
+              p[1] >= bounds[1] &&
+              p[0] <= bounds[2] &&
+              p[1] <= bounds[3])
+            {
+              color_index = (int) (p[2] * CMAP_SIZE);
+
+              if (color_index < 0)
+                color_index = 0;
+              else if (color_index > CMAP_SIZE - 1)
+                color_index = CMAP_SIZE - 1;
+
+              b = task->buckets +
+                  (int) (width * (p[0] - bounds[0]) * size[0]) +
+                  width * (int) (height * (p[1] - bounds[1]) * size[1]);
+
+              for (k = 0; k < 4; k++)
+                bump_no_overflow(b[0][k], task->cmap[color_index][k], short);
+            }
+        }
+    }
+
+  free (points);
+}
+
+/* adds the buckets of a thread to the buckets of the frame, this
+   is a plain loop over shorts so that the compiler can vectorize it */
+static void
+merge_buckets (bucket       *dest,
+               const bucket *src,
+               int           nbuckets)
+{
+  short       *d = dest[0];
+  const short *s = src[0];
+  int          i;
+
+  for (i = 0; i < 4 * nbuckets; i++)
+    {
+      int t = d[i] + s[i];
+      d[i] = MIN (t, G_MAXSHORT);
+    }
+}
+
+static unsigned char
+gamma_correct (float  t,
+               double g)
+{
+  int a = 256.0 * pow((double) t / PREFILTER_WHITE, g) + 0.5;
+
+  return CLAMP (a, 0, 255);
+}
+
+/* the gaussian filter is separable: each output row first filters its
+   histogram rows vertically into one row of floats, which is then
+   filtered horizontally into the pixels */
+static void
+filter_rows (void *data)
+{
+  filter_task *task  = data;
+  int          width = task->width;
+  float       *row   = malloc (sizeof (float) * 4 * width);
+  int          i, j, k, ii, jj;
+
+  for (j = task->first_row; j < task->first_row + task->n_rows; j++)
+    {
+      unsigned char *p = task->out + task->nchan * j * task->out_width;
+      int            y = j * task->oversample;
+
+      if (task->progress && ((j - task->first_row) % 32) == 0)
+        (*task->progress)(0.5 + 0.5 * (j - task->first_row) /
+                          (double) task->n_rows);
+
+      memset (row, 0, sizeof (float) * 4 * width);
+
+      for (jj = 0; jj < task->filter_width; jj++)
+        {
+          const accum_t *a = task->accumulate[(y + jj) * width];
+          float          f = task->filter_y[jj];
+
+          for (k = 0; k < 4 * width; k++)
+            row[k] += f * a[k];
+        }
+
+      for (i = 0; i < task->image_width; i++)
+        {
+          const float *r    = row + 4 * i * task->oversample;
+          float        t[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+          for (ii = 0; ii < task->filter_width; ii++)
+            {
+              float f = task->filter_x[ii];
+
+              t[0] += f * r[4 * ii + 0];
+              t[1] += f * r[4 * ii + 1];
+              t[2] += f * r[4 * ii + 2];
+              t[3] += f * r[4 * ii + 3];
+            }
+
+          p[0] = gamma_correct (t[0], task->gamma);
+          p[1] = gamma_correct (t[1], task->gamma);
+          p[2] = gamma_correct (t[2], task->gamma);
+          if (task->nchan > 3)
+            p[3] = gamma_correct (t[3], task->gamma);
+
+          p += task->nchan;
+        }
+    }
+
+  free (row);
+}
+
 void
 render_rectangle (frame_spec    *spec,
                   unsigned char *out,
@@ -88,11 +311,13 @@ render_rectangle (frame_spec    *spec,
                   int            nchan,
                   int progress(double))
 {
-  int      i, j, k, nsamples, nbuckets, batch_size, batch_num, sub_batch;
+  int      i, j, k, nsamples, nbuckets, batch_size, batch_num;
   bucket  *buckets;
+  bucket  *thread_buckets;
   abucket *accumulate;
-  point   *points;
-  double  *filter, *temporal_filter, *temporal_deltas;
+  float   *filter_x, *filter_y;
+  double  *temporal_filter, *temporal_deltas;
+  double  *log_scale;
   double   bounds[4], size[2], ppux, ppuy;
   int      image_width, image_height;    /* size of the image to produce */
   int      width, height;               /* size of histogram */
@@ -101,7 +326,10 @@ render_rectangle (frame_spec    *spec,
   int      nbatches = spec->cps[0].nbatches;
   bucket   cmap[CMAP_SIZE];
   int      gutter_width;
-  int      sbc;
+  int      max_threads, n_threads;
+  GRand  **rands;
+  chaos_task  *chaos_tasks;
+  filter_task *filter_tasks;
 
   image_width = spec->cps[0].width;
   if (field)
@@ -116,24 +344,39 @@ render_rectangle (frame_spec    *spec,
 
   if (1)
     {
+      double *fx, *fy;
+
       filter_width = (2.0 * FILTER_CUTOFF * oversample *
                       spec->cps[0].spatial_filter_radius);
       /* make sure it has same parity as oversample */
       if ((filter_width ^ oversample) & 1)
         filter_width++;
 
-      filter = malloc (sizeof (double) * filter_width * filter_width);
-      /* fill in the coefs */
+      /* the coefs exp(-2.0 * (ii * ii + jj * jj)) of the filter are
+         the products of a horizontal and a vertical filter */
+      fx = malloc (sizeof (double) * filter_width);
+      fy = malloc (sizeof (double) * filter_width);
       for (i = 0; i < filter_width; i++)
-        for (j = 0; j < filter_width; j++)
-          {
-            double ii = ((2.0 * i + 1.0) / filter_width - 1.0) * FILTER_CUTOFF;
-            double jj = ((2.0 * j + 1.0) / filter_width - 1.0) * FILTER_CUTOFF;
-            if (field)
-              jj *= 2.0;
-            filter[i + j * filter_width] = exp(-2.0 * (ii * ii + jj * jj));
-          }
-      normalize_vector(filter, filter_width * filter_width);
+        {
+          double ii = ((2.0 * i + 1.0) / filter_width - 1.0) * FILTER_CUTOFF;
+          double jj = ii;
+          if (field)
+            jj *= 2.0;
+          fx[i] = exp(-2.0 * ii * ii);
+          fy[i] = exp(-2.0 * jj * jj);
+        }
+      normalize_vector(fx, filter_width);
+      normalize_vector(fy, filter_width);
+
+      filter_x = malloc (sizeof (float) * filter_width);
+      filter_y = malloc (sizeof (float) * filter_width);
+      for (i = 0; i < filter_width; i++)
+        {
+          filter_x[i] = fx[i];
+          filter_y[i] = fy[i];
+        }
+      free (fx);
+      free (fy);
     }
   temporal_filter = malloc (sizeof (double) * nbatches);
   temporal_deltas = malloc (sizeof (double) * nbatches);
@@ -167,8 +410,7 @@ render_rectangle (frame_spec    *spec,
       static char *last_block = NULL;
       static int   last_block_size = 0;
       int memory_rqd = (sizeof (bucket) * nbuckets +
-                        sizeof (abucket) * nbuckets +
-                        sizeof (point) * SUB_BATCH_SIZE);
+                        sizeof (abucket) * nbuckets);
       if (memory_rqd > last_block_size)
         {
           if (last_block != NULL)
@@ -184,15 +426,40 @@ render_rectangle (frame_spec    *spec,
         }
       buckets = (bucket *) last_block;
       accumulate = (abucket *) (last_block + sizeof (bucket) * nbuckets);
-      points = (point *)  (last_block + (sizeof (bucket) + sizeof (abucket)) * nbuckets);
     }
 
+  /* the first thread fills in the frame's buckets, the others
+     their own ones, which are added up after each batch */
+  max_threads = MIN (g_get_num_processors (),
+                     1 + (int) (THREAD_BUCKETS_MEMORY /
+                                (sizeof (bucket) * MAX (nbuckets, 1))));
+  max_threads = MAX (max_threads, 1);
+
+  thread_buckets = NULL;
+  if (max_threads > 1)
+    {
+      thread_buckets = malloc (sizeof (bucket) * nbuckets * (max_threads - 1));
+      if (thread_buckets == NULL)
+        max_threads = 1;
+    }
+
+  /* each thread draws its own stream of random numbers */
+  rands = g_new (GRand *, max_threads);
+  for (i = 0; i < max_threads; i++)
+    rands[i] = g_rand_new_with_seed (g_random_int ());
+
+  chaos_tasks = g_new (chaos_task, max_threads);
+
+  log_scale = malloc (sizeof (double) * (G_MAXSHORT + 1));
+
   memset ((char *) accumulate, 0, sizeof (abucket) * nbuckets);
   for (batch_num = 0; batch_num < nbatches; batch_num++)
     {
       double        batch_time;
       double        sample_density;
       control_point cp;
+      chaos_task   *tasks = chaos_tasks;
+      int           n_sub_batches;
       memset ((char *) buckets, 0, sizeof (bucket) * nbuckets);
       batch_time = spec->time + temporal_deltas[batch_num];
 
@@ -252,54 +519,44 @@ render_rectangle (frame_spec    *spec,
         }
       nsamples = (int) (sample_density * nbuckets /
                         (oversample * oversample));
+
+      /* stay within the sample budget, with the density the
+         samples really have, so that the brightness is kept */
+      if (spec->max_samples > 0 && nsamples > spec->max_samples)
+        {
+          sample_density *= (double) spec->max_samples / nsamples;
+          nsamples = spec->max_samples;
+        }
+
       batch_size = nsamples / cp.nbatches;
 
-      sbc = 0;
-      for (sub_batch = 0;
-           sub_batch < batch_size;
-           sub_batch += SUB_BATCH_SIZE)
+      n_sub_batches = (batch_size + SUB_BATCH_SIZE - 1) / SUB_BATCH_SIZE;
+      n_threads = CLAMP (n_sub_batches, 1, max_threads);
+
+      for (i = 0; i < n_threads; i++)
         {
-          if (progress && (sbc++ % 32) == 0)
-              (*progress)(0.5 * sub_batch / (double) batch_size);
-          /* generate a sub_batch_size worth of samples */
-          points[0][0] = random_uniform11 ();
-          points[0][1] = random_uniform11 ();
-          points[0][2] = random_uniform01 ();
-          iterate (&cp, SUB_BATCH_SIZE, FUSE, points);
-
-          /* merge them into buckets, looking up colors */
-          for (j = 0; j < SUB_BATCH_SIZE; j++)
-            {
-              int k, color_index;
-              double *p = points[j];
-              bucket *b;
-
-              /* Note that we must test if p[0] and p[1] is "within"
-               * the valid bounds rather than "not outside", because
-               * p[0] and p[1] might be NaN.
-               */
-              if (p[0] >= bounds[0] &&
-                  p[1] >= bounds[1] &&
-                  p[0] <= bounds[2] &&
-                  p[1] <= bounds[3])
-                {
-                  color_index = (int) (p[2] * CMAP_SIZE);
-
-                  if (color_index < 0)
-                    color_index = 0;
-                  else if (color_index > CMAP_SIZE - 1)
-                    color_index = CMAP_SIZE - 1;
-
-                  b = buckets +
-                      (int) (width * (p[0] - bounds[0]) * size[0]) +
-                      width * (int) (height * (p[1] - bounds[1]) * size[1]);
-
-                  for (k = 0; k < 4; k++)
-                    bump_no_overflow(b[0][k], cmap[color_index][k], short);
-                }
-            }
+          tasks[i].cp            = &cp;
+          tasks[i].buckets       = (i == 0) ? buckets :
+                                   thread_buckets + (i - 1) * nbuckets;
+          tasks[i].cmap          = cmap;
+          tasks[i].bounds        = bounds;
+          tasks[i].size          = size;
+          tasks[i].width         = width;
+          tasks[i].height        = height;
+          tasks[i].n_sub_batches = (n_sub_batches / n_threads +
+                                    (i < n_sub_batches % n_threads));
+          tasks[i].rand          = rands[i];
+          tasks[i].progress      = (i == 0) ? progress : NULL;
+
+          if (i > 0)
+            memset ((char *) tasks[i].buckets, 0, sizeof (bucket) * nbuckets);
         }
 
+      run_tasks (chaos_game, tasks, sizeof (chaos_task), n_threads);
+
+      for (i = 1; i < n_threads; i++)
+        merge_buckets (buckets, tasks[i].buckets, nbuckets);
+
       if (1)
         {
           double k1 = (cp.contrast * cp.brightness *
@@ -308,32 +565,33 @@ render_rectangle (frame_spec    *spec,
           double area = image_width * image_height / (ppux * ppuy);
           double k2 = (oversample * oversample * nbatches) /
                        (cp.contrast * area * cp.white_level * sample_density);
+          int    max_count = 0;
+
+          /* the log intensity scale only depends on the count of a
+             bucket, so look it up instead of computing it per bucket */
+          for (i = 0; i < nbuckets; i++)
+            max_count = MAX (max_count, buckets[i][3]);
+
+          log_scale[0] = 0.0;
+          for (i = 1; i <= max_count; i++)
+            log_scale[i] = (k1 * log(1.0 + i * k2)) / i;
 
           /* log intensity in hsv space */
-          for (j = 0; j < height; j++)
-            for (i = 0; i < width; i++)
-              {
-                abucket *a = accumulate + i + j * width;
-                bucket *b = buckets + i + j * width;
-                double c[4], ls;
-                c[0] = (double) b[0][0];
-                c[1] = (double) b[0][1];
-                c[2] = (double) b[0][2];
-                c[3] = (double) b[0][3];
-                if (0.0 == c[3])
-                  continue;
-
-                ls = (k1 * log(1.0 + c[3] * k2))/c[3];
-                c[0] *= ls;
-                c[1] *= ls;
-                c[2] *= ls;
-                c[3] *= ls;
-
-                bump_no_overflow(a[0][0], c[0] + 0.5, accum_t);
-                bump_no_overflow(a[0][1], c[1] + 0.5, accum_t);
-                bump_no_overflow(a[0][2], c[2] + 0.5, accum_t);
-                bump_no_overflow(a[0][3], c[3] + 0.5, accum_t);
-              }
+          for (i = 0; i < nbuckets; i++)
+            {
+              abucket *a = accumulate + i;
+              bucket  *b = buckets + i;
+              double   ls;
+              if (b[0][3] <= 0)
+                continue;
+
+              ls = log_scale[b[0][3]];
+
+              bump_no_overflow(a[0][0], b[0][0] * ls + 0.5, accum_t);
+              bump_no_overflow(a[0][1], b[0][1] * ls + 0.5, accum_t);
+              bump_no_overflow(a[0][2], b[0][2] * ls + 0.5, accum_t);
+              bump_no_overflow(a[0][3], b[0][3] * ls + 0.5, accum_t);
+            }
         }
     }
   /*
@@ -341,57 +599,45 @@ render_rectangle (frame_spec    *spec,
    */
   if (1)
     {
-      int    x, y;
-      double t[4];
-      double g = 1.0 / spec->cps[0].gamma;
-      y = 0;
-      for (j = 0; j < image_height; j++)
+      filter_task *tasks;
+
+      n_threads = MAX (1, MIN (g_get_num_processors (), image_height));
+
+      tasks = filter_tasks = g_new (filter_task, n_threads);
+
+      for (i = 0; i < n_threads; i++)
         {
-          if (progress && (j % 32) == 0)
-            (*progress)(0.5 + 0.5 * j / (double)image_height);
-          x = 0;
-          for (i = 0; i < image_width; i++)
-            {
-              int            ii, jj, a;
-              unsigned char *p;
-              t[0] = t[1] = t[2] = t[3] = 0.0;
-              for (ii = 0; ii < filter_width; ii++)
-                for (jj = 0; jj < filter_width; jj++)
-                  {
-                    double k = filter[ii + jj * filter_width];
-                    abucket *a = accumulate + x + ii + (y + jj) * width;
-
-                    t[0] += k * a[0][0];
-                    t[1] += k * a[0][1];
-                    t[2] += k * a[0][2];
-                    t[3] += k * a[0][3];
-                  }
-              /* FIXME: we should probably use glib facilities to make
-               * this code readable
-               */
-              p = out + nchan * (i + j * out_width);
-              a = 256.0 * pow((double) t[0] / PREFILTER_WHITE, g) + 0.5;
-              if (a < 0) a = 0; else if (a > 255) a = 255;
-              p[0] = a;
-              a = 256.0 * pow((double) t[1] / PREFILTER_WHITE, g) + 0.5;
-              if (a < 0) a = 0; else if (a > 255) a = 255;
-              p[1] = a;
-              a = 256.0 * pow((double) t[2] / PREFILTER_WHITE, g) + 0.5;
-              if (a < 0) a = 0; else if (a > 255) a = 255;
-              p[2] = a;
-              if (nchan > 3)
-                {
-                  a = 256.0 * pow((double) t[3] / PREFILTER_WHITE, g) + 0.5;
-                  if (a < 0) a = 0; else if (a > 255) a = 255;
-                  p[3] = a;
-                }
-              x += oversample;
-            }
-          y += oversample;
+          tasks[i].accumulate   = accumulate;
+          tasks[i].filter_x     = filter_x;
+          tasks[i].filter_y     = filter_y;
+          tasks[i].filter_width = filter_width;
+          tasks[i].oversample   = oversample;
+          tasks[i].width        = width;
+          tasks[i].image_width  = image_width;
+          tasks[i].first_row    = (image_height * i) / n_threads;
+          tasks[i].n_rows       = ((image_height * (i + 1)) / n_threads -
+                                   tasks[i].first_row);
+          tasks[i].gamma        = 1.0 / spec->cps[0].gamma;
+          tasks[i].out          = out;
+          tasks[i].out_width    = out_width;
+          tasks[i].nchan        = nchan;
+          tasks[i].progress     = (i == 0) ? progress : NULL;
         }
+
+      run_tasks (filter_rows, tasks, sizeof (filter_task), n_threads);
+
+      g_free (filter_tasks);
     }
 
-  free (filter);
+  for (i = 0; i < max_threads; i++)
+    g_rand_free (rands[i]);
+  g_free (rands);
+  g_free (chaos_tasks);
+
+  free (thread_buckets);
+  free (log_scale);
+  free (filter_x);
+  free (filter_y);
   free (temporal_filter);
   free (temporal_deltas);
 }
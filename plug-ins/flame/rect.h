@@ -27,6 +27,7 @@ typedef struct {
    control_point *cps;
    int           ncps;
    double        time;
+   int           max_samples;  /* per frame, no limit if 0 */
 } frame_spec;
 
 
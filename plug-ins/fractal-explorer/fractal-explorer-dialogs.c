@@ -35,6 +35,9 @@
 
 #define ZOOM_UNDO_SIZE 100
 
+#define PREVIEW_COARSE_STEP 4   /* pixels per point of the first pass  */
+#define PREVIEW_REFINE_ROWS 16  /* rows per idle call of the full pass */
+
 
 static gint              n_gradient_samples = 0;
 static gdouble          *gradient_samples = NULL;
@@ -54,6 +57,9 @@ static gint              oldypos = -1;
 static gdouble           x_press = -1.0;
 static gdouble           y_press = -1.0;
 
+static guint             preview_refine_id  = 0;
+static gint              preview_refine_row = 0;
+
 static explorer_vals_t standardvals =
 {
   0,
@@ -97,6 +103,15 @@ static void create_save_file_chooser   (GtkWidget      *widget,
 static void cmap_preview_size_allocate (GtkWidget      *widget,
                                         GtkAllocation  *allocation);
 
+static void     preview_set_scale      (gint            step);
+static void     preview_render_rows    (guchar         *data,
+                                        gint            width,
+                                        gint            height,
+                                        gint            y,
+                                        gint            n_rows);
+static gboolean preview_refine_idle    (gpointer        data);
+static void     preview_cancel         (void);
+
 /**********************************************************************
  CALLBACKS
  *********************************************************************/
@@ -1210,6 +1225,8 @@ explorer_dialog (void)
 
   gtk_main ();
 
+  preview_cancel ();
+
   g_free (wint.wimage);
 
   return wint.run;
@@ -1223,36 +1240,139 @@ explorer_dialog (void)
 void
 dialog_update_preview (void)
 {
-  gint     ycoord;
-  guchar  *p_ul;
-
   if (NULL == wint.preview)
     return;
 
+  preview_cancel ();
+
   if (ready_now && wvals.alwayspreview)
     {
+      gint    coarse_width;
+      gint    coarse_height;
+      guchar *coarse;
+      gint    xcoord;
+      gint    ycoord;
+
       xmin = wvals.xmin;
       xmax = wvals.xmax;
       ymin = wvals.ymin;
       ymax = wvals.ymax;
-      xbild = preview_width;
-      ybild = preview_height;
-      xdiff = (xmax - xmin) / xbild;
-      ydiff = (ymax - ymin) / ybild;
 
-      p_ul = wint.wimage;
+      /* A coarse pass right away, one point for each block of
+       * pixels, the full resolution rows are rendered a few at a
+       * time while the dialog is idle
+       */
+      coarse_width  = ((preview_width  + PREVIEW_COARSE_STEP - 1) /
+                       PREVIEW_COARSE_STEP);
+      coarse_height = ((preview_height + PREVIEW_COARSE_STEP - 1) /
+                       PREVIEW_COARSE_STEP);
+
+      coarse = g_new (guchar, coarse_width * coarse_height * 3);
+
+      preview_set_scale (PREVIEW_COARSE_STEP);
+      preview_render_rows (coarse, coarse_width, coarse_height,
+                           0, coarse_height);
 
       for (ycoord = 0; ycoord < preview_height; ycoord++)
         {
-          explorer_render_row (NULL,
-                               p_ul,
-                               ycoord,
-                               preview_width,
-                               3);
-          p_ul += preview_width * 3;
+          const guchar *src  = (coarse +
+                                (ycoord / PREVIEW_COARSE_STEP) *
+                                coarse_width * 3);
+          guchar       *dest = wint.wimage + ycoord * preview_width * 3;
+
+          for (xcoord = 0; xcoord < preview_width; xcoord++)
+            memcpy (dest + xcoord * 3,
+                    src + (xcoord / PREVIEW_COARSE_STEP) * 3, 3);
         }
 
+      g_free (coarse);
+
+      /*  the image was replaced, along with the crosshair in it  */
+      oldxpos = oldypos = -1;
+
+      preview_set_scale (1);
       preview_redraw ();
+
+      preview_refine_row = 0;
+      preview_refine_id  = g_idle_add (preview_refine_idle, NULL);
+    }
+}
+
+/* Maps the preview to the fractal, with one point for each block of
+ * step x step pixels
+ */
+static void
+preview_set_scale (gint step)
+{
+  xbild = preview_width;
+  ybild = preview_height;
+  xdiff = (xmax - xmin) / xbild * step;
+  ydiff = (ymax - ymin) / ybild * step;
+}
+
+/* Renders n_rows rows from y on of an RGB image of width x height
+ * pixels on all processors
+ */
+static void
+preview_render_rows (guchar *data,
+                     gint    width,
+                     gint    height,
+                     gint    y,
+                     gint    n_rows)
+{
+  const Babl *format = babl_format ("R'G'B' u8");
+  GeglBuffer *buffer;
+
+  buffer = gegl_buffer_linear_new_from_data (data, format,
+                                             GEGL_RECTANGLE (0, 0,
+                                                             width, height),
+                                             width * 3,
+                                             NULL, NULL);
+
+  explorer_render_buffer (buffer, GEGL_RECTANGLE (0, y, width, n_rows),
+                          format, PREVIEW_COARSE_STEP, FALSE);
+
+  g_object_unref (buffer);
+}
+
+static gboolean
+preview_refine_idle (gpointer data)
+{
+  gint n_rows = MIN (PREVIEW_REFINE_ROWS, preview_height - preview_refine_row);
+
+  /*  the crosshair is XORed into the image, take it out while the
+   *  rows under it are replaced
+   */
+  if (oldypos != -1)
+    preview_draw_crosshair (oldxpos, oldypos);
+
+  preview_set_scale (1);
+  preview_render_rows (wint.wimage, preview_width, preview_height,
+                       preview_refine_row, n_rows);
+
+  if (oldypos != -1)
+    preview_draw_crosshair (oldxpos, oldypos);
+
+  preview_refine_row += n_rows;
+
+  preview_redraw ();
+
+  if (preview_refine_row < preview_height)
+    return TRUE;
+
+  preview_refine_id = 0;
+
+  return FALSE;
+}
+
+/* Stops rendering the preview at full resolution */
+static void
+preview_cancel (void)
+{
+  if (preview_refine_id)
+    {
+      g_source_remove (preview_refine_id);
+      preview_refine_id = 0;
     }
 }
 
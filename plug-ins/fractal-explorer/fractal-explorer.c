@@ -70,6 +70,13 @@
 #include "libgimp/stdplugins-intl.h"
 
 
+/* the number of pixels explorer_iterate_lanes() iterates at once */
+#define EXPLORER_LANES          4
+
+/* how close a periodic orbit has to come back to a point */
+#define EXPLORER_PERIOD_EPSILON 1e-13
+
+
 /**********************************************************************
   Global variables
  *********************************************************************/
@@ -141,7 +148,18 @@ static void run   (const gchar      *name,
                    gint             *nreturn_vals,
                    GimpParam       **return_vals);
 
-static void explorer            (GimpDrawable *drawable);
+static void explorer               (GimpDrawable           *drawable);
+static gint explorer_iterate       (gdouble                 a,
+                                    gdouble                 b,
+                                    gdouble                *x_ret,
+                                    gdouble                *y_ret);
+static void explorer_iterate_lanes (const gdouble          *a,
+                                    gdouble                 b,
+                                    gint                   *counter,
+                                    gdouble                *x_ret,
+                                    gdouble                *y_ret);
+static void explorer_render_area   (const GimpParallelArea *area,
+                                    gpointer                data);
 
 /**********************************************************************
  Declare local functions
@@ -275,6 +293,7 @@ run (const gchar      *name,
   *return_vals = values;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   /*  Get the specified drawable  */
   drawable = gimp_drawable_get (param[2].data.d_drawable);
@@ -397,18 +416,12 @@ run (const gchar      *name,
 static void
 explorer (GimpDrawable * drawable)
 {
-  GimpPixelRgn  srcPR;
-  GimpPixelRgn  destPR;
-  gint          width;
-  gint          height;
-  gint          bpp;
-  gint          row;
+  GeglBuffer   *buffer;
+  const Babl   *format;
   gint          x1;
   gint          y1;
   gint          x2;
   gint          y2;
-  guchar       *src_row;
-  guchar       *dest_row;
 
   /* Get the input area. This is the bounding box of the selection in
    *  the image (or the entire image if there is no selection). Only
@@ -418,28 +431,28 @@ explorer (GimpDrawable * drawable)
    */
   gimp_drawable_mask_bounds (drawable->drawable_id, &x1, &y1, &x2, &y2);
 
-  /* Get the size of the input image. (This will/must be the same
-   *  as the size of the output image.
-   */
-  width  = drawable->width;
-  height = drawable->height;
-  bpp  = drawable->bpp;
-
-  /*  allocate row buffers  */
-  src_row  = g_new (guchar, bpp * (x2 - x1));
-  dest_row = g_new (guchar, bpp * (x2 - x1));
-
-  /*  initialize the pixel regions  */
-  gimp_pixel_rgn_init (&srcPR, drawable, 0, 0, width, height, FALSE, FALSE);
-  gimp_pixel_rgn_init (&destPR, drawable, 0, 0, width, height, TRUE, TRUE);
+  if (gimp_drawable_is_rgb (drawable->drawable_id))
+    {
+      if (gimp_drawable_has_alpha (drawable->drawable_id))
+        format = babl_format ("R'G'B'A u8");
+      else
+        format = babl_format ("R'G'B' u8");
+    }
+  else
+    {
+      if (gimp_drawable_has_alpha (drawable->drawable_id))
+        format = babl_format ("Y'A u8");
+      else
+        format = babl_format ("Y' u8");
+    }
 
-  xbild = width;
-  ybild = height;
+  xbild = drawable->width;
+  ybild = drawable->height;
   xdiff = (xmax - xmin) / xbild;
   ydiff = (ymax - ymin) / ybild;
 
   /* for grayscale drawables */
-  if (bpp < 3)
+  if (babl_format_get_bytes_per_pixel (format) < 3)
     {
       gint     i;
       for (i = 0; i < MAXNCOLORS; i++)
@@ -448,47 +461,32 @@ explorer (GimpDrawable * drawable)
                                             colormap[i].b);
     }
 
-  for (row = y1; row < y2; row++)
-    {
-      gimp_pixel_rgn_get_row (&srcPR, src_row, x1, row, (x2 - x1));
-
-      explorer_render_row (src_row,
-                           dest_row,
-                           row,
-                           (x2 - x1),
-                           bpp);
+  buffer = gimp_drawable_get_shadow_buffer (drawable->drawable_id);
 
-      /*  store the dest  */
-      gimp_pixel_rgn_set_row (&destPR, dest_row, x1, row, (x2 - x1));
+  explorer_render_buffer (buffer,
+                          GEGL_RECTANGLE (x1, y1, (x2 - x1), (y2 - y1)),
+                          format, 0, TRUE);
 
-      if ((row % 10) == 0)
-        gimp_progress_update ((double) row / (double) (y2 - y1));
-    }
-  gimp_progress_update (1.0);
+  g_object_unref (buffer);
 
   /*  update the processed region  */
-  gimp_drawable_flush (drawable);
   gimp_drawable_merge_shadow (drawable->drawable_id, TRUE);
   gimp_drawable_update (drawable->drawable_id, x1, y1, (x2 - x1), (y2 - y1));
-
-  g_free (src_row);
-  g_free (dest_row);
 }
 
 /**********************************************************************
- FUNCTION: explorer_render_row
+ FUNCTION: explorer_iterate
  *********************************************************************/
 
-void
-explorer_render_row (const guchar *src_row,
-                     guchar       *dest_row,
-                     gint          row,
-                     gint          row_width,
-                     gint          bpp)
+/* Iterates the point (a, b) of any of the fractal types, returns the
+ * number of iterations it took to escape and the point it escaped to.
+ */
+static gint
+explorer_iterate (gdouble  a,
+                  gdouble  b,
+                  gdouble *x_ret,
+                  gdouble *y_ret)
 {
-  gint    col;
-  gdouble a;
-  gdouble b;
   gdouble x;
   gdouble y;
   gdouble oldx;
@@ -502,181 +500,368 @@ explorer_render_row (const guchar *src_row,
   gdouble foldyinitx;
   gdouble foldyinity;
   gdouble xx = 0;
-  gdouble adjust;
-  gdouble cx;
-  gdouble cy;
+  gdouble cx = wvals.cx;
+  gdouble cy = wvals.cy;
+  gint    iteration = wvals.iter;
   gint    counter;
-  gint    color;
-  gint    iteration;
-  gint    useloglog;
-  gdouble log2;
 
-  cx = wvals.cx;
-  cy = wvals.cy;
-  useloglog = wvals.useloglog;
-  iteration = wvals.iter;
-  log2 = log (2.0);
+  if (wvals.fractaltype != 0)
+    {
+      tmpx = x = a;
+      tmpy = y = b;
+    }
+  else
+    {
+      x = 0;
+      y = 0;
+    }
 
-  for (col = 0; col < row_width; col++)
+  for (counter = 0; counter < iteration; counter++)
+    {
+      oldx=x;
+      oldy=y;
+
+      switch (wvals.fractaltype)
+        {
+        case TYPE_MANDELBROT:
+          xx = x * x - y * y + a;
+          y = 2.0 * x * y + b;
+          break;
+
+        case TYPE_JULIA:
+          xx = x * x - y * y + cx;
+          y = 2.0 * x * y + cy;
+          break;
+
+        case TYPE_BARNSLEY_1:
+          foldxinitx = oldx * cx;
+          foldyinity = oldy * cy;
+          foldxinity = oldx * cy;
+          foldyinitx = oldy * cx;
+          /* orbit calculation */
+          if (oldx >= 0)
+            {
+              xx = (foldxinitx - cx - foldyinity);
+              y  = (foldyinitx - cy + foldxinity);
+            }
+          else
+            {
+              xx = (foldxinitx + cx - foldyinity);
+              y  = (foldyinitx + cy + foldxinity);
+            }
+          break;
+
+        case TYPE_BARNSLEY_2:
+          foldxinitx = oldx * cx;
+          foldyinity = oldy * cy;
+          foldxinity = oldx * cy;
+          foldyinitx = oldy * cx;
+          /* orbit calculation */
+          if (foldxinity + foldyinitx >= 0)
+            {
+              xx = foldxinitx - cx - foldyinity;
+              y  = foldyinitx - cy + foldxinity;
+            }
+          else
+            {
+              xx = foldxinitx + cx - foldyinity;
+              y  = foldyinitx + cy + foldxinity;
+            }
+          break;
+
+        case TYPE_BARNSLEY_3:
+          foldxinitx  = oldx * oldx;
+          foldyinity  = oldy * oldy;
+          foldxinity  = oldx * oldy;
+          /* orbit calculation */
+          if (oldx > 0)
+            {
+              xx = foldxinitx - foldyinity - 1.0;
+              y  = foldxinity * 2;
+            }
+          else
+            {
+              xx = foldxinitx - foldyinity -1.0 + cx * oldx;
+              y  = foldxinity * 2;
+              y += cy * oldx;
+            }
+          break;
+
+        case TYPE_SPIDER:
+          /* { c=z=pixel: z=z*z+c; c=c/2+z, |z|<=4 } */
+          xx = x*x - y*y + tmpx + cx;
+          y = 2 * oldx * oldy + tmpy +cy;
+          tmpx = tmpx/2 + xx;
+          tmpy = tmpy/2 + y;
+          break;
+
+        case TYPE_MAN_O_WAR:
+          xx = x*x - y*y + tmpx + cx;
+          y = 2.0 * x * y + tmpy + cy;
+          tmpx = oldx;
+          tmpy = oldy;
+          break;
+
+        case TYPE_LAMBDA:
+          tempsqrx = x * x;
+          tempsqry = y * y;
+          tempsqrx = oldx - tempsqrx + tempsqry;
+          tempsqry = -(oldy * oldx);
+          tempsqry += tempsqry + oldy;
+          xx = cx * tempsqrx - cy * tempsqry;
+          y = cx * tempsqry + cy * tempsqrx;
+          break;
+
+        case TYPE_SIERPINSKI:
+          xx = oldx + oldx;
+          y = oldy + oldy;
+          if (oldy > .5)
+            y = y - 1;
+          else if (oldx > .5)
+            xx = xx - 1;
+          break;
+
+        default:
+          break;
+        }
+
+      x = xx;
+
+      if (((x * x) + (y * y)) >= 4.0)
+        break;
+    }
+
+  *x_ret = x;
+  *y_ret = y;
+
+  return counter;
+}
+
+/**********************************************************************
+ FUNCTION: explorer_iterate_lanes
+ *********************************************************************/
+
+/* Iterates EXPLORER_LANES points (a[i], b) of the Mandelbrot or Julia
+ * set at once. Each step runs over all lanes in a plain loop the
+ * compiler can vectorize; lanes that are done keep their values.
+ *
+ * The orbit is compared to a point saved at growing intervals (Brent's
+ * method), an orbit that comes back to it is periodic and the point is
+ * inside the set, which saves iterating it up to the maximum.
+ */
+static void
+explorer_iterate_lanes (const gdouble *a,
+                        gdouble        b,
+                        gint          *counter,
+                        gdouble       *x_ret,
+                        gdouble       *y_ret)
+{
+  gdouble  x[EXPLORER_LANES];
+  gdouble  y[EXPLORER_LANES];
+  gdouble  ca[EXPLORER_LANES];
+  gdouble  cb[EXPLORER_LANES];
+  gdouble  saved_x[EXPLORER_LANES];
+  gdouble  saved_y[EXPLORER_LANES];
+  gboolean active[EXPLORER_LANES];
+  gint     iteration = wvals.iter;
+  gint     n_active  = EXPLORER_LANES;
+  gint     period    = 8;
+  gint     since     = 0;
+  gint     n;
+  gint     i;
+
+  for (i = 0; i < EXPLORER_LANES; i++)
     {
-      a = xmin + (double) col * xdiff;
-      b = ymin + (double) row * ydiff;
-      if (wvals.fractaltype != 0)
+      if (wvals.fractaltype == TYPE_MANDELBROT)
         {
-          tmpx = x = a;
-          tmpy = y = b;
+          x[i]  = 0.0;
+          y[i]  = 0.0;
+          ca[i] = a[i];
+          cb[i] = b;
         }
       else
         {
-          x = 0;
-          y = 0;
+          x[i]  = a[i];
+          y[i]  = b;
+          ca[i] = wvals.cx;
+          cb[i] = wvals.cy;
         }
 
-      for (counter = 0; counter < iteration; counter++)
+      saved_x[i] = x[i];
+      saved_y[i] = y[i];
+      active[i]  = TRUE;
+      counter[i] = iteration;
+    }
+
+  for (n = 0; n < iteration && n_active > 0; n++)
+    {
+      for (i = 0; i < EXPLORER_LANES; i++)
         {
-          oldx=x;
-          oldy=y;
+          gdouble xx = x[i] * x[i] - y[i] * y[i] + ca[i];
+          gdouble yy = 2.0 * x[i] * y[i] + cb[i];
 
-          switch (wvals.fractaltype)
+          x[i] = active[i] ? xx : x[i];
+          y[i] = active[i] ? yy : y[i];
+        }
+
+      for (i = 0; i < EXPLORER_LANES; i++)
+        {
+          if (! active[i])
+            continue;
+
+          if (((x[i] * x[i]) + (y[i] * y[i])) >= 4.0)
             {
-            case TYPE_MANDELBROT:
-              xx = x * x - y * y + a;
-              y = 2.0 * x * y + b;
-              break;
-
-            case TYPE_JULIA:
-              xx = x * x - y * y + cx;
-              y = 2.0 * x * y + cy;
-              break;
-
-            case TYPE_BARNSLEY_1:
-              foldxinitx = oldx * cx;
-              foldyinity = oldy * cy;
-              foldxinity = oldx * cy;
-              foldyinitx = oldy * cx;
-              /* orbit calculation */
-              if (oldx >= 0)
-                {
-                  xx = (foldxinitx - cx - foldyinity);
-                  y  = (foldyinitx - cy + foldxinity);
-                }
-              else
-                {
-                  xx = (foldxinitx + cx - foldyinity);
-                  y  = (foldyinitx + cy + foldxinity);
-                }
-              break;
-
-            case TYPE_BARNSLEY_2:
-              foldxinitx = oldx * cx;
-              foldyinity = oldy * cy;
-              foldxinity = oldx * cy;
-              foldyinitx = oldy * cx;
-              /* orbit calculation */
-              if (foldxinity + foldyinitx >= 0)
-                {
-                  xx = foldxinitx - cx - foldyinity;
-                  y  = foldyinitx - cy + foldxinity;
-                }
-              else
-                {
-                  xx = foldxinitx + cx - foldyinity;
-                  y  = foldyinitx + cy + foldxinity;
-                }
-              break;
-
-            case TYPE_BARNSLEY_3:
-              foldxinitx  = oldx * oldx;
-              foldyinity  = oldy * oldy;
-              foldxinity  = oldx * oldy;
-              /* orbit calculation */
-              if (oldx > 0)
-                {
-                  xx = foldxinitx - foldyinity - 1.0;
-                  y  = foldxinity * 2;
-                }
-              else
-                {
-                  xx = foldxinitx - foldyinity -1.0 + cx * oldx;
-                  y  = foldxinity * 2;
-                  y += cy * oldx;
-                }
-              break;
-
-            case TYPE_SPIDER:
-              /* { c=z=pixel: z=z*z+c; c=c/2+z, |z|<=4 } */
-              xx = x*x - y*y + tmpx + cx;
-              y = 2 * oldx * oldy + tmpy +cy;
-              tmpx = tmpx/2 + xx;
-              tmpy = tmpy/2 + y;
-              break;
-
-            case TYPE_MAN_O_WAR:
-              xx = x*x - y*y + tmpx + cx;
-              y = 2.0 * x * y + tmpy + cy;
-              tmpx = oldx;
-              tmpy = oldy;
-              break;
-
-            case TYPE_LAMBDA:
-              tempsqrx = x * x;
-              tempsqry = y * y;
-              tempsqrx = oldx - tempsqrx + tempsqry;
-              tempsqry = -(oldy * oldx);
-              tempsqry += tempsqry + oldy;
-              xx = cx * tempsqrx - cy * tempsqry;
-              y = cx * tempsqry + cy * tempsqrx;
-              break;
-
-            case TYPE_SIERPINSKI:
-              xx = oldx + oldx;
-              y = oldy + oldy;
-              if (oldy > .5)
-                y = y - 1;
-              else if (oldx > .5)
-                xx = xx - 1;
-              break;
-
-            default:
-              break;
+              counter[i] = n;
+              active[i]  = FALSE;
+              n_active--;
+            }
+          else if (fabs (x[i] - saved_x[i]) < EXPLORER_PERIOD_EPSILON &&
+                   fabs (y[i] - saved_y[i]) < EXPLORER_PERIOD_EPSILON)
+            {
+              active[i] = FALSE;
+              n_active--;
             }
+        }
 
-          x = xx;
+      if (++since == period)
+        {
+          since   = 0;
+          period *= 2;
 
-          if (((x * x) + (y * y)) >= 4.0)
-            break;
+          memcpy (saved_x, x, sizeof (x));
+          memcpy (saved_y, y, sizeof (y));
         }
+    }
 
-      if (useloglog)
-        {
-          gdouble modulus_square = (x * x) + (y * y);
+  memcpy (x_ret, x, sizeof (x));
+  memcpy (y_ret, y, sizeof (y));
+}
 
-          if (modulus_square > (G_E * G_E))
-              adjust = log (log (modulus_square) / 2.0) / log2;
-          else
-              adjust = 0.0;
+/**********************************************************************
+ FUNCTION: explorer_render_row
+ *********************************************************************/
+
+void
+explorer_render_row (const guchar *src_row,
+                     guchar       *dest_row,
+                     gint          row,
+                     gint          row_width,
+                     gint          bpp)
+{
+  gint     col;
+  gdouble  b;
+  gdouble  adjust;
+  gint     color;
+  gint     iteration;
+  gint     useloglog;
+  gdouble  log2;
+  gboolean lanes;
+
+  useloglog = wvals.useloglog;
+  iteration = wvals.iter;
+  log2 = log (2.0);
+  lanes = (wvals.fractaltype == TYPE_MANDELBROT ||
+           wvals.fractaltype == TYPE_JULIA);
+
+  b = ymin + (double) row * ydiff;
+
+  for (col = 0; col < row_width; col += EXPLORER_LANES)
+    {
+      gdouble a[EXPLORER_LANES];
+      gdouble x[EXPLORER_LANES];
+      gdouble y[EXPLORER_LANES];
+      gint    counter[EXPLORER_LANES];
+      gint    n_pixels = MIN (EXPLORER_LANES, row_width - col);
+      gint    i;
+
+      /*  the lanes past the end of the row repeat its last pixel  */
+      for (i = 0; i < EXPLORER_LANES; i++)
+        a[i] = xmin + (double) (col + MIN (i, n_pixels - 1)) * xdiff;
+
+      if (lanes)
+        {
+          explorer_iterate_lanes (a, b, counter, x, y);
         }
       else
         {
-          adjust = 0.0;
+          for (i = 0; i < n_pixels; i++)
+            counter[i] = explorer_iterate (a[i], b, &x[i], &y[i]);
         }
 
-      color = (int) (((counter - adjust) * (wvals.ncolors - 1)) / iteration);
-      if (bpp >= 3)
+      for (i = 0; i < n_pixels; i++)
         {
-          dest_row[col * bpp + 0] = colormap[color].r;
-          dest_row[col * bpp + 1] = colormap[color].g;
-          dest_row[col * bpp + 2] = colormap[color].b;
+          guchar *dest = dest_row + (col + i) * bpp;
+
+          if (useloglog)
+            {
+              gdouble modulus_square = (x[i] * x[i]) + (y[i] * y[i]);
+
+              if (modulus_square > (G_E * G_E))
+                  adjust = log (log (modulus_square) / 2.0) / log2;
+              else
+                  adjust = 0.0;
+            }
+          else
+            {
+              adjust = 0.0;
+            }
+
+          color = (int) (((counter[i] - adjust) * (wvals.ncolors - 1)) /
+                         iteration);
+          if (bpp >= 3)
+            {
+              dest[0] = colormap[color].r;
+              dest[1] = colormap[color].g;
+              dest[2] = colormap[color].b;
+            }
+          else
+              dest[0] = valuemap[color];
+
+          if (! ( bpp % 2))
+            dest[bpp - 1] = 255;
         }
-      else
-          dest_row[col * bpp + 0] = valuemap[color];
+    }
+}
+
+/**********************************************************************
+ FUNCTION: explorer_render_buffer
+ *********************************************************************/
 
-      if (! ( bpp % 2))
-        dest_row [col * bpp + bpp - 1] = 255;
+static void
+explorer_render_area (const GimpParallelArea *area,
+                      gpointer                data)
+{
+  gint row;
 
+  for (row = area->roi.y; row < area->roi.y + area->roi.height; row++)
+    {
+      explorer_render_row (NULL,
+                           area->dest +
+                           (row - area->roi.y) * area->dest_rowstride,
+                           row,
+                           area->roi.width,
+                           area->bpp);
     }
 }
 
+/* Renders the rows of rect into buffer on all processors, in areas of
+ * area_height rows, or of the tile height if area_height is 0. Like
+ * explorer_render_row(), the columns are counted from rect's left edge.
+ */
+void
+explorer_render_buffer (GeglBuffer          *buffer,
+                        const GeglRectangle *rect,
+                        const Babl          *format,
+                        gint                 area_height,
+                        gboolean             show_progress)
+{
+  gimp_parallel_process (NULL, NULL, buffer, rect, format,
+                         0, 0, GEGL_ABYSS_NONE,
+                         rect->width, area_height,
+                         explorer_render_area, NULL,
+                         0.0, show_progress ? 1.0 : 0.0);
+}
+
 static void
 delete_dialog_callback (GtkWidget *widget,
                         gboolean   delete,
@@ -208,9 +208,14 @@ extern GimpDrawable   *drawable;
   Global functions
  *********************************************************************/
 
-void explorer_render_row (const guchar *src_row,
-                          guchar       *dest_row,
-                          gint          row,
-                          gint          row_width,
-                          gint          bpp);
+void explorer_render_row    (const guchar        *src_row,
+                             guchar              *dest_row,
+                             gint                 row,
+                             gint                 row_width,
+                             gint                 bpp);
+void explorer_render_buffer (GeglBuffer          *buffer,
+                             const GeglRectangle *rect,
+                             const Babl          *format,
+                             gint                 area_height,
+                             gboolean             show_progress);
 #endif
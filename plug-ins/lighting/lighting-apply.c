@@ -16,6 +16,36 @@
 #include "libgimp/stdplugins-intl.h"
 
 
+static void
+compute_rows (const GimpParallelArea *area,
+              gpointer                data)
+{
+  get_ray_func  ray_func   = *(get_ray_func *) data;
+  const gint    n_channels = area->bpp / sizeof (gfloat);
+  gint          x, y;
+
+  for (y = area->roi.y; y < area->roi.y + area->roi.height; y++)
+    {
+      gfloat *dest = (gfloat *) (area->dest +
+                                 (y - area->roi.y) * area->dest_rowstride);
+
+      for (x = area->roi.x; x < area->roi.x + area->roi.width; x++)
+        {
+          GimpVector3 p     = int_to_pos (x, y);
+          GimpRGB     color = (* ray_func) (&p);
+
+          dest[0] = color.r;
+          dest[1] = color.g;
+          dest[2] = color.b;
+
+          if (n_channels == 4)
+            dest[3] = color.a;
+
+          dest += n_channels;
+        }
+    }
+}
+
 /*************/
 /* Main loop */
 /*************/
@@ -23,19 +53,11 @@
 void
 compute_image (void)
 {
-  gint         xcount, ycount;
-  GimpRGB       color;
-  glong        progress_counter = 0;
-  GimpVector3  p;
-  gint32       new_image_id = -1;
-  gint32       new_layer_id = -1;
-  gint32       index;
-  guchar      *row = NULL;
-  guchar       obpp;
-  gboolean     has_alpha;
-  get_ray_func ray_func;
-
-
+  gint32        new_image_id = -1;
+  gint32        new_layer_id = -1;
+  GeglBuffer   *dest_buffer;
+  const Babl   *format;
+  get_ray_func  ray_func;
 
   if (mapvals.create_new_image == TRUE ||
       (mapvals.transparent_background == TRUE &&
@@ -73,76 +95,45 @@ compute_image (void)
       output_drawable = gimp_drawable_get (new_layer_id);
     }
 
-  if (mapvals.bump_mapped == TRUE && mapvals.bumpmap_id != -1)
-    {
-      gimp_pixel_rgn_init (&bump_region, gimp_drawable_get (mapvals.bumpmap_id),
-			   0, 0, width, height, FALSE, FALSE);
-    }
+  /* Read the maps before asking for the output's buffer, which  */
+  /* switches the plug-in to the precision of the image          */
+  /* =========================================================== */
 
-  precompute_init (width, height);
+  bumpmap_setup ();
+  envmap_setup ();
 
   if (!mapvals.env_mapped || mapvals.envmap_id == -1)
-    {
-      ray_func = get_ray_color;
-    }
+    ray_func = get_ray_color;
   else
-    {
-      env_width = gimp_drawable_width (mapvals.envmap_id);
-      env_height = gimp_drawable_height (mapvals.envmap_id);
-      gimp_pixel_rgn_init (&env_region, gimp_drawable_get (mapvals.envmap_id),
-			   0, 0, env_width, env_height, FALSE, FALSE);
-      ray_func = get_ray_color_ref;
-    }
-
-  gimp_pixel_rgn_init (&dest_region, output_drawable,
-		       0, 0, width, height, TRUE, TRUE);
+    ray_func = get_ray_color_ref;
 
-  obpp = gimp_drawable_bpp (output_drawable->drawable_id);
-  has_alpha = gimp_drawable_has_alpha (output_drawable->drawable_id);
-
-  row = g_new (guchar, obpp * width);
+  if (gimp_drawable_has_alpha (output_drawable->drawable_id))
+    format = babl_format ("R'G'B'A float");
+  else
+    format = babl_format ("R'G'B' float");
 
   gimp_progress_init (_("Lighting Effects"));
 
-  /* Init the first row */
-  if (mapvals.bump_mapped == TRUE && mapvals.bumpmap_id != -1 && height >= 2)
-    interpol_row (0, width, 0);
+  /* Render rows of tiles on all processors, the results are  */
+  /* written to the shadow tiles as they come in              */
+  /* ======================================================== */
 
-  for (ycount = 0; ycount < height; ycount++)
-    {
-      if (mapvals.bump_mapped == TRUE && mapvals.bumpmap_id != -1)
-	precompute_normals (0, width, ycount);
-
-      index = 0;
-
-      for (xcount = 0; xcount < width; xcount++)
-	{
-	  p = int_to_pos (xcount, ycount);
-	  color = (* ray_func) (&p);
-
-	  row[index++] = (guchar) (color.r * 255.0);
-	  row[index++] = (guchar) (color.g * 255.0);
-	  row[index++] = (guchar) (color.b * 255.0);
+  dest_buffer = gimp_drawable_get_shadow_buffer (output_drawable->drawable_id);
 
-	  if (has_alpha)
-	    row[index++] = (guchar) (color.a * 255.0);
+  gimp_parallel_process (NULL, NULL, dest_buffer,
+                         GEGL_RECTANGLE (0, 0, width, height), format,
+                         0, 0, GEGL_ABYSS_NONE,
+                         width, 0,
+                         compute_rows, &ray_func,
+                         0.0, 1.0);
 
-	  if ((progress_counter++ % width) == 0)
-	    gimp_progress_update ((gdouble) progress_counter /
-				  (gdouble) maxcounter);
-	}
-
-      gimp_pixel_rgn_set_row (&dest_region, row, 0, ycount, width);
-    }
+  g_object_unref (dest_buffer);
 
   gimp_progress_update (1.0);
 
-  g_free (row);
-
   /* Update image */
   /* ============ */
 
-  gimp_drawable_flush (output_drawable);
   gimp_drawable_merge_shadow (output_drawable->drawable_id, TRUE);
   gimp_drawable_update (output_drawable->drawable_id, 0, 0, width, height);
 
@@ -11,17 +11,15 @@
 #include "lighting-main.h"
 #include "lighting-image.h"
 #include "lighting-preview.h"
+#include "lighting-shade.h"
 #include "lighting-ui.h"
 
 
 GimpDrawable *input_drawable,*output_drawable;
-GimpPixelRgn  source_region, dest_region;
 
 GimpDrawable *bump_drawable = NULL;
-GimpPixelRgn  bump_region;
 
 GimpDrawable *env_drawable = NULL;
-GimpPixelRgn  env_region;
 
 guchar          *preview_rgb_data = NULL;
 gint             preview_rgb_stride;
@@ -35,40 +33,27 @@ gint border_x1, border_y1, border_x2, border_y2;
 
 guchar sinemap[256], spheremap[256], logmap[256];
 
+/* The input image and the environment map are read into memory once,
+ * so that the shading functions can look at any pixel from any thread.
+ */
+static guchar *source_data = NULL;
+
+static guchar *env_data    = NULL;
+static gint32  env_id      = -1;
+static gint    env_bpp;
+
 /******************/
 /* Implementation */
 /******************/
 
-guchar
-peek_map (GimpPixelRgn *region,
-	  gint       x,
-	  gint       y)
-{
-  guchar data[4];
-  guchar ret_val;
-
-
-  gimp_pixel_rgn_get_pixel (region, data, x, y);
-
-  if (region->bpp == 1)
-  {
-    ret_val = data[0];
-  } else
-  {
-    ret_val = (guchar)((float)((data[0] + data[1] + data[2])/3.0));
-  }
-
-  return ret_val;
-}
-
 GimpRGB
 peek (gint x,
       gint y)
 {
-  guchar data[4];
-  GimpRGB color;
+  const guchar *data;
+  GimpRGB       color;
 
-  gimp_pixel_rgn_get_pixel (&source_region,data, x, y);
+  data = source_data + ((gsize) y * width + x) * input_drawable->bpp;
 
   color.r = (gdouble) (data[0]) / 255.0;
   color.g = (gdouble) (data[1]) / 255.0;
@@ -93,8 +78,8 @@ GimpRGB
 peek_env_map (gint x,
 	      gint y)
 {
-  guchar data[4];
-  GimpRGB color;
+  const guchar *data;
+  GimpRGB       color;
 
   if (x < 0)
     x = 0;
@@ -105,7 +90,7 @@ peek_env_map (gint x,
   else if (y >= env_height)
     y = env_height - 1;
 
-  gimp_pixel_rgn_get_pixel (&env_region, data, x, y);
+  data = env_data + ((gsize) y * env_width + x) * env_bpp;
 
   color.r = (gdouble) (data[0]) / 255.0;
   color.g = (gdouble) (data[1]) / 255.0;
@@ -115,30 +100,6 @@ peek_env_map (gint x,
   return color;
 }
 
-void
-poke (gint    x,
-      gint    y,
-      GimpRGB *color)
-{
-  static guchar data[4];
-
-  if (x < 0)
-    x = 0;
-  else if (x >= width)
-    x = width - 1;
-  if (y < 0)
-    y = 0;
-  else if (y >= height)
-    y = height - 1;
-
-  data[0] = (guchar) (color->r * 255.0);
-  data[1] = (guchar) (color->g * 255.0);
-  data[2] = (guchar) (color->b * 255.0);
-  data[3] = (guchar) (color->a * 255.0);
-
-  gimp_pixel_rgn_set_pixel (&dest_region, data, x, y);
-}
-
 gint
 check_bounds (gint x,
 	      gint y)
@@ -282,36 +243,6 @@ get_image_color (gdouble  u,
   return gimp_bilinear_rgba (u, v, p);
 }
 
-gdouble
-get_map_value (GimpPixelRgn *region,
-	       gdouble    u,
-	       gdouble    v,
-	       gint      *inside)
-{
-  gint    x1, y1, x2, y2;
-  gdouble p[4];
-
-  x1 = RINT (u);
-  y1 = RINT (v);
-
-  x2 = (x1 + 1);
-  y2 = (y1 + 1);
-
-  if (check_bounds (x2, y2) == FALSE)
-    {
-      *inside = TRUE;
-      return (gdouble) peek_map (region, x1, y1);
-    }
-
-  *inside = TRUE;
-  p[0] = (gdouble) peek_map (region, x1, y1);
-  p[1] = (gdouble) peek_map (region, x2, y1);
-  p[2] = (gdouble) peek_map (region, x1, y2);
-  p[3] = (gdouble) peek_map (region, x2, y2);
-
-  return gimp_bilinear (u, v, p);
-}
-
 static void
 compute_maps (void)
 {
@@ -347,6 +278,8 @@ gint
 image_setup (GimpDrawable *drawable,
 	     gint          interactive)
 {
+  GimpPixelRgn region;
+
   compute_maps ();
 
   /* Get some useful info on the input drawable */
@@ -361,8 +294,12 @@ image_setup (GimpDrawable *drawable,
   width  = input_drawable->width;
   height = input_drawable->height;
 
-  gimp_pixel_rgn_init (&source_region, input_drawable,
-		       0, 0, width, height, FALSE, FALSE);
+  g_free (source_data);
+  source_data = g_new (guchar, (gsize) width * height * input_drawable->bpp);
+
+  gimp_pixel_rgn_init (&region, input_drawable,
+                       0, 0, width, height, FALSE, FALSE);
+  gimp_pixel_rgn_get_rect (&region, source_data, 0, 0, width, height);
 
   maxcounter = (glong) width * (glong) height;
 
@@ -387,3 +324,51 @@ image_setup (GimpDrawable *drawable,
 
   return TRUE;
 }
+
+/*****************************************/
+/* Read the environment map into memory  */
+/*****************************************/
+
+void
+envmap_setup (void)
+{
+  GimpDrawable *drawable;
+  GimpPixelRgn  region;
+
+  if (! mapvals.env_mapped || mapvals.envmap_id == -1 ||
+      env_id == mapvals.envmap_id)
+    return;
+
+  g_free (env_data);
+
+  drawable = gimp_drawable_get (mapvals.envmap_id);
+
+  env_id     = mapvals.envmap_id;
+  env_width  = drawable->width;
+  env_height = drawable->height;
+  env_bpp    = drawable->bpp;
+  env_data   = g_new (guchar, (gsize) env_width * env_height * env_bpp);
+
+  gimp_pixel_rgn_init (&region, drawable,
+                       0, 0, env_width, env_height, FALSE, FALSE);
+  gimp_pixel_rgn_get_rect (&region, env_data, 0, 0, env_width, env_height);
+
+  gimp_drawable_detach (drawable);
+}
+
+/**************************/
+/* Free the memory images */
+/**************************/
+
+void
+image_cleanup (void)
+{
+  g_free (source_data);
+  g_free (env_data);
+
+  source_data = NULL;
+  env_data    = NULL;
+  env_id      = -1;
+
+  bumpmap_free ();
+}
@@ -218,6 +218,7 @@ run (const gchar      *name,
   run_mode = param[0].data.d_int32;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   *nreturn_vals = 1;
   *return_vals = values;
@@ -319,6 +320,8 @@ run (const gchar      *name,
   values[0].data.d_status = status;
   gimp_drawable_detach (drawable);
 
+  image_cleanup ();
+
   g_free (xpostab);
   g_free (ypostab);
 }
@@ -4,6 +4,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 
 #include <libgimp/gimp.h>
@@ -18,7 +20,18 @@
 #include "lighting-preview.h"
 
 
-#define LIGHT_SYMBOL_SIZE 8
+#define LIGHT_SYMBOL_SIZE   8
+
+#define PREVIEW_COARSE_STEP 4   /* pixels per ray of the first pass    */
+#define PREVIEW_REFINE_ROWS 16  /* rows per idle call of the full pass */
+
+typedef struct
+{
+  get_ray_func ray_func;
+  gint         startx, starty, w, h;
+  gint         step;
+  GimpRGB      lightcheck, darkcheck;
+} PreviewRender;
 
 static gint handle_xpos = 0, handle_ypos = 0;
 
@@ -33,23 +46,147 @@ static gboolean    light_hit           = FALSE;
 static gboolean    left_button_pressed = FALSE;
 static guint preview_update_timer = 0;
 
+static PreviewRender preview_render;
+static guint         preview_refine_id  = 0;
+static gint          preview_refine_row = 0;
+
 
 /* Protos */
 /* ====== */
 static gboolean
 interactive_preview_timer_callback ( gpointer data );
 
+static gboolean preview_refine_idle (gpointer      data);
+static void     preview_set_cursor  (GdkCursorType type);
+
+/* Renders one pixel of the preview */
 static void
-compute_preview (gint startx, gint starty, gint w, gint h)
+compute_preview_pixel (const PreviewRender *render,
+                       gint                 xcnt,
+                       gint                 ycnt,
+                       guchar              *dest)
 {
-  gint xcnt, ycnt, f1, f2;
   guchar r, g, b;
-  gdouble imagex, imagey;
-  gint32 index = 0;
-  GimpRGB color;
-  GimpRGB lightcheck, darkcheck;
-  GimpVector3 pos;
-  get_ray_func ray_func;
+
+  if ((ycnt >= render->starty && ycnt < (render->starty + render->h)) &&
+      (xcnt >= render->startx && xcnt < (render->startx + render->w)))
+    {
+      GimpVector3 pos;
+      GimpRGB     color;
+      gint        f1, f2;
+
+      pos = int_to_posf (xpostab[xcnt - render->startx],
+                         ypostab[ycnt - render->starty]);
+
+      color = (* render->ray_func) (&pos);
+
+      if (color.a < 1.0)
+        {
+          f1 = ((xcnt % 32) < 16);
+          f2 = ((ycnt % 32) < 16);
+          f1 = f1 ^ f2;
+
+          if (f1)
+            {
+              if (color.a == 0.0)
+                color = render->lightcheck;
+              else
+                gimp_rgb_composite (&color,
+                                    &render->lightcheck,
+                                    GIMP_RGB_COMPOSITE_BEHIND);
+            }
+          else
+            {
+              if (color.a == 0.0)
+                color = render->darkcheck;
+              else
+                gimp_rgb_composite (&color,
+                                    &render->darkcheck,
+                                    GIMP_RGB_COMPOSITE_BEHIND);
+            }
+        }
+
+      gimp_rgb_get_uchar (&color, &r, &g, &b);
+    }
+  else
+    {
+      r = g = b = 200;
+    }
+
+  GIMP_CAIRO_RGB24_SET_PIXEL (dest, r, g, b);
+}
+
+/* Renders an area of the preview, with one ray for each block of
+ * step x step pixels
+ */
+static void
+compute_preview_area (const GimpParallelArea *area,
+                      gpointer                data)
+{
+  const PreviewRender *render = data;
+  gint                 xcnt, ycnt;
+
+  for (ycnt = area->roi.y; ycnt < area->roi.y + area->roi.height; ycnt++)
+    {
+      guchar *dest = area->dest + (ycnt - area->roi.y) * area->dest_rowstride;
+      gint    ay   = ycnt - ycnt % render->step;
+
+      for (xcnt = area->roi.x; xcnt < area->roi.x + area->roi.width; xcnt++)
+        {
+          gint ax = xcnt - xcnt % render->step;
+
+          if ((ax != xcnt || ay != ycnt) &&
+              ax >= area->roi.x && ay >= area->roi.y)
+            {
+              memcpy (dest,
+                      area->dest +
+                      (ay - area->roi.y) * area->dest_rowstride +
+                      (ax - area->roi.x) * 4,
+                      4);
+            }
+          else
+            {
+              compute_preview_pixel (render, xcnt, ycnt, dest);
+            }
+
+          dest += 4;
+        }
+    }
+}
+
+/* Renders the preview rows from y to y + h on all processors */
+static void
+compute_preview_rows (gint y,
+                      gint h)
+{
+  const Babl *format = babl_format ("cairo-RGB24");
+  GeglBuffer *buffer;
+
+  cairo_surface_flush (preview_surface);
+
+  buffer = gegl_buffer_linear_new_from_data (preview_rgb_data, format,
+                                             GEGL_RECTANGLE (0, 0,
+                                                             PREVIEW_WIDTH,
+                                                             PREVIEW_HEIGHT),
+                                             preview_rgb_stride,
+                                             NULL, NULL);
+
+  gimp_parallel_process (NULL, NULL, buffer,
+                         GEGL_RECTANGLE (0, y, PREVIEW_WIDTH, h), format,
+                         0, 0, GEGL_ABYSS_NONE,
+                         PREVIEW_WIDTH, PREVIEW_COARSE_STEP,
+                         compute_preview_area, &preview_render,
+                         0.0, 0.0);
+
+  g_object_unref (buffer);
+
+  cairo_surface_mark_dirty (preview_surface);
+}
+
+static void
+compute_preview (gint startx, gint starty, gint w, gint h)
+{
+  gint xcnt, ycnt;
 
   if (xpostab_size != w)
     {
@@ -86,108 +223,76 @@ compute_preview (gint startx, gint starty, gint w, gint h)
   for (ycnt = 0; ycnt < h; ycnt++)
     ypostab[ycnt] = (gdouble) height *((gdouble) ycnt / (gdouble) h);
 
-  precompute_init (width, height);
+  preview_render.startx = startx;
+  preview_render.starty = starty;
+  preview_render.w      = w;
+  preview_render.h      = h;
 
-  gimp_rgba_set (&lightcheck,
+  gimp_rgba_set (&preview_render.lightcheck,
                  GIMP_CHECK_LIGHT, GIMP_CHECK_LIGHT, GIMP_CHECK_LIGHT,
                  1.0);
-  gimp_rgba_set (&darkcheck, GIMP_CHECK_DARK, GIMP_CHECK_DARK,
+  gimp_rgba_set (&preview_render.darkcheck, GIMP_CHECK_DARK, GIMP_CHECK_DARK,
                  GIMP_CHECK_DARK, 1.0);
 
-  if (mapvals.bump_mapped == TRUE && mapvals.bumpmap_id != -1)
-    {
-      gimp_pixel_rgn_init (&bump_region,
-                           gimp_drawable_get (mapvals.bumpmap_id),
-                           0, 0, width, height, FALSE, FALSE);
-    }
-
-  imagey = 0;
+  bumpmap_setup ();
+  envmap_setup ();
 
   if (mapvals.previewquality)
-    ray_func = get_ray_color;
+    preview_render.ray_func = get_ray_color;
   else
-    ray_func = get_ray_color_no_bilinear;
+    preview_render.ray_func = get_ray_color_no_bilinear;
 
   if (mapvals.env_mapped == TRUE && mapvals.envmap_id != -1)
     {
-      env_width = gimp_drawable_width (mapvals.envmap_id);
-      env_height = gimp_drawable_height (mapvals.envmap_id);
-
-      gimp_pixel_rgn_init (&env_region,
-                           gimp_drawable_get (mapvals.envmap_id), 0,
-                           0, env_width, env_height, FALSE, FALSE);
-
       if (mapvals.previewquality)
-        ray_func = get_ray_color_ref;
+        preview_render.ray_func = get_ray_color_ref;
       else
-        ray_func = get_ray_color_no_bilinear_ref;
+        preview_render.ray_func = get_ray_color_no_bilinear_ref;
     }
 
-  cairo_surface_flush (preview_surface);
+  /* A coarse pass right away, the full resolution rows are */
+  /* rendered a few at a time while the dialog is idle       */
+  /* ======================================================= */
 
-  for (ycnt = 0; ycnt < PREVIEW_HEIGHT; ycnt++)
-    {
-      index = ycnt * preview_rgb_stride;
-      for (xcnt = 0; xcnt < PREVIEW_WIDTH; xcnt++)
-        {
-          if ((ycnt >= starty && ycnt < (starty + h)) &&
-              (xcnt >= startx && xcnt < (startx + w)))
-            {
-              imagex = xpostab[xcnt - startx];
-              imagey = ypostab[ycnt - starty];
-              pos = int_to_posf (imagex, imagey);
-
-              if (mapvals.bump_mapped == TRUE &&
-                  mapvals.bumpmap_id != -1 &&
-                  xcnt == startx)
-                {
-                  pos_to_float (pos.x, pos.y, &imagex, &imagey);
-                  precompute_normals (0, width, RINT (imagey));
-                }
-
-              color = (*ray_func) (&pos);
-
-              if (color.a < 1.0)
-                {
-                  f1 = ((xcnt % 32) < 16);
-                  f2 = ((ycnt % 32) < 16);
-                  f1 = f1 ^ f2;
-
-                  if (f1)
-                    {
-                      if (color.a == 0.0)
-                        color = lightcheck;
-                      else
-                        gimp_rgb_composite (&color,
-                                            &lightcheck,
-                                            GIMP_RGB_COMPOSITE_BEHIND);
-                    }
-                  else
-                    {
-                      if (color.a == 0.0)
-                        color = darkcheck;
-                      else
-                        gimp_rgb_composite (&color,
-                                            &darkcheck,
-                                            GIMP_RGB_COMPOSITE_BEHIND);
-                    }
-                }
-
-              gimp_rgb_get_uchar (&color, &r, &g, &b);
-              GIMP_CAIRO_RGB24_SET_PIXEL((preview_rgb_data + index), r, g, b);
-              index += 4;
-              imagex++;
-            }
-          else
-            {
-              preview_rgb_data[index++] = 200;
-              preview_rgb_data[index++] = 200;
-              preview_rgb_data[index++] = 200;
-              index++;
-            }
-        }
-    }
-  cairo_surface_mark_dirty (preview_surface);
+  preview_render.step = PREVIEW_COARSE_STEP;
+
+  compute_preview_rows (0, PREVIEW_HEIGHT);
+
+  preview_render.step = 1;
+  preview_refine_row  = 0;
+  preview_refine_id   = g_idle_add (preview_refine_idle, NULL);
+}
+
+static gboolean
+preview_refine_idle (gpointer data)
+{
+  gint h = MIN (PREVIEW_REFINE_ROWS, PREVIEW_HEIGHT - preview_refine_row);
+
+  compute_preview_rows (preview_refine_row, h);
+
+  preview_refine_row += h;
+
+  gtk_widget_queue_draw (previewarea);
+
+  if (preview_refine_row < PREVIEW_HEIGHT)
+    return TRUE;
+
+  preview_refine_id = 0;
+
+  preview_set_cursor (GDK_HAND2);
+
+  return FALSE;
+}
+
+static void
+preview_set_cursor (GdkCursorType type)
+{
+  GdkDisplay *display = gtk_widget_get_display (previewarea);
+  GdkCursor  *cursor;
+
+  cursor = gdk_cursor_new_for_display (display, type);
+  gdk_window_set_cursor (gtk_widget_get_window (previewarea), cursor);
+  gdk_cursor_unref (cursor);
 }
 
 static void
@@ -380,24 +485,35 @@ update_light (gint xpos, gint ypos)
 void
 preview_compute (void)
 {
-  GdkDisplay *display = gtk_widget_get_display (previewarea);
-  GdkCursor  *cursor;
-  gint        startx, starty, pw, ph;
+  gint startx, starty, pw, ph;
 
-  compute_preview_rectangle (&startx, &starty, &pw, &ph);
+  preview_cancel ();
 
-  cursor = gdk_cursor_new_for_display (display, GDK_WATCH);
+  compute_preview_rectangle (&startx, &starty, &pw, &ph);
 
-  gdk_window_set_cursor (gtk_widget_get_window (previewarea), cursor);
-  gdk_cursor_unref (cursor);
+  preview_set_cursor (GDK_WATCH);
 
   compute_preview (startx, starty, pw, ph);
-  cursor = gdk_cursor_new_for_display (display, GDK_HAND2);
-  gdk_window_set_cursor (gtk_widget_get_window (previewarea), cursor);
-  gdk_cursor_unref (cursor);
+
   gdk_flush ();
 }
 
+/***************************************************/
+/* Stop rendering the preview at full resolution.  */
+/***************************************************/
+
+void
+preview_cancel (void)
+{
+  if (preview_refine_id)
+    {
+      g_source_remove (preview_refine_id);
+      preview_refine_id = 0;
+
+      preview_set_cursor (GDK_HAND2);
+    }
+}
+
 
 /******************************/
 /* Preview area event handler */
@@ -463,6 +579,9 @@ preview_expose (GtkWidget *area,
 void
 interactive_preview_callback (GtkWidget *widget)
 {
+  /* the settings are changing, the preview being rendered is outdated */
+  preview_cancel ();
+
   if ( preview_update_timer != 0)
     {
       g_source_remove ( preview_update_timer );
@@ -11,27 +11,29 @@
 #include "lighting-shade.h"
 
 
-static GimpVector3 *triangle_normals[2] = { NULL, NULL };
-static GimpVector3 *vertex_normals[3]   = { NULL, NULL, NULL };
-static gdouble     *heights[3] = { NULL, NULL, NULL };
-static gdouble      xstep, ystep;
-static guchar      *bumprow = NULL;
-
-static gint pre_w = -1;
-static gint pre_h = -1;
+/* The bump map's heights and the normals of its pixels, they are
+ * only recomputed when the bump map or its settings change.
+ */
+static gfloat  *bump_heights = NULL;
+static gfloat  *bump_normals = NULL;
+static gint32   bump_id      = -1;
+static gint     bump_type    = -1;
+static gdouble  bump_max     = 0.0;
+static gdouble  xstep, ystep;
 
 /*****************/
 /* Phong shading */
 /*****************/
 
 static GimpRGB
-phong_shade (GimpVector3 *position,
-             GimpVector3 *viewpoint,
-             GimpVector3 *normal,
-             GimpVector3 *lightposition,
-             GimpRGB      *diff_col,
-             GimpRGB      *light_col,
-             LightType    light_type)
+phong_shade (GimpVector3            *position,
+             GimpVector3            *viewpoint,
+             GimpVector3            *normal,
+             GimpVector3            *lightposition,
+             GimpRGB                *diff_col,
+             GimpRGB                *light_col,
+             LightType               light_type,
+             const MaterialSettings *material)
 {
   GimpRGB       diffuse_color, specular_color;
   gdouble      nl, rv, dist;
@@ -75,27 +77,27 @@ phong_shade (GimpVector3 *position,
       gimp_vector3_normalize (&h);
 
       rv = MAX (0.01, gimp_vector3_inner_product (&n, &h));
-      rv = pow (rv, mapvals.material.highlight);
+      rv = pow (rv, material->highlight);
       rv *= nl;
 
       /* Compute diffuse and specular intensity contribution */
       /* =================================================== */
 
       diffuse_color = *light_col;
-      gimp_rgb_multiply (&diffuse_color, mapvals.material.diffuse_int);
+      gimp_rgb_multiply (&diffuse_color, material->diffuse_int);
       diffuse_color.r *= diff_col->r;
       diffuse_color.g *= diff_col->g;
       diffuse_color.b *= diff_col->b;
       gimp_rgb_multiply (&diffuse_color, nl);
 
       specular_color = *light_col;
-      if (mapvals.material.metallic)  /* for metals, specular color = diffuse color */
+      if (material->metallic)  /* for metals, specular color = diffuse color */
         {
           specular_color.r *= diff_col->r;
           specular_color.g *= diff_col->g;
           specular_color.b *= diff_col->b;
         }
-      gimp_rgb_multiply (&specular_color, mapvals.material.specular_ref);
+      gimp_rgb_multiply (&specular_color, material->specular_ref);
       gimp_rgb_multiply (&specular_color, rv);
 
       gimp_rgb_add (&diffuse_color, &specular_color);
@@ -107,333 +109,235 @@ phong_shade (GimpVector3 *position,
   return diffuse_color;
 }
 
-void
-precompute_init (gint w,
-                 gint h)
-{
-  gint n;
-  gint bpp=1;
-
-  xstep = 1.0 / (gdouble) width;
-  ystep = 1.0 / (gdouble) height;
-
-  pre_w = w;
-  pre_h = h;
-
-  for (n = 0; n < 3; n++)
-    {
-      if (vertex_normals[n] != NULL)
-        g_free (vertex_normals[n]);
-      if (heights[n] != NULL)
-        g_free (heights[n]);
-
-      heights[n] = g_new (gdouble, w);
-      vertex_normals[n] = g_new (GimpVector3, w);
-    }
-
-  for (n = 0; n < 2; n++)
-    if (triangle_normals[n] != NULL)
-      g_free (triangle_normals[n]);
+/*****************************/
+/* Bump map heights, normals */
+/*****************************/
 
-  if (bumprow != NULL)
-    {
-      g_free (bumprow);
-      bumprow = NULL;
-    }
-  if (mapvals.bumpmap_id != -1)
-    {
-      bpp = gimp_drawable_bpp(mapvals.bumpmap_id);
-    }
+/* The normals of the two triangles of the cell between (x, y) and
+ * (x + 1, y + 1) of the height field
+ */
+static void
+bump_triangle_normals (gint         x,
+                       gint         y,
+                       GimpVector3 *t0,
+                       GimpVector3 *t1)
+{
+  const gfloat *h1 = bump_heights + (gsize) y * width + x;
+  const gfloat *h2 = h1 + width;
+  GimpVector3   p1, p2, p3;
 
-  bumprow = g_new (guchar, w * bpp);
+  gimp_vector3_set (&p1, 0.0,   ystep, h2[0] - h1[0]);
+  gimp_vector3_set (&p2, xstep, ystep, h2[1] - h1[0]);
+  gimp_vector3_set (&p3, xstep, 0.0,   h1[1] - h1[0]);
 
-  triangle_normals[0] = g_new (GimpVector3, (w << 1) + 2);
-  triangle_normals[1] = g_new (GimpVector3, (w << 1) + 2);
+  *t0 = gimp_vector3_cross_product (&p2, &p1);
+  *t1 = gimp_vector3_cross_product (&p3, &p2);
 
-  for (n = 0; n < (w << 1) + 1; n++)
-    {
-      gimp_vector3_set (&triangle_normals[0][n], 0.0, 0.0, 1.0);
-      gimp_vector3_set (&triangle_normals[1][n], 0.0, 0.0, 1.0);
-    }
-
-  for (n = 0; n < w; n++)
-    {
-      gimp_vector3_set (&vertex_normals[0][n], 0.0, 0.0, 1.0);
-      gimp_vector3_set (&vertex_normals[1][n], 0.0, 0.0, 1.0);
-      gimp_vector3_set (&vertex_normals[2][n], 0.0, 0.0, 1.0);
-      heights[0][n] = 0.0;
-      heights[1][n] = 0.0;
-      heights[2][n] = 0.0;
-    }
+  gimp_vector3_normalize (t0);
+  gimp_vector3_normalize (t1);
 }
 
-
-/* Interpol linearly height[2] and triangle_normals[1]
- * using the next row
+/* The normal of a vertex is the average of the normals of the six
+ * triangles around it
  */
-void
-interpol_row (gint x1,
-              gint x2,
-              gint y)
+static void
+bump_compute_normals (const GimpParallelArea *area,
+                      gpointer                data)
 {
-  GimpVector3   p1, p2, p3;
-  gint          n, i;
-  guchar        *map = NULL;
-  gint          bpp = 1;
-  guchar* bumprow1 = NULL;
-  guchar* bumprow2 = NULL;
+  gint x, y;
 
-  if (mapvals.bumpmap_id != -1)
+  for (y = area->roi.y; y < area->roi.y + area->roi.height; y++)
     {
-      bpp = gimp_drawable_bpp(mapvals.bumpmap_id);
-    }
-
-  bumprow1 = g_new (guchar, pre_w * bpp);
-  bumprow2 = g_new (guchar, pre_w * bpp);
-
-  gimp_pixel_rgn_get_row (&bump_region, bumprow1, x1, y, x2 - x1);
-  gimp_pixel_rgn_get_row (&bump_region, bumprow2, x1, y+1, x2 - x1);
+      gfloat *dest = (gfloat *) (area->dest +
+                                 (y - area->roi.y) * area->dest_rowstride);
 
-  if (mapvals.bumpmaptype > 0)
-    {
-      switch (mapvals.bumpmaptype)
+      for (x = area->roi.x; x < area->roi.x + area->roi.width; x++)
         {
-        case 1:
-          map = logmap;
-          break;
-        case 2:
-          map = sinemap;
-          break;
-        default:
-          map = spheremap;
-          break;
-        }
-    }
+          GimpVector3 normal = { 0.0, 0.0, 0.0 };
+          GimpVector3 t0, t1;
 
-  for (n = 0; n < (x2 - x1); n++)
-    {
-      gdouble diff;
-      guchar mapval;
-      guchar mapval1, mapval2;
+          if (y > 0)
+            {
+              if (x > 0)
+                {
+                  bump_triangle_normals (x - 1, y - 1, &t0, &t1);
+                  gimp_vector3_add (&normal, &normal, &t0);
+                  gimp_vector3_add (&normal, &normal, &t1);
+                }
+
+              if (x < width - 1)
+                {
+                  bump_triangle_normals (x, y - 1, &t0, &t1);
+                  gimp_vector3_add (&normal, &normal, &t0);
+                  gimp_vector3_add (&normal, &normal, &t1);
+                }
+            }
 
-      if (bpp>1)
-        {
-          mapval1 = (guchar)((float)((bumprow1[n * bpp] +bumprow1[n * bpp +1] + bumprow1[n * bpp + 2])/3.0 )) ;
-          mapval2 = (guchar)((float)((bumprow2[n * bpp] +bumprow2[n * bpp +1] + bumprow2[n * bpp + 2])/3.0 )) ;
-        }
-      else
-        {
-          mapval1 = bumprow1[n * bpp];
-          mapval2 = bumprow2[n * bpp];
-        }
+          if (y < height - 1)
+            {
+              if (x > 0)
+                {
+                  bump_triangle_normals (x - 1, y, &t0, &t1);
+                  gimp_vector3_add (&normal, &normal, &t1);
+                }
+
+              if (x < width - 1)
+                {
+                  bump_triangle_normals (x, y, &t0, &t1);
+                  gimp_vector3_add (&normal, &normal, &t0);
+                  gimp_vector3_add (&normal, &normal, &t1);
+                }
+            }
 
-      diff =  mapval1 - mapval2;
-      mapval = (guchar) CLAMP (mapval1 + diff, 0.0, 255.0);
+          if (gimp_vector3_length (&normal) == 0.0)
+            gimp_vector3_set (&normal, 0.0, 0.0, 1.0);
+          else
+            gimp_vector3_normalize (&normal);
 
-      if (mapvals.bumpmaptype > 0)
-        {
-          heights[1][n] = (gdouble) mapvals.bumpmax * (gdouble) map[mapval1] / 255.0;
-          heights[2][n] = (gdouble) mapvals.bumpmax * (gdouble) map[mapval] / 255.0;
+          *dest++ = normal.x;
+          *dest++ = normal.y;
+          *dest++ = normal.z;
         }
-      else
-        {
-          heights[1][n] = (gdouble) mapvals.bumpmax * (gdouble) mapval1 / 255.0;
-          heights[2][n] = (gdouble) mapvals.bumpmax * (gdouble) mapval / 255.0;
-        }
-    }
-
-  i = 0;
-  for (n = 0; n < (x2 - x1 - 1); n++)
-    {
-      /* heights rows 1 and 2 are inverted */
-      p1.x = 0.0;
-      p1.y = ystep;
-      p1.z = heights[1][n] - heights[2][n];
-
-      p2.x = xstep;
-      p2.y = ystep;
-      p2.z = heights[1][n+1] - heights[2][n];
-
-      p3.x = xstep;
-      p3.y = 0.0;
-      p3.z = heights[2][n+1] - heights[2][n];
-
-      triangle_normals[1][i] = gimp_vector3_cross_product (&p2, &p1);
-      triangle_normals[1][i+1] = gimp_vector3_cross_product (&p3, &p2);
-
-      gimp_vector3_normalize (&triangle_normals[1][i]);
-      gimp_vector3_normalize (&triangle_normals[1][i+1]);
-
-      i += 2;
     }
-
-  g_free (bumprow1);
-  g_free (bumprow2);
 }
 
-/********************************************/
-/* Compute triangle and then vertex normals */
-/********************************************/
-
-
+/* Reads the bump map and computes its heights and normals, unless
+ * they are still there from the last call.  Has to be called before
+ * the get_ray_color functions are used with a bump map.
+ */
 void
-precompute_normals (gint x1,
-                    gint x2,
-                    gint y)
+bumpmap_setup (void)
 {
-  GimpVector3 *tmpv, p1, p2, p3, normal;
-  gdouble     *tmpd;
-  gint         n, i, nv;
-  guchar      *map = NULL;
-  gint bpp = 1;
-  guchar mapval;
+  GimpDrawable *drawable;
+  GimpPixelRgn  region;
+  GeglBuffer   *buffer;
+  guchar       *map = NULL;
+  guchar       *data;
+  gint          bpp;
+  gsize         n_pixels;
+  gsize         i;
+
+  if (! mapvals.bump_mapped || mapvals.bumpmap_id == -1)
+    return;
+
+  if (bump_heights                          &&
+      bump_id   == mapvals.bumpmap_id       &&
+      bump_type == mapvals.bumpmaptype      &&
+      bump_max  == mapvals.bumpmax)
+    return;
+
+  g_free (bump_heights);
+  g_free (bump_normals);
+
+  bump_id   = mapvals.bumpmap_id;
+  bump_type = mapvals.bumpmaptype;
+  bump_max  = mapvals.bumpmax;
 
+  xstep = 1.0 / (gdouble) width;
+  ystep = 1.0 / (gdouble) height;
 
-  /* First, compute the heights */
-  /* ========================== */
+  n_pixels = (gsize) width * height;
 
-  tmpv                = triangle_normals[0];
-  triangle_normals[0] = triangle_normals[1];
-  triangle_normals[1] = tmpv;
+  /*  check_drawables() made sure the bump map has the image's size  */
+  drawable = gimp_drawable_get (mapvals.bumpmap_id);
+  bpp      = drawable->bpp;
+  data     = g_new (guchar, n_pixels * bpp);
 
-  tmpv              = vertex_normals[0];
-  vertex_normals[0] = vertex_normals[1];
-  vertex_normals[1] = vertex_normals[2];
-  vertex_normals[2] = tmpv;
+  gimp_pixel_rgn_init (&region, drawable, 0, 0, width, height, FALSE, FALSE);
+  gimp_pixel_rgn_get_rect (&region, data, 0, 0, width, height);
 
-  tmpd       = heights[0];
-  heights[0] = heights[1];
-  heights[1] = heights[2];
-  heights[2] = tmpd;
+  gimp_drawable_detach (drawable);
 
-  if (mapvals.bumpmap_id != -1)
+  switch (mapvals.bumpmaptype)
     {
-      bpp = gimp_drawable_bpp(mapvals.bumpmap_id);
+    case LINEAR_MAP:
+      break;
+    case LOGARITHMIC_MAP:
+      map = logmap;
+      break;
+    case SINUSOIDAL_MAP:
+      map = sinemap;
+      break;
+    default:
+      map = spheremap;
+      break;
     }
 
-  gimp_pixel_rgn_get_row (&bump_region, bumprow, x1, y, x2 - x1);
+  bump_heights = g_new (gfloat, n_pixels);
 
-  if (mapvals.bumpmaptype > 0)
+  for (i = 0; i < n_pixels; i++)
     {
-      switch (mapvals.bumpmaptype)
-        {
-          case 1:
-            map = logmap;
-            break;
-          case 2:
-            map = sinemap;
-            break;
-          default:
-            map = spheremap;
-            break;
-        }
+      const guchar *p = data + i * bpp;
+      guchar        mapval;
 
-      for (n = 0; n < (x2 - x1); n++)
-        {
-          if (bpp>1)
-            {
-              mapval = (guchar)((float)((bumprow[n * bpp] +bumprow[n * bpp +1] + bumprow[n * bpp + 2])/3.0 )) ;
-            }
-          else
-            {
-              mapval = bumprow[n * bpp];
-            }
+      if (bpp > 1)
+        mapval = (guchar) ((float) ((p[0] + p[1] + p[2]) / 3.0));
+      else
+        mapval = p[0];
 
-          heights[2][n] = (gdouble) mapvals.bumpmax * (gdouble) map[mapval] / 255.0;
-        }
-    }
-  else
-    {
-      for (n = 0; n < (x2 - x1); n++)
-        {
-          if (bpp>1)
-            {
-              mapval = (guchar)((float)((bumprow[n * bpp] +bumprow[n * bpp +1] + bumprow[n * bpp + 2])/3.0 )) ;
-            }
-          else
-            {
-              mapval = bumprow[n * bpp];
-            }
-          heights[2][n] = (gdouble) mapvals.bumpmax * (gdouble) mapval / 255.0;
-        }
-    }
+      if (map)
+        mapval = map[mapval];
 
-  /* Compute triangle normals */
-  /* ======================== */
+      bump_heights[i] = mapvals.bumpmax * (gdouble) mapval / 255.0;
+    }
 
-  i = 0;
-  for (n = 0; n < (x2 - x1 - 1); n++)
-    {
-      p1.x = 0.0;
-      p1.y = ystep;
-      p1.z = heights[2][n] - heights[1][n];
+  g_free (data);
 
-      p2.x = xstep;
-      p2.y = ystep;
-      p2.z = heights[2][n+1] - heights[1][n];
+  bump_normals = g_new (gfloat, n_pixels * 3);
 
-      p3.x = xstep;
-      p3.y = 0.0;
-      p3.z = heights[1][n+1] - heights[1][n];
+  buffer = gegl_buffer_linear_new_from_data (bump_normals,
+                                             babl_format ("RGB float"),
+                                             GEGL_RECTANGLE (0, 0,
+                                                             width, height),
+                                             GEGL_AUTO_ROWSTRIDE,
+                                             NULL, NULL);
 
-      triangle_normals[1][i] = gimp_vector3_cross_product (&p2, &p1);
-      triangle_normals[1][i+1] = gimp_vector3_cross_product (&p3, &p2);
+  gimp_parallel_process (NULL, NULL, buffer, NULL, babl_format ("RGB float"),
+                         0, 0, GEGL_ABYSS_NONE, 0, 0,
+                         bump_compute_normals, NULL,
+                         0.0, 0.0);
 
-      gimp_vector3_normalize (&triangle_normals[1][i]);
-      gimp_vector3_normalize (&triangle_normals[1][i+1]);
+  g_object_unref (buffer);
+}
 
-      i += 2;
-    }
+void
+bumpmap_free (void)
+{
+  g_free (bump_heights);
+  g_free (bump_normals);
 
-  /* Compute vertex normals */
-  /* ====================== */
+  bump_heights = NULL;
+  bump_normals = NULL;
+  bump_id      = -1;
+}
 
-  i = 0;
-  gimp_vector3_set (&normal, 0.0, 0.0, 0.0);
+/* Looks up the bump map at image position (xf, yf), returns its height
+ * and its normal there, or 0 and the plane's normal without a bump map.
+ */
+static gdouble
+bump_lookup (gdouble      xf,
+             gdouble      yf,
+             GimpVector3 *normal)
+{
+  gint   x, y;
+  gsize  i;
 
-  for (n = 0; n < (x2 - x1 - 1); n++)
+  if (! mapvals.bump_mapped || mapvals.bumpmap_id == -1 || ! bump_heights)
     {
-      nv = 0;
-
-      if (n > 0)
-        {
-          if (y > 0)
-            {
-              gimp_vector3_add (&normal, &normal, &triangle_normals[0][i-1]);
-              gimp_vector3_add (&normal, &normal, &triangle_normals[0][i-2]);
-              nv += 2;
-            }
-
-          if (y < pre_h)
-            {
-              gimp_vector3_add (&normal, &normal, &triangle_normals[1][i-1]);
-              nv++;
-            }
-        }
-
-      if (n <pre_w)
-        {
-          if (y > 0)
-            {
-              gimp_vector3_add (&normal, &normal, &triangle_normals[0][i]);
-              gimp_vector3_add (&normal, &normal, &triangle_normals[0][i+1]);
-              nv += 2;
-            }
+      *normal = mapvals.planenormal;
+      return 0.0;
+    }
 
-          if (y < pre_h)
-            {
-              gimp_vector3_add (&normal, &normal, &triangle_normals[1][i]);
-              gimp_vector3_add (&normal, &normal, &triangle_normals[1][i+1]);
-              nv += 2;
-            }
-        }
+  x = CLAMP (RINT (xf), 0, width  - 1);
+  y = CLAMP (RINT (yf), 0, height - 1);
+  i = (gsize) y * width + x;
 
-      gimp_vector3_mul (&normal, 1.0 / (gdouble) nv);
-      gimp_vector3_normalize (&normal);
-      vertex_normals[1][n] = normal;
+  gimp_vector3_set (normal,
+                    bump_normals[i * 3 + 0],
+                    bump_normals[i * 3 + 1],
+                    bump_normals[i * 3 + 2]);
 
-      i += 2;
-    }
+  return bump_heights[i];
 }
 
 /***********************************************************************/
@@ -467,10 +371,10 @@ sphere_to_image (GimpVector3 *normal,
                  gdouble     *u,
                  gdouble     *v)
 {
-  static gdouble     alpha, fac;
-  static GimpVector3 cross_prod;
-  static GimpVector3 firstaxis  = { 1.0, 0.0, 0.0 };
-  static GimpVector3 secondaxis = { 0.0, 1.0, 0.0 };
+  static const GimpVector3 firstaxis  = { 1.0, 0.0, 0.0 };
+  static const GimpVector3 secondaxis = { 0.0, 1.0, 0.0 };
+  gdouble                  alpha, fac;
+  GimpVector3              cross_prod;
 
   alpha = acos (-gimp_vector3_inner_product (&secondaxis, normal));
 
@@ -512,16 +416,17 @@ get_ray_color (GimpVector3 *position)
   GimpRGB       color_int;
   GimpRGB       color_sum;
   GimpRGB       light_color;
-  gint          x, f;
+  gint          f;
   gdouble       xf, yf;
+  gdouble       bump_height;
   GimpVector3   normal, *p;
   gint          k;
 
   pos_to_float (position->x, position->y, &xf, &yf);
 
-  x = RINT (xf);
+  bump_height = bump_lookup (xf, yf, &normal);
 
-  if (mapvals.transparent_background && heights[1][x] == 0)
+  if (mapvals.transparent_background && bump_height == 0)
     {
       gimp_rgb_set_alpha (&color_sum, 0.0);
     }
@@ -545,28 +450,14 @@ get_ray_color (GimpVector3 *position)
           color_int = mapvals.lightsource[k].color;
           gimp_rgb_multiply (&color_int, mapvals.lightsource[k].intensity);
 
-          if (mapvals.bump_mapped == FALSE || mapvals.bumpmap_id == -1)
-            {
-              light_color = phong_shade (position,
-                                         &mapvals.viewpoint,
-                                         &mapvals.planenormal,
-                                         p,
-                                         &color,
-                                         &color_int,
-                                         mapvals.lightsource[k].type);
-            }
-          else
-            {
-              normal = vertex_normals[1][(gint) RINT (xf)];
-
-              light_color = phong_shade (position,
-                                         &mapvals.viewpoint,
-                                         &normal,
-                                         p,
-                                         &color,
-                                         &color_int,
-                                         mapvals.lightsource[k].type);
-            }
+          light_color = phong_shade (position,
+                                     &mapvals.viewpoint,
+                                     &normal,
+                                     p,
+                                     &color,
+                                     &color_int,
+                                     mapvals.lightsource[k].type,
+                                     &mapvals.material);
 
           gimp_rgb_add (&color_sum, &light_color);
         }
@@ -579,27 +470,23 @@ get_ray_color (GimpVector3 *position)
 GimpRGB
 get_ray_color_ref (GimpVector3 *position)
 {
-  GimpRGB      color_sum;
-  GimpRGB      color_int;
-  GimpRGB      light_color;
-  GimpRGB      color, env_color;
-  gint         x, f;
-  gdouble      xf, yf;
-  GimpVector3  normal, *p, v, r;
-  gint         k;
-  gdouble      tmpval;
+  GimpRGB           color_sum;
+  GimpRGB           color_int;
+  GimpRGB           light_color;
+  GimpRGB           color, env_color;
+  MaterialSettings  reflection;
+  gint              f;
+  gdouble           xf, yf;
+  gdouble           bump_height;
+  GimpVector3       normal, *p, v, r;
+  gint              k;
 
   pos_to_float (position->x, position->y, &xf, &yf);
 
-  x = RINT (xf);
-
-  if (mapvals.bump_mapped == FALSE || mapvals.bumpmap_id == -1)
-    normal = mapvals.planenormal;
-  else
-    normal = vertex_normals[1][(gint) RINT (xf)];
+  bump_height = bump_lookup (xf, yf, &normal);
   gimp_vector3_normalize (&normal);
 
-  if (mapvals.transparent_background && heights[1][x] == 0)
+  if (mapvals.transparent_background && bump_height == 0)
     {
       gimp_rgb_set_alpha (&color_sum, 0.0);
     }
@@ -628,7 +515,8 @@ get_ray_color_ref (GimpVector3 *position)
                                      p,
                                      &color,
                                      &color_int,
-                                     mapvals.lightsource[0].type);
+                                     mapvals.lightsource[0].type,
+                                     &mapvals.material);
         }
 
       gimp_vector3_sub (&v, &mapvals.viewpoint, position);
@@ -643,8 +531,9 @@ get_ray_color_ref (GimpVector3 *position)
       env_color = peek_env_map (RINT (env_width * xf),
                                 RINT (env_height * yf));
 
-      tmpval = mapvals.material.diffuse_int;
-      mapvals.material.diffuse_int = 0.;
+      /*  the reflection only has a specular part  */
+      reflection = mapvals.material;
+      reflection.diffuse_int = 0.0;
 
       light_color = phong_shade (position,
                                  &mapvals.viewpoint,
@@ -652,9 +541,8 @@ get_ray_color_ref (GimpVector3 *position)
                                  &r,
                                  &color,
                                  &env_color,
-                                 DIRECTIONAL_LIGHT);
-
-      mapvals.material.diffuse_int = tmpval;
+                                 DIRECTIONAL_LIGHT,
+                                 &reflection);
 
       gimp_rgb_add (&color_sum, &light_color);
     }
@@ -672,6 +560,7 @@ get_ray_color_no_bilinear (GimpVector3 *position)
   GimpRGB       light_color;
   gint          x;
   gdouble       xf, yf;
+  gdouble       bump_height;
   GimpVector3   normal, *p;
   gint          k;
 
@@ -680,7 +569,9 @@ get_ray_color_no_bilinear (GimpVector3 *position)
 
   x = RINT (xf);
 
-  if (mapvals.transparent_background && heights[1][x] == 0)
+  bump_height = bump_lookup (xf, yf, &normal);
+
+  if (mapvals.transparent_background && bump_height == 0)
     {
       gimp_rgb_set_alpha (&color_sum, 0.0);
     }
@@ -704,28 +595,14 @@ get_ray_color_no_bilinear (GimpVector3 *position)
           color_int = mapvals.lightsource[k].color;
           gimp_rgb_multiply (&color_int, mapvals.lightsource[k].intensity);
 
-          if (mapvals.bump_mapped == FALSE || mapvals.bumpmap_id == -1)
-            {
-              light_color = phong_shade (position,
-                                         &mapvals.viewpoint,
-                                         &mapvals.planenormal,
-                                         p,
-                                         &color,
-                                         &color_int,
-                                         mapvals.lightsource[k].type);
-            }
-          else
-            {
-              normal = vertex_normals[1][x];
-
-              light_color = phong_shade (position,
-                                         &mapvals.viewpoint,
-                                         &normal,
-                                         p,
-                                         &color,
-                                         &color_int,
-                                         mapvals.lightsource[k].type);
-            }
+          light_color = phong_shade (position,
+                                     &mapvals.viewpoint,
+                                     &normal,
+                                     p,
+                                     &color,
+                                     &color_int,
+                                     mapvals.lightsource[k].type,
+                                     &mapvals.material);
 
           gimp_rgb_add (&color_sum, &light_color);
         }
@@ -738,27 +615,22 @@ get_ray_color_no_bilinear (GimpVector3 *position)
 GimpRGB
 get_ray_color_no_bilinear_ref (GimpVector3 *position)
 {
-  GimpRGB      color_sum;
-  GimpRGB      color_int;
-  GimpRGB      light_color;
-  GimpRGB      color, env_color;
-  gint         x;
-  gdouble      xf, yf;
-  GimpVector3  normal, *p, v, r;
-  gint         k;
-  gdouble      tmpval;
+  GimpRGB           color_sum;
+  GimpRGB           color_int;
+  GimpRGB           light_color;
+  GimpRGB           color, env_color;
+  MaterialSettings  reflection;
+  gdouble           xf, yf;
+  gdouble           bump_height;
+  GimpVector3       normal, *p, v, r;
+  gint              k;
 
   pos_to_float (position->x, position->y, &xf, &yf);
 
-  x = RINT (xf);
-
-  if (mapvals.bump_mapped == FALSE || mapvals.bumpmap_id == -1)
-    normal = mapvals.planenormal;
-  else
-    normal = vertex_normals[1][(gint) RINT (xf)];
+  bump_height = bump_lookup (xf, yf, &normal);
   gimp_vector3_normalize (&normal);
 
-  if (mapvals.transparent_background && heights[1][x] == 0)
+  if (mapvals.transparent_background && bump_height == 0)
     {
       gimp_rgb_set_alpha (&color_sum, 0.0);
     }
@@ -787,7 +659,8 @@ get_ray_color_no_bilinear_ref (GimpVector3 *position)
                                          p,
                                          &color,
                                          &color_int,
-                                         mapvals.lightsource[0].type);
+                                         mapvals.lightsource[0].type,
+                                         &mapvals.material);
         }
 
       gimp_vector3_sub (&v, &mapvals.viewpoint, position);
@@ -802,8 +675,9 @@ get_ray_color_no_bilinear_ref (GimpVector3 *position)
       env_color = peek_env_map (RINT (env_width * xf),
                                 RINT (env_height * yf));
 
-      tmpval = mapvals.material.diffuse_int;
-      mapvals.material.diffuse_int = 0.;
+      /*  the reflection only has a specular part  */
+      reflection = mapvals.material;
+      reflection.diffuse_int = 0.0;
 
       light_color = phong_shade (position,
                                  &mapvals.viewpoint,
@@ -811,9 +685,8 @@ get_ray_color_no_bilinear_ref (GimpVector3 *position)
                                  &r,
                                  &color,
                                  &env_color,
-                                 DIRECTIONAL_LIGHT);
-
-      mapvals.material.diffuse_int = tmpval;
+                                 DIRECTIONAL_LIGHT,
+                                 &reflection);
 
       gimp_rgb_add (&color_sum, &light_color);
     }
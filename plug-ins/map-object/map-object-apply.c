@@ -30,8 +30,6 @@ static gfloat a[16], b[16];
 void
 init_compute (void)
 {
-  gint i;
-
   switch (mapvals.maptype)
     {
       case MAP_SPHERE:
@@ -128,19 +126,10 @@ init_compute (void)
 
         memcpy (rotmat, b, sizeof (gfloat) * 16);
 
-        /* Set up pixel regions for the box face images */
-        /* ============================================ */
-
-        for (i = 0; i < 6; i++)
-          {
-            box_drawables[i] = gimp_drawable_get (mapvals.boxmap_id[i]);
+        /* Read the box face images */
+        /* ======================== */
 
-            gimp_pixel_rgn_init (&box_regions[i], box_drawables[i],
-                                 0, 0,
-                                 box_drawables[i]->width,
-                                 box_drawables[i]->height,
-                                 FALSE, FALSE);
-          }
+        box_images_setup ();
 
         break;
 
@@ -169,20 +158,10 @@ init_compute (void)
 
         memcpy (rotmat, b, sizeof (gfloat) * 16);
 
-        /* Set up pixel regions for the cylinder cap images */
-        /* ================================================ */
+        /* Read the cylinder cap images */
+        /* ============================ */
 
-        for (i = 0; i < 2; i++)
-          {
-            cylinder_drawables[i] =
-              gimp_drawable_get (mapvals.cylindermap_id[i]);
-
-            gimp_pixel_rgn_init (&cylinder_regions[i], cylinder_drawables[i],
-                                 0, 0,
-                                 cylinder_drawables[i]->width,
-                                 cylinder_drawables[i]->height,
-                                 FALSE, FALSE);
-          }
+        cylinder_images_setup ();
 
         break;
     }
@@ -206,12 +185,64 @@ render (gdouble   x,
 }
 
 static void
-show_progress (gint     min,
-               gint     max,
-               gint     curr,
-               gpointer data)
+poke_area (gint      x,
+           gint      y,
+           GimpRGB  *color,
+           gpointer  data)
 {
-  gimp_progress_update ((gdouble) curr / (gdouble) max);
+  const GimpParallelArea *area       = data;
+  const gint              n_channels = area->bpp / sizeof (gfloat);
+  gfloat                 *dest;
+
+  dest = (gfloat *) (area->dest + (y - area->roi.y) * area->dest_rowstride);
+  dest += (x - area->roi.x) * n_channels;
+
+  dest[0] = color->r;
+  dest[1] = color->g;
+  dest[2] = color->b;
+
+  if (n_channels == 4)
+    dest[3] = color->a;
+}
+
+/* Computes the rows of an area, one ray per pixel */
+static void
+compute_rows (const GimpParallelArea *area,
+              gpointer                data)
+{
+  gint x, y;
+
+  for (y = area->roi.y; y < area->roi.y + area->roi.height; y++)
+    {
+      for (x = area->roi.x; x < area->roi.x + area->roi.width; x++)
+        {
+          GimpVector3 p     = int_to_pos (x, y);
+          GimpRGB     color = (* get_ray_color) (&p);
+
+          poke_area (x, y, &color, (gpointer) area);
+        }
+    }
+}
+
+/* Computes an area with adaptive supersampling. The areas are sampled
+ * on their own, their borders are sampled twice.
+ */
+static void
+compute_area_antialiased (const GimpParallelArea *area,
+                          gpointer                data)
+{
+  gimp_adaptive_supersample_area (area->roi.x,
+                                  area->roi.y,
+                                  area->roi.x + area->roi.width  - 1,
+                                  area->roi.y + area->roi.height - 1,
+                                  max_depth,
+                                  mapvals.pixeltreshold,
+                                  render,
+                                  NULL,
+                                  poke_area,
+                                  (gpointer) area,
+                                  NULL,
+                                  NULL);
 }
 
 /**************************************************/
@@ -222,13 +253,11 @@ show_progress (gint     min,
 void
 compute_image (void)
 {
-  gint         xcount, ycount;
-  GimpRGB      color;
-  glong        progress_counter = 0;
-  GimpVector3  p;
   gint32       new_image_id = -1;
   gint32       new_layer_id = -1;
   gboolean     insert_layer = FALSE;
+  GeglBuffer  *dest_buffer;
+  const Babl  *format;
 
   init_compute ();
 
@@ -263,8 +292,12 @@ compute_image (void)
       output_drawable = gimp_drawable_get (new_layer_id);
     }
 
-  gimp_pixel_rgn_init (&dest_region, output_drawable,
-                       0, 0, width, height, TRUE, TRUE);
+  if (gimp_drawable_has_alpha (output_drawable->drawable_id))
+    format = babl_format ("R'G'B'A float");
+  else
+    format = babl_format ("R'G'B' float");
+
+  dest_buffer = gimp_drawable_get_shadow_buffer (output_drawable->drawable_id);
 
   switch (mapvals.maptype)
     {
@@ -284,39 +317,26 @@ compute_image (void)
 
   if (mapvals.antialiasing == FALSE)
     {
-      for (ycount = 0; ycount < height; ycount++)
-        {
-          for (xcount = 0; xcount < width; xcount++)
-            {
-              p = int_to_pos (xcount, ycount);
-              color = (* get_ray_color) (&p);
-              poke (xcount, ycount, &color, NULL);
-
-              if ((progress_counter++ % width) == 0)
-                gimp_progress_update ((gdouble) progress_counter /
-                                      (gdouble) maxcounter);
-            }
-        }
+      gimp_parallel_process (NULL, NULL, dest_buffer,
+                             GEGL_RECTANGLE (0, 0, width, height), format,
+                             0, 0, GEGL_ABYSS_NONE, width, 0,
+                             compute_rows, NULL,
+                             0.0, 1.0);
     }
   else
     {
-      gimp_adaptive_supersample_area (0, 0,
-                                      width - 1, height - 1,
-                                      max_depth,
-                                      mapvals.pixeltreshold,
-                                      render,
-                                      NULL,
-                                      poke,
-                                      NULL,
-                                      show_progress,
-                                      NULL);
+      gimp_parallel_process (NULL, NULL, dest_buffer,
+                             GEGL_RECTANGLE (0, 0, width, height), format,
+                             0, 0, GEGL_ABYSS_NONE, 0, 0,
+                             compute_area_antialiased, NULL,
+                             0.0, 1.0);
     }
-  gimp_progress_update (1.0);
 
   /* Update the region */
   /* ================= */
 
-  gimp_drawable_flush (output_drawable);
+  g_object_unref (dest_buffer);
+
   if (insert_layer)
     gimp_image_insert_layer (new_image_id, new_layer_id, -1, 0);
   gimp_drawable_merge_shadow (output_drawable->drawable_id, TRUE);
@@ -24,13 +24,10 @@
 
 
 GimpDrawable *input_drawable, *output_drawable;
-GimpPixelRgn source_region,dest_region;
 
 GimpDrawable *box_drawables[6];
-GimpPixelRgn box_regions[6];
 
 GimpDrawable *cylinder_drawables[2];
-GimpPixelRgn cylinder_regions[2];
 
 guchar          *preview_rgb_data = NULL;
 gint             preview_rgb_stride;
@@ -43,6 +40,18 @@ gdouble oldtreshold;
 
 gint border_x1, border_y1, border_x2, border_y2;
 
+/* The pixels of the input image and of the box and cylinder maps are
+ * read into memory once, so that the shading functions can look at
+ * any of them from any thread.
+ */
+static guchar   *source_data = NULL;
+
+static guchar   *box_data[6];
+static gboolean  box_has_alpha[6];
+
+static guchar   *cylinder_data[2];
+static gboolean  cylinder_has_alpha[2];
+
 /******************/
 /* Implementation */
 /******************/
@@ -51,11 +60,10 @@ GimpRGB
 peek (gint x,
       gint y)
 {
-  static guchar data[4];
-
-  GimpRGB color;
+  const guchar *data;
+  GimpRGB       color;
 
-  gimp_pixel_rgn_get_pixel (&source_region, data, x, y);
+  data = source_data + ((gsize) y * width + x) * input_drawable->bpp;
 
   color.r = (gdouble) (data[0]) / 255.0;
   color.g = (gdouble) (data[1]) / 255.0;
@@ -81,11 +89,11 @@ peek_box_image (gint image,
                 gint x,
                 gint y)
 {
-  static guchar data[4];
+  const guchar *data;
+  GimpRGB       color;
 
-  GimpRGB color;
-
-  gimp_pixel_rgn_get_pixel (&box_regions[image], data, x, y);
+  data = box_data[image] + (((gsize) y * box_drawables[image]->width + x) *
+                            box_drawables[image]->bpp);
 
   color.r = (gdouble) (data[0]) / 255.0;
   color.g = (gdouble) (data[1]) / 255.0;
@@ -93,7 +101,7 @@ peek_box_image (gint image,
 
   if (box_drawables[image]->bpp == 4)
     {
-      if (gimp_drawable_has_alpha (box_drawables[image]->drawable_id))
+      if (box_has_alpha[image])
         color.a = (gdouble) (data[3]) / 255.0;
       else
         color.a = 1.0;
@@ -111,11 +119,12 @@ peek_cylinder_image (gint image,
                      gint x,
                      gint y)
 {
-  static guchar data[4];
-
-  GimpRGB color;
+  const guchar *data;
+  GimpRGB       color;
 
-  gimp_pixel_rgn_get_pixel (&cylinder_regions[image],data, x, y);
+  data = cylinder_data[image] + (((gsize) y *
+                                  cylinder_drawables[image]->width + x) *
+                                 cylinder_drawables[image]->bpp);
 
   color.r = (gdouble) (data[0]) / 255.0;
   color.g = (gdouble) (data[1]) / 255.0;
@@ -123,7 +132,7 @@ peek_cylinder_image (gint image,
 
   if (cylinder_drawables[image]->bpp == 4)
     {
-      if (gimp_drawable_has_alpha (cylinder_drawables[image]->drawable_id))
+      if (cylinder_has_alpha[image])
         color.a = (gdouble) (data[3]) / 255.0;
       else
         color.a = 1.0;
@@ -136,19 +145,6 @@ peek_cylinder_image (gint image,
   return color;
 }
 
-void
-poke (gint      x,
-      gint      y,
-      GimpRGB  *color,
-      gpointer  data)
-{
-  static guchar col[4];
-
-  gimp_rgba_get_uchar (color, &col[0], &col[1], &col[2], &col[3]);
-
-  gimp_pixel_rgn_set_pixel (&dest_region, col, x, y);
-}
-
 gint
 checkbounds (gint x,
              gint y)
@@ -349,6 +345,8 @@ gint
 image_setup (GimpDrawable *drawable,
              gint       interactive)
 {
+  GimpPixelRgn region;
+
   /* Set the tile cache size */
   /* ======================= */
 
@@ -367,8 +365,12 @@ image_setup (GimpDrawable *drawable,
   width  = input_drawable->width;
   height = input_drawable->height;
 
-  gimp_pixel_rgn_init (&source_region, input_drawable,
+  g_free (source_data);
+  source_data = g_new (guchar, (gsize) width * height * input_drawable->bpp);
+
+  gimp_pixel_rgn_init (&region, input_drawable,
                        0, 0, width, height, FALSE, FALSE);
+  gimp_pixel_rgn_get_rect (&region, source_data, 0, 0, width, height);
 
   maxcounter = (glong) width * (glong) height;
 
@@ -403,3 +405,92 @@ image_setup (GimpDrawable *drawable,
 
   return TRUE;
 }
+
+/******************************************************/
+/* Read a box or cylinder map into memory, unless the */
+/* drawable is still the one read the last time       */
+/******************************************************/
+
+static void
+map_image_read (gint32          drawable_id,
+                GimpDrawable  **drawable,
+                guchar        **data,
+                gboolean       *has_alpha)
+{
+  GimpPixelRgn region;
+
+  if (*drawable && (*drawable)->drawable_id == drawable_id)
+    return;
+
+  if (*drawable)
+    gimp_drawable_detach (*drawable);
+
+  g_free (*data);
+
+  *drawable  = gimp_drawable_get (drawable_id);
+  *has_alpha = gimp_drawable_has_alpha (drawable_id);
+  *data      = g_new (guchar, ((gsize) (*drawable)->width *
+                               (*drawable)->height * (*drawable)->bpp));
+
+  gimp_pixel_rgn_init (&region, *drawable,
+                       0, 0, (*drawable)->width, (*drawable)->height,
+                       FALSE, FALSE);
+  gimp_pixel_rgn_get_rect (&region, *data,
+                           0, 0, (*drawable)->width, (*drawable)->height);
+}
+
+void
+box_images_setup (void)
+{
+  gint i;
+
+  for (i = 0; i < 6; i++)
+    map_image_read (mapvals.boxmap_id[i],
+                    &box_drawables[i], &box_data[i], &box_has_alpha[i]);
+}
+
+void
+cylinder_images_setup (void)
+{
+  gint i;
+
+  for (i = 0; i < 2; i++)
+    map_image_read (mapvals.cylindermap_id[i],
+                    &cylinder_drawables[i], &cylinder_data[i],
+                    &cylinder_has_alpha[i]);
+}
+
+/**************************/
+/* Free the memory images */
+/**************************/
+
+void
+image_cleanup (void)
+{
+  gint i;
+
+  for (i = 0; i < 6; i++)
+    {
+      if (box_drawables[i])
+        gimp_drawable_detach (box_drawables[i]);
+
+      g_free (box_data[i]);
+
+      box_drawables[i] = NULL;
+      box_data[i]      = NULL;
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+      if (cylinder_drawables[i])
+        gimp_drawable_detach (cylinder_drawables[i]);
+
+      g_free (cylinder_data[i]);
+
+      cylinder_drawables[i] = NULL;
+      cylinder_data[i]      = NULL;
+    }
+
+  g_free (source_data);
+  source_data = NULL;
+}
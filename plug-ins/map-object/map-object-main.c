@@ -213,6 +213,7 @@ run (const gchar      *name,
   run_mode = param[0].data.d_int32;
 
   INIT_I18N ();
+  gegl_init (NULL, NULL);
 
   values[0].type = GIMP_PDB_STATUS;
   values[0].data.d_status = status;
@@ -320,6 +321,8 @@ run (const gchar      *name,
   if (run_mode != GIMP_RUN_NONINTERACTIVE)
     gimp_displays_flush ();
 
+  image_cleanup ();
+
   gimp_drawable_detach (drawable);
 }
 
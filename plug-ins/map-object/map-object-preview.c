@@ -4,6 +4,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <gtk/gtk.h>
 
 #include <libgimp/gimp.h>
@@ -17,9 +19,25 @@
 #include "map-object-preview.h"
 
 
+#define PREVIEW_COARSE_STEP 4   /* pixels per ray of the first pass    */
+#define PREVIEW_REFINE_ROWS 16  /* rows per idle call of the full pass */
+
+typedef struct
+{
+  gdouble xpostab[PREVIEW_WIDTH];
+  gdouble ypostab[PREVIEW_HEIGHT];
+  gint    pw, ph;
+  gint    step;
+  GimpRGB lightcheck, darkcheck;
+} PreviewRender;
+
 gdouble mat[3][4];
 gint    lightx, lighty;
 
+static PreviewRender preview_render;
+static guint         preview_refine_id  = 0;
+static gint          preview_refine_row = 0;
+
 /* Protos */
 /* ====== */
 
@@ -29,6 +47,8 @@ static void compute_preview         (gint x,
                                      gint h,
                                      gint pw,
                                      gint ph);
+static gboolean preview_refine_idle (gpointer      data);
+static void preview_set_cursor      (GdkCursorType type);
 static void draw_light_marker       (cairo_t *cr,
                                      gint xpos,
                                      gint ypos);
@@ -70,6 +90,119 @@ static void draw_wireframe_cylinder (cairo_t *cr,
                                      gint        pw,
                                      gint        ph);
 
+/* Renders one pixel of the preview */
+static void
+compute_preview_pixel (const PreviewRender *render,
+                       gint                 xcnt,
+                       gint                 ycnt,
+                       guchar              *dest)
+{
+  GimpVector3 p;
+  GimpRGB     color;
+  gint        f1, f2;
+  guchar      r, g, b;
+
+  p.x = render->xpostab[xcnt];
+  p.y = render->ypostab[ycnt];
+  p.z = 0.0;
+
+  color = (* get_ray_color) (&p);
+
+  if (color.a < 1.0)
+    {
+      f1 = ((xcnt % 32) < 16);
+      f2 = ((ycnt % 32) < 16);
+      f1 = f1 ^ f2;
+
+      if (f1)
+        {
+          if (color.a == 0.0)
+            color = render->lightcheck;
+          else
+            gimp_rgb_composite (&color, &render->lightcheck,
+                                GIMP_RGB_COMPOSITE_BEHIND);
+        }
+      else
+        {
+          if (color.a == 0.0)
+            color = render->darkcheck;
+          else
+            gimp_rgb_composite (&color, &render->darkcheck,
+                                GIMP_RGB_COMPOSITE_BEHIND);
+        }
+    }
+
+  gimp_rgb_get_uchar (&color, &r, &g, &b);
+  GIMP_CAIRO_RGB24_SET_PIXEL (dest, r, g, b);
+}
+
+/* Renders an area of the preview, with one ray for each block of
+ * step x step pixels
+ */
+static void
+compute_preview_area (const GimpParallelArea *area,
+                      gpointer                data)
+{
+  const PreviewRender *render = data;
+  gint                 xcnt, ycnt;
+
+  for (ycnt = area->roi.y; ycnt < area->roi.y + area->roi.height; ycnt++)
+    {
+      guchar *dest = area->dest + (ycnt - area->roi.y) * area->dest_rowstride;
+      gint    ay   = ycnt - ycnt % render->step;
+
+      for (xcnt = area->roi.x; xcnt < area->roi.x + area->roi.width; xcnt++)
+        {
+          gint ax = xcnt - xcnt % render->step;
+
+          if ((ax != xcnt || ay != ycnt) &&
+              ax >= area->roi.x && ay >= area->roi.y)
+            {
+              memcpy (dest,
+                      area->dest +
+                      (ay - area->roi.y) * area->dest_rowstride +
+                      (ax - area->roi.x) * 4,
+                      4);
+            }
+          else
+            {
+              compute_preview_pixel (render, xcnt, ycnt, dest);
+            }
+
+          dest += 4;
+        }
+    }
+}
+
+/* Renders the preview rows from y to y + h on all processors */
+static void
+compute_preview_rows (gint y,
+                      gint h)
+{
+  const Babl *format = babl_format ("cairo-RGB24");
+  GeglBuffer *buffer;
+
+  cairo_surface_flush (preview_surface);
+
+  buffer = gegl_buffer_linear_new_from_data (preview_rgb_data, format,
+                                             GEGL_RECTANGLE (0, 0,
+                                                             preview_render.pw,
+                                                             preview_render.ph),
+                                             preview_rgb_stride,
+                                             NULL, NULL);
+
+  gimp_parallel_process (NULL, NULL, buffer,
+                         GEGL_RECTANGLE (0, y, preview_render.pw, h), format,
+                         0, 0, GEGL_ABYSS_NONE,
+                         preview_render.pw, PREVIEW_COARSE_STEP,
+                         compute_preview_area, &preview_render,
+                         0.0, 0.0);
+
+  g_object_unref (buffer);
+
+  cairo_surface_mark_dirty (preview_surface);
+}
+
 /**************************************************************/
 /* Computes a preview of the rectangle starting at (x,y) with */
 /* dimensions (w,h), placing the result in preview_RGB_data.  */
@@ -83,16 +216,10 @@ compute_preview (gint x,
                  gint pw,
                  gint ph)
 {
-  gdouble      xpostab[PREVIEW_WIDTH];
-  gdouble      ypostab[PREVIEW_HEIGHT];
   gdouble      realw;
   gdouble      realh;
   GimpVector3  p1, p2;
-  GimpRGB      color;
-  GimpRGB      lightcheck, darkcheck;
-  gint         xcnt, ycnt, f1, f2;
-  guchar       r, g, b;
-  glong        index = 0;
+  gint         xcnt, ycnt;
 
   init_compute ();
 
@@ -106,10 +233,15 @@ compute_preview (gint x,
   realh = (p2.y - p1.y);
 
   for (xcnt = 0; xcnt < pw; xcnt++)
-    xpostab[xcnt] = p1.x + realw * ((gdouble) xcnt / (gdouble) pw);
+    preview_render.xpostab[xcnt] = (p1.x +
+                                    realw * ((gdouble) xcnt / (gdouble) pw));
 
   for (ycnt = 0; ycnt < ph; ycnt++)
-    ypostab[ycnt] = p1.y + realh * ((gdouble) ycnt / (gdouble) ph);
+    preview_render.ypostab[ycnt] = (p1.y +
+                                    realh * ((gdouble) ycnt / (gdouble) ph));
+
+  preview_render.pw = pw;
+  preview_render.ph = ph;
 
   /* Compute preview using the offset tables */
   /* ======================================= */
@@ -124,55 +256,54 @@ compute_preview (gint x,
       gimp_rgb_set_alpha (&background, 1.0);
     }
 
-  gimp_rgba_set (&lightcheck,
+  gimp_rgba_set (&preview_render.lightcheck,
                  GIMP_CHECK_LIGHT, GIMP_CHECK_LIGHT, GIMP_CHECK_LIGHT, 1.0);
-  gimp_rgba_set (&darkcheck,
+  gimp_rgba_set (&preview_render.darkcheck,
                  GIMP_CHECK_DARK, GIMP_CHECK_DARK, GIMP_CHECK_DARK, 1.0);
-  gimp_vector3_set (&p2, -1.0, -1.0, 0.0);
 
-  cairo_surface_flush (preview_surface);
+  /* A coarse pass right away, the full resolution rows are */
+  /* rendered a few at a time while the dialog is idle       */
+  /* ======================================================= */
 
-  for (ycnt = 0; ycnt < ph; ycnt++)
-    {
-      index = ycnt * preview_rgb_stride;
-      for (xcnt = 0; xcnt < pw; xcnt++)
-        {
-          p1.x = xpostab[xcnt];
-          p1.y = ypostab[ycnt];
+  preview_render.step = PREVIEW_COARSE_STEP;
 
-          p2 = p1;
-          color = (* get_ray_color) (&p1);
+  compute_preview_rows (0, ph);
 
-          if (color.a < 1.0)
-            {
-              f1 = ((xcnt % 32) < 16);
-              f2 = ((ycnt % 32) < 16);
-              f1 = f1 ^ f2;
-
-              if (f1)
-                {
-                  if (color.a == 0.0)
-                    color = lightcheck;
-                  else
-                    gimp_rgb_composite (&color, &lightcheck,
-                                        GIMP_RGB_COMPOSITE_BEHIND);
-                 }
-              else
-                {
-                  if (color.a == 0.0)
-                    color = darkcheck;
-                  else
-                    gimp_rgb_composite (&color, &darkcheck,
-                                        GIMP_RGB_COMPOSITE_BEHIND);
-                }
-            }
+  preview_render.step = 1;
+  preview_refine_row  = 0;
+  preview_refine_id   = g_idle_add (preview_refine_idle, NULL);
+}
 
-          gimp_rgb_get_uchar (&color, &r, &g, &b);
-          GIMP_CAIRO_RGB24_SET_PIXEL((preview_rgb_data + index), r, g, b);
-          index += 4;
-        }
-    }
-  cairo_surface_mark_dirty (preview_surface);
+static gboolean
+preview_refine_idle (gpointer data)
+{
+  gint h = MIN (PREVIEW_REFINE_ROWS, preview_render.ph - preview_refine_row);
+
+  compute_preview_rows (preview_refine_row, h);
+
+  preview_refine_row += h;
+
+  gtk_widget_queue_draw (previewarea);
+
+  if (preview_refine_row < preview_render.ph)
+    return TRUE;
+
+  preview_refine_id = 0;
+
+  preview_set_cursor (GDK_HAND2);
+
+  return FALSE;
+}
+
+static void
+preview_set_cursor (GdkCursorType type)
+{
+  GdkDisplay *display = gtk_widget_get_display (previewarea);
+  GdkCursor  *cursor;
+
+  cursor = gdk_cursor_new_for_display (display, type);
+  gdk_window_set_cursor (gtk_widget_get_window (previewarea), cursor);
+  gdk_cursor_unref (cursor);
 }
 
 /*************************************************/
@@ -280,22 +411,32 @@ update_light (gint xpos,
 void
 compute_preview_image (void)
 {
-  GdkDisplay *display = gtk_widget_get_display (previewarea);
-  GdkCursor  *cursor;
-  gint        pw, ph;
+  gint pw, ph;
+
+  preview_cancel ();
 
   pw = PREVIEW_WIDTH * mapvals.zoom;
   ph = PREVIEW_HEIGHT * mapvals.zoom;
 
-  cursor = gdk_cursor_new_for_display (display, GDK_WATCH);
-  gdk_window_set_cursor (gtk_widget_get_window (previewarea), cursor);
-  gdk_cursor_unref (cursor);
+  preview_set_cursor (GDK_WATCH);
 
   compute_preview (0, 0, width - 1, height - 1, pw, ph);
+}
 
-  cursor = gdk_cursor_new_for_display (display, GDK_HAND2);
-  gdk_window_set_cursor(gtk_widget_get_window (previewarea), cursor);
-  gdk_cursor_unref (cursor);
+/***************************************************/
+/* Stop rendering the preview at full resolution.  */
+/***************************************************/
+
+void
+preview_cancel (void)
+{
+  if (preview_refine_id)
+    {
+      g_source_remove (preview_refine_id);
+      preview_refine_id = 0;
+
+      preview_set_cursor (GDK_HAND2);
+    }
 }
 
 gboolean
@@ -16,6 +16,7 @@ extern gint       lightx,lighty;
 /* ============================ */
 
 void     compute_preview_image  (void);
+void     preview_cancel         (void);
 gboolean preview_expose         (GtkWidget      *widget,
                                  GdkEventExpose *eevent);
 gint     check_light_hit        (gint            xpos,
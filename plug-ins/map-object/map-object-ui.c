@@ -79,6 +79,9 @@ double_adjustment_update (GtkAdjustment *adjustment,
 {
   gimp_double_adjustment_update (adjustment, data);
 
+  /* the settings changed, the preview being rendered is outdated */
+  preview_cancel ();
+
   if (mapvals.livepreview)
     compute_preview_image ();
 
@@ -145,6 +148,8 @@ lightmenu_callback (GtkWidget *widget,
 
   mapvals.lightsource.type = active;
 
+  preview_cancel ();
+
   if (mapvals.lightsource.type == POINT_LIGHT)
     {
       gtk_widget_hide (dirlightwid);
@@ -183,6 +188,8 @@ mapmenu_callback (GtkWidget *widget,
 
   mapvals.maptype = active;
 
+  preview_cancel ();
+
   if (mapvals.livepreview)
     {
       compute_preview_image ();
@@ -1410,6 +1417,8 @@ main_dialog (GimpDrawable *drawable)
   if (gimp_dialog_run (GIMP_DIALOG (appwin)) == GTK_RESPONSE_OK)
     run = TRUE;
 
+  preview_cancel ();
+
   gtk_widget_destroy (appwin);
   if (preview_rgb_data)
     g_free (preview_rgb_data);